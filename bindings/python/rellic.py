@@ -0,0 +1,174 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2021-present, Trail of Bits, Inc.
+# All rights reserved.
+#
+# This source code is licensed in accordance with the terms specified in
+# the LICENSE file found in the root directory of this source tree.
+#
+
+"""Python binding of the C interface of the decompiler, include/rellic/rellic.h
+
+The shared library is looked up in the RELLIC_LIBRARY environment variable,
+then next to this file, then in the default library search path.
+
+Calls into the library go through ctypes.CDLL, which releases the GIL for
+their whole duration, so decompilations run in parallel on the threads of a
+single Python process:
+
+    with concurrent.futures.ThreadPoolExecutor() as pool:
+        results = pool.map(rellic.decompile_file, paths)
+"""
+
+import ctypes
+import ctypes.util
+import json
+import os
+import sys
+
+API_VERSION = 1
+
+
+class RellicError(Exception):
+    pass
+
+
+def _find_library():
+    path = os.environ.get("RELLIC_LIBRARY")
+    if path:
+        return path
+    here = os.path.dirname(os.path.abspath(__file__))
+    for name in ["librellic-c.so", "librellic-c.dylib"]:
+        path = os.path.join(here, name)
+        if os.path.exists(path):
+            return path
+    path = ctypes.util.find_library("rellic-c")
+    if path:
+        return path
+    raise RellicError("Cannot find librellic-c, set RELLIC_LIBRARY to its path")
+
+
+_lib = None
+
+
+def _load():
+    global _lib
+    if _lib is not None:
+        return _lib
+    lib = ctypes.CDLL(_find_library())
+    lib.rellic_api_version.restype = ctypes.c_int
+    lib.rellic_api_version.argtypes = []
+    lib.rellic_version.restype = ctypes.c_char_p
+    lib.rellic_version.argtypes = []
+    lib.rellic_set_min_log_level.restype = None
+    lib.rellic_set_min_log_level.argtypes = [ctypes.c_int]
+    lib.rellic_decompile.restype = ctypes.c_void_p
+    lib.rellic_decompile.argtypes = [ctypes.c_char_p, ctypes.c_size_t,
+                                     ctypes.c_char_p]
+    lib.rellic_result_free.restype = None
+    lib.rellic_result_free.argtypes = [ctypes.c_void_p]
+    lib.rellic_result_succeeded.restype = ctypes.c_int
+    lib.rellic_result_succeeded.argtypes = [ctypes.c_void_p]
+    for name in ["code", "provenance", "stats", "degraded_functions", "error"]:
+        fn = getattr(lib, "rellic_result_" + name)
+        fn.restype = ctypes.c_void_p
+        fn.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_size_t)]
+    if lib.rellic_api_version() < API_VERSION:
+        raise RellicError("librellic-c is too old: API version %d, expected %d"
+                          % (lib.rellic_api_version(), API_VERSION))
+    _lib = lib
+    return lib
+
+
+def _get_string(lib, result, name):
+    size = ctypes.c_size_t()
+    ptr = getattr(lib, "rellic_result_" + name)(result, ctypes.byref(size))
+    return ctypes.string_at(ptr, size.value).decode("utf-8", "replace")
+
+
+class Result:
+    """Output of a successful decompilation"""
+
+    def __init__(self, code, provenance, stats, degraded_functions):
+        # The C source
+        self.code = code
+        # The provenance of the ranges of `code`, if requested, in the format
+        # of `rellic-decomp --provenance`
+        self.provenance = provenance
+        # The statistics of the decompilation, as in `rellic-decomp --stats`
+        self.stats = stats
+        # The functions that were not fully refined
+        self.degraded_functions = degraded_functions
+
+
+def version():
+    return _load().rellic_version().decode()
+
+
+def set_min_log_level(level):
+    """Hides log messages below `level`: 0 INFO, 1 WARNING, 2 ERROR"""
+    _load().rellic_set_min_log_level(level)
+
+
+def decompile(bitcode, **options):
+    """Decompiles the module in `bitcode`, a bytes object.
+
+    `options` are the fields of `rellic::DecompilationOptions`, e.g.
+    `num_workers=4` or `functions=["main"]`, plus `provenance`,
+    `hex_literals` and `alpha_cache`. Raises RellicError if the
+    decompilation fails.
+    """
+    lib = _load()
+    result = lib.rellic_decompile(bitcode, len(bitcode),
+                                  json.dumps(options).encode())
+    try:
+        if not lib.rellic_result_succeeded(result):
+            raise RellicError(_get_string(lib, result, "error"))
+        provenance = _get_string(lib, result, "provenance")
+        return Result(
+            _get_string(lib, result, "code"),
+            json.loads(provenance) if provenance else None,
+            json.loads(_get_string(lib, result, "stats")),
+            json.loads(_get_string(lib, result, "degraded_functions")),
+        )
+    finally:
+        lib.rellic_result_free(result)
+
+
+def decompile_file(path, **options):
+    """Decompiles the bitcode file at `path`, see `decompile`"""
+    with open(path, "rb") as f:
+        return decompile(f.read(), **options)
+
+
+if __name__ == "__main__":
+    import argparse
+
+    parser = argparse.ArgumentParser(description="Decompiles bitcode files")
+    parser.add_argument("inputs", nargs="+", help="bitcode files")
+    parser.add_argument("--options", default="{}",
+                        help="decompilation options as a JSON object")
+    parser.add_argument("-j", "--jobs", type=int, default=os.cpu_count(),
+                        help="number of files decompiled at the same time")
+    args = parser.parse_args()
+
+    import concurrent.futures
+
+    set_min_log_level(1)
+    options = json.loads(args.options)
+    failures = 0
+    with concurrent.futures.ThreadPoolExecutor(args.jobs) as pool:
+        futures = {pool.submit(decompile_file, path, **options): path
+                   for path in args.inputs}
+        for future in concurrent.futures.as_completed(futures):
+            path = futures[future]
+            try:
+                result = future.result()
+            except RellicError as e:
+                print("FAIL %s: %s" % (path, e), file=sys.stderr)
+                failures += 1
+                continue
+            with open(os.path.splitext(path)[0] + ".c", "w") as f:
+                f.write(result.code)
+            print("ok   %s" % path)
+    sys.exit(1 if failures else 0)
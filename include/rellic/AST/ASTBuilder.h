@@ -12,6 +12,7 @@
 #include <clang/Frontend/ASTUnit.h>
 
 #include <string>
+#include <vector>
 
 namespace clang {
 class Sema;
@@ -24,9 +25,31 @@ class ASTBuilder {
   clang::ASTUnit &unit;
   clang::ASTContext &ctx;
   clang::Sema &sema;
+  // Whether expressions whose operands need no implicit conversion are built
+  // directly instead of through `sema`, see `SetFastPath`
+  bool fast_path{true};
+
+  // Build the same nodes that `sema` would, or return null if the operands
+  // need more than an lvalue-to-rvalue conversion
+  clang::CStyleCastExpr *CreateCStyleCastFast(clang::QualType type,
+                                              clang::Expr *expr);
+  clang::UnaryOperator *CreateUnaryOpFast(clang::UnaryOperatorKind opc,
+                                          clang::Expr *expr);
+  clang::BinaryOperator *CreateBinaryOpFast(clang::BinaryOperatorKind opc,
+                                            clang::Expr *lhs,
+                                            clang::Expr *rhs);
+  clang::CallExpr *CreateCallFast(clang::Expr *callee,
+                                  std::vector<clang::Expr *> &args);
+  clang::Expr *CreateRValue(clang::Expr *expr);
 
  public:
   ASTBuilder(clang::ASTUnit &unit);
+  // Declaration references, casts, unary and binary operators, calls and
+  // field accesses are built without semantic checks when their operands are
+  // already well-typed, and only go through `clang::Sema` when it has to
+  // insert implicit conversions. The nodes are the same either way; turning
+  // this off is only useful to compare the two.
+  void SetFastPath(bool enabled) { fast_path = enabled; }
   // Type helpers
   clang::QualType GetLeastIntTypeForBitWidth(unsigned size, unsigned sign);
   clang::QualType GetLeastRealTypeForBitWidth(unsigned size);
@@ -48,6 +71,10 @@ class ASTBuilder {
   clang::CharacterLiteral *CreateCharLit(llvm::APInt val);
   clang::CharacterLiteral *CreateCharLit(unsigned val);
   clang::StringLiteral *CreateStrLit(std::string val);
+  // `data` holds the code units of the literal in host byte order. They must
+  // be 16 or 32 bits wide, like `char_type`.
+  clang::StringLiteral *CreateWideStrLit(clang::QualType char_type,
+                                         llvm::StringRef data);
   clang::Expr *CreateFPLit(llvm::APFloat val);
   // Special values
   clang::Expr *CreateNull();
@@ -297,6 +324,13 @@ class ASTBuilder {
   clang::DoStmt *CreateDo(clang::Expr *cond, clang::Stmt *body);
   // Break
   clang::BreakStmt *CreateBreak();
+  // Label declaration, the statement that places it before `body`, and a
+  // jump to it
+  clang::LabelDecl *CreateLabelDecl(clang::DeclContext *decl_ctx,
+                                    std::string name);
+  clang::LabelStmt *CreateLabelStmt(clang::LabelDecl *label,
+                                    clang::Stmt *body);
+  clang::GotoStmt *CreateGoto(clang::LabelDecl *label);
   // Return
   clang::ReturnStmt *CreateReturn(clang::Expr *retval = nullptr);
   // Typedef declaration
@@ -9,14 +9,26 @@
 #pragma once
 #include <clang/AST/ASTContext.h>
 #include <clang/Frontend/ASTUnit.h>
+#include <llvm/Support/TimeProfiler.h>
 #include <rellic/AST/ASTBuilder.h>
+#include <rellic/AST/PassProfile.h>
+#include <rellic/AST/Statistics.h>
 #include <rellic/AST/Util.h>
+#include <rellic/Activity.h>
 
+#include <algorithm>
 #include <atomic>
 #include <memory>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 namespace rellic {
 
+using FunctionSet = std::unordered_set<clang::FunctionDecl*>;
+
 class ASTPass {
   std::atomic_bool stop{false};
 
@@ -25,47 +37,371 @@ class ASTPass {
 
   bool changed{false};
 
+  // Functions the pass should visit, or nullptr for all of them. Passes that
+  // work one function at a time should skip the ones outside of the scope, and
+  // report the ones they change through `MarkModified`.
+  const FunctionSet* scope{nullptr};
+  // Functions changed by the last run
+  FunctionSet modified;
+  // Whether the last run made changes that could not be attributed to a
+  // function
+  bool untracked{false};
+
+  bool InScope(clang::FunctionDecl* fdecl) const {
+    return !scope || scope->count(fdecl);
+  }
+
+  // Definitions of the functions in scope, in the order of the translation
+  // unit. Passes only rewrite function bodies, so they go through these
+  // instead of every type and global variable in the translation unit.
+  std::vector<clang::FunctionDecl*> GetFunctionsInScope() const {
+    std::vector<clang::FunctionDecl*> result;
+    for (auto decl : dec_ctx.ast_ctx.getTranslationUnitDecl()->decls()) {
+      auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+      if (fdecl && fdecl->doesThisDeclarationHaveABody() && InScope(fdecl)) {
+        result.push_back(fdecl);
+      }
+    }
+    return result;
+  }
+
+  void MarkModified(clang::FunctionDecl* fdecl) {
+    modified.insert(fdecl);
+    changed = true;
+  }
+
   virtual void RunImpl() = 0;
   virtual void StopImpl() {}
 
+  // Collects timing information for named passes
+  PassStatistics* GetStatistics() {
+    auto name{GetName()};
+    return name ? &dec_ctx.stats.passes[name] : nullptr;
+  }
+
  public:
   ASTPass(DecompilationContext& dec_ctx)
       : dec_ctx(dec_ctx) {}
   virtual ~ASTPass() = default;
+  // Also cancels the work done on the context, so that passes and Z3 queries
+  // that run outside of this pass stop as well
   void Stop() {
     stop = true;
+    if (dec_ctx.progress) {
+      dec_ctx.progress->Cancel();
+    }
     StopImpl();
   }
 
+  // Name under which statistics about the pass are recorded. Passes that
+  // return nullptr are not recorded.
+  virtual const char* GetName() const { return nullptr; }
+
+  // Kinds of changes a pass can make to a function
+  enum Effect : unsigned {
+    // Statements are added, removed or replaced
+    kStatements = 1u << 0,
+    // Conditions are created or rewritten
+    kConditions = 1u << 1,
+    kAllEffects = kStatements | kConditions,
+  };
+  // The changes this pass may make, and the changes made by other passes that
+  // may give it something new to do in a function it left unchanged. Adaptive
+  // fixpoints rely on these to skip passes, so they must not leave anything
+  // out.
+  virtual unsigned GetEffects() const { return kAllEffects; }
+  virtual unsigned GetTriggers() const { return kAllEffects; }
+  // Whether the functions changed by the pass are reported by `GetModified`.
+  // Otherwise the pass is assumed to change every function that it is run on
+  // and that one of its triggers changed since its last run.
+  virtual bool TracksFunctions() const { return true; }
+  // Whether the pass marks the statements it changes, along with the ones
+  // above them, in `dec_ctx.subtree_changes`. Otherwise every function it
+  // changes is marked as a whole.
+  virtual bool TracksStatements() const { return false; }
+
+  void SetScope(const FunctionSet* functions) { scope = functions; }
+  const FunctionSet& GetModified() const { return modified; }
+  bool HasUntrackedChanges() const { return untracked; }
+
   bool Run() {
+    auto stats{GetStatistics()};
+    Duration elapsed{0};
+    HardwareCounters counters;
     changed = false;
+    modified.clear();
+    untracked = false;
     stop = false;
-    RunImpl();
+    {
+      std::optional<llvm::TimeTraceScope> trace;
+      std::optional<ActivityScope> activity;
+      auto outer_pass{dec_ctx.current_pass};
+      if (auto name = GetName()) {
+        trace.emplace(name);
+        activity.emplace("pass", name);
+        SetStage(name);
+      }
+      ScopedTimer timer(elapsed);
+      ScopedCounters scoped_counters(counters);
+      RunProfiled();
+      SetStage(outer_pass);
+    }
+    untracked |= changed && modified.empty();
+    MarkSubtreeChanges();
+    if (stats) {
+      stats->wall_time += elapsed;
+      stats->counters.Merge(counters);
+      ++stats->runs;
+      stats->changes += changed;
+    }
     return changed;
   }
 
+  // Runs the pass until it stops changing the AST. After the first iteration,
+  // only the functions that were changed by the previous one are visited,
+  // unless a change could not be attributed to any function. Stops early once
+  // a soft memory limit has been exceeded or the work has been cancelled.
   unsigned Fixpoint() {
+    auto stats{GetStatistics()};
+    Duration elapsed{0};
+    HardwareCounters counters;
     unsigned iter_count{0};
+    auto outer_scope{scope};
+    FunctionSet all_modified;
+    FunctionSet dirty;
+    auto any_untracked{false};
     changed = false;
-    auto DoIter = [this]() {
+    auto DoIter = [this, stats, outer_scope, &all_modified, &dirty,
+                   &any_untracked, &iter_count]() {
+      std::optional<llvm::TimeTraceScope> trace;
+      std::optional<ActivityScope> activity;
+      auto outer_pass{dec_ctx.current_pass};
+      if (auto name = GetName()) {
+        trace.emplace(name);
+        activity.emplace("pass", name);
+        SetActivityDetail("iteration " + std::to_string(iter_count + 1));
+        SetStage(name);
+      }
+      if (auto progress = dec_ctx.progress) {
+        progress->iteration = iter_count + 1;
+        progress->Update();
+      }
       changed = false;
-      RunImpl();
+      modified.clear();
+      untracked = false;
+      RunProfiled();
+      SetStage(outer_pass);
+      untracked |= changed && modified.empty();
+      MarkSubtreeChanges();
+      if (stats) {
+        ++stats->runs;
+        stats->changes += changed;
+      }
+      all_modified.insert(modified.begin(), modified.end());
+      any_untracked |= untracked;
+      if (untracked) {
+        scope = outer_scope;
+      } else if (changed) {
+        dirty = std::move(modified);
+        scope = &dirty;
+      }
       return changed;
     };
     stop = false;
-    while (DoIter()) {
-      ++iter_count;
+    {
+      ScopedTimer timer(elapsed);
+      ScopedCounters scoped_counters(counters);
+      while (DoIter()) {
+        ++iter_count;
+        if (dec_ctx.OverSoftLimit(GetName()) || dec_ctx.Cancelled()) {
+          break;
+        }
+      }
+    }
+    scope = outer_scope;
+    modified = std::move(all_modified);
+    untracked = any_untracked;
+    changed = iter_count > 0;
+    if (stats) {
+      stats->wall_time += elapsed;
+      stats->counters.Merge(counters);
+      ++stats->fixpoints;
     }
 
     return iter_count;
   }
 
-  bool Stopped() { return stop; }
+  bool Stopped() { return stop || dec_ctx.Cancelled(); }
+
+ private:
+  // Runs `RunImpl` without the functions in scope whose shape the pass never
+  // changes according to `dec_ctx.pass_profile`, and records which of the
+  // others it changed into `dec_ctx.recorded_profile`
+  void RunProfiled() {
+    ++dec_ctx.subtree_changes.clock;
+    auto name{GetName()};
+    if (!name || (!dec_ctx.pass_profile && !dec_ctx.recorded_profile)) {
+      RunImpl();
+      return;
+    }
+    auto& shapes{dec_ctx.function_shapes};
+    auto outer_scope{scope};
+    auto functions{GetFunctionsInScope()};
+    FunctionSet profiled;
+    if (auto profile = dec_ctx.pass_profile) {
+      auto end{std::remove_if(
+          functions.begin(), functions.end(),
+          [profile, name, &shapes](clang::FunctionDecl* fdecl) {
+            auto shape{shapes.find(fdecl)};
+            return shape != shapes.end() &&
+                   profile->IsUseless(shape->second, name);
+          })};
+      if (end != functions.end()) {
+        dec_ctx.stats.passes[name].profile_skipped_functions +=
+            functions.end() - end;
+        functions.erase(end, functions.end());
+        if (functions.empty()) {
+          return;
+        }
+        profiled.insert(functions.begin(), functions.end());
+        scope = &profiled;
+      }
+    }
+
+    Duration elapsed{0};
+    {
+      ScopedTimer timer(elapsed);
+      RunImpl();
+    }
+    scope = outer_scope;
+    if (!dec_ctx.recorded_profile || functions.empty()) {
+      return;
+    }
+    // Changes that are not attributed to a function may be in any of them
+    auto changed_all{changed && (modified.empty() || !TracksFunctions())};
+    auto share{elapsed / functions.size()};
+    for (auto fdecl : functions) {
+      auto shape{shapes.find(fdecl)};
+      if (shape != shapes.end()) {
+        dec_ctx.recorded_profile->Record(
+            shape->second, name, changed_all || modified.count(fdecl), share);
+      }
+    }
+  }
+
+  // Marks the functions changed by the last run, unless the pass marked the
+  // statements it changed itself
+  void MarkSubtreeChanges() {
+    if (!changed || TracksStatements()) {
+      return;
+    }
+    auto& changes{dec_ctx.subtree_changes};
+    if (untracked || !TracksFunctions()) {
+      changes.all = changes.clock;
+      return;
+    }
+    for (auto fdecl : modified) {
+      changes.Mark(fdecl);
+    }
+  }
+
+  void SetStage(const char* name) {
+    dec_ctx.current_pass = name;
+    if (dec_ctx.progress) {
+      dec_ctx.progress->stage = name;
+    }
+  }
 };
 
+/*
+ * Runs a sequence of passes. In adaptive mode, the passes remember when they
+ * last ran on every function, and are not run again on a function that they
+ * left unchanged until a pass that may trigger them changes it.
+ */
 class CompositeASTPass : public ASTPass {
   std::vector<std::unique_ptr<ASTPass>> passes;
 
+  struct PassSchedule {
+    // When the pass last ran on a function, and last changed it
+    std::unordered_map<clang::FunctionDecl*, unsigned> ran;
+    std::unordered_map<clang::FunctionDecl*, unsigned> changed;
+    // When the pass last made changes that it could not attribute to a
+    // function
+    unsigned changed_all{0};
+  };
+  bool adaptive{false};
+  // Advanced by every pass that runs, 0 is never
+  unsigned clock{0};
+  std::vector<PassSchedule> schedule;
+
+  // Whether `passes[idx]` can be skipped on `fdecl`
+  bool IsQuiet(size_t idx, clang::FunctionDecl* fdecl) const {
+    auto& mine{schedule[idx]};
+    auto ran{mine.ran.find(fdecl)};
+    if (ran == mine.ran.end()) {
+      return false;
+    }
+    auto triggers{passes[idx]->GetTriggers()};
+    for (size_t i{0}; i < passes.size(); ++i) {
+      if (i != idx && !(passes[i]->GetEffects() & triggers)) {
+        continue;
+      }
+      auto& other{schedule[i]};
+      auto changed{other.changed.find(fdecl)};
+      if (other.changed_all >= ran->second ||
+          (changed != other.changed.end() && changed->second >= ran->second)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Runs `passes[idx]` on the functions of `functions` that it may change
+  void RunAdaptive(size_t idx,
+                   const std::vector<clang::FunctionDecl*>& functions) {
+    auto& pass{passes[idx]};
+    auto& mine{schedule[idx]};
+    FunctionSet active;
+    unsigned skipped{0};
+    for (auto fdecl : functions) {
+      if (IsQuiet(idx, fdecl)) {
+        ++skipped;
+      } else {
+        active.insert(fdecl);
+      }
+    }
+    if (auto name = pass->GetName()) {
+      dec_ctx.stats.passes[name].skipped_functions += skipped;
+    }
+    if (active.empty()) {
+      return;
+    }
+
+    auto now{++clock};
+    pass->SetScope(&active);
+    changed |= pass->Run();
+    if (pass->TracksFunctions()) {
+      for (auto fdecl : pass->GetModified()) {
+        mine.changed[fdecl] = now;
+      }
+      if (pass->HasUntrackedChanges()) {
+        mine.changed_all = now;
+      }
+    } else {
+      for (auto fdecl : active) {
+        mine.changed[fdecl] = now;
+      }
+    }
+    // The functions that were skipped would have been left unchanged, and
+    // passes that do not track functions may have ignored the scope anyway
+    for (auto fdecl : functions) {
+      mine.ran[fdecl] = now;
+    }
+    auto& pass_modified{pass->GetModified()};
+    modified.insert(pass_modified.begin(), pass_modified.end());
+    untracked |= pass->HasUntrackedChanges();
+  }
+
  protected:
   void StopImpl() override {
     for (auto& pass : passes) {
@@ -74,11 +410,24 @@ class CompositeASTPass : public ASTPass {
   }
 
   void RunImpl() override {
+    llvm::TimeTraceScope trace("CompositeASTPass");
+    if (adaptive) {
+      schedule.resize(passes.size());
+      auto functions{GetFunctionsInScope()};
+      for (size_t i{0}; i < passes.size() && !Stopped(); ++i) {
+        RunAdaptive(i, functions);
+      }
+      return;
+    }
     for (auto& pass : passes) {
       if (Stopped()) {
         break;
       }
+      pass->SetScope(scope);
       changed |= pass->Run();
+      auto& pass_modified{pass->GetModified()};
+      modified.insert(pass_modified.begin(), pass_modified.end());
+      untracked |= pass->HasUntrackedChanges();
     }
   }
 
@@ -86,5 +435,80 @@ class CompositeASTPass : public ASTPass {
   CompositeASTPass(DecompilationContext& dec_ctx)
       : ASTPass(dec_ctx) {}
   std::vector<std::unique_ptr<ASTPass>>& GetPasses() { return passes; }
+
+  unsigned GetEffects() const override {
+    unsigned effects{0};
+    for (auto& pass : passes) {
+      effects |= pass->GetEffects();
+    }
+    return effects;
+  }
+  unsigned GetTriggers() const override {
+    unsigned triggers{0};
+    for (auto& pass : passes) {
+      triggers |= pass->GetTriggers();
+    }
+    return triggers;
+  }
+  bool TracksFunctions() const override {
+    return std::all_of(passes.begin(), passes.end(), [](auto& pass) {
+      return pass->TracksFunctions();
+    });
+  }
+  // The passes mark their own changes
+  bool TracksStatements() const override { return true; }
+
+  // Enables or disables adaptive mode, and forgets what the passes did so far.
+  // Only meant for runs of the passes where nothing else changes the AST in
+  // between, such as the iterations of a fixpoint.
+  void ResetSchedule(bool adaptive_mode) {
+    adaptive = adaptive_mode;
+    clock = 0;
+    schedule.clear();
+  }
+};
+
+// Runs a sequence of passes to a fixpoint every time it is run
+class FixpointASTPass : public ASTPass {
+  CompositeASTPass comp;
+  // Name of the group in `DecompilationStatistics::fixpoint_groups`
+  std::string description;
+
+ protected:
+  void StopImpl() override { comp.Stop(); }
+
+  void RunImpl() override {
+    comp.SetScope(scope);
+    comp.ResetSchedule(dec_ctx.adaptive_passes);
+    Duration elapsed{0};
+    unsigned rounds{0};
+    {
+      ScopedTimer timer(elapsed);
+      rounds = comp.Fixpoint();
+    }
+    if (!description.empty()) {
+      auto& stats{dec_ctx.stats.fixpoint_groups[description]};
+      stats.wall_time += elapsed;
+      ++stats.runs;
+      stats.rounds += rounds;
+      stats.max_rounds = std::max(stats.max_rounds, rounds);
+    }
+    changed = rounds > 0;
+    modified = comp.GetModified();
+    untracked = comp.HasUntrackedChanges();
+  }
+
+ public:
+  FixpointASTPass(DecompilationContext& dec_ctx)
+      : ASTPass(dec_ctx), comp(dec_ctx) {}
+  std::vector<std::unique_ptr<ASTPass>>& GetPasses() {
+    return comp.GetPasses();
+  }
+  void SetDescription(std::string desc) { description = std::move(desc); }
+
+  unsigned GetEffects() const override { return comp.GetEffects(); }
+  unsigned GetTriggers() const override { return comp.GetTriggers(); }
+  bool TracksFunctions() const override { return comp.TracksFunctions(); }
+  bool TracksStatements() const override { return true; }
 };
 }  // namespace rellic
\ No newline at end of file
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <clang/Frontend/ASTUnit.h>
+#include <clang/Frontend/CompilerInvocation.h>
+#include <clang/Serialization/PCHContainerOperations.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace rellic {
+
+/*
+ * Creates the empty ASTUnits that decompiled code is generated into.
+ *
+ * Building an ASTUnit from scratch goes through the clang driver to turn a
+ * command line into a `CompilerInvocation`. The invocation only depends on the
+ * target triple, so it is computed once per triple and copied for every new
+ * unit. Safe to use from multiple threads.
+ */
+class ASTUnitFactory {
+  std::mutex mutex;
+  std::unordered_map<std::string, std::shared_ptr<clang::CompilerInvocation>>
+      invocations;
+  std::shared_ptr<clang::PCHContainerOperations> pch_ops;
+
+  std::shared_ptr<clang::CompilerInvocation> GetInvocation(
+      const std::string &triple);
+
+ public:
+  ASTUnitFactory();
+
+  // Command line used for the translation units of `triple`
+  static std::vector<std::string> GetArgs(const std::string &triple);
+
+  // Instance shared by the whole process
+  static ASTUnitFactory &Get();
+
+  std::unique_ptr<clang::ASTUnit> Create(const std::string &triple);
+};
+
+}  // namespace rellic
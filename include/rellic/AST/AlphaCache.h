@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <z3++.h>
+
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+
+namespace rellic {
+
+/*
+ * Results of `Prove` and `HeavySimplify` shared between the functions of one
+ * or more modules, keyed by formulas up to the names of their variables.
+ * Inlined helpers, macros and template instantiations give many functions
+ * reaching conditions that only differ by the names of their branch
+ * variables, which are then only solved once.
+ *
+ * Formulas are looked up by their canonical form, in which every constant is
+ * renamed after the order in which it is first met. Entries are kept in a Z3
+ * context of the cache's own, so that the contexts of different functions and
+ * modules can share them. Only decided answers are stored: queries that timed
+ * out or were interrupted are asked again.
+ *
+ * Safe to use from several threads at once, as long as each context it is
+ * given is only used by one of them.
+ */
+class AlphaCache {
+ public:
+  // A formula in canonical form, along with the constants that were renamed,
+  // in order. Both are in the context of the original formula.
+  struct Key {
+    z3::expr expr;
+    z3::expr_vector vars;
+  };
+
+  static Key Canonicalize(z3::expr expr);
+
+  std::optional<bool> GetProof(const Key &key);
+  void SetProof(const Key &key, bool valid);
+  // Simplified forms are stored and returned in terms of the variables of
+  // `key`. Results that refer to other constants are not stored.
+  std::optional<z3::expr> GetSimplified(const Key &key);
+  void SetSimplified(const Key &key, z3::expr simplified);
+
+  std::atomic<size_t> hits{0};
+  std::atomic<size_t> misses{0};
+
+ private:
+  // Returns the index in `exprs` of `expr`, translated into `ctx`
+  unsigned Intern(z3::expr expr);
+
+  std::mutex mutex;
+  z3::context ctx;
+  // Keys and results, kept alive so that their ids are not recycled
+  z3::expr_vector exprs{ctx};
+  std::unordered_map<unsigned, unsigned> ids;
+  std::unordered_map<unsigned, bool> proofs;
+  // Maps the index of a key to the index of its simplified form
+  std::unordered_map<unsigned, unsigned> simplified;
+};
+
+}  // namespace rellic
@@ -0,0 +1,81 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace rellic {
+
+/*
+ * Reduced ordered binary decision diagrams. Nodes are hash-consed, so two
+ * formulas built in the same manager are equivalent if and only if they are
+ * the same node. Variables are ordered by their index.
+ */
+class BDD {
+ public:
+  using Node = unsigned;
+  static constexpr Node False = 0;
+  static constexpr Node True = 1;
+
+ private:
+  // Either a node, as variable and children, or the operands of `Ite`
+  struct Triple {
+    unsigned a, b, c;
+
+    bool operator==(const Triple &other) const {
+      return a == other.a && b == other.b && c == other.c;
+    }
+  };
+
+  struct TripleHash {
+    size_t operator()(const Triple &t) const {
+      uint64_t h{t.a};
+      h = h * 0x9E3779B97F4A7C15ULL + t.b;
+      h = h * 0x9E3779B97F4A7C15ULL + t.c;
+      return static_cast<size_t>(h ^ (h >> 32));
+    }
+  };
+
+  std::vector<Triple> nodes;
+  std::unordered_map<Triple, Node, TripleHash> unique;
+  std::unordered_map<Triple, Node, TripleHash> ite_cache;
+  size_t max_nodes;
+  bool overflowed{false};
+
+  unsigned TopVar(Node node) const;
+  Node Cofactor(Node node, unsigned var, bool value) const;
+  Node MakeNode(unsigned var, Node lo, Node hi);
+
+ public:
+  // Once more than `max_nodes` nodes exist, operations stop creating new ones
+  // and `Overflowed` becomes true
+  BDD(size_t max_nodes = 1 << 20);
+
+  Node Var(unsigned var);
+  // If-then-else, the operation every other one is expressed with
+  Node Ite(Node f, Node g, Node h);
+  Node Not(Node f) { return Ite(f, False, True); }
+  Node And(Node f, Node g) { return Ite(f, g, False); }
+  Node Or(Node f, Node g) { return Ite(f, True, g); }
+  Node Xor(Node f, Node g) { return Ite(f, Not(g), g); }
+  Node Iff(Node f, Node g) { return Ite(f, g, Not(g)); }
+
+  // Returns true if a result could not be computed within the node limit since
+  // the last call to `Clear`. Results computed while overflowed are
+  // meaningless.
+  bool Overflowed() const { return overflowed; }
+  // Removes every node except the constants
+  void Clear();
+  size_t Size() const { return nodes.size(); }
+};
+
+}  // namespace rellic
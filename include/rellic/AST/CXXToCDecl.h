@@ -12,7 +12,10 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <mutex>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
 
 #include "rellic/AST/ASTBuilder.h"
 
@@ -22,6 +25,20 @@ class ASTUnit;
 
 namespace rellic {
 
+// Mangled names of the C++ records whose members have been lowered, shared by
+// the visitors of several translation units, e.g. all the sources of a
+// codebase, which may run on different threads. Records that another
+// translation unit lowered first are only declared, since their definition
+// and methods are in its output.
+class LoweredRecords {
+  std::mutex mutex;
+  std::unordered_set<std::string> names;
+
+ public:
+  // Returns whether `name` had not been claimed yet, and claims it
+  bool Claim(const std::string &name);
+};
+
 class CXXToCDeclVisitor : public clang::RecursiveASTVisitor<CXXToCDeclVisitor> {
  private:
   clang::ASTContext &ast_ctx;
@@ -29,12 +46,19 @@ class CXXToCDeclVisitor : public clang::RecursiveASTVisitor<CXXToCDeclVisitor> {
 
   ASTBuilder ast;
 
+  // Records are keyed by their canonical declaration, so that every
+  // redeclaration and every visit of an instantiation maps to the same struct
   std::unordered_map<clang::Decl *, clang::Decl *> c_decls;
+  // Canonical declarations of the records whose members have been visited
+  std::unordered_set<clang::Decl *> lowered;
+  LoweredRecords *shared;
 
   clang::QualType GetAsCType(clang::QualType type);
+  // Whether the members of `cls` still need to be lowered
+  bool ShouldLowerMembers(clang::CXXRecordDecl *cls);
 
  public:
-  CXXToCDeclVisitor(clang::ASTUnit &unit);
+  CXXToCDeclVisitor(clang::ASTUnit &unit, LoweredRecords *shared = nullptr);
 
   bool shouldVisitTemplateInstantiations() { return true; }
 
@@ -44,13 +68,33 @@ class CXXToCDeclVisitor : public clang::RecursiveASTVisitor<CXXToCDeclVisitor> {
   }
 
   bool TraverseClassTemplateDecl(clang::ClassTemplateDecl *decl) {
-    // Only process class template specializations
+    // Only process class template specializations, which every redeclaration
+    // of the template shares
+    if (decl != decl->getCanonicalDecl()) {
+      return true;
+    }
     for (auto spec : decl->specializations()) {
       TraverseDecl(spec);
     }
     return true;
   }
 
+  // Records whose members were already lowered are only declared
+  bool TraverseCXXRecordDecl(clang::CXXRecordDecl *cls) {
+    if (!ShouldLowerMembers(cls)) {
+      return WalkUpFromCXXRecordDecl(cls);
+    }
+    return RecursiveASTVisitor::TraverseCXXRecordDecl(cls);
+  }
+
+  bool TraverseClassTemplateSpecializationDecl(
+      clang::ClassTemplateSpecializationDecl *spec) {
+    if (!ShouldLowerMembers(spec)) {
+      return WalkUpFromClassTemplateSpecializationDecl(spec);
+    }
+    return RecursiveASTVisitor::TraverseClassTemplateSpecializationDecl(spec);
+  }
+
   bool VisitFunctionDecl(clang::FunctionDecl *func);
   bool VisitCXXMethodDecl(clang::CXXMethodDecl *method);
   bool VisitRecordDecl(clang::RecordDecl *record);
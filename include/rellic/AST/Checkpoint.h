@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <clang/AST/Decl.h>
+#include <clang/AST/Stmt.h>
+#include <z3++.h>
+
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "rellic/AST/DecompilationContext.h"
+
+namespace rellic {
+
+/*
+ * In-memory checkpoints of the function bodies of a context, so that the
+ * effect of refinement passes can be undone without decompiling again.
+ *
+ * Passes rewrite functions by patching the child slots of their statements,
+ * and statements are never freed while the AST is alive. The state of a
+ * function is therefore its body along with the children of every statement
+ * reachable from it, their conditions and their provenance: restoring it only
+ * writes the old pointers back. Nothing is recorded when a checkpoint is
+ * taken. The state of a function is only recorded the first time a pass
+ * enters it afterwards, through `Preserve`, and is shared by every checkpoint
+ * taken while the function was left unchanged.
+ *
+ * Conditions are kept as formulas rather than indices into `z3_exprs`, so
+ * that checkpoints survive `CompactZExprs`. Declarations, types and the
+ * statistics of the context are not part of a checkpoint.
+ */
+class Checkpoints {
+  // The state of a function, recorded lazily
+  struct Version {
+    clang::Stmt *body;
+    bool recorded{false};
+    // Statements reachable from `body`, in pre-order, and their children
+    // laid out one after the other
+    std::vector<clang::Stmt *> stmts;
+    std::vector<clang::Stmt *> children;
+    std::vector<std::pair<clang::Stmt *, z3::expr>> conds;
+    std::vector<std::pair<clang::Stmt *, llvm::Value *>> stmt_provenance;
+    std::vector<std::pair<clang::Expr *, llvm::Use *>> use_provenance;
+
+    Version(clang::Stmt *body) : body(body) {}
+  };
+  using Versions =
+      std::unordered_map<clang::FunctionDecl *, std::shared_ptr<Version>>;
+
+  DecompilationContext &dec_ctx;
+  std::vector<Versions> checkpoints;
+  // Versions that the functions of the AST are still in
+  Versions current;
+
+  void Record(Version &version);
+
+ public:
+  // Installs itself as `dec_ctx.checkpoints` until it is destroyed, which
+  // must happen before `dec_ctx` is
+  Checkpoints(DecompilationContext &dec_ctx);
+  ~Checkpoints();
+  Checkpoints(const Checkpoints &) = delete;
+  Checkpoints &operator=(const Checkpoints &) = delete;
+
+  // Takes a checkpoint of every function definition and returns its index
+  size_t Create();
+  // Restores the functions to the state of checkpoint `idx`, which is kept,
+  // and returns the ones that changed since
+  std::vector<clang::FunctionDecl *> Checkout(size_t idx);
+  // Drops the checkpoints from `idx` on
+  void Truncate(size_t idx);
+  size_t Size() const { return checkpoints.size(); }
+
+  // Records the state of `fdecl` for the checkpoints that share it. Must be
+  // called before it is modified, which `DecompilationContext::EnterFunction`
+  // does for the passes.
+  void Preserve(clang::FunctionDecl *fdecl);
+};
+
+}  // namespace rellic
@@ -31,16 +31,24 @@ namespace rellic {
  *   } else {
  *     body_else;
  *   }
+ *
+ * Runs of more than two such statements are merged in a single visit.
  */
-class CondBasedRefine : public TransformVisitor<CondBasedRefine> {
+class CondBasedRefine : public LocalRewriteVisitor<CondBasedRefine> {
  private:
+  // Returns the combination of two consecutive `if` statements, or nullptr if
+  // their conditions are neither equivalent nor opposite
+  clang::IfStmt *Merge(clang::IfStmt *if_a, clang::IfStmt *if_b);
+
  protected:
   void RunImpl() override;
 
  public:
   CondBasedRefine(DecompilationContext &dec_ctx);
+  const char *GetName() const override { return "CondBasedRefine"; }
+  unsigned GetEffects() const override { return kStatements; }
 
-  bool VisitCompoundStmt(clang::CompoundStmt *compound);
+  clang::Stmt *Rewrite(clang::Stmt *stmt) override;
 };
 
 }  // namespace rellic
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+
+#include "rellic/AST/Statistics.h"
+
+namespace llvm {
+class Function;
+class Module;
+}  // namespace llvm
+
+namespace rellic {
+
+// Rough estimate of the work it takes to decompile a function, in arbitrary
+// units, along with what it is computed from. Structuring and refinement grow
+// faster than linearly with the number of blocks, all the more inside loops,
+// and every case of a switch is an edge with a condition of its own.
+struct FunctionCost {
+  uint64_t blocks = 0;
+  uint64_t instructions = 0;
+  uint64_t switch_cases = 0;
+  unsigned loop_depth = 0;
+  uint64_t cost = 0;
+};
+
+// Linear in the size of `func`, without building anything but its loops
+FunctionCost EstimateFunctionCost(llvm::Function &func);
+
+/*
+ * Time that decompiling the functions of each shape (see `GetFunctionShape`)
+ * actually took, so that estimates can follow what was measured rather than
+ * the size of functions alone. Times are converted to the units of
+ * `EstimateFunctionCost` by the ratio of everything estimated to everything
+ * measured so far. Recording and looking up are safe from several threads.
+ */
+class CostHistory {
+  struct Entry {
+    uint64_t count = 0;
+    Duration time{0};
+  };
+
+  mutable std::mutex mutex;
+  std::map<std::string, Entry> shapes;
+  uint64_t total_cost = 0;
+  Duration total_time{0};
+
+ public:
+  // Records that decompiling `func` took `time`
+  void Record(llvm::Function &func, Duration time);
+  // Average cost of the functions of `shape`, or nullopt if none was recorded
+  std::optional<uint64_t> Lookup(const std::string &shape) const;
+};
+
+struct ModuleCost {
+  // Functions with a body, and how many of them were priced from a history
+  uint64_t functions = 0;
+  uint64_t known_functions = 0;
+  uint64_t blocks = 0;
+  uint64_t instructions = 0;
+  uint64_t switch_cases = 0;
+  unsigned max_loop_depth = 0;
+  uint64_t cost = 0;
+};
+
+// Sums the estimates of the functions with a body in `module`, taking the
+// cost of the shapes found in `history` from it if not null
+ModuleCost EstimateModuleCost(llvm::Module &module,
+                              const CostHistory *history = nullptr);
+
+}  // namespace rellic
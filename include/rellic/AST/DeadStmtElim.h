@@ -17,15 +17,24 @@ namespace rellic {
 /*
  * This pass eliminates statements that have no effect
  */
-class DeadStmtElim : public TransformVisitor<DeadStmtElim> {
+class DeadStmtElim : public LocalRewriteVisitor<DeadStmtElim> {
+ private:
+  clang::Stmt *RewriteIf(clang::IfStmt *ifstmt);
+  clang::Stmt *RewriteCompound(clang::CompoundStmt *compound);
+  // Whether `stmt` must be kept in its compound statement
+  bool IsNeeded(clang::Stmt *stmt);
+
  protected:
   void RunImpl() override;
 
  public:
   DeadStmtElim(DecompilationContext &dec_ctx);
+  const char *GetName() const override { return "DeadStmtElim"; }
+  unsigned GetEffects() const override { return kStatements; }
+  bool TracksStatements() const override { return true; }
 
-  bool VisitIfStmt(clang::IfStmt *ifstmt);
-  bool VisitCompoundStmt(clang::CompoundStmt *compound);
+  void Prepare() override;
+  clang::Stmt *Rewrite(clang::Stmt *stmt) override;
 };
 
 }  // namespace rellic
\ No newline at end of file
@@ -12,6 +12,9 @@
 #include <llvm/IR/InstVisitor.h>
 
 #include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
 #include <unordered_map>
 #include <unordered_set>
 #include <vector>
@@ -27,7 +30,29 @@ using IRFuncToDITypeMap =
 using IRArgToDITypeMap = std::unordered_map<llvm::Argument *, llvm::DIType *>;
 
 class DebugInfoCollector : public llvm::InstVisitor<DebugInfoCollector> {
+ public:
+  // Maps that can be collected. Scopes are recorded for every instruction
+  // with a location, and are only worth it when they are used.
+  enum Collect : unsigned {
+    kNames = 1 << 0,
+    kScopes = 1 << 1,
+    kValueTypes = 1 << 2,
+    // IR types, and the set of debug types that are used
+    kTypes = 1 << 3,
+    // Subprograms, and the debug types of functions and their arguments
+    kFunctions = 1 << 4,
+    kAll = kNames | kScopes | kValueTypes | kTypes | kFunctions,
+  };
+
  private:
+  unsigned collect;
+  // Functions are only visited once something from them is asked for
+  llvm::Module *lazy_module{nullptr};
+  std::unordered_set<llvm::Function *> collected;
+  bool collected_all{false};
+  // Shards look names up from several threads
+  std::mutex mutex;
+
   IRToNameMap names;
   IRToScopeMap scopes;
   IRToDITypeMap valtypes;
@@ -38,16 +63,60 @@ class DebugInfoCollector : public llvm::InstVisitor<DebugInfoCollector> {
   std::vector<llvm::DISubprogram *> subprograms;
 
   void WalkType(llvm::Type *type, llvm::DIType *ditype);
+  void CollectFunction(llvm::Function &func);
+  void CollectAll();
 
  public:
-  IRToNameMap &GetIRToNameMap() { return names; }
-  IRToScopeMap &GetIRToScopeMap() { return scopes; }
-  IRToDITypeMap &GetIRToDITypeMap() { return valtypes; }
-  IRTypeToDITypeMap &GetIRTypeToDITypeMap() { return types; }
-  IRFuncToDITypeMap &GetIRFuncToDITypeMap() { return funcs; }
-  IRArgToDITypeMap &GetIRArgToDITypeMap() { return args; }
-  std::unordered_set<llvm::DIType *> &GetTypes() { return type_set; }
-  std::vector<llvm::DISubprogram *> &GetSubprograms() { return subprograms; }
+  DebugInfoCollector(unsigned collect = kAll) : collect(collect) {}
+
+  // Collects from the functions of `module` as they are needed, instead of
+  // visiting the whole module up front. Asking for any of the maps below
+  // visits every function that was not visited yet.
+  void CollectLazily(llvm::Module &module);
+
+  // Name of `val` from the debug information, visiting only the function it
+  // belongs to. Safe to call from several threads.
+  std::optional<std::string> GetName(llvm::Value *val);
+
+  // Names of the fields of `type` from its debug type, in order, with the
+  // names that repeat an earlier one suffixed the way `StructFieldRenamer`
+  // does. Empty if the debug type is unknown or does not list one member per
+  // field. Visits every function that was not visited yet, and is safe to
+  // call from several threads.
+  std::vector<std::string> GetFieldNames(llvm::StructType *type);
+
+  IRToNameMap &GetIRToNameMap() {
+    CollectAll();
+    return names;
+  }
+  IRToScopeMap &GetIRToScopeMap() {
+    CollectAll();
+    return scopes;
+  }
+  IRToDITypeMap &GetIRToDITypeMap() {
+    CollectAll();
+    return valtypes;
+  }
+  IRTypeToDITypeMap &GetIRTypeToDITypeMap() {
+    CollectAll();
+    return types;
+  }
+  IRFuncToDITypeMap &GetIRFuncToDITypeMap() {
+    CollectAll();
+    return funcs;
+  }
+  IRArgToDITypeMap &GetIRArgToDITypeMap() {
+    CollectAll();
+    return args;
+  }
+  std::unordered_set<llvm::DIType *> &GetTypes() {
+    CollectAll();
+    return type_set;
+  }
+  std::vector<llvm::DISubprogram *> &GetSubprograms() {
+    CollectAll();
+    return subprograms;
+  }
 
   void visitDbgDeclareInst(llvm::DbgDeclareInst &inst);
   void visitInstruction(llvm::Instruction &inst);
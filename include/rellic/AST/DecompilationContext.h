@@ -10,17 +10,34 @@
 
 #include <clang/AST/ASTContext.h>
 #include <clang/Frontend/ASTUnit.h>
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/Value.h>
 #include <z3++.h>
 
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <mutex>
+#include <string>
 #include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "rellic/AST/ASTBuilder.h"
+#include "rellic/AST/BDD.h"
+#include "rellic/AST/Progress.h"
+#include "rellic/AST/Statistics.h"
 #include "rellic/AST/TypeProvider.h"
 
 namespace rellic {
 
+class AlphaCache;
+class Checkpoints;
+class DebugInfoCollector;
+class PassProfile;
+class Z3QueryLog;
+
 struct DecompilationContext {
   using StmtToIRMap = std::unordered_map<clang::Stmt *, llvm::Value *>;
   using ExprToUseMap = std::unordered_map<clang::Expr *, llvm::Use *>;
@@ -34,9 +51,97 @@ struct DecompilationContext {
 
   using BBEdge = std::pair<llvm::BasicBlock *, llvm::BasicBlock *>;
   using BrEdge = std::pair<llvm::BranchInst *, bool>;
-  using SwEdge = std::pair<llvm::SwitchInst *, llvm::ConstantInt *>;
+  using SwEdge = std::pair<llvm::SwitchInst *, llvm::BasicBlock *>;
+
+  struct EdgeHash {
+    template <typename T, typename U>
+    size_t operator()(const std::pair<T, U> &edge) const {
+      auto h{std::hash<T>{}(edge.first)};
+      return h ^ (std::hash<U>{}(edge.second) + 0x9E3779B9 + (h << 6) +
+                  (h >> 2));
+    }
+  };
+
+  // Memoized results of `Prove` and `HeavySimplify`. Z3 hash-conses ASTs
+  // within a context, so ids identify formulas uniquely as long as they are
+  // alive: every key is kept in `exprs` so that its id cannot be recycled.
+  struct Z3Cache {
+    z3::expr_vector exprs;
+    std::unordered_map<unsigned, bool> proofs;
+    // Maps the id of a formula to the index of its simplified form in `exprs`
+    std::unordered_map<unsigned, unsigned> simplified;
+    // Same for `OrderById`
+    std::unordered_map<unsigned, unsigned> ordered;
+
+    size_t prove_hits = 0;
+    size_t prove_misses = 0;
+    size_t simplify_hits = 0;
+    size_t simplify_misses = 0;
+    // Number of queries that were abandoned because of `z3_timeout`
+    size_t timeouts = 0;
+    // Number of queries that were abandoned because the work was cancelled
+    size_t interrupts = 0;
+    // Number of proofs that were decided from the shape of the formula,
+    // without calling the solver
+    size_t prove_shortcuts = 0;
+    // Number of proofs that were decided by `bdd_engine`
+    size_t bdd_decisions = 0;
+    // Number of queries that were raced across a portfolio of tactics after
+    // `z3_portfolio`, and the ones that a tactic of it answered
+    size_t portfolio_races = 0;
+    size_t portfolio_wins = 0;
+    // Number of proofs and simplifications that were answered by
+    // `alpha_cache`
+    size_t alpha_hits = 0;
+
+    Z3Cache(z3::context &ctx) : exprs(ctx) {}
+
+    // Adds the counters of `other`. Its memoized results are not taken, since
+    // they refer to formulas of another context.
+    void Merge(const Z3Cache &other);
+  };
+
+  // Solver and tactics used by `Prove` and `HeavySimplify`, so that they are
+  // only set up once per context
+  struct Z3Solver {
+    z3::solver solver;
+    z3::tactic heavy_simplify;
+    // Used instead of `heavy_simplify` on large formulas
+    z3::tactic light_simplify;
+    // Timeout `solver` is currently configured with
+    unsigned timeout = 0;
+
+    Z3Solver(z3::context &ctx);
+  };
+
+  // Decides purely boolean conditions exactly, before they reach Z3. The
+  // formulas used as variables are kept alive in `atoms`, so that their ids
+  // are not recycled.
+  struct BDDEngine {
+    BDD bdd;
+    z3::expr_vector atoms;
+    // Maps the id of a formula to its variable in `bdd`
+    std::unordered_map<unsigned, unsigned> vars;
+
+    BDDEngine(z3::context &ctx) : atoms(ctx) {}
+  };
+
+  // Marks a query as running on `z3_ctx` while alive, so that cancelling
+  // `progress` interrupts it, and adds the time it took to `progress`.
+  // Queries must not be sent if `Cancelled()` returns true once the scope
+  // exists, or they may run to completion.
+  class Z3Query {
+    DecompilationContext &dec_ctx;
+    std::chrono::steady_clock::time_point start;
+
+   public:
+    Z3Query(DecompilationContext &dec_ctx);
+    ~Z3Query();
+    bool Cancelled() const { return dec_ctx.Cancelled(); }
+  };
 
   DecompilationContext(clang::ASTUnit &ast_unit);
+  ~DecompilationContext();
 
   clang::ASTUnit &ast_unit;
   clang::ASTContext &ast_ctx;
@@ -47,36 +152,226 @@ struct DecompilationContext {
   StmtToIRMap stmt_provenance;
   ExprToUseMap use_provenance;
   IRToTypeDeclMap type_decls;
+  // Memoized results of `GetQualType`. The types of structs depend on
+  // `type_decls`, so this must be cleared whenever an entry of it is replaced.
+  llvm::DenseMap<llvm::Type *, clang::QualType> qual_types;
   IRToValDeclMap value_decls;
+  // Memoized results of `clang::Expr::HasSideEffects` for the expression
+  // statements seen by a run of `DeadStmtElim`. Other passes can substitute
+  // the children of an expression in place, which changes its side effects
+  // without changing its address, so this is cleared before every run.
+  llvm::DenseMap<clang::Expr *, bool> side_effects;
   ArgToTempMap temp_decls;
   BlockToUsesMap outgoing_uses;
   z3::context z3_ctx;
+  // Conditions referenced by index from `conds` and the maps below. Each
+  // formula is stored once, so entries must not be modified in place except to
+  // replace them with an equivalent formula.
   z3::expr_vector z3_exprs{z3_ctx};
+  // Maps the id of a formula to its index in `z3_exprs`
+  std::unordered_map<unsigned, unsigned> z3_expr_ids;
+  // Entries before this index have already been through `Z3CondSimplify`.
+  // Since entries are only ever replaced by equivalent formulas, only the ones
+  // inserted since it last ran need to be simplified.
+  unsigned z3_simplified = 0;
+  // Called with every formula that `InsertZExpr` adds to `z3_exprs`, e.g. to
+  // record corpora of the conditions of real inputs. May be empty.
+  std::function<void(const z3::expr &)> on_insert_z_expr;
   Z3CondMap conds;
+  Z3Cache z3_cache{z3_ctx};
+  Z3Solver z3_solver{z3_ctx};
+  // Only set if conditions should be decided with BDDs when possible
+  std::unique_ptr<BDDEngine> bdd_engine;
+  // Where proofs and simplifications are shared with the contexts of other
+  // functions, if anywhere. Not owned by the context.
+  AlphaCache *alpha_cache = nullptr;
+  // Where the queries that reach Z3 are recorded, if anywhere. Not owned by
+  // the context.
+  Z3QueryLog *z3_query_log = nullptr;
+  // Where local variables and struct fields take their names from as they
+  // are created, if anywhere, instead of being renamed by `LocalDeclRenamer`
+  // and `StructFieldRenamer` afterwards. Not owned by the context.
+  DebugInfoCollector *debug_names = nullptr;
+  // Whether conditions are only decided from their shape and simplified with
+  // Z3's rewriter, never with the solver: `Prove` answers false to what it
+  // cannot tell syntactically
+  bool syntactic_conditions = false;
 
   clang::Expr *marker_expr;
 
   std::unordered_map<unsigned, BrEdge> z3_br_edges_inv;
 
-  // Pairs do not have a std::hash specialization so we can't use unordered maps
-  // here. If this turns out to be a performance issue, investigate adding hash
-  // specializations for these specifically
-  std::map<BrEdge, unsigned> z3_br_edges;
+  // Conditions of the edges and blocks of the function being structured. They
+  // are cleared once it is done, since only the inverse maps are needed to
+  // materialize its conditions.
+  std::unordered_map<BrEdge, unsigned, EdgeHash> z3_br_edges;
 
   std::unordered_map<llvm::SwitchInst *, unsigned> z3_sw_vars;
   std::unordered_map<unsigned, llvm::SwitchInst *> z3_sw_vars_inv;
-  std::map<SwEdge, unsigned> z3_sw_edges;
+  std::unordered_map<SwEdge, unsigned, EdgeHash> z3_sw_edges;
+
+  std::unordered_map<BBEdge, unsigned, EdgeHash> z3_edges;
+  // Reaching condition of every block of the function being structured, by
+  // the index `GenerateAST` gives the block. Blocks without one yet have the
+  // largest `unsigned`.
+  std::vector<unsigned> reaching_conds;
+
+  // Whether `GenerateAST` builds the reaching condition of a block relative to
+  // its immediate dominator, which keeps the conditions it has in common with
+  // its predecessors out of the disjunction over them
+  bool dominator_reaching_conds = false;
+  // Whether `GenerateAST` reuses the relative reaching conditions of regions
+  // with the same control flow, which needs `dominator_reaching_conds`
+  bool reuse_region_conds = false;
+  // Branch and switch conditions translated from at least this many
+  // instructions get a variable of their own, 0 to disable. The instructions
+  // that got one are mapped to the number of instructions they stand for.
+  unsigned cond_temp_threshold = 0;
+  std::unordered_map<llvm::Instruction *, unsigned> cond_temps;
+  // Constant arrays of 16- and 32-bit integers with at least this many
+  // elements are translated to wide string literals, 0 to disable
+  unsigned wide_string_threshold = 0;
+  // Limits past which `GenerateAST` emits functions with `goto`s instead of
+  // structuring them, see `DecompilationOptions`
+  unsigned goto_fallback_blocks = 0;
+  bool goto_fallback_irreducible = false;
+  Duration structuring_budget{0};
+  // Size limits of `HeavySimplify`, see `DecompilationOptions`
+  unsigned simplify_light_nodes = 0;
+  unsigned simplify_max_nodes = 0;
+  // Whether fixpoints skip the passes that cannot change a function, see
+  // `CompositeASTPass`
+  bool adaptive_passes = false;
+  // Profile that passes are not run on the function shapes it shows they never
+  // change by, and profile that the runs of the passes are recorded into, if
+  // any. Not owned by the context. Both need the shape of every function that
+  // is refined in `function_shapes`.
+  const PassProfile *pass_profile = nullptr;
+  PassProfile *recorded_profile = nullptr;
+  std::unordered_map<clang::FunctionDecl *, std::string> function_shapes;
+
+  // When the subtrees of statements last changed, so that passes can skip
+  // the ones that did not change since they last examined them, see
+  // `TransformVisitor`. Times are values of `clock`, which every run of a pass
+  // advances. Passes that report the statements they change mark them along
+  // with every statement above them, while the functions changed by other
+  // passes are marked as a whole.
+  struct SubtreeChanges {
+    unsigned clock = 0;
+    std::unordered_map<clang::Stmt *, unsigned> stmts;
+    std::unordered_map<clang::FunctionDecl *, unsigned> functions;
+    // When a change that could not be attributed to a function was last made
+    unsigned all = 0;
 
-  std::map<BBEdge, unsigned> z3_edges;
-  std::unordered_map<llvm::BasicBlock *, unsigned> reaching_conds;
+    void Mark(clang::Stmt *stmt) { stmts[stmt] = clock; }
+    void Mark(clang::FunctionDecl *fdecl) { functions[fdecl] = clock; }
+    // Last time the subtree of `stmt`, which is in `fdecl`, may have changed
+    unsigned LastChange(clang::FunctionDecl *fdecl, clang::Stmt *stmt) const {
+      auto last{all};
+      auto fit{functions.find(fdecl)};
+      if (fit != functions.end()) {
+        last = std::max(last, fit->second);
+      }
+      auto sit{stmts.find(stmt)};
+      if (sit != stmts.end()) {
+        last = std::max(last, sit->second);
+      }
+      return last;
+    }
+  };
+  SubtreeChanges subtree_changes;
 
   size_t num_literal_structs = 0;
   size_t num_declared_structs = 0;
 
-  // Inserts an expression into z3_exprs and returns its index
+  DecompilationStatistics stats;
+
+  // Limits on the effort spent refining the AST. Running out of resources is
+  // not an error: queries that time out are treated as unprovable, and
+  // functions that exceed their budget are left as they are.
+  //
+  // Time limit in milliseconds for a single Z3 query, 0 for no limit.
+  unsigned z3_timeout = 0;
+  // Time in milliseconds after which a `Prove` or `HeavySimplify` query is
+  // raced across the portfolios of `RaceTactics` for the rest of `z3_timeout`,
+  // 0 to disable.
+  unsigned z3_portfolio = 0;
+  // Wall-clock time each function may spend in refinement passes, 0 for no
+  // limit.
+  Duration function_budget{0};
+  std::unordered_map<clang::FunctionDecl *, Duration> function_time;
+  // Functions that are emitted as they are, including the ones that
+  // `GenerateAST` emitted with `goto`s
+  std::unordered_set<clang::FunctionDecl *> degraded_functions;
+  // Soft limits on memory, 0 for no limit: the peak resident set size of the
+  // process, the memory allocated by `ast_ctx` and the memory Z3 has allocated
+  // across the process, all in bytes, and the number of entries of `z3_exprs`.
+  // Once one of them is exceeded, every function visited afterwards is over
+  // budget and fixpoints stop iterating.
+  uint64_t rss_limit = 0;
+  uint64_t ast_memory_limit = 0;
+  uint64_t z3_memory_limit = 0;
+  size_t z3_exprs_limit = 0;
+  // Name of the soft limit that was exceeded, if any
+  const char *exceeded_limit = nullptr;
+  // Set once provenance is no longer recorded because of `exceeded_limit`
+  bool provenance_shed = false;
+  // Where functions are preserved before a pass enters them, if anywhere. Not
+  // owned by the context.
+  Checkpoints *checkpoints = nullptr;
+  // Function being visited by the running pass, and the name of the innermost
+  // named pass that is running
+  clang::FunctionDecl *current_function = nullptr;
+  std::chrono::steady_clock::time_point current_function_start;
+  const char *current_pass = nullptr;
+  // Function being structured by `GenerateAST`, whose Z3 work is attributed
+  // to it while no pass is running
+  llvm::Function *structuring_function = nullptr;
+  // Where progress is reported and cancellation requested, if anywhere. Not
+  // owned by the context. Only set with `SetProgress`.
+  Progress *progress = nullptr;
+  // Guards `z3_querying`, which is true while a `Z3Query` is alive
+  std::mutex z3_query_mutex;
+  bool z3_querying = false;
+
+  // Called by passes before they visit `fdecl`, which they may then modify
+  void EnterFunction(clang::FunctionDecl *fdecl);
+  void LeaveFunction();
+  // Returns true if the current function has run out of budget
+  bool OutOfBudget();
+  // Returns true if the work being done on the context has been cancelled
+  bool Cancelled() const { return progress && progress->cancelled; }
+  // Reports progress to `progress` from now on, and lets `Progress::Cancel`
+  // interrupt the queries running on `z3_ctx`. May be null.
+  void SetProgress(Progress *progress);
+  // Returns true if a soft limit has been exceeded. The first time it is, the
+  // limit is logged along with `stage`, or the running pass if null, and the
+  // current function.
+  bool OverSoftLimit(const char *stage = nullptr);
+  // Adds the Z3 work in `z3` to the statistics of the running pass and of the
+  // current function
+  void RecordZ3(const Z3Statistics &z3);
+  // Measures the memory held by each part of the decompiler and appends it to
+  // `stats.memory` as the end of `stage`. `module` is only measured if given.
+  void RecordMemory(const char *stage, const llvm::Module *module = nullptr);
+
+  // Inserts an expression into z3_exprs and returns its index, or the index it
+  // already had
   unsigned InsertZExpr(const z3::expr &e);
+  // Replaces the entry at `idx` with an equivalent formula
+  void SetZExpr(unsigned idx, const z3::expr &e);
+  // Drops the entries of z3_exprs that are no longer referenced by any
+  // statement in the translation unit or by the structuring maps, and
+  // renumbers the remaining ones. No index obtained before may be held across
+  // a call to this.
+  void CompactZExprs();
 
+  // Returns the C type of `type`, creating the declarations of the structs it
+  // refers to if needed
   clang::QualType GetQualType(llvm::Type *type);
+
+ private:
+  clang::QualType CreateQualType(llvm::Type *type);
 };
 
 }  // namespace rellic
\ No newline at end of file
@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include "rellic/AST/InferenceRule.h"
 #include "rellic/AST/TransformVisitor.h"
 
 namespace rellic {
@@ -17,18 +18,21 @@ namespace rellic {
  * like turning *&a into a, or !(a == b) into a != b
  */
 class ExprCombine : public TransformVisitor<ExprCombine> {
+ private:
+  InferenceRuleSet cast_pre_rules;
+  InferenceRuleSet cast_rules;
+  // Rules for the other expressions, by class
+  InferenceRuleEngine rules;
+
  protected:
   void RunImpl() override;
 
  public:
   ExprCombine(DecompilationContext &dec_ctx);
+  const char *GetName() const override { return "ExprCombine"; }
 
   bool VisitCStyleCastExpr(clang::CStyleCastExpr *cast);
-  bool VisitUnaryOperator(clang::UnaryOperator *op);
-  bool VisitBinaryOperator(clang::BinaryOperator *op);
-  bool VisitArraySubscriptExpr(clang::ArraySubscriptExpr *expr);
-  bool VisitMemberExpr(clang::MemberExpr *expr);
-  bool VisitParenExpr(clang::ParenExpr *paren);
+  bool VisitExpr(clang::Expr *expr);
 };
 
 }  // namespace rellic
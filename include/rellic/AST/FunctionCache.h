@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <llvm/IR/Function.h>
+#include <llvm/IR/ModuleSlotTracker.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+
+#include "rellic/AST/FunctionShard.h"
+
+namespace rellic {
+
+/*
+ * A content-addressed cache of refined function bodies stored in a directory.
+ *
+ * Every entry holds a single function shard: the serialized ASTUnit the
+ * function was decompiled into, and a map from its declarations and statements
+ * back to the IR. Entries are keyed by a hash of the function's IR, of the
+ * types and globals it refers to, and of a caller-provided string describing
+ * the options that affect decompilation, so an entry can be used for the same
+ * function in any module.
+ *
+ * Entries are written to temporary files and renamed into place, so a cache
+ * directory can be shared by concurrent processes, including over network
+ * file systems. Failing to read or write an entry is never an error: the cache
+ * just behaves as if the entry did not exist.
+ */
+class FunctionCache {
+  std::string dir;
+  uint64_t max_size;
+  std::string options_key;
+  // Numbering of the module that keys were last computed for, which is
+  // expensive to recompute for every function
+  std::unique_ptr<llvm::ModuleSlotTracker> slots;
+
+  std::string GetPath(const std::string &key, llvm::StringRef ext) const;
+
+ public:
+  // `max_size` is the size in bytes the directory is trimmed to by `Evict`, 0
+  // for no limit
+  FunctionCache(std::string dir, uint64_t max_size, std::string options_key);
+
+  // Hash of everything the decompiled body of `func` depends on. With
+  // `anonymous`, the name of `func` is left out, so that it hashes the same
+  // once renamed, but the key cannot be used to look it up.
+  std::string GetKey(llvm::Function &func, bool anonymous = false);
+
+  // Returns a shard holding the cached body of `func`, or nullptr
+  std::unique_ptr<FunctionShard> Load(llvm::Function &func,
+                                      const std::string &key);
+
+  // Returns true if an entry has been stored under `key`, which can still fail
+  // to load. Does not depend on the options of the cache.
+  bool Contains(const std::string &key) const;
+
+  // Saves a shard holding a single function
+  void Store(FunctionShard &shard, const std::string &key);
+
+  // Removes the least recently used entries until the cache fits in
+  // `max_size`
+  void Evict();
+};
+
+}  // namespace rellic
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <clang/AST/ASTImporter.h>
+#include <clang/Frontend/ASTUnit.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/JSON.h>
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "rellic/AST/DecompilationContext.h"
+
+namespace rellic {
+
+/*
+ * A function shard decompiles a subset of the function bodies of a module into
+ * its own ASTUnit. Since it owns its own `z3::context`, conditions, reaching
+ * conditions and edge maps, separate shards can be processed concurrently.
+ *
+ * Declarations of global values and types are created the same way in every
+ * context, keyed by the IR they come from, and a shard only creates the ones
+ * its functions refer to. When merging, the shard uses the
+ * type and value declarations of the destination context as read-only lookup
+ * tables and maps its own declarations onto them. Only function bodies and
+ * their local declarations are actually imported.
+ */
+class FunctionShard {
+ private:
+  std::unique_ptr<clang::ASTUnit> ast_unit;
+  std::unique_ptr<DecompilationContext> dec_ctx;
+  std::vector<llvm::Function *> funcs;
+  std::unique_ptr<clang::ASTImporter> importer;
+  std::unordered_map<clang::Stmt *, clang::Stmt *> imported_stmts;
+
+  void PrepareMerge(DecompilationContext &into);
+  void MergeFunction(llvm::Function &func, DecompilationContext &into);
+  void FinishMerge(DecompilationContext &into);
+
+ public:
+  FunctionShard(std::unique_ptr<clang::ASTUnit> ast_unit,
+                std::vector<llvm::Function *> funcs);
+
+  clang::ASTUnit &GetASTUnit() { return *ast_unit; }
+  DecompilationContext &GetContext() { return *dec_ctx; }
+  const std::vector<llvm::Function *> &GetFunctions() const { return funcs; }
+
+  // Creates bodies for the functions belonging to this shard, and declarations
+  // for them and the global values they refer to. The rest of the module is
+  // declared by the context the shard is merged into, so the cost of a shard
+  // does not grow with the size of the module.
+  void GenerateAST(llvm::Module &module);
+
+  // Describes the declarations and provenance of a shard holding a single
+  // function in terms of indices into its AST and its IR, so that they can be
+  // recovered from a serialized copy of the ASTUnit.
+  llvm::json::Object Serialize() const;
+
+  // Creates a shard for `func` from the ASTUnit `cached` saved from another
+  // shard, and the output of `Serialize` for that shard. The IR of `func` must
+  // be identical to the one the original shard was created from. Throws if
+  // `map` does not match `cached` or `func`.
+  static std::unique_ptr<FunctionShard> Deserialize(
+      llvm::Function &func, clang::ASTUnit &cached,
+      const llvm::json::Object &map);
+
+  // Moves the function bodies of `shards` into `into`, together with their
+  // statement, use and declaration provenance. Bodies are merged in module
+  // order, so the result does not depend on how functions were partitioned.
+  static void Merge(llvm::Module &module,
+                    std::vector<std::unique_ptr<FunctionShard>> &shards,
+                    DecompilationContext &into);
+};
+
+}  // namespace rellic
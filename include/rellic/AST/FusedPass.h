@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rellic/AST/TransformVisitor.h"
+
+namespace rellic {
+
+/*
+ * Runs several `LocalRewrite` passes in a single post-order traversal of the
+ * function bodies instead of one traversal each. Every statement is handed to
+ * the passes in the order they were added, each seeing the result of the
+ * previous one, after all of its children went through the same. A statement
+ * that is removed is not seen by the passes that come after the one that
+ * removed it.
+ */
+class FusedPass : public TransformVisitor<FusedPass> {
+  std::vector<std::unique_ptr<ASTPass>> passes;
+  std::vector<LocalRewrite *> rewrites;
+  std::string name{"Fused"};
+
+ protected:
+  void RunImpl() override;
+
+ public:
+  FusedPass(DecompilationContext &dec_ctx);
+  const char *GetName() const override { return name.c_str(); }
+
+  // `pass` must be a `LocalRewrite`
+  void Add(std::unique_ptr<ASTPass> pass);
+
+  unsigned GetEffects() const override;
+  unsigned GetTriggers() const override;
+  bool TracksStatements() const override;
+
+  bool VisitStmt(clang::Stmt *stmt);
+};
+
+}  // namespace rellic
@@ -8,6 +8,8 @@
 
 #pragma once
 
+#include <llvm/ADT/BitVector.h>
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/Analysis/RegionInfo.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/PassManager.h>
@@ -15,7 +17,10 @@
 
 #include <limits>
 #include <map>
+#include <string>
+#include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "rellic/AST/ASTBuilder.h"
 #include "rellic/AST/IRToASTVisitor.h"
@@ -33,15 +38,37 @@ class GenerateAST : public llvm::AnalysisInfoMixin<GenerateAST> {
   rellic::IRToASTVisitor ast_gen;
   DecompilationContext &dec_ctx;
   ASTBuilder &ast;
-  bool reaching_conds_changed{true};
-  std::unordered_map<llvm::BasicBlock *, clang::IfStmt *> block_stmts;
-  std::unordered_map<llvm::Region *, clang::CompoundStmt *> region_stmts;
 
   llvm::DominatorTree *domtree;
   llvm::RegionInfo *regions;
   llvm::LoopInfo *loops;
 
   std::vector<llvm::BasicBlock *> rpo_walk;
+  // Every block of the function being structured, in function order, and the
+  // index of each in it, so that sets of blocks can be bit vectors
+  std::vector<llvm::BasicBlock *> func_blocks;
+  llvm::DenseMap<llvm::BasicBlock *, unsigned> block_ids;
+  unsigned GetBlockId(llvm::BasicBlock *block);
+  // By block index: the innermost region of each block, the regions that are
+  // entered through it, innermost first, and the statement it is gated by
+  std::vector<llvm::Region *> block_regions;
+  std::vector<llvm::SmallVector<llvm::Region *, 1>> entered_regions;
+  std::vector<clang::IfStmt *> block_stmts;
+  // Every region of the function being structured, outermost first, and the
+  // index of each in it. The tables of regions are vectors by region index
+  // rather than maps, since structuring looks them up in its inner loops.
+  std::vector<llvm::Region *> func_regions;
+  llvm::DenseMap<llvm::Region *, unsigned> region_ids;
+  unsigned GetRegionId(llvm::Region *region);
+  // By region index: the blocks of `rpo_walk` that each region is structured
+  // from, in the same order, which are the ones that belong to the region
+  // itself and the entries of its direct subregions, and the statement it was
+  // structured into
+  std::vector<std::vector<llvm::BasicBlock *>> region_blocks;
+  std::vector<clang::CompoundStmt *> region_stmts;
+  void CollectRegionBlocks();
+  // Returns the direct subregion of `region` whose entry is `block`, if any
+  llvm::Region *GetSubregion(llvm::Region *region, llvm::BasicBlock *block);
 
   // GetOrCreateEdgeForBranch(branch, true) will return the index of an
   // expression that is true when branch is taken.
@@ -52,28 +79,121 @@ class GenerateAST : public llvm::AnalysisInfoMixin<GenerateAST> {
   // Returns the index of an expression containing a numerical variable that
   // represents the condition of a switch.
   unsigned GetOrCreateVarForSwitch(llvm::SwitchInst *inst);
-  // Returns the index of an expression that is true when a particular case of a
-  // switch is taken. If c is nullptr, the expression for the default case will
-  // be returned.
+  // Returns the index of an expression that is true when a switch jumps to
+  // `dest`, either through its cases or its default. Its size depends on the
+  // number of runs of consecutive cases that lead to `dest`, not on the number
+  // of cases.
   unsigned GetOrCreateEdgeForSwitch(llvm::SwitchInst *inst,
-                                    llvm::ConstantInt *c);
+                                    llvm::BasicBlock *dest);
 
   unsigned GetOrCreateEdgeCond(llvm::BasicBlock *from, llvm::BasicBlock *to);
   unsigned GetReachingCond(llvm::BasicBlock *block);
-  void CreateReachingCond(llvm::BasicBlock *block);
+  // Returns true if the reaching condition of `block` changed
+  bool CreateReachingCond(llvm::BasicBlock *block);
+  // With `dominator_reaching_conds`, the reaching condition of a block is
+  // the one of its immediate dominator, conjoined with the condition of
+  // reaching the block from it, which is kept in `relative_conds`. Returns
+  // true if either of them changed. By block index, like `reaching_conds`.
+  std::vector<unsigned> relative_conds;
+  unsigned GetRelativeCond(llvm::BasicBlock *block);
+  bool CreateRelativeReachingCond(llvm::BasicBlock *block);
+  // With `reuse_region_conds`, the relative conditions of the blocks of the
+  // regions structured so far, other than their entries, by the shape of the
+  // regions. They are kept along with the variables of the branches and
+  // switches of the regions, in the order of `GetRegionShape`, so that
+  // regions of the same shape can substitute their own variables in. Kept
+  // across functions.
+  struct RegionConds {
+    std::vector<z3::expr> vars;
+    std::vector<z3::expr> conds;
+  };
+  std::unordered_map<std::string, RegionConds> region_conds;
+  // Blocks whose relative condition was taken from `region_conds`, by block
+  // index
+  llvm::BitVector reused_conds;
+  // Describes how the blocks of `region` branch to each other, leaving out
+  // everything else about them, and sets `blocks` to them in depth-first
+  // order from the entry
+  std::string GetRegionShape(llvm::Region *region,
+                             std::vector<llvm::BasicBlock *> &blocks);
+  // The variables that the edges out of `blocks` are written in
+  std::vector<z3::expr> GetRegionVars(
+      const std::vector<llvm::BasicBlock *> &blocks);
+  // Sets the relative conditions of the blocks of the largest regions whose
+  // shape is in `region_conds`, before any is computed
+  void ReuseRegionConds();
+  // Adds the regions of the function whose conditions were computed to
+  // `region_conds`
+  void RecordRegionConds();
+  // The predecessor of `block` if it is its only one and only jumps to it, in
+  // which case both are reached under the same condition
+  llvm::BasicBlock *GetSequentialPred(llvm::BasicBlock *block);
+  // Blocks of `rpo_walk` whose reaching conditions are used: the ones of the
+  // regions that are not structured as switches, and those their conditions
+  // are computed from, by block index
+  llvm::BitVector GetConditionedBlocks();
+  // Computes reaching conditions for the blocks of `GetConditionedBlocks`
+  // until a fixpoint is reached. Returns the number of blocks that have been
+  // evaluated.
+  unsigned CreateReachingConds();
+  // Set by the above to the number of blocks of `rpo_walk` left out
+  unsigned skipped_blocks{0};
+  // Where the number of `HeavySimplify` calls made by the above is counted
+  unsigned *simplifications{nullptr};
+  // Set by the above when it gives up because of `structuring_budget`
+  bool out_of_budget{false};
+  // Maps the block where the cases of a switch join to the block of the
+  // switch, when every case is a single block that jumps there and no other
+  // block does. The join is then reached exactly when the switch is, which
+  // saves simplifying a disjunction over all of the cases.
+  std::unordered_map<llvm::BasicBlock *, llvm::BasicBlock *> switch_joins;
+  void CollectSwitchJoins();
 
   std::vector<clang::Stmt *> CreateBasicBlockStmts(llvm::BasicBlock *block);
   std::vector<clang::Stmt *> CreateRegionStmts(llvm::Region *region);
 
   using BBSet = std::unordered_set<llvm::BasicBlock *>;
 
-  void RefineLoopSuccessors(llvm::Loop *loop, BBSet &members,
-                            BBSet &successors);
+  // Sets `members` to the blocks of `loop`, extended with the blocks that are
+  // only reached from them, and `successors` to the blocks the loop exits to.
+  // Both are indexed by `block_ids`.
+  void RefineLoopSuccessors(llvm::Loop *loop, llvm::BitVector &members,
+                            llvm::BitVector &successors);
 
   clang::CompoundStmt *StructureAcyclicRegion(llvm::Region *region);
   clang::CompoundStmt *StructureCyclicRegion(llvm::Region *region);
+  // Whether `region` is a switch whose cases are single blocks or subregions
+  // that all lead to the exit of `region`, so that it can be structured as a
+  // switch statement without looking at reaching conditions
+  bool IsSwitchRegion(llvm::Region *region);
   clang::CompoundStmt *StructureSwitchRegion(llvm::Region *region);
   clang::CompoundStmt *StructureRegion(llvm::Region *region);
+  // Computes the reaching conditions of the blocks of `rpo_walk` and
+  // structures the regions of `func`, returning the statements of its body.
+  // Returns nothing if `out_of_budget` is set along the way.
+  std::vector<clang::Stmt *> StructureFunction(
+      llvm::Function &func, llvm::FunctionAnalysisManager &FAM,
+      FunctionStatistics &stats);
+
+  // Returns why the function should be emitted with `goto`s rather than
+  // structured, according to the limits in `dec_ctx`, or null if it should be
+  // structured. Only looks at `rpo_walk` and `domtree`.
+  const char *GetGotoFallbackReason();
+  // Emits the blocks of `rpo_walk` in order, each one followed by jumps to its
+  // successors, labeling the ones that are jumped to. Conditions are the
+  // edges of the branches, so reaching conditions are not needed.
+  std::vector<clang::Stmt *> CreateGotoStmts(clang::FunctionDecl *fdecl);
+
+  void CreateDeclarations(llvm::Module &M);
+  // Declares `funcs` and the global values that their bodies refer to,
+  // directly or through the initializers of variables and the aliasees of
+  // aliases, in module order
+  void CreateReferencedDeclarations(llvm::Module &M,
+                                    const std::vector<llvm::Function *> &funcs);
+  // Declares the types of `funcs` and structures their bodies, once their
+  // declarations exist
+  void GenerateBodies(const std::vector<llvm::Function *> &funcs,
+                      llvm::FunctionAnalysisManager &fam);
 
  public:
   using Result = llvm::PreservedAnalyses;
@@ -83,6 +203,40 @@ class GenerateAST : public llvm::AnalysisInfoMixin<GenerateAST> {
   Result run(llvm::Module &M, llvm::ModuleAnalysisManager &MAM);
 
   static void run(llvm::Module &M, DecompilationContext &dec_ctx);
+  // Creates declarations for every global value in `M`, but only generates
+  // bodies for the functions in `funcs`
+  static void run(llvm::Module &M, const std::vector<llvm::Function *> &funcs,
+                  DecompilationContext &dec_ctx);
+  // Same as above, but computes the dominator trees, regions and loops of
+  // `funcs` through `fam`, reusing the results it already holds. The results
+  // of each function are cleared once it has been structured, so that only
+  // one function's worth of analyses is alive at a time.
+  static void run(llvm::Module &M, const std::vector<llvm::Function *> &funcs,
+                  DecompilationContext &dec_ctx,
+                  llvm::FunctionAnalysisManager &fam);
+  // Same as `run`, but only declares `funcs` and the global values they refer
+  // to instead of the whole module. The bodies are the same, and each context
+  // only costs as much as the functions it holds. Meant for contexts whose
+  // bodies are merged into one that declares everything, see `FunctionShard`.
+  static void generateReferenced(llvm::Module &M,
+                                 const std::vector<llvm::Function *> &funcs,
+                                 DecompilationContext &dec_ctx);
+  // Declares the structure types that the bodies of `funcs` refer to, in the
+  // order they are referred to. Types are declared this way before any body
+  // is generated, so that their names and the order of their declarations do
+  // not depend on how functions are split among contexts.
+  static void DeclareTypes(const std::vector<llvm::Function *> &funcs,
+                           DecompilationContext &dec_ctx);
+  // Registers the analyses that structuring needs, and nothing else
+  static void RegisterAnalyses(llvm::FunctionAnalysisManager &fam);
+  // Replaces the declarations and bodies previously generated for `funcs`,
+  // e.g. after their IR has been modified. Provenance entries that refer to
+  // the old declarations or statements are removed. References to the old
+  // declarations from other functions are left as they are, so functions whose
+  // signature has changed should be regenerated along with their callers.
+  static void regenerate(llvm::Module &M,
+                         const std::vector<llvm::Function *> &funcs,
+                         DecompilationContext &dec_ctx);
 };
 
 }  // namespace rellic
@@ -29,15 +29,25 @@ class IRToASTVisitor {
  private:
   DecompilationContext &dec_ctx;
   ASTBuilder &ast;
+  // Conversions of Z3 subformulas made since the last `ClearConvertedExprs`,
+  // keyed by the id of the formula. `converted_keys` keeps the formulas alive
+  // so that their ids are not reused.
+  std::unordered_map<unsigned, clang::Expr *> converted;
+  z3::expr_vector converted_keys;
 
   void VisitArgument(llvm::Argument &arg);
+  clang::Expr *TranslateExpr(z3::expr expr);
+  clang::Expr *TranslateSwitchCond(z3::expr expr);
 
  public:
   IRToASTVisitor(DecompilationContext &dec_ctx);
 
   clang::Expr *CreateOperandExpr(llvm::Use &val);
   clang::Expr *CreateConstantExpr(llvm::Constant *constant);
+  // Converts `expr` to C. Subformulas that were already converted since the
+  // last `ClearConvertedExprs` are cloned instead of translated again.
   clang::Expr *ConvertExpr(z3::expr expr);
+  void ClearConvertedExprs();
 
   void VisitGlobalVar(llvm::GlobalVariable &var);
   void VisitFunctionDecl(llvm::Function &func);
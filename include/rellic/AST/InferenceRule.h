@@ -11,6 +11,9 @@
 #include <clang/ASTMatchers/ASTMatchFinder.h>
 #include <clang/ASTMatchers/ASTMatchers.h>
 
+#include <memory>
+#include <vector>
+
 #include "rellic/AST/IRToASTVisitor.h"
 
 namespace clang {
@@ -30,6 +33,12 @@ class InferenceRule : public clang::ast_matchers::MatchFinder::MatchCallback {
 
   operator bool() { return match; }
 
+  // Name the rule is reported under in the decompilation statistics
+  virtual const char *GetName() const = 0;
+
+  // Forgets the last match, so that the rule can be run on another statement
+  virtual void Reset() { match = nullptr; }
+
   const clang::ast_matchers::StatementMatcher &GetCondition() const {
     return cond;
   }
@@ -42,4 +51,31 @@ clang::Stmt *ApplyFirstMatchingRule(
     DecompilationContext &dec_ctx, clang::Stmt *stmt,
     std::vector<std::unique_ptr<InferenceRule>> &rules);
 
+// A list of rules whose matchers are registered with a single `MatchFinder`
+// when they are added, so that applying them to a statement only runs the
+// matchers. Meant to be kept for the lifetime of a pass.
+class InferenceRuleSet {
+  std::vector<std::unique_ptr<InferenceRule>> rules;
+  clang::ast_matchers::MatchFinder finder;
+
+ public:
+  void Add(std::unique_ptr<InferenceRule> rule);
+
+  // Same as `ApplyFirstMatchingRule`, using the rules in the set in the order
+  // they were added
+  clang::Stmt *Apply(DecompilationContext &dec_ctx, clang::Stmt *stmt);
+};
+
+// Rules indexed by the class of the statement they are rooted at, so that each
+// statement is only matched against the rules that can apply to it, and
+// statements of other classes are not matched at all
+class InferenceRuleEngine {
+  std::vector<std::unique_ptr<InferenceRuleSet>> sets;
+
+ public:
+  void Add(clang::Stmt::StmtClass root, std::unique_ptr<InferenceRule> rule);
+
+  clang::Stmt *Apply(DecompilationContext &dec_ctx, clang::Stmt *stmt);
+};
+
 }  // namespace rellic
\ No newline at end of file
@@ -8,8 +8,11 @@
 
 #pragma once
 
+#include <llvm/ADT/DenseMap.h>
+
 #include <unordered_map>
 #include <unordered_set>
+#include <vector>
 
 #include "rellic/AST/DebugInfoCollector.h"
 #include "rellic/AST/IRToASTVisitor.h"
@@ -23,19 +26,26 @@ class LocalDeclRenamer : public TransformVisitor<LocalDeclRenamer> {
  private:
   ValDeclToIRMap decls;
 
-  // Stores currently visible names, with scope awareness
-  std::vector<std::unordered_set<std::string>> seen_names;
+  // Number of declarations of each currently visible name. Names declared
+  // in a scope are logged, and forgotten again when the scope is left.
+  llvm::DenseMap<clang::IdentifierInfo *, unsigned> visible_names;
+  std::vector<clang::IdentifierInfo *> declared_names;
+  std::vector<size_t> scope_starts;
 
   std::unordered_set<clang::VarDecl *> renamed_decls;
-  IRToNameMap &names;
+  DebugInfoCollector &dic;
 
-  bool IsNameVisible(const std::string &name);
+  bool IsNameVisible(clang::IdentifierInfo *name);
+  void DeclareName(clang::IdentifierInfo *name);
+  void PushScope();
+  void PopScope();
 
  protected:
   void RunImpl() override;
 
  public:
-  LocalDeclRenamer(DecompilationContext &dec_ctx, IRToNameMap &names);
+  LocalDeclRenamer(DecompilationContext &dec_ctx, DebugInfoCollector &dic);
+  const char *GetName() const override { return "LocalDeclRenamer"; }
 
   bool shouldTraversePostOrder() override;
   bool VisitVarDecl(clang::VarDecl *decl);
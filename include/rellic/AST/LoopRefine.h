@@ -8,6 +8,7 @@
 
 #pragma once
 
+#include "rellic/AST/InferenceRule.h"
 #include "rellic/AST/TransformVisitor.h"
 
 namespace rellic {
@@ -30,11 +31,16 @@ namespace rellic {
  *   }
  */
 class LoopRefine : public TransformVisitor<LoopRefine> {
+ private:
+  InferenceRuleSet rules;
+
  protected:
   void RunImpl() override;
 
  public:
   LoopRefine(DecompilationContext &dec_ctx);
+  const char *GetName() const override { return "LoopRefine"; }
+  bool TracksStatements() const override { return true; }
 
   bool VisitWhileStmt(clang::WhileStmt *loop);
 };
@@ -28,6 +28,7 @@ class MaterializeConds : public TransformVisitor<MaterializeConds> {
 
  public:
   MaterializeConds(DecompilationContext &dec_ctx);
+  const char *GetName() const override { return "MaterializeConds"; }
 
   bool VisitIfStmt(clang::IfStmt *stmt);
   bool VisitWhileStmt(clang::WhileStmt *loop);
@@ -55,6 +55,9 @@ class NestedCondProp : public ASTPass {
 
  public:
   NestedCondProp(DecompilationContext& dec_ctx);
+  const char* GetName() const override { return "NestedCondProp"; }
+  // Marks the statements whose conditions it rewrites
+  bool TracksStatements() const override { return true; }
 };
 
 }  // namespace rellic
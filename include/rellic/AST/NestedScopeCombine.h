@@ -30,16 +30,23 @@ namespace rellic {
  *
  *   body1;
  */
-class NestedScopeCombine : public TransformVisitor<NestedScopeCombine> {
+class NestedScopeCombine : public LocalRewriteVisitor<NestedScopeCombine> {
+ private:
+  clang::Stmt *RewriteIf(clang::IfStmt *ifstmt);
+  clang::Stmt *RewriteWhile(clang::WhileStmt *stmt);
+  clang::Stmt *RewriteCompound(clang::CompoundStmt *compound);
+
  protected:
   void RunImpl() override;
 
  public:
   NestedScopeCombine(DecompilationContext &dec_ctx);
+  const char *GetName() const override { return "NestedScopeCombine"; }
+  unsigned GetEffects() const override { return kStatements; }
+  bool TracksStatements() const override { return true; }
 
-  bool VisitIfStmt(clang::IfStmt *ifstmt);
-  bool VisitWhileStmt(clang::WhileStmt *stmt);
-  bool VisitCompoundStmt(clang::CompoundStmt *compound);
+  void Prepare() override;
+  clang::Stmt *Rewrite(clang::Stmt *stmt) override;
 };
 
 }  // namespace rellic
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <llvm/Support/JSON.h>
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+
+#include "rellic/AST/Statistics.h"
+
+namespace llvm {
+class Function;
+}  // namespace llvm
+
+namespace rellic {
+
+// Describes the control flow of `func` coarsely enough that functions of the
+// same shape tend to get the same treatment from the passes: its number of
+// blocks and the width of its widest switch, both rounded up to a power of
+// two, and the depth of its loop nest, up to 4. Cheap to compute.
+std::string GetFunctionShape(llvm::Function &func);
+
+/*
+ * Cost and benefit of each pass on the functions of each shape, accumulated
+ * across decompilations. Passes are recorded into a profile when it is the
+ * `recorded_profile` of a context, and are not run on the shapes that a
+ * profile shows they never change when it is its `pass_profile`.
+ *
+ * Saved as JSON:
+ *
+ *   {"min_visits": 32,
+ *    "shapes": {"b4.l1.s0": {"rbr": {"visits": 120, "changes": 0,
+ *                                    "time": 0.5}, ...}, ...}}
+ *
+ * Recording is safe from several threads at once.
+ */
+class PassProfile {
+ public:
+  struct Entry {
+    // Runs of the pass on a function of the shape, and the ones that changed
+    // it
+    uint64_t visits = 0;
+    uint64_t changes = 0;
+    // Share of the wall time of those runs, split evenly between the
+    // functions each run visited
+    Duration time{0};
+  };
+
+ private:
+  mutable std::mutex mutex;
+  // By shape, then by pass name
+  std::map<std::string, std::map<std::string, Entry>> shapes;
+
+ public:
+  // Visits of a pass to the functions of a shape, none of which changed one,
+  // before the pass is skipped on that shape
+  unsigned min_visits = 32;
+
+  PassProfile() = default;
+  PassProfile(const PassProfile &other);
+  PassProfile &operator=(const PassProfile &other);
+
+  void Record(const std::string &shape, const std::string &pass, bool changed,
+              Duration time);
+  // Whether `pass` never changed a function of `shape` in `min_visits` visits
+  bool IsUseless(const std::string &shape, const std::string &pass) const;
+  void Merge(const PassProfile &other);
+  // Describes which passes are skipped on which shapes, for use in cache keys
+  std::string GetKey() const;
+
+  llvm::json::Object ToJSON() const;
+  // Returns nullopt if `json` is not a profile
+  static std::optional<PassProfile> FromJSON(const llvm::json::Value &json);
+
+  // Reads the profile saved at `path`. A missing file is an empty profile.
+  // Throws `rellic::Exception` if the file cannot be read or parsed.
+  static PassProfile Load(const std::string &path);
+  // Replaces the file at `path` atomically. Throws on failure.
+  void Save(const std::string &path) const;
+};
+
+}  // namespace rellic
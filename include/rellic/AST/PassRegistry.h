@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "rellic/AST/ASTPass.h"
+#include "rellic/AST/DebugInfoCollector.h"
+
+namespace rellic {
+
+struct PassInfo {
+  // Short name used by the tools and in pipeline descriptions
+  const char *name;
+  const char *description;
+  // Whether the pass needs debug information to be created
+  bool needs_debug_info;
+};
+
+// Returns every pass that can be created by `CreatePass`
+const std::vector<PassInfo> &GetRegisteredPasses();
+
+// Creates the refinement pass called `name`, or returns nullptr if there is no
+// such pass, or if it needs debug information and `dic` is null.
+std::unique_ptr<ASTPass> CreatePass(const std::string &name,
+                                    DecompilationContext &dec_ctx,
+                                    DebugInfoCollector *dic = nullptr);
+
+/*
+ * A sequence of pass groups, built from a textual description such as
+ *
+ *   dse,ldr,sfr;fix(zcs,ncp,fuse(nsc,cbr,rbr));fix(lr,ncp,nsc);mc,ec
+ *
+ * Groups are separated by `;`, and the passes in a group by `,`. `fix(...)`
+ * runs the passes it contains until they stop changing the AST. `fuse(...)`
+ * runs the passes it names in a single traversal, see `FusedPass`; only
+ * `nsc`, `cbr`, `rbr` and `dse` can be fused. Conditions that are no longer
+ * referenced are compacted after each group.
+ */
+class Pipeline : public ASTPass {
+  std::vector<std::unique_ptr<ASTPass>> groups;
+  std::unordered_set<std::string> names;
+
+ protected:
+  void StopImpl() override;
+  void RunImpl() override;
+
+ public:
+  Pipeline(DecompilationContext &dec_ctx) : ASTPass(dec_ctx) {}
+
+  // Throws `rellic::Exception` if `spec` is malformed or refers to a pass that
+  // cannot be created. Passes named in `excluded` are left out.
+  static std::unique_ptr<Pipeline> Parse(
+      const std::string &spec, DecompilationContext &dec_ctx,
+      DebugInfoCollector *dic = nullptr,
+      const std::unordered_set<std::string> &excluded = {});
+
+  // Whether `name` appears in the description, even if it was excluded
+  bool Uses(const std::string &name) const { return names.count(name); }
+};
+
+// The pipeline used by `Decompile` when none is specified
+std::string GetDefaultPipeline();
+
+}  // namespace rellic
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+
+namespace rellic {
+
+/*
+ * Progress of the work done on the contexts that refer to it, updated by
+ * `GenerateAST`, passes and Z3 queries as they run. Counters are atomic so
+ * that other threads can poll them while the work goes on, and the contexts
+ * of the shards of a module can share a single instance.
+ *
+ * Cancelling stops passes at their next check, `GenerateAST` after the
+ * function it is structuring, and Z3 queries before they are sent or, with
+ * `Cancel`, while they run. Whoever owns the instance resets it before
+ * starting new work.
+ */
+struct Progress {
+  // Functions structured by `GenerateAST` so far, out of the ones it has been
+  // asked to structure
+  std::atomic<size_t> functions_generated{0};
+  std::atomic<size_t> functions_total{0};
+  // Function visits made by passes so far
+  std::atomic<size_t> functions_refined{0};
+  // Iteration of the fixpoint that started last, counting from 1
+  std::atomic<unsigned> iteration{0};
+  // Queries sent to Z3 so far, i.e. solver checks and tactic applications
+  std::atomic<size_t> z3_calls{0};
+  // Time spent waiting for those queries
+  std::atomic<uint64_t> z3_nanoseconds{0};
+  // Innermost named pass that is running, or "GenerateAST"
+  std::atomic<const char *> stage{nullptr};
+  std::atomic_bool cancelled{false};
+
+  // Called after each function is structured or visited and at the start of
+  // each fixpoint iteration, possibly from several threads at once
+  std::function<void(const Progress &)> on_update;
+
+  void Update() const {
+    if (on_update) {
+      on_update(*this);
+    }
+  }
+
+  // Sets `cancelled` and runs the interrupters that are registered, from the
+  // calling thread
+  void Cancel() {
+    cancelled = true;
+    std::unique_lock<std::mutex> lock(interrupters_mutex);
+    for (auto &[key, interrupt] : interrupters) {
+      interrupt();
+    }
+  }
+
+  // Registers `interrupt` to be run by `Cancel` until it is removed with the
+  // same `key`. Interrupters must not call back into this instance.
+  void AddInterrupter(const void *key, std::function<void()> interrupt) {
+    std::unique_lock<std::mutex> lock(interrupters_mutex);
+    interrupters[key] = std::move(interrupt);
+  }
+
+  void RemoveInterrupter(const void *key) {
+    std::unique_lock<std::mutex> lock(interrupters_mutex);
+    interrupters.erase(key);
+  }
+
+  void Reset() {
+    functions_generated = 0;
+    functions_total = 0;
+    functions_refined = 0;
+    iteration = 0;
+    z3_calls = 0;
+    z3_nanoseconds = 0;
+    stage = nullptr;
+    cancelled = false;
+  }
+
+ private:
+  std::mutex interrupters_mutex;
+  std::unordered_map<const void *, std::function<void()>> interrupters;
+};
+
+}  // namespace rellic
@@ -8,6 +8,10 @@
 
 #pragma once
 
+#include <z3++.h>
+
+#include <vector>
+
 #include "rellic/AST/TransformVisitor.h"
 
 namespace rellic {
@@ -35,15 +39,33 @@ namespace rellic {
  *     body3;
  *   }
  */
-class ReachBasedRefine : public TransformVisitor<ReachBasedRefine> {
+class ReachBasedRefine : public LocalRewriteVisitor<ReachBasedRefine> {
  private:
+  // Holds the conditions of the chain being collected. Each condition `c`
+  // that joins the chain defines a fresh literal `reach <=> old_reach || c`,
+  // so that the disjunction of the chain is extended instead of rebuilt.
+  z3::solver chain_solver;
+  z3::expr reach;
+  bool chain_open{false};
+  // `if` statements of the chain being collected, kept across compounds so
+  // that it is only allocated once
+  std::vector<clang::IfStmt *> ifs;
+
+  void ResetChain();
+  void ExtendChain(z3::expr cond);
+  // Returns false if the query could not be decided
+  bool IsUnsat(z3::expr expr);
+
  protected:
   void RunImpl() override;
 
  public:
   ReachBasedRefine(DecompilationContext &dec_ctx);
+  const char *GetName() const override { return "ReachBasedRefine"; }
+  unsigned GetEffects() const override { return kStatements; }
 
-  bool VisitCompoundStmt(clang::CompoundStmt *compound);
+  void Prepare() override;
+  clang::Stmt *Rewrite(clang::Stmt *stmt) override;
 };
 
 }  // namespace rellic
\ No newline at end of file
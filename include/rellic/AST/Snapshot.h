@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <clang/Frontend/ASTUnit.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+#include <memory>
+#include <string>
+
+#include "rellic/AST/DecompilationContext.h"
+
+namespace rellic {
+
+/*
+ * The state of a decompilation session: a module, the translation unit it was
+ * decompiled into and the context needed to keep refining it.
+ *
+ * A snapshot is stored as three files sharing a prefix: the module as bitcode
+ * in `<prefix>.bc`, the translation unit as a serialized ASTUnit in
+ * `<prefix>.ast`, and in `<prefix>.json` the provenance, declaration maps,
+ * conditions and the formulas they refer to, in terms of positions in the
+ * other two files. Snapshots do not depend on the process that saved them, so
+ * they can be moved to another machine running the same version of rellic.
+ *
+ * Only state that outlives the structuring of a function is saved, so a
+ * snapshot must not be taken while a function is being generated.
+ */
+struct Snapshot {
+  std::unique_ptr<llvm::Module> module;
+  std::unique_ptr<clang::ASTUnit> ast_unit;
+  // Refers to `ast_unit`, so it is declared last to be destroyed first
+  std::unique_ptr<DecompilationContext> dec_ctx;
+};
+
+// Saves `module` and the translation unit of `dec_ctx`, which must have been
+// generated from it, with `path` as prefix. Throws if a file cannot be written.
+void SaveSnapshot(llvm::Module &module, DecompilationContext &dec_ctx,
+                  const std::string &path);
+
+// Loads the snapshot saved with `path` as prefix into `llvm_ctx`. Passes can
+// be run on the returned context, and functions can be generated again, as if
+// the session had never been interrupted. Throws if the files are missing or
+// do not match.
+Snapshot LoadSnapshot(llvm::LLVMContext &llvm_ctx, const std::string &path);
+
+}  // namespace rellic
@@ -0,0 +1,234 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <chrono>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace rellic {
+
+using Duration = std::chrono::duration<double>;
+
+// Hardware events counted on the threads that did some work, see
+// `EnableHardwareCounters`. All zero unless they are enabled.
+struct HardwareCounters {
+  uint64_t cycles = 0;
+  uint64_t instructions = 0;
+  // Misses of the last level cache
+  uint64_t cache_misses = 0;
+  uint64_t branch_misses = 0;
+
+  void Merge(const HardwareCounters &other);
+
+  llvm::json::Object ToJSON() const;
+};
+
+// Z3 work done on behalf of a pass or a function
+struct Z3Statistics {
+  // Time spent waiting for the solver
+  Duration time{0};
+  // Queries that reached the solver, and the ones answered from the caches
+  unsigned queries = 0;
+  unsigned cache_hits = 0;
+  unsigned timeouts = 0;
+  // Size in DAG nodes of the formulas given to the solver, and of the results
+  // it returned
+  uint64_t nodes_in = 0;
+  uint64_t nodes_out = 0;
+  // Size in DAG nodes of the largest formula given to the solver
+  uint64_t max_nodes = 0;
+  // Most memory in bytes that Z3 had allocated, across the whole process, when
+  // one of the queries was done
+  uint64_t peak_memory = 0;
+  HardwareCounters counters;
+
+  void Merge(const Z3Statistics &other);
+
+  llvm::json::Object ToJSON() const;
+};
+
+struct PassStatistics {
+  Duration wall_time{0};
+  // Number of times the pass was run, either directly or as a fixpoint step
+  unsigned runs = 0;
+  // Number of runs that changed the AST
+  unsigned changes = 0;
+  // Number of times the pass has been run to a fixpoint
+  unsigned fixpoints = 0;
+  // Number of times adaptive fixpoints did not run the pass on a function
+  // because it could not change it
+  unsigned skipped_functions = 0;
+  // Number of times the pass was not run on a function because a
+  // `PassProfile` shows that it never changes functions of its shape
+  unsigned profile_skipped_functions = 0;
+  // Number of times the pass skipped a subtree that did not change since it
+  // last examined it
+  unsigned skipped_subtrees = 0;
+  HardwareCounters counters;
+  Z3Statistics z3;
+};
+
+struct FunctionStatistics {
+  Duration reaching_conds_time{0};
+  Duration structuring_time{0};
+  unsigned num_blocks = 0;
+  unsigned reaching_cond_evaluations = 0;
+  // Number of times `HeavySimplify` was called on reaching conditions
+  unsigned reaching_cond_simplifications = 0;
+  // Blocks whose reaching conditions were not computed because structuring
+  // does not use them, such as the cases of switches
+  unsigned reaching_cond_skipped_blocks = 0;
+  // Time each refinement pass spent in the function, and the number of times
+  // it visited it
+  std::map<std::string, Duration> pass_time;
+  std::map<std::string, unsigned> pass_visits;
+  // Counted while `GenerateAST` structured the function
+  HardwareCounters counters;
+  Z3Statistics z3;
+};
+
+// Runs of a `fix(...)` group of the pipeline, named after its description
+struct FixpointStatistics {
+  Duration wall_time{0};
+  // Number of times the group was run to a fixpoint
+  unsigned runs = 0;
+  // Rounds that changed the AST across all runs, and in the longest run
+  unsigned rounds = 0;
+  unsigned max_rounds = 0;
+};
+
+// Bytes held by each part of the decompiler when a stage of it ends. The
+// sizes of maps include their buckets and an estimate of the overhead of
+// their nodes.
+struct MemorySnapshot {
+  // Resident set size of the process, 0 if unknown
+  uint64_t rss = 0;
+  // Nodes, types and declarations allocated by the `ASTContext`
+  uint64_t ast = 0;
+  // Everything Z3 has allocated across the process, formulas included
+  uint64_t z3 = 0;
+  // Estimate of the globals, blocks and instructions of the LLVM module,
+  // leaving out constants, types and metadata. 0 once it has been released.
+  uint64_t module = 0;
+  // References held by `z3_exprs` and the Z3 caches, and the maps from
+  // statements and IR to conditions
+  uint64_t conditions = 0;
+  // Maps from AST nodes to the IR they come from
+  uint64_t provenance = 0;
+  // Maps from IR to declarations and types, and the other maps of the context
+  uint64_t maps = 0;
+
+  // Keeps the largest figure of each part
+  void Merge(const MemorySnapshot &other);
+
+  llvm::json::Object ToJSON() const;
+};
+
+struct DecompilationStatistics {
+  // Wall time of each step that prepared the IR for decompilation
+  std::map<std::string, Duration> preprocessing;
+  std::map<std::string, PassStatistics> passes;
+  std::map<std::string, FunctionStatistics> functions;
+  std::map<std::string, FixpointStatistics> fixpoint_groups;
+  // Number of substitutions made by each inference rule
+  std::map<std::string, uint64_t> rule_hits;
+  // Peak resident set size of the process in bytes, 0 if unknown
+  uint64_t peak_rss = 0;
+  // Bytes allocated for the nodes of the resulting AST, and for the nodes of
+  // function shards, which are released once their bodies have been merged
+  uint64_t ast_memory = 0;
+  uint64_t released_ast_memory = 0;
+  // Calls to `DecompilationContext::GetQualType` that were answered from its
+  // cache, and the ones that created a type
+  uint64_t qual_type_hits = 0;
+  uint64_t qual_type_misses = 0;
+  // Functions loaded from a `FunctionCache`, and the ones that were decompiled
+  // because they were not found in it
+  uint64_t function_cache_hits = 0;
+  uint64_t function_cache_misses = 0;
+  // Variables given to large branch conditions, and the number of instruction
+  // translations they saved, net of the assignments that compute them
+  uint64_t cond_temps = 0;
+  int64_t cond_temp_savings = 0;
+  // Formulas that `HeavySimplify` simplified fully, the ones that were too
+  // large and only got cheap rewrites, and the ones it left as they were
+  uint64_t full_simplifications = 0;
+  uint64_t light_simplifications = 0;
+  uint64_t skipped_simplifications = 0;
+  // Regions that took the reaching conditions of their blocks from a region
+  // of the same shape, and the number of blocks whose condition was reused
+  uint64_t reused_regions = 0;
+  uint64_t reused_region_blocks = 0;
+  // Functions that were emitted with `goto`s instead of being structured
+  uint64_t goto_fallbacks = 0;
+  // Internal functions and global variables that were removed before
+  // decompilation because nothing referred to them
+  uint64_t dead_functions = 0;
+  uint64_t dead_variables = 0;
+  // Memory held when each stage ended, in the order the stages ran
+  std::vector<std::pair<std::string, MemorySnapshot>> memory;
+
+  // Accumulates the statistics of `other` into this object
+  void Merge(const DecompilationStatistics &other);
+
+  llvm::json::Object ToJSON() const;
+};
+
+// Writes a summary of `stats` for people deciding what to do about slow
+// inputs: the `top_functions` functions that took longest with the work that
+// dominated each, the rounds of every fixpoint group, and the hit rates of the
+// caches
+void PrintReport(const DecompilationStatistics &stats, llvm::raw_ostream &os,
+                 unsigned top_functions = 10);
+
+// Measures the wall time elapsed between construction and destruction
+class ScopedTimer {
+  Duration &out;
+  std::chrono::steady_clock::time_point start;
+
+ public:
+  ScopedTimer(Duration &out)
+      : out(out), start(std::chrono::steady_clock::now()) {}
+  ~ScopedTimer() { out += std::chrono::steady_clock::now() - start; }
+};
+
+// Makes every `ScopedCounters` count hardware events on its thread from now
+// on, with perf_event_open. Returns false, and leaves them disabled, if they
+// cannot be counted, e.g. outside of Linux, in virtual machines that do not
+// expose the counters, or when /proc/sys/kernel/perf_event_paranoid forbids
+// it.
+bool EnableHardwareCounters();
+
+// Adds the hardware events counted on the calling thread between construction
+// and destruction to `out`, if they are enabled
+class ScopedCounters {
+  HardwareCounters &out;
+  HardwareCounters start;
+  bool counting;
+
+ public:
+  ScopedCounters(HardwareCounters &out);
+  ~ScopedCounters();
+};
+
+// Returns the peak resident set size of the process so far in bytes, or 0 if
+// it cannot be measured on this platform
+uint64_t GetPeakRSS();
+// Returns the current resident set size of the process in bytes, or 0 if it
+// cannot be measured on this platform
+uint64_t GetCurrentRSS();
+
+}  // namespace rellic
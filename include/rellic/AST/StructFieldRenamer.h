@@ -23,15 +23,21 @@ class StructFieldRenamer
       public clang::RecursiveASTVisitor<StructFieldRenamer> {
  private:
   TypeDeclToIRMap decls;
-  IRTypeToDITypeMap &types;
+  DebugInfoCollector &dic;
 
  protected:
   void RunImpl() override;
 
  public:
-  StructFieldRenamer(DecompilationContext &dec_ctx, IRTypeToDITypeMap &types);
+  StructFieldRenamer(DecompilationContext &dec_ctx, DebugInfoCollector &dic);
+  const char *GetName() const override { return "StructFieldRenamer"; }
 
   bool VisitRecordDecl(clang::RecordDecl *decl);
+
+  // Renames the fields of `decl` alone, without traversing the translation
+  // unit. Used for declarations that are handed out as soon as they are
+  // created, and must not be renamed again by `Run`.
+  void RenameFields(clang::RecordDecl *decl);
 };
 
 }  // namespace rellic
\ No newline at end of file
@@ -8,20 +8,31 @@
 
 #pragma once
 
+#include <clang/AST/ASTImporter.h>
 #include <clang/AST/Decl.h>
 #include <llvm/IR/DebugInfoMetadata.h>
 
 #include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 
 #include "rellic/AST/ASTBuilder.h"
 
 namespace rellic {
-struct OffsetDIDerivedType;
+class TypePrelude;
+
+struct OffsetDIDerivedType {
+  uint64_t offset;
+  llvm::DIDerivedType* type;
+};
 
 class StructGenerator {
+  clang::ASTUnit& ast_unit;
   clang::ASTContext& ast_ctx;
   rellic::ASTBuilder ast;
   std::unordered_map<llvm::DICompositeType*, clang::RecordDecl*>
@@ -29,11 +40,33 @@ class StructGenerator {
   std::unordered_map<llvm::DICompositeType*, clang::QualType> enum_types{};
   std::unordered_map<llvm::DIDerivedType*, clang::TypedefNameDecl*>
       typedef_decls{};
+  // Debug information that describes the same type more than once, e.g. a
+  // struct defined in several compilation units, is collapsed onto the first
+  // description seen, so that it only gets one declaration
+  std::unordered_map<uint64_t, llvm::DIType*> canonical_types{};
+  std::unordered_map<llvm::DIType*, llvm::DIType*> canonical_of{};
+  std::unordered_map<llvm::DIType*, uint64_t> type_keys{};
+  std::unordered_map<llvm::DICompositeType*, std::vector<OffsetDIDerivedType>>
+      composite_fields{};
+  unsigned num_workers;
   std::unordered_set<std::string> visible_structs;
   std::unordered_set<std::string> visible_unions;
   std::unordered_set<std::string> visible_enums;
   std::unordered_set<std::string> visible_tdefs;
   std::unordered_set<std::string> visible_values;
+  // Declarations of types found in a prelude are imported from it instead of
+  // being generated
+  TypePrelude* prelude{nullptr};
+  std::unique_ptr<clang::ASTImporter> importer;
+  std::unordered_set<clang::Decl*> prelude_decls;
+
+  clang::TypeDecl* ImportFromPrelude(llvm::DIType* t);
+
+  llvm::DIType* Canonicalize(llvm::DIType* t);
+  // Computes the keys `Canonicalize` uses for every type reachable from
+  // `roots` on `num_workers` threads
+  void ComputeTypeKeys(const std::vector<llvm::DIType*>& roots);
+  const std::vector<OffsetDIDerivedType>& GetFields(llvm::DICompositeType* s);
 
   using DeclToDbgInfo =
       std::unordered_map<clang::FieldDecl*, OffsetDIDerivedType>;
@@ -46,7 +79,7 @@ class StructGenerator {
   clang::QualType GetEnumDecl(llvm::DICompositeType* t);
 
   void DefineNonPackedStruct(clang::RecordDecl* decl,
-                             std::vector<OffsetDIDerivedType>& fields);
+                             const std::vector<OffsetDIDerivedType>& fields);
   uint64_t GetLayoutSize(const clang::ASTRecordLayout& layout);
 
   clang::QualType BuildArray(llvm::DICompositeType* a);
@@ -63,25 +96,99 @@ class StructGenerator {
   void VisitType(llvm::DIType* t, std::vector<llvm::DICompositeType*>& list,
                  std::unordered_set<llvm::DIType*>& visited);
 
+  // Where the fields of a record lie, in bits from its start, found through
+  // the records nested in it once rather than on every `GetAccessor`
+  struct FieldIndex {
+    struct Entry {
+      uint64_t offset;
+      uint64_t size;
+      // Fields accessed one after the other to reach it
+      std::vector<clang::FieldDecl*> path;
+      // Desugared type of the last field of `path`
+      clang::QualType type;
+    };
+    // Scalar fields, by offset, in declaration order for the same offset
+    std::vector<Entry> scalars;
+    // Array fields, whose elements are only looked at when queried
+    std::vector<Entry> arrays;
+    // Indices in `scalars` of the fields matching the ranges queried recently
+    std::map<std::pair<uint64_t, uint64_t>, std::vector<unsigned>> cache;
+  };
+  std::unordered_map<clang::RecordDecl*, FieldIndex> field_indices;
+  void IndexFields(clang::RecordDecl* decl, uint64_t offset,
+                   std::vector<clang::FieldDecl*>& path, FieldIndex& index);
+  FieldIndex& GetFieldIndex(clang::RecordDecl* decl);
+  const std::vector<unsigned>& FindScalars(FieldIndex& index, uint64_t offset,
+                                           uint64_t length);
+  // A step of an accessor: a field, or an array element if `field` is null
+  struct AccessStep {
+    clang::FieldDecl* field;
+    uint64_t index;
+  };
+  using AccessPath = std::vector<AccessStep>;
+  // Appends to `res` the accessors of [offset, offset + length) in a record
+  // or in a value of `type`, each of them after `prefix`
+  void FindAccessPaths(clang::RecordDecl* decl, uint64_t offset,
+                       uint64_t length, AccessPath& prefix,
+                       std::vector<AccessPath>& res);
+  void FindAccessPaths(clang::QualType type, uint64_t offset, uint64_t length,
+                       AccessPath& prefix, std::vector<AccessPath>& res);
+
  public:
-  StructGenerator(clang::ASTUnit& ast_unit);
+  // With `num_workers` other than 1, the types passed to `GenerateDecls` are
+  // hashed on that many threads (0 uses all available hardware threads).
+  // Declarations are always created on the calling thread, in the same order.
+  StructGenerator(clang::ASTUnit& ast_unit, unsigned num_workers = 1);
 
   clang::QualType GetType(llvm::DIType* t);
 
+  // Reuses the declarations of `prelude` for the types it contains, and keeps
+  // the names it declares from being used by other types. Must be called
+  // before any type is generated. `prelude` must outlive the generator.
+  void UsePrelude(TypePrelude& prelude);
+  // Whether `decl` was imported from the prelude, either as a type found in it
+  // or as something that one of them refers to
+  bool IsFromPrelude(clang::Decl* decl) const {
+    return prelude_decls.count(decl);
+  }
+  // Declarations of the types seen so far, keyed by `GetDITypeHash` of the
+  // debug information they were generated from
+  std::unordered_map<uint64_t, clang::TypeDecl*> GetTypeDecls();
+
+  // Drops what was read from the debug information of `t` about its fields.
+  // It is read again if needed, e.g. if `t` is the base of a type generated
+  // later.
+  void ReleaseFields(llvm::DICompositeType* t) { composite_fields.erase(t); }
+
+  // Declares the types of [begin, end) and everything they refer to. Forward
+  // declarations come first, then definitions in dependency order.
+  // `on_defined`, if not empty, is called after each definition, at which
+  // point every declaration it needs is in the translation unit.
   template <typename It>
-  void GenerateDecls(It begin, It end) {
+  void GenerateDecls(
+      It begin, It end,
+      const std::function<void(llvm::DICompositeType*)>& on_defined = {}) {
     std::unordered_set<std::string> visible_types;
     std::vector<llvm::DICompositeType*> sorted_types{};
     std::unordered_set<llvm::DIType*> visited_types{};
+    if (num_workers != 1) {
+      ComputeTypeKeys(std::vector<llvm::DIType*>(begin, end));
+    }
     for (auto i{begin}; i != end; ++i) {
       VisitType(*i, sorted_types, visited_types);
     }
 
     for (auto type : sorted_types) {
       DefineComposite(type);
+      if (on_defined) {
+        on_defined(type);
+      }
     }
   }
 
+  // Accesses to the scalar fields of `decl`, or the elements of its arrays,
+  // that are exactly [offset, offset + length) bits into `base`. Several of
+  // them can fit if they are in a union.
   std::vector<clang::Expr*> GetAccessor(clang::Expr* base,
                                         clang::RecordDecl* decl,
                                         unsigned offset, unsigned length);
@@ -11,6 +11,7 @@
 #include <clang/AST/RecursiveASTVisitor.h>
 
 #include <unordered_map>
+#include <vector>
 
 #include "rellic/AST/ASTPass.h"
 #include "rellic/AST/Util.h"
@@ -19,18 +20,73 @@ namespace rellic {
 
 using StmtSubMap = std::unordered_map<clang::Stmt *, clang::Stmt *>;
 
+/*
+ * Base of the passes that replace statements while traversing the AST in
+ * post-order. `Substitute` patches the slot that holds the statement in its
+ * parent as soon as it is called, by keeping track of the statements whose
+ * children are being traversed, so that nothing needs to be probed when the
+ * parents are visited later.
+ *
+ * Passes that track statements skip the subtrees they examined and left
+ * alone, for as long as `dec_ctx.subtree_changes` shows that nothing in them
+ * changed since. They must only look at a statement and the ones below it,
+ * and change nothing but through `Substitute`, or mark what else they change.
+ */
 template <typename Derived>
 class TransformVisitor : public ASTPass,
                          public clang::RecursiveASTVisitor<Derived> {
- protected:
-  StmtSubMap substitutions;
+  // Statements whose children are being traversed, innermost last
+  std::vector<clang::Stmt *> parents;
+  clang::FunctionDecl *current_function{nullptr};
 
-  void CopyProvenance(clang::Stmt *from, clang::Stmt *to) {
-    ::rellic::CopyProvenance(from, to, dec_ctx.stmt_provenance);
+  // When the statements were last examined by a run that left their subtrees
+  // unchanged, and the statements entered in the current function
+  std::unordered_map<clang::Stmt *, unsigned> examined;
+  std::vector<clang::Stmt *> entered;
+  // Time of the current run in `dec_ctx.subtree_changes`
+  unsigned run_time{0};
+
+  bool IsUnchanged(clang::Stmt *stmt) const {
+    auto it{examined.find(stmt)};
+    return it != examined.end() &&
+           dec_ctx.subtree_changes.LastChange(current_function, stmt) <
+               it->second;
   }
 
-  void CopyProvenance(clang::Expr *from, clang::Expr *to) {
-    ::rellic::CopyProvenance(from, to, dec_ctx.use_provenance);
+  // Marks `stmt` and the statements above it as changed
+  void MarkChanged(clang::Stmt *stmt) {
+    auto &changes{dec_ctx.subtree_changes};
+    changes.Mark(stmt);
+    for (auto parent : parents) {
+      changes.Mark(parent);
+    }
+  }
+
+  // Remembers the statements of `fdecl` that were entered and not changed
+  // by the run, once all of them have been visited
+  void RecordExamined(clang::FunctionDecl *fdecl) {
+    auto &changes{dec_ctx.subtree_changes};
+    for (auto stmt : entered) {
+      if (changes.LastChange(fdecl, stmt) < run_time) {
+        examined[stmt] = run_time;
+      }
+    }
+  }
+
+  // Replacements that could not be applied directly, e.g. because `from` is
+  // not a child of the statement being traversed. They are applied when the
+  // parents of `from` are visited.
+  StmtSubMap substitutions;
+
+  void CopyAllProvenance(clang::Stmt *from, clang::Stmt *to) {
+    if (!to) {
+      return;
+    }
+    CopyProvenance(from, to);
+    if (clang::isa<clang::Expr>(from) && clang::isa<clang::Expr>(to)) {
+      CopyProvenance(clang::cast<clang::Expr>(from),
+                     clang::cast<clang::Expr>(to));
+    }
   }
 
   bool ReplaceChildren(clang::Stmt *stmt, StmtSubMap &repl_map) {
@@ -39,28 +95,131 @@ class TransformVisitor : public ASTPass,
       auto s_it = repl_map.find(*c_it);
       if (s_it != repl_map.end()) {
         *c_it = s_it->second;
-        CopyProvenance(s_it->first, s_it->second);
-        if (clang::isa<clang::Expr>(s_it->first) &&
-            clang::isa<clang::Expr>(s_it->second)) {
-          auto from_expr{clang::cast<clang::Expr>(s_it->first)};
-          auto to_expr{clang::cast<clang::Expr>(s_it->second)};
-          CopyProvenance(from_expr, to_expr);
-        }
+        CopyAllProvenance(s_it->first, s_it->second);
         change = true;
       }
     }
+    if (change) {
+      MarkChanged(stmt);
+    }
     return change;
   }
 
-  void RunImpl() override { substitutions.clear(); }
+ protected:
+  void CopyProvenance(clang::Stmt *from, clang::Stmt *to) {
+    ::rellic::CopyProvenance(from, to, dec_ctx.stmt_provenance);
+  }
+
+  void CopyProvenance(clang::Expr *from, clang::Expr *to) {
+    ::rellic::CopyProvenance(from, to, dec_ctx.use_provenance);
+  }
+
+  // Replaces `from` with `to` in its parent, which may be null to remove it
+  // from a compound statement. Meant to be called while visiting `from`.
+  void Substitute(clang::Stmt *from, clang::Stmt *to) {
+    MarkChanged(from);
+    if (parents.empty()) {
+      if (current_function && current_function->getBody() == from) {
+        current_function->setBody(to);
+        CopyAllProvenance(from, to);
+        changed = true;
+        return;
+      }
+    } else {
+      for (auto &child : parents.back()->children()) {
+        if (child == from) {
+          child = to;
+          CopyAllProvenance(from, to);
+          changed = true;
+          return;
+        }
+      }
+    }
+    substitutions[from] = to;
+  }
+
+  void RunImpl() override {
+    parents.clear();
+    substitutions.clear();
+    entered.clear();
+    run_time = dec_ctx.subtree_changes.clock;
+  }
+
+  // Traverses the bodies of the functions in scope, rather than the whole
+  // translation unit
+  void TraverseFunctions() {
+    for (auto fdecl : GetFunctionsInScope()) {
+      if (!this->TraverseDecl(fdecl)) {
+        break;
+      }
+    }
+  }
 
  public:
   TransformVisitor(DecompilationContext &dec_ctx) : ASTPass(dec_ctx) {}
 
   virtual bool shouldTraversePostOrder() { return true; }
 
+  // Skips the subtrees that are known to be left unchanged
+  bool dataTraverseStmtPre(clang::Stmt *stmt) {
+    if (TracksStatements()) {
+      if (IsUnchanged(stmt)) {
+        if (auto stats = GetStatistics()) {
+          ++stats->skipped_subtrees;
+        }
+        return false;
+      }
+      entered.push_back(stmt);
+    }
+    parents.push_back(stmt);
+    return true;
+  }
+
+  // Called after the children of `stmt` are traversed, but before `stmt` itself
+  // is visited, so that its own parent is on top of the stack by then
+  bool dataTraverseStmtPost(clang::Stmt *stmt) {
+    parents.pop_back();
+    return true;
+  }
+
+  bool TraverseFunctionDecl(clang::FunctionDecl *fdecl) {
+    if (!InScope(fdecl)) {
+      return true;
+    }
+    // Keep track of which function is being refined so that its time can be
+    // accounted against its budget, and so that fixpoints only revisit the
+    // functions that changed
+    auto changed_before{changed};
+    changed = false;
+    auto function_before{current_function};
+    current_function = fdecl;
+    dec_ctx.EnterFunction(fdecl);
+    auto result{
+        clang::RecursiveASTVisitor<Derived>::TraverseFunctionDecl(fdecl)};
+    // Statements entered by an interrupted traversal may not have been
+    // visited, and functions out of budget are left alone
+    if (result && !Stopped() && !dec_ctx.OutOfBudget()) {
+      RecordExamined(fdecl);
+    }
+    entered.clear();
+    dec_ctx.LeaveFunction();
+    if (auto progress = dec_ctx.progress) {
+      ++progress->functions_refined;
+      progress->Update();
+    }
+    current_function = function_before;
+    if (changed) {
+      MarkModified(fdecl);
+    }
+    changed |= changed_before;
+    return result;
+  }
+
   bool VisitFunctionDecl(clang::FunctionDecl *fdecl) {
     // DLOG(INFO) << "VisitFunctionDecl";
+    if (substitutions.empty()) {
+      return !Stopped();
+    }
     if (auto body = fdecl->getBody()) {
       auto iter = substitutions.find(body);
       if (iter != substitutions.end()) {
@@ -73,9 +232,93 @@ class TransformVisitor : public ASTPass,
 
   bool VisitStmt(clang::Stmt *stmt) {
     // DLOG(INFO) << "VisitStmt";
-    changed |= ReplaceChildren(stmt, substitutions);
+    if (!substitutions.empty()) {
+      changed |= ReplaceChildren(stmt, substitutions);
+    }
     return !Stopped();
   }
 };
 
+/*
+ * Vectors of statements that are handed out to build the bodies of new
+ * compound statements, and returned when the buffer that holds one goes out
+ * of scope, so that rewrites only allocate until the vectors have grown to
+ * the largest body they are used for.
+ */
+class StmtBufferPool {
+  std::vector<std::vector<clang::Stmt *>> free;
+
+ public:
+  class Buffer {
+    StmtBufferPool &pool;
+    std::vector<clang::Stmt *> stmts;
+
+   public:
+    Buffer(StmtBufferPool &pool) : pool(pool) {
+      if (!pool.free.empty()) {
+        stmts = std::move(pool.free.back());
+        pool.free.pop_back();
+        stmts.clear();
+      }
+    }
+    ~Buffer() { pool.free.push_back(std::move(stmts)); }
+    Buffer(const Buffer &) = delete;
+    Buffer &operator=(const Buffer &) = delete;
+
+    std::vector<clang::Stmt *> &operator*() { return stmts; }
+    std::vector<clang::Stmt *> *operator->() { return &stmts; }
+  };
+
+  // Returns an empty vector
+  Buffer Get() { return Buffer(*this); }
+};
+
+/*
+ * A refinement that rewrites each statement by looking only at the statement
+ * and its children, once the children have been rewritten. Such refinements
+ * can be applied one after the other to every statement of a single
+ * post-order traversal, see `FusedPass`.
+ */
+class LocalRewrite {
+ public:
+  virtual ~LocalRewrite() = default;
+
+  // Called before every traversal, with the scope of the pass already set
+  virtual void Prepare() {}
+  // Returns the statement that replaces `stmt`, which is `stmt` itself if it
+  // is left alone, or nullptr to remove it from its compound statement
+  virtual clang::Stmt *Rewrite(clang::Stmt *stmt) = 0;
+};
+
+// Base of the passes that are a `LocalRewrite`, which also run on their own
+template <typename Derived>
+class LocalRewriteVisitor : public TransformVisitor<Derived>,
+                            public LocalRewrite {
+ protected:
+  // Compounds are inspected in place, and only copied into one of these once
+  // they need to be rewritten
+  StmtBufferPool buffers;
+
+  void RunImpl() override {
+    TransformVisitor<Derived>::RunImpl();
+    Prepare();
+    this->TraverseFunctions();
+  }
+
+ public:
+  LocalRewriteVisitor(DecompilationContext &dec_ctx)
+      : TransformVisitor<Derived>(dec_ctx) {}
+
+  bool VisitStmt(clang::Stmt *stmt) {
+    if (!TransformVisitor<Derived>::VisitStmt(stmt)) {
+      return false;
+    }
+    auto sub{Rewrite(stmt)};
+    if (sub != stmt) {
+      this->Substitute(stmt, sub);
+    }
+    return !this->Stopped();
+  }
+};
+
 }  // namespace rellic
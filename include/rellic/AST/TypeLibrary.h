@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Decl.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/StringMap.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "rellic/AST/TypeProvider.h"
+
+namespace rellic {
+
+/*
+ * Prototypes of functions and types of global variables, keyed by symbol
+ * name, along with the structs, unions and typedefs they refer to, in a
+ * binary form that is used where it is mapped instead of being parsed. A
+ * library is built once from C headers by `TypeLibraryBuilder`, e.g. with
+ * rellic-typelib, and processes that load the same file share its pages.
+ *
+ * The file is a header followed by tables of fixed-size entries made of
+ * 32-bit integers, in the byte order of the machine that built it: types,
+ * records, fields, symbols sorted by name, lists of parameter types, and
+ * the NUL-terminated strings that the other tables refer to by offset.
+ * Types other than records only refer to types before them, so they can be
+ * rebuilt without cycles; records are where recursion goes through.
+ */
+class TypeLibrary {
+ public:
+  enum class TypeKind : uint8_t {
+    Builtin,
+    Pointer,
+    Array,
+    Function,
+    Record,
+    Typedef
+  };
+
+  // Builtin types by a number of their own, which unlike the kinds of clang
+  // do not change between versions
+  enum class Builtin : uint8_t {
+    Void,
+    Bool,
+    Char,
+    SChar,
+    UChar,
+    Short,
+    UShort,
+    Int,
+    UInt,
+    Long,
+    ULong,
+    LongLong,
+    ULongLong,
+    Int128,
+    UInt128,
+    Float,
+    Double,
+    LongDouble
+  };
+
+  // Bits of `TypeEntry::flags`
+  static constexpr uint32_t kConst{1};
+  static constexpr uint32_t kVolatile{2};
+  static constexpr uint32_t kRestrict{4};
+  static constexpr uint32_t kVariadic{8};
+  static constexpr uint32_t kNoProto{16};
+  static constexpr uint32_t kIncompleteArray{32};
+  // Bits of `RecordEntry::flags`
+  static constexpr uint32_t kUnion{1};
+  static constexpr uint32_t kComplete{2};
+  // Bits of `FieldEntry::flags`
+  static constexpr uint32_t kBitField{1};
+
+  // Builtins have their kind in `a`, pointers their pointee. Arrays have
+  // their element in `a` and their size in `b` and `c`, low half first.
+  // Functions have their return type in `a`, and `c` parameters listed from
+  // index `b`. Records have the index of their record in `a`, and typedefs
+  // their name in `a` and the type they stand for in `b`.
+  struct TypeEntry {
+    uint32_t kind;
+    uint32_t flags;
+    uint32_t a, b, c;
+  };
+
+  struct RecordEntry {
+    uint32_t name;
+    uint32_t flags;
+    uint32_t first_field;
+    uint32_t num_fields;
+  };
+
+  struct FieldEntry {
+    uint32_t name;
+    uint32_t type;
+    uint32_t flags;
+    uint32_t bit_width;
+  };
+
+  enum class SymbolKind : uint32_t { Function, Variable };
+
+  struct SymbolEntry {
+    uint32_t name;
+    uint32_t kind;
+    uint32_t type;
+  };
+
+  struct Header {
+    char magic[4];
+    uint32_t version;
+    uint32_t triple;
+    uint32_t num_types;
+    uint32_t num_records;
+    uint32_t num_fields;
+    uint32_t num_symbols;
+    uint32_t num_indices;
+    uint32_t strings_size;
+  };
+
+  static constexpr char kMagic[4]{'R', 'T', 'L', 'B'};
+  static constexpr uint32_t kVersion{1};
+
+ private:
+  std::unique_ptr<llvm::MemoryBuffer> buffer;
+  const Header *header;
+  const TypeEntry *types;
+  const RecordEntry *records;
+  const FieldEntry *fields;
+  const SymbolEntry *symbols;
+  const uint32_t *indices;
+  const char *strings;
+
+  TypeLibrary() = default;
+
+ public:
+  // Maps the library at `path`. Throws if it cannot be read, or is not a
+  // library of this version.
+  static std::shared_ptr<const TypeLibrary> Load(const std::string &path);
+  // Same with the contents of a library. Throws if they are not one.
+  static std::shared_ptr<const TypeLibrary> Load(
+      std::unique_ptr<llvm::MemoryBuffer> buffer);
+
+  // Target triple of the headers the library was built from
+  llvm::StringRef GetTriple() const { return GetString(header->triple); }
+  // Returns the symbol `name` if it is of `kind`, or null
+  const SymbolEntry *Lookup(llvm::StringRef name, SymbolKind kind) const;
+
+  // Accessors that return null when an index is out of range
+  const TypeEntry *GetType(uint32_t idx) const;
+  const RecordEntry *GetRecord(uint32_t idx) const;
+  const FieldEntry *GetField(uint32_t idx) const;
+  const uint32_t *GetIndex(uint32_t idx) const;
+  // Returns an empty string for offsets out of range
+  llvm::StringRef GetString(uint32_t offset) const;
+};
+
+// Collects the prototypes of functions and the types of variables declared
+// in a translation unit, and writes them as a `TypeLibrary`
+class TypeLibraryBuilder {
+  clang::ASTContext &ast_ctx;
+  std::vector<TypeLibrary::TypeEntry> types;
+  std::vector<TypeLibrary::RecordEntry> records;
+  std::vector<TypeLibrary::FieldEntry> fields;
+  std::vector<std::pair<std::string, TypeLibrary::SymbolEntry>> symbols;
+  std::vector<uint32_t> indices;
+  std::string strings;
+  llvm::StringMap<uint32_t> string_offsets;
+  uint32_t triple;
+  // Indices of the types and records added so far, types by opaque
+  // `clang::QualType` and records by canonical declaration
+  llvm::DenseMap<void *, uint32_t> type_indices;
+  llvm::DenseMap<const clang::RecordDecl *, uint32_t> record_indices;
+
+  uint32_t AddString(llvm::StringRef str);
+  uint32_t AddEntry(TypeLibrary::TypeEntry entry);
+  uint32_t AddRecord(const clang::RecordDecl *decl);
+  // Returns the index of `type`, or `kInvalid` if it cannot be stored
+  uint32_t AddType(clang::QualType type);
+
+ public:
+  static constexpr uint32_t kInvalid{~0U};
+
+  TypeLibraryBuilder(clang::ASTContext &ast_ctx);
+  // Adds the type of a function or variable under its name. Returns false if
+  // it is of neither kind, or of a type that cannot be stored. Later
+  // declarations of a name replace earlier ones.
+  bool Add(const clang::DeclaratorDecl *decl);
+  // Returns the contents of the library
+  std::string Serialize() const;
+  // Writes the library to `path`. Throws if it cannot be written.
+  void Save(const std::string &path) const;
+};
+
+// Answers with the types of the symbols found in a library, declaring the
+// records and typedefs they refer to in the translation unit the first time
+// they are used. Functions are only answered for when the number of their
+// parameters and the types of the IR match the prototype, since the IR of
+// functions that pass records by value does not.
+class TypeLibraryProvider : public TypeProvider {
+  std::shared_ptr<const TypeLibrary> library;
+  // Whether the library was built for the target of the translation unit
+  bool matches_target;
+  llvm::DenseMap<uint32_t, clang::QualType> built_types;
+
+  clang::QualType BuildType(uint32_t idx);
+  clang::QualType BuildRecord(uint32_t idx, const TypeLibrary::TypeEntry &type);
+  // Returns the function type entry for `func`, if its prototype matches
+  const TypeLibrary::TypeEntry *GetFunctionType(llvm::Function &func);
+
+ public:
+  TypeLibraryProvider(DecompilationContext &dec_ctx,
+                      std::shared_ptr<const TypeLibrary> library);
+
+  clang::QualType GetFunctionReturnType(llvm::Function &func) override;
+  clang::QualType GetArgumentType(llvm::Argument &arg) override;
+  clang::QualType GetGlobalVarType(llvm::GlobalVariable &gvar) override;
+};
+
+}  // namespace rellic
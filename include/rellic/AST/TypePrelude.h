@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <clang/AST/Decl.h>
+#include <clang/Frontend/ASTUnit.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+
+namespace rellic {
+
+// Hash of the structure of `type` and of every type it refers to, which does
+// not depend on the module it comes from. Types that would be generated the
+// same way by `StructGenerator` have the same hash.
+uint64_t GetDITypeHash(llvm::DIType *type);
+
+/*
+ * Type declarations generated once by `StructGenerator` and shared by the
+ * modules of a project, so that each of them only declares the types that are
+ * not in the prelude.
+ *
+ * A prelude is stored as three files sharing a prefix: the declarations as C
+ * in `<prefix>.h`, for the output of the modules to include, the translation
+ * unit they were generated in as a serialized ASTUnit in `<prefix>.ast`, and
+ * in `<prefix>.json` the hashes of the debug information types that each
+ * declaration was generated from.
+ */
+class TypePrelude {
+  std::unique_ptr<clang::ASTUnit> ast_unit;
+  std::string header;
+  std::unordered_map<uint64_t, clang::TypeDecl *> decls;
+
+  TypePrelude() = default;
+
+ public:
+  using DeclMap = std::unordered_map<uint64_t, clang::TypeDecl *>;
+
+  // Loads the prelude saved with `path` as prefix, which must have been
+  // generated for `triple`. Throws if the files are missing or do not match.
+  static std::unique_ptr<TypePrelude> Load(const std::string &path,
+                                           const std::string &triple);
+
+  // Saves every declaration of `ast_unit`, of which `decls` are the types that
+  // modules can reuse, with `path` as prefix. Throws if a file cannot be
+  // written.
+  static void Save(clang::ASTUnit &ast_unit, const DeclMap &decls,
+                   const std::string &path);
+
+  clang::ASTUnit &GetASTUnit() { return *ast_unit; }
+  // Path of the header that declares the types of the prelude
+  const std::string &GetHeader() const { return header; }
+  // Returns the declaration generated from a type with hash `hash`, or null
+  clang::TypeDecl *Lookup(uint64_t hash) const;
+};
+
+}  // namespace rellic
@@ -7,9 +7,11 @@
  */
 
 #pragma once
+#include <llvm/ADT/DenseMap.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/IR/Function.h>
 #include <llvm/IR/GlobalVariable.h>
+#include <llvm/IR/Module.h>
 
 #include "rellic/AST/ASTBuilder.h"
 
@@ -35,18 +37,27 @@ class TypeProvider {
   // Returns the type of a global variable if available.
   // A null return value is assumed to mean that no info is available.
   virtual clang::QualType GetGlobalVarType(llvm::GlobalVariable& gvar);
+
+  // Called before the functions, arguments and global variables of `module`
+  // are queried, so that providers whose answers are expensive to get, e.g.
+  // from an external database, can get all of them at once.
+  virtual void Prefetch(llvm::Module& module);
 };
 
+// Asks its providers in reverse order of addition, and remembers the first
+// answer it gets for each value.
 class TypeProviderCombiner : public TypeProvider {
  private:
   std::vector<std::unique_ptr<TypeProvider>> providers;
+  llvm::DenseMap<llvm::Function*, clang::QualType> return_types;
+  llvm::DenseMap<llvm::Argument*, clang::QualType> arg_types;
+  llvm::DenseMap<llvm::GlobalVariable*, clang::QualType> gvar_types;
 
  public:
   TypeProviderCombiner(DecompilationContext& dec_ctx);
   template <typename T, typename... TArgs>
   void AddProvider(TArgs&&... args) {
-    providers.push_back(
-        std::make_unique<T>(dec_ctx, std::forward<TArgs>(args)...));
+    AddProvider(std::make_unique<T>(dec_ctx, std::forward<TArgs>(args)...));
   }
 
   void AddProvider(std::unique_ptr<TypeProvider> provider);
@@ -54,5 +65,10 @@ class TypeProviderCombiner : public TypeProvider {
   clang::QualType GetFunctionReturnType(llvm::Function& func) override;
   clang::QualType GetArgumentType(llvm::Argument& arg) override;
   clang::QualType GetGlobalVarType(llvm::GlobalVariable& gvar) override;
+  void Prefetch(llvm::Module& module) override;
+
+  // Forgets the answers given so far, e.g. because the values they were
+  // about may have been freed
+  void ClearCache();
 };
 }  // namespace rellic
\ No newline at end of file
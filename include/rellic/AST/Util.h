@@ -8,27 +8,72 @@
 
 #pragma once
 
+#include <llvm/Support/JSON.h>
+
+#include <unordered_map>
+#include <vector>
+
 #include "rellic/AST/DecompilationContext.h"
 
 namespace rellic {
 
 unsigned GetHash(clang::ASTContext &ctx, clang::Stmt *stmt);
 bool IsEquivalent(clang::Expr *a, clang::Expr *b);
+
+// Structural hashes of expressions that agree with `IsEquivalent`: equivalent
+// expressions have the same hash and the same number of nodes. Results are
+// memoized, so an instance must not outlive changes to the expressions it has
+// seen, unless it is told about them through `Invalidate`.
+class ExprHasher {
+ public:
+  struct Info {
+    size_t hash;
+    unsigned size;
+  };
+
+ private:
+  std::unordered_map<const clang::Expr *, Info> cache;
+
+ public:
+  Info Get(clang::Expr *expr);
+  void Invalidate(clang::Expr *expr) { cache.erase(expr); }
+};
+
+// Same as above, but mismatching hashes are rejected without a full comparison
+bool IsEquivalent(clang::Expr *a, clang::Expr *b, ExprHasher &hasher);
+
 template <typename TFrom, typename TIn>
-bool Replace(TFrom *from, clang::Expr *to, TIn **in) {
+bool Replace(TFrom *from, clang::Expr *to, TIn **in, ExprHasher &hasher) {
   auto from_expr{clang::cast<clang::Expr>(from)};
   auto in_expr{clang::cast<clang::Expr>(*in)};
-  if (IsEquivalent(in_expr, from_expr)) {
-    *in = to;
-    return true;
-  } else {
-    bool changed{false};
-    for (auto child{(*in)->child_begin()}; child != (*in)->child_end();
-         ++child) {
-      changed |= Replace(from_expr, to, &*child);
+  auto from_info{hasher.Get(from_expr)};
+  auto in_info{hasher.Get(in_expr)};
+  // Subtrees smaller than `from` cannot contain it, and neither can subtrees
+  // of the same size that are not equivalent to it
+  if (in_info.size <= from_info.size) {
+    if (in_info.size == from_info.size && in_info.hash == from_info.hash &&
+        IsEquivalent(in_expr, from_expr)) {
+      *in = to;
+      return true;
     }
-    return changed;
+    return false;
   }
+
+  bool changed{false};
+  for (auto child{(*in)->child_begin()}; child != (*in)->child_end();
+       ++child) {
+    changed |= Replace(from_expr, to, &*child, hasher);
+  }
+  if (changed) {
+    hasher.Invalidate(in_expr);
+  }
+  return changed;
+}
+
+template <typename TFrom, typename TIn>
+bool Replace(TFrom *from, clang::Expr *to, TIn **in) {
+  ExprHasher hasher;
+  return Replace(from, to, in, hasher);
 }
 
 template <typename T>
@@ -51,6 +96,44 @@ void CopyProvenance(TKey1 *from, TKey2 *to,
 clang::Expr *Clone(clang::ASTUnit &unit, clang::Expr *stmt,
                    DecompilationContext::ExprToUseMap &provenance);
 
+// Returns the statements in the bodies of functions and in the initializers
+// of global variables
+std::unordered_set<clang::Stmt *> GetReachableStmts(clang::ASTContext &ctx);
+
+// Lists the declarations of a translation unit in lexical order, each function
+// followed by its parameters. The order is preserved by AST serialization, so
+// positions identify declarations across a save and load.
+void EnumerateDecls(clang::DeclContext *dc, std::vector<clang::Decl *> &decls);
+
+// Lists the nodes of a statement tree in preorder, in the same order as
+// `ZipStmts` visits them
+void EnumerateStmts(clang::Stmt *stmt, std::vector<clang::Stmt *> &stmts);
+
+// Records the correspondence between the nodes of a statement tree and the
+// ones of its imported copy
+void ZipStmts(clang::Stmt *from, clang::Stmt *to,
+              std::unordered_map<clang::Stmt *, clang::Stmt *> &map);
+
+// Maps the elements of `vec` to their first position in it
+template <typename T>
+std::unordered_map<T *, int64_t> Invert(const std::vector<T *> &vec) {
+  std::unordered_map<T *, int64_t> res;
+  for (size_t i{0}; i < vec.size(); ++i) {
+    res.emplace(vec[i], i);
+  }
+  return res;
+}
+
+// Reads the serialized form of the maps above. All of these throw if the
+// value does not have the expected shape.
+//
+// Reads an array of `[a, b, ...]` entries from `map`
+const llvm::json::Array &GetJSONEntries(const llvm::json::Object &map,
+                                        llvm::StringRef key);
+// Reads an index into a sequence of `size` elements
+int64_t GetJSONIndex(const llvm::json::Value &val, size_t size);
+llvm::StringRef GetJSONString(const llvm::json::Value &val);
+
 std::string ClangThingToString(const clang::Stmt *stmt);
 std::string ClangThingToString(clang::QualType ty);
 
@@ -59,9 +142,35 @@ z3::goal ApplyTactic(const z3::tactic &tactic, z3::expr expr);
 bool Prove(z3::expr expr);
 
 z3::expr HeavySimplify(z3::expr expr);
+
+// The tactic `HeavySimplify` applies to the formulas it cannot prove. Both
+// overloads of `HeavySimplify` build it here, so that they simplify alike.
+z3::tactic MakeHeavySimplifyTactic(z3::context &ctx);
+
+// Same as above, but memoized in `dec_ctx.z3_cache`. `HeavySimplify` also
+// applies the size limits of `dec_ctx` to `expr`, and on a miss proves it
+// with the memoized `Prove` and applies its tactic within `z3_timeout`.
+bool Prove(DecompilationContext &dec_ctx, z3::expr expr);
+z3::expr HeavySimplify(DecompilationContext &dec_ctx, z3::expr expr);
+
+// Whether a condition always holds, never holds, or neither could be proved
+enum class CondVerdict { True, False, Unknown };
+
+// Classifies the conditions at the indices `conds` of `dec_ctx.z3_exprs`,
+// asking the solver about the undecided ones in a single session. Like
+// `Prove`, the validity of each condition and of its negation is memoized in
+// `dec_ctx.z3_cache`.
+std::vector<CondVerdict> ClassifyConds(DecompilationContext &dec_ctx,
+                                       const std::vector<unsigned> &conds);
+CondVerdict ClassifyCond(DecompilationContext &dec_ctx, unsigned cond);
+
 z3::expr_vector Clone(z3::expr_vector &vec);
 
 // Tries to keep each subformula sorted by its id so that they don't get
-// shuffled around by simplification
+// shuffled around by simplification. Subformulas that are already sorted are
+// returned as they are.
 z3::expr OrderById(z3::expr expr);
+// Same as above, but memoized in `dec_ctx.z3_cache`, so that subformulas
+// shared between conditions are only sorted once
+z3::expr OrderById(DecompilationContext &dec_ctx, z3::expr expr);
 }  // namespace rellic
\ No newline at end of file
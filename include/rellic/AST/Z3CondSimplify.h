@@ -25,6 +25,11 @@ class Z3CondSimplify : public ASTPass {
 
  public:
   Z3CondSimplify(DecompilationContext& dec_ctx);
+  const char* GetName() const override { return "Z3CondSimplify"; }
+  // Only the conditions created since the last run are simplified
+  unsigned GetEffects() const override { return kConditions; }
+  unsigned GetTriggers() const override { return kConditions; }
+  bool TracksFunctions() const override { return false; }
 };
 
 }  // namespace rellic
@@ -0,0 +1,43 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <z3++.h>
+
+#include <functional>
+#include <optional>
+#include <vector>
+
+namespace rellic {
+
+struct Progress;
+
+// Builds a tactic in the context it is given
+using TacticBuilder = std::function<z3::tactic(z3::context &)>;
+
+// Alternatives to the tactic of `HeavySimplify`, and tactics that decide the
+// satisfiability of a goal or fail, for the portfolio of `RaceTactics`
+const std::vector<TacticBuilder> &GetSimplifyPortfolio();
+const std::vector<TacticBuilder> &GetProvePortfolio();
+
+// Applies every tactic of `portfolio` to `expr` at the same time, each on a
+// context and a thread of its own, and returns the goal produced by the first
+// one to succeed, translated into the context of `expr`. The others are
+// interrupted. Gives up after `timeout` milliseconds if nonzero, or once
+// `progress` is cancelled if it is not null. Returns nothing if every tactic
+// failed or the race was given up.
+//
+// Meant for the few queries on which a single tactic is either fast or
+// catastrophically slow depending on the shape of the formula: spare cores
+// are traded for the latency of the slowest ones.
+std::optional<z3::goal> RaceTactics(z3::expr expr,
+                                    const std::vector<TacticBuilder> &portfolio,
+                                    unsigned timeout, Progress *progress);
+
+}  // namespace rellic
@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+#include <z3++.h>
+
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "rellic/AST/Statistics.h"
+
+namespace rellic {
+
+struct DecompilationContext;
+
+/*
+ * Log of the queries that reach Z3, so that slow inputs can be reproduced and
+ * measured by `rellic-z3replay` without the input itself.
+ *
+ * Each query is an SMT-LIB 2 benchmark that asserts its formula, preceded by
+ * a comment holding what was asked of it as JSON:
+ *
+ *   ;; rellic-query {"kind": "prove", "tactic": "solver", "pass": "cbr",
+ *   ;;   "function": "main", "timeout": 100, "result": "unsat",
+ *   ;;   "time": 0.004}
+ *
+ * `prove` queries check the validity of the formula, and `simplify` queries
+ * apply the `heavy_simplify` or `light_simplify` tactic of
+ * `DecompilationContext::Z3Solver` to it. Logs are therefore also corpora of
+ * formulas for `rellic-z3bench`. Formulas do not mention where they come
+ * from beyond the names of their variables.
+ *
+ * Safe to record into from several threads at once.
+ */
+class Z3QueryLog {
+  std::mutex mutex;
+  std::unique_ptr<llvm::raw_fd_ostream> os;
+
+ public:
+  struct Query {
+    std::string kind;
+    std::string tactic;
+    // Running pass and function being refined or structured, if any
+    std::string pass;
+    std::string function;
+    // Timeout in milliseconds the query ran with, 0 for none
+    unsigned timeout = 0;
+    // `sat`, `unsat` or `unknown` for proofs, which refer to the negation of
+    // the formula, and `simplified` or `failed` for simplifications
+    std::string result;
+    Duration time{0};
+  };
+
+  // Creates the log at `path`. Throws if it cannot be written.
+  Z3QueryLog(const std::string &path);
+
+  // Appends a query about `expr` made on `dec_ctx`, whose running pass and
+  // function are taken from it
+  void Record(const DecompilationContext &dec_ctx, z3::expr expr,
+              const char *kind, const char *tactic, const char *result,
+              Duration time);
+
+  // Parses the queries of `log` into `queries` and their formulas into
+  // `formulas`, in order. Throws if the log is malformed.
+  static void Parse(llvm::StringRef log, std::vector<Query> &queries,
+                    z3::expr_vector &formulas);
+};
+
+}  // namespace rellic
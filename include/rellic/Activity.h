@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <string>
+
+namespace rellic {
+
+// Every thread keeps a stack of frames that say what it is doing, such as the
+// input it is decompiling, the pass and fixpoint iteration that is running,
+// the function being visited and the Z3 query being waited for. They are
+// pushed and popped at those boundaries, which only takes a lock of the
+// thread's own, and can be dumped at any time from another thread to tell
+// where a long job is stuck.
+
+// Pushes a frame of `kind`, a string literal, named `name` onto the stack of
+// the calling thread
+void PushActivity(const char *kind, llvm::StringRef name);
+// Pops the innermost frame of the calling thread, if any
+void PopActivity();
+// Sets the detail shown after the name of the innermost frame, such as the
+// iteration of a fixpoint
+void SetActivityDetail(llvm::StringRef detail);
+
+// Pushes a frame for the lifetime of the object
+class ActivityScope {
+ public:
+  ActivityScope(const char *kind, llvm::StringRef name) {
+    PushActivity(kind, name);
+  }
+  ~ActivityScope() { PopActivity(); }
+  ActivityScope(const ActivityScope &) = delete;
+  ActivityScope &operator=(const ActivityScope &) = delete;
+};
+
+// Writes the frames of every thread that has any, outermost first, along with
+// how long each has been on the stack
+void DumpActivity(llvm::raw_ostream &os);
+// Returns the same as an array with an object per thread
+llvm::json::Array GetActivityJSON();
+
+// Dumps the activity to standard error whenever the process receives
+// `signal`. The dump is written by a thread of its own, since it takes locks
+// that a signal handler cannot.
+void DumpActivityOnSignal(int signal);
+
+}  // namespace rellic
@@ -8,11 +8,20 @@
 
 #pragma once
 
+#include <llvm/ADT/ArrayRef.h>
 #include <llvm/IR/IntrinsicInst.h>
+#include <llvm/Support/MemoryBufferRef.h>
 
+#include <chrono>
+#include <map>
+#include <memory>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
 namespace llvm {
+class Function;
+class GlobalValue;
 class Module;
 class Type;
 class Value;
@@ -30,13 +39,33 @@ std::string LLVMThingToString(llvm::DIType *thing);
 // Try to verify a module.
 bool VerifyModule(llvm::Module *module);
 
-// Parses and loads a bitcode file into memory.
+// Parses and loads a bitcode file into memory, or standard input if
+// `file_name` is "-". Large files are memory-mapped rather than read. With
+// `lazy`, function bodies are only read when they are materialized, and the
+// module is not verified.
 llvm::Module *LoadModuleFromFile(llvm::LLVMContext *context,
                                  std::string file_name,
-                                 bool allow_failure = false);
+                                 bool allow_failure = false, bool lazy = false);
 llvm::Module *LoadModuleFromMemory(llvm::LLVMContext *context,
-                                   std::string file_data,
+                                   const std::string &file_data,
                                    bool allow_failure = false);
+// Parses a module from `buffer` without copying it, e.g. from a memory-mapped
+// file or a buffer owned by the caller. Textual IR must be followed by a null
+// byte. With `lazy`, the buffer must outlive the module, since bodies are read
+// from it when they are materialized.
+llvm::Module *LoadModuleFromBuffer(llvm::LLVMContext *context,
+                                   llvm::MemoryBufferRef buffer,
+                                   bool allow_failure = false,
+                                   bool lazy = false);
+
+// Links `modules`, which must share a context, into a single module. The
+// function and variable definitions of each of them are recorded in `origins`
+// under the name they have in the linked module, which differs from the
+// original one when internal symbols of several modules clash, with the index
+// of the module that defined them.
+std::unique_ptr<llvm::Module> LinkModules(
+    std::vector<std::unique_ptr<llvm::Module>> modules,
+    std::unordered_map<std::string, size_t> &origins);
 
 // Check if an intrinsic ID is an annotation
 bool IsAnnotationIntrinsic(llvm::Intrinsic::ID id);
@@ -67,4 +96,46 @@ void RemoveInsertValues(llvm::Module &module);
 // Converts by value array arguments and wraps them into a struct, so that
 // semantics are preserved in C
 void ConvertArrayArguments(llvm::Module &module);
+
+// Functions and global variables removed by `RemoveDeadGlobals`
+struct DeadGlobals {
+  unsigned functions = 0;
+  unsigned variables = 0;
+};
+
+// Erases the functions and global variables with internal or private linkage
+// that cannot be reached from `roots` or from the other global values of
+// `module`, through function bodies, initializers and aliasees. Unreferenced
+// helpers are common in lifted bitcode, and would otherwise be structured and
+// refined like the rest.
+DeadGlobals RemoveDeadGlobals(llvm::Module &module,
+                              llvm::ArrayRef<llvm::GlobalValue *> roots = {});
+
+// Wall time spent in each preprocessing step, by name
+using PreprocessTimes = std::map<std::string, std::chrono::duration<double>>;
+
+// Applies the steps above that decompilation needs in a single walk over the
+// functions of `module`: `ConvertArrayArguments` first, since it replaces
+// functions, then `RemovePHINodes` and `LowerSwitches` if enabled, and
+// `RemoveInsertValues`, to each function in turn. The analyses needed to lower
+// switches are only set up once, and the module is verified once at the end.
+// Adds the time spent in each step to `times`.
+// With `num_workers` greater than 1, functions are scanned for the
+// instructions to rewrite on that many threads, ahead of the rewriting, and
+// functions that have none are not visited again. The rewriting itself stays
+// on the calling thread, since it uniques constants and types in the context.
+void PreprocessModule(llvm::Module &module, bool remove_phi_nodes,
+                      bool lower_switches, PreprocessTimes &times,
+                      unsigned num_workers = 1);
+
+// Collects the types and global values that the body of `func` refers to,
+// including the ones nested in constant expressions and struct types, in the
+// order in which they are first encountered.
+void GetReferencedIR(llvm::Function &func, std::vector<llvm::Type *> &types,
+                     std::vector<llvm::GlobalValue *> &globals);
+
+// Collects the global values that `constant` refers to, including itself if it
+// is one, looking through constant expressions and aggregates
+void GetReferencedGlobals(llvm::Constant *constant,
+                          std::vector<llvm::GlobalValue *> &globals);
 }  // namespace rellic
\ No newline at end of file
@@ -9,7 +9,9 @@
 #pragma once
 
 #include <clang/AST/ASTContext.h>
+#include <clang/AST/PrettyPrinter.h>
 #include <llvm/ADT/APInt.h>
+#include <llvm/ADT/StringRef.h>
 #include <llvm/Support/raw_ostream.h>
 
 #include <functional>
@@ -26,4 +28,34 @@ namespace rellic {
 void ConvertIntegerLiteralsToHex(
     clang::ASTContext& ast_ctx, llvm::raw_ostream& os,
     std::function<bool(const llvm::APInt&)> shouldConvert);
+
+// Same as above, but the top-level declarations of the main file are split
+// between `num_threads` threads, for large files. `shouldConvert` must be safe
+// to call concurrently. The output is the same as with a single thread.
+void ConvertIntegerLiteralsToHex(
+    clang::ASTContext& ast_ctx, llvm::raw_ostream& os,
+    std::function<bool(const llvm::APInt&)> shouldConvert,
+    unsigned num_threads);
+
+// Returns the suffix that clang's statement printer prints after integer
+// literals of `type`, such as `U` for `unsigned int`
+llvm::StringRef GetIntegerLiteralSuffix(clang::QualType type);
+
+// Prints integer literals in hexadecimal form when `shouldConvert` returns
+// true, for use with `clang::Stmt::printPretty`. Does not need source range
+// information.
+class HexLiteralPrinter : public clang::PrinterHelper {
+  std::function<bool(const llvm::APInt&)> shouldConvert;
+
+ public:
+  HexLiteralPrinter(std::function<bool(const llvm::APInt&)> shouldConvert);
+  bool handledStmt(clang::Stmt* stmt, llvm::raw_ostream& os) override;
+};
+
+// Prints `decl` with `HexLiteralPrinter` using `PrintDecl`, so that the AST
+// generated by Rellic can be printed with hexadecimal literals directly.
+// Literals in the initializers of local variables are left in decimal form.
+void PrintDeclWithHexLiterals(
+    clang::Decl* decl, llvm::raw_ostream& os,
+    std::function<bool(const llvm::APInt&)> shouldConvert);
 }  // namespace rellic
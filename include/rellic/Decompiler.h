@@ -9,16 +9,38 @@
 #pragma once
 
 #include <clang/Frontend/ASTUnit.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
+#include <llvm/Support/MemoryBufferRef.h>
 
+#include <cstdint>
+#include <chrono>
+#include <functional>
+#include <future>
+#include <map>
 #include <memory>
+#include <optional>
+#include <string>
 #include <unordered_map>
 #include <vector>
 
 #include "Result.h"
+#include "rellic/AST/Progress.h"
+#include "rellic/AST/Statistics.h"
+#include "rellic/AST/TypeLibrary.h"
 #include "rellic/AST/TypeProvider.h"
+#include "rellic/Provenance.h"
+
+namespace z3 {
+class expr;
+}  // namespace z3
 
 namespace rellic {
+class AlphaCache;
+class FunctionCache;
+class PassProfile;
+class Z3QueryLog;
 
 /* This additional level of indirection is needed to alleviate the users from
  * the burden of having to instantiate custom TypeProviders before the actual
@@ -37,11 +59,216 @@ class SimpleTypeProviderFactory final : public TypeProviderFactory {
   }
 };
 
+// Creates providers that answer from a type library, which they share
+class TypeLibraryProviderFactory final : public TypeProviderFactory {
+  std::shared_ptr<const TypeLibrary> library;
+
+ public:
+  TypeLibraryProviderFactory(std::shared_ptr<const TypeLibrary> library)
+      : library(std::move(library)) {}
+  std::unique_ptr<TypeProvider> create(DecompilationContext& ctx) override {
+    return std::make_unique<TypeLibraryProvider>(ctx, library);
+  }
+};
+
 struct DecompilationOptions {
   using TypeProviderFactoryPtr = std::unique_ptr<TypeProviderFactory>;
 
+  // How conditions are proven during structuring and refinement. `BDD`
+  // decides purely boolean conditions with binary decision diagrams, and only
+  // uses Z3 for the ones that involve switch variables or whose diagrams grow
+  // too large. `Syntactic` never calls the solver or its tactics: conditions
+  // are only decided when they are structurally equal or one is the negation
+  // of the other, and are only simplified by Z3's rewriter. The output is
+  // valid but less refined, at a fraction of the cost.
+  enum class ConditionEngine { Z3, BDD, Syntactic };
+
   bool lower_switches = false;
   bool remove_phi_nodes = false;
+  // Removes the internal functions and global variables that nothing
+  // exported refers to before decompiling, see `rellic::RemoveDeadGlobals`.
+  // They are counted in the statistics instead.
+  bool remove_dead_globals = false;
+
+  // Names of the functions to decompile, empty for all of them. A hexadecimal
+  // address also selects the function that lifters name `sub_<address>`. The
+  // functions that they refer to are decompiled too, up to `call_depth` levels
+  // away (unlimited when unset), and the others lose their bodies and are only
+  // declared. When the module has been loaded lazily, only the bodies of the
+  // decompiled functions are ever read.
+  std::vector<std::string> functions;
+  std::optional<unsigned> call_depth;
+
+  // Number of threads used to structure and refine function bodies. When
+  // greater than 1, functions are decompiled in separate ASTUnits and their
+  // bodies are merged into the final translation unit. Preprocessing also
+  // scans functions on this many threads. 0 means one thread per available
+  // hardware thread.
+  unsigned num_workers = 1;
+
+  // Structures and refines every function in an ASTUnit of its own, which is
+  // released as soon as the final body has been merged, instead of in the
+  // final translation unit. Nodes that refinement creates and then discards
+  // then take memory in proportion to the largest function rather than to the
+  // whole module. Implied by `cache_dir`.
+  bool scratch_contexts = false;
+
+  ConditionEngine condition_engine = ConditionEngine::Z3;
+
+  // How the reaching conditions of blocks are built during structuring.
+  // `Predecessors` takes the disjunction over the predecessors of a block of
+  // their conditions and edges. `Dominators` conjoins the condition of the
+  // immediate dominator of the block with the condition of reaching the block
+  // from it, which keeps formulas small by construction, so that far fewer of
+  // them need `HeavySimplify`.
+  enum class ReachingCondMode { Predecessors, Dominators };
+  ReachingCondMode reaching_cond_mode = ReachingCondMode::Predecessors;
+
+  // With `ReachingCondMode::Dominators`, regions whose control flow has the
+  // same shape as one structured before, e.g. copies of an inlined function,
+  // take the reaching conditions of their blocks from it instead of computing
+  // them again. Only the conditions of the blocks other than the entry of a
+  // region are reused, as those do not depend on anything outside of it.
+  bool reuse_region_conds = false;
+
+  // Conditions of branches and switches that are translated from at least
+  // this many instructions are assigned to a variable where they are
+  // computed, instead of being repeated in every structured condition that
+  // tests them. 0 disables it.
+  unsigned cond_temp_threshold = 0;
+
+  // Constant arrays of 16- and 32-bit integers with at least this many
+  // elements are translated to a single `u""` or `U""` string literal instead
+  // of a list of integer literals, which keeps large tables from taking an
+  // AST node per element. 0 disables it.
+  unsigned wide_string_threshold = 0;
+
+  // Local variables and struct fields take their names from debug
+  // information as they are created, instead of being renamed by the `ldr`
+  // and `sfr` passes afterwards, which are then left out of the pipeline.
+  // This saves two traversals of the translation unit and the identifiers of
+  // the generated names. Names are the same as the passes give, except that
+  // locals are checked against the global variables declared so far rather
+  // than the ones before their function in the output, and that records with
+  // unnamed members keep all of their generated field names.
+  bool debug_names_at_creation = false;
+
+  // Limits on the size in DAG nodes of the formulas given to `HeavySimplify`,
+  // 0 for no limit. Formulas larger than `simplify_light_nodes` only get the
+  // cheap rewrites of Z3's `simplify` and `propagate-values` tactics, instead
+  // of `ctx-solver-simplify` whose cost grows quickly with their size.
+  // Formulas larger than `simplify_max_nodes` are left as they are.
+  unsigned simplify_light_nodes = 0;
+  unsigned simplify_max_nodes = 0;
+
+  // Description of the refinement passes to run, see `rellic::Pipeline`.
+  // Empty uses `GetDefaultPipeline()`.
+  std::string pipeline;
+  // Within fixpoints, stops running a pass on a function once it has left it
+  // unchanged, until one of the passes whose changes may give it something
+  // new to do changes that function. The output is the same, with fewer
+  // wasted traversals.
+  bool adaptive_passes = false;
+  // Profile of earlier runs, see `rellic::PassProfile`. Passes are not run on
+  // the functions whose shape `pass_profile` shows they never change, and
+  // the passes of this run are recorded into `record_pass_profile`. Both are
+  // owned by the caller and may be shared between concurrent decompilations.
+  const PassProfile *pass_profile = nullptr;
+  PassProfile *record_pass_profile = nullptr;
+  // Where the answers of Z3 are shared between the functions whose conditions
+  // are the same up to the names of their variables, see
+  // `rellic::AlphaCache`. Owned by the caller, and may be shared between
+  // concurrent decompilations with the same options, so that such conditions
+  // are solved once per cache rather than once per function.
+  AlphaCache *alpha_cache = nullptr;
+  // Where every query that reaches Z3 is recorded, see `rellic::Z3QueryLog`.
+  // Owned by the caller, and may be shared between concurrent
+  // decompilations. Functions found in `cache_dir` make no queries.
+  Z3QueryLog *z3_query_log = nullptr;
+
+  // Functions that structuring would take too long on are emitted as labeled
+  // blocks and `goto`s instead, with nothing asked of Z3: the ones with more
+  // than `goto_fallback_blocks` blocks (0 for no limit), the ones with
+  // irreducible control flow if `goto_fallback_irreducible`, and the ones
+  // whose reaching conditions take longer than `structuring_budget_ms`
+  // milliseconds to compute (0 for no limit). They are not refined, and are
+  // listed in `DecompilationResult::degraded_functions`.
+  unsigned goto_fallback_blocks = 0;
+  bool goto_fallback_irreducible = false;
+  unsigned structuring_budget_ms = 0;
+
+  // Limits on the time spent refining the structured AST, both in
+  // milliseconds, 0 for no limit. Z3 queries that exceed `z3_timeout_ms` are
+  // treated as unprovable. Functions that exceed `function_budget_ms` stop
+  // being refined and are emitted as they are at that point.
+  unsigned z3_timeout_ms = 0;
+  unsigned function_budget_ms = 0;
+  // Refinement queries that take longer than this many milliseconds, 0 to
+  // disable, are abandoned and raced across alternative Z3 tactics for the
+  // rest of `z3_timeout_ms`, each on a context and a thread of its own. The
+  // first answer is taken and the other tactics are interrupted, which trades
+  // spare cores for the latency of the slowest queries.
+  unsigned z3_portfolio_ms = 0;
+
+  // Soft limits on memory, 0 for no limit: the peak resident set size of the
+  // process in bytes, the memory allocated for each translation unit that
+  // functions are refined in, in bytes, the memory Z3 has allocated across the
+  // process, in bytes, and the number of conditions each translation unit
+  // keeps as Z3 formulas. Z3 keeps the formulas of a translation unit until it
+  // is released, so `scratch_contexts` bounds its memory by the largest
+  // function rather than the whole module. Once one is exceeded, optional
+  // work is shed to stay clear of a hard limit: the functions refined from
+  // then on are degraded as if over `function_budget_ms`, fixpoints stop
+  // iterating, and provenance is dropped from the result. Which limit was
+  // exceeded, and in which pass and function, is logged. The Z3 memory of each
+  // pass is reported in `DecompilationStatistics`.
+  uint64_t soft_rss_limit = 0;
+  uint64_t soft_ast_memory_limit = 0;
+  uint64_t soft_z3_memory_limit = 0;
+  size_t soft_z3_exprs_limit = 0;
+
+  // Directory of a cache of refined function bodies, empty to disable it.
+  // Functions found in the cache are not decompiled again. The directory can
+  // be shared between processes, and is trimmed to `cache_max_size` bytes by
+  // removing the least recently used entries (0 for no limit). Since the
+  // output of custom type providers cannot be accounted for, the cache is not
+  // used when `additional_providers` is not empty.
+  std::string cache_dir;
+  uint64_t cache_max_size = 0;
+
+  // Directory where `LoadPreprocessedModule` stores the modules it has
+  // preprocessed, empty to disable it. Can be the same as `cache_dir`, whose
+  // trimming then covers these entries too.
+  std::string preprocess_cache_dir;
+
+  // Whether `DecompilationResult` records which IR the AST was generated from.
+  // Callers that only need the C source can disable it to save memory, but
+  // then cannot pass the result to `Redecompile`.
+  bool provenance = true;
+
+  // Called with consecutive ranges of the top-level declarations of the
+  // translation unit, in order, as soon as they will not change anymore:
+  // first the types, global variables and prototypes, then the definitions
+  // of each batch of functions once they have been refined. Implies
+  // `scratch_contexts`, so the state used to refine a function is released
+  // once its definition has been passed on.
+  // `provenance` describes the statements of the declarations, and is only
+  // valid during the call.
+  std::function<void(llvm::ArrayRef<clang::Decl*>,
+                     const ProvenanceLookup& provenance)>
+      on_decls;
+
+  // Where the progress of structuring and refinement is reported, shared by
+  // every translation unit the module is decompiled in. Cancelling it makes
+  // decompilation stop early, interrupting the Z3 queries that are running,
+  // and return what has been done so far. Must outlive the call.
+  Progress* progress = nullptr;
+
+  // Called with every formula that structuring and refinement add to the
+  // conditions of a translation unit, from the thread that decompiles it. The
+  // formula belongs to a context that is destroyed once decompilation is done,
+  // so it must be copied or serialized during the call.
+  std::function<void(const z3::expr&)> on_z3_expr;
 
   // Additional type providers to be used during code generation.
   // Providers added later will have higher priority.
@@ -49,6 +276,8 @@ struct DecompilationOptions {
 };
 
 struct DecompilationResult {
+  // Maps that the provenance of a result used to be stored in, kept so that
+  // code naming them still builds. New code should use the maps below.
   using StmtToIRMap =
       std::unordered_map<const clang::Stmt*, const llvm::Value*>;
   using DeclToIRMap =
@@ -64,16 +293,42 @@ struct DecompilationResult {
       std::unordered_map<const llvm::Type*, const clang::TypeDecl*>;
   using UseToExprMap = std::unordered_map<const llvm::Use*, const clang::Expr*>;
 
+  using StmtProvenance = ProvenanceMap<clang::Stmt, llvm::Value>;
+  using DeclProvenance = ProvenanceMap<llvm::Value, clang::ValueDecl>;
+  using TypeDeclProvenance = ProvenanceMap<llvm::Type, clang::TypeDecl>;
+  using UseProvenance = ProvenanceMap<clang::Expr, llvm::Use>;
+
   std::unique_ptr<llvm::Module> module;
   std::unique_ptr<clang::ASTUnit> ast;
-  StmtToIRMap stmt_provenance_map;
-  IRToStmtMap value_to_stmt_map;
-  DeclToIRMap decl_provenance_map;
-  IRToDeclMap value_to_decl_map;
-  TypeDeclToIRMap type_provenance_map;
-  IRToTypeDeclMap type_to_decl_map;
-  ExprToUseMap expr_use_map;
-  UseToExprMap use_expr_map;
+  // The IR each statement, declaration and use expression was generated from,
+  // queried in the other direction with `LookupInverse`. Empty when
+  // `DecompilationOptions::provenance` is false.
+  StmtProvenance stmt_provenance;
+  DeclProvenance value_decls;
+  TypeDeclProvenance type_decls;
+  UseProvenance use_provenance;
+  // Time spent in each pass and in generating each function
+  DecompilationStatistics stats;
+  // Functions whose refinement was cut short by `function_budget_ms` or by a
+  // soft memory limit
+  std::vector<std::string> degraded_functions;
+};
+
+// Provenance recorded in a result, which must outlive it
+class ResultProvenance final : public ProvenanceLookup {
+  const DecompilationResult& result;
+
+ public:
+  ResultProvenance(const DecompilationResult& result) : result(result) {}
+  const llvm::Value* GetValue(const clang::Stmt* stmt) const override {
+    return result.stmt_provenance.Lookup(stmt);
+  }
+  const llvm::Use* GetUse(const clang::Expr* expr) const override {
+    return result.use_provenance.Lookup(expr);
+  }
+  const llvm::Value* GetDeclValue(const clang::ValueDecl* decl) const override {
+    return result.value_decls.LookupInverse(decl);
+  }
 };
 
 struct DecompilationError {
@@ -84,4 +339,139 @@ struct DecompilationError {
 
 Result<DecompilationResult, DecompilationError> Decompile(
     std::unique_ptr<llvm::Module> module, DecompilationOptions options = {});
+
+// Decompiles a sequence of modules, e.g. the inputs of a batch, keeping what
+// can be shared between them instead of setting it up again for each one: the
+// LLVM context modules are loaded into, and the function caches, which are
+// only trimmed by `Flush` rather than after every module. An engine must only
+// be used by one thread at a time, and outlive the modules and results it
+// produces.
+class DecompilerEngine {
+  llvm::LLVMContext llvm_ctx;
+  // By directory, maximum size and options key
+  std::map<std::string, std::unique_ptr<FunctionCache>> caches;
+  DecompilationStatistics stats;
+
+ public:
+  DecompilerEngine();
+  DecompilerEngine(const DecompilerEngine&) = delete;
+  DecompilerEngine& operator=(const DecompilerEngine&) = delete;
+  // Calls `Flush`
+  ~DecompilerEngine();
+
+  llvm::LLVMContext& GetLLVMContext() { return llvm_ctx; }
+  // Loads a module from bitcode or textual IR in `buffer` into the context of
+  // the engine. Returns null if it cannot be parsed.
+  std::unique_ptr<llvm::Module> LoadModule(llvm::MemoryBufferRef buffer);
+  // Same as `rellic::Decompile`. `module` must belong to `GetLLVMContext()`.
+  Result<DecompilationResult, DecompilationError> Decompile(
+      std::unique_ptr<llvm::Module> module, DecompilationOptions options = {});
+  // Trims the caches used so far to their maximum size
+  void Flush();
+  // Statistics of all successful decompilations so far, merged
+  const DecompilationStatistics& GetStatistics() const { return stats; }
+};
+
+// Called with the definition of each function as soon as it has been
+// decompiled, in module order, and the provenance of its statements, which is
+// only valid during the call
+using FunctionCallback = std::function<void(
+    const clang::FunctionDecl* fdecl, const ProvenanceLookup& provenance)>;
+
+// A decompilation running on a thread of its own, see `DecompileAsync`.
+// Destroying it cancels the decompilation and waits for it to stop.
+class DecompilationHandle {
+  std::unique_ptr<Progress> owned_progress;
+  Progress* progress;
+  std::future<Result<DecompilationResult, DecompilationError>> future;
+
+ public:
+  DecompilationHandle(
+      std::unique_ptr<Progress> owned_progress, Progress* progress,
+      std::future<Result<DecompilationResult, DecompilationError>> future);
+  DecompilationHandle(DecompilationHandle&&) = default;
+  DecompilationHandle& operator=(DecompilationHandle&&) = default;
+  ~DecompilationHandle();
+
+  // Makes the decompilation stop as soon as possible. What has been done so
+  // far is still returned by `Get`.
+  void Cancel();
+  // Whether `Get` would return without waiting
+  bool IsReady() const;
+  // Waits for at most `timeout`, and returns whether the decompilation is done
+  bool WaitFor(std::chrono::milliseconds timeout) const;
+  // Waits for the decompilation to be done and returns its result. Can only
+  // be called once.
+  Result<DecompilationResult, DecompilationError> Get();
+  // Progress of the decompilation, which may be polled from any thread
+  const Progress& GetProgress() const { return *progress; }
+};
+
+// Starts decompiling `module` as `Decompile` would, and returns right away.
+// `on_function`, if set, and the callbacks of `options` are called from the
+// thread that runs the decompilation. Since functions are streamed to
+// `on_function` as they are done, it implies `options.scratch_contexts`.
+// Cancelling `options.progress`, if set, has the same effect as cancelling the
+// handle.
+DecompilationHandle DecompileAsync(std::unique_ptr<llvm::Module> module,
+                                   DecompilationOptions options = {},
+                                   FunctionCallback on_function = nullptr);
+
+// A function extracted into a module of its own, along with the prototypes and
+// global variables it refers to, so that it can be decompiled by another
+// process. Decompiling `bitcode` with the same options and a `cache_dir` shared
+// with this process stores the function under `cache_key`, where `Decompile`
+// finds it.
+struct WorkUnit {
+  std::string function;
+  std::string cache_key;
+  std::string bitcode;
+};
+
+// Selects and preprocesses the functions of `module` as `Decompile` would with
+// `options`, and returns a work unit for each function that has a body, in
+// module order. The module can be passed to `Decompile` afterwards.
+std::vector<WorkUnit> SplitModule(llvm::Module& module,
+                                  DecompilationOptions options = {});
+
+// How the functions defined in `module` compare to the ones of a previous
+// version of it, see `DiffModules`. Names are the ones in `module`, except for
+// `removed` and the first of each pair of `renamed`.
+struct ModuleDiff {
+  std::vector<std::string> unchanged;
+  std::vector<std::pair<std::string, std::string>> renamed;
+  std::vector<std::string> changed;
+  std::vector<std::string> added;
+  std::vector<std::string> removed;
+};
+
+// Matches the functions with a body in `module` to the ones in `previous`:
+// first by a hash of their IR and of the types and globals it refers to,
+// which leaves out their own name so that renamed functions are still found,
+// then by name for the ones whose IR changed. Both modules should be loaded
+// and preprocessed the same way. Bodies of lazily loaded modules are read.
+ModuleDiff DiffModules(llvm::Module& previous, llvm::Module& module);
+
+// Reads the module in `buffer` into `ctx`, with its functions selected and
+// preprocessed as `Decompile` would with `options`, so that decompiling it
+// with the same options has nothing left to prepare. With
+// `options.preprocess_cache_dir`, the result is stored there under a hash of
+// `buffer` and of the options that preprocessing depends on, and read back
+// instead of being preprocessed again by later calls. Debug information is
+// kept, so the names and types collected from it do not change. Returns
+// nullptr if `buffer` cannot be read. Throws `rellic::Exception` if it has no
+// function of `options.functions`.
+std::unique_ptr<llvm::Module> LoadPreprocessedModule(
+    llvm::LLVMContext& ctx, llvm::MemoryBufferRef buffer,
+    const DecompilationOptions& options);
+
+// Decompiles `funcs` again after their IR has been modified, and replaces
+// their declarations and bodies in the translation unit of `previous`. The
+// other functions are not structured or refined again. `funcs` may contain
+// functions that were added to the module. Since existing calls keep referring
+// to the old prototype, callers of functions whose signature has changed must
+// be in `funcs` too. `options` should be the same that produced `previous`.
+Result<DecompilationResult, DecompilationError> Redecompile(
+    DecompilationResult previous, const std::vector<llvm::Function*>& funcs,
+    DecompilationOptions options = {});
 }  // namespace rellic
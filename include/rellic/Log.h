@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <glog/logging.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <atomic>
+
+namespace rellic {
+
+// Categories of diagnostic messages, which are enabled separately. Messages of
+// a disabled category cost a single branch: their operands, e.g. IR printed
+// with `LLVMThingToString`, are not evaluated.
+enum class LogCategory : unsigned {
+  // What each refinement pass is doing
+  Passes,
+  // Structuring of regions and reaching conditions
+  Structuring,
+  // Translation of instructions and values to AST nodes
+  IRGen,
+  // Translation of IR and debug information types to C types
+  Types,
+  // Collection of debug information
+  DebugInfo,
+  // Progress of `Decompile` over a module, and statistics of its caches and
+  // memory. They are also reported in `DecompilationResult::stats`.
+  Stats,
+};
+
+namespace detail {
+extern std::atomic<unsigned> enabled_log_categories;
+}  // namespace detail
+
+inline bool IsLogEnabled(LogCategory category) {
+  return detail::enabled_log_categories.load(std::memory_order_relaxed) &
+         (1U << static_cast<unsigned>(category));
+}
+
+// Enables the categories in `names`, a comma-separated list of `passes`,
+// `structuring`, `irgen`, `types`, `debuginfo` and `stats`, or `all`, and
+// disables the others. Only `passes` is enabled by default. Returns false,
+// changing nothing, if a name is unknown.
+bool SetLogCategories(llvm::StringRef names);
+
+}  // namespace rellic
+
+// Logs at INFO severity if `category`, a `rellic::LogCategory` enumerator, is
+// enabled
+#define RELLIC_LOG(category) \
+  LOG_IF(INFO, ::rellic::IsLogEnabled(::rellic::LogCategory::category))
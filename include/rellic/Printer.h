@@ -0,0 +1,159 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Decl.h>
+#include <clang/AST/Expr.h>
+#include <clang/AST/PrettyPrinter.h>
+#include <llvm/ADT/APInt.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/DenseMap.h>
+#include <llvm/ADT/DenseSet.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/IR/Function.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+#include "rellic/Provenance.h"
+
+namespace rellic {
+// Prints a single top-level declaration, without the terminator that follows
+// it in a translation unit
+using DeclPrinter = std::function<void(clang::Decl*, llvm::raw_ostream&)>;
+
+// A span of printed output and the IR it was generated from. Expressions span
+// exactly their text, other statements the first line they are printed on.
+struct PrintedRange {
+  uint64_t begin, end;
+  const llvm::Value* value;
+  const llvm::Use* use;
+};
+
+struct PrintOptions {
+  // Function definitions are rendered into separate buffers by this many
+  // threads (0 for one per available hardware thread) and written out in
+  // order
+  unsigned num_workers = 1;
+  // Integer literals for which this returns true are printed in hexadecimal
+  std::function<bool(const llvm::APInt&)> hex_literals;
+  // Where to find the IR that statements were generated from. Must be safe to
+  // query concurrently.
+  const ProvenanceLookup* provenance = nullptr;
+  // Called from the printing thread after each declaration is written, in
+  // output order, with the offsets that `os.tell()` had before and after it,
+  // and the ranges of its statements that have provenance
+  std::function<void(clang::Decl* decl, uint64_t begin, uint64_t end,
+                     llvm::ArrayRef<PrintedRange> ranges)>
+      on_printed;
+  // Replaces the printing of declarations, in which case `hex_literals` and
+  // `provenance` are not used. Called concurrently.
+  DeclPrinter print;
+};
+
+// Prints `decl` like `Decl::print`, but with `helper` for function bodies and
+// variable initializers. Statements in the initializers of local variables
+// are printed by clang's declaration printer, which does not take a
+// `PrinterHelper`, and are not seen by it.
+void PrintDecl(clang::Decl* decl, llvm::raw_ostream& os,
+               clang::PrinterHelper* helper);
+
+// Initializer lists of at least this many integer literals of a single type,
+// such as the contents of global arrays, are printed by `PrintIntegerList`
+constexpr unsigned kIntegerListThreshold{64};
+
+// Returns `expr` if it is a list of at least `kIntegerListThreshold` integer
+// literals that all have the same builtin type, or null
+const clang::InitListExpr* GetIntegerList(const clang::Expr* expr);
+
+// Appends `value` to `buffer` the way `llvm::APInt::toString` does, in
+// decimal or as a hexadecimal C literal
+void AppendInteger(llvm::SmallVectorImpl<char>& buffer,
+                   const llvm::APInt& value, bool is_signed, bool hex);
+
+// Prints a list returned by `GetIntegerList` the same as clang's statement
+// printer, with the literals for which `hex` returns true printed like
+// `HexLiteralPrinter` does. The elements are formatted into a single buffer
+// that is written out at once, instead of visiting them one by one.
+void PrintIntegerList(const clang::InitListExpr* list, llvm::raw_ostream& os,
+                      const std::function<bool(const llvm::APInt&)>& hex = {});
+
+// Prints `decls`, consecutive top-level declarations of a translation unit,
+// the same way `TranslationUnitDecl::print` prints them. The AST must not
+// change while it is being printed.
+void PrintDecls(llvm::ArrayRef<clang::Decl*> decls, llvm::raw_ostream& os,
+                const PrintOptions& options = {});
+
+// Prints `decls` as declarations only, e.g. for a header shared by the files
+// that define them: functions are printed as prototypes, and variables
+// without their initializer, as `extern` unless they have a storage class.
+void PrintDeclarations(llvm::ArrayRef<clang::Decl*> decls,
+                       llvm::raw_ostream& os);
+
+// Prints every declaration of the translation unit of `ast_ctx`
+void PrintTranslationUnit(clang::ASTContext& ast_ctx, llvm::raw_ostream& os,
+                          const PrintOptions& options = {});
+
+/*
+ * Writes the ranges passed to `PrintOptions::on_printed` as line-delimited
+ * JSON, one object per declaration:
+ *
+ *   {"decl": "main", "begin": 120, "end": 384,
+ *    "ranges": [[131, 140, "@main:3", "@main:5/0"], ...]}
+ *
+ * Each range is its offsets, the identifier of the value it comes from, and
+ * the identifier of the use it stands for, or null. Global values are
+ * identified as `@name`, arguments as `@function:argN`, basic blocks as
+ * `@function:bbN` and instructions as `@function:N`, where N counts them in
+ * function order. A use is identified as its user and the operand number.
+ * Constants other than global values have no identifier.
+ */
+class ProvenanceExporter {
+  llvm::raw_ostream& os;
+  // Position of arguments, blocks and instructions in their function
+  llvm::DenseMap<const llvm::Value*, unsigned> indices;
+  llvm::DenseSet<const llvm::Function*> numbered;
+
+  void Number(const llvm::Function* func);
+  // Empty for values without an identifier
+  std::string GetId(const llvm::Value* value);
+
+ public:
+  ProvenanceExporter(llvm::raw_ostream& os) : os(os) {}
+  void Write(clang::Decl* decl, uint64_t begin, uint64_t end,
+             llvm::ArrayRef<PrintedRange> ranges);
+};
+
+/*
+ * Writes where each function and global variable passed to
+ * `PrintOptions::on_printed` is in the output as line-delimited JSON, so that
+ * the text of one declaration can be read directly from the output without
+ * parsing it:
+ *
+ *   {"name": "main", "kind": "function", "definition": true,
+ *    "ir": "@main", "begin": 120, "end": 384}
+ *
+ * `begin` and `end` are byte offsets into the output, and `ir` identifies the
+ * global value that the declaration was generated from, as in
+ * `ProvenanceExporter`, or is null if it is not known.
+ */
+class DeclIndexExporter {
+  llvm::raw_ostream& os;
+
+ public:
+  DeclIndexExporter(llvm::raw_ostream& os) : os(os) {}
+  // `provenance` may be null
+  void Write(clang::Decl* decl, uint64_t begin, uint64_t end,
+             const ProvenanceLookup* provenance);
+  void Flush() { os.flush(); }
+};
+}  // namespace rellic
@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace clang {
+class Expr;
+class Stmt;
+class ValueDecl;
+}  // namespace clang
+
+namespace llvm {
+class Use;
+class Value;
+}  // namespace llvm
+
+namespace rellic {
+
+// Where the statements and expressions of a translation unit were generated
+// from, independently of how that is stored
+class ProvenanceLookup {
+ public:
+  virtual ~ProvenanceLookup() = default;
+  // Returns the IR that `stmt` was generated from, or null
+  virtual const llvm::Value *GetValue(const clang::Stmt *stmt) const = 0;
+  // Returns the use of an IR value that `expr` stands for, or null
+  virtual const llvm::Use *GetUse(const clang::Expr *expr) const = 0;
+  // Returns the IR that the declaration `decl` was generated from, or null
+  virtual const llvm::Value *GetDeclValue(const clang::ValueDecl *decl) const {
+    return nullptr;
+  }
+};
+
+/*
+ * Read-only association between pointers that can be queried in both
+ * directions. Entries are kept in a flat array sorted by key, and the inverse
+ * direction is an array of indices into it sorted by value, so every entry
+ * takes the size of two pointers and an index instead of two hash table
+ * nodes. The inverse array is only built by the first reverse query.
+ */
+template <typename TKey, typename TValue>
+class ProvenanceMap {
+ public:
+  using value_type = std::pair<const TKey *, const TValue *>;
+  using const_iterator = typename std::vector<value_type>::const_iterator;
+
+ private:
+  std::vector<value_type> entries;
+  mutable std::vector<uint32_t> inverse;
+  mutable std::unique_ptr<std::once_flag> inverse_built{
+      std::make_unique<std::once_flag>()};
+
+  static bool KeyLess(const value_type &entry, const TKey *key) {
+    return std::less<const TKey *>{}(entry.first, key);
+  }
+
+  void SortEntries() {
+    std::sort(entries.begin(), entries.end(),
+              [](const value_type &a, const value_type &b) {
+                return std::less<const TKey *>{}(a.first, b.first);
+              });
+  }
+
+  void BuildInverse() const {
+    inverse.resize(entries.size());
+    std::iota(inverse.begin(), inverse.end(), 0);
+    std::sort(inverse.begin(), inverse.end(), [this](uint32_t a, uint32_t b) {
+      auto va{entries[a].second};
+      auto vb{entries[b].second};
+      if (va != vb) {
+        return std::less<const TValue *>{}(va, vb);
+      }
+      return a < b;
+    });
+  }
+
+ public:
+  ProvenanceMap() = default;
+
+  // Builds the map from any container of key-value pairs with unique keys.
+  // Entries with a null value are not recorded.
+  template <typename TMap>
+  explicit ProvenanceMap(const TMap &map) {
+    entries.reserve(map.size());
+    for (auto &[key, value] : map) {
+      if (value) {
+        entries.emplace_back(key, value);
+      }
+    }
+    SortEntries();
+  }
+
+  // Same as above, but releases the elements of `map` as they are recorded,
+  // so that the two representations never both exist in full
+  template <typename TMap, typename = std::enable_if_t<
+                               !std::is_lvalue_reference_v<TMap>>>
+  explicit ProvenanceMap(TMap &&map) {
+    entries.reserve(map.size());
+    for (auto it{map.begin()}; it != map.end(); it = map.erase(it)) {
+      if (it->second) {
+        entries.emplace_back(it->first, it->second);
+      }
+    }
+    map = TMap();
+    SortEntries();
+  }
+
+  ProvenanceMap(ProvenanceMap &&) = default;
+  ProvenanceMap &operator=(ProvenanceMap &&) = default;
+
+  // Returns the value associated to `key`, or null
+  const TValue *Lookup(const TKey *key) const {
+    auto it{std::lower_bound(entries.begin(), entries.end(), key, KeyLess)};
+    if (it == entries.end() || it->first != key) {
+      return nullptr;
+    }
+    return it->second;
+  }
+
+  // Returns a key associated to `value`, or null. When several keys are, the
+  // first one in iteration order is returned. Safe to call concurrently.
+  const TKey *LookupInverse(const TValue *value) const {
+    std::call_once(*inverse_built, [this]() { BuildInverse(); });
+    auto it{std::lower_bound(inverse.begin(), inverse.end(), value,
+                             [this](uint32_t idx, const TValue *value) {
+                               return std::less<const TValue *>{}(
+                                   entries[idx].second, value);
+                             })};
+    if (it == inverse.end() || entries[*it].second != value) {
+      return nullptr;
+    }
+    return entries[*it].first;
+  }
+
+  bool Contains(const TKey *key) const { return Lookup(key) != nullptr; }
+
+  // Entries are iterated in key order
+  const_iterator begin() const { return entries.begin(); }
+  const_iterator end() const { return entries.end(); }
+  size_t Size() const { return entries.size(); }
+  bool Empty() const { return entries.empty(); }
+
+  // Bytes used by the map itself
+  size_t GetMemoryUsage() const {
+    return entries.capacity() * sizeof(value_type) +
+           inverse.capacity() * sizeof(uint32_t);
+  }
+};
+
+}  // namespace rellic
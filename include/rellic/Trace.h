@@ -0,0 +1,42 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/TimeProfiler.h>
+
+#include <string>
+
+namespace rellic {
+
+// Spans are recorded with `llvm::TimeTraceScope`, and written out in the Chrome
+// Trace Event format, which can be loaded in Perfetto or chrome://tracing.
+
+// Starts recording spans on the calling thread. Spans shorter than
+// `granularity_us` microseconds are discarded.
+void StartTracing(unsigned granularity_us, llvm::StringRef process_name);
+
+// Writes the spans recorded by every thread to `path` and stops tracing. Must
+// be called from the same thread that called `StartTracing`.
+void StopTracing(const std::string &path);
+
+bool IsTracing();
+
+// Records spans from the current thread for the lifetime of the object, if
+// tracing has been started. Used by worker threads, since the tracing state of
+// LLVM's profiler is thread-local.
+class TraceThread {
+  bool enabled;
+
+ public:
+  TraceThread();
+  ~TraceThread();
+};
+
+}  // namespace rellic
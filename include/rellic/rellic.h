@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+/*
+ * C interface to the decompiler, exported by the `rellic-c` shared library so
+ * that it can be used from other languages without going through
+ * `rellic-decomp`. Only plain C types cross it, and it only ever grows: new
+ * options are new keys of the options object, new outputs new accessors.
+ *
+ * Every function is safe to call from several threads at once, each with its
+ * own result.
+ */
+
+#ifndef RELLIC_RELLIC_H
+#define RELLIC_RELLIC_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#if defined(RELLIC_C_API_EXPORTS) && defined(__GNUC__)
+#define RELLIC_C_API __attribute__((visibility("default")))
+#else
+#define RELLIC_C_API
+#endif
+
+/* Bumped when a function is added to this interface */
+#define RELLIC_C_API_VERSION 1
+
+/* Returns `RELLIC_C_API_VERSION` as the library was built with it */
+RELLIC_C_API int rellic_api_version(void);
+
+/* Returns the version string of the library. Owned by the library. */
+RELLIC_C_API const char *rellic_version(void);
+
+/*
+ * Log messages below `level` (0 for INFO, 1 for WARNING, 2 for ERROR) are not
+ * written to standard error. Affects the whole process.
+ */
+RELLIC_C_API void rellic_set_min_log_level(int level);
+
+typedef struct rellic_result rellic_result;
+
+/*
+ * Decompiles the module in the `size` bytes of bitcode at `bitcode`, with the
+ * options of `options_json`, a JSON object that may be null or empty for the
+ * defaults. Its keys are the fields of `rellic::DecompilationOptions`, e.g.
+ * `{"num_workers": 4, "functions": ["main"]}`, with `condition_engine` being
+ * `"z3"`, `"bdd"` or `"syntactic"` and `reaching_cond_mode` `"predecessors"`
+ * or `"dominators"`. `provenance` requests the provenance of the printed
+ * ranges, `hex_literals` prints integer literals of 16 and above in
+ * hexadecimal, and `alpha_cache` lets the functions of the module share the
+ * answers of Z3 about conditions that only differ by the names of their
+ * variables.
+ *
+ * Never returns null. The result must be released with `rellic_result_free`.
+ */
+RELLIC_C_API rellic_result *rellic_decompile(const char *bitcode, size_t size,
+                                             const char *options_json);
+
+RELLIC_C_API void rellic_result_free(rellic_result *result);
+
+/* Whether the decompilation succeeded, otherwise see `rellic_result_error` */
+RELLIC_C_API int rellic_result_succeeded(const rellic_result *result);
+
+/*
+ * The following return strings owned by `result`, which stay valid until it is
+ * released, and store their length in `size` if it is not null. They are empty
+ * when the decompilation failed.
+ */
+
+/* The C source */
+RELLIC_C_API const char *rellic_result_code(const rellic_result *result,
+                                            size_t *size);
+/*
+ * The provenance of the ranges of the C source as a JSON array, in the format
+ * of `rellic-decomp --provenance`. Empty unless requested.
+ */
+RELLIC_C_API const char *rellic_result_provenance(
+    const rellic_result *result, size_t *size);
+/* The statistics of the decompilation as a JSON object */
+RELLIC_C_API const char *rellic_result_stats(const rellic_result *result,
+                                             size_t *size);
+/* The functions that were not fully refined, as a JSON array of names */
+RELLIC_C_API const char *rellic_result_degraded_functions(
+    const rellic_result *result, size_t *size);
+/* Why the decompilation failed, empty if it succeeded */
+RELLIC_C_API const char *rellic_result_error(const rellic_result *result,
+                                             size_t *size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* RELLIC_RELLIC_H */
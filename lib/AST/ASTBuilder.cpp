@@ -85,6 +85,26 @@ static unsigned GetOperatorPrecedence(clang::Expr *op) {
   return 0U;
 }
 
+// Type of `expr` after `clang::Sema::DefaultFunctionArrayLvalueConversion`, or
+// a null type if that takes more than an lvalue-to-rvalue conversion
+static clang::QualType GetRValueType(clang::Expr *expr) {
+  auto type{expr->getType()};
+  if (expr->hasPlaceholderType() || type->isArrayType() ||
+      type->isFunctionType() || type->isAtomicType() || type->isVoidType() ||
+      type->isNullPtrType()) {
+    return clang::QualType();
+  }
+  return expr->isGLValue() ? type.getUnqualifiedType() : type;
+}
+
+// Whether the integer promotions leave `expr`, whose rvalue is of type `type`,
+// as it is
+static bool IsUnpromotedInt(clang::ASTContext &ctx, clang::Expr *expr,
+                            clang::QualType type) {
+  return type->isIntegerType() && !type->isEnumeralType() &&
+         !ctx.isPromotableIntegerType(type) && !expr->getSourceBitField();
+}
+
 }  // namespace
 
 ASTBuilder::ASTBuilder(clang::ASTUnit &unit)
@@ -177,6 +197,21 @@ clang::StringLiteral *ASTBuilder::CreateStrLit(std::string val) {
       /*Pascal=*/false, type, clang::SourceLocation());
 }
 
+clang::StringLiteral *ASTBuilder::CreateWideStrLit(clang::QualType char_type,
+                                                   llvm::StringRef data) {
+  auto width{ctx.getTypeSize(char_type)};
+  clang::StringLiteral::StringKind kind;
+  if (width == 16) {
+    kind = clang::StringLiteral::StringKind::UTF16;
+  } else {
+    CHECK_THROW(width == 32) << "Unsupported string literal code unit width";
+    kind = clang::StringLiteral::StringKind::UTF32;
+  }
+  auto type{ctx.getStringLiteralArrayType(char_type, data.size() / (width / 8))};
+  return clang::StringLiteral::Create(ctx, data, kind, /*Pascal=*/false, type,
+                                      clang::SourceLocation());
+}
+
 clang::Expr *ASTBuilder::CreateFPLit(llvm::APFloat val) {
   auto size{llvm::APFloat::getSizeInBits(val.getSemantics())};
   auto type{GetLeastRealTypeForBitWidth(size)};
@@ -315,12 +350,295 @@ clang::DeclStmt *ASTBuilder::CreateDeclStmt(clang::Decl *decl) {
 clang::DeclRefExpr *ASTBuilder::CreateDeclRef(clang::ValueDecl *val) {
   CHECK(val) << "Should not be null in CreateDeclRef.";
   clang::DeclarationNameInfo dni(val->getDeclName(), clang::SourceLocation());
+  if (fast_path && !val->isInvalidDecl()) {
+    // In C, variables are lvalues, while functions and enumerators are rvalues
+    auto func{clang::dyn_cast<clang::FunctionDecl>(val)};
+    auto is_var{clang::isa<clang::VarDecl>(val) &&
+                !val->getType()->isVoidType()};
+    auto is_enum{clang::isa<clang::EnumConstantDecl>(val)};
+    if (is_var || is_enum ||
+        (func && func->hasPrototype() && !func->getBuiltinID())) {
+      auto ref{clang::DeclRefExpr::Create(
+          ctx, clang::NestedNameSpecifierLoc(), clang::SourceLocation(), val,
+          /*RefersToEnclosingVariableOrCapture=*/false, dni, val->getType(),
+          is_var ? clang::VK_LValue : clang::VK_PRValue)};
+      val->setReferenced();
+      if (!is_enum) {
+        val->markUsed(ctx);
+      }
+      return ref;
+    }
+  }
   clang::CXXScopeSpec ss;
   auto er{sema.BuildDeclarationNameExpr(ss, dni, val)};
   CHECK(er.isUsable());
   return er.getAs<clang::DeclRefExpr>();
 }
 
+clang::Expr *ASTBuilder::CreateRValue(clang::Expr *expr) {
+  if (!expr->isGLValue()) {
+    return expr;
+  }
+  return clang::ImplicitCastExpr::Create(
+      ctx, expr->getType().getUnqualifiedType(), clang::CK_LValueToRValue, expr,
+      /*BasePath=*/nullptr, clang::VK_PRValue, clang::FPOptionsOverride());
+}
+
+clang::CStyleCastExpr *ASTBuilder::CreateCStyleCastFast(clang::QualType type,
+                                                        clang::Expr *expr) {
+  // Only casts between integers and pointers, whose kind is decided the way
+  // `clang::Sema::PrepareScalarCast` does
+  auto src_type{GetRValueType(expr)};
+  if (src_type.isNull() || type.hasQualifiers() || type->isAtomicType()) {
+    return nullptr;
+  }
+  auto src_ptr{src_type->isPointerType()};
+  auto dst_ptr{type->isPointerType()};
+  if (!(src_ptr || src_type->isIntegerType()) ||
+      !(dst_ptr || type->isIntegerType())) {
+    return nullptr;
+  }
+
+  clang::CastKind kind;
+  auto null_check{false};
+  if (ctx.hasSameUnqualifiedType(src_type, type)) {
+    kind = clang::CK_NoOp;
+  } else if (src_ptr && dst_ptr) {
+    if (src_type->getPointeeType().getAddressSpace() !=
+        type->getPointeeType().getAddressSpace()) {
+      return nullptr;
+    }
+    kind = ctx.hasCvrSimilarType(src_type, type) ? clang::CK_NoOp
+                                                  : clang::CK_BitCast;
+  } else if (src_ptr) {
+    kind = type->isBooleanType() ? clang::CK_PointerToBoolean
+                                 : clang::CK_PointerToIntegral;
+  } else if (dst_ptr) {
+    kind = clang::CK_IntegralToPointer;
+    null_check = true;
+  } else {
+    kind = type->isBooleanType() ? clang::CK_IntegralToBoolean
+                                 : clang::CK_IntegralCast;
+  }
+
+  expr = CreateRValue(expr);
+  if (null_check && expr->isNullPointerConstant(
+                        ctx, clang::Expr::NPC_ValueDependentIsNull)) {
+    kind = clang::CK_NullToPointer;
+  }
+  return clang::CStyleCastExpr::Create(
+      ctx, type, clang::VK_PRValue, kind, expr, /*BasePath=*/nullptr,
+      clang::FPOptionsOverride(), ctx.getTrivialTypeSourceInfo(type),
+      clang::SourceLocation(), clang::SourceLocation());
+}
+
+clang::UnaryOperator *ASTBuilder::CreateUnaryOpFast(
+    clang::UnaryOperatorKind opc, clang::Expr *expr) {
+  clang::QualType type;
+  auto vk{clang::VK_PRValue};
+  if (opc == clang::UO_AddrOf) {
+    // The operand is not converted. It must be an ordinary lvalue or a
+    // function, and not a register variable.
+    if (expr->hasPlaceholderType() ||
+        expr->getObjectKind() != clang::OK_Ordinary ||
+        !(expr->isLValue() || expr->getType()->isFunctionType())) {
+      return nullptr;
+    }
+    auto op{expr->IgnoreParens()};
+    if (auto ref = clang::dyn_cast<clang::DeclRefExpr>(op)) {
+      auto var{clang::dyn_cast<clang::VarDecl>(ref->getDecl())};
+      if (var && var->getStorageClass() == clang::SC_Register) {
+        return nullptr;
+      }
+    }
+    // C99 takes the type of `&*p` from `p`
+    auto deref{clang::dyn_cast<clang::UnaryOperator>(op)};
+    if (ctx.getLangOpts().C99 && deref &&
+        deref->getOpcode() == clang::UO_Deref) {
+      type = deref->getSubExpr()->getType();
+    } else {
+      type = ctx.getPointerType(expr->getType());
+    }
+    return clang::UnaryOperator::Create(
+        ctx, expr, opc, type, vk, clang::OK_Ordinary, clang::SourceLocation(),
+        /*CanOverflow=*/false, clang::FPOptionsOverride());
+  }
+
+  auto op_type{GetRValueType(expr)};
+  if (op_type.isNull()) {
+    return nullptr;
+  }
+  switch (opc) {
+    case clang::UO_Deref: {
+      auto ptr{op_type->getAs<clang::PointerType>()};
+      if (!ptr) {
+        return nullptr;
+      }
+      type = ptr->getPointeeType();
+      if (type->isVoidType() || type->isFunctionType()) {
+        return nullptr;
+      }
+      vk = clang::VK_LValue;
+      break;
+    }
+    case clang::UO_LNot:
+      // No integer promotions here
+      if (!op_type->isIntegerType() && !op_type->isPointerType()) {
+        return nullptr;
+      }
+      type = ctx.getLogicalOperationType();
+      break;
+    case clang::UO_Not:
+      if (!IsUnpromotedInt(ctx, expr, op_type)) {
+        return nullptr;
+      }
+      type = op_type;
+      break;
+    default:
+      return nullptr;
+  }
+  return clang::UnaryOperator::Create(
+      ctx, CreateRValue(expr), opc, type, vk, clang::OK_Ordinary,
+      clang::SourceLocation(), /*CanOverflow=*/false,
+      clang::FPOptionsOverride());
+}
+
+clang::BinaryOperator *ASTBuilder::CreateBinaryOpFast(
+    clang::BinaryOperatorKind opc, clang::Expr *lhs, clang::Expr *rhs) {
+  auto lhs_type{GetRValueType(lhs)};
+  auto rhs_type{GetRValueType(rhs)};
+  if (lhs_type.isNull() || rhs_type.isNull()) {
+    return nullptr;
+  }
+
+  clang::QualType type;
+  switch (opc) {
+    case clang::BO_Assign:
+      // The value is not converted if it already has the type of `lhs`, which
+      // is also the type of the assignment
+      if (!lhs_type->isScalarType() ||
+          lhs->getObjectKind() != clang::OK_Ordinary ||
+          lhs->isModifiableLvalue(ctx) != clang::Expr::MLV_Valid ||
+          !ctx.hasSameType(lhs_type, rhs_type)) {
+        return nullptr;
+      }
+      return clang::BinaryOperator::Create(
+          ctx, lhs, CreateRValue(rhs), opc, lhs_type, clang::VK_PRValue,
+          clang::OK_Ordinary, clang::SourceLocation(),
+          clang::FPOptionsOverride());
+    case clang::BO_LAnd:
+    case clang::BO_LOr:
+      // Each operand only goes through the integer promotions
+      if (!(lhs_type->isPointerType() || IsUnpromotedInt(ctx, lhs, lhs_type)) ||
+          !(rhs_type->isPointerType() || IsUnpromotedInt(ctx, rhs, rhs_type))) {
+        return nullptr;
+      }
+      type = ctx.getLogicalOperationType();
+      break;
+    case clang::BO_Mul:
+    case clang::BO_Div:
+    case clang::BO_Rem:
+    case clang::BO_Add:
+    case clang::BO_Sub:
+    case clang::BO_Shl:
+    case clang::BO_Shr:
+    case clang::BO_And:
+    case clang::BO_Xor:
+    case clang::BO_Or:
+    case clang::BO_LT:
+    case clang::BO_GT:
+    case clang::BO_LE:
+    case clang::BO_GE:
+    case clang::BO_EQ:
+    case clang::BO_NE:
+      // The usual arithmetic conversions leave integers of the exact same type
+      // alone, as long as they are not promoted
+      if (lhs_type != rhs_type || !IsUnpromotedInt(ctx, lhs, lhs_type) ||
+          !IsUnpromotedInt(ctx, rhs, rhs_type)) {
+        return nullptr;
+      }
+      type = clang::BinaryOperator::isComparisonOp(opc)
+                 ? ctx.getLogicalOperationType()
+                 : lhs_type;
+      break;
+    default:
+      return nullptr;
+  }
+  return clang::BinaryOperator::Create(
+      ctx, CreateRValue(lhs), CreateRValue(rhs), opc, type, clang::VK_PRValue,
+      clang::OK_Ordinary, clang::SourceLocation(), clang::FPOptionsOverride());
+}
+
+clang::CallExpr *ASTBuilder::CreateCallFast(clang::Expr *callee,
+                                            std::vector<clang::Expr *> &args) {
+  // Calls to builtins are checked and sometimes rewritten by Sema
+  auto naked{callee->IgnoreParens()};
+  if (auto addr = clang::dyn_cast<clang::UnaryOperator>(naked)) {
+    if (addr->getOpcode() == clang::UO_AddrOf) {
+      naked = addr->getSubExpr()->IgnoreParens();
+    }
+  }
+  if (auto ref = clang::dyn_cast<clang::DeclRefExpr>(naked)) {
+    auto func{clang::dyn_cast<clang::FunctionDecl>(ref->getDecl())};
+    if (func && func->getBuiltinID()) {
+      return nullptr;
+    }
+  }
+
+  // The callee decays to a pointer if it is a function
+  if (callee->hasPlaceholderType()) {
+    return nullptr;
+  }
+  auto callee_type{callee->getType()};
+  auto decays{callee_type->isFunctionType()};
+  if (decays) {
+    callee_type = ctx.getPointerType(callee_type);
+  } else {
+    callee_type = GetRValueType(callee);
+    if (callee_type.isNull() || !callee_type->isPointerType()) {
+      return nullptr;
+    }
+  }
+  auto proto{callee_type->castAs<clang::PointerType>()
+                 ->getPointeeType()
+                 ->getAs<clang::FunctionProtoType>()};
+  if (!proto || proto->isVariadic() || proto->getNumParams() != args.size()) {
+    return nullptr;
+  }
+  auto ret_type{proto->getReturnType()};
+  if (!ret_type->isVoidType() && ret_type->isIncompleteType()) {
+    return nullptr;
+  }
+  // Arguments are initialized as if assigned to the parameters, which does not
+  // convert them if they already have the same type
+  for (unsigned i{0}; i < args.size(); ++i) {
+    auto arg_type{GetRValueType(args[i])};
+    if (arg_type.isNull() ||
+        !ctx.hasSameUnqualifiedType(arg_type, proto->getParamType(i))) {
+      return nullptr;
+    }
+  }
+
+  clang::Expr *fn{callee};
+  if (decays) {
+    fn = clang::ImplicitCastExpr::Create(
+        ctx, callee_type, clang::CK_FunctionToPointerDecay, callee,
+        /*BasePath=*/nullptr, clang::VK_PRValue, clang::FPOptionsOverride());
+  } else {
+    fn = CreateRValue(callee);
+  }
+  std::vector<clang::Expr *> rvalues;
+  rvalues.reserve(args.size());
+  for (auto arg : args) {
+    rvalues.push_back(CreateRValue(arg));
+  }
+  return clang::CallExpr::Create(ctx, fn, rvalues,
+                                 ret_type.getNonLValueExprType(ctx),
+                                 clang::VK_PRValue, clang::SourceLocation(),
+                                 clang::FPOptionsOverride(),
+                                 /*MinNumArgs=*/proto->getNumParams());
+}
+
 clang::ParenExpr *ASTBuilder::CreateParen(clang::Expr *expr) {
   return new (ctx)
       clang::ParenExpr(clang::SourceLocation(), clang::SourceLocation(), expr);
@@ -332,6 +650,11 @@ clang::CStyleCastExpr *ASTBuilder::CreateCStyleCast(clang::QualType type,
   if (CExprPrecedence::UnaryOp < GetOperatorPrecedence(expr)) {
     expr = CreateParen(expr);
   }
+  if (fast_path) {
+    if (auto cast = CreateCStyleCastFast(type, expr)) {
+      return cast;
+    }
+  }
   auto er{sema.BuildCStyleCastExpr(clang::SourceLocation(),
                                    ctx.getTrivialTypeSourceInfo(type),
                                    clang::SourceLocation(), expr)};
@@ -345,6 +668,11 @@ clang::UnaryOperator *ASTBuilder::CreateUnaryOp(clang::UnaryOperatorKind opc,
   if (GetOperatorPrecedence(opc) < GetOperatorPrecedence(expr)) {
     expr = CreateParen(expr);
   }
+  if (fast_path) {
+    if (auto op = CreateUnaryOpFast(opc, expr)) {
+      return op;
+    }
+  }
   auto er{sema.CreateBuiltinUnaryOp(clang::SourceLocation(), opc, expr)};
   CHECK(er.isUsable());
   return er.getAs<clang::UnaryOperator>();
@@ -360,6 +688,11 @@ clang::BinaryOperator *ASTBuilder::CreateBinaryOp(clang::BinaryOperatorKind opc,
   if (GetOperatorPrecedence(opc) < GetOperatorPrecedence(rhs)) {
     rhs = CreateParen(rhs);
   }
+  if (fast_path) {
+    if (auto op = CreateBinaryOpFast(opc, lhs, rhs)) {
+      return op;
+    }
+  }
   auto er{sema.CreateBuiltinBinOp(clang::SourceLocation(), opc, lhs, rhs)};
   CHECK(er.isUsable());
   return er.getAs<clang::BinaryOperator>();
@@ -392,6 +725,11 @@ clang::CallExpr *ASTBuilder::CreateCall(clang::Expr *callee,
   if (CExprPrecedence::SpecialOp < GetOperatorPrecedence(callee)) {
     callee = CreateParen(callee);
   }
+  if (fast_path) {
+    if (auto call = CreateCallFast(callee, args)) {
+      return call;
+    }
+  }
   auto er{sema.BuildCallExpr(/*Scope=*/nullptr, callee, clang::SourceLocation(),
                              args, clang::SourceLocation())};
   CHECK(er.isUsable());
@@ -420,8 +758,45 @@ clang::MemberExpr *ASTBuilder::CreateFieldAcc(clang::Expr *base,
   CHECK(base && field) << "Should not be null in CreateFieldAcc.";
   CHECK(!is_arrow || base->getType()->isPointerType())
       << "Base operand in arrow operator must be a pointer!";
-  clang::CXXScopeSpec ss;
   auto dap{clang::DeclAccessPair::make(field, field->getAccess())};
+  if (fast_path) {
+    // Field accesses never convert their base. The field picks up the
+    // qualifiers of the structure, and is an lvalue if the structure is.
+    auto vk{clang::VK_LValue};
+    if (!is_arrow) {
+      vk = base->getObjectKind() == clang::OK_Ordinary ? base->getValueKind()
+                                                       : clang::VK_PRValue;
+    }
+    auto ok{vk != clang::VK_PRValue && field->isBitField()
+                ? clang::OK_BitField
+                : clang::OK_Ordinary};
+    auto base_type{base->getType()};
+    if (is_arrow) {
+      base_type = base_type->castAs<clang::PointerType>()->getPointeeType();
+    }
+    auto base_quals{base_type.getQualifiers()};
+    base_quals.removeObjCGCAttr();
+    if (field->isMutable()) {
+      base_quals.removeConst();
+    }
+    auto type{field->getType()};
+    auto field_quals{ctx.getCanonicalType(type).getQualifiers()};
+    auto quals{base_quals + field_quals};
+    if (quals != field_quals) {
+      type = ctx.getQualifiedType(type, quals);
+    }
+    if (base_type->hasAttr(clang::attr::NoDeref)) {
+      type = ctx.getAttributedType(clang::attr::NoDeref, type, type);
+    }
+    auto member{clang::MemberExpr::Create(
+        ctx, base, is_arrow, clang::SourceLocation(),
+        clang::NestedNameSpecifierLoc(), clang::SourceLocation(), field, dap,
+        clang::DeclarationNameInfo(), /*TemplateArgs=*/nullptr, type, vk, ok,
+        clang::NOUR_None)};
+    field->setReferenced();
+    return member;
+  }
+  clang::CXXScopeSpec ss;
   auto er{sema.BuildFieldReferenceExpr(base, is_arrow, clang::SourceLocation(),
                                        ss, field, dap,
                                        clang::DeclarationNameInfo())};
@@ -511,6 +886,24 @@ clang::BreakStmt *ASTBuilder::CreateBreak() {
   return new (ctx) clang::BreakStmt(clang::SourceLocation());
 }
 
+clang::LabelDecl *ASTBuilder::CreateLabelDecl(clang::DeclContext *decl_ctx,
+                                              std::string name) {
+  return clang::LabelDecl::Create(ctx, decl_ctx, clang::SourceLocation(),
+                                  CreateIdentifier(name));
+}
+
+clang::LabelStmt *ASTBuilder::CreateLabelStmt(clang::LabelDecl *label,
+                                              clang::Stmt *body) {
+  auto stmt{new (ctx) clang::LabelStmt(clang::SourceLocation(), label, body)};
+  label->setStmt(stmt);
+  return stmt;
+}
+
+clang::GotoStmt *ASTBuilder::CreateGoto(clang::LabelDecl *label) {
+  return new (ctx)
+      clang::GotoStmt(label, clang::SourceLocation(), clang::SourceLocation());
+}
+
 clang::ReturnStmt *ASTBuilder::CreateReturn(clang::Expr *retval) {
   // auto sr{sema.BuildReturnStmt(clang::SourceLocation(), retval)};
   // CHECK(sr.isUsable());
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/ASTUnitFactory.h"
+
+#include <clang/Basic/DiagnosticOptions.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Frontend/Utils.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include "rellic/Exception.h"
+
+namespace rellic {
+
+static constexpr const char *kFileName{"out.c"};
+
+ASTUnitFactory::ASTUnitFactory()
+    : pch_ops(std::make_shared<clang::PCHContainerOperations>()) {}
+
+std::vector<std::string> ASTUnitFactory::GetArgs(const std::string &triple) {
+  std::vector<std::string> args{"-Wno-pointer-to-int-cast",
+                                "-Wno-pointer-sign", "-target", triple};
+  // Silence clang warning
+  // warning: unknown platform, assumming -mfloat-abi=soft
+  if (llvm::Triple(triple).isARM()) {
+    args.push_back("-mfloat-abi=soft");
+  }
+  return args;
+}
+
+ASTUnitFactory &ASTUnitFactory::Get() {
+  static ASTUnitFactory factory;
+  return factory;
+}
+
+std::shared_ptr<clang::CompilerInvocation> ASTUnitFactory::GetInvocation(
+    const std::string &triple) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto &invocation{invocations[triple]};
+  if (invocation) {
+    return invocation;
+  }
+
+  auto args{GetArgs(triple)};
+  // The driver is forced into -fsyntax-only mode
+  std::vector<const char *> argv{"clang"};
+  for (auto &arg : args) {
+    argv.push_back(arg.c_str());
+  }
+  argv.push_back(kFileName);
+
+  clang::CreateInvocationOptions opts;
+  opts.Diags = clang::CompilerInstance::createDiagnostics(
+      new clang::DiagnosticOptions());
+  auto created{clang::createInvocation(argv, std::move(opts))};
+  CHECK_THROW(created) << "Cannot create compiler invocation for " << triple;
+  invocation = std::move(created);
+  return invocation;
+}
+
+std::unique_ptr<clang::ASTUnit> ASTUnitFactory::Create(
+    const std::string &triple) {
+  auto invocation{
+      std::make_shared<clang::CompilerInvocation>(*GetInvocation(triple))};
+  // The preprocessor takes ownership of the buffer
+  invocation->getPreprocessorOpts().addRemappedFile(
+      kFileName, llvm::MemoryBuffer::getMemBuffer("", kFileName).release());
+
+  auto diags{clang::CompilerInstance::createDiagnostics(
+      new clang::DiagnosticOptions())};
+  std::unique_ptr<clang::ASTUnit> unit{
+      clang::ASTUnit::LoadFromCompilerInvocationAction(invocation, pch_ops,
+                                                       diags)};
+  CHECK_THROW(unit) << "Cannot create ASTUnit for " << triple;
+  return unit;
+}
+
+}  // namespace rellic
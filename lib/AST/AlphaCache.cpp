@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/AlphaCache.h"
+
+#include <string>
+#include <unordered_set>
+
+namespace rellic {
+
+// Appends the constants of `expr` to `vars` in the order they are first met
+static void CollectConsts(z3::expr expr, std::unordered_set<unsigned> &visited,
+                          z3::expr_vector &vars) {
+  if (!expr.is_app() || !visited.insert(expr.id()).second) {
+    return;
+  }
+  if (expr.is_const() && expr.decl().decl_kind() == Z3_OP_UNINTERPRETED) {
+    vars.push_back(expr);
+    return;
+  }
+  for (unsigned i{0}; i < expr.num_args(); ++i) {
+    CollectConsts(expr.arg(i), visited, vars);
+  }
+}
+
+// The canonical names of `vars`
+static z3::expr_vector GetCanonicalVars(const z3::expr_vector &vars) {
+  z3::expr_vector canonical{vars.ctx()};
+  for (unsigned i{0}; i < vars.size(); ++i) {
+    canonical.push_back(vars.ctx().constant(
+        ("alpha!" + std::to_string(i)).c_str(), vars[i].get_sort()));
+  }
+  return canonical;
+}
+
+AlphaCache::Key AlphaCache::Canonicalize(z3::expr expr) {
+  std::unordered_set<unsigned> visited;
+  z3::expr_vector vars{expr.ctx()};
+  CollectConsts(expr, visited, vars);
+  auto canonical{GetCanonicalVars(vars)};
+  return {expr.substitute(vars, canonical), vars};
+}
+
+unsigned AlphaCache::Intern(z3::expr expr) {
+  z3::expr translated(ctx, Z3_translate(expr.ctx(), expr, ctx));
+  auto [it, inserted]{ids.try_emplace(translated.id(), exprs.size())};
+  if (inserted) {
+    exprs.push_back(translated);
+  }
+  return it->second;
+}
+
+std::optional<bool> AlphaCache::GetProof(const Key &key) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it{proofs.find(Intern(key.expr))};
+  if (it == proofs.end()) {
+    ++misses;
+    return std::nullopt;
+  }
+  ++hits;
+  return it->second;
+}
+
+void AlphaCache::SetProof(const Key &key, bool valid) {
+  std::lock_guard<std::mutex> lock(mutex);
+  proofs[Intern(key.expr)] = valid;
+}
+
+std::optional<z3::expr> AlphaCache::GetSimplified(const Key &key) {
+  auto &src_ctx{key.expr.ctx()};
+  std::optional<z3::expr> result;
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    auto it{simplified.find(Intern(key.expr))};
+    if (it == simplified.end()) {
+      ++misses;
+      return std::nullopt;
+    }
+    ++hits;
+    auto canonical{exprs[it->second]};
+    result.emplace(src_ctx, Z3_translate(ctx, canonical, src_ctx));
+  }
+  return result->substitute(GetCanonicalVars(key.vars), key.vars);
+}
+
+void AlphaCache::SetSimplified(const Key &key, z3::expr simplified_expr) {
+  std::unordered_set<unsigned> vars;
+  for (auto var : key.vars) {
+    vars.insert(var.id());
+  }
+  std::unordered_set<unsigned> visited;
+  z3::expr_vector consts{simplified_expr.ctx()};
+  CollectConsts(simplified_expr, visited, consts);
+  for (auto var : consts) {
+    if (!vars.count(var.id())) {
+      return;
+    }
+  }
+  auto canonical{
+      simplified_expr.substitute(key.vars, GetCanonicalVars(key.vars))};
+
+  std::lock_guard<std::mutex> lock(mutex);
+  auto idx{Intern(key.expr)};
+  simplified[idx] = Intern(canonical);
+}
+
+}  // namespace rellic
@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/BDD.h"
+
+#include <algorithm>
+#include <limits>
+
+namespace rellic {
+
+// Constants sort after every variable
+static constexpr unsigned kTerminalVar{std::numeric_limits<unsigned>::max()};
+
+BDD::BDD(size_t max_nodes) : max_nodes(max_nodes) { Clear(); }
+
+void BDD::Clear() {
+  nodes = {{kTerminalVar, False, False}, {kTerminalVar, True, True}};
+  unique.clear();
+  ite_cache.clear();
+  overflowed = false;
+}
+
+unsigned BDD::TopVar(Node node) const { return nodes[node].a; }
+
+BDD::Node BDD::Cofactor(Node node, unsigned var, bool value) const {
+  auto &data{nodes[node]};
+  if (data.a != var) {
+    return node;
+  }
+  return value ? data.c : data.b;
+}
+
+BDD::Node BDD::MakeNode(unsigned var, Node lo, Node hi) {
+  if (lo == hi) {
+    return lo;
+  }
+
+  auto [it, inserted]{unique.try_emplace({var, lo, hi}, nodes.size())};
+  if (inserted) {
+    if (nodes.size() >= max_nodes) {
+      overflowed = true;
+      unique.erase(it);
+      return False;
+    }
+    nodes.push_back({var, lo, hi});
+  }
+  return it->second;
+}
+
+BDD::Node BDD::Var(unsigned var) { return MakeNode(var, False, True); }
+
+BDD::Node BDD::Ite(Node f, Node g, Node h) {
+  if (f == True) {
+    return g;
+  }
+  if (f == False) {
+    return h;
+  }
+  if (g == h) {
+    return g;
+  }
+  if (g == True && h == False) {
+    return f;
+  }
+  if (overflowed) {
+    return False;
+  }
+
+  auto it{ite_cache.find({f, g, h})};
+  if (it != ite_cache.end()) {
+    return it->second;
+  }
+
+  auto var{std::min({TopVar(f), TopVar(g), TopVar(h)})};
+  auto hi{Ite(Cofactor(f, var, true), Cofactor(g, var, true),
+              Cofactor(h, var, true))};
+  auto lo{Ite(Cofactor(f, var, false), Cofactor(g, var, false),
+              Cofactor(h, var, false))};
+  auto result{MakeNode(var, lo, hi)};
+  if (!overflowed) {
+    // The cache is only an accelerator, so it is simply dropped when it grows
+    // as large as the node table may
+    if (ite_cache.size() >= max_nodes) {
+      ite_cache.clear();
+    }
+    ite_cache[{f, g, h}] = result;
+  }
+  return result;
+}
+
+}  // namespace rellic
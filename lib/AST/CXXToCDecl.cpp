@@ -14,6 +14,8 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include "rellic/Log.h"
+
 namespace rellic {
 
 namespace {
@@ -40,10 +42,28 @@ static std::string GetMangledName(clang::NamedDecl *decl) {
 
 }  // namespace
 
-CXXToCDeclVisitor::CXXToCDeclVisitor(clang::ASTUnit &unit)
+bool LoweredRecords::Claim(const std::string &name) {
+  std::unique_lock<std::mutex> lock(mutex);
+  return names.insert(name).second;
+}
+
+CXXToCDeclVisitor::CXXToCDeclVisitor(clang::ASTUnit &unit,
+                                     LoweredRecords *shared)
     : ast_ctx(unit.getASTContext()),
       c_tu(ast_ctx.getTranslationUnitDecl()),
-      ast(unit) {}
+      ast(unit),
+      shared(shared) {}
+
+bool CXXToCDeclVisitor::ShouldLowerMembers(clang::CXXRecordDecl *cls) {
+  // Declarations that are not definitions have no members to lower
+  if (!cls->isThisDeclarationADefinition()) {
+    return true;
+  }
+  if (!lowered.insert(cls->getCanonicalDecl()).second) {
+    return false;
+  }
+  return !shared || shared->Claim(GetMangledName(cls));
+}
 
 clang::QualType CXXToCDeclVisitor::GetAsCType(clang::QualType type) {
   const clang::Type *result;
@@ -61,7 +81,7 @@ clang::QualType CXXToCDeclVisitor::GetAsCType(clang::QualType type) {
     result = attr_type.getTypePtr();
   } else if (auto cls = type->getAsCXXRecordDecl()) {
     // Handle class-type attributes by translating to struct types
-    auto iter = c_decls.find(cls);
+    auto iter = c_decls.find(cls->getCanonicalDecl());
     CHECK(iter != c_decls.end())
         << "C struct for class" << cls->getNameAsString() << " does not exist";
     auto decl = clang::cast<clang::RecordDecl>(iter->second);
@@ -74,7 +94,7 @@ clang::QualType CXXToCDeclVisitor::GetAsCType(clang::QualType type) {
 
 bool CXXToCDeclVisitor::VisitFunctionDecl(clang::FunctionDecl *cxx_func) {
   auto name = cxx_func->getNameAsString();
-  DLOG(INFO) << "VisitFunctionDecl: " << name;
+  RELLIC_LOG(Types) << "VisitFunctionDecl: " << name;
   // Check if the corresponding C function doesn't exist already
   if (c_decls.count(cxx_func)) {
     LOG(WARNING) << "Asking to re-generate function: " << name << "; returning";
@@ -112,14 +132,14 @@ bool CXXToCDeclVisitor::VisitFunctionDecl(clang::FunctionDecl *cxx_func) {
 
 bool CXXToCDeclVisitor::VisitCXXMethodDecl(clang::CXXMethodDecl *method) {
   auto name = method->getNameAsString();
-  DLOG(INFO) << "VisitCXXMethodDecl: " << name;
+  RELLIC_LOG(Types) << "VisitCXXMethodDecl: " << name;
   // Get the result of `VisitFunctionDecl`
   auto func_iter = c_decls.find(method);
   CHECK(func_iter != c_decls.end())
       << "Method " << name
       << " does not have a C function equivalent created by VisitFunctionDecl";
   // Get C struct equivalent of `method` parent class
-  auto struct_iter = c_decls.find(method->getParent());
+  auto struct_iter = c_decls.find(method->getParent()->getCanonicalDecl());
   CHECK(struct_iter != c_decls.end())
       << "Method " << name << " does not have a parent";
   // Get the `this` pointer type
@@ -159,9 +179,10 @@ bool CXXToCDeclVisitor::VisitRecordDecl(clang::RecordDecl *record) {
 
 bool CXXToCDeclVisitor::VisitCXXRecordDecl(clang::CXXRecordDecl *cls) {
   auto name = cls->getNameAsString();
-  DLOG(INFO) << "VisitCXXRecordDecl: " << name;
-  if (c_decls.count(cls)) {
-    LOG(WARNING) << "Asking to re-generate class " << name << " ; returning";
+  RELLIC_LOG(Types) << "VisitCXXRecordDecl: " << name;
+  // Redeclarations share the struct of the first one
+  auto canonical = cls->getCanonicalDecl();
+  if (c_decls.count(canonical)) {
     return true;
   }
   // Create a vtable
@@ -172,7 +193,7 @@ bool CXXToCDeclVisitor::VisitCXXRecordDecl(clang::CXXRecordDecl *cls) {
   // Complete the C struct definition
   decl->completeDefinition();
   // Save the result
-  c_decls[cls] = decl;
+  c_decls[canonical] = decl;
   // Add the C struct to the C translation unit
   c_tu->addDecl(decl);
   // Done
@@ -181,9 +202,9 @@ bool CXXToCDeclVisitor::VisitCXXRecordDecl(clang::CXXRecordDecl *cls) {
 
 bool CXXToCDeclVisitor::VisitFieldDecl(clang::FieldDecl *field) {
   auto name = field->getNameAsString();
-  DLOG(INFO) << "FieldDecl: " << name;
+  RELLIC_LOG(Types) << "FieldDecl: " << name;
   // Get parent C struct
-  auto iter = c_decls.find(field->getParent());
+  auto iter = c_decls.find(field->getParent()->getCanonicalDecl());
   CHECK(iter != c_decls.end()) << "Field " << name << " does not have a parent";
   auto parent = clang::cast<clang::RecordDecl>(iter->second);
   // Create the field
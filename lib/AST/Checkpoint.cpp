@@ -0,0 +1,144 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/Checkpoint.h"
+
+#include <clang/AST/Expr.h>
+#include <glog/logging.h>
+
+#include <unordered_set>
+
+namespace rellic {
+
+Checkpoints::Checkpoints(DecompilationContext &dec_ctx) : dec_ctx(dec_ctx) {
+  dec_ctx.checkpoints = this;
+}
+
+Checkpoints::~Checkpoints() {
+  if (dec_ctx.checkpoints == this) {
+    dec_ctx.checkpoints = nullptr;
+  }
+}
+
+void Checkpoints::Record(Version &version) {
+  std::unordered_set<clang::Stmt *> visited;
+  std::vector<clang::Stmt *> worklist{version.body};
+  while (!worklist.empty()) {
+    auto stmt{worklist.back()};
+    worklist.pop_back();
+    // Placeholders such as `marker_expr` are shared between statements
+    if (!stmt || !visited.insert(stmt).second) {
+      continue;
+    }
+    version.stmts.push_back(stmt);
+    for (auto child : stmt->children()) {
+      version.children.push_back(child);
+      worklist.push_back(child);
+    }
+
+    auto cond{dec_ctx.conds.find(stmt)};
+    if (cond != dec_ctx.conds.end()) {
+      version.conds.emplace_back(stmt, dec_ctx.z3_exprs[cond->second]);
+    }
+    auto stmt_prov{dec_ctx.stmt_provenance.find(stmt)};
+    if (stmt_prov != dec_ctx.stmt_provenance.end()) {
+      version.stmt_provenance.push_back(*stmt_prov);
+    }
+    if (auto expr = clang::dyn_cast<clang::Expr>(stmt)) {
+      auto use_prov{dec_ctx.use_provenance.find(expr)};
+      if (use_prov != dec_ctx.use_provenance.end()) {
+        version.use_provenance.push_back(*use_prov);
+      }
+    }
+  }
+  version.recorded = true;
+}
+
+size_t Checkpoints::Create() {
+  Versions versions;
+  for (auto decl : dec_ctx.ast_ctx.getTranslationUnitDecl()->decls()) {
+    auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+    if (!fdecl || !fdecl->doesThisDeclarationHaveABody()) {
+      continue;
+    }
+    auto &version{current[fdecl]};
+    if (!version) {
+      version = std::make_shared<Version>(fdecl->getBody());
+    }
+    versions[fdecl] = version;
+  }
+  checkpoints.push_back(std::move(versions));
+  return checkpoints.size() - 1;
+}
+
+void Checkpoints::Preserve(clang::FunctionDecl *fdecl) {
+  auto it{current.find(fdecl)};
+  if (it == current.end()) {
+    return;
+  }
+  if (!it->second->recorded) {
+    Record(*it->second);
+  }
+  current.erase(it);
+}
+
+std::vector<clang::FunctionDecl *> Checkpoints::Checkout(size_t idx) {
+  CHECK_LT(idx, checkpoints.size()) << "Unknown checkpoint";
+  std::vector<clang::FunctionDecl *> restored;
+  for (auto &[fdecl, version] : checkpoints[idx]) {
+    auto it{current.find(fdecl)};
+    if (it != current.end() && it->second == version) {
+      continue;
+    }
+    // The current state may belong to later checkpoints
+    Preserve(fdecl);
+    // Versions are recorded before they stop being current
+    CHECK(version->recorded);
+
+    fdecl->setBody(version->body);
+    auto child_it{version->children.begin()};
+    for (auto stmt : version->stmts) {
+      for (auto &child : stmt->children()) {
+        CHECK(child_it != version->children.end())
+            << "Statement layout changed in place";
+        child = *child_it++;
+      }
+      dec_ctx.conds.erase(stmt);
+      dec_ctx.stmt_provenance.erase(stmt);
+      if (auto expr = clang::dyn_cast<clang::Expr>(stmt)) {
+        dec_ctx.use_provenance.erase(expr);
+      }
+    }
+    CHECK(child_it == version->children.end())
+        << "Statement layout changed in place";
+    for (auto &[stmt, cond] : version->conds) {
+      dec_ctx.conds[stmt] = dec_ctx.InsertZExpr(cond);
+    }
+    dec_ctx.stmt_provenance.insert(version->stmt_provenance.begin(),
+                                   version->stmt_provenance.end());
+    dec_ctx.use_provenance.insert(version->use_provenance.begin(),
+                                  version->use_provenance.end());
+
+    current[fdecl] = version;
+    dec_ctx.subtree_changes.Mark(fdecl);
+    restored.push_back(fdecl);
+  }
+  // Memoized from the children that expressions had before
+  if (!restored.empty()) {
+    dec_ctx.side_effects.clear();
+  }
+  return restored;
+}
+
+void Checkpoints::Truncate(size_t idx) {
+  if (idx < checkpoints.size()) {
+    checkpoints.resize(idx);
+  }
+}
+
+}  // namespace rellic
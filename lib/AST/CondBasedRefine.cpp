@@ -10,113 +10,134 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <llvm/ADT/ArrayRef.h>
 
 #include <iterator>
 
+#include "rellic/Log.h"
+
 namespace rellic {
 
 CondBasedRefine::CondBasedRefine(DecompilationContext &dec_ctx)
-    : TransformVisitor<CondBasedRefine>(dec_ctx) {}
+    : LocalRewriteVisitor<CondBasedRefine>(dec_ctx) {}
+
+clang::IfStmt *CondBasedRefine::Merge(clang::IfStmt *if_a,
+                                      clang::IfStmt *if_b) {
+  auto cond_a{dec_ctx.z3_exprs[dec_ctx.conds[if_a]]};
+  auto cond_b{dec_ctx.z3_exprs[dec_ctx.conds[if_b]]};
+
+  auto then_a{if_a->getThen()};
+  auto then_b{if_b->getThen()};
+
+  auto else_a{if_a->getElse()};
+  auto else_b{if_b->getElse()};
+
+  auto new_then_body{buffers.Get()};
+  new_then_body->push_back(then_a);
+  clang::IfStmt *new_if{nullptr};
+  if (Prove(dec_ctx, cond_a == cond_b)) {
+    // We found two consecutive `if` statements with identical conditions, so
+    // we can merge their `then` and `else` branches
+    //
+    // if(a) { X1; } else { Y1; }
+    // if(a) { X2; } else { Y2; }
+    // becomes
+    // if(a) { X1; X2; } else { Y1; Y2; }
+    new_then_body->push_back(then_b);
+    auto new_then{dec_ctx.ast.CreateCompoundStmt(*new_then_body)};
+
+    new_if = dec_ctx.ast.CreateIf(dec_ctx.marker_expr, new_then);
+
+    if (else_a || else_b) {
+      // At least one of the two `if` statements has an `else` branch
+      auto new_else_body{buffers.Get()};
 
-bool CondBasedRefine::VisitCompoundStmt(clang::CompoundStmt *compound) {
-  std::vector<clang::Stmt *> body{compound->body_begin(), compound->body_end()};
-  bool did_something{false};
+      if (else_a) {
+        new_else_body->push_back(else_a);
+      }
 
-  for (size_t i{0}; i + 1 < body.size() && !did_something; ++i) {
-    auto if_a{clang::dyn_cast<clang::IfStmt>(body[i])};
-    auto if_b{clang::dyn_cast<clang::IfStmt>(body[i + 1])};
+      if (else_b) {
+        new_else_body->push_back(else_b);
+      }
 
-    // We need two `if` statements to combine
-    if (!if_a || !if_b) {
-      continue;
+      auto new_else{dec_ctx.ast.CreateCompoundStmt(*new_else_body)};
+      new_if->setElse(new_else);
+    }
+  } else if (Prove(dec_ctx, cond_a == !cond_b)) {
+    // We found two consecutive `if` statements with opposite conditions, so
+    // we can append the else branch of the second to the then branch of the
+    // first, and viceversa
+    //
+    // if(a) { X1; } else { Y1; }
+    // if(!a) { X2; } else { Y2; }
+    // becomes
+    // if(a) { X1; Y2; } else { Y1; X2; }
+    if (else_b) {
+      new_then_body->push_back(else_b);
     }
 
-    auto cond_a{dec_ctx.z3_exprs[dec_ctx.conds[if_a]]};
-    auto cond_b{dec_ctx.z3_exprs[dec_ctx.conds[if_b]]};
-
-    auto then_a{if_a->getThen()};
-    auto then_b{if_b->getThen()};
-
-    auto else_a{if_a->getElse()};
-    auto else_b{if_b->getElse()};
-
-    std::vector<clang::Stmt *> new_then_body{then_a};
-    clang::IfStmt *new_if{nullptr};
-    if (Prove(cond_a == cond_b)) {
-      // We found two consecutive `if` statements with identical conditions, so
-      // we can merge their `then` and `else` branches
-      //
-      // if(a) { X1; } else { Y1; }
-      // if(a) { X2; } else { Y2; }
-      // becomes
-      // if(a) { X1; X2; } else { Y1; Y2; }
-      new_then_body.push_back(then_b);
-      auto new_then{dec_ctx.ast.CreateCompoundStmt(new_then_body)};
-
-      new_if = dec_ctx.ast.CreateIf(dec_ctx.marker_expr, new_then);
-
-      if (else_a || else_b) {
-        // At least one of the two `if` statements has an `else` branch
-        std::vector<clang::Stmt *> new_else_body{};
-
-        if (else_a) {
-          new_else_body.push_back(else_a);
-        }
-
-        if (else_b) {
-          new_else_body.push_back(else_b);
-        }
+    auto new_then{dec_ctx.ast.CreateCompoundStmt(*new_then_body)};
 
-        auto new_else{dec_ctx.ast.CreateCompoundStmt(new_else_body)};
-        new_if->setElse(new_else);
-      }
+    auto new_else_body{buffers.Get()};
+    if (else_a) {
+      new_else_body->push_back(else_a);
+    }
+    new_else_body->push_back(then_b);
 
-      did_something = true;
-    } else if (Prove(cond_a == !cond_b)) {
-      // We found two consecutive `if` statements with opposite conditions, so
-      // we can append the else branch of the second to the then branch of the
-      // first, and viceversa
-      //
-      // if(a) { X1; } else { Y1; }
-      // if(!a) { X2; } else { Y2; }
-      // becomes
-      // if(a) { X1; Y2; } else { Y1; X2; }
-      if (else_b) {
-        new_then_body.push_back(else_b);
-      }
+    new_if = dec_ctx.ast.CreateIf(dec_ctx.marker_expr, new_then);
 
-      auto new_then{dec_ctx.ast.CreateCompoundStmt(new_then_body)};
+    auto new_else{dec_ctx.ast.CreateCompoundStmt(*new_else_body)};
+    new_if->setElse(new_else);
+  }
 
-      std::vector<clang::Stmt *> new_else_body{};
-      if (else_a) {
-        new_else_body.push_back(else_a);
-      }
-      new_else_body.push_back(then_b);
+  if (new_if) {
+    dec_ctx.conds[new_if] = dec_ctx.conds[if_a];
+  }
+  return new_if;
+}
 
-      new_if = dec_ctx.ast.CreateIf(dec_ctx.marker_expr, new_then);
+clang::Stmt *CondBasedRefine::Rewrite(clang::Stmt *stmt) {
+  auto compound{clang::dyn_cast<clang::CompoundStmt>(stmt)};
+  if (!compound) {
+    return stmt;
+  }
+  // The statements are only copied once two of them are merged
+  llvm::ArrayRef<clang::Stmt *> stmts{compound->body_begin(),
+                                      compound->body_end()};
+  auto body{buffers.Get()};
+  bool did_something{false};
 
-      auto new_else{dec_ctx.ast.CreateCompoundStmt(new_else_body)};
-      new_if->setElse(new_else);
+  // Every run of mergeable statements is folded in a single visit: after a
+  // merge the result is compared against its new neighbour, so that the
+  // enclosing fixpoint does not need one round per pair
+  for (size_t i{0}; i + 1 < stmts.size() && !Stopped();) {
+    auto if_a{clang::dyn_cast<clang::IfStmt>(stmts[i])};
+    auto if_b{clang::dyn_cast<clang::IfStmt>(stmts[i + 1])};
 
-      did_something = true;
+    // We need two `if` statements to combine
+    auto new_if{if_a && if_b ? Merge(if_a, if_b) : nullptr};
+    if (!new_if) {
+      ++i;
+      continue;
     }
 
-    if (did_something) {
-      dec_ctx.conds[new_if] = dec_ctx.conds[if_a];
-      body[i] = new_if;
-      body.erase(std::next(body.begin(), i + 1));
+    if (!did_something) {
+      body->assign(stmts.begin(), stmts.end());
+      did_something = true;
     }
+    (*body)[i] = new_if;
+    body->erase(std::next(body->begin(), i + 1));
+    stmts = *body;
   }
   if (did_something) {
-    substitutions[compound] = dec_ctx.ast.CreateCompoundStmt(body);
+    return dec_ctx.ast.CreateCompoundStmt(*body);
   }
-  return !Stopped();
+  return compound;
 }
 
 void CondBasedRefine::RunImpl() {
-  LOG(INFO) << "Condition-based refinement";
-  TransformVisitor<CondBasedRefine>::RunImpl();
-  TraverseDecl(dec_ctx.ast_ctx.getTranslationUnitDecl());
+  RELLIC_LOG(Passes) << "Condition-based refinement";
+  LocalRewriteVisitor<CondBasedRefine>::RunImpl();
 }
 
 }  // namespace rellic
\ No newline at end of file
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/CostEstimate.h"
+
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/Module.h>
+
+#include <algorithm>
+
+#include "rellic/AST/PassProfile.h"
+
+namespace rellic {
+
+FunctionCost EstimateFunctionCost(llvm::Function &func) {
+  FunctionCost res;
+  if (func.isDeclaration()) {
+    return res;
+  }
+  llvm::DominatorTree dom_tree(func);
+  llvm::LoopInfo loop_info(dom_tree);
+  for (auto &block : func) {
+    ++res.blocks;
+    res.instructions += block.size();
+    res.loop_depth = std::max(res.loop_depth, loop_info.getLoopDepth(&block));
+    if (auto sw = llvm::dyn_cast<llvm::SwitchInst>(block.getTerminator())) {
+      res.switch_cases += sw->getNumCases();
+    }
+  }
+  res.cost = res.instructions + res.switch_cases * 4 +
+             res.blocks * res.blocks * (1 + res.loop_depth);
+  return res;
+}
+
+void CostHistory::Record(llvm::Function &func, Duration time) {
+  auto shape{GetFunctionShape(func)};
+  auto cost{EstimateFunctionCost(func).cost};
+  std::lock_guard<std::mutex> lock(mutex);
+  auto &entry{shapes[shape]};
+  ++entry.count;
+  entry.time += time;
+  total_cost += cost;
+  total_time += time;
+}
+
+std::optional<uint64_t> CostHistory::Lookup(const std::string &shape) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto it{shapes.find(shape)};
+  if (it == shapes.end() || total_time.count() <= 0) {
+    return std::nullopt;
+  }
+  auto &entry{it->second};
+  auto units_per_second{total_cost / total_time.count()};
+  return static_cast<uint64_t>(entry.time.count() / entry.count *
+                               units_per_second);
+}
+
+ModuleCost EstimateModuleCost(llvm::Module &module,
+                              const CostHistory *history) {
+  ModuleCost res;
+  for (auto &func : module.functions()) {
+    if (func.isDeclaration()) {
+      continue;
+    }
+    auto cost{EstimateFunctionCost(func)};
+    ++res.functions;
+    res.blocks += cost.blocks;
+    res.instructions += cost.instructions;
+    res.switch_cases += cost.switch_cases;
+    res.max_loop_depth = std::max(res.max_loop_depth, cost.loop_depth);
+    std::optional<uint64_t> known;
+    if (history) {
+      known = history->Lookup(GetFunctionShape(func));
+    }
+    res.known_functions += known.has_value();
+    res.cost += known ? *known : cost.cost;
+  }
+  return res;
+}
+
+}  // namespace rellic
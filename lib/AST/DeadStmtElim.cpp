@@ -10,54 +10,93 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <algorithm>
+#include <iterator>
+
+#include "rellic/Log.h"
+
 namespace rellic {
 
 DeadStmtElim::DeadStmtElim(DecompilationContext &dec_ctx)
-    : TransformVisitor<DeadStmtElim>(dec_ctx) {}
+    : LocalRewriteVisitor<DeadStmtElim>(dec_ctx) {}
 
-bool DeadStmtElim::VisitIfStmt(clang::IfStmt *ifstmt) {
-  // DLOG(INFO) << "VisitIfStmt";
+clang::Stmt *DeadStmtElim::RewriteIf(clang::IfStmt *ifstmt) {
   bool can_delete = false;
   if (ifstmt->getCond() == dec_ctx.marker_expr) {
-    can_delete = Prove(!dec_ctx.z3_exprs[dec_ctx.conds[ifstmt]]);
+    can_delete = ClassifyCond(dec_ctx, dec_ctx.conds[ifstmt]) ==
+                 CondVerdict::False;
   }
 
   auto compound = clang::dyn_cast<clang::CompoundStmt>(ifstmt->getThen());
   bool is_empty = compound ? compound->body_empty() : false;
-  if (can_delete || is_empty) {
-    substitutions[ifstmt] = nullptr;
-  }
-  return true;
+  return can_delete || is_empty ? nullptr : ifstmt;
 }
 
-bool DeadStmtElim::VisitCompoundStmt(clang::CompoundStmt *compound) {
-  // DLOG(INFO) << "VisitCompoundStmt";
-  std::vector<clang::Stmt *> new_body;
-  for (auto stmt : compound->body()) {
-    // Filter out nullptr statements
-    if (!stmt) {
-      continue;
+bool DeadStmtElim::IsNeeded(clang::Stmt *stmt) {
+  // Filter out nullptr statements
+  if (!stmt) {
+    return false;
+  }
+  if (auto expr = clang::dyn_cast<clang::Expr>(stmt)) {
+    auto [it, inserted]{dec_ctx.side_effects.try_emplace(expr, false)};
+    if (inserted) {
+      it->second = expr->HasSideEffects(dec_ctx.ast_ctx);
     }
-    // Add only necessary statements
-    if (auto expr = clang::dyn_cast<clang::Expr>(stmt)) {
-      if (expr->HasSideEffects(dec_ctx.ast_ctx)) {
-        new_body.push_back(stmt);
+    return it->second;
+  }
+  return !clang::isa<clang::NullStmt>(stmt);
+}
+
+clang::Stmt *DeadStmtElim::RewriteCompound(clang::CompoundStmt *compound) {
+  auto needed{[this](clang::Stmt *stmt) { return IsNeeded(stmt); }};
+  auto body{compound->body()};
+  auto dead{std::find_if_not(body.begin(), body.end(), needed)};
+  if (dead == body.end()) {
+    return compound;
+  }
+  // Create a new compound with only the necessary statements
+  auto new_body{buffers.Get()};
+  new_body->assign(body.begin(), dead);
+  std::copy_if(std::next(dead), body.end(), std::back_inserter(*new_body),
+               needed);
+  return dec_ctx.ast.CreateCompoundStmt(*new_body);
+}
+
+clang::Stmt *DeadStmtElim::Rewrite(clang::Stmt *stmt) {
+  if (auto ifstmt = clang::dyn_cast<clang::IfStmt>(stmt)) {
+    return RewriteIf(ifstmt);
+  } else if (auto compound = clang::dyn_cast<clang::CompoundStmt>(stmt)) {
+    return RewriteCompound(compound);
+  }
+  return stmt;
+}
+
+void DeadStmtElim::Prepare() {
+  // Passes run since the last time may have substituted subexpressions
+  dec_ctx.side_effects.clear();
+  // Decide the conditions of all the `if`s that may be deleted in one go, so
+  // that visiting them only hits the cache
+  std::vector<unsigned> conds;
+  auto stmts{buffers.Get()};
+  for (auto fdecl : GetFunctionsInScope()) {
+    stmts->clear();
+    EnumerateStmts(fdecl->getBody(), *stmts);
+    for (auto stmt : *stmts) {
+      auto ifstmt{clang::dyn_cast<clang::IfStmt>(stmt)};
+      if (ifstmt && ifstmt->getCond() == dec_ctx.marker_expr) {
+        auto it{dec_ctx.conds.find(ifstmt)};
+        if (it != dec_ctx.conds.end()) {
+          conds.push_back(it->second);
+        }
       }
-    } else if (!clang::dyn_cast<clang::NullStmt>(stmt)) {
-      new_body.push_back(stmt);
     }
   }
-  // Create the a new compound
-  if (changed || new_body.size() < compound->size()) {
-    substitutions[compound] = dec_ctx.ast.CreateCompoundStmt(new_body);
-  }
-  return !Stopped();
+  ClassifyConds(dec_ctx, conds);
 }
 
 void DeadStmtElim::RunImpl() {
-  LOG(INFO) << "Eliminating dead statements";
-  TransformVisitor<DeadStmtElim>::RunImpl();
-  TraverseDecl(dec_ctx.ast_ctx.getTranslationUnitDecl());
+  RELLIC_LOG(Passes) << "Eliminating dead statements";
+  LocalRewriteVisitor<DeadStmtElim>::RunImpl();
 }
 
 }  // namespace rellic
@@ -15,21 +15,34 @@
 #include <llvm/IR/DebugInfoMetadata.h>
 #include <llvm/IR/DerivedTypes.h>
 #include <llvm/Support/Casting.h>
+#include <llvm/Support/TimeProfiler.h>
 #include <rellic/BC/Util.h>
 
 #include <algorithm>
 #include <iterator>
+#include <unordered_set>
 #include <utility>
 
+#include "rellic/Log.h"
+
 namespace rellic {
 
 void DebugInfoCollector::visitDbgDeclareInst(llvm::DbgDeclareInst& inst) {
   auto var{inst.getVariable()};
   auto loc{inst.getAddress()};
 
-  names[loc] = var->getName().str();
-  scopes[loc] = var->getScope();
-  valtypes[loc] = var->getType();
+  if (collect & kNames) {
+    names[loc] = var->getName().str();
+  }
+  if (collect & kScopes) {
+    scopes[loc] = var->getScope();
+  }
+  if (collect & kValueTypes) {
+    valtypes[loc] = var->getType();
+  }
+  if (!(collect & kTypes)) {
+    return;
+  }
 
   if (auto alloca = llvm::dyn_cast<llvm::AllocaInst>(loc)) {
     WalkType(alloca->getAllocatedType(), var->getType());
@@ -39,6 +52,9 @@ void DebugInfoCollector::visitDbgDeclareInst(llvm::DbgDeclareInst& inst) {
 }
 
 void DebugInfoCollector::visitInstruction(llvm::Instruction& inst) {
+  if (!(collect & kScopes)) {
+    return;
+  }
   if (auto loc{inst.getDebugLoc().get()}) {
     scopes[&inst] = loc->getScope();
   }
@@ -50,7 +66,7 @@ void DebugInfoCollector::WalkType(llvm::Type* type, llvm::DIType* ditype) {
   }
   type_set.insert(ditype);
 
-  DLOG(INFO) << "Inspecting " << LLVMThingToString(ditype);
+  RELLIC_LOG(DebugInfo) << "Inspecting " << LLVMThingToString(ditype);
   if (auto funcditype = llvm::dyn_cast<llvm::DISubroutineType>(ditype)) {
     auto di_types{funcditype->getTypeArray()};
 
@@ -63,8 +79,9 @@ void DebugInfoCollector::WalkType(llvm::Type* type, llvm::DIType* ditype) {
     if (functype) {
       if (functype->getNumParams() + functype->isVarArg() + 1 !=
           di_types.size()) {
-        DLOG(INFO) << "Associated function " << LLVMThingToString(type)
-                   << " is not compatible";
+        RELLIC_LOG(DebugInfo) << "Associated function "
+                              << LLVMThingToString(type)
+                              << " is not compatible";
         type_array.resize(di_types.size());
       } else {
         type_array.push_back(functype->getReturnType());
@@ -104,15 +121,17 @@ void DebugInfoCollector::WalkType(llvm::Type* type, llvm::DIType* ditype) {
           if (auto arrtype = llvm::dyn_cast<llvm::ArrayType>(type)) {
             basetype = arrtype->getElementType();
           } else {
-            DLOG(INFO) << "Associated type " << LLVMThingToString(type)
-                       << " is not an array";
+            RELLIC_LOG(DebugInfo) << "Associated type "
+                                  << LLVMThingToString(type)
+                                  << " is not an array";
           }
         } else {
           if (auto vectype = llvm::dyn_cast<llvm::VectorType>(type)) {
             basetype = vectype->getElementType();
           } else {
-            DLOG(INFO) << "Associated type " << LLVMThingToString(type)
-                       << " is not a vector";
+            RELLIC_LOG(DebugInfo) << "Associated type "
+                                  << LLVMThingToString(type)
+                                  << " is not a vector";
           }
         }
         types[type] = ditype;
@@ -129,8 +148,9 @@ void DebugInfoCollector::WalkType(llvm::Type* type, llvm::DIType* ditype) {
       if (strcttype) {
         if (strcttype->getNumElements() != di_fields.size()) {
           elems.resize(di_fields.size());
-          DLOG(INFO) << "Associated struct " << LLVMThingToString(type)
-                     << " is not compatible";
+          RELLIC_LOG(DebugInfo) << "Associated struct "
+                                << LLVMThingToString(type)
+                                << " is not compatible";
         } else {
           elems = strcttype->elements();
         }
@@ -202,22 +222,97 @@ void DebugInfoCollector::visitFunction(llvm::Function& func) {
   if (!subprogram) {
     return;
   }
-  subprograms.push_back(subprogram);
-
   auto ditype{subprogram->getType()};
-  auto type_array{ditype->getTypeArray()};
-  if (func.arg_size() + func.isVarArg() + 1 == type_array.size()) {
-    funcs[&func] = ditype;
-    size_t i{1};
-    for (auto& arg : func.args()) {
-      auto argtype{type_array[i++]};
-      args[&arg] = argtype;
+  if (collect & kFunctions) {
+    subprograms.push_back(subprogram);
+
+    auto type_array{ditype->getTypeArray()};
+    if (func.arg_size() + func.isVarArg() + 1 == type_array.size()) {
+      funcs[&func] = ditype;
+      size_t i{1};
+      for (auto& arg : func.args()) {
+        auto argtype{type_array[i++]};
+        args[&arg] = argtype;
+      }
+    } else {
+      // Debug metadata is not compatible with bitcode, bail out
+      // TODO(frabert): Find a way to reconcile differences
     }
-  } else {
-    // Debug metadata is not compatible with bitcode, bail out
-    // TODO(frabert): Find a way to reconcile differences
   }
-  WalkType(func.getFunctionType(), ditype);
+  if (collect & kTypes) {
+    WalkType(func.getFunctionType(), ditype);
+  }
+}
+
+void DebugInfoCollector::CollectLazily(llvm::Module& module) {
+  lazy_module = &module;
+}
+
+void DebugInfoCollector::CollectFunction(llvm::Function& func) {
+  if (collected.insert(&func).second) {
+    visit(func);
+  }
+}
+
+void DebugInfoCollector::CollectAll() {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (!lazy_module || collected_all) {
+    return;
+  }
+  llvm::TimeTraceScope trace("DebugInfoCollector");
+  for (auto& func : *lazy_module) {
+    CollectFunction(func);
+  }
+  collected_all = true;
+}
+
+std::optional<std::string> DebugInfoCollector::GetName(llvm::Value* val) {
+  std::lock_guard<std::mutex> lock(mutex);
+  if (lazy_module && !collected_all) {
+    llvm::Function* func{nullptr};
+    if (auto arg = llvm::dyn_cast<llvm::Argument>(val)) {
+      func = arg->getParent();
+    } else if (auto inst = llvm::dyn_cast<llvm::Instruction>(val)) {
+      func = inst->getFunction();
+    }
+    if (func) {
+      CollectFunction(*func);
+    }
+  }
+  auto it{names.find(val)};
+  if (it == names.end()) {
+    return std::nullopt;
+  }
+  return it->second;
+}
+
+std::vector<std::string> DebugInfoCollector::GetFieldNames(
+    llvm::StructType* type) {
+  // Nothing is collected anymore once everything was
+  CollectAll();
+  auto it{types.find(type)};
+  if (it == types.end()) {
+    return {};
+  }
+  auto ditype{llvm::dyn_cast_or_null<llvm::DICompositeType>(it->second)};
+  if (!ditype || ditype->getElements().size() != type->getNumElements()) {
+    return {};
+  }
+
+  std::vector<std::string> names;
+  std::unordered_set<std::string> seen_names;
+  for (auto element : ditype->getElements()) {
+    auto field{llvm::dyn_cast<llvm::DIDerivedType>(element)};
+    if (!field || field->getName().empty()) {
+      return {};
+    }
+    auto name{field->getName().str()};
+    if (!seen_names.insert(name).second) {
+      name += "_field" + std::to_string(names.size());
+    }
+    names.push_back(std::move(name));
+  }
+  return names;
 }
 
 }  // namespace rellic
@@ -14,6 +14,7 @@
 
 #include "rellic/AST/InferenceRule.h"
 #include "rellic/AST/Util.h"
+#include "rellic/Log.h"
 
 namespace rellic {
 
@@ -32,6 +33,8 @@ class ArraySubscriptAddrOfRule : public InferenceRule {
             hasBase(parenExpr(has(unaryOperator(stmt().bind("base"))))),
             hasIndex(zero_int_lit))) {}
 
+  const char *GetName() const override { return "ArraySubscriptAddrOfRule"; }
+
   void run(const MatchFinder::MatchResult &result) override {
     auto op = result.Nodes.getNodeAs<clang::UnaryOperator>("base");
     if (op->getOpcode() == clang::UO_AddrOf) {
@@ -60,6 +63,8 @@ class AddrOfArraySubscriptRule : public InferenceRule {
                           has(ignoringParenImpCasts(
                               arraySubscriptExpr(hasIndex(zero_int_lit)))))) {}
 
+  const char *GetName() const override { return "AddrOfArraySubscriptRule"; }
+
   void run(const MatchFinder::MatchResult &result) override {
     match = result.Nodes.getNodeAs<clang::UnaryOperator>("addr_of");
   }
@@ -84,6 +89,8 @@ class DerefAddrOfRule : public InferenceRule {
             stmt().bind("deref"), hasOperatorName("*"),
             has(ignoringParenImpCasts(unaryOperator(hasOperatorName("&")))))) {}
 
+  const char *GetName() const override { return "DerefAddrOfRule"; }
+
   void run(const MatchFinder::MatchResult &result) override {
     match = result.Nodes.getNodeAs<clang::UnaryOperator>("deref");
   }
@@ -112,6 +119,8 @@ class DerefAddrOfConditionalRule : public InferenceRule {
                 hasFalseExpression(ignoringParenImpCasts(
                     unaryOperator(hasOperatorName("&"))))))))) {}
 
+  const char *GetName() const override { return "DerefAddrOfConditionalRule"; }
+
   void run(const MatchFinder::MatchResult &result) override {
     match = result.Nodes.getNodeAs<clang::UnaryOperator>("deref");
   }
@@ -149,6 +158,8 @@ class NegComparisonRule : public InferenceRule {
             has(ignoringParenImpCasts(binaryOperator(stmt().bind("binop")))))) {
   }
 
+  const char *GetName() const override { return "NegComparisonRule"; }
+
   void run(const MatchFinder::MatchResult &result) override {
     auto binop = result.Nodes.getNodeAs<clang::BinaryOperator>("binop");
     if (binop->isComparisonOp()) {
@@ -179,6 +190,8 @@ class ParenDeclRefExprStripRule : public InferenceRule {
             parenExpr(stmt().bind("paren"),
                       has(ignoringImpCasts(declRefExpr(to(varDecl())))))) {}
 
+  const char *GetName() const override { return "ParenDeclRefExprStripRule"; }
+
   void run(const MatchFinder::MatchResult &result) override {
     match = result.Nodes.getNodeAs<clang::ParenExpr>("paren");
   }
@@ -198,6 +211,8 @@ class DoubleParenStripRule : public InferenceRule {
   DoubleParenStripRule()
       : InferenceRule(parenExpr(stmt().bind("paren"), has(parenExpr()))) {}
 
+  const char *GetName() const override { return "DoubleParenStripRule"; }
+
   void run(const MatchFinder::MatchResult &result) override {
     match = result.Nodes.getNodeAs<clang::ParenExpr>("paren");
   }
@@ -220,6 +235,8 @@ class MemberExprAddrOfRule : public InferenceRule {
             has(expr(stmt().bind("base"), ignoringParenImpCasts(unaryOperator(
                                               hasOperatorName("&"))))))) {}
 
+  const char *GetName() const override { return "MemberExprAddrOfRule"; }
+
   void run(const MatchFinder::MatchResult &result) override {
     auto arrow{result.Nodes.getNodeAs<clang::MemberExpr>("arrow")};
     if (result.Nodes.getNodeAs<clang::Expr>("base") == arrow->getBase()) {
@@ -252,6 +269,8 @@ class MemberExprArraySubRule : public InferenceRule {
                      ignoringParenImpCasts(
                          arraySubscriptExpr(hasIndex(zero_int_lit))))))) {}
 
+  const char *GetName() const override { return "MemberExprArraySubRule"; }
+
   void run(const MatchFinder::MatchResult &result) override {
     auto dot{result.Nodes.getNodeAs<clang::MemberExpr>("dot")};
     if (result.Nodes.getNodeAs<clang::Expr>("base") == dot->getBase()) {
@@ -282,6 +301,8 @@ class AssignCastedExprRule : public InferenceRule {
             stmt().bind("assign"), hasOperatorName("="),
             has(ignoringParenImpCasts(cStyleCastExpr(stmt().bind("cast")))))) {}
 
+  const char *GetName() const override { return "AssignCastedExprRule"; }
+
   void run(const MatchFinder::MatchResult &result) override {
     auto assign{result.Nodes.getNodeAs<clang::BinaryOperator>("assign")};
     auto cast{result.Nodes.getNodeAs<clang::CStyleCastExpr>("cast")};
@@ -321,6 +342,10 @@ class UnsignedToSignedCStyleCastRule : public InferenceRule {
             has(ignoringParenImpCasts(
                 cStyleCastExpr(hasType(isUnsignedInteger())))))) {}
 
+  const char *GetName() const override {
+    return "UnsignedToSignedCStyleCastRule";
+  }
+
   void run(const MatchFinder::MatchResult &result) override {
     match = result.Nodes.getNodeAs<clang::CStyleCastExpr>("cast");
   }
@@ -354,6 +379,8 @@ class TripleCStyleCastElimRule : public InferenceRule {
                 hasType(isInteger()), has(ignoringImpCasts(cStyleCastExpr(
                                           hasType(isInteger()))))))))) {}
 
+  const char *GetName() const override { return "TripleCStyleCastElimRule"; }
+
   void run(const MatchFinder::MatchResult &result) override {
     match = result.Nodes.getNodeAs<clang::CStyleCastExpr>("cast");
   }
@@ -392,6 +419,8 @@ class VoidToTypePtrCastElimRule : public InferenceRule {
                            has(ignoringParenImpCasts(
                                cStyleCastExpr(hasType(pointerType())))))) {}
 
+  const char *GetName() const override { return "VoidToTypePtrCastElimRule"; }
+
   void run(const MatchFinder::MatchResult &result) override {
     match = result.Nodes.getNodeAs<clang::CStyleCastExpr>("cast");
   }
@@ -424,6 +453,8 @@ class CStyleZeroToPtrCastElimRule : public InferenceRule {
                            has(ignoringImpCasts(integerLiteral(equals(0U)))))
                 .bind("cast")) {}
 
+  const char *GetName() const override { return "CStyleZeroToPtrCastElimRule"; }
+
   void run(const MatchFinder::MatchResult &result) override {
     match = result.Nodes.getNodeAs<clang::CStyleCastExpr>("cast");
   }
@@ -445,6 +476,8 @@ class CStyleConstElimRule : public InferenceRule {
       : InferenceRule(cStyleCastExpr(has(ignoringImpCasts(integerLiteral())))
                           .bind("cast")) {}
 
+  const char *GetName() const override { return "CStyleConstElimRule"; }
+
   void run(const MatchFinder::MatchResult &result) override {
     match = result.Nodes.getNodeAs<clang::CStyleCastExpr>("cast");
   }
@@ -468,23 +501,46 @@ class CStyleConstElimRule : public InferenceRule {
 }  // namespace
 
 ExprCombine::ExprCombine(DecompilationContext &dec_ctx)
-    : TransformVisitor<ExprCombine>(dec_ctx) {}
+    : TransformVisitor<ExprCombine>(dec_ctx) {
+  cast_pre_rules.Add(std::make_unique<VoidToTypePtrCastElimRule>());
+
+  cast_rules.Add(std::make_unique<UnsignedToSignedCStyleCastRule>());
+  cast_rules.Add(std::make_unique<TripleCStyleCastElimRule>());
+  cast_rules.Add(std::make_unique<CStyleConstElimRule>());
+
+  using clang::Stmt;
+  rules.Add(Stmt::UnaryOperatorClass, std::make_unique<NegComparisonRule>());
+  rules.Add(Stmt::UnaryOperatorClass, std::make_unique<DerefAddrOfRule>());
+  rules.Add(Stmt::UnaryOperatorClass,
+            std::make_unique<DerefAddrOfConditionalRule>());
+  rules.Add(Stmt::UnaryOperatorClass,
+            std::make_unique<AddrOfArraySubscriptRule>());
+
+  rules.Add(Stmt::BinaryOperatorClass,
+            std::make_unique<AssignCastedExprRule>());
+
+  rules.Add(Stmt::ArraySubscriptExprClass,
+            std::make_unique<ArraySubscriptAddrOfRule>());
+
+  rules.Add(Stmt::MemberExprClass, std::make_unique<MemberExprAddrOfRule>());
+  rules.Add(Stmt::MemberExprClass, std::make_unique<MemberExprArraySubRule>());
+
+  rules.Add(Stmt::ParenExprClass,
+            std::make_unique<ParenDeclRefExprStripRule>());
+  rules.Add(Stmt::ParenExprClass, std::make_unique<DoubleParenStripRule>());
+}
 
 bool ExprCombine::VisitCStyleCastExpr(clang::CStyleCastExpr *cast) {
   // TODO(frabert): Re-enable nullptr casts simplification
 
   if (cast->getCastKind() == clang::CastKind::CK_NoOp) {
-    substitutions[cast] = cast->getSubExpr();
+    Substitute(cast, cast->getSubExpr());
     return true;
   }
 
-  std::vector<std::unique_ptr<InferenceRule>> pre_rules;
-
-  pre_rules.emplace_back(new VoidToTypePtrCastElimRule);
-
-  auto pre_sub{ApplyFirstMatchingRule(dec_ctx, cast, pre_rules)};
+  auto pre_sub{cast_pre_rules.Apply(dec_ctx, cast)};
   if (pre_sub != cast) {
-    substitutions[cast] = pre_sub;
+    Substitute(cast, pre_sub);
     return true;
   }
 
@@ -498,7 +554,7 @@ bool ExprCombine::VisitCStyleCastExpr(clang::CStyleCastExpr *cast) {
       case clang::APValue::ValueKind::Int: {
         auto sub{dec_ctx.ast.CreateIntLit(result.Val.getInt())};
         if (GetHash(dec_ctx.ast_ctx, cast) != GetHash(dec_ctx.ast_ctx, sub)) {
-          substitutions[cast] = sub;
+          Substitute(cast, sub);
         }
       } break;
 
@@ -509,100 +565,29 @@ bool ExprCombine::VisitCStyleCastExpr(clang::CStyleCastExpr *cast) {
     return true;
   }
 
-  std::vector<std::unique_ptr<InferenceRule>> rules;
-
-  rules.emplace_back(new UnsignedToSignedCStyleCastRule);
-  rules.emplace_back(new TripleCStyleCastElimRule);
-  rules.emplace_back(new CStyleConstElimRule);
-
-  auto sub{ApplyFirstMatchingRule(dec_ctx, cast, rules)};
+  auto sub{cast_rules.Apply(dec_ctx, cast)};
   if (sub != cast) {
-    substitutions[cast] = sub;
+    Substitute(cast, sub);
   }
 
   return true;
 }
 
-bool ExprCombine::VisitUnaryOperator(clang::UnaryOperator *op) {
-  // DLOG(INFO) << "VisitUnaryOperator: "
-  //            << op->getOpcodeStr(op->getOpcode()).str();
-  std::vector<std::unique_ptr<InferenceRule>> rules;
-
-  rules.emplace_back(new NegComparisonRule);
-  rules.emplace_back(new DerefAddrOfRule);
-  rules.emplace_back(new DerefAddrOfConditionalRule);
-  rules.emplace_back(new AddrOfArraySubscriptRule);
-
-  auto sub{ApplyFirstMatchingRule(dec_ctx, op, rules)};
-  if (sub != op) {
-    substitutions[op] = sub;
-  }
-
-  return true;
-}
-
-bool ExprCombine::VisitBinaryOperator(clang::BinaryOperator *op) {
-  // DLOG(INFO) << "VisitBinaryOperator: " << op->getOpcodeStr().str();
-  std::vector<std::unique_ptr<InferenceRule>> rules;
-
-  rules.emplace_back(new AssignCastedExprRule);
-
-  auto sub{ApplyFirstMatchingRule(dec_ctx, op, rules)};
-  if (sub != op) {
-    substitutions[op] = sub;
-  }
-
-  return true;
-}
-
-bool ExprCombine::VisitArraySubscriptExpr(clang::ArraySubscriptExpr *expr) {
-  // DLOG(INFO) << "VisitArraySubscriptExpr";
-  std::vector<std::unique_ptr<InferenceRule>> rules;
-
-  rules.emplace_back(new ArraySubscriptAddrOfRule);
-
-  auto sub{ApplyFirstMatchingRule(dec_ctx, expr, rules)};
-  if (sub != expr) {
-    substitutions[expr] = sub;
-  }
-
-  return true;
-}
-
-bool ExprCombine::VisitMemberExpr(clang::MemberExpr *expr) {
-  // DLOG(INFO) << "VisitMemberExpr";
-  std::vector<std::unique_ptr<InferenceRule>> rules;
-
-  rules.emplace_back(new MemberExprAddrOfRule);
-  rules.emplace_back(new MemberExprArraySubRule);
-
-  auto sub{ApplyFirstMatchingRule(dec_ctx, expr, rules)};
-  if (sub != expr) {
-    substitutions[expr] = sub;
-  }
-
-  return true;
-}
-
-bool ExprCombine::VisitParenExpr(clang::ParenExpr *expr) {
-  // DLOG(INFO) << "VisitParenExpr";
-  std::vector<std::unique_ptr<InferenceRule>> rules;
-
-  rules.emplace_back(new ParenDeclRefExprStripRule);
-  rules.emplace_back(new DoubleParenStripRule);
-
-  auto sub{ApplyFirstMatchingRule(dec_ctx, expr, rules)};
+bool ExprCombine::VisitExpr(clang::Expr *expr) {
+  // Casts are handled by `VisitCStyleCastExpr`, since some of them are folded
+  // without any rule
+  auto sub{rules.Apply(dec_ctx, expr)};
   if (sub != expr) {
-    substitutions[expr] = sub;
+    Substitute(expr, sub);
   }
 
   return true;
 }
 
 void ExprCombine::RunImpl() {
-  LOG(INFO) << "Rule-based statement simplification";
+  RELLIC_LOG(Passes) << "Rule-based statement simplification";
   TransformVisitor<ExprCombine>::RunImpl();
-  TraverseDecl(dec_ctx.ast_ctx.getTranslationUnitDecl());
+  TraverseFunctions();
 }
 
 }  // namespace rellic
\ No newline at end of file
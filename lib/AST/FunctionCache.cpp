@@ -0,0 +1,298 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/FunctionCache.h"
+
+#include <clang/Basic/DiagnosticOptions.h>
+#include <clang/Basic/FileSystemOptions.h>
+#include <clang/Frontend/ASTUnit.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Serialization/PCHContainerOperations.h>
+#include <glog/logging.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/IR/DebugInfoMetadata.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/IntrinsicInst.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Process.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <regex>
+#include <vector>
+
+#include "rellic/BC/Util.h"
+#include "rellic/Exception.h"
+#include "rellic/Version.h"
+
+namespace rellic {
+
+// Bumped whenever the contents of entries change meaning
+static constexpr unsigned kCacheVersion{1};
+
+FunctionCache::FunctionCache(std::string dir, uint64_t max_size,
+                             std::string options_key)
+    : dir(std::move(dir)),
+      max_size(max_size),
+      options_key(std::move(options_key)) {}
+
+std::string FunctionCache::GetPath(const std::string &key,
+                                   llvm::StringRef ext) const {
+  llvm::SmallString<128> path{dir};
+  llvm::sys::path::append(path, key + ext);
+  return path.str().str();
+}
+
+// Replaces the references of `text` to `name`, as the operand that LLVM prints,
+// by a bare `@`
+static void RemoveName(std::string &text, const std::string &name) {
+  auto IsNameChar{[](char c) {
+    return llvm::isAlnum(c) || c == '-' || c == '$' || c == '.' || c == '_';
+  }};
+  std::string res;
+  size_t start{0};
+  for (auto pos{text.find(name)}; pos != std::string::npos;
+       pos = text.find(name, pos)) {
+    auto end{pos + name.size()};
+    // Other names that `name` is a prefix of are left alone
+    if (end < text.size() && IsNameChar(text[end]) && name.back() != '"') {
+      pos = end;
+      continue;
+    }
+    res.append(text, start, pos - start);
+    res += '@';
+    start = pos = end;
+  }
+  res.append(text, start);
+  text = std::move(res);
+}
+
+std::string FunctionCache::GetKey(llvm::Function &func, bool anonymous) {
+  auto &module{*func.getParent()};
+  if (!slots || slots->getModule() != &module) {
+    slots = std::make_unique<llvm::ModuleSlotTracker>(&module);
+  }
+  std::string text;
+  llvm::raw_string_ostream os(text);
+  os << kCacheVersion << '\n'
+     << Version::GetVersionString() << '\n'
+     << options_key << '\n'
+     << module.getTargetTriple() << '\n'
+     << module.getDataLayoutStr() << '\n';
+  {
+    std::string body;
+    llvm::raw_string_ostream body_os(body);
+    // `Function::print` hides the overload that takes a slot tracker
+    static_cast<llvm::Value &>(func).print(body_os, *slots);
+    body_os.flush();
+    if (anonymous) {
+      std::string name;
+      llvm::raw_string_ostream name_os(name);
+      func.printAsOperand(name_os, /*PrintType=*/false, *slots);
+      RemoveName(body, name_os.str());
+    }
+    os << body;
+  }
+
+  // Names of local variables come from debug information, which is only
+  // referenced by number in the printed IR
+  for (auto &inst : llvm::instructions(func)) {
+    if (auto dbg = llvm::dyn_cast<llvm::DbgVariableIntrinsic>(&inst)) {
+      auto var{dbg->getVariable()};
+      os << var->getName() << ':' << var->getArg();
+      if (auto type = var->getType()) {
+        os << ':' << type->getName();
+      }
+      os << '\n';
+    }
+  }
+
+  std::vector<llvm::Type *> types;
+  std::vector<llvm::GlobalValue *> globals;
+  GetReferencedIR(func, types, globals);
+  for (auto type : types) {
+    auto strct{llvm::dyn_cast<llvm::StructType>(type)};
+    if (strct && !strct->isLiteral()) {
+      os << LLVMThingToString(strct) << " =";
+      for (auto elem : strct->elements()) {
+        os << ' ' << LLVMThingToString(elem);
+      }
+      os << (strct->isPacked() ? " packed\n" : "\n");
+    }
+  }
+  for (auto gv : globals) {
+    if (anonymous && gv == &func) {
+      os << "@ ";
+    } else {
+      os << gv->getName() << ' ';
+    }
+    os << LLVMThingToString(gv->getValueType()) << '\n';
+  }
+  os.flush();
+
+  // Metadata and attribute groups are numbered per module
+  static const std::regex numbering{"([!#])[0-9]+"};
+  text = std::regex_replace(text, numbering, "$1");
+
+  llvm::SHA1 hasher;
+  hasher.update(text);
+  return llvm::toHex(hasher.final(), /*LowerCase=*/true);
+}
+
+// Marks an entry as recently used
+static void Touch(const std::string &path) {
+  int fd;
+  if (llvm::sys::fs::openFileForWrite(path, fd, llvm::sys::fs::CD_OpenExisting,
+                                      llvm::sys::fs::OF_Append)) {
+    return;
+  }
+  llvm::sys::fs::setLastAccessAndModificationTime(
+      fd, std::chrono::time_point_cast<std::chrono::nanoseconds>(
+              std::chrono::system_clock::now()));
+  llvm::sys::Process::SafelyCloseFileDescriptor(fd);
+}
+
+std::unique_ptr<FunctionShard> FunctionCache::Load(llvm::Function &func,
+                                                   const std::string &key) {
+  auto ast_path{GetPath(key, ".ast")};
+  auto map_path{GetPath(key, ".json")};
+  auto buffer{llvm::MemoryBuffer::getFile(map_path)};
+  if (!buffer) {
+    return nullptr;
+  }
+
+  auto map{llvm::json::parse(buffer.get()->getBuffer())};
+  if (!map) {
+    LOG(WARNING) << "Ignoring malformed cache entry " << map_path << ": "
+                 << llvm::toString(map.takeError());
+    return nullptr;
+  }
+  if (!map->getAsObject()) {
+    LOG(WARNING) << "Ignoring malformed cache entry " << map_path;
+    return nullptr;
+  }
+
+  static clang::PCHContainerOperations pch_ops;
+  auto diags{clang::CompilerInstance::createDiagnostics(
+      new clang::DiagnosticOptions())};
+  auto unit{clang::ASTUnit::LoadFromASTFile(
+      ast_path, pch_ops.getRawReader(), clang::ASTUnit::LoadEverything, diags,
+      clang::FileSystemOptions())};
+  if (!unit) {
+    LOG(WARNING) << "Cannot load cache entry " << ast_path;
+    return nullptr;
+  }
+
+  try {
+    auto shard{FunctionShard::Deserialize(func, *unit, *map->getAsObject())};
+    Touch(ast_path);
+    Touch(map_path);
+    return shard;
+  } catch (Exception &ex) {
+    LOG(WARNING) << "Ignoring cache entry " << map_path << " for "
+                 << func.getName().str() << ": " << ex.what();
+    return nullptr;
+  }
+}
+
+bool FunctionCache::Contains(const std::string &key) const {
+  return llvm::sys::fs::exists(GetPath(key, ".json"));
+}
+
+void FunctionCache::Store(FunctionShard &shard, const std::string &key) {
+  if (auto ec = llvm::sys::fs::create_directories(dir)) {
+    LOG(WARNING) << "Cannot create cache directory " << dir << ": "
+                 << ec.message();
+    return;
+  }
+
+  // The map is written last, so that readers never see it without its AST.
+  // `ASTUnit::Save` also writes to a temporary file that is renamed in place.
+  auto map_path{GetPath(key, ".json")};
+  if (shard.GetASTUnit().Save(GetPath(key, ".ast"))) {
+    LOG(WARNING) << "Cannot write cache entry " << GetPath(key, ".ast");
+    return;
+  }
+
+  llvm::SmallString<128> tmp_path;
+  int fd;
+  if (auto ec = llvm::sys::fs::createUniqueFile(map_path + "-%%%%%%%%", fd,
+                                                tmp_path)) {
+    LOG(WARNING) << "Cannot write cache entry " << map_path << ": "
+                 << ec.message();
+    return;
+  }
+  {
+    llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+    os << llvm::json::Value(shard.Serialize());
+  }
+  if (auto ec = llvm::sys::fs::rename(tmp_path, map_path)) {
+    LOG(WARNING) << "Cannot write cache entry " << map_path << ": "
+                 << ec.message();
+    llvm::sys::fs::remove(tmp_path);
+  }
+}
+
+void FunctionCache::Evict() {
+  if (!max_size) {
+    return;
+  }
+
+  struct Entry {
+    llvm::sys::TimePoint<> last_used;
+    uint64_t size = 0;
+    std::vector<std::string> files;
+  };
+
+  // Files are grouped by key, including leftover temporary files
+  std::map<std::string, Entry> entries;
+  uint64_t total_size{0};
+  std::error_code ec;
+  for (llvm::sys::fs::directory_iterator it(dir, ec), end; it != end && !ec;
+       it.increment(ec)) {
+    llvm::sys::fs::file_status status;
+    if (llvm::sys::fs::status(it->path(), status) ||
+        !llvm::sys::fs::is_regular_file(status)) {
+      continue;
+    }
+    auto name{llvm::sys::path::filename(it->path()).split('.').first};
+    auto &entry{entries[name.str()]};
+    entry.last_used =
+        std::max(entry.last_used, status.getLastModificationTime());
+    entry.size += status.getSize();
+    entry.files.push_back(it->path());
+    total_size += status.getSize();
+  }
+
+  std::vector<Entry *> by_age;
+  for (auto &[key, entry] : entries) {
+    by_age.push_back(&entry);
+  }
+  std::sort(by_age.begin(), by_age.end(), [](Entry *a, Entry *b) {
+    return a->last_used < b->last_used;
+  });
+
+  for (auto entry : by_age) {
+    if (total_size <= max_size) {
+      break;
+    }
+    for (auto &file : entry->files) {
+      llvm::sys::fs::remove(file);
+    }
+    total_size -= entry->size;
+  }
+}
+
+}  // namespace rellic
@@ -0,0 +1,454 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/FunctionShard.h"
+
+#include <clang/AST/Decl.h>
+#include <glog/logging.h>
+#include <llvm/AsmParser/Parser.h>
+#include <llvm/IR/InlineAsm.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/SourceMgr.h>
+
+#include <algorithm>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "rellic/AST/ASTUnitFactory.h"
+#include "rellic/AST/GenerateAST.h"
+#include "rellic/AST/Util.h"
+#include "rellic/BC/Util.h"
+#include "rellic/Exception.h"
+
+namespace rellic {
+
+// Declarations that are created identically in every context. These are mapped
+// onto the existing ones instead of being imported.
+static bool IsSharedDecl(llvm::Value *val) {
+  return llvm::isa<llvm::GlobalValue>(val) || llvm::isa<llvm::Argument>(val) ||
+         llvm::isa<llvm::InlineAsm>(val);
+}
+
+// Version of the format produced by `Serialize`
+static constexpr int64_t kSerializationVersion{1};
+
+namespace {
+// Names the values a function body can refer to relative to the function
+// itself: arguments, blocks and instructions by position, global values by
+// name, and any other operand by the first instruction operand it appears in.
+class ValueNames {
+  llvm::Module &module;
+  std::unordered_map<llvm::Value *, std::string> names;
+  std::unordered_map<std::string, llvm::Value *> values;
+
+  void Add(llvm::Value *val, std::string name) {
+    if (names.emplace(val, name).second) {
+      values.emplace(std::move(name), val);
+    }
+  }
+
+ public:
+  std::vector<llvm::Instruction *> insts;
+
+  ValueNames(llvm::Function &func) : module(*func.getParent()) {
+    for (auto &arg : func.args()) {
+      Add(&arg, "a" + std::to_string(arg.getArgNo()));
+    }
+    auto block_idx{0U};
+    for (auto &block : func) {
+      Add(&block, "b" + std::to_string(block_idx++));
+    }
+    for (auto &inst : llvm::instructions(func)) {
+      Add(&inst, "i" + std::to_string(insts.size()));
+      insts.push_back(&inst);
+    }
+    for (size_t i{0}; i < insts.size(); ++i) {
+      for (auto &op : insts[i]->operands()) {
+        auto val{op.get()};
+        if (!llvm::isa<llvm::GlobalValue>(val) && !names.count(val)) {
+          Add(val, "o" + std::to_string(i) + ":" +
+                       std::to_string(op.getOperandNo()));
+        }
+      }
+    }
+  }
+
+  std::string GetName(llvm::Value *val) const {
+    if (auto gv = llvm::dyn_cast<llvm::GlobalValue>(val)) {
+      return gv->hasName() ? "g" + gv->getName().str() : "";
+    }
+    auto it{names.find(val)};
+    return it == names.end() ? "" : it->second;
+  }
+
+  llvm::Value *GetValue(llvm::StringRef name) const {
+    if (name.consume_front("g")) {
+      return module.getNamedValue(name);
+    }
+    auto it{values.find(name.str())};
+    return it == values.end() ? nullptr : it->second;
+  }
+};
+}  // namespace
+
+FunctionShard::FunctionShard(std::unique_ptr<clang::ASTUnit> ast_unit,
+                             std::vector<llvm::Function *> funcs)
+    : ast_unit(std::move(ast_unit)), funcs(std::move(funcs)) {
+  dec_ctx = std::make_unique<DecompilationContext>(*this->ast_unit);
+}
+
+void FunctionShard::GenerateAST(llvm::Module &module) {
+  rellic::GenerateAST::generateReferenced(module, funcs, *dec_ctx);
+}
+
+llvm::json::Object FunctionShard::Serialize() const {
+  CHECK_EQ(funcs.size(), 1U) << "Only single function shards can be saved";
+  auto &func{*funcs[0]};
+  auto fdefn{clang::cast<clang::FunctionDecl>(dec_ctx->value_decls.at(&func))};
+
+  std::vector<clang::Decl *> decls;
+  EnumerateDecls(dec_ctx->ast_ctx.getTranslationUnitDecl(), decls);
+  auto decl_idx{Invert(decls)};
+  std::vector<clang::Stmt *> stmts;
+  EnumerateStmts(fdefn->getBody(), stmts);
+  auto stmt_idx{Invert(stmts)};
+  ValueNames names{func};
+  auto inst_idx{Invert(names.insts)};
+
+  // Only declarations of IR the function refers to are recorded, since other
+  // types and globals with the same names may be different in another module
+  std::vector<llvm::Type *> types;
+  std::vector<llvm::GlobalValue *> globals;
+  GetReferencedIR(func, types, globals);
+  std::unordered_set<llvm::GlobalValue *> referenced(globals.begin(),
+                                                     globals.end());
+  referenced.insert(&func);
+
+  llvm::json::Array json_types;
+  for (auto type : types) {
+    auto it{dec_ctx->type_decls.find(type)};
+    if (it == dec_ctx->type_decls.end() || !it->second) {
+      continue;
+    }
+    auto idx{decl_idx.find(it->second)};
+    if (idx != decl_idx.end()) {
+      json_types.push_back(
+          llvm::json::Array{LLVMThingToString(type), idx->second});
+    }
+  }
+
+  llvm::json::Array json_values;
+  for (auto [val, decl] : dec_ctx->value_decls) {
+    auto gv{llvm::dyn_cast<llvm::GlobalValue>(val)};
+    auto it{decl_idx.find(decl)};
+    if (!decl || it == decl_idx.end() || (gv && !referenced.count(gv))) {
+      continue;
+    }
+    auto name{names.GetName(val)};
+    if (!name.empty()) {
+      json_values.push_back(llvm::json::Array{name, it->second});
+    }
+  }
+
+  llvm::json::Array json_temps;
+  for (auto [arg, decl] : dec_ctx->temp_decls) {
+    auto it{decl_idx.find(decl)};
+    if (arg->getParent() == &func && it != decl_idx.end()) {
+      json_temps.push_back(llvm::json::Array{arg->getArgNo(), it->second});
+    }
+  }
+
+  llvm::json::Array json_stmts;
+  for (auto [stmt, val] : dec_ctx->stmt_provenance) {
+    auto it{stmt_idx.find(stmt)};
+    auto name{val ? names.GetName(val) : ""};
+    if (it != stmt_idx.end() && !name.empty()) {
+      json_stmts.push_back(llvm::json::Array{it->second, name});
+    }
+  }
+
+  llvm::json::Array json_uses;
+  for (auto [expr, use] : dec_ctx->use_provenance) {
+    auto it{stmt_idx.find(expr)};
+    if (it == stmt_idx.end() || !use) {
+      continue;
+    }
+    auto inst{llvm::dyn_cast<llvm::Instruction>(use->getUser())};
+    auto user{inst_idx.find(inst)};
+    if (user != inst_idx.end()) {
+      json_uses.push_back(
+          llvm::json::Array{it->second, user->second, use->getOperandNo()});
+    }
+  }
+
+  return llvm::json::Object{
+      {"version", kSerializationVersion},
+      {"function", decl_idx.at(fdefn)},
+      {"types", std::move(json_types)},
+      {"values", std::move(json_values)},
+      {"temps", std::move(json_temps)},
+      {"stmts", std::move(json_stmts)},
+      {"uses", std::move(json_uses)},
+  };
+}
+
+std::unique_ptr<FunctionShard> FunctionShard::Deserialize(
+    llvm::Function &func, clang::ASTUnit &cached,
+    const llvm::json::Object &map) {
+  CHECK_THROW(map.getInteger("version") == kSerializationVersion)
+      << "Unsupported version";
+
+  auto &module{*func.getParent()};
+  auto shard{std::make_unique<FunctionShard>(
+      ASTUnitFactory::Get().Create(module.getTargetTriple()),
+      std::vector<llvm::Function *>{&func})};
+  auto &ctx{*shard->dec_ctx};
+
+  std::vector<clang::Decl *> decls;
+  EnumerateDecls(cached.getASTContext().getTranslationUnitDecl(), decls);
+  clang::ASTImporter importer(ctx.ast_ctx, shard->ast_unit->getFileManager(),
+                              cached.getASTContext(), cached.getFileManager(),
+                              /*MinimalImport=*/false);
+  auto ImportDecl = [&](const llvm::json::Value &idx) {
+    auto decl{importer.Import(decls[GetJSONIndex(idx, decls.size())])};
+    if (!decl) {
+      THROW() << "Cannot import declaration: "
+              << llvm::toString(decl.takeError());
+    }
+    return *decl;
+  };
+  ValueNames names{func};
+  auto GetValue = [&](const llvm::json::Value &name) {
+    auto val{names.GetValue(GetJSONString(name))};
+    CHECK_THROW(val) << "Unknown value " << GetJSONString(name).str();
+    return val;
+  };
+
+  auto function{map.get("function")};
+  CHECK_THROW(function) << "Missing function";
+  auto from_defn{clang::dyn_cast<clang::FunctionDecl>(
+      decls[GetJSONIndex(*function, decls.size())])};
+  CHECK_THROW(from_defn && from_defn->hasBody()) << "Missing function body";
+  auto fdefn{clang::cast<clang::FunctionDecl>(ImportDecl(*function))};
+  ctx.value_decls[&func] = fdefn;
+
+  for (auto &entry : GetJSONEntries(map, "types")) {
+    auto &arr{*entry.getAsArray()};
+    CHECK_THROW(arr.size() == 2) << "Malformed type entry";
+    llvm::SMDiagnostic err;
+    auto type{llvm::parseType(GetJSONString(arr[0]), err, module)};
+    CHECK_THROW(type) << "Unknown type " << GetJSONString(arr[0]).str();
+    ctx.type_decls[type] = clang::cast<clang::TypeDecl>(ImportDecl(arr[1]));
+  }
+  // Types created before refer to the declarations that were replaced
+  ctx.qual_types.clear();
+  ctx.type_provider->ClearCache();
+
+  for (auto &entry : GetJSONEntries(map, "values")) {
+    auto &arr{*entry.getAsArray()};
+    CHECK_THROW(arr.size() == 2) << "Malformed value entry";
+    auto val{GetValue(arr[0])};
+    if (val != &func) {
+      ctx.value_decls[val] = clang::cast<clang::ValueDecl>(ImportDecl(arr[1]));
+    }
+  }
+
+  for (auto &entry : GetJSONEntries(map, "temps")) {
+    auto &arr{*entry.getAsArray()};
+    CHECK_THROW(arr.size() == 2) << "Malformed temporary entry";
+    auto arg{func.getArg(GetJSONIndex(arr[0], func.arg_size()))};
+    ctx.temp_decls[arg] = clang::cast<clang::VarDecl>(ImportDecl(arr[1]));
+  }
+
+  std::vector<clang::Stmt *> stmts;
+  EnumerateStmts(from_defn->getBody(), stmts);
+  std::unordered_map<clang::Stmt *, clang::Stmt *> imported;
+  ZipStmts(from_defn->getBody(), fdefn->getBody(), imported);
+
+  for (auto &entry : GetJSONEntries(map, "stmts")) {
+    auto &arr{*entry.getAsArray()};
+    CHECK_THROW(arr.size() == 2) << "Malformed statement entry";
+    auto stmt{imported[stmts[GetJSONIndex(arr[0], stmts.size())]]};
+    CHECK_THROW(stmt) << "Statement was not imported";
+    ctx.stmt_provenance[stmt] = GetValue(arr[1]);
+  }
+
+  for (auto &entry : GetJSONEntries(map, "uses")) {
+    auto &arr{*entry.getAsArray()};
+    CHECK_THROW(arr.size() == 3) << "Malformed use entry";
+    auto expr{clang::dyn_cast_or_null<clang::Expr>(
+        imported[stmts[GetJSONIndex(arr[0], stmts.size())]])};
+    auto inst{names.insts[GetJSONIndex(arr[1], names.insts.size())]};
+    auto &use{
+        inst->getOperandUse(GetJSONIndex(arr[2], inst->getNumOperands()))};
+    CHECK_THROW(expr) << "Use provenance on a statement that was not "
+                         "imported or is not an expression";
+    ctx.use_provenance[expr] = &use;
+  }
+
+  return shard;
+}
+
+void FunctionShard::PrepareMerge(DecompilationContext &into) {
+  importer = std::make_unique<clang::ASTImporter>(
+      into.ast_ctx, into.ast_unit.getFileManager(), dec_ctx->ast_ctx,
+      ast_unit->getFileManager(), /*MinimalImport=*/false);
+
+  // Visited in the order they were declared in the shard, so that any type the
+  // destination does not know about yet is declared deterministically
+  std::unordered_map<clang::Decl *, unsigned> positions;
+  for (auto decl : dec_ctx->ast_ctx.getTranslationUnitDecl()->decls()) {
+    positions.emplace(decl, positions.size());
+  }
+  std::vector<std::pair<llvm::Type *, clang::TypeDecl *>> types;
+  for (auto [type, from_decl] : dec_ctx->type_decls) {
+    if (from_decl) {
+      types.emplace_back(type, from_decl);
+    }
+  }
+  auto position{[&positions](clang::Decl *decl) {
+    auto it{positions.find(decl)};
+    return it == positions.end() ? positions.size() : it->second;
+  }};
+  std::sort(types.begin(), types.end(), [&position](auto &a, auto &b) {
+    return position(a.second) < position(b.second);
+  });
+
+  for (auto [type, from_decl] : types) {
+    // Types can be created lazily while generating bodies, so the destination
+    // might not know about this one yet
+    if (!into.type_decls[type]) {
+      into.GetQualType(type);
+    }
+    auto to_decl{into.type_decls[type]};
+    if (!to_decl) {
+      continue;
+    }
+    importer->MapImported(from_decl, to_decl);
+
+    auto from_rec{clang::dyn_cast<clang::RecordDecl>(from_decl)};
+    auto to_rec{clang::dyn_cast<clang::RecordDecl>(to_decl)};
+    if (from_rec && to_rec) {
+      auto to_field{to_rec->field_begin()};
+      for (auto from_field : from_rec->fields()) {
+        CHECK(to_field != to_rec->field_end())
+            << "Mismatched fields in " << to_rec->getName().str();
+        importer->MapImported(from_field, *to_field);
+        ++to_field;
+      }
+    }
+  }
+
+  for (auto [val, from_decl] : dec_ctx->value_decls) {
+    if (!from_decl || !IsSharedDecl(val)) {
+      continue;
+    }
+    auto to_decl{into.value_decls[val]};
+    if (!to_decl) {
+      continue;
+    }
+    auto fdecl{clang::dyn_cast<clang::FunctionDecl>(from_decl)};
+    if (fdecl && fdecl->hasBody() && fdecl->getPreviousDecl()) {
+      // The definition is merged separately, only map the prototype here
+      from_decl = fdecl->getPreviousDecl();
+    }
+    importer->MapImported(from_decl, to_decl);
+  }
+}
+
+void FunctionShard::MergeFunction(llvm::Function &func,
+                                  DecompilationContext &into) {
+  auto from_defn{clang::cast<clang::FunctionDecl>(dec_ctx->value_decls[&func])};
+  auto fdecl{clang::cast<clang::FunctionDecl>(into.value_decls[&func])};
+  // Same as what `GenerateAST` does when it creates a definition
+  auto tudecl{into.ast_ctx.getTranslationUnitDecl()};
+  auto fdefn{into.ast.CreateFunctionDecl(tudecl, fdecl->getType(),
+                                         fdecl->getIdentifier())};
+  fdefn->setPreviousDecl(fdecl);
+  into.value_decls[&func] = fdefn;
+  tudecl->addDecl(fdefn);
+  fdefn->setParams(fdecl->parameters());
+
+  importer->MapImported(from_defn, fdefn);
+  auto body{importer->Import(from_defn->getBody())};
+  if (!body) {
+    THROW() << "Cannot merge body of " << func.getName().str() << ": "
+            << llvm::toString(body.takeError());
+  }
+  fdefn->setBody(*body);
+  if (dec_ctx->degraded_functions.count(from_defn)) {
+    into.degraded_functions.insert(fdefn);
+  }
+  ZipStmts(from_defn->getBody(), *body, imported_stmts);
+}
+
+void FunctionShard::FinishMerge(DecompilationContext &into) {
+  for (auto [stmt, val] : dec_ctx->stmt_provenance) {
+    auto it{imported_stmts.find(stmt)};
+    if (it != imported_stmts.end()) {
+      into.stmt_provenance[it->second] = val;
+    }
+  }
+
+  for (auto [expr, use] : dec_ctx->use_provenance) {
+    auto it{imported_stmts.find(expr)};
+    if (it != imported_stmts.end()) {
+      into.use_provenance[clang::cast<clang::Expr>(it->second)] = use;
+    }
+  }
+
+  for (auto [val, from_decl] : dec_ctx->value_decls) {
+    if (!from_decl || IsSharedDecl(val)) {
+      continue;
+    }
+    if (auto decl = importer->GetAlreadyImportedOrNull(from_decl)) {
+      into.value_decls[val] = clang::cast<clang::ValueDecl>(decl);
+    }
+  }
+
+  for (auto [arg, from_decl] : dec_ctx->temp_decls) {
+    if (!from_decl) {
+      continue;
+    }
+    if (auto decl = importer->GetAlreadyImportedOrNull(from_decl)) {
+      into.temp_decls[arg] = clang::cast<clang::VarDecl>(decl);
+    }
+  }
+
+  into.z3_cache.Merge(dec_ctx->z3_cache);
+  into.stats.Merge(dec_ctx->stats);
+
+  importer = nullptr;
+  imported_stmts.clear();
+}
+
+void FunctionShard::Merge(llvm::Module &module,
+                          std::vector<std::unique_ptr<FunctionShard>> &shards,
+                          DecompilationContext &into) {
+  std::unordered_map<llvm::Function *, FunctionShard *> owners;
+  for (auto &shard : shards) {
+    for (auto func : shard->funcs) {
+      owners[func] = shard.get();
+    }
+    shard->PrepareMerge(into);
+  }
+
+  for (auto &func : module.functions()) {
+    auto owner{owners.find(&func)};
+    if (owner != owners.end()) {
+      owner->second->MergeFunction(func, into);
+    }
+  }
+
+  for (auto &shard : shards) {
+    shard->FinishMerge(into);
+  }
+}
+
+}  // namespace rellic
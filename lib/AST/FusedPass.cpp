@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/FusedPass.h"
+
+#include <glog/logging.h>
+
+#include <algorithm>
+#include <iterator>
+
+#include "rellic/Log.h"
+
+namespace rellic {
+
+FusedPass::FusedPass(DecompilationContext &dec_ctx)
+    : TransformVisitor<FusedPass>(dec_ctx) {}
+
+void FusedPass::Add(std::unique_ptr<ASTPass> pass) {
+  auto rewrite{dynamic_cast<LocalRewrite *>(pass.get())};
+  CHECK(rewrite) << pass->GetName() << " cannot be fused";
+  // Named after its passes, e.g. `Fused(NestedScopeCombine,CondBasedRefine)`
+  if (rewrites.empty()) {
+    name += "(";
+  } else {
+    name.back() = ',';
+  }
+  name += pass->GetName();
+  name += ")";
+  rewrites.push_back(rewrite);
+  passes.push_back(std::move(pass));
+}
+
+unsigned FusedPass::GetEffects() const {
+  unsigned effects{0};
+  for (auto &pass : passes) {
+    effects |= pass->GetEffects();
+  }
+  return effects;
+}
+
+unsigned FusedPass::GetTriggers() const {
+  unsigned triggers{0};
+  for (auto &pass : passes) {
+    triggers |= pass->GetTriggers();
+  }
+  return triggers;
+}
+
+bool FusedPass::TracksStatements() const {
+  return std::all_of(passes.begin(), passes.end(),
+                     [](auto &pass) { return pass->TracksStatements(); });
+}
+
+bool FusedPass::VisitStmt(clang::Stmt *stmt) {
+  if (!TransformVisitor<FusedPass>::VisitStmt(stmt)) {
+    return false;
+  }
+
+  auto sub{stmt};
+  for (auto rewrite : rewrites) {
+    // Statements removed by an earlier pass leave holes in their compound,
+    // which the passes that come after it do not expect
+    if (auto compound = clang::dyn_cast<clang::CompoundStmt>(sub)) {
+      auto body{compound->body()};
+      if (std::find(body.begin(), body.end(), nullptr) != body.end()) {
+        std::vector<clang::Stmt *> new_body;
+        std::copy_if(body.begin(), body.end(), std::back_inserter(new_body),
+                     [](clang::Stmt *child) { return child != nullptr; });
+        sub = dec_ctx.ast.CreateCompoundStmt(new_body);
+      }
+    }
+    sub = rewrite->Rewrite(sub);
+    if (!sub || Stopped()) {
+      break;
+    }
+  }
+  if (sub != stmt) {
+    Substitute(stmt, sub);
+  }
+  return !Stopped();
+}
+
+void FusedPass::RunImpl() {
+  RELLIC_LOG(Passes) << "Running " << name;
+  TransformVisitor<FusedPass>::RunImpl();
+  for (auto &pass : passes) {
+    pass->SetScope(scope);
+  }
+  for (auto rewrite : rewrites) {
+    rewrite->Prepare();
+  }
+  TraverseFunctions();
+}
+
+}  // namespace rellic
@@ -14,21 +14,31 @@
 #include <llvm/ADT/DepthFirstIterator.h>
 #include <llvm/ADT/PostOrderIterator.h>
 #include <llvm/Analysis/CFG.h>
+#include <llvm/Analysis/DominanceFrontier.h>
 #include <llvm/Analysis/LoopInfo.h>
+#include <llvm/Analysis/PostDominators.h>
 #include <llvm/Analysis/RegionInfo.h>
+#include <llvm/IR/Dominators.h>
 #include <llvm/IR/Instruction.h>
 #include <llvm/IR/Module.h>
+#include <llvm/IR/PassInstrumentation.h>
 #include <llvm/IR/PassManager.h>
-#include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/TimeProfiler.h>
 #include <llvm/Support/raw_ostream.h>
 
 #include <algorithm>
+#include <chrono>
+#include <optional>
+#include <set>
+#include <unordered_set>
 #include <vector>
 
 #include "rellic/AST/ASTBuilder.h"
 #include "rellic/AST/Util.h"
+#include "rellic/Activity.h"
 #include "rellic/BC/Util.h"
 #include "rellic/Exception.h"
+#include "rellic/Log.h"
 
 namespace rellic {
 
@@ -75,19 +85,6 @@ using StmtVec = std::vector<clang::Stmt *>;
 //   }
 // }
 
-static bool IsRegionBlock(llvm::Region *region, llvm::BasicBlock *block) {
-  return region->getRegionInfo()->getRegionFor(block) == region;
-}
-
-static bool IsSubregionEntry(llvm::Region *region, llvm::BasicBlock *block) {
-  for (auto &subregion : *region) {
-    if (subregion->getEntry() == block) {
-      return true;
-    }
-  }
-  return false;
-}
-
 // static bool IsSubregionExit(llvm::Region *region, llvm::BasicBlock *block) {
 //   for (auto &subregion : *region) {
 //     if (subregion->getExit() == block) {
@@ -97,15 +94,6 @@ static bool IsSubregionEntry(llvm::Region *region, llvm::BasicBlock *block) {
 //   return false;
 // }
 
-static llvm::Region *GetSubregion(llvm::Region *region,
-                                  llvm::BasicBlock *block) {
-  if (!region->contains(block)) {
-    return nullptr;
-  } else {
-    return region->getSubRegionNode(block);
-  }
-}
-
 std::string GetRegionNameStr(llvm::Region *region) {
   std::string exit_name;
   std::string entry_name;
@@ -189,28 +177,52 @@ unsigned GenerateAST::GetOrCreateVarForSwitch(llvm::SwitchInst *inst) {
 }
 
 unsigned GenerateAST::GetOrCreateEdgeForSwitch(llvm::SwitchInst *inst,
-                                               llvm::ConstantInt *c) {
-  if (dec_ctx.z3_sw_edges.find({inst, c}) != dec_ctx.z3_sw_edges.end()) {
-    return dec_ctx.z3_sw_edges[{inst, c}];
+                                               llvm::BasicBlock *dest) {
+  auto it{dec_ctx.z3_sw_edges.find({inst, dest})};
+  if (it != dec_ctx.z3_sw_edges.end()) {
+    return it->second;
   }
 
-  unsigned idx;
-  if (c) {
-    auto sw_case{inst->findCaseValue(c)};
-    auto var{ToExpr(GetOrCreateVarForSwitch(inst))};
-    auto expr{var == dec_ctx.z3_ctx.int_val(sw_case->getCaseIndex())};
-
-    idx = dec_ctx.InsertZExpr(expr);
-  } else {
-    // Default case
-    z3::expr_vector vec{dec_ctx.z3_ctx};
-    for (auto sw_case : inst->cases()) {
-      vec.push_back(
-          !ToExpr(GetOrCreateEdgeForSwitch(inst, sw_case.getCaseValue())));
+  // The variable of the switch is the index of the case that is taken, and
+  // any index from the number of cases up stands for the default, so that the
+  // edges partition the integers into ranges. Equalities are kept for single
+  // cases, as they are the most common and print the same way.
+  auto var{ToExpr(GetOrCreateVarForSwitch(inst))};
+  auto num_cases{inst->getNumCases()};
+  z3::expr_vector ranges{dec_ctx.z3_ctx};
+  auto AddRange{[&](unsigned first, unsigned last) {
+    if (first == last && first != 0 && last != num_cases) {
+      ranges.push_back(var == dec_ctx.z3_ctx.int_val(first));
+      return;
+    }
+    z3::expr_vector bounds{dec_ctx.z3_ctx};
+    if (first != 0) {
+      bounds.push_back(var >= dec_ctx.z3_ctx.int_val(first));
+    }
+    if (last != num_cases) {
+      bounds.push_back(var <= dec_ctx.z3_ctx.int_val(last));
+    }
+    ranges.push_back(z3::mk_and(bounds));
+  }};
+  std::optional<unsigned> first;
+  for (unsigned i{0}; i <= num_cases; ++i) {
+    // Successor 0 is the default destination, and case i jumps to i + 1
+    auto succ{inst->getSuccessor(i == num_cases ? 0 : i + 1)};
+    if (succ == dest) {
+      if (!first) {
+        first = i;
+      }
+    } else if (first) {
+      AddRange(*first, i - 1);
+      first.reset();
     }
-    idx = dec_ctx.InsertZExpr(z3::mk_and(vec));
   }
-  dec_ctx.z3_sw_edges[{inst, c}] = idx;
+  if (first) {
+    AddRange(*first, num_cases);
+  }
+
+  auto idx{dec_ctx.InsertZExpr(z3::mk_or(ranges))};
+  dec_ctx.z3_sw_edges[{inst, dest}] = idx;
   return idx;
 }
 
@@ -235,18 +247,7 @@ unsigned GenerateAST::GetOrCreateEdgeCond(llvm::BasicBlock *from,
     // Switches
     case llvm::Instruction::Switch: {
       auto sw{llvm::cast<llvm::SwitchInst>(term)};
-      if (to == sw->getDefaultDest()) {
-        result = ToExpr(GetOrCreateEdgeForSwitch(sw, nullptr));
-      } else {
-        z3::expr_vector or_vec{dec_ctx.z3_ctx};
-        for (auto sw_case : sw->cases()) {
-          if (sw_case.getCaseSuccessor() == to) {
-            or_vec.push_back(
-                ToExpr(GetOrCreateEdgeForSwitch(sw, sw_case.getCaseValue())));
-          }
-        }
-        result = HeavySimplify(z3::mk_or(or_vec));
-      }
+      result = ToExpr(GetOrCreateEdgeForSwitch(sw, to));
     } break;
     // Returns
     case llvm::Instruction::Ret:
@@ -271,16 +272,45 @@ unsigned GenerateAST::GetOrCreateEdgeCond(llvm::BasicBlock *from,
   return dec_ctx.z3_edges[{from, to}];
 }
 
-unsigned GenerateAST::GetReachingCond(llvm::BasicBlock *block) {
-  if (dec_ctx.reaching_conds.find(block) == dec_ctx.reaching_conds.end()) {
-    return poison_idx;
-  }
+unsigned GenerateAST::GetBlockId(llvm::BasicBlock *block) {
+  auto it{block_ids.find(block)};
+  DCHECK(it != block_ids.end());
+  return it->second;
+}
 
-  return dec_ctx.reaching_conds[block];
+unsigned GenerateAST::GetRegionId(llvm::Region *region) {
+  auto it{region_ids.find(region)};
+  DCHECK(it != region_ids.end());
+  return it->second;
 }
 
-void GenerateAST::CreateReachingCond(llvm::BasicBlock *block) {
-  auto old_cond_idx{GetReachingCond(block)};
+unsigned GenerateAST::GetReachingCond(llvm::BasicBlock *block) {
+  return dec_ctx.reaching_conds[GetBlockId(block)];
+}
+
+bool GenerateAST::CreateReachingCond(llvm::BasicBlock *block) {
+  auto id{GetBlockId(block)};
+  auto old_cond_idx{dec_ctx.reaching_conds[id]};
+  // The edges of a switch partition the ways out of it, so the disjunction
+  // over its cases is the condition of the switch itself
+  auto join{switch_joins.find(block)};
+  if (join != switch_joins.end()) {
+    auto cond_idx{GetReachingCond(join->second)};
+    if (cond_idx == poison_idx || cond_idx == old_cond_idx) {
+      return false;
+    }
+    dec_ctx.reaching_conds[id] = cond_idx;
+    return true;
+  }
+  // Straight-line code is reached exactly when its predecessor is
+  if (auto pred = GetSequentialPred(block)) {
+    auto cond_idx{GetReachingCond(pred)};
+    if (cond_idx == poison_idx || cond_idx == old_cond_idx) {
+      return false;
+    }
+    dec_ctx.reaching_conds[id] = cond_idx;
+    return true;
+  }
   auto old_cond{ToExpr(old_cond_idx)};
   if (block->hasNPredecessorsOrMore(1)) {
     // Gather reaching conditions from predecessors of the block
@@ -291,23 +321,395 @@ void GenerateAST::CreateReachingCond(llvm::BasicBlock *block) {
       // Construct reaching condition from `pred` to `block` as
       // `reach_cond[pred] && edge_cond(pred, block)` or one of
       // the two if the other one is missing.
-      auto conj_cond{HeavySimplify(pred_cond && edge_cond)};
+      auto conj_cond{HeavySimplify(dec_ctx, pred_cond && edge_cond)};
       // Append `conj_cond` to reaching conditions of other
       // predecessors via an `||`. Use `conj_cond` if there
       // is no `cond` yet.
       conds.push_back(conj_cond);
     }
 
-    auto cond{HeavySimplify(z3::mk_or(conds))};
-    if (old_cond_idx == poison_idx || !Prove(old_cond == cond)) {
-      dec_ctx.reaching_conds[block] = dec_ctx.InsertZExpr(cond);
-      reaching_conds_changed = true;
+    auto cond{HeavySimplify(dec_ctx, z3::mk_or(conds))};
+    *simplifications += conds.size() + 1;
+    if (old_cond_idx == poison_idx || !Prove(dec_ctx, old_cond == cond)) {
+      dec_ctx.reaching_conds[id] = dec_ctx.InsertZExpr(cond);
+      return true;
     }
-  } else if (dec_ctx.reaching_conds.find(block) ==
-             dec_ctx.reaching_conds.end()) {
-    dec_ctx.reaching_conds[block] =
+  } else if (old_cond_idx == poison_idx) {
+    dec_ctx.reaching_conds[id] =
         dec_ctx.InsertZExpr(dec_ctx.z3_ctx.bool_val(true));
-    reaching_conds_changed = true;
+    return true;
+  }
+  return false;
+}
+
+llvm::BasicBlock *GenerateAST::GetSequentialPred(llvm::BasicBlock *block) {
+  auto pred{block->getUniquePredecessor()};
+  if (pred && pred != block && pred->getUniqueSuccessor() == block) {
+    return pred;
+  }
+  return nullptr;
+}
+
+unsigned GenerateAST::GetRelativeCond(llvm::BasicBlock *block) {
+  return relative_conds[GetBlockId(block)];
+}
+
+bool GenerateAST::CreateRelativeReachingCond(llvm::BasicBlock *block) {
+  auto id{GetBlockId(block)};
+  auto idom{domtree->getNode(block)->getIDom()};
+  if (!idom) {
+    if (relative_conds[id] != poison_idx) {
+      return false;
+    }
+    auto idx{dec_ctx.InsertZExpr(dec_ctx.z3_ctx.bool_val(true))};
+    relative_conds[id] = idx;
+    dec_ctx.reaching_conds[id] = idx;
+    return true;
+  }
+
+  // Every path to `block` goes through `dom`, and so does every path to its
+  // predecessors. The condition of reaching a predecessor from `dom` is the
+  // conjunction of the relative conditions along the dominator tree between
+  // them, so the condition of `dom` itself is left out of the disjunction.
+  auto dom{idom->getBlock()};
+  bool changed{false};
+  // Conditions taken from a region of the same shape are already final
+  if (!reused_conds.test(id)) {
+    auto join{switch_joins.find(block)};
+    z3::expr_vector conds{dec_ctx.z3_ctx};
+    if ((join != switch_joins.end() && join->second == dom) ||
+        GetSequentialPred(block) == dom) {
+      // Every way out of the switch or of the predecessor leads here
+      conds.push_back(dec_ctx.z3_ctx.bool_val(true));
+    } else {
+      for (auto pred : llvm::predecessors(block)) {
+        if (!domtree->isReachableFromEntry(pred)) {
+          continue;
+        }
+        z3::expr_vector path{dec_ctx.z3_ctx};
+        for (auto node{pred}; node != dom;
+             node = domtree->getNode(node)->getIDom()->getBlock()) {
+          path.push_back(ToExpr(GetRelativeCond(node)));
+        }
+        path.push_back(ToExpr(GetOrCreateEdgeCond(pred, block)));
+        conds.push_back(z3::mk_and(path).simplify());
+      }
+    }
+    // Only joins can create redundancy that the rewriter cannot see
+    auto cond{z3::mk_or(conds).simplify()};
+    if (conds.size() > 1) {
+      cond = HeavySimplify(dec_ctx, cond);
+      ++*simplifications;
+    }
+
+    auto old_cond_idx{relative_conds[id]};
+    if (old_cond_idx == poison_idx ||
+        (!z3::eq(ToExpr(old_cond_idx), cond) &&
+         !Prove(dec_ctx, ToExpr(old_cond_idx) == cond))) {
+      relative_conds[id] = dec_ctx.InsertZExpr(cond);
+      changed = true;
+    }
+  }
+
+  auto reach{(ToExpr(GetReachingCond(dom)) &&
+              ToExpr(GetRelativeCond(block)))
+                 .simplify()};
+  auto old_reach_idx{dec_ctx.reaching_conds[id]};
+  if (old_reach_idx == poison_idx || !z3::eq(ToExpr(old_reach_idx), reach)) {
+    dec_ctx.reaching_conds[id] = dec_ctx.InsertZExpr(reach);
+    changed = true;
+  }
+  return changed;
+}
+
+std::string GenerateAST::GetRegionShape(
+    llvm::Region *region, std::vector<llvm::BasicBlock *> &blocks) {
+  blocks.clear();
+  llvm::DenseMap<llvm::BasicBlock *, unsigned> order;
+  std::vector<llvm::BasicBlock *> stack{region->getEntry()};
+  while (!stack.empty()) {
+    auto block{stack.back()};
+    stack.pop_back();
+    if (!order.try_emplace(block, blocks.size()).second) {
+      continue;
+    }
+    blocks.push_back(block);
+    // Pushed in reverse, so that successors are visited in order
+    auto term{block->getTerminator()};
+    for (auto i{term->getNumSuccessors()}; i-- > 0;) {
+      auto succ{term->getSuccessor(i)};
+      if (succ != region->getExit() && region->contains(succ)) {
+        stack.push_back(succ);
+      }
+    }
+  }
+
+  // Edge conditions only depend on the kind of the terminators and on where
+  // they lead, the variables of the switches being the index of their cases
+  std::string shape;
+  llvm::raw_string_ostream os(shape);
+  for (auto block : blocks) {
+    auto term{block->getTerminator()};
+    os << term->getOpcodeName();
+    if (auto br = llvm::dyn_cast<llvm::BranchInst>(term)) {
+      if (br->isConditional()) {
+        if (auto constant =
+                llvm::dyn_cast<llvm::ConstantInt>(br->getCondition())) {
+          os << (constant->isOne() ? " true" : " false");
+        }
+      }
+    }
+    for (auto succ : llvm::successors(block)) {
+      auto it{order.find(succ)};
+      if (it == order.end()) {
+        os << " x";
+      } else {
+        os << ' ' << it->second;
+      }
+    }
+    os << ';';
+  }
+  return os.str();
+}
+
+std::vector<z3::expr> GenerateAST::GetRegionVars(
+    const std::vector<llvm::BasicBlock *> &blocks) {
+  std::vector<z3::expr> vars;
+  for (auto block : blocks) {
+    auto term{block->getTerminator()};
+    if (auto br = llvm::dyn_cast<llvm::BranchInst>(term)) {
+      if (br->isConditional() &&
+          !llvm::isa<llvm::ConstantInt>(br->getCondition())) {
+        vars.push_back(ToExpr(GetOrCreateEdgeForBranch(br, true)));
+      }
+    } else if (auto sw = llvm::dyn_cast<llvm::SwitchInst>(term)) {
+      vars.push_back(ToExpr(GetOrCreateVarForSwitch(sw)));
+    }
+  }
+  return vars;
+}
+
+void GenerateAST::ReuseRegionConds() {
+  // Regions are walked from the outermost, and the subregions of a region
+  // that was reused are not visited
+  std::vector<llvm::Region *> worklist{regions->getTopLevelRegion()};
+  std::vector<llvm::BasicBlock *> blocks;
+  while (!worklist.empty()) {
+    auto region{worklist.back()};
+    worklist.pop_back();
+    auto it{region_conds.find(GetRegionShape(region, blocks))};
+    if (it == region_conds.end()) {
+      for (auto &subregion : *region) {
+        worklist.push_back(subregion.get());
+      }
+      continue;
+    }
+    auto &known{it->second};
+    z3::expr_vector from{dec_ctx.z3_ctx};
+    z3::expr_vector to{dec_ctx.z3_ctx};
+    for (auto var : known.vars) {
+      from.push_back(var);
+    }
+    for (auto var : GetRegionVars(blocks)) {
+      to.push_back(var);
+    }
+    for (size_t i{1}; i < blocks.size(); ++i) {
+      auto cond{known.conds[i - 1]};
+      auto id{GetBlockId(blocks[i])};
+      relative_conds[id] = dec_ctx.InsertZExpr(cond.substitute(from, to));
+      reused_conds.set(id);
+    }
+    ++dec_ctx.stats.reused_regions;
+    dec_ctx.stats.reused_region_blocks += blocks.size() - 1;
+    RELLIC_LOG(Structuring) << "Reusing the conditions of region "
+                            << GetRegionNameStr(region);
+  }
+}
+
+void GenerateAST::RecordRegionConds() {
+  std::vector<llvm::Region *> worklist{regions->getTopLevelRegion()};
+  std::vector<llvm::BasicBlock *> blocks;
+  while (!worklist.empty()) {
+    auto region{worklist.back()};
+    worklist.pop_back();
+    for (auto &subregion : *region) {
+      worklist.push_back(subregion.get());
+    }
+    auto shape{GetRegionShape(region, blocks)};
+    if (blocks.size() < 2 || region_conds.count(shape)) {
+      continue;
+    }
+    RegionConds known;
+    for (size_t i{1}; i < blocks.size(); ++i) {
+      auto idx{GetRelativeCond(blocks[i])};
+      if (idx == poison_idx) {
+        break;
+      }
+      known.conds.push_back(ToExpr(idx));
+    }
+    if (known.conds.size() + 1 == blocks.size()) {
+      known.vars = GetRegionVars(blocks);
+      region_conds.emplace(std::move(shape), std::move(known));
+    }
+  }
+}
+
+llvm::BitVector GenerateAST::GetConditionedBlocks() {
+  llvm::BitVector res(func_blocks.size());
+  std::vector<llvm::BasicBlock *> worklist;
+  auto Need{[&](llvm::BasicBlock *block) {
+    auto id{GetBlockId(block)};
+    if (!res.test(id)) {
+      res.set(id);
+      worklist.push_back(block);
+    }
+  }};
+  for (size_t i{0}; i < func_regions.size(); ++i) {
+    if (!IsSwitchRegion(func_regions[i])) {
+      for (auto block : region_blocks[i]) {
+        Need(block);
+      }
+    }
+  }
+
+  // Adds what the conditions of the blocks are computed from, following
+  // `CreateReachingCond` and `CreateRelativeReachingCond`
+  auto relative{dec_ctx.dominator_reaching_conds};
+  while (!worklist.empty()) {
+    auto block{worklist.back()};
+    worklist.pop_back();
+    auto join{switch_joins.find(block)};
+    if (relative) {
+      auto idom{domtree->getNode(block)->getIDom()};
+      if (!idom) {
+        continue;
+      }
+      auto dom{idom->getBlock()};
+      Need(dom);
+      if (join != switch_joins.end() && join->second == dom) {
+        continue;
+      }
+      for (auto pred : llvm::predecessors(block)) {
+        if (!domtree->isReachableFromEntry(pred)) {
+          continue;
+        }
+        for (auto node{pred}; node != dom;
+             node = domtree->getNode(node)->getIDom()->getBlock()) {
+          Need(node);
+        }
+      }
+    } else if (join != switch_joins.end()) {
+      Need(join->second);
+    } else if (auto pred = GetSequentialPred(block)) {
+      Need(pred);
+    } else {
+      for (auto pred : llvm::predecessors(block)) {
+        Need(pred);
+      }
+    }
+  }
+  return res;
+}
+
+unsigned GenerateAST::CreateReachingConds() {
+  // The reaching condition of a block only depends on the ones of its
+  // predecessors, so after an initial sweep only the successors of blocks
+  // whose condition changed need to be reevaluated. The worklist is keyed by
+  // position in `rpo_walk` so that blocks are still visited in reverse
+  // post-order, which keeps the number of evaluations low. Only the blocks
+  // that structuring asks about, and the ones they depend on, are evaluated.
+  auto conditioned{GetConditionedBlocks()};
+  // Position in `rpo_walk` by block index, for the blocks that are evaluated
+  std::vector<unsigned> rpo_idx(func_blocks.size(), poison_idx);
+  std::set<unsigned> worklist;
+  for (auto i{0U}; i < rpo_walk.size(); ++i) {
+    auto id{GetBlockId(rpo_walk[i])};
+    if (conditioned.test(id)) {
+      rpo_idx[id] = i;
+      worklist.insert(i);
+    }
+  }
+  skipped_blocks = rpo_walk.size() - worklist.size();
+
+  auto relative{dec_ctx.dominator_reaching_conds};
+  auto budget{dec_ctx.structuring_budget};
+  auto start{std::chrono::steady_clock::now()};
+  unsigned num_evaluations{0};
+  while (!worklist.empty()) {
+    if (budget.count() && std::chrono::steady_clock::now() - start > budget) {
+      out_of_budget = true;
+      break;
+    }
+    auto block{rpo_walk[*worklist.begin()]};
+    worklist.erase(worklist.begin());
+    ++num_evaluations;
+    if (relative ? !CreateRelativeReachingCond(block)
+                 : !CreateReachingCond(block)) {
+      continue;
+    }
+    // Unreachable blocks are not part of the walk, and neither are the ones
+    // whose conditions are not needed
+    auto Reevaluate{[&](llvm::BasicBlock *succ) {
+      auto idx{rpo_idx[GetBlockId(succ)]};
+      if (idx != poison_idx) {
+        worklist.insert(idx);
+      }
+    }};
+    for (auto succ : llvm::successors(block)) {
+      Reevaluate(succ);
+    }
+    // Relative conditions are conjoined with the ones of their immediate
+    // dominators
+    if (relative) {
+      for (auto child : domtree->getNode(block)->children()) {
+        Reevaluate(child->getBlock());
+      }
+    }
+  }
+
+  RELLIC_LOG(Structuring) << "Reaching conditions for "
+                          << rpo_walk.size() - skipped_blocks << " of "
+                          << rpo_walk.size()
+                          << " blocks computed in " << num_evaluations
+                          << " evaluations";
+  return num_evaluations;
+}
+
+void GenerateAST::CollectSwitchJoins() {
+  for (auto block : rpo_walk) {
+    if (!llvm::isa<llvm::SwitchInst>(block->getTerminator())) {
+      continue;
+    }
+    // Blocks that are only entered from the switch and have a single
+    // successor are cases, which must all lead to the join. The switch may
+    // also jump to the join directly.
+    auto IsCase{[block](llvm::BasicBlock *succ) {
+      return succ->getUniquePredecessor() == block &&
+             succ->getUniqueSuccessor();
+    }};
+    llvm::BasicBlock *join{nullptr};
+    for (auto succ : llvm::successors(block)) {
+      if (IsCase(succ)) {
+        join = succ->getUniqueSuccessor();
+        break;
+      }
+    }
+    if (!join || join == block) {
+      continue;
+    }
+    BBSet succs{llvm::succ_begin(block), llvm::succ_end(block)};
+    auto valid{std::all_of(succs.begin(), succs.end(), [&](auto succ) {
+      return succ == join ||
+             (IsCase(succ) && succ->getUniqueSuccessor() == join);
+    })};
+    valid = valid && std::all_of(llvm::pred_begin(join), llvm::pred_end(join),
+                                 [&](llvm::BasicBlock *pred) {
+                                   return pred == block ||
+                                          (pred != join && succs.count(pred));
+                                 });
+    if (valid) {
+      switch_joins[join] = block;
+    }
   }
 }
 
@@ -317,58 +719,125 @@ StmtVec GenerateAST::CreateBasicBlockStmts(llvm::BasicBlock *block) {
   return result;
 }
 
+void GenerateAST::CollectRegionBlocks() {
+  func_regions.clear();
+  region_ids.clear();
+  std::vector<llvm::Region *> walk{regions->getTopLevelRegion()};
+  while (!walk.empty()) {
+    auto region{walk.back()};
+    walk.pop_back();
+    region_ids[region] = func_regions.size();
+    func_regions.push_back(region);
+    for (auto &subregion : *region) {
+      walk.push_back(subregion.get());
+    }
+  }
+  region_blocks.assign(func_regions.size(), {});
+  region_stmts.assign(func_regions.size(), nullptr);
+
+  block_regions.assign(func_blocks.size(), nullptr);
+  entered_regions.assign(func_blocks.size(), {});
+  for (auto block : rpo_walk) {
+    auto id{block_ids[block]};
+    auto region{regions->getRegionFor(block)};
+    block_regions[id] = region;
+    region_blocks[GetRegionId(region)].push_back(block);
+    // The entry of a region also stands for it in its parent. Any region that
+    // contains `block` and is entered through it is nested in one that is, so
+    // the walk stops at the first region with another entry.
+    while (region->getParent() && region->getEntry() == block) {
+      entered_regions[id].push_back(region);
+      region = region->getParent();
+      region_blocks[GetRegionId(region)].push_back(block);
+    }
+  }
+}
+
+llvm::Region *GenerateAST::GetSubregion(llvm::Region *region,
+                                        llvm::BasicBlock *block) {
+  auto it{block_ids.find(block)};
+  if (it == block_ids.end()) {
+    return nullptr;
+  }
+  for (auto subregion : entered_regions[it->second]) {
+    if (subregion->getParent() == region) {
+      return subregion;
+    }
+  }
+  return nullptr;
+}
+
 StmtVec GenerateAST::CreateRegionStmts(llvm::Region *region) {
   StmtVec result;
-  for (auto block : rpo_walk) {
+  for (auto block : region_blocks[GetRegionId(region)]) {
     // Check if the block is a subregion entry
     auto subregion = GetSubregion(region, block);
-    // Ignore blocks that are neither a subregion or a region block
-    if (!subregion && !IsRegionBlock(region, block)) {
-      continue;
-    }
     // If the block is a head of a subregion, get the compound statement of
     // the subregion otherwise create a new compound and gate it behind a
     // reaching condition.
     clang::CompoundStmt *compound = nullptr;
     StmtVec epi_body;
     if (subregion) {
-      CHECK(compound = region_stmts[subregion]);
+      CHECK(compound = region_stmts[GetRegionId(subregion)]);
     } else {
       // Create a compound, wrapping the block
       auto block_body = CreateBasicBlockStmts(block);
       compound = ast.CreateCompoundStmt(block_body);
     }
     // Gate the compound behind a reaching condition
-    auto z_expr{GetReachingCond(block)};
-    block_stmts[block] = ast.CreateIf(dec_ctx.marker_expr, compound);
-    dec_ctx.conds[block_stmts[block]] =
-        dec_ctx.InsertZExpr(dec_ctx.z3_exprs[z_expr]);
+    auto id{GetBlockId(block)};
+    auto z_expr{dec_ctx.reaching_conds[id]};
+    auto stmt{ast.CreateIf(dec_ctx.marker_expr, compound)};
+    block_stmts[id] = stmt;
+    dec_ctx.conds[stmt] = dec_ctx.InsertZExpr(dec_ctx.z3_exprs[z_expr]);
     // Store the compound
-    result.push_back(block_stmts[block]);
+    result.push_back(stmt);
   }
   return result;
 }
 
-void GenerateAST::RefineLoopSuccessors(llvm::Loop *loop, BBSet &members,
-                                       BBSet &successors) {
+void GenerateAST::RefineLoopSuccessors(llvm::Loop *loop,
+                                       llvm::BitVector &members,
+                                       llvm::BitVector &successors) {
+  auto num_blocks{func_blocks.size()};
   // Initialize loop members
-  members.insert(loop->block_begin(), loop->block_end());
+  members.clear();
+  members.resize(num_blocks);
+  for (auto block : loop->blocks()) {
+    members.set(block_ids[block]);
+  }
   // Initialize loop successors
   llvm::SmallVector<llvm::BasicBlock *, 1> exits;
   loop->getExitBlocks(exits);
-  successors.insert(exits.begin(), exits.end());
+  successors.clear();
+  successors.resize(num_blocks);
+  for (auto block : exits) {
+    successors.set(block_ids[block]);
+  }
   auto header = loop->getHeader();
   auto region = regions->getRegionFor(header);
   auto exit = region->getExit();
-  // Loop membership test
-  auto IsLoopMember = [&members](llvm::BasicBlock *block) {
-    return members.count(block) > 0;
+  // Number of incoming edges of each block that do not come from loop
+  // members. It is counted the first time the block is a candidate, and kept
+  // up to date as members are added, so that candidates are only scanned once.
+  std::vector<unsigned> outside_preds(num_blocks);
+  llvm::BitVector counted(num_blocks);
+  auto AllPredsAreMembers = [&](unsigned id) {
+    if (!counted.test(id)) {
+      counted.set(id);
+      for (auto pred : llvm::predecessors(func_blocks[id])) {
+        outside_preds[id] += !members.test(block_ids[pred]);
+      }
+    }
+    return outside_preds[id] == 0;
   };
   // Refinement
   auto new_blocks = successors;
-  while (successors.size() > 1 && !new_blocks.empty()) {
-    new_blocks.clear();
-    for (auto block : BBSet(successors)) {
+  while (successors.count() > 1 && new_blocks.any()) {
+    new_blocks.reset();
+    auto candidates = successors;
+    for (auto id : candidates.set_bits()) {
+      auto block = func_blocks[id];
       if (block == exit) {
         // Don't remove this block from the list of successors if it is the
         // direct exit of the region
@@ -376,35 +845,40 @@ void GenerateAST::RefineLoopSuccessors(llvm::Loop *loop, BBSet &members,
       }
 
       // Check if all predecessors of `block` are loop members
-      if (std::all_of(llvm::pred_begin(block), llvm::pred_end(block),
-                      IsLoopMember)) {
+      if (AllPredsAreMembers(id)) {
         // Add `block` as a loop member
-        members.insert(block);
+        members.set(id);
         // Remove it as a loop successor
-        successors.erase(block);
+        successors.reset(id);
         // Add a successor of `block` to the set of discovered blocks if
         // if it is a region member, if it is NOT a loop member and if
         // the loop header dominates it.
         for (auto succ : llvm::successors(block)) {
-          if (IsRegionBlock(region, succ) && !IsLoopMember(succ) &&
+          auto succ_id = block_ids[succ];
+          if (counted.test(succ_id)) {
+            --outside_preds[succ_id];
+          }
+          if (block_regions[succ_id] == region && !members.test(succ_id) &&
               domtree->dominates(header, succ)) {
-            new_blocks.insert(succ);
+            new_blocks.set(succ_id);
           }
         }
       }
     }
-    successors.insert(new_blocks.begin(), new_blocks.end());
+    successors |= new_blocks;
   }
 }
 
 clang::CompoundStmt *GenerateAST::StructureAcyclicRegion(llvm::Region *region) {
-  DLOG(INFO) << "Region " << GetRegionNameStr(region) << " is acyclic";
+  RELLIC_LOG(Structuring) << "Region " << GetRegionNameStr(region)
+                          << " is acyclic";
   auto region_body = CreateRegionStmts(region);
   return ast.CreateCompoundStmt(region_body);
 }
 
 clang::CompoundStmt *GenerateAST::StructureCyclicRegion(llvm::Region *region) {
-  DLOG(INFO) << "Region " << GetRegionNameStr(region) << " is cyclic";
+  RELLIC_LOG(Structuring) << "Region " << GetRegionNameStr(region)
+                          << " is cyclic";
   auto region_body = CreateRegionStmts(region);
   // Get the loop for which the entry block of the region is a header
   // loops->getLoopFor(region->getEntry())->print(llvm::errs());
@@ -416,36 +890,45 @@ clang::CompoundStmt *GenerateAST::StructureCyclicRegion(llvm::Region *region) {
     return ast.CreateCompoundStmt(region_body);
   }
   // Refine loop members and successors without invalidating LoopInfo
-  BBSet members, successors;
+  llvm::BitVector members, successors;
   RefineLoopSuccessors(loop, members, successors);
-  // Construct the initial loop body
-  StmtVec loop_body;
-  for (auto block : rpo_walk) {
-    if (members.count(block)) {
-      if (IsRegionBlock(region, block) || IsSubregionEntry(region, block)) {
-        auto stmt = block_stmts[block];
-        auto it = std::find(region_body.begin(), region_body.end(), stmt);
-        region_body.erase(it);
-        loop_body.push_back(stmt);
-      }
+  // Construct the initial loop body. Each member block of the region gets a
+  // slot, which is followed by the `break`s that leave the loop from it.
+  std::vector<clang::Stmt *> slots;
+  llvm::DenseMap<llvm::BasicBlock *, unsigned> slot_of;
+  std::unordered_set<clang::Stmt *> loop_stmts;
+  for (auto block : region_blocks[GetRegionId(region)]) {
+    auto id{GetBlockId(block)};
+    if (members.test(id)) {
+      auto stmt = block_stmts[id];
+      slot_of[block] = slots.size();
+      slots.push_back(stmt);
+      loop_stmts.insert(stmt);
     }
   }
+  region_body.erase(std::remove_if(region_body.begin(), region_body.end(),
+                                   [&loop_stmts](clang::Stmt *stmt) {
+                                     return loop_stmts.count(stmt) > 0;
+                                   }),
+                    region_body.end());
   // Get loop exit edges
   std::vector<BBEdge> exits;
-  for (auto succ : successors) {
+  for (auto succ_id : successors.set_bits()) {
+    auto succ = func_blocks[succ_id];
     for (auto pred : llvm::predecessors(succ)) {
-      if (members.count(pred)) {
+      if (members.test(block_ids[pred])) {
         exits.push_back({pred, succ});
       }
     }
   }
-  // Insert `break` statements
+  // Create `break` statements
+  std::vector<StmtVec> slot_exits(slots.size());
   for (auto edge : exits) {
     auto from = edge.first;
     auto to = edge.second;
-    // Find the statement corresponding to the exiting block
-    auto it = std::find(loop_body.begin(), loop_body.end(), block_stmts[from]);
-    CHECK(it != loop_body.end());
+    // Find the slot of the exiting block
+    auto slot = slot_of.find(from);
+    CHECK(slot != slot_of.end());
     // Create a loop exiting `break` statement
     StmtVec break_stmt({ast.CreateBreak()});
     auto exit_stmt =
@@ -454,8 +937,16 @@ clang::CompoundStmt *GenerateAST::StructureCyclicRegion(llvm::Region *region) {
     dec_ctx.conds[exit_stmt] = dec_ctx.InsertZExpr(
         (ToExpr(GetReachingCond(from)) && ToExpr(GetOrCreateEdgeCond(from, to)))
             .simplify());
-    // Insert it after the exiting block statement
-    loop_body.insert(std::next(it), exit_stmt);
+    slot_exits[slot->second].push_back(exit_stmt);
+  }
+  // Place the `break`s after their exiting block statements, the last one
+  // created first
+  StmtVec loop_body;
+  loop_body.reserve(slots.size() + exits.size());
+  for (unsigned i{0}; i < slots.size(); ++i) {
+    loop_body.push_back(slots[i]);
+    loop_body.insert(loop_body.end(), slot_exits[i].rbegin(),
+                     slot_exits[i].rend());
   }
   // Create the loop statement
   auto loop_stmt =
@@ -466,9 +957,44 @@ clang::CompoundStmt *GenerateAST::StructureCyclicRegion(llvm::Region *region) {
   return ast.CreateCompoundStmt(region_body);
 }
 
+bool GenerateAST::IsSwitchRegion(llvm::Region *region) {
+  auto entry{region->getEntry()};
+  if (!llvm::isa<llvm::SwitchInst>(entry->getTerminator()) ||
+      GetSubregion(region, entry)) {
+    return false;
+  }
+  // The switch may head a loop, as long as the back edges are outside of the
+  // region, like those of a switch at the top of a loop body
+  if (region->outermostLoopInRegion(loops, entry)) {
+    return false;
+  }
+
+  auto exit{region->getExit()};
+  BBSet cases;
+  for (auto succ : llvm::successors(entry)) {
+    if (succ == exit || !cases.insert(succ).second) {
+      continue;
+    }
+    // Cases cannot fall through into each other
+    if (succ->getUniquePredecessor() != entry) {
+      return false;
+    }
+    if (auto subregion = GetSubregion(region, succ)) {
+      if (subregion->getExit() != exit) {
+        return false;
+      }
+    } else if (std::any_of(llvm::succ_begin(succ), llvm::succ_end(succ),
+                           [exit](auto block) { return block != exit; })) {
+      return false;
+    }
+  }
+  // Nothing but the switch and its cases may be in the region
+  return region_blocks[GetRegionId(region)].size() == cases.size() + 1;
+}
+
 clang::CompoundStmt *GenerateAST::StructureSwitchRegion(llvm::Region *region) {
-  DLOG(INFO) << "Region " << GetRegionNameStr(region)
-             << " has a switch instruction";
+  RELLIC_LOG(Structuring) << "Region " << GetRegionNameStr(region)
+                          << " has a switch instruction";
   // TODO(frabert): find a way to do this in a refinement pass.
   // See "No More Gotos": Condition-aware refinement
   auto body{CreateBasicBlockStmts(region->getEntry())};
@@ -478,33 +1004,48 @@ clang::CompoundStmt *GenerateAST::StructureSwitchRegion(llvm::Region *region) {
   auto sw_stmt{ast.CreateSwitchStmt(cond)};
   StmtVec sw_body;
 
+  // Cases that jump to the same block share its body, which follows all of
+  // their labels. The default comes first, then the other destinations in the
+  // order of their first case.
+  auto exit{region->getExit()};
   auto default_dest{sw_inst->getDefaultDest()};
-  if (default_dest != region->getExit()) {
-    auto default_body{CreateBasicBlockStmts(default_dest)};
-    sw_body.push_back(
-        ast.CreateDefaultStmt(ast.CreateCompoundStmt(default_body)));
-    sw_body.push_back(ast.CreateBreak());
-  }
-
-  std::vector<llvm::SwitchInst::CaseHandle> cases{sw_inst->case_begin(),
-                                                  sw_inst->case_end()};
-  for (auto i{0U}; i < cases.size(); ++i) {
-    auto sw_case{cases[i]};
-    auto successor{sw_case.getCaseSuccessor()};
-    if (i + 1 < cases.size() && cases[i + 1].getCaseSuccessor() == successor) {
-      continue;
+  std::vector<llvm::BasicBlock *> dests;
+  std::unordered_map<llvm::BasicBlock *, std::vector<llvm::ConstantInt *>>
+      labels;
+  if (default_dest != exit) {
+    dests.push_back(default_dest);
+  }
+  for (auto sw_case : sw_inst->cases()) {
+    auto dest{sw_case.getCaseSuccessor()};
+    auto &values{labels[dest]};
+    if (values.empty() && dest != default_dest) {
+      dests.push_back(dest);
     }
+    values.push_back(sw_case.getCaseValue());
+  }
 
-    auto value{ast_gen.CreateConstantExpr(sw_case.getCaseValue())};
-    auto case_stmt{ast.CreateCaseStmt(value)};
-    if (successor != region->getExit()) {
-      auto case_body{CreateBasicBlockStmts(successor)};
-      case_stmt->setSubStmt(ast.CreateCompoundStmt(case_body));
-      sw_body.push_back(case_stmt);
-      sw_body.push_back(ast.CreateBreak());
+  for (auto dest : dests) {
+    clang::Stmt *stmt{nullptr};
+    if (dest == exit) {
+      stmt = ast.CreateBreak();
+    } else if (auto subregion = GetSubregion(region, dest)) {
+      CHECK(stmt = region_stmts[GetRegionId(subregion)]);
     } else {
-      case_stmt->setSubStmt(ast.CreateBreak());
-      sw_body.push_back(case_stmt);
+      auto case_body{CreateBasicBlockStmts(dest)};
+      stmt = ast.CreateCompoundStmt(case_body);
+    }
+    if (dest == default_dest) {
+      stmt = ast.CreateDefaultStmt(stmt);
+    }
+    auto &values{labels[dest]};
+    for (auto it{values.rbegin()}; it != values.rend(); ++it) {
+      auto case_stmt{ast.CreateCaseStmt(ast_gen.CreateConstantExpr(*it))};
+      case_stmt->setSubStmt(stmt);
+      stmt = case_stmt;
+    }
+    sw_body.push_back(stmt);
+    if (dest != exit) {
+      sw_body.push_back(ast.CreateBreak());
     }
   }
   sw_stmt->setBody(ast.CreateCompoundStmt(sw_body));
@@ -512,21 +1053,113 @@ clang::CompoundStmt *GenerateAST::StructureSwitchRegion(llvm::Region *region) {
   return ast.CreateCompoundStmt(body);
 }
 
+// Whether some edge of `rpo_walk` goes back to a block that does not dominate
+// its source, which makes a cycle that is not a natural loop
+static bool IsIrreducible(const std::vector<llvm::BasicBlock *> &rpo_walk,
+                          llvm::DominatorTree &domtree) {
+  llvm::DenseMap<llvm::BasicBlock *, unsigned> rpo_idx;
+  for (auto i{0U}; i < rpo_walk.size(); ++i) {
+    rpo_idx[rpo_walk[i]] = i;
+  }
+  for (auto block : rpo_walk) {
+    for (auto succ : llvm::successors(block)) {
+      if (rpo_idx[succ] <= rpo_idx[block] && !domtree.dominates(succ, block)) {
+        return true;
+      }
+    }
+  }
+  return false;
+}
+
+const char *GenerateAST::GetGotoFallbackReason() {
+  if (dec_ctx.goto_fallback_blocks &&
+      rpo_walk.size() > dec_ctx.goto_fallback_blocks) {
+    return "too many blocks";
+  }
+  if (dec_ctx.goto_fallback_irreducible && IsIrreducible(rpo_walk, *domtree)) {
+    return "irreducible control flow";
+  }
+  return nullptr;
+}
+
+StmtVec GenerateAST::CreateGotoStmts(clang::FunctionDecl *fdecl) {
+  std::vector<clang::LabelDecl *> labels(rpo_walk.size(), nullptr);
+  llvm::DenseMap<llvm::BasicBlock *, unsigned> layout;
+  for (auto i{0U}; i < rpo_walk.size(); ++i) {
+    layout[rpo_walk[i]] = i;
+  }
+  auto Goto{[&](llvm::BasicBlock *block) {
+    auto idx{layout[block]};
+    auto &label{labels[idx]};
+    if (!label) {
+      label = ast.CreateLabelDecl(fdecl, "L" + std::to_string(idx));
+    }
+    return ast.CreateGoto(label);
+  }};
+
+  std::vector<StmtVec> bodies(rpo_walk.size());
+  for (auto i{0U}; i < rpo_walk.size(); ++i) {
+    auto block{rpo_walk[i]};
+    auto next{i + 1 < rpo_walk.size() ? rpo_walk[i + 1] : nullptr};
+    auto &body{bodies[i]};
+    body = CreateBasicBlockStmts(block);
+    auto term{block->getTerminator()};
+    if (auto br = llvm::dyn_cast<llvm::BranchInst>(term)) {
+      auto succ{br->getSuccessor(0)};
+      if (br->isConditional()) {
+        StmtVec then_body{Goto(succ)};
+        auto if_stmt{ast.CreateIf(dec_ctx.marker_expr,
+                                  ast.CreateCompoundStmt(then_body))};
+        dec_ctx.conds[if_stmt] = GetOrCreateEdgeForBranch(br, true);
+        body.push_back(if_stmt);
+        succ = br->getSuccessor(1);
+      }
+      // Jumps to the next block fall through
+      if (succ != next) {
+        body.push_back(Goto(succ));
+      }
+    } else if (auto sw = llvm::dyn_cast<llvm::SwitchInst>(term)) {
+      auto cond{ast_gen.CreateOperandExpr(sw->getOperandUse(0))};
+      auto sw_stmt{ast.CreateSwitchStmt(cond)};
+      StmtVec sw_body;
+      for (auto sw_case : sw->cases()) {
+        auto value{ast_gen.CreateConstantExpr(sw_case.getCaseValue())};
+        auto case_stmt{ast.CreateCaseStmt(value)};
+        case_stmt->setSubStmt(Goto(sw_case.getCaseSuccessor()));
+        sw_body.push_back(case_stmt);
+      }
+      sw_body.push_back(ast.CreateDefaultStmt(Goto(sw->getDefaultDest())));
+      sw_stmt->setBody(ast.CreateCompoundStmt(sw_body));
+      body.push_back(sw_stmt);
+    }
+  }
+
+  // Labels precede an empty statement rather than the first one of their
+  // block, so that passes are free to replace or delete it
+  StmtVec result;
+  for (auto i{0U}; i < rpo_walk.size(); ++i) {
+    if (labels[i]) {
+      result.push_back(ast.CreateLabelStmt(labels[i], ast.CreateNullStmt()));
+    }
+    result.insert(result.end(), bodies[i].begin(), bodies[i].end());
+  }
+  return result;
+}
+
 clang::CompoundStmt *GenerateAST::StructureRegion(llvm::Region *region) {
-  DLOG(INFO) << "Structuring region " << GetRegionNameStr(region);
-  auto &region_stmt = region_stmts[region];
+  RELLIC_LOG(Structuring) << "Structuring region " << GetRegionNameStr(region);
+  auto &region_stmt = region_stmts[GetRegionId(region)];
   if (region_stmt) {
     LOG(WARNING) << "Asking to re-structure region: "
                  << GetRegionNameStr(region)
                  << "; returning current region instead";
     return region_stmt;
   }
-  bool is_cyclic{loops->isLoopHeader(region->getEntry())};
-  if (llvm::isa<llvm::SwitchInst>(region->getEntry()->getTerminator()) &&
-      !GetSubregion(region, region->getEntry()) && !is_cyclic) {
+  if (IsSwitchRegion(region)) {
     region_stmt = StructureSwitchRegion(region);
     return region_stmt;
   }
+  bool is_cyclic{loops->isLoopHeader(region->getEntry())};
 
   // Structure
   region_stmt = is_cyclic ? StructureCyclicRegion(region)
@@ -539,8 +1172,8 @@ llvm::AnalysisKey GenerateAST::Key;
 GenerateAST::GenerateAST(DecompilationContext &dec_ctx)
     : dec_ctx(dec_ctx), ast(dec_ctx.ast), ast_gen(dec_ctx) {}
 
-GenerateAST::Result GenerateAST::run(llvm::Module &module,
-                                     llvm::ModuleAnalysisManager &MAM) {
+void GenerateAST::CreateDeclarations(llvm::Module &module) {
+  dec_ctx.type_provider->Prefetch(module);
   for (auto &func : module.functions()) {
     ast_gen.VisitFunctionDecl(func);
   }
@@ -548,28 +1181,89 @@ GenerateAST::Result GenerateAST::run(llvm::Module &module,
   for (auto &var : module.globals()) {
     ast_gen.VisitGlobalVar(var);
   }
-
-  return llvm::PreservedAnalyses::all();
 }
 
-GenerateAST::Result GenerateAST::run(llvm::Function &func,
-                                     llvm::FunctionAnalysisManager &FAM) {
-  if (func.isDeclaration()) {
-    return llvm::PreservedAnalyses::all();
+void GenerateAST::CreateReferencedDeclarations(
+    llvm::Module &module, const std::vector<llvm::Function *> &funcs) {
+  dec_ctx.type_provider->Prefetch(module);
+  std::unordered_set<llvm::GlobalValue *> referenced;
+  std::vector<llvm::GlobalValue *> worklist;
+  auto Add{[&](llvm::GlobalValue *gv) {
+    if (referenced.insert(gv).second) {
+      worklist.push_back(gv);
+    }
+  }};
+  std::vector<llvm::Type *> types;
+  std::vector<llvm::GlobalValue *> globals;
+  for (auto func : funcs) {
+    Add(func);
+    if (func->isDeclaration()) {
+      continue;
+    }
+    GetReferencedIR(*func, types, globals);
+    for (auto gv : globals) {
+      Add(gv);
+    }
+  }
+  // Initializers are translated along with the variables they belong to, so
+  // whatever they refer to has to be declared as well
+  while (!worklist.empty()) {
+    auto gv{worklist.back()};
+    worklist.pop_back();
+    llvm::Constant *init{nullptr};
+    if (auto var = llvm::dyn_cast<llvm::GlobalVariable>(gv)) {
+      init = var->hasInitializer() ? var->getInitializer() : nullptr;
+    } else if (auto alias = llvm::dyn_cast<llvm::GlobalAlias>(gv)) {
+      init = alias->getAliasee();
+    }
+    if (!init) {
+      continue;
+    }
+    GetReferencedGlobals(init, globals);
+    for (auto ref : globals) {
+      Add(ref);
+    }
   }
 
-  // Clear the region statements from previous functions
-  region_stmts.clear();
-  // Get dominator tree
-  domtree = &FAM.getResult<llvm::DominatorTreeAnalysis>(func);
+  for (auto &func : module.functions()) {
+    if (referenced.count(&func)) {
+      ast_gen.VisitFunctionDecl(func);
+    }
+  }
+
+  for (auto &var : module.globals()) {
+    if (referenced.count(&var)) {
+      ast_gen.VisitGlobalVar(var);
+    }
+  }
+}
+
+GenerateAST::Result GenerateAST::run(llvm::Module &module,
+                                     llvm::ModuleAnalysisManager &MAM) {
+  CreateDeclarations(module);
+  return llvm::PreservedAnalyses::all();
+}
+
+StmtVec GenerateAST::StructureFunction(llvm::Function &func,
+                                       llvm::FunctionAnalysisManager &FAM,
+                                       FunctionStatistics &stats) {
   // Get single-entry, single-exit regions
   regions = &FAM.getResult<llvm::RegionInfoAnalysis>(func);
   // Get loops
   loops = &FAM.getResult<llvm::LoopAnalysis>(func);
-  // Get a reverse post-order walk for iterating over region blocks in
-  // structurization
-  llvm::ReversePostOrderTraversal<llvm::Function *> rpo(&func);
-  rpo_walk.assign(rpo.begin(), rpo.end());
+  func_blocks.clear();
+  block_ids.clear();
+  for (auto &block : func) {
+    block_ids[&block] = func_blocks.size();
+    func_blocks.push_back(&block);
+  }
+  dec_ctx.reaching_conds.assign(func_blocks.size(), poison_idx);
+  relative_conds.assign(func_blocks.size(), poison_idx);
+  reused_conds.clear();
+  reused_conds.resize(func_blocks.size());
+  block_stmts.assign(func_blocks.size(), nullptr);
+  CollectRegionBlocks();
+  CollectSwitchJoins();
   // Computing reaching conditions is necessary in some cyclic regions:
   //
   //          %0
@@ -598,24 +1292,83 @@ GenerateAST::Result GenerateAST::run(llvm::Function &func,
   // reaching conditions are memoized, or `false` if not yet computed.
   // Unfortunately, this means that a single pass of computation might not
   // produce complete reaching conditions.
-  do {
-    reaching_conds_changed = false;
-    for (auto block : rpo_walk) {
-      CreateReachingCond(block);
-    }
-  } while (reaching_conds_changed);
-  // Recursively walk regions in post-order and structure
-  std::function<void(llvm::Region *)> POWalkSubRegions;
-  POWalkSubRegions = [&](llvm::Region *region) {
-    for (auto &subregion : *region) {
-      POWalkSubRegions(&*subregion);
+  {
+    llvm::TimeTraceScope trace("CreateReachingConds");
+    ScopedTimer timer(stats.reaching_conds_time);
+    simplifications = &stats.reaching_cond_simplifications;
+    auto reuse{dec_ctx.reuse_region_conds && dec_ctx.dominator_reaching_conds};
+    if (reuse) {
+      ReuseRegionConds();
+    }
+    stats.reaching_cond_evaluations += CreateReachingConds();
+    stats.reaching_cond_skipped_blocks += skipped_blocks;
+    if (reuse && !out_of_budget) {
+      RecordRegionConds();
+    }
+  }
+  if (out_of_budget) {
+    return {};
+  }
+  ScopedTimer timer(stats.structuring_time);
+  // Walk regions in post-order and structure. The walk keeps its own stack,
+  // since region trees of generated code can be nested deeper than the call
+  // stack allows.
+  std::vector<std::pair<llvm::Region *, llvm::Region::iterator>> walk;
+  auto top{regions->getTopLevelRegion()};
+  walk.emplace_back(top, top->begin());
+  while (!walk.empty()) {
+    auto [region, next] = walk.back();
+    if (next != region->end()) {
+      ++walk.back().second;
+      auto subregion{next->get()};
+      walk.emplace_back(subregion, subregion->begin());
+      continue;
     }
     StructureRegion(region);
-  };
-  // Call the above declared bad boy
-  POWalkSubRegions(regions->getTopLevelRegion());
+    walk.pop_back();
+  }
+  auto body{region_stmts[GetRegionId(top)]->body()};
+  return StmtVec(body.begin(), body.end());
+}
+
+GenerateAST::Result GenerateAST::run(llvm::Function &func,
+                                     llvm::FunctionAnalysisManager &FAM) {
+  if (func.isDeclaration()) {
+    return llvm::PreservedAnalyses::all();
+  }
+
+  llvm::TimeTraceScope trace("GenerateAST", func.getName());
+  ActivityScope activity("structuring", func.getName());
+  // Clear the region statements from previous functions
+  region_stmts.clear();
+  // Get dominator tree
+  domtree = &FAM.getResult<llvm::DominatorTreeAnalysis>(func);
+  // Get a reverse post-order walk for iterating over region blocks in
+  // structurization
+  llvm::ReversePostOrderTraversal<llvm::Function *> rpo(&func);
+  rpo_walk.assign(rpo.begin(), rpo.end());
+  auto &stats{dec_ctx.stats.functions[func.getName().str()]};
+  ScopedCounters counters(stats.counters);
+  stats.num_blocks += rpo_walk.size();
+  dec_ctx.structuring_function = &func;
   // Get the function declaration AST node for `func`
   auto fdecl = clang::cast<clang::FunctionDecl>(dec_ctx.value_decls[&func]);
+  StmtVec body;
+  auto fallback{GetGotoFallbackReason()};
+  if (!fallback) {
+    body = StructureFunction(func, FAM, stats);
+    if (out_of_budget) {
+      fallback = "structuring budget exceeded";
+    }
+  }
+  if (fallback) {
+    LOG(WARNING) << "Function " << func.getName().str()
+                 << " is emitted with gotos: " << fallback;
+    ++dec_ctx.stats.goto_fallbacks;
+    ScopedTimer timer(stats.structuring_time);
+    body = CreateGotoStmts(fdecl);
+  }
+  dec_ctx.structuring_function = nullptr;
   // Create a redeclaration of `fdecl` that will serve as a definition
   auto tudecl = dec_ctx.ast_ctx.getTranslationUnitDecl();
   auto fdefn =
@@ -633,33 +1386,205 @@ GenerateAST::Result GenerateAST::run(llvm::Function &func,
       fbody.push_back(ast.CreateDeclStmt(decl));
     }
   }
-  // Add statements of the top-level region compound
-  for (auto stmt : region_stmts[regions->getTopLevelRegion()]->body()) {
-    fbody.push_back(stmt);
-  }
+  fbody.insert(fbody.end(), body.begin(), body.end());
   // Set body to a new compound
   fdefn->setBody(ast.CreateCompoundStmt(fbody));
+  // Functions emitted with gotos are not worth refining
+  if (fallback) {
+    dec_ctx.degraded_functions.insert(fdefn);
+  }
+  // Drop the structuring state of `func`, which is not needed for the next
+  // one. Only `conds` and the provenance maps are used after this point.
+  dec_ctx.reaching_conds.clear();
+  dec_ctx.z3_edges.clear();
+  dec_ctx.z3_br_edges.clear();
+  dec_ctx.z3_sw_vars.clear();
+  dec_ctx.z3_sw_edges.clear();
+  for (auto &block : func) {
+    dec_ctx.outgoing_uses.erase(&block);
+  }
+  block_stmts.clear();
+  region_stmts.clear();
+  region_blocks.clear();
+  func_regions.clear();
+  region_ids.clear();
+  relative_conds.clear();
+  reused_conds.clear();
+  switch_joins.clear();
+  out_of_budget = false;
+  rpo_walk.clear();
+  func_blocks.clear();
+  block_ids.clear();
+  block_regions.clear();
+  entered_regions.clear();
+  domtree = nullptr;
+  regions = nullptr;
+  loops = nullptr;
 
   return llvm::PreservedAnalyses::all();
 }
 
 void GenerateAST::run(llvm::Module &module, DecompilationContext &dec_ctx) {
-  llvm::ModulePassManager mpm;
-  llvm::ModuleAnalysisManager mam;
-  llvm::PassBuilder pb;
-  mam.registerPass([&] { return rellic::GenerateAST(dec_ctx); });
-  mpm.addPass(rellic::GenerateAST(dec_ctx));
-  pb.registerModuleAnalyses(mam);
-  mpm.run(module, mam);
-
-  llvm::FunctionPassManager fpm;
-  llvm::FunctionAnalysisManager fam;
-  fam.registerPass([&] { return rellic::GenerateAST(dec_ctx); });
-  fpm.addPass(rellic::GenerateAST(dec_ctx));
-  pb.registerFunctionAnalyses(fam);
+  std::vector<llvm::Function *> funcs;
   for (auto &func : module.functions()) {
-    fpm.run(func, fam);
+    funcs.push_back(&func);
   }
+  run(module, funcs, dec_ctx);
+}
+
+void GenerateAST::generateReferenced(llvm::Module &module,
+                                     const std::vector<llvm::Function *> &funcs,
+                                     DecompilationContext &dec_ctx) {
+  llvm::FunctionAnalysisManager fam;
+  RegisterAnalyses(fam);
+  GenerateAST gen(dec_ctx);
+  gen.CreateReferencedDeclarations(module, funcs);
+  gen.GenerateBodies(funcs, fam);
+}
+
+void GenerateAST::DeclareTypes(const std::vector<llvm::Function *> &funcs,
+                               DecompilationContext &dec_ctx) {
+  llvm::TimeTraceScope trace("GenerateAST::DeclareTypes");
+  std::vector<llvm::Type *> types;
+  std::vector<llvm::GlobalValue *> globals;
+  for (auto func : funcs) {
+    if (func->isDeclaration()) {
+      continue;
+    }
+    GetReferencedIR(*func, types, globals);
+    for (auto type : types) {
+      auto strct{llvm::dyn_cast<llvm::StructType>(type)};
+      if (strct && !strct->isOpaque()) {
+        dec_ctx.GetQualType(strct);
+      }
+    }
+  }
+}
+
+void GenerateAST::RegisterAnalyses(llvm::FunctionAnalysisManager &fam) {
+  fam.registerPass([] { return llvm::PassInstrumentationAnalysis(); });
+  fam.registerPass([] { return llvm::DominatorTreeAnalysis(); });
+  fam.registerPass([] { return llvm::PostDominatorTreeAnalysis(); });
+  fam.registerPass([] { return llvm::DominanceFrontierAnalysis(); });
+  fam.registerPass([] { return llvm::RegionInfoAnalysis(); });
+  fam.registerPass([] { return llvm::LoopAnalysis(); });
+}
+
+void GenerateAST::run(llvm::Module &module,
+                      const std::vector<llvm::Function *> &funcs,
+                      DecompilationContext &dec_ctx) {
+  llvm::FunctionAnalysisManager fam;
+  RegisterAnalyses(fam);
+  run(module, funcs, dec_ctx, fam);
+}
+
+void GenerateAST::run(llvm::Module &module,
+                      const std::vector<llvm::Function *> &funcs,
+                      DecompilationContext &dec_ctx,
+                      llvm::FunctionAnalysisManager &fam) {
+  GenerateAST gen(dec_ctx);
+  gen.CreateDeclarations(module);
+  gen.GenerateBodies(funcs, fam);
+}
+
+void GenerateAST::GenerateBodies(const std::vector<llvm::Function *> &funcs,
+                                 llvm::FunctionAnalysisManager &fam) {
+  DeclareTypes(funcs, dec_ctx);
+
+  auto progress{dec_ctx.progress};
+  if (progress) {
+    progress->stage = "GenerateAST";
+    for (auto func : funcs) {
+      progress->functions_total += !func->isDeclaration();
+    }
+  }
+  for (auto func : funcs) {
+    if (dec_ctx.Cancelled()) {
+      break;
+    }
+    run(*func, fam);
+    // Dominator trees, regions and loops are only needed while structuring
+    fam.clear(*func, func->getName());
+    if (progress && !func->isDeclaration()) {
+      ++progress->functions_generated;
+      progress->Update();
+    }
+  }
+}
+
+template <typename TMap, typename TPred>
+static void EraseIf(TMap &map, TPred pred) {
+  for (auto it{map.begin()}; it != map.end();) {
+    if (pred(*it)) {
+      it = map.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void GenerateAST::regenerate(llvm::Module &module,
+                             const std::vector<llvm::Function *> &funcs,
+                             DecompilationContext &dec_ctx) {
+  llvm::TimeTraceScope trace("GenerateAST::regenerate");
+  auto tudecl{dec_ctx.ast_ctx.getTranslationUnitDecl()};
+
+  std::unordered_set<clang::Decl *> removed;
+  std::unordered_set<llvm::Function *> changed{funcs.begin(), funcs.end()};
+  for (auto func : funcs) {
+    dec_ctx.stats.functions.erase(func->getName().str());
+    auto decl{dec_ctx.value_decls[func]};
+    if (!decl) {
+      continue;
+    }
+    for (auto redecl : clang::cast<clang::FunctionDecl>(decl)->redecls()) {
+      removed.insert(redecl);
+      dec_ctx.degraded_functions.erase(redecl);
+      dec_ctx.function_time.erase(redecl);
+    }
+  }
+  for (auto decl : removed) {
+    tudecl->removeDecl(decl);
+  }
+
+  // Parameters and locals are not reused: they are created again along with
+  // the new prototype
+  EraseIf(dec_ctx.value_decls, [&](auto &entry) {
+    auto decl{entry.second};
+    return decl && (removed.count(decl) ||
+                    removed.count(clang::cast<clang::Decl>(
+                        decl->getDeclContext())));
+  });
+  EraseIf(dec_ctx.temp_decls, [&](auto &entry) {
+    return changed.count(entry.first->getParent());
+  });
+
+  // Blocks and instructions may have been freed by the changes to the IR, and
+  // their addresses reused, so the memoized conditions of every block and edge
+  // are discarded. They are only needed while structuring, which is done for
+  // the other functions. The inverse maps are kept, since they are used to
+  // materialize conditions that are still pending in the other functions.
+  dec_ctx.reaching_conds.clear();
+  dec_ctx.outgoing_uses.clear();
+  dec_ctx.z3_edges.clear();
+  dec_ctx.z3_br_edges.clear();
+  dec_ctx.z3_sw_vars.clear();
+  dec_ctx.z3_sw_edges.clear();
+  // The same goes for the functions and arguments that providers were asked
+  // about
+  dec_ctx.type_provider->ClearCache();
+
+  // Statements that are no longer part of the translation unit may refer to
+  // values that have been freed, so only the live ones are kept
+  auto live{GetReachableStmts(dec_ctx.ast_ctx)};
+  EraseIf(dec_ctx.stmt_provenance,
+          [&](auto &entry) { return !live.count(entry.first); });
+  EraseIf(dec_ctx.use_provenance,
+          [&](auto &entry) { return !live.count(entry.first); });
+  EraseIf(dec_ctx.conds,
+          [&](auto &entry) { return !live.count(entry.first); });
+
+  run(module, funcs, dec_ctx);
 }
 
 }  // namespace rellic
@@ -7,6 +7,8 @@
  */
 
 #include <clang/Basic/Builtins.h>
+#include <clang/Basic/TargetInfo.h>
+#include <llvm/ADT/StringSet.h>
 #include <llvm/IR/InstIterator.h>
 #include <llvm/IR/Instructions.h>
 #include <llvm/IR/IntrinsicInst.h>
@@ -17,12 +19,18 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <algorithm>
 #include <iterator>
+#include <limits>
+#include <mutex>
+#include <utility>
 
 #include "rellic/AST/IRToASTVisitor.h"
+#include "rellic/AST/DebugInfoCollector.h"
 #include "rellic/AST/TypeProvider.h"
 #include "rellic/BC/Util.h"
 #include "rellic/Exception.h"
+#include "rellic/Log.h"
 
 namespace rellic {
 class ExprGen : public llvm::InstVisitor<ExprGen, clang::Expr *> {
@@ -41,6 +49,7 @@ class ExprGen : public llvm::InstVisitor<ExprGen, clang::Expr *> {
 
   clang::Expr *CreateConstantExpr(llvm::Constant *constant);
   clang::Expr *CreateLiteralExpr(llvm::Constant *constant);
+  bool IsWideString(llvm::Constant *constant);
   clang::Expr *CreateOperandExpr(llvm::Use &val);
 
   clang::Expr *visitMemCpyInst(llvm::MemCpyInst &inst);
@@ -62,36 +71,131 @@ class ExprGen : public llvm::InstVisitor<ExprGen, clang::Expr *> {
 };
 
 clang::Expr *IRToASTVisitor::ConvertExpr(z3::expr expr) {
-  if (expr.decl().decl_kind() == Z3_OP_EQ) {
-    // Equalities generated form the reaching conditions of switch instructions
-    // Always in the for (VAR == CONST) or (CONST == VAR)
-    // VAR will uniquely identify a SwitchInst, CONST will represent the index
-    // of the case taken
-    CHECK_EQ(expr.num_args(), 2) << "Equalities must have 2 arguments";
-    auto a{expr.arg(0)};
-    auto b{expr.arg(1)};
-
-    llvm::SwitchInst *inst{dec_ctx.z3_sw_vars_inv[a.id()]};
-    unsigned case_idx{};
-
-    // GenerateAST always generates equalities in the form (VAR == CONST), but
-    // there is a chance that some Z3 simplification inverts the order, so
-    // handle that here.
-    if (!inst) {
-      inst = dec_ctx.z3_sw_vars_inv[b.id()];
-      case_idx = a.get_numeral_uint();
-    } else {
-      case_idx = b.get_numeral_uint();
+  switch (expr.decl().decl_kind()) {
+    case Z3_OP_TRUE:
+    case Z3_OP_FALSE:
+      return TranslateExpr(expr);
+    default:
+      break;
+  }
+
+  // Clang nodes cannot appear twice in the tree, so a subformula that is
+  // shared between conditions is cloned, which is cheaper than translating
+  // the IR it refers to again.
+  auto it{converted.find(expr.id())};
+  if (it != converted.end()) {
+    return Clone(dec_ctx.ast_unit, it->second, dec_ctx.use_provenance);
+  }
+
+  auto res{TranslateExpr(expr)};
+  converted[expr.id()] = res;
+  converted_keys.push_back(expr);
+  return res;
+}
+
+void IRToASTVisitor::ClearConvertedExprs() {
+  converted.clear();
+  converted_keys.resize(0);
+}
+
+// Translates a comparison between the variable of a switch and a constant, as
+// made by `GenerateAST::GetOrCreateEdgeForSwitch` and possibly rearranged by
+// Z3. The variable is the index of the case that is taken, and any index from
+// the number of cases up means the default. Returns null if `expr` is not
+// such a comparison.
+clang::Expr *IRToASTVisitor::TranslateSwitchCond(z3::expr expr) {
+  auto kind{expr.decl().decl_kind()};
+  if (expr.num_args() != 2 ||
+      (kind != Z3_OP_EQ && kind != Z3_OP_LE && kind != Z3_OP_LT &&
+       kind != Z3_OP_GE && kind != Z3_OP_GT)) {
+    return nullptr;
+  }
+
+  auto var{expr.arg(0)};
+  auto bound_expr{expr.arg(1)};
+  auto it{dec_ctx.z3_sw_vars_inv.find(var.id())};
+  if (it == dec_ctx.z3_sw_vars_inv.end()) {
+    // Z3 may put the constant first, in which case the comparison is flipped
+    std::swap(var, bound_expr);
+    it = dec_ctx.z3_sw_vars_inv.find(var.id());
+    if (it == dec_ctx.z3_sw_vars_inv.end()) {
+      return nullptr;
     }
+    switch (kind) {
+      case Z3_OP_LE:
+        kind = Z3_OP_GE;
+        break;
+      case Z3_OP_LT:
+        kind = Z3_OP_GT;
+        break;
+      case Z3_OP_GE:
+        kind = Z3_OP_LE;
+        break;
+      case Z3_OP_GT:
+        kind = Z3_OP_LT;
+        break;
+      default:
+        break;
+    }
+  }
+  auto inst{it->second};
+  int64_t bound{};
+  CHECK(bound_expr.is_numeral_i64(bound))
+      << "Switch variables must be compared to constants";
+
+  // Indices in `[first, last]` satisfy the comparison
+  int64_t num_cases{inst->getNumCases()};
+  auto first{std::numeric_limits<int64_t>::min()};
+  auto last{std::numeric_limits<int64_t>::max()};
+  switch (kind) {
+    case Z3_OP_EQ:
+      first = last = bound;
+      break;
+    case Z3_OP_LE:
+      last = bound;
+      break;
+    case Z3_OP_LT:
+      last = bound - 1;
+      break;
+    case Z3_OP_GE:
+      first = bound;
+      break;
+    case Z3_OP_GT:
+      first = bound + 1;
+      break;
+    default:
+      break;
+  }
 
-    for (auto sw_case : inst->cases()) {
-      if (sw_case.getCaseIndex() == case_idx) {
-        return ast.CreateEQ(CreateOperandExpr(inst->getOperandUse(0)),
-                            CreateConstantExpr(sw_case.getCaseValue()));
-      }
+  // Case values are distinct, so the default is taken exactly when no case
+  // is. If it satisfies the comparison, the cases below `first` are excluded,
+  // otherwise the ones in `[first, last]` are included.
+  auto is_default{first <= num_cases && num_cases <= last};
+  auto begin{is_default ? 0 : std::max<int64_t>(first, 0)};
+  auto end{is_default ? std::min(first, num_cases)
+                      : std::min(last, num_cases - 1) + 1};
+  clang::Expr *res{nullptr};
+  for (auto i{begin}; i < end; ++i) {
+    // Clang nodes cannot be shared, so the operand is translated every time
+    auto operand{CreateOperandExpr(inst->getOperandUse(0))};
+    auto value{CreateConstantExpr((inst->case_begin() + i)->getCaseValue())};
+    if (is_default) {
+      auto cmp{ast.CreateNE(operand, value)};
+      res = res ? ast.CreateLAnd(res, cmp) : cmp;
+    } else {
+      auto cmp{ast.CreateEQ(operand, value)};
+      res = res ? ast.CreateLOr(res, cmp) : cmp;
     }
+  }
+  if (!res) {
+    return is_default ? ast.CreateTrue() : ast.CreateFalse();
+  }
+  return res;
+}
 
-    LOG(FATAL) << "Couldn't find switch case";
+clang::Expr *IRToASTVisitor::TranslateExpr(z3::expr expr) {
+  if (auto sw_cond = TranslateSwitchCond(expr)) {
+    return sw_cond;
   }
 
   auto hash{expr.id()};
@@ -154,7 +258,7 @@ clang::Expr *IRToASTVisitor::ConvertExpr(z3::expr expr) {
 }
 
 void ExprGen::VisitGlobalVar(llvm::GlobalVariable &gvar) {
-  DLOG(INFO) << "VisitGlobalVar: " << LLVMThingToString(&gvar);
+  RELLIC_LOG(IRGen) << "VisitGlobalVar: " << LLVMThingToString(&gvar);
   auto &var{dec_ctx.value_decls[&gvar]};
   if (var) {
     return;
@@ -163,7 +267,7 @@ void ExprGen::VisitGlobalVar(llvm::GlobalVariable &gvar) {
   clang::Expr *init{nullptr};
 
   if (IsGlobalMetadata(gvar)) {
-    DLOG(INFO) << "Skipping global variable only used for metadata";
+    RELLIC_LOG(IRGen) << "Skipping global variable only used for metadata";
     return;
   }
 
@@ -219,6 +323,11 @@ static bool IsGVarAString(llvm::GlobalVariable *gvar) {
   return true;
 }
 
+// Materializing a `ConstantExpr` as an instruction temporarily adds uses to
+// its operands. Use lists are not thread-safe, so this must be serialized when
+// functions are being decompiled concurrently.
+static std::mutex cexpr_mutex;
+
 clang::Expr *ExprGen::CreateConstantExpr(llvm::Constant *constant) {
   if (auto gvar = llvm::dyn_cast<llvm::GlobalVariable>(constant)) {
     if (IsGVarAString(gvar)) {
@@ -229,10 +338,17 @@ clang::Expr *ExprGen::CreateConstantExpr(llvm::Constant *constant) {
   }
 
   if (auto cexpr = llvm::dyn_cast<llvm::ConstantExpr>(constant)) {
-    auto inst{cexpr->getAsInstruction()};
+    llvm::Instruction *inst;
+    {
+      std::lock_guard<std::mutex> lock(cexpr_mutex);
+      inst = cexpr->getAsInstruction();
+    }
     auto expr{visit(inst)};
     dec_ctx.use_provenance.erase(expr);
-    inst->deleteValue();
+    {
+      std::lock_guard<std::mutex> lock(cexpr_mutex);
+      inst->deleteValue();
+    }
     return expr;
   } else if (auto alias = llvm::dyn_cast<llvm::GlobalAlias>(constant)) {
     return CreateConstantExpr(alias->getAliasee());
@@ -244,8 +360,37 @@ clang::Expr *ExprGen::CreateConstantExpr(llvm::Constant *constant) {
   return CreateLiteralExpr(constant);
 }
 
+// Whether `constant` is a large enough array of integers whose C type is that
+// of the code units of `u""` or `U""` literals. Literals can only be printed
+// if every element is a code point other than a surrogate.
+bool ExprGen::IsWideString(llvm::Constant *constant) {
+  auto arr{llvm::dyn_cast<llvm::ConstantDataArray>(constant)};
+  if (!dec_ctx.wide_string_threshold || !arr ||
+      arr->getNumElements() < dec_ctx.wide_string_threshold) {
+    return false;
+  }
+  auto elm_type{arr->getElementType()};
+  if (!elm_type->isIntegerTy(16U) && !elm_type->isIntegerTy(32U)) {
+    return false;
+  }
+  auto &target{ast_ctx.getTargetInfo()};
+  auto c_type{dec_ctx.GetQualType(elm_type)};
+  if (c_type != ast_ctx.getFromTargetType(target.getChar16Type()) &&
+      c_type != ast_ctx.getFromTargetType(target.getChar32Type())) {
+    return false;
+  }
+  for (auto i{0U}; i < arr->getNumElements(); ++i) {
+    auto elm{arr->getElementAsInteger(i)};
+    if (elm > 0x10ffff || (elm >= 0xd800 && elm <= 0xdfff)) {
+      return false;
+    }
+  }
+  return true;
+}
+
 clang::Expr *ExprGen::CreateLiteralExpr(llvm::Constant *constant) {
-  DLOG(INFO) << "Creating literal Expr for " << LLVMThingToString(constant);
+  RELLIC_LOG(IRGen) << "Creating literal Expr for "
+                    << LLVMThingToString(constant);
 
   clang::Expr *result{nullptr};
 
@@ -301,6 +446,10 @@ clang::Expr *ExprGen::CreateLiteralExpr(llvm::Constant *constant) {
           init = arr->getAsString().str();
         }
         result = ast.CreateStrLit(init);
+      } else if (IsWideString(constant)) {
+        auto arr{llvm::cast<llvm::ConstantDataArray>(constant)};
+        result = ast.CreateWideStrLit(dec_ctx.GetQualType(elm_type),
+                                      arr->getRawDataValues());
       } else {
         result = CreateInitListLiteral();
       }
@@ -329,7 +478,7 @@ clang::Expr *ExprGen::CreateLiteralExpr(llvm::Constant *constant) {
   }
 
 clang::Expr *ExprGen::CreateOperandExpr(llvm::Use &val) {
-  DLOG(INFO) << "Getting Expr for " << LLVMThingToString(val);
+  RELLIC_LOG(IRGen) << "Getting Expr for " << LLVMThingToString(val);
   auto CreateRef{[this, &val] {
     auto decl{dec_ctx.value_decls[val]};
     auto ref{ast.CreateDeclRef(decl)};
@@ -399,7 +548,7 @@ clang::Expr *ExprGen::CreateOperandExpr(llvm::Use &val) {
 }
 
 clang::Expr *ExprGen::visitMemCpyInst(llvm::MemCpyInst &inst) {
-  DLOG(INFO) << "visitMemCpyInst: " << LLVMThingToString(&inst);
+  RELLIC_LOG(IRGen) << "visitMemCpyInst: " << LLVMThingToString(&inst);
 
   std::vector<clang::Expr *> args;
   for (auto i{0U}; i < 3; ++i) {
@@ -411,7 +560,7 @@ clang::Expr *ExprGen::visitMemCpyInst(llvm::MemCpyInst &inst) {
 }
 
 clang::Expr *ExprGen::visitMemCpyInlineInst(llvm::MemCpyInlineInst &inst) {
-  DLOG(INFO) << "visitMemCpyInlineInst: " << LLVMThingToString(&inst);
+  RELLIC_LOG(IRGen) << "visitMemCpyInlineInst: " << LLVMThingToString(&inst);
 
   std::vector<clang::Expr *> args;
   for (auto i{0U}; i < 3; ++i) {
@@ -423,7 +572,7 @@ clang::Expr *ExprGen::visitMemCpyInlineInst(llvm::MemCpyInlineInst &inst) {
 }
 
 clang::Expr *ExprGen::visitAnyMemMoveInst(llvm::AnyMemMoveInst &inst) {
-  DLOG(INFO) << "visitAnyMemMoveInst: " << LLVMThingToString(&inst);
+  RELLIC_LOG(IRGen) << "visitAnyMemMoveInst: " << LLVMThingToString(&inst);
 
   std::vector<clang::Expr *> args;
   for (auto i{0U}; i < 3; ++i) {
@@ -435,7 +584,7 @@ clang::Expr *ExprGen::visitAnyMemMoveInst(llvm::AnyMemMoveInst &inst) {
 }
 
 clang::Expr *ExprGen::visitAnyMemSetInst(llvm::AnyMemSetInst &inst) {
-  DLOG(INFO) << "visitAnyMemSetInst: " << LLVMThingToString(&inst);
+  RELLIC_LOG(IRGen) << "visitAnyMemSetInst: " << LLVMThingToString(&inst);
 
   std::vector<clang::Expr *> args;
   for (auto i{0U}; i < 3; ++i) {
@@ -447,7 +596,7 @@ clang::Expr *ExprGen::visitAnyMemSetInst(llvm::AnyMemSetInst &inst) {
 }
 
 clang::Expr *ExprGen::visitIntrinsicInst(llvm::IntrinsicInst &inst) {
-  DLOG(INFO) << "visitIntrinsicInst: " << LLVMThingToString(&inst);
+  RELLIC_LOG(IRGen) << "visitIntrinsicInst: " << LLVMThingToString(&inst);
 
   // NOTE(artem): As of this writing, rellic does not do anything
   // with debug intrinsics and debug metadata. Processing them to C
@@ -456,7 +605,7 @@ clang::Expr *ExprGen::visitIntrinsicInst(llvm::IntrinsicInst &inst) {
   // low-priority on the "to fix" list
 
   if (llvm::isDbgInfoIntrinsic(inst.getIntrinsicID())) {
-    DLOG(INFO) << "Skipping debug data intrinsic";
+    RELLIC_LOG(IRGen) << "Skipping debug data intrinsic";
     return nullptr;
   }
 
@@ -464,7 +613,7 @@ clang::Expr *ExprGen::visitIntrinsicInst(llvm::IntrinsicInst &inst) {
     // Some of this overlaps with the debug data case above.
     // This is fine. We want debug data special cased as we know it is present
     // and we may make use of it earlier than other annotations
-    DLOG(INFO) << "Skipping non-debug annotation";
+    RELLIC_LOG(IRGen) << "Skipping non-debug annotation";
     return nullptr;
   }
 
@@ -473,7 +622,7 @@ clang::Expr *ExprGen::visitIntrinsicInst(llvm::IntrinsicInst &inst) {
 }
 
 clang::Expr *ExprGen::visitCallInst(llvm::CallInst &inst) {
-  DLOG(INFO) << "visitCallInst: " << LLVMThingToString(&inst);
+  RELLIC_LOG(IRGen) << "visitCallInst: " << LLVMThingToString(&inst);
 
   std::vector<clang::Expr *> args;
   for (auto i{0U}; i < inst.arg_size(); ++i) {
@@ -518,7 +667,7 @@ clang::Expr *ExprGen::visitCallInst(llvm::CallInst &inst) {
 }
 
 clang::Expr *ExprGen::visitGetElementPtrInst(llvm::GetElementPtrInst &inst) {
-  DLOG(INFO) << "visitGetElementPtrInst: " << LLVMThingToString(&inst);
+  RELLIC_LOG(IRGen) << "visitGetElementPtrInst: " << LLVMThingToString(&inst);
 
   auto indexed_type{inst.getPointerOperandType()};
   auto &ptr_opnd{inst.getOperandUse(inst.getPointerOperandIndex())};
@@ -620,7 +769,7 @@ clang::Expr *ExprGen::visitInstruction(llvm::Instruction &inst) {
 }
 
 clang::Expr *ExprGen::visitExtractValueInst(llvm::ExtractValueInst &inst) {
-  DLOG(INFO) << "visitExtractValueInst: " << LLVMThingToString(&inst);
+  RELLIC_LOG(IRGen) << "visitExtractValueInst: " << LLVMThingToString(&inst);
 
   auto base{CreateOperandExpr(inst.getOperandUse(0))};
   auto indexed_type{inst.getAggregateOperand()->getType()};
@@ -662,7 +811,7 @@ clang::Expr *ExprGen::visitExtractValueInst(llvm::ExtractValueInst &inst) {
 }
 
 clang::Expr *ExprGen::visitLoadInst(llvm::LoadInst &inst) {
-  DLOG(INFO) << "visitLoadInst: " << LLVMThingToString(&inst);
+  RELLIC_LOG(IRGen) << "visitLoadInst: " << LLVMThingToString(&inst);
   auto ptr_type{ast_ctx.getPointerType(dec_ctx.GetQualType(inst.getType()))};
   auto cast{
       ast.CreateCStyleCast(ptr_type, CreateOperandExpr(inst.getOperandUse(0)))};
@@ -670,7 +819,7 @@ clang::Expr *ExprGen::visitLoadInst(llvm::LoadInst &inst) {
 }
 
 clang::Expr *ExprGen::visitBinaryOperator(llvm::BinaryOperator &inst) {
-  DLOG(INFO) << "visitBinaryOperator: " << LLVMThingToString(&inst);
+  RELLIC_LOG(IRGen) << "visitBinaryOperator: " << LLVMThingToString(&inst);
   // Get operands
   auto lhs{CreateOperandExpr(inst.getOperandUse(0))};
   auto rhs{CreateOperandExpr(inst.getOperandUse(1))};
@@ -752,7 +901,7 @@ clang::Expr *ExprGen::visitBinaryOperator(llvm::BinaryOperator &inst) {
 }
 
 clang::Expr *ExprGen::visitCmpInst(llvm::CmpInst &inst) {
-  DLOG(INFO) << "visitCmpInst: " << LLVMThingToString(&inst);
+  RELLIC_LOG(IRGen) << "visitCmpInst: " << LLVMThingToString(&inst);
   // Get operands
   auto lhs{CreateOperandExpr(inst.getOperandUse(0))};
   auto rhs{CreateOperandExpr(inst.getOperandUse(1))};
@@ -864,7 +1013,7 @@ clang::Expr *ExprGen::visitCmpInst(llvm::CmpInst &inst) {
 }
 
 clang::Expr *ExprGen::visitCastInst(llvm::CastInst &inst) {
-  DLOG(INFO) << "visitCastInst: " << LLVMThingToString(&inst);
+  RELLIC_LOG(IRGen) << "visitCastInst: " << LLVMThingToString(&inst);
   // There should always be an operand with a cast instruction
   // Get a C-language expression of the operand
   auto operand{CreateOperandExpr(inst.getOperandUse(0))};
@@ -918,7 +1067,7 @@ clang::Expr *ExprGen::visitCastInst(llvm::CastInst &inst) {
 }
 
 clang::Expr *ExprGen::visitSelectInst(llvm::SelectInst &inst) {
-  DLOG(INFO) << "visitSelectInst: " << LLVMThingToString(&inst);
+  RELLIC_LOG(IRGen) << "visitSelectInst: " << LLVMThingToString(&inst);
 
   auto cond{CreateOperandExpr(inst.getOperandUse(0))};
   auto tval{CreateOperandExpr(inst.getOperandUse(1))};
@@ -928,13 +1077,13 @@ clang::Expr *ExprGen::visitSelectInst(llvm::SelectInst &inst) {
 }
 
 clang::Expr *ExprGen::visitFreezeInst(llvm::FreezeInst &inst) {
-  DLOG(INFO) << "visitFreezeInst: " << LLVMThingToString(&inst);
+  RELLIC_LOG(IRGen) << "visitFreezeInst: " << LLVMThingToString(&inst);
 
   return CreateOperandExpr(inst.getOperandUse(0));
 }
 
 clang::Expr *ExprGen::visitUnaryOperator(llvm::UnaryOperator &inst) {
-  DLOG(INFO) << "visitUnaryOperator: " << LLVMThingToString(&inst);
+  RELLIC_LOG(IRGen) << "visitUnaryOperator: " << LLVMThingToString(&inst);
 
   THROW_IF(inst.getOpcode() != llvm::UnaryOperator::FNeg)
       << "Unsupported UnaryOperator: " << LLVMThingToString(&inst);
@@ -979,7 +1128,7 @@ class StmtGen : public llvm::InstVisitor<StmtGen, clang::Stmt *> {
 };
 
 clang::Stmt *StmtGen::visitStoreInst(llvm::StoreInst &inst) {
-  DLOG(INFO) << "visitStoreInst: " << LLVMThingToString(&inst);
+  RELLIC_LOG(IRGen) << "visitStoreInst: " << LLVMThingToString(&inst);
   // Get the operand we're assigning from
   auto &value_opnd{inst.getOperandUse(0)};
   // Stores in LLVM IR correspond to value assignments in C
@@ -990,7 +1139,7 @@ clang::Stmt *StmtGen::visitStoreInst(llvm::StoreInst &inst) {
       ptr_type, expr_gen.CreateOperandExpr(
                     inst.getOperandUse(inst.getPointerOperandIndex())))};
   if (auto undef = llvm::dyn_cast<llvm::UndefValue>(value_opnd)) {
-    DLOG(INFO) << "Invalid store ignored: " << LLVMThingToString(&inst);
+    RELLIC_LOG(IRGen) << "Invalid store ignored: " << LLVMThingToString(&inst);
     return nullptr;
   }
   auto rhs{expr_gen.CreateOperandExpr(value_opnd)};
@@ -1026,7 +1175,7 @@ clang::Stmt *StmtGen::visitCallInst(llvm::CallInst &inst) {
 }
 
 clang::Stmt *StmtGen::visitReturnInst(llvm::ReturnInst &inst) {
-  DLOG(INFO) << "visitReturnInst: " << LLVMThingToString(&inst);
+  RELLIC_LOG(IRGen) << "visitReturnInst: " << LLVMThingToString(&inst);
   if (auto retval = inst.getReturnValue()) {
     return ast.CreateReturn(expr_gen.CreateOperandExpr(inst.getOperandUse(0)));
   } else {
@@ -1041,17 +1190,18 @@ clang::Stmt *StmtGen::visitAllocaInst(llvm::AllocaInst &inst) {
 }
 
 clang::Stmt *StmtGen::visitBranchInst(llvm::BranchInst &inst) {
-  DLOG(INFO) << "visitBranchInst ignored: " << LLVMThingToString(&inst);
+  RELLIC_LOG(IRGen) << "visitBranchInst ignored: " << LLVMThingToString(&inst);
   return nullptr;
 }
 
 clang::Stmt *StmtGen::visitSwitchInst(llvm::SwitchInst &inst) {
-  DLOG(INFO) << "visitSwitchInst ignored: " << LLVMThingToString(&inst);
+  RELLIC_LOG(IRGen) << "visitSwitchInst ignored: " << LLVMThingToString(&inst);
   return nullptr;
 }
 
 clang::Stmt *StmtGen::visitUnreachableInst(llvm::UnreachableInst &inst) {
-  DLOG(INFO) << "visitUnreachableInst ignored:" << LLVMThingToString(&inst);
+  RELLIC_LOG(IRGen) << "visitUnreachableInst ignored:"
+                    << LLVMThingToString(&inst);
   return nullptr;
 }
 
@@ -1067,7 +1217,7 @@ clang::Stmt *StmtGen::visitInstruction(llvm::Instruction &inst) {
 }
 
 IRToASTVisitor::IRToASTVisitor(DecompilationContext &dec_ctx)
-    : dec_ctx(dec_ctx), ast(dec_ctx.ast) {}
+    : dec_ctx(dec_ctx), ast(dec_ctx.ast), converted_keys(dec_ctx.z3_ctx) {}
 
 void IRToASTVisitor::VisitGlobalVar(llvm::GlobalVariable &gvar) {
   ExprGen expr_gen{dec_ctx};
@@ -1075,7 +1225,7 @@ void IRToASTVisitor::VisitGlobalVar(llvm::GlobalVariable &gvar) {
 }
 
 void IRToASTVisitor::VisitArgument(llvm::Argument &arg) {
-  DLOG(INFO) << "VisitArgument: " << LLVMThingToString(&arg);
+  RELLIC_LOG(IRGen) << "VisitArgument: " << LLVMThingToString(&arg);
   auto &parm{dec_ctx.value_decls[&arg]};
   if (parm) {
     return;
@@ -1101,6 +1251,12 @@ void IRToASTVisitor::VisitBasicBlock(llvm::BasicBlock &block,
       stmts.push_back(stmt);
       dec_ctx.stmt_provenance[stmt] = &inst;
     }
+    auto temp{dec_ctx.cond_temps.find(&inst)};
+    if (temp != dec_ctx.cond_temps.end()) {
+      // The assignment is the only place the expression is translated
+      ++dec_ctx.stats.cond_temps;
+      dec_ctx.stats.cond_temp_savings -= temp->second;
+    }
   }
 
   auto &uses{dec_ctx.outgoing_uses[&block]};
@@ -1112,12 +1268,42 @@ void IRToASTVisitor::VisitBasicBlock(llvm::BasicBlock &block,
   }
 }
 
+// Number of instructions that are translated into the expression of `inst`:
+// itself, and the operands that have no variable of their own
+static unsigned GetExprSize(llvm::Instruction &inst) {
+  unsigned size{1};
+  for (auto &opnd : inst.operands()) {
+    auto op{llvm::dyn_cast<llvm::Instruction>(opnd)};
+    if (op && op->hasOneUse() &&
+        !llvm::isa<llvm::AllocaInst, llvm::PHINode, llvm::CallInst>(op)) {
+      size += GetExprSize(*op);
+    }
+  }
+  return size;
+}
+
+// Whether the only use of `inst` is as the condition of a branch or switch,
+// which is translated again for every structured condition that tests it
+static bool IsBranchCondition(llvm::Instruction &inst) {
+  if (!inst.hasOneUse()) {
+    return false;
+  }
+  auto user{*inst.user_begin()};
+  if (auto br = llvm::dyn_cast<llvm::BranchInst>(user)) {
+    return br->isConditional() && br->getCondition() == &inst;
+  }
+  if (auto sw = llvm::dyn_cast<llvm::SwitchInst>(user)) {
+    return sw->getCondition() == &inst;
+  }
+  return false;
+}
+
 void IRToASTVisitor::VisitFunctionDecl(llvm::Function &func) {
   auto name{func.getName().str()};
-  DLOG(INFO) << "VisitFunctionDecl: " << name;
+  RELLIC_LOG(IRGen) << "VisitFunctionDecl: " << name;
 
   if (IsAnnotationIntrinsic(func.getIntrinsicID())) {
-    DLOG(INFO) << "Skipping creating declaration for LLVM intrinsic";
+    RELLIC_LOG(IRGen) << "Skipping creating declaration for LLVM intrinsic";
     return;
   }
 
@@ -1126,7 +1312,7 @@ void IRToASTVisitor::VisitFunctionDecl(llvm::Function &func) {
     return;
   }
 
-  DLOG(INFO) << "Creating FunctionDecl for " << name;
+  RELLIC_LOG(IRGen) << "Creating FunctionDecl for " << name;
   auto tudecl{dec_ctx.ast_ctx.getTranslationUnitDecl()};
 
   std::vector<clang::QualType> arg_types;
@@ -1151,10 +1337,35 @@ void IRToASTVisitor::VisitFunctionDecl(llvm::Function &func) {
   auto fdecl{decl->getAsFunction()};
   fdecl->setParams(params);
 
+  // Names of the parameters and locals declared so far, which locals named
+  // from debug information must not shadow, as in `LocalDeclRenamer`
+  llvm::StringSet<> local_names;
+  for (auto param : params) {
+    local_names.insert(param->getName());
+  }
+  auto IsNameVisible{[&](const std::string &name) {
+    if (local_names.count(name)) {
+      return true;
+    }
+    for (auto decl : tudecl->lookup(&dec_ctx.ast_ctx.Idents.get(name))) {
+      if (clang::isa<clang::VarDecl>(decl)) {
+        return true;
+      }
+    }
+    return false;
+  }};
+
   for (auto &inst : llvm::instructions(func)) {
     auto &var{dec_ctx.value_decls[&inst]};
     if (auto alloca = llvm::dyn_cast<llvm::AllocaInst>(&inst)) {
       auto name{"var" + std::to_string(GetNumDecls<clang::VarDecl>(fdecl))};
+      if (dec_ctx.debug_names) {
+        if (auto debug_name = dec_ctx.debug_names->GetName(alloca)) {
+          name = IsNameVisible(*debug_name) ? *debug_name + "_" + name
+                                            : *debug_name;
+        }
+        local_names.insert(name);
+      }
       // TLDR: Here we discard the variable name as present in the bitcode
       // because there probably is a better one we can assign afterwards, using
       // debug metadata.
@@ -1176,15 +1387,29 @@ void IRToASTVisitor::VisitFunctionDecl(llvm::Function &func) {
       var = ast.CreateVarDecl(
           fdecl, dec_ctx.GetQualType(alloca->getAllocatedType()), name);
       fdecl->addDecl(var);
-    } else if (inst.hasNUsesOrMore(2) ||
-               (inst.hasNUsesOrMore(1) && llvm::isa<llvm::CallInst>(inst)) ||
-               llvm::isa<llvm::PHINode>(inst)) {
+      continue;
+    }
+
+    auto is_cond_temp{false};
+    if (dec_ctx.cond_temp_threshold && IsBranchCondition(inst)) {
+      auto size{GetExprSize(inst)};
+      if (size >= dec_ctx.cond_temp_threshold) {
+        dec_ctx.cond_temps[&inst] = size;
+        is_cond_temp = true;
+      }
+    }
+
+    if (inst.hasNUsesOrMore(2) ||
+        (inst.hasNUsesOrMore(1) && llvm::isa<llvm::CallInst>(inst)) ||
+        llvm::isa<llvm::PHINode>(inst) || is_cond_temp) {
       if (!inst.getType()->isVoidTy()) {
         auto GetPrefix{[&](llvm::Instruction *inst) {
           if (llvm::isa<llvm::CallInst>(inst)) {
             return "call";
           } else if (llvm::isa<llvm::PHINode>(inst)) {
             return "phi";
+          } else if (is_cond_temp) {
+            return "cond";
           } else {
             return "val";
           }
@@ -1199,6 +1424,7 @@ void IRToASTVisitor::VisitFunctionDecl(llvm::Function &func) {
 
         var = ast.CreateVarDecl(fdecl, type, name);
         fdecl->addDecl(var);
+        local_names.insert(name);
 
         if (auto phi = llvm::dyn_cast<llvm::PHINode>(&inst)) {
           for (auto i{0U}; i < phi->getNumIncomingValues(); ++i) {
@@ -1245,6 +1471,13 @@ void IRToASTVisitor::VisitFunctionDecl(llvm::Function &func) {
 }
 
 clang::Expr *IRToASTVisitor::CreateOperandExpr(llvm::Use &val) {
+  if (auto inst = llvm::dyn_cast<llvm::Instruction>(val)) {
+    auto temp{dec_ctx.cond_temps.find(inst)};
+    if (temp != dec_ctx.cond_temps.end()) {
+      // A reference stands for the whole expression
+      dec_ctx.stats.cond_temp_savings += temp->second;
+    }
+  }
   ExprGen expr_gen{dec_ctx};
   return expr_gen.CreateOperandExpr(val);
 }
@@ -23,10 +23,38 @@ clang::Stmt *ApplyFirstMatchingRule(
     finder.addMatcher(rule->GetCondition(), rule.get());
   }
 
+  for (auto &rule : rules) {
+    rule->Reset();
+  }
+
+  finder.match(*stmt, dec_ctx.ast_unit.getASTContext());
+
+  for (auto &rule : rules) {
+    if (*rule) {
+      ++dec_ctx.stats.rule_hits[rule->GetName()];
+      return rule->GetOrCreateSubstitution(dec_ctx, stmt);
+    }
+  }
+
+  return stmt;
+}
+
+void InferenceRuleSet::Add(std::unique_ptr<InferenceRule> rule) {
+  finder.addMatcher(rule->GetCondition(), rule.get());
+  rules.push_back(std::move(rule));
+}
+
+clang::Stmt *InferenceRuleSet::Apply(DecompilationContext &dec_ctx,
+                                     clang::Stmt *stmt) {
+  for (auto &rule : rules) {
+    rule->Reset();
+  }
+
   finder.match(*stmt, dec_ctx.ast_unit.getASTContext());
 
   for (auto &rule : rules) {
     if (*rule) {
+      ++dec_ctx.stats.rule_hits[rule->GetName()];
       return rule->GetOrCreateSubstitution(dec_ctx, stmt);
     }
   }
@@ -34,4 +62,25 @@ clang::Stmt *ApplyFirstMatchingRule(
   return stmt;
 }
 
+void InferenceRuleEngine::Add(clang::Stmt::StmtClass root,
+                              std::unique_ptr<InferenceRule> rule) {
+  size_t idx{root};
+  if (idx >= sets.size()) {
+    sets.resize(idx + 1);
+  }
+  if (!sets[idx]) {
+    sets[idx] = std::make_unique<InferenceRuleSet>();
+  }
+  sets[idx]->Add(std::move(rule));
+}
+
+clang::Stmt *InferenceRuleEngine::Apply(DecompilationContext &dec_ctx,
+                                        clang::Stmt *stmt) {
+  size_t idx{stmt->getStmtClass()};
+  if (idx >= sets.size() || !sets[idx]) {
+    return stmt;
+  }
+  return sets[idx]->Apply(dec_ctx, stmt);
+}
+
 }  // namespace rellic
\ No newline at end of file
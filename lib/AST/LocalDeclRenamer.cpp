@@ -17,18 +17,32 @@
 namespace rellic {
 
 LocalDeclRenamer::LocalDeclRenamer(DecompilationContext &dec_ctx,
-                                   IRToNameMap &names)
-    : TransformVisitor<LocalDeclRenamer>(dec_ctx),
-      seen_names(1),
-      names(names) {}
-
-bool LocalDeclRenamer::IsNameVisible(const std::string &name) {
-  for (auto &scope : seen_names) {
-    if (scope.find(name) != scope.end()) {
-      return true;
+                                   DebugInfoCollector &dic)
+    : TransformVisitor<LocalDeclRenamer>(dec_ctx), dic(dic) {}
+
+bool LocalDeclRenamer::IsNameVisible(clang::IdentifierInfo *name) {
+  return visible_names.count(name);
+}
+
+void LocalDeclRenamer::DeclareName(clang::IdentifierInfo *name) {
+  ++visible_names[name];
+  declared_names.push_back(name);
+}
+
+void LocalDeclRenamer::PushScope() {
+  scope_starts.push_back(declared_names.size());
+}
+
+void LocalDeclRenamer::PopScope() {
+  auto start{scope_starts.back()};
+  scope_starts.pop_back();
+  for (auto i{start}; i < declared_names.size(); ++i) {
+    auto it{visible_names.find(declared_names[i])};
+    if (!--it->second) {
+      visible_names.erase(it);
     }
   }
-  return false;
+  declared_names.resize(start);
 }
 
 bool LocalDeclRenamer::VisitVarDecl(clang::VarDecl *decl) {
@@ -42,36 +56,36 @@ bool LocalDeclRenamer::VisitVarDecl(clang::VarDecl *decl) {
     return !Stopped();
   }
 
-  auto name{names.find(val->second)};
-  if (name == names.end()) {
-    seen_names.back().insert(decl->getName().str());
+  auto name{dic.GetName(val->second)};
+  if (!name) {
+    DeclareName(decl->getIdentifier());
     return !Stopped();
   }
 
-  if (!IsNameVisible(name->second)) {
-    seen_names.back().insert(name->second);
-    decl->setDeclName(dec_ctx.ast.CreateIdentifier(name->second));
+  auto id{dec_ctx.ast.CreateIdentifier(*name)};
+  if (!IsNameVisible(id)) {
+    DeclareName(id);
+    decl->setDeclName(id);
   } else {
     // Append the automatically-generated name to the debug-info name in order
     // to avoid any lexical scoping issue
     // TODO(frabert): Recover proper lexical scoping from debug info metadata
-    auto old_name{decl->getName().str()};
-    auto new_name{name->second + "_" + old_name};
-    decl->setDeclName(dec_ctx.ast.CreateIdentifier(new_name));
-    seen_names.back().insert(new_name);
+    auto new_name{
+        dec_ctx.ast.CreateIdentifier(*name + "_" + decl->getName().str())};
+    decl->setDeclName(new_name);
+    DeclareName(new_name);
   }
 
   return !Stopped();
 }
 
 bool LocalDeclRenamer::TraverseFunctionDecl(clang::FunctionDecl *decl) {
-  std::unordered_set<std::string> scope;
+  PushScope();
   for (auto param : decl->parameters()) {
-    scope.insert(param->getName().str());
+    DeclareName(param->getIdentifier());
   }
-  seen_names.push_back(scope);
   RecursiveASTVisitor<LocalDeclRenamer>::TraverseFunctionDecl(decl);
-  seen_names.pop_back();
+  PopScope();
   return !Stopped();
 }
 
@@ -17,6 +17,7 @@
 #include "rellic/AST/ASTBuilder.h"
 #include "rellic/AST/InferenceRule.h"
 #include "rellic/AST/Util.h"
+#include "rellic/Log.h"
 
 namespace rellic {
 
@@ -38,6 +39,8 @@ class WhileRule : public InferenceRule {
             hasBody(compoundStmt(
                 has(ifStmt(stmt().bind("if"), hasThen(comp_break))))))) {}
 
+  const char *GetName() const override { return "WhileRule"; }
+
   void run(const MatchFinder::MatchResult &result) override {
     auto loop{result.Nodes.getNodeAs<clang::WhileStmt>("while")};
     auto body{clang::cast<clang::CompoundStmt>(loop->getBody())};
@@ -78,6 +81,8 @@ class ElseWhileRule : public InferenceRule {
             hasBody(compoundStmt(
                 has(ifStmt(stmt().bind("if"), hasElse(comp_break))))))) {}
 
+  const char *GetName() const override { return "ElseWhileRule"; }
+
   void run(const MatchFinder::MatchResult &result) override {
     auto loop{result.Nodes.getNodeAs<clang::WhileStmt>("while")};
     auto body{clang::cast<clang::CompoundStmt>(loop->getBody())};
@@ -112,6 +117,8 @@ class DoWhileRule : public InferenceRule {
             hasBody(compoundStmt(
                 has(ifStmt(stmt().bind("if"), hasThen(comp_break))))))) {}
 
+  const char *GetName() const override { return "DoWhileRule"; }
+
   void run(const MatchFinder::MatchResult &result) override {
     auto loop{result.Nodes.getNodeAs<clang::WhileStmt>("while")};
     auto body{clang::cast<clang::CompoundStmt>(loop->getBody())};
@@ -133,14 +140,15 @@ class DoWhileRule : public InferenceRule {
     auto cond{dec_ctx.z3_exprs[dec_ctx.conds[ifstmt]]};
     std::vector<clang::Stmt *> new_body(comp->body_begin(),
                                         comp->body_end() - 1);
+    auto not_cond{dec_ctx.InsertZExpr(!cond)};
     if (auto else_stmt = ifstmt->getElse()) {
       auto new_if{dec_ctx.ast.CreateIf(dec_ctx.marker_expr, else_stmt)};
-      dec_ctx.conds[new_if] = dec_ctx.z3_exprs.size();
+      dec_ctx.conds[new_if] = not_cond;
       new_body.push_back(new_if);
     }
     auto new_do{dec_ctx.ast.CreateDo(dec_ctx.marker_expr,
                                      dec_ctx.ast.CreateCompoundStmt(new_body))};
-    dec_ctx.conds[new_do] = dec_ctx.InsertZExpr(!cond);
+    dec_ctx.conds[new_do] = not_cond;
     return new_do;
   }
 };
@@ -153,6 +161,8 @@ class ElseDoWhileRule : public InferenceRule {
             hasBody(compoundStmt(
                 has(ifStmt(stmt().bind("if"), hasElse(comp_break))))))) {}
 
+  const char *GetName() const override { return "ElseDoWhileRule"; }
+
   void run(const MatchFinder::MatchResult &result) override {
     auto loop{result.Nodes.getNodeAs<clang::WhileStmt>("while")};
     auto body{clang::cast<clang::CompoundStmt>(loop->getBody())};
@@ -175,6 +185,7 @@ class ElseDoWhileRule : public InferenceRule {
                                         comp->body_end() - 1);
 
     ifstmt->setElse(nullptr);
+    dec_ctx.subtree_changes.Mark(ifstmt);
     new_body.push_back(ifstmt);
 
     auto new_do{dec_ctx.ast.CreateDo(dec_ctx.marker_expr,
@@ -195,6 +206,13 @@ class NestedDoWhileRule : public InferenceRule {
                       hasBody(compoundStmt(findAll(ifStmt(
                           stmt().bind("if"), hasThen(has(breakStmt())))))))) {}
 
+  const char *GetName() const override { return "NestedDoWhileRule"; }
+
+  void Reset() override {
+    InferenceRule::Reset();
+    matched = false;
+  }
+
   void run(const MatchFinder::MatchResult &result) override {
     if (!matched) {
       auto loop{result.Nodes.getNodeAs<clang::WhileStmt>("while")};
@@ -221,15 +239,16 @@ class NestedDoWhileRule : public InferenceRule {
 
     std::vector<clang::Stmt *> do_body(comp->body_begin(),
                                        comp->body_end() - 1);
+    auto not_cond{dec_ctx.InsertZExpr(!cond)};
     if (auto else_stmt = if_stmt->getElse()) {
       auto new_if{dec_ctx.ast.CreateIf(dec_ctx.marker_expr, else_stmt)};
-      dec_ctx.conds[new_if] = dec_ctx.z3_exprs.size();
+      dec_ctx.conds[new_if] = not_cond;
       do_body.push_back(new_if);
     }
 
     auto do_stmt{dec_ctx.ast.CreateDo(dec_ctx.marker_expr,
                                       dec_ctx.ast.CreateCompoundStmt(do_body))};
-    dec_ctx.conds[do_stmt] = dec_ctx.InsertZExpr(!cond);
+    dec_ctx.conds[do_stmt] = not_cond;
 
     std::vector<clang::Stmt *> while_body({do_stmt, if_stmt->getThen()});
     auto new_while{dec_ctx.ast.CreateWhile(
@@ -249,6 +268,8 @@ class LoopToSeq : public InferenceRule {
                                  hasElse(has(breakStmt()))),
                           breakStmt())))))) {}
 
+  const char *GetName() const override { return "LoopToSeq"; }
+
   void run(const MatchFinder::MatchResult &result) override {
     auto loop{result.Nodes.getNodeAs<clang::WhileStmt>("while")};
     if (auto ifstmt = result.Nodes.getNodeAs<clang::IfStmt>("if")) {
@@ -290,6 +311,8 @@ class LoopToSeq : public InferenceRule {
       }
       ifstmt->setThen(branches[0]);
       ifstmt->setElse(branches[1]);
+      // Changed in place, unlike the loop it is moved out of
+      dec_ctx.subtree_changes.Mark(ifstmt);
     } else {
       new_body.pop_back();
     }
@@ -309,6 +332,8 @@ class CondToSeqRule : public InferenceRule {
                 has(ifStmt(hasThen(unless(has_break)), hasElse(has_break))),
                 statementCountIs(1))))) {}
 
+  const char *GetName() const override { return "CondToSeqRule"; }
+
   void run(const MatchFinder::MatchResult &result) override {
     match = result.Nodes.getNodeAs<clang::WhileStmt>("while");
   }
@@ -347,6 +372,8 @@ class CondToSeqNegRule : public InferenceRule {
                 has(ifStmt(hasThen(has_break), hasElse(unless(has_break)))),
                 statementCountIs(1))))) {}
 
+  const char *GetName() const override { return "CondToSeqNegRule"; }
+
   void run(const MatchFinder::MatchResult &result) override {
     match = result.Nodes.getNodeAs<clang::WhileStmt>("while");
   }
@@ -381,7 +408,16 @@ class CondToSeqNegRule : public InferenceRule {
 }  // namespace
 
 LoopRefine::LoopRefine(DecompilationContext &dec_ctx)
-    : TransformVisitor<LoopRefine>(dec_ctx) {}
+    : TransformVisitor<LoopRefine>(dec_ctx) {
+  rules.Add(std::make_unique<CondToSeqRule>());
+  rules.Add(std::make_unique<CondToSeqNegRule>());
+  rules.Add(std::make_unique<NestedDoWhileRule>());
+  rules.Add(std::make_unique<LoopToSeq>());
+  rules.Add(std::make_unique<WhileRule>());
+  rules.Add(std::make_unique<DoWhileRule>());
+  rules.Add(std::make_unique<ElseWhileRule>());
+  rules.Add(std::make_unique<ElseDoWhileRule>());
+}
 
 bool LoopRefine::VisitWhileStmt(clang::WhileStmt *loop) {
   // DLOG(INFO) << "VisitWhileStmt";
@@ -395,34 +431,24 @@ bool LoopRefine::VisitWhileStmt(clang::WhileStmt *loop) {
       [](auto stmt) { return clang::isa<clang::BreakStmt>(stmt); })};
   if (break_stmt != body->body_end()) {
     std::vector<clang::Stmt *> new_body_stmts{body->body_begin(), break_stmt};
-    substitutions[loop] = dec_ctx.ast.CreateIf(
-        loop->getCond(), dec_ctx.ast.CreateCompoundStmt(new_body_stmts));
+    auto new_if{dec_ctx.ast.CreateIf(
+        loop->getCond(), dec_ctx.ast.CreateCompoundStmt(new_body_stmts))};
+    Substitute(loop, new_if);
     return !Stopped();
   }
 
-  std::vector<std::unique_ptr<InferenceRule>> rules;
-
-  rules.emplace_back(new CondToSeqRule);
-  rules.emplace_back(new CondToSeqNegRule);
-  rules.emplace_back(new NestedDoWhileRule);
-  rules.emplace_back(new LoopToSeq);
-  rules.emplace_back(new WhileRule);
-  rules.emplace_back(new DoWhileRule);
-  rules.emplace_back(new ElseWhileRule);
-  rules.emplace_back(new ElseDoWhileRule);
-
-  auto sub{ApplyFirstMatchingRule(dec_ctx, loop, rules)};
+  auto sub{rules.Apply(dec_ctx, loop)};
   if (sub != loop) {
-    substitutions[loop] = sub;
+    Substitute(loop, sub);
   }
 
   return !Stopped();
 }
 
 void LoopRefine::RunImpl() {
-  LOG(INFO) << "Rule-based loop refinement";
+  RELLIC_LOG(Passes) << "Rule-based loop refinement";
   TransformVisitor<LoopRefine>::RunImpl();
-  TraverseDecl(dec_ctx.ast_ctx.getTranslationUnitDecl());
+  TraverseFunctions();
 }
 
 }  // namespace rellic
\ No newline at end of file
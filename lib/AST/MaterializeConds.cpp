@@ -12,6 +12,7 @@
 #include <glog/logging.h>
 
 #include "rellic/AST/Util.h"
+#include "rellic/Log.h"
 
 namespace rellic {
 
@@ -43,9 +44,11 @@ bool MaterializeConds::VisitDoStmt(clang::DoStmt *stmt) {
 }
 
 void MaterializeConds::RunImpl() {
-  LOG(INFO) << "Materializing conditions";
+  RELLIC_LOG(Passes) << "Materializing conditions";
   TransformVisitor<MaterializeConds>::RunImpl();
-  TraverseDecl(dec_ctx.ast_ctx.getTranslationUnitDecl());
+  ast_gen.ClearConvertedExprs();
+  TraverseFunctions();
+  ast_gen.ClearConvertedExprs();
 }
 
 }  // namespace rellic
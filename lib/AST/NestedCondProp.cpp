@@ -12,18 +12,35 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <optional>
 #include <unordered_map>
 #include <vector>
 
 #include "rellic/AST/ASTBuilder.h"
+#include "rellic/AST/Checkpoint.h"
 #include "rellic/AST/Util.h"
+#include "rellic/Log.h"
 
 namespace rellic {
 // Stores a set of expression that have a known value, so that they can be
 // recognized as part of larger expressions and simplified.
-struct KnownExprs {
+//
+// The set is shared by a whole function body: scopes take a `Mark` before
+// adding the values that only hold inside them, and `Rollback` to it when they
+// end, which undoes the additions from an undo log instead of copying the set
+// for every nested statement.
+class KnownExprs {
   std::unordered_map<unsigned, bool> values;
+  // Previous state of every entry changed by `AddExpr`, in order. Keeping the
+  // expressions here also keeps their ids from being recycled while they are
+  // in `values`.
+  struct Undo {
+    z3::expr expr;
+    std::optional<bool> value;
+  };
+  std::vector<Undo> log;
 
+ public:
   void AddExpr(z3::expr expr, bool value) {
     // When adding expressions to the set of known values, it's important that
     // they are added in their smallest possible form. E.g., if it's known that
@@ -67,7 +84,28 @@ struct KnownExprs {
       return;
     }
 
-    values[expr.id()] = value;
+    auto [it, inserted]{values.try_emplace(expr.id(), value)};
+    if (inserted) {
+      log.push_back({expr, std::nullopt});
+    } else if (it->second != value) {
+      log.push_back({expr, it->second});
+      it->second = value;
+    }
+  }
+
+  size_t Mark() const { return log.size(); }
+
+  // Forgets every value added since `mark` was taken
+  void Rollback(size_t mark) {
+    while (log.size() > mark) {
+      auto &undo{log.back()};
+      if (undo.value) {
+        values[undo.expr.id()] = *undo.value;
+      } else {
+        values.erase(undo.expr.id());
+      }
+      log.pop_back();
+    }
   }
 
   // Simplify an expression `expr` using all the known values stored. Sets
@@ -77,21 +115,37 @@ struct KnownExprs {
       return expr;
     }
 
-    if (values.find(expr.id()) != values.end()) {
+    auto it{values.find(expr.id())};
+    if (it != values.end()) {
       changed = true;
-      return expr.ctx().bool_val(values[expr.id()]);
+      return expr.ctx().bool_val(it->second);
     }
 
     if (expr.is_and() || expr.is_or()) {
-      z3::expr_vector args{expr.ctx()};
-      for (auto arg : expr.args()) {
-        args.push_back(ApplyAssumptions(arg, changed));
-      }
-      if (expr.is_and()) {
-        return z3::mk_and(args);
-      } else {
-        return z3::mk_or(args);
+      // The arguments are only collected once one of them is simplified
+      auto num_args{expr.num_args()};
+      for (unsigned i{0}; i < num_args; ++i) {
+        bool arg_changed{false};
+        auto arg{ApplyAssumptions(expr.arg(i), arg_changed)};
+        if (!arg_changed) {
+          continue;
+        }
+        changed = true;
+        z3::expr_vector args{expr.ctx()};
+        for (unsigned j{0}; j < i; ++j) {
+          args.push_back(expr.arg(j));
+        }
+        args.push_back(arg);
+        for (unsigned j{i + 1}; j < num_args; ++j) {
+          args.push_back(ApplyAssumptions(expr.arg(j), changed));
+        }
+        if (expr.is_and()) {
+          return z3::mk_and(args);
+        } else {
+          return z3::mk_or(args);
+        }
       }
+      return expr;
     }
 
     if (expr.is_not()) {
@@ -102,10 +156,25 @@ struct KnownExprs {
   }
 };
 
+// Applies every propagation in a body in a single traversal, and returns
+// whether any condition was changed
 class CompoundVisitor
     : public clang::StmtVisitor<CompoundVisitor, bool, KnownExprs&> {
  private:
   DecompilationContext& dec_ctx;
+  // Statements being visited, innermost last
+  std::vector<clang::Stmt*> path;
+
+  // Gives `stmt` a new condition, and marks it along with the statements
+  // above it as changed
+  void SetCond(clang::Stmt* stmt, z3::expr cond) {
+    dec_ctx.conds[stmt] = dec_ctx.InsertZExpr(cond);
+    auto& changes{dec_ctx.subtree_changes};
+    changes.Mark(stmt);
+    for (auto parent : path) {
+      changes.Mark(parent);
+    }
+  }
 
   template <bool cond_is_true_in_body, typename T>
   bool VisitLoop(T* loop, KnownExprs& known_exprs) {
@@ -113,21 +182,22 @@ class CompoundVisitor
     bool changed{false};
     auto old_cond{dec_ctx.z3_exprs[cond_idx]};
     auto new_cond{known_exprs.ApplyAssumptions(old_cond, changed)};
-    if (loop->getCond() != dec_ctx.marker_expr && changed) {
-      dec_ctx.z3_exprs.set(cond_idx, new_cond);
-      return true;
+    changed &= loop->getCond() != dec_ctx.marker_expr;
+    if (changed) {
+      SetCond(loop, new_cond);
     }
 
-    auto inner{known_exprs};
+    auto mark{known_exprs.Mark()};
     if constexpr (cond_is_true_in_body) {
-      inner.AddExpr(new_cond, true);
+      known_exprs.AddExpr(new_cond, true);
     }
-    known_exprs.AddExpr(new_cond, false);
+    path.push_back(loop);
+    changed |= Visit(loop->getBody(), known_exprs);
+    path.pop_back();
+    known_exprs.Rollback(mark);
 
-    if (Visit(loop->getBody(), inner)) {
-      return true;
-    }
-    return false;
+    known_exprs.AddExpr(new_cond, false);
+    return changed;
   }
 
  public:
@@ -135,13 +205,14 @@ class CompoundVisitor
 
   bool VisitCompoundStmt(clang::CompoundStmt* compound,
                          KnownExprs& known_exprs) {
+    bool changed{false};
+    path.push_back(compound);
     for (auto stmt : compound->body()) {
-      if (Visit(stmt, known_exprs)) {
-        return true;
-      }
+      changed |= Visit(stmt, known_exprs);
     }
+    path.pop_back();
 
-    return false;
+    return changed;
   }
 
   bool VisitWhileStmt(clang::WhileStmt* while_stmt, KnownExprs& known_exprs) {
@@ -157,25 +228,24 @@ class CompoundVisitor
     bool changed{false};
     auto old_cond{dec_ctx.z3_exprs[cond_idx]};
     auto new_cond{known_exprs.ApplyAssumptions(old_cond, changed)};
-    if (if_stmt->getCond() == dec_ctx.marker_expr && changed) {
-      dec_ctx.z3_exprs.set(cond_idx, new_cond);
-      return true;
+    changed &= if_stmt->getCond() == dec_ctx.marker_expr;
+    if (changed) {
+      SetCond(if_stmt, new_cond);
     }
 
-    auto inner_then{known_exprs};
-    inner_then.AddExpr(new_cond, true);
-    if (Visit(if_stmt->getThen(), inner_then)) {
-      return true;
-    }
+    auto mark{known_exprs.Mark()};
+    known_exprs.AddExpr(new_cond, true);
+    path.push_back(if_stmt);
+    changed |= Visit(if_stmt->getThen(), known_exprs);
+    known_exprs.Rollback(mark);
 
     if (if_stmt->getElse()) {
-      auto inner_else{known_exprs};
-      inner_else.AddExpr(new_cond, false);
-      if (Visit(if_stmt->getElse(), inner_else)) {
-        return true;
-      }
+      known_exprs.AddExpr(new_cond, false);
+      changed |= Visit(if_stmt->getElse(), known_exprs);
+      known_exprs.Rollback(mark);
     }
-    return false;
+    path.pop_back();
+    return changed;
   }
 };
 
@@ -183,23 +253,22 @@ NestedCondProp::NestedCondProp(DecompilationContext& dec_ctx)
     : ASTPass(dec_ctx) {}
 
 void NestedCondProp::RunImpl() {
-  LOG(INFO) << "Propagating conditions";
+  RELLIC_LOG(Passes) << "Propagating conditions";
   changed = false;
   CompoundVisitor visitor{dec_ctx};
 
-  for (auto decl : dec_ctx.ast_ctx.getTranslationUnitDecl()->decls()) {
-    if (auto fdecl = clang::dyn_cast<clang::FunctionDecl>(decl)) {
-      if (Stopped()) {
-        return;
-      }
+  for (auto fdecl : GetFunctionsInScope()) {
+    if (Stopped()) {
+      return;
+    }
 
-      if (fdecl->hasBody()) {
-        KnownExprs known_exprs{};
-        if (visitor.Visit(fdecl->getBody(), known_exprs)) {
-          changed = true;
-          return;
-        }
-      }
+    // Conditions are rewritten without entering the function
+    if (dec_ctx.checkpoints) {
+      dec_ctx.checkpoints->Preserve(fdecl);
+    }
+    KnownExprs known_exprs{};
+    if (visitor.Visit(fdecl->getBody(), known_exprs)) {
+      MarkModified(fdecl);
     }
   }
 }
@@ -11,65 +11,96 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include <algorithm>
+
 #include "rellic/AST/Util.h"
+#include "rellic/Log.h"
 
 namespace rellic {
 
 NestedScopeCombine::NestedScopeCombine(DecompilationContext &dec_ctx)
-    : TransformVisitor<NestedScopeCombine>(dec_ctx) {}
+    : LocalRewriteVisitor<NestedScopeCombine>(dec_ctx) {}
 
-bool NestedScopeCombine::VisitIfStmt(clang::IfStmt *ifstmt) {
-  // DLOG(INFO) << "VisitIfStmt";
+clang::Stmt *NestedScopeCombine::RewriteIf(clang::IfStmt *ifstmt) {
   // Determine whether `cond` is a constant expression that is always true and
   // `ifstmt` should be replaced by `then` in it's parent nodes.
-  auto cond{dec_ctx.z3_exprs[dec_ctx.conds[ifstmt]]};
-  if (Prove(cond)) {
-    substitutions[ifstmt] = ifstmt->getThen();
-  } else if (ifstmt->getElse() && Prove(!cond)) {
-    substitutions[ifstmt] = ifstmt->getElse();
+  auto verdict{ClassifyCond(dec_ctx, dec_ctx.conds[ifstmt])};
+  if (verdict == CondVerdict::True) {
+    return ifstmt->getThen();
+  } else if (ifstmt->getElse() && verdict == CondVerdict::False) {
+    return ifstmt->getElse();
   }
-  return !Stopped();
+  return ifstmt;
 }
 
-bool NestedScopeCombine::VisitWhileStmt(clang::WhileStmt *stmt) {
+clang::Stmt *NestedScopeCombine::RewriteWhile(clang::WhileStmt *stmt) {
   // Substitute while statements in the form `while(1) { sth; break; }` with
   // just `{ sth; }`
-  auto cond{dec_ctx.z3_exprs[dec_ctx.conds[stmt]]};
-  if (Prove(cond)) {
+  if (ClassifyCond(dec_ctx, dec_ctx.conds[stmt]) == CondVerdict::True) {
     auto body{clang::cast<clang::CompoundStmt>(stmt->getBody())};
     if (clang::isa<clang::BreakStmt>(body->body_back())) {
-      std::vector<clang::Stmt *> new_body{body->body_begin(),
-                                          body->body_end() - 1};
-      substitutions[stmt] = dec_ctx.ast.CreateCompoundStmt(new_body);
+      auto new_body{buffers.Get()};
+      new_body->assign(body->body_begin(), body->body_end() - 1);
+      return dec_ctx.ast.CreateCompoundStmt(*new_body);
     }
   }
-  return !Stopped();
+  return stmt;
 }
 
-bool NestedScopeCombine::VisitCompoundStmt(clang::CompoundStmt *compound) {
-  // DLOG(INFO) << "VisitCompoundStmt";
-  bool has_compound = false;
-  std::vector<clang::Stmt *> new_body;
-  for (auto stmt : compound->body()) {
+clang::Stmt *NestedScopeCombine::RewriteCompound(
+    clang::CompoundStmt *compound) {
+  auto body{compound->body()};
+  if (std::none_of(body.begin(), body.end(), [](clang::Stmt *stmt) {
+        return clang::isa<clang::CompoundStmt>(stmt);
+      })) {
+    return compound;
+  }
+
+  auto new_body{buffers.Get()};
+  for (auto stmt : body) {
     if (auto child = clang::dyn_cast<clang::CompoundStmt>(stmt)) {
-      new_body.insert(new_body.end(), child->body_begin(), child->body_end());
-      has_compound = true;
+      new_body->insert(new_body->end(), child->body_begin(), child->body_end());
     } else {
-      new_body.push_back(stmt);
+      new_body->push_back(stmt);
     }
   }
+  return dec_ctx.ast.CreateCompoundStmt(*new_body);
+}
 
-  if (has_compound) {
-    substitutions[compound] = dec_ctx.ast.CreateCompoundStmt(new_body);
+clang::Stmt *NestedScopeCombine::Rewrite(clang::Stmt *stmt) {
+  if (auto ifstmt = clang::dyn_cast<clang::IfStmt>(stmt)) {
+    return RewriteIf(ifstmt);
+  } else if (auto whilestmt = clang::dyn_cast<clang::WhileStmt>(stmt)) {
+    return RewriteWhile(whilestmt);
+  } else if (auto compound = clang::dyn_cast<clang::CompoundStmt>(stmt)) {
+    return RewriteCompound(compound);
   }
+  return stmt;
+}
 
-  return !Stopped();
+void NestedScopeCombine::Prepare() {
+  // Decide all the conditions in one go, so that visiting them only hits the
+  // cache
+  std::vector<unsigned> conds;
+  auto stmts{buffers.Get()};
+  for (auto fdecl : GetFunctionsInScope()) {
+    stmts->clear();
+    EnumerateStmts(fdecl->getBody(), *stmts);
+    for (auto stmt : *stmts) {
+      if (clang::isa<clang::IfStmt, clang::WhileStmt>(stmt)) {
+        auto it{dec_ctx.conds.find(stmt)};
+        if (it != dec_ctx.conds.end()) {
+          conds.push_back(it->second);
+        }
+      }
+    }
+  }
+  ClassifyConds(dec_ctx, conds);
 }
 
 void NestedScopeCombine::RunImpl() {
-  LOG(INFO) << "Combining nested scopes";
-  TransformVisitor<NestedScopeCombine>::RunImpl();
-  TraverseDecl(dec_ctx.ast_ctx.getTranslationUnitDecl());
+  RELLIC_LOG(Passes) << "Combining nested scopes";
+  LocalRewriteVisitor<NestedScopeCombine>::RunImpl();
 }
 
 }  // namespace rellic
@@ -0,0 +1,197 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/PassProfile.h"
+
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Analysis/LoopInfo.h>
+#include <llvm/IR/Dominators.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MathExtras.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
+
+#include <algorithm>
+
+#include "rellic/Exception.h"
+
+namespace rellic {
+
+// 0 for 0, otherwise 1 plus the base 2 logarithm of `n` rounded up
+static unsigned GetBucket(unsigned n) {
+  return n ? llvm::Log2_32_Ceil(n) + 1 : 0;
+}
+
+std::string GetFunctionShape(llvm::Function &func) {
+  static constexpr unsigned kMaxLoopDepth{4};
+  llvm::DominatorTree dom_tree(func);
+  llvm::LoopInfo loop_info(dom_tree);
+  unsigned loop_depth{0};
+  unsigned switch_width{0};
+  for (auto &block : func) {
+    loop_depth = std::max(loop_depth, loop_info.getLoopDepth(&block));
+    if (auto sw = llvm::dyn_cast<llvm::SwitchInst>(block.getTerminator())) {
+      switch_width = std::max(switch_width, sw->getNumCases());
+    }
+  }
+  return "b" + std::to_string(GetBucket(func.size())) + ".l" +
+         std::to_string(std::min(loop_depth, kMaxLoopDepth)) + ".s" +
+         std::to_string(GetBucket(switch_width));
+}
+
+PassProfile::PassProfile(const PassProfile &other) { *this = other; }
+
+PassProfile &PassProfile::operator=(const PassProfile &other) {
+  if (this == &other) {
+    return *this;
+  }
+  std::scoped_lock lock(mutex, other.mutex);
+  shapes = other.shapes;
+  min_visits = other.min_visits;
+  return *this;
+}
+
+void PassProfile::Record(const std::string &shape, const std::string &pass,
+                         bool changed, Duration time) {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto &entry{shapes[shape][pass]};
+  ++entry.visits;
+  entry.changes += changed;
+  entry.time += time;
+}
+
+bool PassProfile::IsUseless(const std::string &shape,
+                            const std::string &pass) const {
+  std::lock_guard<std::mutex> lock(mutex);
+  auto passes{shapes.find(shape)};
+  if (passes == shapes.end()) {
+    return false;
+  }
+  auto entry{passes->second.find(pass)};
+  return entry != passes->second.end() && !entry->second.changes &&
+         entry->second.visits >= min_visits;
+}
+
+void PassProfile::Merge(const PassProfile &other) {
+  if (this == &other) {
+    return;
+  }
+  std::scoped_lock lock(mutex, other.mutex);
+  for (auto &[shape, passes] : other.shapes) {
+    auto &mine{shapes[shape]};
+    for (auto &[pass, entry] : passes) {
+      auto &mine_entry{mine[pass]};
+      mine_entry.visits += entry.visits;
+      mine_entry.changes += entry.changes;
+      mine_entry.time += entry.time;
+    }
+  }
+}
+
+std::string PassProfile::GetKey() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  std::string skipped;
+  for (auto &[shape, passes] : shapes) {
+    for (auto &[pass, entry] : passes) {
+      if (!entry.changes && entry.visits >= min_visits) {
+        skipped += shape + ':' + pass + ';';
+      }
+    }
+  }
+  return llvm::utohexstr(llvm::xxHash64(skipped));
+}
+
+llvm::json::Object PassProfile::ToJSON() const {
+  std::lock_guard<std::mutex> lock(mutex);
+  llvm::json::Object json_shapes;
+  for (auto &[shape, passes] : shapes) {
+    llvm::json::Object json_passes;
+    for (auto &[pass, entry] : passes) {
+      json_passes[pass] = llvm::json::Object{
+          {"visits", static_cast<int64_t>(entry.visits)},
+          {"changes", static_cast<int64_t>(entry.changes)},
+          {"time", entry.time.count()},
+      };
+    }
+    json_shapes[shape] = std::move(json_passes);
+  }
+  return llvm::json::Object{{"min_visits", min_visits},
+                            {"shapes", std::move(json_shapes)}};
+}
+
+std::optional<PassProfile> PassProfile::FromJSON(
+    const llvm::json::Value &json) {
+  auto obj{json.getAsObject()};
+  auto json_shapes{obj ? obj->getObject("shapes") : nullptr};
+  if (!json_shapes) {
+    return std::nullopt;
+  }
+  PassProfile profile;
+  if (auto min_visits = obj->getInteger("min_visits")) {
+    profile.min_visits = *min_visits;
+  }
+  for (auto &[shape, json_passes] : *json_shapes) {
+    auto passes{json_passes.getAsObject()};
+    if (!passes) {
+      return std::nullopt;
+    }
+    auto &mine{profile.shapes[shape.str()]};
+    for (auto &[pass, json_entry] : *passes) {
+      auto entry{json_entry.getAsObject()};
+      auto visits{entry ? entry->getInteger("visits") : std::nullopt};
+      auto changes{entry ? entry->getInteger("changes") : std::nullopt};
+      if (!visits || !changes) {
+        return std::nullopt;
+      }
+      auto &mine_entry{mine[pass.str()]};
+      mine_entry.visits = *visits;
+      mine_entry.changes = *changes;
+      mine_entry.time = Duration(entry->getNumber("time").value_or(0));
+    }
+  }
+  return profile;
+}
+
+PassProfile PassProfile::Load(const std::string &path) {
+  if (!llvm::sys::fs::exists(path)) {
+    return {};
+  }
+  auto buffer{llvm::MemoryBuffer::getFile(path)};
+  CHECK_THROW(buffer) << "Cannot read " << path << ": "
+                      << buffer.getError().message();
+  auto json{llvm::json::parse(buffer.get()->getBuffer())};
+  if (!json) {
+    THROW() << "Malformed pass profile " << path << ": "
+            << llvm::toString(json.takeError());
+  }
+  auto profile{FromJSON(*json)};
+  CHECK_THROW(profile) << "Malformed pass profile " << path;
+  return std::move(*profile);
+}
+
+void PassProfile::Save(const std::string &path) const {
+  llvm::SmallString<128> tmp_path;
+  int fd;
+  auto ec{llvm::sys::fs::createUniqueFile(path + "-%%%%%%%%", fd, tmp_path)};
+  CHECK_THROW(!ec) << "Cannot write " << path << ": " << ec.message();
+  {
+    llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+    os << llvm::json::Value(ToJSON()) << '\n';
+  }
+  ec = llvm::sys::fs::rename(tmp_path, path);
+  if (ec) {
+    llvm::sys::fs::remove(tmp_path);
+    THROW() << "Cannot write " << path << ": " << ec.message();
+  }
+}
+
+}  // namespace rellic
@@ -0,0 +1,260 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/PassRegistry.h"
+
+#include <cctype>
+
+#include "rellic/AST/CondBasedRefine.h"
+#include "rellic/AST/DeadStmtElim.h"
+#include "rellic/AST/ExprCombine.h"
+#include "rellic/AST/FusedPass.h"
+#include "rellic/AST/LocalDeclRenamer.h"
+#include "rellic/AST/LoopRefine.h"
+#include "rellic/AST/MaterializeConds.h"
+#include "rellic/AST/NestedCondProp.h"
+#include "rellic/AST/NestedScopeCombine.h"
+#include "rellic/AST/ReachBasedRefine.h"
+#include "rellic/AST/StructFieldRenamer.h"
+#include "rellic/AST/Z3CondSimplify.h"
+#include "rellic/Exception.h"
+
+namespace rellic {
+
+const std::vector<PassInfo> &GetRegisteredPasses() {
+  static const std::vector<PassInfo> passes{
+      {"cbr", "Condition-based refinement", false},
+      {"dse", "Dead statement elimination", false},
+      {"ec", "Expression combination", false},
+      {"ldr", "Local declaration renaming", true},
+      {"lr", "Loop refinement", false},
+      {"mc", "Condition materialization", false},
+      {"ncp", "Nested condition propagation", false},
+      {"nsc", "Nested scope combination", false},
+      {"rbr", "Reach-based refinement", false},
+      {"sfr", "Struct field renaming", true},
+      {"zcs", "Z3-based condition simplification", false},
+  };
+  return passes;
+}
+
+std::unique_ptr<ASTPass> CreatePass(const std::string &name,
+                                    DecompilationContext &dec_ctx,
+                                    DebugInfoCollector *dic) {
+  if (name == "cbr") {
+    return std::make_unique<CondBasedRefine>(dec_ctx);
+  } else if (name == "dse") {
+    return std::make_unique<DeadStmtElim>(dec_ctx);
+  } else if (name == "ec") {
+    return std::make_unique<ExprCombine>(dec_ctx);
+  } else if (name == "ldr" && dic) {
+    return std::make_unique<LocalDeclRenamer>(dec_ctx, *dic);
+  } else if (name == "lr") {
+    return std::make_unique<LoopRefine>(dec_ctx);
+  } else if (name == "mc") {
+    return std::make_unique<MaterializeConds>(dec_ctx);
+  } else if (name == "ncp") {
+    return std::make_unique<NestedCondProp>(dec_ctx);
+  } else if (name == "nsc") {
+    return std::make_unique<NestedScopeCombine>(dec_ctx);
+  } else if (name == "rbr") {
+    return std::make_unique<ReachBasedRefine>(dec_ctx);
+  } else if (name == "sfr" && dic) {
+    return std::make_unique<StructFieldRenamer>(dec_ctx, *dic);
+  } else if (name == "zcs") {
+    return std::make_unique<Z3CondSimplify>(dec_ctx);
+  }
+  return nullptr;
+}
+
+namespace {
+bool IsRegistered(const std::string &name) {
+  for (auto &pass : GetRegisteredPasses()) {
+    if (name == pass.name) {
+      return true;
+    }
+  }
+  return false;
+}
+
+class PipelineParser {
+  const std::string &spec;
+  size_t pos{0};
+  DecompilationContext &dec_ctx;
+  DebugInfoCollector *dic;
+  const std::unordered_set<std::string> &excluded;
+  std::unordered_set<std::string> &names;
+
+  void SkipSpaces() {
+    while (pos < spec.size() &&
+           std::isspace(static_cast<unsigned char>(spec[pos]))) {
+      ++pos;
+    }
+  }
+
+  bool Consume(char c) {
+    SkipSpaces();
+    if (pos < spec.size() && spec[pos] == c) {
+      ++pos;
+      return true;
+    }
+    return false;
+  }
+
+  std::string ParseName() {
+    SkipSpaces();
+    auto start{pos};
+    while (pos < spec.size() &&
+           (std::isalnum(static_cast<unsigned char>(spec[pos])) ||
+            spec[pos] == '_')) {
+      ++pos;
+    }
+    CHECK_THROW(pos != start) << "Expected a pass name at offset " << start
+                              << " of pipeline '" << spec << "'";
+    return spec.substr(start, pos - start);
+  }
+
+ public:
+  PipelineParser(const std::string &spec, DecompilationContext &dec_ctx,
+                 DebugInfoCollector *dic,
+                 const std::unordered_set<std::string> &excluded,
+                 std::unordered_set<std::string> &names)
+      : spec(spec),
+        dec_ctx(dec_ctx),
+        dic(dic),
+        excluded(excluded),
+        names(names) {}
+
+  bool AtEnd() {
+    SkipSpaces();
+    return pos == spec.size();
+  }
+
+  std::unique_ptr<ASTPass> ParsePass(const std::string &name) {
+    names.insert(name);
+    if (excluded.count(name)) {
+      return nullptr;
+    }
+    auto pass{CreatePass(name, dec_ctx, dic)};
+    CHECK_THROW(pass || !IsRegistered(name))
+        << "Pass '" << name << "' needs debug information";
+    CHECK_THROW(pass) << "Unknown pass '" << name << "' in pipeline '" << spec
+                      << "'";
+    return pass;
+  }
+
+  // fused := name (',' name)*
+  void ParseFused(std::vector<std::unique_ptr<ASTPass>> &passes) {
+    std::vector<std::unique_ptr<ASTPass>> fused;
+    do {
+      auto name{ParseName()};
+      auto pass{ParsePass(name)};
+      if (!pass) {
+        continue;
+      }
+      CHECK_THROW(dynamic_cast<LocalRewrite *>(pass.get()))
+          << "Pass '" << name << "' cannot be fused in pipeline '" << spec
+          << "'";
+      fused.push_back(std::move(pass));
+    } while (Consume(','));
+
+    if (fused.size() == 1) {
+      passes.push_back(std::move(fused.front()));
+    } else if (!fused.empty()) {
+      auto fused_pass{std::make_unique<FusedPass>(dec_ctx)};
+      for (auto &pass : fused) {
+        fused_pass->Add(std::move(pass));
+      }
+      passes.push_back(std::move(fused_pass));
+    }
+  }
+
+  // group := item (',' item)*
+  // item  := name | 'fix' '(' group ')' | 'fuse' '(' fused ')'
+  void ParseGroup(std::vector<std::unique_ptr<ASTPass>> &passes) {
+    do {
+      SkipSpaces();
+      auto start{pos};
+      auto name{ParseName()};
+      if (name == "fuse" && Consume('(')) {
+        ParseFused(passes);
+        CHECK_THROW(Consume(')'))
+            << "Expected ')' at offset " << pos << " of pipeline '" << spec
+            << "'";
+        continue;
+      }
+      if (name == "fix" && Consume('(')) {
+        auto fix{std::make_unique<FixpointASTPass>(dec_ctx)};
+        ParseGroup(fix->GetPasses());
+        CHECK_THROW(Consume(')'))
+            << "Expected ')' at offset " << pos << " of pipeline '" << spec
+            << "'";
+        fix->SetDescription(spec.substr(start, pos - start));
+        if (!fix->GetPasses().empty()) {
+          passes.push_back(std::move(fix));
+        }
+        continue;
+      }
+
+      if (auto pass = ParsePass(name)) {
+        passes.push_back(std::move(pass));
+      }
+    } while (Consume(','));
+  }
+
+  // pipeline := group (';' group)*
+  void ParsePipeline(std::vector<std::unique_ptr<ASTPass>> &groups) {
+    do {
+      auto group{std::make_unique<CompositeASTPass>(dec_ctx)};
+      ParseGroup(group->GetPasses());
+      groups.push_back(std::move(group));
+    } while (Consume(';'));
+    CHECK_THROW(AtEnd()) << "Unexpected character at offset " << pos
+                         << " of pipeline '" << spec << "'";
+  }
+};
+}  // namespace
+
+std::unique_ptr<Pipeline> Pipeline::Parse(
+    const std::string &spec, DecompilationContext &dec_ctx,
+    DebugInfoCollector *dic, const std::unordered_set<std::string> &excluded) {
+  auto pipeline{std::make_unique<Pipeline>(dec_ctx)};
+  PipelineParser parser{spec, dec_ctx, dic, excluded, pipeline->names};
+  parser.ParsePipeline(pipeline->groups);
+  return pipeline;
+}
+
+void Pipeline::StopImpl() {
+  for (auto &group : groups) {
+    group->Stop();
+  }
+}
+
+void Pipeline::RunImpl() {
+  for (auto &group : groups) {
+    if (Stopped()) {
+      break;
+    }
+    group->SetScope(scope);
+    changed |= group->Run();
+    auto &group_modified{group->GetModified()};
+    modified.insert(group_modified.begin(), group_modified.end());
+    untracked |= group->HasUntrackedChanges();
+    dec_ctx.CompactZExprs();
+  }
+}
+
+std::string GetDefaultPipeline() {
+  return "dse,ldr,sfr;"
+         "fix(zcs,ncp,fuse(nsc,cbr,rbr));"
+         "fix(lr,ncp,nsc);"
+         "fix(zcs,ncp,nsc);"
+         "mc,ec";
+}
+
+}  // namespace rellic
@@ -10,55 +10,119 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <llvm/ADT/ArrayRef.h>
 
-#include "rellic/AST/Util.h"
+#include <algorithm>
+#include <iterator>
+#include <limits>
+
+#include "rellic/Log.h"
 
 namespace rellic {
 
 ReachBasedRefine::ReachBasedRefine(DecompilationContext &dec_ctx)
-    : TransformVisitor<ReachBasedRefine>(dec_ctx) {}
+    : LocalRewriteVisitor<ReachBasedRefine>(dec_ctx),
+      chain_solver(dec_ctx.z3_ctx),
+      reach(dec_ctx.z3_ctx.bool_val(false)) {}
 
-bool ReachBasedRefine::VisitCompoundStmt(clang::CompoundStmt *compound) {
-  std::vector<clang::Stmt *> body{compound->body_begin(), compound->body_end()};
-  std::vector<clang::IfStmt *> ifs;
-  z3::expr_vector conds{dec_ctx.z3_ctx};
+void ReachBasedRefine::ResetChain() {
+  if (chain_open) {
+    chain_solver.pop();
+  }
+  chain_solver.push();
+  chain_open = true;
+  reach = dec_ctx.z3_ctx.bool_val(false);
+}
 
-  auto ResetChain = [&]() {
-    ifs.clear();
-    conds.resize(0);
-  };
+void ReachBasedRefine::ExtendChain(z3::expr cond) {
+  auto &ctx{dec_ctx.z3_ctx};
+  z3::expr next{ctx, Z3_mk_fresh_const(ctx, "reach", ctx.bool_sort())};
+  chain_solver.add(next == (reach || cond));
+  reach = next;
+}
 
-  bool done_something{false};
-  for (size_t i{0}; i < body.size() && !done_something; ++i) {
-    auto if_stmt{clang::dyn_cast<clang::IfStmt>(body[i])};
-    if (!if_stmt) {
-      ResetChain();
-      continue;
+bool ReachBasedRefine::IsUnsat(z3::expr expr) {
+  if (dec_ctx.OutOfBudget() || dec_ctx.syntactic_conditions) {
+    return false;
+  }
+
+  auto check{z3::unknown};
+  {
+    DecompilationContext::Z3Query query{dec_ctx};
+    if (query.Cancelled()) {
+      return false;
+    }
+    chain_solver.push();
+    try {
+      chain_solver.add(expr);
+      check = chain_solver.check();
+    } catch (z3::exception &) {
+      // Treated as undecided, like a query that ran out of time
     }
+    chain_solver.pop();
+  }
+  if (check == z3::unknown && dec_ctx.Cancelled()) {
+    ++dec_ctx.z3_cache.interrupts;
+  } else if (check == z3::unknown && dec_ctx.z3_timeout) {
+    ++dec_ctx.z3_cache.timeouts;
+  }
+  return check == z3::unsat;
+}
 
-    ifs.push_back(if_stmt);
-    auto cond{dec_ctx.z3_exprs[dec_ctx.conds[if_stmt]]};
+clang::Stmt *ReachBasedRefine::Rewrite(clang::Stmt *stmt) {
+  auto compound{clang::dyn_cast<clang::CompoundStmt>(stmt)};
+  if (!compound) {
+    return stmt;
+  }
+  // Chains are made of at least three `if` statements without `else`
+  auto body{compound->body()};
+  auto num_ifs{std::count_if(body.begin(), body.end(), [](clang::Stmt *stmt) {
+    auto if_stmt{clang::dyn_cast<clang::IfStmt>(stmt)};
+    return if_stmt && !if_stmt->getElse();
+  })};
+  if (num_ifs < 3) {
+    return compound;
+  }
+
+  // The statements are only copied once a chain is linked
+  llvm::ArrayRef<clang::Stmt *> stmts{compound->body_begin(),
+                                      compound->body_end()};
+  auto new_body{buffers.Get()};
 
-    if (if_stmt->getElse()) {
+  auto StartChain = [&]() {
+    // Nothing was added to the chain since it was last reset
+    if (chain_open && ifs.empty()) {
+      return;
+    }
+    ifs.clear();
+    ResetChain();
+  };
+  StartChain();
+
+  // Every chain in the compound is linked in a single visit, and each `if`
+  // costs a constant number of incremental queries
+  bool done_something{false};
+  for (size_t i{0}; i < stmts.size() && !Stopped(); ++i) {
+    auto if_stmt{clang::dyn_cast<clang::IfStmt>(stmts[i])};
+    if (!if_stmt || if_stmt->getElse()) {
       // We cannot link `if` statements that contain `else` branches
-      ResetChain();
+      StartChain();
       continue;
     }
 
-    // Is the current `if` statement unreachable from all the others?
-    bool is_unreachable{Prove(HeavySimplify(!(cond && z3::mk_or(conds))))};
+    auto cond{dec_ctx.z3_exprs[dec_ctx.conds[if_stmt]]};
 
-    if (!is_unreachable) {
-      ResetChain();
-      continue;
+    // Is the current `if` statement unreachable from all the others? If not,
+    // a new chain may still start from it
+    if (!ifs.empty() && !IsUnsat(cond && reach)) {
+      StartChain();
     }
 
-    conds.push_back(cond);
+    ifs.push_back(if_stmt);
+    ExtendChain(cond);
 
     // Do the collected statements cover all possibilities?
-    auto is_complete{Prove(HeavySimplify(z3::mk_or(conds)))};
-
-    if (ifs.size() <= 2 || !is_complete) {
+    if (ifs.size() <= 2 || !IsUnsat(!reach)) {
       // We need to collect more statements
       continue;
     }
@@ -120,21 +184,41 @@ bool ReachBasedRefine::VisitCompoundStmt(clang::CompoundStmt *compound) {
     */
     size_t start_delete{i - (ifs.size() - 2)};
     size_t end_delete{i};
-    body.erase(body.erase(std::next(body.begin(), start_delete),
-                          std::next(body.begin(), end_delete)));
-    done_something = true;
+    if (!done_something) {
+      new_body->assign(stmts.begin(), stmts.end());
+      done_something = true;
+    }
+    new_body->erase(new_body->erase(std::next(new_body->begin(), start_delete),
+                                    std::next(new_body->begin(), end_delete)));
+    stmts = *new_body;
+
+    // Resume right after the statement the chain was linked into
+    i = start_delete - 1;
+    StartChain();
+  }
+
+  if (chain_open) {
+    chain_solver.pop();
+    chain_open = false;
   }
 
   if (done_something) {
-    substitutions[compound] = dec_ctx.ast.CreateCompoundStmt(body);
+    return dec_ctx.ast.CreateCompoundStmt(*new_body);
   }
-  return !Stopped();
+  return compound;
+}
+
+void ReachBasedRefine::Prepare() {
+  z3::params params{dec_ctx.z3_ctx};
+  params.set("timeout", dec_ctx.z3_timeout
+                            ? dec_ctx.z3_timeout
+                            : std::numeric_limits<unsigned>::max());
+  chain_solver.set(params);
 }
 
 void ReachBasedRefine::RunImpl() {
-  LOG(INFO) << "Reachability-based refinement";
-  TransformVisitor<ReachBasedRefine>::RunImpl();
-  TraverseDecl(dec_ctx.ast_ctx.getTranslationUnitDecl());
+  RELLIC_LOG(Passes) << "Reachability-based refinement";
+  LocalRewriteVisitor<ReachBasedRefine>::RunImpl();
 }
 
 }  // namespace rellic
\ No newline at end of file
@@ -0,0 +1,599 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/Snapshot.h"
+
+#include <clang/AST/ASTImporter.h>
+#include <clang/AST/Decl.h>
+#include <clang/Basic/DiagnosticOptions.h>
+#include <clang/Basic/FileSystemOptions.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Serialization/PCHContainerOperations.h>
+#include <glog/logging.h>
+#include <llvm/AsmParser/Parser.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/TypeFinder.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <limits>
+#include <unordered_set>
+#include <vector>
+
+#include "rellic/AST/ASTUnitFactory.h"
+#include "rellic/AST/Util.h"
+#include "rellic/BC/Util.h"
+#include "rellic/Exception.h"
+
+namespace rellic {
+
+// Version of the format of `<prefix>.json`
+static constexpr int64_t kSnapshotVersion{1};
+
+namespace {
+// Names the values that declarations and statements can come from: global
+// values by position, since they may be unnamed, constants in the initializers
+// of global variables by their operand path, and arguments, blocks,
+// instructions and other operands by their position in the function, itself
+// identified by position.
+class ModuleValueNames {
+  std::unordered_map<llvm::Value *, std::string> names;
+  std::unordered_map<std::string, llvm::Value *> values;
+
+  void Add(llvm::Value *val, std::string name) {
+    if (names.emplace(val, name).second) {
+      values.emplace(std::move(name), val);
+    }
+  }
+
+  void AddConstant(llvm::Constant *c, const std::string &name) {
+    if (llvm::isa<llvm::GlobalValue>(c) || names.count(c)) {
+      return;
+    }
+    Add(c, name);
+    for (unsigned i{0}; i < c->getNumOperands(); ++i) {
+      if (auto op = llvm::dyn_cast<llvm::Constant>(c->getOperand(i))) {
+        AddConstant(op, name + ":" + std::to_string(i));
+      }
+    }
+  }
+
+ public:
+  ModuleValueNames(llvm::Module &module) {
+    unsigned idx{0};
+    for (auto &gv : module.global_values()) {
+      Add(&gv, "v" + std::to_string(idx++));
+    }
+
+    idx = 0;
+    for (auto &gv : module.global_values()) {
+      auto prefix{std::to_string(idx++)};
+      auto var{llvm::dyn_cast<llvm::GlobalVariable>(&gv)};
+      if (var && var->hasInitializer()) {
+        AddConstant(var->getInitializer(), "c" + prefix);
+      }
+      auto func{llvm::dyn_cast<llvm::Function>(&gv)};
+      if (!func) {
+        continue;
+      }
+      for (auto &arg : func->args()) {
+        Add(&arg, prefix + "a" + std::to_string(arg.getArgNo()));
+      }
+      auto block_idx{0U};
+      for (auto &block : *func) {
+        Add(&block, prefix + "b" + std::to_string(block_idx++));
+      }
+      std::vector<llvm::Instruction *> insts;
+      for (auto &inst : llvm::instructions(*func)) {
+        Add(&inst, prefix + "i" + std::to_string(insts.size()));
+        insts.push_back(&inst);
+      }
+      for (size_t i{0}; i < insts.size(); ++i) {
+        for (auto &op : insts[i]->operands()) {
+          Add(op.get(), prefix + "o" + std::to_string(i) + ":" +
+                            std::to_string(op.getOperandNo()));
+        }
+      }
+    }
+  }
+
+  std::string GetName(llvm::Value *val) const {
+    auto it{names.find(val)};
+    return it == names.end() ? "" : it->second;
+  }
+
+  llvm::Value *GetValue(llvm::StringRef name) const {
+    auto it{values.find(name.str())};
+    CHECK_THROW(it != values.end()) << "Unknown value " << name.str();
+    return it->second;
+  }
+};
+
+// Names types as they are printed, except identified structs without a name,
+// which the printer only tells apart within a single module. These are named
+// by their position among the types of the module instead.
+class ModuleTypeNames {
+  llvm::Module &module;
+  std::vector<llvm::StructType *> unnamed;
+  std::unordered_map<llvm::StructType *, size_t> unnamed_idx;
+
+ public:
+  ModuleTypeNames(llvm::Module &module) : module(module) {
+    llvm::TypeFinder finder;
+    finder.run(module, /*onlyNamed=*/false);
+    for (auto type : finder) {
+      if (!type->isLiteral() && !type->hasName()) {
+        unnamed_idx[type] = unnamed.size();
+        unnamed.push_back(type);
+      }
+    }
+  }
+
+  std::string GetName(llvm::Type *type) const {
+    auto strct{llvm::dyn_cast<llvm::StructType>(type)};
+    auto it{strct ? unnamed_idx.find(strct) : unnamed_idx.end()};
+    if (it != unnamed_idx.end()) {
+      return "#" + std::to_string(it->second);
+    }
+    return LLVMThingToString(type);
+  }
+
+  // Returns null if `name` cannot be parsed
+  llvm::Type *GetType(llvm::StringRef name) const {
+    size_t idx;
+    if (name.consume_front("#")) {
+      CHECK_THROW(!name.getAsInteger(10, idx) && idx < unnamed.size())
+          << "Unknown type #" << name.str();
+      return unnamed[idx];
+    }
+    llvm::SMDiagnostic err;
+    return llvm::parseType(name, err, module);
+  }
+};
+}  // namespace
+
+// Same as the names `GenerateAST` gives to the variables of conditions
+static std::string GetVarName(llvm::Value *v) {
+  std::string s{"h"};
+  llvm::raw_string_ostream os(s);
+  os.write_hex((unsigned long long)v);
+  return s;
+}
+
+// The statement tree of a top-level declaration, in any copy of it
+static clang::Stmt *GetRoot(clang::Decl *decl) {
+  if (auto fdecl = clang::dyn_cast<clang::FunctionDecl>(decl)) {
+    return fdecl->doesThisDeclarationHaveABody() ? fdecl->getBody() : nullptr;
+  }
+  if (auto var = clang::dyn_cast<clang::VarDecl>(decl)) {
+    return var->getInit();
+  }
+  return nullptr;
+}
+
+static size_t CountStmts(clang::Stmt *stmt) {
+  size_t res{1};
+  for (auto child : stmt->children()) {
+    if (child) {
+      res += CountStmts(child);
+    }
+  }
+  return res;
+}
+
+// Points the children of `stmt` that were the marker expression before saving
+// back to `marker`. Serialization does not preserve sharing across statement
+// trees, so each tree has its own copy of it. `pos` is the position of `stmt`
+// in the order of `EnumerateStmts`.
+static void RestoreMarkers(clang::Stmt *stmt, size_t &pos,
+                           const std::unordered_set<size_t> &markers,
+                           clang::Expr *marker) {
+  ++pos;
+  for (auto &child : stmt->children()) {
+    if (!child) {
+      continue;
+    }
+    if (markers.count(pos)) {
+      pos += CountStmts(child);
+      child = marker;
+    } else {
+      RestoreMarkers(child, pos, markers, marker);
+    }
+  }
+}
+
+// Collects the subformulas of `expr` that stand for a branch or switch
+// condition
+static void CollectTerms(const z3::expr &expr, DecompilationContext &dec_ctx,
+                         std::unordered_set<unsigned> &seen,
+                         z3::expr_vector &terms) {
+  if (!seen.insert(expr.id()).second) {
+    return;
+  }
+  if (dec_ctx.z3_br_edges_inv.count(expr.id()) ||
+      dec_ctx.z3_sw_vars_inv.count(expr.id())) {
+    terms.push_back(expr);
+  }
+  if (expr.is_app()) {
+    for (unsigned i{0}; i < expr.num_args(); ++i) {
+      CollectTerms(expr.arg(i), dec_ctx, seen, terms);
+    }
+  }
+}
+
+void SaveSnapshot(llvm::Module &module, DecompilationContext &dec_ctx,
+                  const std::string &path) {
+  llvm::TimeTraceScope trace("SaveSnapshot");
+  auto tudecl{dec_ctx.ast_ctx.getTranslationUnitDecl()};
+  std::vector<clang::Decl *> decls;
+  EnumerateDecls(tudecl, decls);
+  auto decl_idx{Invert(decls)};
+  std::vector<clang::Stmt *> stmts;
+  for (auto decl : tudecl->decls()) {
+    if (!decl->isImplicit()) {
+      EnumerateStmts(GetRoot(decl), stmts);
+    }
+  }
+  auto stmt_idx{Invert(stmts)};
+  ModuleValueNames names{module};
+  ModuleTypeNames type_names{module};
+
+  llvm::json::Array json_types;
+  for (auto [type, decl] : dec_ctx.type_decls) {
+    auto it{decl_idx.find(decl)};
+    if (decl && it != decl_idx.end()) {
+      json_types.push_back(
+          llvm::json::Array{type_names.GetName(type), it->second});
+    }
+  }
+
+  llvm::json::Array json_values;
+  for (auto [val, decl] : dec_ctx.value_decls) {
+    auto it{decl_idx.find(decl)};
+    auto name{names.GetName(val)};
+    if (decl && it != decl_idx.end() && !name.empty()) {
+      json_values.push_back(llvm::json::Array{name, it->second});
+    }
+  }
+
+  llvm::json::Array json_temps;
+  for (auto [arg, decl] : dec_ctx.temp_decls) {
+    auto it{decl_idx.find(decl)};
+    if (decl && it != decl_idx.end()) {
+      json_temps.push_back(llvm::json::Array{names.GetName(arg), it->second});
+    }
+  }
+
+  llvm::json::Array json_degraded;
+  for (auto fdecl : dec_ctx.degraded_functions) {
+    auto it{decl_idx.find(fdecl)};
+    if (it != decl_idx.end()) {
+      json_degraded.push_back(it->second);
+    }
+  }
+
+  llvm::json::Array json_stmts;
+  for (auto [stmt, val] : dec_ctx.stmt_provenance) {
+    auto it{stmt_idx.find(stmt)};
+    auto name{val ? names.GetName(val) : ""};
+    if (it != stmt_idx.end() && !name.empty()) {
+      json_stmts.push_back(llvm::json::Array{it->second, name});
+    }
+  }
+
+  llvm::json::Array json_uses;
+  for (auto [expr, use] : dec_ctx.use_provenance) {
+    auto it{stmt_idx.find(expr)};
+    auto user{use ? names.GetName(use->getUser()) : ""};
+    if (it != stmt_idx.end() && !user.empty()) {
+      json_uses.push_back(
+          llvm::json::Array{it->second, user, use->getOperandNo()});
+    }
+  }
+
+  llvm::json::Array json_conds;
+  for (auto [stmt, idx] : dec_ctx.conds) {
+    auto it{stmt_idx.find(stmt)};
+    if (it != stmt_idx.end()) {
+      json_conds.push_back(llvm::json::Array{it->second, idx});
+    }
+  }
+
+  llvm::json::Array json_markers;
+  for (size_t i{0}; i < stmts.size(); ++i) {
+    if (stmts[i] == dec_ctx.marker_expr) {
+      json_markers.push_back(i);
+    }
+  }
+
+  // Formulas are written as the assertions of an SMT-LIB script, followed by
+  // the terms the inverse maps refer to. Terms that are not boolean are
+  // wrapped in a trivial equality.
+  auto &exprs{dec_ctx.z3_exprs};
+  z3::expr_vector terms{dec_ctx.z3_ctx};
+  std::unordered_set<unsigned> seen;
+  for (unsigned i{0}; i < exprs.size(); ++i) {
+    CollectTerms(exprs[i], dec_ctx, seen, terms);
+  }
+  z3::solver script{dec_ctx.z3_ctx};
+  llvm::json::Array json_wrapped;
+  auto Assert{[&](const z3::expr &expr, size_t idx) {
+    if (expr.is_bool()) {
+      script.add(expr);
+    } else {
+      script.add(expr == expr);
+      json_wrapped.push_back(idx);
+    }
+  }};
+  for (unsigned i{0}; i < exprs.size(); ++i) {
+    Assert(exprs[i], i);
+  }
+  llvm::json::Array json_terms;
+  for (unsigned i{0}; i < terms.size(); ++i) {
+    Assert(terms[i], exprs.size() + i);
+    auto br{dec_ctx.z3_br_edges_inv.find(terms[i].id())};
+    llvm::Value *inst{br != dec_ctx.z3_br_edges_inv.end()
+                          ? br->second.first
+                          : dec_ctx.z3_sw_vars_inv[terms[i].id()]};
+    json_terms.push_back(names.GetName(inst));
+  }
+
+  llvm::json::Object map{
+      {"version", kSnapshotVersion},
+      {"types", std::move(json_types)},
+      {"values", std::move(json_values)},
+      {"temps", std::move(json_temps)},
+      {"degraded", std::move(json_degraded)},
+      {"stmts", std::move(json_stmts)},
+      {"uses", std::move(json_uses)},
+      {"conds", std::move(json_conds)},
+      {"markers", std::move(json_markers)},
+      {"exprs", script.to_smt2()},
+      {"num_exprs", exprs.size()},
+      {"wrapped", std::move(json_wrapped)},
+      {"terms", std::move(json_terms)},
+      {"simplified", dec_ctx.z3_simplified},
+      {"literal_structs", dec_ctx.num_literal_structs},
+      {"declared_structs", dec_ctx.num_declared_structs},
+  };
+
+  // The map is written last, so that it is never found without the rest
+  std::error_code ec;
+  {
+    llvm::raw_fd_ostream os(path + ".bc", ec);
+    CHECK_THROW(!ec) << "Cannot write " << path << ".bc: " << ec.message();
+    llvm::WriteBitcodeToFile(module, os);
+  }
+  CHECK_THROW(!dec_ctx.ast_unit.Save(path + ".ast"))
+      << "Cannot write " << path << ".ast";
+  llvm::raw_fd_ostream os(path + ".json", ec);
+  CHECK_THROW(!ec) << "Cannot write " << path << ".json: " << ec.message();
+  os << llvm::json::Value(std::move(map));
+}
+
+Snapshot LoadSnapshot(llvm::LLVMContext &llvm_ctx, const std::string &path) {
+  llvm::TimeTraceScope trace("LoadSnapshot");
+  auto buffer{llvm::MemoryBuffer::getFile(path + ".json")};
+  CHECK_THROW(buffer) << "Cannot read " << path << ".json: "
+                      << buffer.getError().message();
+  auto json{llvm::json::parse(buffer.get()->getBuffer())};
+  if (!json) {
+    THROW() << "Malformed snapshot " << path
+            << ".json: " << llvm::toString(json.takeError());
+  }
+  auto map{json->getAsObject()};
+  CHECK_THROW(map) << "Malformed snapshot " << path << ".json";
+  CHECK_THROW(map->getInteger("version") == kSnapshotVersion)
+      << "Unsupported snapshot version";
+
+  Snapshot snapshot;
+  snapshot.module.reset(
+      LoadModuleFromFile(&llvm_ctx, path + ".bc", /*allow_failure=*/true));
+  CHECK_THROW(snapshot.module) << "Cannot load " << path << ".bc";
+  auto &module{*snapshot.module};
+
+  static clang::PCHContainerOperations pch_ops;
+  auto diags{clang::CompilerInstance::createDiagnostics(
+      new clang::DiagnosticOptions())};
+  auto cached{clang::ASTUnit::LoadFromASTFile(
+      path + ".ast", pch_ops.getRawReader(), clang::ASTUnit::LoadEverything,
+      diags, clang::FileSystemOptions())};
+  CHECK_THROW(cached) << "Cannot load " << path << ".ast";
+
+  snapshot.ast_unit = ASTUnitFactory::Get().Create(module.getTargetTriple());
+  snapshot.dec_ctx =
+      std::make_unique<DecompilationContext>(*snapshot.ast_unit);
+  auto &ctx{*snapshot.dec_ctx};
+  clang::ASTImporter importer(ctx.ast_ctx, snapshot.ast_unit->getFileManager(),
+                              cached->getASTContext(), cached->getFileManager(),
+                              /*MinimalImport=*/false);
+  auto Import = [&](clang::Decl *decl) {
+    auto res{importer.Import(decl)};
+    if (!res) {
+      THROW() << "Cannot import declaration: "
+              << llvm::toString(res.takeError());
+    }
+    return *res;
+  };
+
+  auto json_markers{map->getArray("markers")};
+  CHECK_THROW(json_markers) << "Missing markers";
+  std::unordered_set<size_t> markers;
+  for (auto &idx : *json_markers) {
+    markers.insert(GetJSONIndex(idx, std::numeric_limits<size_t>::max()));
+  }
+
+  // Declarations are imported in order so that the translation unit is
+  // printed the same way
+  auto tudecl{cached->getASTContext().getTranslationUnitDecl()};
+  std::vector<clang::Decl *> decls;
+  EnumerateDecls(tudecl, decls);
+  std::vector<clang::Stmt *> stmts;
+  std::unordered_map<clang::Stmt *, clang::Stmt *> imported;
+  for (auto decl : tudecl->decls()) {
+    if (decl->isImplicit()) {
+      continue;
+    }
+    auto to_decl{Import(decl)};
+    auto from_root{GetRoot(decl)};
+    if (!from_root) {
+      continue;
+    }
+    auto pos{stmts.size()};
+    auto to_root{GetRoot(to_decl)};
+    EnumerateStmts(from_root, stmts);
+    ZipStmts(from_root, to_root, imported);
+    RestoreMarkers(to_root, pos, markers, ctx.marker_expr);
+  }
+  auto ImportDecl = [&](const llvm::json::Value &idx) {
+    return Import(decls[GetJSONIndex(idx, decls.size())]);
+  };
+  auto ImportedStmt = [&](const llvm::json::Value &idx) {
+    auto stmt{imported[stmts[GetJSONIndex(idx, stmts.size())]]};
+    CHECK_THROW(stmt) << "Statement was not imported";
+    return stmt;
+  };
+
+  ModuleValueNames names{module};
+  ModuleTypeNames type_names{module};
+  for (auto &entry : GetJSONEntries(*map, "types")) {
+    auto &arr{*entry.getAsArray()};
+    CHECK_THROW(arr.size() == 2) << "Malformed type entry";
+    auto type{type_names.GetType(GetJSONString(arr[0]))};
+    if (!type) {
+      LOG(WARNING) << "Cannot restore the declaration of type "
+                   << GetJSONString(arr[0]).str();
+      continue;
+    }
+    ctx.type_decls[type] = clang::cast<clang::TypeDecl>(ImportDecl(arr[1]));
+  }
+  // Types created before refer to the declarations that were replaced
+  ctx.qual_types.clear();
+  ctx.type_provider->ClearCache();
+
+  for (auto &entry : GetJSONEntries(*map, "values")) {
+    auto &arr{*entry.getAsArray()};
+    CHECK_THROW(arr.size() == 2) << "Malformed value entry";
+    ctx.value_decls[names.GetValue(GetJSONString(arr[0]))] =
+        clang::cast<clang::ValueDecl>(ImportDecl(arr[1]));
+  }
+
+  for (auto &entry : GetJSONEntries(*map, "temps")) {
+    auto &arr{*entry.getAsArray()};
+    CHECK_THROW(arr.size() == 2) << "Malformed temporary entry";
+    auto arg{llvm::dyn_cast<llvm::Argument>(
+        names.GetValue(GetJSONString(arr[0])))};
+    CHECK_THROW(arg) << "Temporary of a value that is not an argument";
+    ctx.temp_decls[arg] = clang::cast<clang::VarDecl>(ImportDecl(arr[1]));
+  }
+
+  auto degraded{map->getArray("degraded")};
+  CHECK_THROW(degraded) << "Missing degraded";
+  for (auto &idx : *degraded) {
+    ctx.degraded_functions.insert(
+        clang::cast<clang::FunctionDecl>(ImportDecl(idx)));
+  }
+
+  for (auto &entry : GetJSONEntries(*map, "stmts")) {
+    auto &arr{*entry.getAsArray()};
+    CHECK_THROW(arr.size() == 2) << "Malformed statement entry";
+    ctx.stmt_provenance[ImportedStmt(arr[0])] =
+        names.GetValue(GetJSONString(arr[1]));
+  }
+
+  for (auto &entry : GetJSONEntries(*map, "uses")) {
+    auto &arr{*entry.getAsArray()};
+    CHECK_THROW(arr.size() == 3) << "Malformed use entry";
+    auto expr{clang::dyn_cast<clang::Expr>(ImportedStmt(arr[0]))};
+    CHECK_THROW(expr) << "Use provenance on a statement";
+    auto user{llvm::dyn_cast<llvm::User>(
+        names.GetValue(GetJSONString(arr[1])))};
+    CHECK_THROW(user) << "Use of a value that is not a user";
+    ctx.use_provenance[expr] =
+        &user->getOperandUse(GetJSONIndex(arr[2], user->getNumOperands()));
+  }
+
+  // Variables are named after the instruction they stand for, which has a
+  // different address in this process
+  auto num_exprs{map->getInteger("num_exprs")};
+  auto smt{map->getString("exprs")};
+  auto json_terms{map->getArray("terms")};
+  auto wrapped{map->getArray("wrapped")};
+  CHECK_THROW(num_exprs && smt && json_terms && wrapped)
+      << "Missing conditions";
+  z3::expr_vector parsed{ctx.z3_ctx};
+  try {
+    parsed = ctx.z3_ctx.parse_string(smt->str().c_str());
+  } catch (z3::exception &ex) {
+    THROW() << "Malformed conditions: " << ex.msg();
+  }
+  CHECK_THROW(*num_exprs >= 0 &&
+              parsed.size() == *num_exprs + json_terms->size())
+      << "Mismatched number of conditions";
+  std::vector<z3::expr> exprs;
+  for (unsigned i{0}; i < parsed.size(); ++i) {
+    exprs.push_back(parsed[i]);
+  }
+  for (auto &idx : *wrapped) {
+    auto &expr{exprs[GetJSONIndex(idx, exprs.size())]};
+    expr = expr.arg(0);
+  }
+
+  z3::expr_vector from{ctx.z3_ctx};
+  z3::expr_vector to{ctx.z3_ctx};
+  std::vector<llvm::Value *> term_insts;
+  for (size_t i{0}; i < json_terms->size(); ++i) {
+    auto inst{names.GetValue(GetJSONString((*json_terms)[i]))};
+    CHECK_THROW(llvm::isa<llvm::BranchInst>(inst) ||
+                llvm::isa<llvm::SwitchInst>(inst))
+        << "Condition of a value that is not a branch";
+    term_insts.push_back(inst);
+    auto &term{exprs[*num_exprs + i]};
+    if (term.is_const() && term.decl().decl_kind() == Z3_OP_UNINTERPRETED) {
+      from.push_back(term);
+      to.push_back(ctx.z3_ctx.constant(GetVarName(inst).c_str(),
+                                       term.get_sort()));
+    }
+  }
+  for (auto &expr : exprs) {
+    expr = expr.substitute(from, to);
+  }
+
+  for (int64_t i{0}; i < *num_exprs; ++i) {
+    ctx.z3_expr_ids.try_emplace(exprs[i].id(), ctx.z3_exprs.size());
+    ctx.z3_exprs.push_back(exprs[i]);
+  }
+  for (size_t i{0}; i < term_insts.size(); ++i) {
+    auto id{exprs[*num_exprs + i].id()};
+    if (auto br = llvm::dyn_cast<llvm::BranchInst>(term_insts[i])) {
+      ctx.z3_br_edges_inv[id] = {br, true};
+    } else {
+      ctx.z3_sw_vars_inv[id] = llvm::cast<llvm::SwitchInst>(term_insts[i]);
+    }
+  }
+
+  for (auto &entry : GetJSONEntries(*map, "conds")) {
+    auto &arr{*entry.getAsArray()};
+    CHECK_THROW(arr.size() == 2) << "Malformed condition entry";
+    ctx.conds[ImportedStmt(arr[0])] =
+        GetJSONIndex(arr[1], ctx.z3_exprs.size());
+  }
+
+  ctx.z3_simplified = map->getInteger("simplified").value_or(0);
+  ctx.num_literal_structs = map->getInteger("literal_structs").value_or(0);
+  ctx.num_declared_structs = map->getInteger("declared_structs").value_or(0);
+  return snapshot;
+}
+
+}  // namespace rellic
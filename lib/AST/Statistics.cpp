@@ -0,0 +1,546 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/Statistics.h"
+
+#ifndef _WIN32
+#include <sys/resource.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#include <llvm/Support/Format.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstring>
+
+namespace rellic {
+
+namespace {
+std::atomic_bool hardware_counters{false};
+
+#ifdef __linux__
+// Group of counters of the thread it belongs to, opened the first time it
+// is read. Threads whose counters cannot be opened count nothing.
+class ThreadCounters {
+  static constexpr uint64_t kEvents[]{
+      PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+      PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES};
+  static constexpr size_t kNumEvents{sizeof(kEvents) / sizeof(kEvents[0])};
+  int fds[kNumEvents];
+  bool opened{false}, failed{false};
+
+  void Open() {
+    opened = true;
+    for (size_t i{0}; i < kNumEvents; ++i) {
+      perf_event_attr attr;
+      std::memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = kEvents[i];
+      attr.read_format = PERF_FORMAT_GROUP;
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      // The calling thread on any CPU, in the group of the first counter
+      fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, i ? fds[0] : -1, 0);
+      if (fds[i] < 0) {
+        failed = true;
+        Close(i);
+        return;
+      }
+    }
+  }
+
+  void Close(size_t num_fds) {
+    for (size_t i{0}; i < num_fds; ++i) {
+      close(fds[i]);
+    }
+  }
+
+ public:
+  ~ThreadCounters() {
+    if (opened && !failed) {
+      Close(kNumEvents);
+    }
+  }
+
+  bool Read(HardwareCounters &out) {
+    if (!opened) {
+      Open();
+    }
+    if (failed) {
+      return false;
+    }
+    uint64_t values[1 + kNumEvents];
+    if (read(fds[0], values, sizeof(values)) != sizeof(values)) {
+      return false;
+    }
+    out.cycles = values[1];
+    out.instructions = values[2];
+    out.cache_misses = values[3];
+    out.branch_misses = values[4];
+    return true;
+  }
+};
+
+thread_local ThreadCounters thread_counters;
+#endif
+
+bool ReadHardwareCounters(HardwareCounters &out) {
+#ifdef __linux__
+  return thread_counters.Read(out);
+#else
+  return false;
+#endif
+}
+}  // namespace
+
+bool EnableHardwareCounters() {
+  HardwareCounters counters;
+  if (!ReadHardwareCounters(counters)) {
+    return false;
+  }
+  hardware_counters = true;
+  return true;
+}
+
+ScopedCounters::ScopedCounters(HardwareCounters &out)
+    : out(out),
+      counting(hardware_counters.load(std::memory_order_relaxed) &&
+               ReadHardwareCounters(start)) {}
+
+ScopedCounters::~ScopedCounters() {
+  HardwareCounters end;
+  if (!counting || !ReadHardwareCounters(end)) {
+    return;
+  }
+  out.cycles += end.cycles - start.cycles;
+  out.instructions += end.instructions - start.instructions;
+  out.cache_misses += end.cache_misses - start.cache_misses;
+  out.branch_misses += end.branch_misses - start.branch_misses;
+}
+
+void HardwareCounters::Merge(const HardwareCounters &other) {
+  cycles += other.cycles;
+  instructions += other.instructions;
+  cache_misses += other.cache_misses;
+  branch_misses += other.branch_misses;
+}
+
+llvm::json::Object HardwareCounters::ToJSON() const {
+  return llvm::json::Object{
+      {"cycles", static_cast<int64_t>(cycles)},
+      {"instructions", static_cast<int64_t>(instructions)},
+      {"cache_misses", static_cast<int64_t>(cache_misses)},
+      {"branch_misses", static_cast<int64_t>(branch_misses)}};
+}
+
+uint64_t GetPeakRSS() {
+#ifdef _WIN32
+  return 0;
+#else
+  rusage usage{};
+  if (getrusage(RUSAGE_SELF, &usage)) {
+    return 0;
+  }
+#ifdef __APPLE__
+  return usage.ru_maxrss;
+#else
+  // Linux reports kilobytes
+  return static_cast<uint64_t>(usage.ru_maxrss) * 1024;
+#endif
+#endif
+}
+
+uint64_t GetCurrentRSS() {
+#ifdef __linux__
+  // The second field of statm is the number of resident pages
+  auto file{std::fopen("/proc/self/statm", "r")};
+  if (!file) {
+    return 0;
+  }
+  unsigned long long size{0}, resident{0};
+  auto read{std::fscanf(file, "%llu %llu", &size, &resident)};
+  std::fclose(file);
+  if (read != 2) {
+    return 0;
+  }
+  return static_cast<uint64_t>(resident) * sysconf(_SC_PAGESIZE);
+#else
+  return 0;
+#endif
+}
+
+void MemorySnapshot::Merge(const MemorySnapshot &other) {
+  rss = std::max(rss, other.rss);
+  ast = std::max(ast, other.ast);
+  z3 = std::max(z3, other.z3);
+  module = std::max(module, other.module);
+  conditions = std::max(conditions, other.conditions);
+  provenance = std::max(provenance, other.provenance);
+  maps = std::max(maps, other.maps);
+}
+
+llvm::json::Object MemorySnapshot::ToJSON() const {
+  return llvm::json::Object{{"rss", static_cast<int64_t>(rss)},
+                            {"ast", static_cast<int64_t>(ast)},
+                            {"z3", static_cast<int64_t>(z3)},
+                            {"module", static_cast<int64_t>(module)},
+                            {"conditions", static_cast<int64_t>(conditions)},
+                            {"provenance", static_cast<int64_t>(provenance)},
+                            {"maps", static_cast<int64_t>(maps)}};
+}
+
+void Z3Statistics::Merge(const Z3Statistics &other) {
+  time += other.time;
+  queries += other.queries;
+  cache_hits += other.cache_hits;
+  timeouts += other.timeouts;
+  nodes_in += other.nodes_in;
+  nodes_out += other.nodes_out;
+  max_nodes = std::max(max_nodes, other.max_nodes);
+  peak_memory = std::max(peak_memory, other.peak_memory);
+  counters.Merge(other.counters);
+}
+
+// Counters are left out of the JSON unless they were enabled
+static void AddCounters(llvm::json::Object &json,
+                        const HardwareCounters &counters) {
+  if (counters.cycles) {
+    json["counters"] = counters.ToJSON();
+  }
+}
+
+llvm::json::Object Z3Statistics::ToJSON() const {
+  llvm::json::Object json{{"time", time.count()},
+                          {"queries", queries},
+                          {"cache_hits", cache_hits},
+                          {"timeouts", timeouts},
+                          {"nodes_in", static_cast<int64_t>(nodes_in)},
+                          {"nodes_out", static_cast<int64_t>(nodes_out)},
+                          {"max_nodes", static_cast<int64_t>(max_nodes)},
+                          {"peak_memory", static_cast<int64_t>(peak_memory)}};
+  AddCounters(json, counters);
+  return json;
+}
+
+void DecompilationStatistics::Merge(const DecompilationStatistics &other) {
+  for (auto &[name, time] : other.preprocessing) {
+    preprocessing[name] += time;
+  }
+
+  for (auto &[name, stats] : other.passes) {
+    auto &mine{passes[name]};
+    mine.wall_time += stats.wall_time;
+    mine.runs += stats.runs;
+    mine.changes += stats.changes;
+    mine.fixpoints += stats.fixpoints;
+    mine.skipped_functions += stats.skipped_functions;
+    mine.profile_skipped_functions += stats.profile_skipped_functions;
+    mine.skipped_subtrees += stats.skipped_subtrees;
+    mine.counters.Merge(stats.counters);
+    mine.z3.Merge(stats.z3);
+  }
+
+  for (auto &[name, stats] : other.functions) {
+    auto &mine{functions[name]};
+    mine.reaching_conds_time += stats.reaching_conds_time;
+    mine.structuring_time += stats.structuring_time;
+    mine.num_blocks += stats.num_blocks;
+    mine.reaching_cond_evaluations += stats.reaching_cond_evaluations;
+    mine.reaching_cond_simplifications += stats.reaching_cond_simplifications;
+    mine.reaching_cond_skipped_blocks += stats.reaching_cond_skipped_blocks;
+    for (auto &[pass, time] : stats.pass_time) {
+      mine.pass_time[pass] += time;
+    }
+    for (auto &[pass, visits] : stats.pass_visits) {
+      mine.pass_visits[pass] += visits;
+    }
+    mine.counters.Merge(stats.counters);
+    mine.z3.Merge(stats.z3);
+  }
+
+  for (auto &[name, stats] : other.fixpoint_groups) {
+    auto &mine{fixpoint_groups[name]};
+    mine.wall_time += stats.wall_time;
+    mine.runs += stats.runs;
+    mine.rounds += stats.rounds;
+    mine.max_rounds = std::max(mine.max_rounds, stats.max_rounds);
+  }
+
+  for (auto &[name, hits] : other.rule_hits) {
+    rule_hits[name] += hits;
+  }
+
+  peak_rss = std::max(peak_rss, other.peak_rss);
+  ast_memory = std::max(ast_memory, other.ast_memory);
+  released_ast_memory += other.released_ast_memory;
+  qual_type_hits += other.qual_type_hits;
+  qual_type_misses += other.qual_type_misses;
+  function_cache_hits += other.function_cache_hits;
+  function_cache_misses += other.function_cache_misses;
+  cond_temps += other.cond_temps;
+  cond_temp_savings += other.cond_temp_savings;
+  full_simplifications += other.full_simplifications;
+  light_simplifications += other.light_simplifications;
+  skipped_simplifications += other.skipped_simplifications;
+  reused_regions += other.reused_regions;
+  reused_region_blocks += other.reused_region_blocks;
+  goto_fallbacks += other.goto_fallbacks;
+  dead_functions += other.dead_functions;
+  dead_variables += other.dead_variables;
+
+  // Stages that both ran are merged, the others are kept in order
+  for (auto &[stage, snapshot] : other.memory) {
+    auto it{std::find_if(memory.begin(), memory.end(),
+                         [&stage = stage](auto &entry) {
+                           return entry.first == stage;
+                         })};
+    if (it == memory.end()) {
+      memory.emplace_back(stage, snapshot);
+    } else {
+      it->second.Merge(snapshot);
+    }
+  }
+}
+
+llvm::json::Object DecompilationStatistics::ToJSON() const {
+  llvm::json::Object json_preprocessing;
+  for (auto &[name, time] : preprocessing) {
+    json_preprocessing[name] = time.count();
+  }
+
+  llvm::json::Object json_passes;
+  for (auto &[name, stats] : passes) {
+    llvm::json::Object json_pass{
+        {"wall_time", stats.wall_time.count()},
+        {"runs", stats.runs},
+        {"changes", stats.changes},
+        {"fixpoints", stats.fixpoints},
+        {"skipped_functions", stats.skipped_functions},
+        {"profile_skipped_functions", stats.profile_skipped_functions},
+        {"skipped_subtrees", stats.skipped_subtrees},
+        {"z3", stats.z3.ToJSON()},
+    };
+    AddCounters(json_pass, stats.counters);
+    json_passes[name] = std::move(json_pass);
+  }
+
+  llvm::json::Object json_functions;
+  for (auto &[name, stats] : functions) {
+    llvm::json::Object json_pass_time;
+    for (auto &[pass, time] : stats.pass_time) {
+      json_pass_time[pass] = time.count();
+    }
+    llvm::json::Object json_pass_visits;
+    for (auto &[pass, visits] : stats.pass_visits) {
+      json_pass_visits[pass] = visits;
+    }
+    llvm::json::Object json_function{
+        {"reaching_conds_time", stats.reaching_conds_time.count()},
+        {"structuring_time", stats.structuring_time.count()},
+        {"num_blocks", stats.num_blocks},
+        {"reaching_cond_evaluations", stats.reaching_cond_evaluations},
+        {"reaching_cond_simplifications",
+         stats.reaching_cond_simplifications},
+        {"reaching_cond_skipped_blocks", stats.reaching_cond_skipped_blocks},
+        {"pass_time", std::move(json_pass_time)},
+        {"pass_visits", std::move(json_pass_visits)},
+        {"z3", stats.z3.ToJSON()},
+    };
+    AddCounters(json_function, stats.counters);
+    json_functions[name] = std::move(json_function);
+  }
+
+  llvm::json::Object json_groups;
+  for (auto &[name, stats] : fixpoint_groups) {
+    json_groups[name] = llvm::json::Object{
+        {"wall_time", stats.wall_time.count()},
+        {"runs", stats.runs},
+        {"rounds", stats.rounds},
+        {"max_rounds", stats.max_rounds},
+    };
+  }
+
+  llvm::json::Object json_rules;
+  for (auto &[name, hits] : rule_hits) {
+    json_rules[name] = static_cast<int64_t>(hits);
+  }
+
+  llvm::json::Array json_memory;
+  for (auto &[stage, snapshot] : memory) {
+    auto json{snapshot.ToJSON()};
+    json["stage"] = stage;
+    json_memory.push_back(std::move(json));
+  }
+
+  return llvm::json::Object{{"preprocessing", std::move(json_preprocessing)},
+                            {"passes", std::move(json_passes)},
+                            {"functions", std::move(json_functions)},
+                            {"fixpoint_groups", std::move(json_groups)},
+                            {"rule_hits", std::move(json_rules)},
+                            {"peak_rss", static_cast<int64_t>(peak_rss)},
+                            {"ast_memory", static_cast<int64_t>(ast_memory)},
+                            {"released_ast_memory",
+                             static_cast<int64_t>(released_ast_memory)},
+                            {"qual_type_hits",
+                             static_cast<int64_t>(qual_type_hits)},
+                            {"qual_type_misses",
+                             static_cast<int64_t>(qual_type_misses)},
+                            {"function_cache_hits",
+                             static_cast<int64_t>(function_cache_hits)},
+                            {"function_cache_misses",
+                             static_cast<int64_t>(function_cache_misses)},
+                            {"cond_temps", static_cast<int64_t>(cond_temps)},
+                            {"cond_temp_savings", cond_temp_savings},
+                            {"full_simplifications",
+                             static_cast<int64_t>(full_simplifications)},
+                            {"light_simplifications",
+                             static_cast<int64_t>(light_simplifications)},
+                            {"skipped_simplifications",
+                             static_cast<int64_t>(skipped_simplifications)},
+                            {"reused_regions",
+                             static_cast<int64_t>(reused_regions)},
+                            {"reused_region_blocks",
+                             static_cast<int64_t>(reused_region_blocks)},
+                            {"goto_fallbacks",
+                             static_cast<int64_t>(goto_fallbacks)},
+                            {"dead_functions",
+                             static_cast<int64_t>(dead_functions)},
+                            {"dead_variables",
+                             static_cast<int64_t>(dead_variables)},
+                            {"memory", std::move(json_memory)}};
+}
+
+namespace {
+struct FunctionCostSummary {
+  const std::string *name;
+  Duration total{0};
+  // The stage or pass that took longest
+  std::string dominant;
+  Duration dominant_time{0};
+  // Number of reaching condition iterations or pass visits behind it
+  unsigned dominant_count{0};
+  const FunctionStatistics *stats;
+};
+
+FunctionCostSummary Summarize(const std::string &name,
+                              const FunctionStatistics &stats) {
+  FunctionCostSummary res{&name};
+  res.stats = &stats;
+  auto Consider = [&res](const std::string &what, Duration time,
+                         unsigned count) {
+    res.total += time;
+    if (time > res.dominant_time || res.dominant.empty()) {
+      res.dominant = what;
+      res.dominant_time = time;
+      res.dominant_count = count;
+    }
+  };
+  Consider("reaching conditions", stats.reaching_conds_time,
+           stats.reaching_cond_evaluations);
+  Consider("structuring", stats.structuring_time, 0);
+  for (auto &[pass, time] : stats.pass_time) {
+    auto visits{stats.pass_visits.find(pass)};
+    Consider("pass " + pass, time,
+             visits == stats.pass_visits.end() ? 0 : visits->second);
+  }
+  return res;
+}
+
+void PrintHitRate(llvm::raw_ostream &os, const char *cache, uint64_t hits,
+                  uint64_t misses) {
+  os << "  " << cache << ": ";
+  if (!hits && !misses) {
+    os << "unused\n";
+    return;
+  }
+  os << llvm::format("%.1f%%", 100.0 * hits / (hits + misses)) << " of "
+     << hits + misses << " lookups\n";
+}
+}  // namespace
+
+void PrintReport(const DecompilationStatistics &stats, llvm::raw_ostream &os,
+                 unsigned top_functions) {
+  std::vector<FunctionCostSummary> summaries;
+  for (auto &[name, function] : stats.functions) {
+    summaries.push_back(Summarize(name, function));
+  }
+  std::sort(summaries.begin(), summaries.end(), [](auto &a, auto &b) {
+    return a.total != b.total ? a.total > b.total : *a.name < *b.name;
+  });
+  if (summaries.size() > top_functions) {
+    summaries.resize(top_functions);
+  }
+
+  os << "Most expensive functions:\n";
+  for (auto &summary : summaries) {
+    auto &z3{summary.stats->z3};
+    os << "  " << *summary.name << ": "
+       << llvm::format("%.3fs", summary.total.count()) << ", mostly "
+       << summary.dominant << " ("
+       << llvm::format("%.3fs", summary.dominant_time.count());
+    if (summary.dominant_count) {
+      os << " over " << summary.dominant_count
+         << (summary.dominant == "reaching conditions" ? " iterations"
+                                                       : " visits");
+    }
+    os << "), " << summary.stats->num_blocks << " blocks; Z3 "
+       << llvm::format("%.3fs", z3.time.count()) << " over " << z3.queries
+       << " queries";
+    if (z3.timeouts) {
+      os << ", " << z3.timeouts << " timed out";
+    }
+    os << ", largest formula " << z3.max_nodes << " nodes\n";
+  }
+
+  if (!stats.fixpoint_groups.empty()) {
+    os << "Fixpoint groups:\n";
+    for (auto &[name, group] : stats.fixpoint_groups) {
+      os << "  " << name << ": " << group.runs << " runs, " << group.rounds
+         << " changing rounds (at most " << group.max_rounds << " in a run), "
+         << llvm::format("%.3fs", group.wall_time.count()) << '\n';
+    }
+  }
+
+  Z3Statistics z3;
+  if (!stats.passes.empty()) {
+    os << "Passes:\n";
+    for (auto &[name, pass] : stats.passes) {
+      z3.Merge(pass.z3);
+      os << "  " << name << ": " << pass.runs << " runs, " << pass.changes
+         << " changed the AST, "
+         << llvm::format("%.3fs", pass.wall_time.count()) << ", Z3 "
+         << llvm::format("%.3fs", pass.z3.time.count());
+      auto &counters{pass.counters};
+      if (counters.cycles && counters.instructions) {
+        double instructions = counters.instructions;
+        os << llvm::format(
+            ", %.2f instructions per cycle, %.2f cache and %.2f branch misses "
+            "per 1000 instructions",
+            instructions / counters.cycles,
+            counters.cache_misses * 1000 / instructions,
+            counters.branch_misses * 1000 / instructions);
+      }
+      os << '\n';
+    }
+  }
+
+  os << "Caches:\n";
+  PrintHitRate(os, "types", stats.qual_type_hits, stats.qual_type_misses);
+  PrintHitRate(os, "Z3 queries", z3.cache_hits, z3.queries);
+  PrintHitRate(os, "functions", stats.function_cache_hits,
+               stats.function_cache_misses);
+}
+
+}  // namespace rellic
@@ -15,22 +15,26 @@
 
 #include <unordered_set>
 
+#include "rellic/Log.h"
+
 namespace rellic {
 
 StructFieldRenamer::StructFieldRenamer(DecompilationContext &dec_ctx,
-                                       IRTypeToDITypeMap &types)
-    : ASTPass(dec_ctx), types(types) {}
+                                       DebugInfoCollector &dic)
+    : ASTPass(dec_ctx), dic(dic) {}
 
 bool StructFieldRenamer::VisitRecordDecl(clang::RecordDecl *decl) {
   auto type{decls[decl]};
   CHECK(type) << "Type information not present for declaration";
 
-  auto di{types[type]};
-  if (!di) {
+  // Types are only collected once the first record is renamed
+  auto &types{dic.GetIRTypeToDITypeMap()};
+  auto it{types.find(type)};
+  if (it == types.end() || !it->second) {
     return !Stopped();
   }
 
-  auto ditype = llvm::cast<llvm::DICompositeType>(di);
+  auto ditype = llvm::cast<llvm::DICompositeType>(it->second);
   std::vector<clang::FieldDecl *> decl_fields;
   std::vector<llvm::DIDerivedType *> di_fields;
 
@@ -66,8 +70,17 @@ bool StructFieldRenamer::VisitRecordDecl(clang::RecordDecl *decl) {
   return !Stopped();
 }
 
+void StructFieldRenamer::RenameFields(clang::RecordDecl *decl) {
+  if (!decls.count(decl)) {
+    for (auto &pair : dec_ctx.type_decls) {
+      decls[pair.second] = pair.first;
+    }
+  }
+  VisitRecordDecl(decl);
+}
+
 void StructFieldRenamer::RunImpl() {
-  LOG(INFO) << "Renaming struct fields";
+  RELLIC_LOG(Passes) << "Renaming struct fields";
   for (auto &pair : dec_ctx.type_decls) {
     decls[pair.second] = pair.first;
   }
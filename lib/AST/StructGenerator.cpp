@@ -16,17 +16,43 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <llvm/BinaryFormat/Dwarf.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/MathExtras.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/xxhash.h>
 
+#include <algorithm>
 #include <string>
 #include <unordered_set>
 
+#include "rellic/AST/TypePrelude.h"
 #include "rellic/BC/Util.h"
+#include "rellic/Log.h"
 
 static std::string MakeValid(const std::string& name, unsigned id) {
   return name + "_" + std::to_string(id);
 }
 
 namespace rellic {
+namespace {
+// Records every declaration it creates
+class PreludeImporter : public clang::ASTImporter {
+  std::unordered_set<clang::Decl*>& imported;
+
+ public:
+  PreludeImporter(clang::ASTUnit& to, clang::ASTUnit& from,
+                  std::unordered_set<clang::Decl*>& imported)
+      : clang::ASTImporter(to.getASTContext(), to.getFileManager(),
+                           from.getASTContext(), from.getFileManager(),
+                           /*MinimalImport=*/false),
+        imported(imported) {}
+
+  void Imported(clang::Decl*, clang::Decl* to) override {
+    imported.insert(to);
+  }
+};
+}  // namespace
+
 clang::QualType StructGenerator::BuildType(llvm::DIType* t, int sizeHint) {
   VLOG(2) << "BuildType: " << rellic::LLVMThingToString(t);
   if (!t) {
@@ -63,13 +89,13 @@ static llvm::DICompositeType* GetBaseType(llvm::DIType* type) {
   return nullptr;
 }
 
-struct OffsetDIDerivedType {
-  uint64_t offset;
-  llvm::DIDerivedType* type;
-};
-
-static std::vector<OffsetDIDerivedType> GetFields(
+const std::vector<OffsetDIDerivedType>& StructGenerator::GetFields(
     llvm::DICompositeType* composite) {
+  auto it{composite_fields.find(composite)};
+  if (it != composite_fields.end()) {
+    return it->second;
+  }
+
   std::vector<OffsetDIDerivedType> fields{};
   auto nodes{composite->getElements()};
   std::for_each(nodes.begin(), nodes.end(), [&](auto node) {
@@ -86,7 +112,7 @@ static std::vector<OffsetDIDerivedType> GetFields(
       }
 
       if (tag == llvm::dwarf::DW_TAG_inheritance) {
-        auto sub_fields{GetFields(GetBaseType(type->getBaseType()))};
+        auto& sub_fields{GetFields(GetBaseType(type->getBaseType()))};
         for (auto sub_field : sub_fields) {
           fields.push_back(
               {type->getOffsetInBits() + sub_field.offset, sub_field.type});
@@ -99,7 +125,7 @@ static std::vector<OffsetDIDerivedType> GetFields(
   std::sort(fields.begin(), fields.end(),
             [](auto a, auto b) { return a.offset < b.offset; });
 
-  return fields;
+  return composite_fields.emplace(composite, std::move(fields)).first->second;
 }
 
 struct FieldInfo {
@@ -160,7 +186,7 @@ static unsigned GetStructSize(clang::ASTContext& ast_ctx, ASTBuilder& ast,
 }
 
 void StructGenerator::DefineNonPackedStruct(
-    clang::RecordDecl* decl, std::vector<OffsetDIDerivedType>& fields) {
+    clang::RecordDecl* decl, const std::vector<OffsetDIDerivedType>& fields) {
   std::unordered_set<std::string> visible_field_names;
   for (auto& field : fields) {
     auto type{
@@ -176,7 +202,7 @@ void StructGenerator::DefineNonPackedStruct(
   }
 }
 
-static bool CheckOffsets(std::vector<OffsetDIDerivedType>& fields,
+static bool CheckOffsets(const std::vector<OffsetDIDerivedType>& fields,
                          const clang::ASTRecordLayout& layout) {
   for (auto i{0U}; i < fields.size(); ++i) {
     if (fields[i].offset != layout.getFieldOffset(i)) {
@@ -193,7 +219,7 @@ uint64_t StructGenerator::GetLayoutSize(const clang::ASTRecordLayout& layout) {
 void StructGenerator::VisitFields(clang::RecordDecl* decl,
                                   llvm::DICompositeType* s, DeclToDbgInfo& map,
                                   bool isUnion) {
-  auto elems{GetFields(s)};
+  auto& elems{GetFields(s)};
   static auto test_count{0U};
   auto test_decl{
       ast.CreateStructDecl(ast_ctx.getTranslationUnitDecl(),
@@ -221,18 +247,39 @@ void StructGenerator::VisitFields(clang::RecordDecl* decl,
     decl->addAttr(clang::PackedAttr::Create(ast_ctx, attrinfo));
   }
 
+  // Packed fields are laid out back to back, except that fields that are not
+  // bitfields start on a byte boundary, so the size so far is kept as fields
+  // are added. Microsoft layouts also depend on the types of bitfields, and
+  // are measured on a temporary record instead.
+  auto ms_layout{ast_ctx.getTargetInfo().getCXXABI().isMicrosoft()};
+  uint64_t packed_size{0};
+  auto add_field{[&](FieldInfo& field) {
+    fields.push_back(field);
+    if (!ms_layout) {
+      auto size{field.BitWidth ? field.BitWidth
+                               : ast_ctx.getTypeSize(field.Type)};
+      auto offset{field.BitWidth
+                      ? packed_size
+                      : llvm::alignTo(packed_size, ast_ctx.getCharWidth())};
+      packed_size = offset + size;
+    }
+  }};
+  auto get_size{[&]() -> uint64_t {
+    return ms_layout ? GetStructSize(ast_ctx, ast, fields) : packed_size;
+  }};
+
   std::unordered_set<std::string> visible_field_names;
   for (auto elem : elems) {
-    auto curr_offset{isUnion ? 0 : GetStructSize(ast_ctx, ast, fields)};
-    DLOG(INFO) << "Field " << elem.type->getName().str()
-               << " offset: " << curr_offset << " in " << decl->getName().str();
+    auto curr_offset{isUnion ? 0 : get_size()};
+    RELLIC_LOG(Types) << "Field " << elem.type->getName().str() << " offset: "
+                      << curr_offset << " in " << decl->getName().str();
     CHECK_LE(curr_offset, elem.offset)
         << "Field " << LLVMThingToString(elem.type)
         << " cannot be correctly aligned";
     if (curr_offset < elem.offset) {
       auto needed_padding{elem.offset - curr_offset};
       auto info{CreatePadding(ast_ctx, needed_padding, field_count)};
-      fields.push_back(info);
+      add_field(info);
       decl->addDecl(FieldInfoToFieldDecl(ast_ctx, ast, decl, info));
     }
 
@@ -247,20 +294,20 @@ void StructGenerator::VisitFields(clang::RecordDecl* decl,
       field = {name, type, 0};
     }
     auto fdecl{FieldInfoToFieldDecl(ast_ctx, ast, decl, field)};
-    fields.push_back(field);
+    add_field(field);
 
     map[fdecl] = elem;
     decl->addDecl(fdecl);
   }
 
   if (!isUnion) {
-    auto cur_size{GetStructSize(ast_ctx, ast, fields)};
+    auto cur_size{get_size()};
     auto expected_size{s->getSizeInBits()};
     CHECK_LE(cur_size, expected_size);
     if (cur_size < expected_size) {
       auto needed_padding{expected_size - cur_size};
       auto info{CreatePadding(ast_ctx, needed_padding, field_count)};
-      fields.push_back(info);
+      add_field(info);
       decl->addDecl(FieldInfoToFieldDecl(ast_ctx, ast, decl, info));
     }
   }
@@ -357,7 +404,12 @@ clang::QualType StructGenerator::BuildDerived(llvm::DIDerivedType* d,
     case llvm::dwarf::DW_TAG_ptr_to_member_type:
       return ast_ctx.getPointerType(BuildType(d->getBaseType(), sizeHint));
     case llvm::dwarf::DW_TAG_typedef: {
+      d = llvm::cast<llvm::DIDerivedType>(Canonicalize(d));
       auto& tdef_decl{typedef_decls[d]};
+      if (!tdef_decl) {
+        tdef_decl = clang::dyn_cast_or_null<clang::TypedefNameDecl>(
+            ImportFromPrelude(d));
+      }
       if (!tdef_decl) {
         auto tudecl{ast_ctx.getTranslationUnitDecl()};
         auto name{GetUniqueName(d->getName().str(), visible_tdefs)};
@@ -439,7 +491,11 @@ clang::QualType StructGenerator::BuildSubroutine(llvm::DISubroutineType* s) {
 }
 
 clang::RecordDecl* StructGenerator::GetRecordDecl(llvm::DICompositeType* t) {
+  t = llvm::cast<llvm::DICompositeType>(Canonicalize(t));
   auto& decl{fwd_decl_records[t]};
+  if (!decl) {
+    decl = clang::dyn_cast_or_null<clang::RecordDecl>(ImportFromPrelude(t));
+  }
   if (!decl) {
     auto tudecl{ast_ctx.getTranslationUnitDecl()};
     switch (t->getTag()) {
@@ -461,11 +517,21 @@ clang::RecordDecl* StructGenerator::GetRecordDecl(llvm::DICompositeType* t) {
 }
 
 clang::QualType StructGenerator::GetEnumDecl(llvm::DICompositeType* t) {
+  t = llvm::cast<llvm::DICompositeType>(Canonicalize(t));
   auto& type{enum_types[t]};
   if (!type.isNull()) {
     return type;
   }
 
+  auto imported{ImportFromPrelude(t)};
+  if (auto tdef = clang::dyn_cast_or_null<clang::TypedefNameDecl>(imported)) {
+    type = ast_ctx.getTypedefType(tdef);
+    return type;
+  } else if (auto decl = clang::dyn_cast_or_null<clang::EnumDecl>(imported)) {
+    type = ast_ctx.getEnumType(decl);
+    return type;
+  }
+
   auto tudecl{ast_ctx.getTranslationUnitDecl()};
   auto base{BuildType(t->getBaseType())};
   auto name{GetUniqueName(t->getName().str(), visible_enums)};
@@ -508,7 +574,7 @@ clang::QualType StructGenerator::BuildComposite(llvm::DICompositeType* type) {
   VLOG(2) << "BuildComposite: " << rellic::LLVMThingToString(type);
   switch (type->getTag()) {
     case llvm::dwarf::DW_TAG_class_type:
-      DLOG(INFO) << "Treating class declaration as struct";
+      RELLIC_LOG(Types) << "Treating class declaration as struct";
       [[fallthrough]];
     case llvm::dwarf::DW_TAG_structure_type:
     case llvm::dwarf::DW_TAG_union_type:
@@ -537,6 +603,7 @@ void StructGenerator::VisitType(llvm::DIType* t,
                                 std::vector<llvm::DICompositeType*>& list,
                                 std::unordered_set<llvm::DIType*>& visited) {
   VLOG(1) << "VisitType: " << rellic::LLVMThingToString(t);
+  t = Canonicalize(t);
   if (!t || visited.count(t)) {
     return;
   }
@@ -548,7 +615,11 @@ void StructGenerator::VisitType(llvm::DIType* t,
       case llvm::dwarf::DW_TAG_class_type:
       case llvm::dwarf::DW_TAG_structure_type:
       case llvm::dwarf::DW_TAG_union_type: {
-        GetRecordDecl(comp);
+        // Types from the prelude are already defined, and so is everything
+        // they refer to
+        if (IsFromPrelude(GetRecordDecl(comp))) {
+          return;
+        }
         for (auto field : GetFields(comp)) {
           VisitType(field.type->getBaseType(), list, visited);
         }
@@ -597,38 +668,293 @@ clang::QualType StructGenerator::GetType(llvm::DIType* t) {
   return BuildType(t);
 }
 
+// Ranges looked up in a record before its cache is emptied
+static constexpr size_t kMaxCachedRanges{256};
+
+void StructGenerator::IndexFields(clang::RecordDecl* decl, uint64_t offset,
+                                  std::vector<clang::FieldDecl*>& path,
+                                  FieldIndex& index) {
+  auto& layout{ast_ctx.getASTRecordLayout(decl)};
+  for (auto field : decl->fields()) {
+    auto type{field->getType().getDesugaredType(ast_ctx)};
+    auto field_offset{offset + layout.getFieldOffset(field->getFieldIndex())};
+    path.push_back(field);
+    if (auto subdecl = type->getAsRecordDecl()) {
+      IndexFields(subdecl, field_offset, path, index);
+    } else if (ast_ctx.getAsConstantArrayType(type)) {
+      index.arrays.push_back(
+          {field_offset, ast_ctx.getTypeSize(type), path, type});
+    } else if (!type->isAggregateType()) {
+      auto field_size{field->isBitField() ? field->getBitWidthValue(ast_ctx)
+                                          : ast_ctx.getTypeSize(type)};
+      index.scalars.push_back({field_offset, field_size, path, type});
+    }
+    path.pop_back();
+  }
+}
+
+StructGenerator::FieldIndex& StructGenerator::GetFieldIndex(
+    clang::RecordDecl* decl) {
+  auto [it, inserted]{field_indices.try_emplace(decl)};
+  auto& index{it->second};
+  if (inserted) {
+    std::vector<clang::FieldDecl*> path;
+    IndexFields(decl, 0, path, index);
+    std::stable_sort(
+        index.scalars.begin(), index.scalars.end(),
+        [](auto& a, auto& b) { return a.offset < b.offset; });
+  }
+  return index;
+}
+
+const std::vector<unsigned>& StructGenerator::FindScalars(FieldIndex& index,
+                                                          uint64_t offset,
+                                                          uint64_t length) {
+  auto cached{index.cache.find({offset, length})};
+  if (cached != index.cache.end()) {
+    return cached->second;
+  }
+  if (index.cache.size() >= kMaxCachedRanges) {
+    index.cache.clear();
+  }
+  auto& res{index.cache[{offset, length}]};
+  auto& scalars{index.scalars};
+  auto it{std::lower_bound(
+      scalars.begin(), scalars.end(), offset,
+      [](auto& entry, uint64_t value) { return entry.offset < value; })};
+  for (; it != scalars.end() && it->offset == offset; ++it) {
+    if (it->size == length) {
+      res.push_back(it - scalars.begin());
+    }
+  }
+  return res;
+}
+
+void StructGenerator::FindAccessPaths(clang::RecordDecl* decl,
+                                      uint64_t offset, uint64_t length,
+                                      AccessPath& prefix,
+                                      std::vector<AccessPath>& res) {
+  auto& index{GetFieldIndex(decl)};
+  for (auto i : FindScalars(index, offset, length)) {
+    res.push_back(prefix);
+    for (auto field : index.scalars[i].path) {
+      res.back().push_back({field, 0});
+    }
+  }
+
+  for (auto& array : index.arrays) {
+    if (offset >= array.offset &&
+        offset + length <= array.offset + array.size) {
+      auto prefix_size{prefix.size()};
+      for (auto field : array.path) {
+        prefix.push_back({field, 0});
+      }
+      FindAccessPaths(array.type, offset - array.offset, length, prefix, res);
+      prefix.resize(prefix_size);
+    }
+  }
+}
+
+void StructGenerator::FindAccessPaths(clang::QualType type, uint64_t offset,
+                                      uint64_t length, AccessPath& prefix,
+                                      std::vector<AccessPath>& res) {
+  type = type.getDesugaredType(ast_ctx);
+  if (auto decl = type->getAsRecordDecl()) {
+    FindAccessPaths(decl, offset, length, prefix, res);
+  } else if (auto array = ast_ctx.getAsConstantArrayType(type)) {
+    auto elem_type{array->getElementType()};
+    auto elem_size{ast_ctx.getTypeSize(elem_type)};
+    if (!elem_size || offset % elem_size + length > elem_size) {
+      return;
+    }
+    prefix.push_back({nullptr, offset / elem_size});
+    FindAccessPaths(elem_type, offset % elem_size, length, prefix, res);
+    prefix.pop_back();
+  } else if (!type->isAggregateType() && offset == 0 &&
+             length == ast_ctx.getTypeSize(type)) {
+    res.push_back(prefix);
+  }
+}
+
 std::vector<clang::Expr*> StructGenerator::GetAccessor(clang::Expr* base,
                                                        clang::RecordDecl* decl,
                                                        unsigned int offset,
                                                        unsigned int length) {
+  std::vector<AccessPath> paths;
+  AccessPath prefix;
+  FindAccessPaths(decl, offset, length, prefix, paths);
+
   std::vector<clang::Expr*> res{};
-  auto& layout{ast_ctx.getASTRecordLayout(decl)};
+  for (auto& path : paths) {
+    auto expr{base};
+    for (auto& step : path) {
+      if (step.field) {
+        expr = ast.CreateDot(expr, step.field);
+      } else {
+        expr = ast.CreateArraySub(
+            expr,
+            ast.CreateIntLit(llvm::APInt(sizeof(unsigned) * 8U, step.index)));
+      }
+    }
+    res.push_back(expr);
+  }
+  return res;
+}
 
-  for (auto field : decl->fields()) {
-    auto idx{field->getFieldIndex()};
-    auto type{field->getType().getDesugaredType(ast_ctx)};
-    auto field_offset{layout.getFieldOffset(idx)};
-    auto field_size{field->isBitField() ? field->getBitWidthValue(ast_ctx)
-                                        : ast_ctx.getTypeSize(type)};
-    if (offset >= field_offset &&
-        offset + length <= field_offset + field_size) {
-      if (type->isAggregateType()) {
-        auto subdecl{type->getAsRecordDecl()};
-        auto suboffset{offset - field_offset};
-        auto new_base{ast.CreateDot(base, field)};
-        for (auto r : GetAccessor(new_base, subdecl, suboffset, length)) {
-          res.push_back(r);
+// Types that get a declaration of their own
+static bool IsDeclared(llvm::DIType* t) {
+  if (auto comp = llvm::dyn_cast<llvm::DICompositeType>(t)) {
+    return comp->getTag() != llvm::dwarf::DW_TAG_array_type;
+  }
+  return t->getTag() == llvm::dwarf::DW_TAG_typedef;
+}
+
+// Types with an ODR identifier are the same wherever they are described, and
+// need not be compared any further
+static uint64_t GetTypeKey(llvm::DIType* t) {
+  if (auto comp = llvm::dyn_cast<llvm::DICompositeType>(t)) {
+    if (!comp->getIdentifier().empty()) {
+      return llvm::xxHash64(comp->getIdentifier());
+    }
+  }
+  return GetDITypeHash(t);
+}
+
+llvm::DIType* StructGenerator::Canonicalize(llvm::DIType* t) {
+  if (!t || !IsDeclared(t)) {
+    return t;
+  }
+  auto& canonical{canonical_of[t]};
+  if (!canonical) {
+    auto key{type_keys.find(t)};
+    canonical =
+        canonical_types
+            .try_emplace(key == type_keys.end() ? GetTypeKey(t) : key->second,
+                         t)
+            .first->second;
+  }
+  return canonical;
+}
+
+void StructGenerator::ComputeTypeKeys(const std::vector<llvm::DIType*>& roots) {
+  std::vector<llvm::DIType*> types;
+  std::unordered_set<llvm::Metadata*> seen;
+  std::vector<llvm::Metadata*> worklist(roots.begin(), roots.end());
+  while (!worklist.empty()) {
+    auto node{worklist.back()};
+    worklist.pop_back();
+    if (!node || !seen.insert(node).second) {
+      continue;
+    }
+    auto type{llvm::dyn_cast<llvm::DIType>(node)};
+    if (type && IsDeclared(type) && !type_keys.count(type)) {
+      types.push_back(type);
+    }
+    if (auto comp = llvm::dyn_cast<llvm::DICompositeType>(node)) {
+      for (auto elem : comp->getElements()) {
+        worklist.push_back(elem);
+      }
+      worklist.push_back(comp->getBaseType());
+    } else if (auto der = llvm::dyn_cast<llvm::DIDerivedType>(node)) {
+      worklist.push_back(der->getBaseType());
+    } else if (auto sub = llvm::dyn_cast<llvm::DISubroutineType>(node)) {
+      for (auto elem : sub->getTypeArray()) {
+        worklist.push_back(elem);
+      }
+    }
+  }
+
+  // Hashing only reads the debug information, unlike creating declarations
+  std::vector<uint64_t> keys(types.size());
+  {
+    auto strategy{llvm::hardware_concurrency(num_workers)};
+    llvm::ThreadPool pool(strategy);
+    size_t num_chunks{strategy.compute_thread_count() * 4U};
+    auto chunk_size{(types.size() + num_chunks - 1) / num_chunks};
+    for (size_t begin{0}; begin < types.size(); begin += chunk_size) {
+      auto end{std::min(begin + chunk_size, types.size())};
+      pool.async([&types, &keys, begin, end] {
+        for (auto i{begin}; i < end; ++i) {
+          keys[i] = GetTypeKey(types[i]);
         }
-      } else if (offset == field_offset && length == field_size) {
-        res.push_back(ast.CreateDot(base, field));
+      });
+    }
+    pool.wait();
+  }
+  for (size_t i{0}; i < types.size(); ++i) {
+    type_keys.emplace(types[i], keys[i]);
+  }
+}
+
+clang::TypeDecl* StructGenerator::ImportFromPrelude(llvm::DIType* t) {
+  if (!prelude) {
+    return nullptr;
+  }
+  auto decl{prelude->Lookup(GetDITypeHash(t))};
+  if (!decl) {
+    return nullptr;
+  }
+  auto imported{importer->Import(decl)};
+  if (!imported) {
+    LOG(WARNING) << "Cannot import " << decl->getNameAsString()
+                 << " from prelude: " << llvm::toString(imported.takeError());
+    return nullptr;
+  }
+  return clang::dyn_cast<clang::TypeDecl>(*imported);
+}
+
+void StructGenerator::UsePrelude(TypePrelude& prelude) {
+  this->prelude = &prelude;
+  auto& from{prelude.GetASTUnit()};
+  importer = std::make_unique<PreludeImporter>(ast_unit, from, prelude_decls);
+
+  for (auto decl : from.getASTContext().getTranslationUnitDecl()->decls()) {
+    auto named{clang::dyn_cast<clang::NamedDecl>(decl)};
+    if (!named || decl->isImplicit()) {
+      continue;
+    }
+    auto name{named->getNameAsString()};
+    if (auto record = clang::dyn_cast<clang::RecordDecl>(decl)) {
+      (record->isUnion() ? visible_unions : visible_structs).insert(name);
+    } else if (auto enm = clang::dyn_cast<clang::EnumDecl>(decl)) {
+      visible_enums.insert(name);
+      for (auto cdecl : enm->enumerators()) {
+        visible_values.insert(cdecl->getNameAsString());
       }
+    } else if (clang::isa<clang::TypedefNameDecl>(decl)) {
+      visible_tdefs.insert(name);
+    } else if (clang::isa<clang::ValueDecl>(decl)) {
+      visible_values.insert(name);
     }
   }
+}
 
+std::unordered_map<uint64_t, clang::TypeDecl*>
+StructGenerator::GetTypeDecls() {
+  std::unordered_map<uint64_t, clang::TypeDecl*> res;
+  for (auto [type, decl] : fwd_decl_records) {
+    auto defn{decl->getDefinition()};
+    res.try_emplace(GetDITypeHash(type), defn ? defn : decl);
+  }
+  for (auto [type, qtype] : enum_types) {
+    clang::TypeDecl* decl{nullptr};
+    if (auto tdef = qtype->getAs<clang::TypedefType>()) {
+      decl = tdef->getDecl();
+    } else {
+      decl = qtype->getAsTagDecl();
+    }
+    res.try_emplace(GetDITypeHash(type), decl);
+  }
+  for (auto [type, decl] : typedef_decls) {
+    res.try_emplace(GetDITypeHash(type), decl);
+  }
   return res;
 }
 
-StructGenerator::StructGenerator(clang::ASTUnit& ast_unit)
-    : ast_ctx(ast_unit.getASTContext()), ast(ast_unit) {}
+StructGenerator::StructGenerator(clang::ASTUnit& ast_unit, unsigned num_workers)
+    : ast_unit(ast_unit),
+      ast_ctx(ast_unit.getASTContext()),
+      ast(ast_unit),
+      num_workers(num_workers) {}
 
 }  // namespace rellic
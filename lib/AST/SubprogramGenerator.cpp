@@ -12,6 +12,8 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 
+#include "rellic/Log.h"
+
 namespace rellic {
 SubprogramGenerator::SubprogramGenerator(clang::ASTUnit& ast_unit,
                                          StructGenerator& struct_gen)
@@ -29,7 +31,7 @@ clang::FunctionDecl* SubprogramGenerator::VisitSubprogram(
     name = linkageName;
   }
   CHECK_NE(name, "");
-  DLOG(INFO) << "Visiting subprogram " << name;
+  RELLIC_LOG(Types) << "Visiting subprogram " << name;
 
   auto type{struct_gen.GetType(subp->getType())};
   auto tudecl{ast_ctx.getTranslationUnitDecl()};
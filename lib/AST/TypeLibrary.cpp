@@ -0,0 +1,741 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/TypeLibrary.h"
+
+#include <clang/Basic/TargetInfo.h>
+#include <glog/logging.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/DataLayout.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+#include "rellic/AST/DecompilationContext.h"
+#include "rellic/Exception.h"
+
+namespace rellic {
+
+std::shared_ptr<const TypeLibrary> TypeLibrary::Load(const std::string &path) {
+  llvm::TimeTraceScope trace("LoadTypeLibrary");
+  // Large files are mapped rather than read
+  auto buffer{llvm::MemoryBuffer::getFile(path, /*IsText=*/false,
+                                          /*RequiresNullTerminator=*/false)};
+  CHECK_THROW(buffer) << "Cannot read " << path << ": "
+                      << buffer.getError().message();
+  return Load(std::move(buffer.get()));
+}
+
+std::shared_ptr<const TypeLibrary> TypeLibrary::Load(
+    std::unique_ptr<llvm::MemoryBuffer> buffer) {
+  auto data{buffer->getBufferStart()};
+  auto size{buffer->getBufferSize()};
+  CHECK_THROW(size >= sizeof(Header) &&
+              reinterpret_cast<uintptr_t>(data) % alignof(Header) == 0)
+      << buffer->getBufferIdentifier().str() << " is not a type library";
+  auto header{reinterpret_cast<const Header *>(data)};
+  CHECK_THROW(std::equal(kMagic, kMagic + 4, header->magic))
+      << buffer->getBufferIdentifier().str() << " is not a type library";
+  CHECK_THROW(header->version == kVersion)
+      << "Unsupported type library version " << header->version;
+  // Computed in 64 bits, so that no count can make it wrap around
+  uint64_t expected{sizeof(Header) +
+                    uint64_t{header->num_types} * sizeof(TypeEntry) +
+                    uint64_t{header->num_records} * sizeof(RecordEntry) +
+                    uint64_t{header->num_fields} * sizeof(FieldEntry) +
+                    uint64_t{header->num_symbols} * sizeof(SymbolEntry) +
+                    uint64_t{header->num_indices} * sizeof(uint32_t) +
+                    header->strings_size};
+  CHECK_THROW(expected == size && header->strings_size &&
+              data[size - 1] == '\0')
+      << "Truncated type library " << buffer->getBufferIdentifier().str();
+
+  std::shared_ptr<TypeLibrary> library{new TypeLibrary()};
+  library->header = header;
+  auto pos{data + sizeof(Header)};
+  auto take{[&pos](auto &table, uint32_t count) {
+    table = reinterpret_cast<std::remove_reference_t<decltype(table)>>(pos);
+    pos += count * sizeof(*table);
+  }};
+  take(library->types, header->num_types);
+  take(library->records, header->num_records);
+  take(library->fields, header->num_fields);
+  take(library->symbols, header->num_symbols);
+  take(library->indices, header->num_indices);
+  library->strings = pos;
+  library->buffer = std::move(buffer);
+  return library;
+}
+
+const TypeLibrary::SymbolEntry *TypeLibrary::Lookup(llvm::StringRef name,
+                                                    SymbolKind kind) const {
+  auto end{symbols + header->num_symbols};
+  auto it{std::lower_bound(symbols, end, name,
+                           [this](const SymbolEntry &entry,
+                                  llvm::StringRef name) {
+                             return GetString(entry.name) < name;
+                           })};
+  if (it == end || GetString(it->name) != name ||
+      it->kind != static_cast<uint32_t>(kind)) {
+    return nullptr;
+  }
+  return it;
+}
+
+const TypeLibrary::TypeEntry *TypeLibrary::GetType(uint32_t idx) const {
+  return idx < header->num_types ? &types[idx] : nullptr;
+}
+
+const TypeLibrary::RecordEntry *TypeLibrary::GetRecord(uint32_t idx) const {
+  return idx < header->num_records ? &records[idx] : nullptr;
+}
+
+const TypeLibrary::FieldEntry *TypeLibrary::GetField(uint32_t idx) const {
+  return idx < header->num_fields ? &fields[idx] : nullptr;
+}
+
+const uint32_t *TypeLibrary::GetIndex(uint32_t idx) const {
+  return idx < header->num_indices ? &indices[idx] : nullptr;
+}
+
+llvm::StringRef TypeLibrary::GetString(uint32_t offset) const {
+  // The last string is terminated, so none runs past the end
+  return offset < header->strings_size ? llvm::StringRef(strings + offset)
+                                       : llvm::StringRef();
+}
+
+static std::optional<TypeLibrary::Builtin> GetBuiltin(
+    clang::BuiltinType::Kind kind) {
+  using B = TypeLibrary::Builtin;
+  switch (kind) {
+    case clang::BuiltinType::Void:
+      return B::Void;
+    case clang::BuiltinType::Bool:
+      return B::Bool;
+    case clang::BuiltinType::Char_S:
+    case clang::BuiltinType::Char_U:
+      return B::Char;
+    case clang::BuiltinType::SChar:
+      return B::SChar;
+    case clang::BuiltinType::UChar:
+      return B::UChar;
+    case clang::BuiltinType::Short:
+      return B::Short;
+    case clang::BuiltinType::UShort:
+      return B::UShort;
+    case clang::BuiltinType::Int:
+      return B::Int;
+    case clang::BuiltinType::UInt:
+      return B::UInt;
+    case clang::BuiltinType::Long:
+      return B::Long;
+    case clang::BuiltinType::ULong:
+      return B::ULong;
+    case clang::BuiltinType::LongLong:
+      return B::LongLong;
+    case clang::BuiltinType::ULongLong:
+      return B::ULongLong;
+    case clang::BuiltinType::Int128:
+      return B::Int128;
+    case clang::BuiltinType::UInt128:
+      return B::UInt128;
+    case clang::BuiltinType::Float:
+      return B::Float;
+    case clang::BuiltinType::Double:
+      return B::Double;
+    case clang::BuiltinType::LongDouble:
+      return B::LongDouble;
+    default:
+      return std::nullopt;
+  }
+}
+
+static clang::QualType GetBuiltinType(clang::ASTContext &ast_ctx,
+                                      uint32_t kind) {
+  using B = TypeLibrary::Builtin;
+  switch (static_cast<B>(kind)) {
+    case B::Void:
+      return ast_ctx.VoidTy;
+    case B::Bool:
+      return ast_ctx.BoolTy;
+    case B::Char:
+      return ast_ctx.CharTy;
+    case B::SChar:
+      return ast_ctx.SignedCharTy;
+    case B::UChar:
+      return ast_ctx.UnsignedCharTy;
+    case B::Short:
+      return ast_ctx.ShortTy;
+    case B::UShort:
+      return ast_ctx.UnsignedShortTy;
+    case B::Int:
+      return ast_ctx.IntTy;
+    case B::UInt:
+      return ast_ctx.UnsignedIntTy;
+    case B::Long:
+      return ast_ctx.LongTy;
+    case B::ULong:
+      return ast_ctx.UnsignedLongTy;
+    case B::LongLong:
+      return ast_ctx.LongLongTy;
+    case B::ULongLong:
+      return ast_ctx.UnsignedLongLongTy;
+    case B::Int128:
+      return ast_ctx.Int128Ty;
+    case B::UInt128:
+      return ast_ctx.UnsignedInt128Ty;
+    case B::Float:
+      return ast_ctx.FloatTy;
+    case B::Double:
+      return ast_ctx.DoubleTy;
+    case B::LongDouble:
+      return ast_ctx.LongDoubleTy;
+  }
+  return {};
+}
+
+TypeLibraryBuilder::TypeLibraryBuilder(clang::ASTContext &ast_ctx)
+    : ast_ctx(ast_ctx) {
+  AddString("");
+  triple = AddString(ast_ctx.getTargetInfo().getTriple().str());
+}
+
+uint32_t TypeLibraryBuilder::AddString(llvm::StringRef str) {
+  auto [it, inserted]{string_offsets.try_emplace(str, strings.size())};
+  if (inserted) {
+    strings.append(str.begin(), str.end());
+    strings.push_back('\0');
+  }
+  return it->second;
+}
+
+uint32_t TypeLibraryBuilder::AddEntry(TypeLibrary::TypeEntry entry) {
+  types.push_back(entry);
+  return types.size() - 1;
+}
+
+uint32_t TypeLibraryBuilder::AddRecord(const clang::RecordDecl *decl) {
+  auto canon{decl->getCanonicalDecl()};
+  auto it{record_indices.find(canon)};
+  if (it != record_indices.end()) {
+    return it->second;
+  }
+  uint32_t idx = records.size();
+  // Registered before the fields, which may point back to it
+  record_indices[canon] = idx;
+  auto name{decl->getName().str()};
+  if (name.empty()) {
+    auto tdef{decl->getTypedefNameForAnonDecl()};
+    name = tdef ? tdef->getName().str() : "anon_" + std::to_string(idx);
+  }
+  records.push_back({AddString(name),
+                     decl->isUnion() ? TypeLibrary::kUnion : 0U, 0, 0});
+
+  // Records with fields that cannot be stored are left incomplete
+  auto def{decl->getDefinition()};
+  if (!def) {
+    return idx;
+  }
+  std::vector<TypeLibrary::FieldEntry> record_fields;
+  for (auto field : def->fields()) {
+    auto type{AddType(field->getType())};
+    if (type == kInvalid) {
+      return idx;
+    }
+    TypeLibrary::FieldEntry entry{AddString(field->getName()), type, 0, 0};
+    if (field->isBitField()) {
+      entry.flags = TypeLibrary::kBitField;
+      entry.bit_width = field->getBitWidthValue(ast_ctx);
+    }
+    record_fields.push_back(entry);
+  }
+  // Other records may have been added in the meantime
+  auto &record{records[idx]};
+  record.flags |= TypeLibrary::kComplete;
+  record.first_field = fields.size();
+  record.num_fields = record_fields.size();
+  fields.insert(fields.end(), record_fields.begin(), record_fields.end());
+  return idx;
+}
+
+uint32_t TypeLibraryBuilder::AddType(clang::QualType type) {
+  if (type.isNull()) {
+    return kInvalid;
+  }
+  auto key{type.getAsOpaquePtr()};
+  auto it{type_indices.find(key)};
+  if (it != type_indices.end()) {
+    return it->second;
+  }
+
+  auto split{type.split()};
+  auto ty{split.Ty};
+  TypeLibrary::TypeEntry entry{};
+  if (split.Quals.hasConst()) {
+    entry.flags |= TypeLibrary::kConst;
+  }
+  if (split.Quals.hasVolatile()) {
+    entry.flags |= TypeLibrary::kVolatile;
+  }
+  if (split.Quals.hasRestrict()) {
+    entry.flags |= TypeLibrary::kRestrict;
+  }
+
+  auto idx{kInvalid};
+  if (auto tdef = clang::dyn_cast<clang::TypedefType>(ty)) {
+    auto underlying{AddType(tdef->getDecl()->getUnderlyingType())};
+    if (underlying != kInvalid) {
+      entry.kind = static_cast<uint32_t>(TypeLibrary::TypeKind::Typedef);
+      entry.a = AddString(tdef->getDecl()->getName());
+      entry.b = underlying;
+      idx = AddEntry(entry);
+    }
+  } else if (auto builtin = clang::dyn_cast<clang::BuiltinType>(ty)) {
+    if (auto kind = GetBuiltin(builtin->getKind())) {
+      entry.kind = static_cast<uint32_t>(TypeLibrary::TypeKind::Builtin);
+      entry.a = static_cast<uint32_t>(*kind);
+      idx = AddEntry(entry);
+    }
+  } else if (auto ptr = clang::dyn_cast<clang::PointerType>(ty)) {
+    // Pointers to what cannot be stored are still pointers
+    auto pointee{AddType(ptr->getPointeeType())};
+    if (pointee == kInvalid) {
+      pointee = AddType(ast_ctx.VoidTy);
+    }
+    entry.kind = static_cast<uint32_t>(TypeLibrary::TypeKind::Pointer);
+    entry.a = pointee;
+    idx = AddEntry(entry);
+  } else if (auto arr = clang::dyn_cast<clang::ConstantArrayType>(ty)) {
+    auto elem{AddType(arr->getElementType())};
+    if (elem != kInvalid) {
+      auto size{arr->getSize().getZExtValue()};
+      entry.kind = static_cast<uint32_t>(TypeLibrary::TypeKind::Array);
+      entry.a = elem;
+      entry.b = static_cast<uint32_t>(size);
+      entry.c = static_cast<uint32_t>(size >> 32);
+      idx = AddEntry(entry);
+    }
+  } else if (auto arr = clang::dyn_cast<clang::IncompleteArrayType>(ty)) {
+    auto elem{AddType(arr->getElementType())};
+    if (elem != kInvalid) {
+      entry.kind = static_cast<uint32_t>(TypeLibrary::TypeKind::Array);
+      entry.flags |= TypeLibrary::kIncompleteArray;
+      entry.a = elem;
+      idx = AddEntry(entry);
+    }
+  } else if (auto func = clang::dyn_cast<clang::FunctionType>(ty)) {
+    auto ret{AddType(func->getReturnType())};
+    std::vector<uint32_t> params;
+    auto proto{clang::dyn_cast<clang::FunctionProtoType>(func)};
+    if (proto) {
+      for (auto param : proto->getParamTypes()) {
+        params.push_back(AddType(param));
+      }
+    }
+    if (ret != kInvalid &&
+        std::find(params.begin(), params.end(), kInvalid) == params.end()) {
+      entry.kind = static_cast<uint32_t>(TypeLibrary::TypeKind::Function);
+      if (!proto) {
+        entry.flags |= TypeLibrary::kNoProto;
+      } else if (proto->isVariadic()) {
+        entry.flags |= TypeLibrary::kVariadic;
+      }
+      entry.a = ret;
+      entry.b = indices.size();
+      entry.c = params.size();
+      indices.insert(indices.end(), params.begin(), params.end());
+      idx = AddEntry(entry);
+    }
+  } else if (auto rec = clang::dyn_cast<clang::RecordType>(ty)) {
+    auto record{AddRecord(rec->getDecl())};
+    // The record may have been added while adding its fields
+    auto added{type_indices.find(key)};
+    if (added != type_indices.end()) {
+      return added->second;
+    }
+    entry.kind = static_cast<uint32_t>(TypeLibrary::TypeKind::Record);
+    entry.a = record;
+    idx = AddEntry(entry);
+  } else if (auto enum_type = clang::dyn_cast<clang::EnumType>(ty)) {
+    // Enumerations are stored as the integer type they stand for
+    auto int_type{enum_type->getDecl()->getIntegerType()};
+    if (!int_type.isNull()) {
+      idx = AddType(ast_ctx.getQualifiedType(int_type, split.Quals));
+    }
+  } else if (ty->isSugared()) {
+    idx = AddType(ast_ctx.getQualifiedType(ty->desugar(), split.Quals));
+  }
+  type_indices[key] = idx;
+  return idx;
+}
+
+bool TypeLibraryBuilder::Add(const clang::DeclaratorDecl *decl) {
+  TypeLibrary::SymbolKind kind;
+  if (clang::isa<clang::FunctionDecl>(decl)) {
+    kind = TypeLibrary::SymbolKind::Function;
+  } else if (clang::isa<clang::VarDecl>(decl)) {
+    kind = TypeLibrary::SymbolKind::Variable;
+  } else {
+    return false;
+  }
+  if (!decl->getDeclName().isIdentifier()) {
+    return false;
+  }
+  auto type{AddType(decl->getType())};
+  if (type == kInvalid) {
+    return false;
+  }
+  auto name{decl->getName()};
+  symbols.emplace_back(
+      name.str(), TypeLibrary::SymbolEntry{AddString(name),
+                                           static_cast<uint32_t>(kind), type});
+  return true;
+}
+
+std::string TypeLibraryBuilder::Serialize() const {
+  // Sorted by name for lookups, keeping the last declaration of each
+  auto sorted{symbols};
+  std::stable_sort(sorted.begin(), sorted.end(),
+                   [](auto &a, auto &b) { return a.first < b.first; });
+  std::vector<TypeLibrary::SymbolEntry> unique;
+  for (size_t i{0}; i < sorted.size(); ++i) {
+    if (i + 1 == sorted.size() || sorted[i + 1].first != sorted[i].first) {
+      unique.push_back(sorted[i].second);
+    }
+  }
+
+  TypeLibrary::Header header{};
+  std::copy(TypeLibrary::kMagic, TypeLibrary::kMagic + 4, header.magic);
+  header.version = TypeLibrary::kVersion;
+  header.triple = triple;
+  header.num_types = types.size();
+  header.num_records = records.size();
+  header.num_fields = fields.size();
+  header.num_symbols = unique.size();
+  header.num_indices = indices.size();
+  header.strings_size = strings.size();
+
+  std::string out;
+  auto append{[&out](const auto &table) {
+    out.append(reinterpret_cast<const char *>(table.data()),
+               table.size() * sizeof(table[0]));
+  }};
+  out.append(reinterpret_cast<const char *>(&header), sizeof(header));
+  append(types);
+  append(records);
+  append(fields);
+  append(unique);
+  append(indices);
+  out += strings;
+  return out;
+}
+
+void TypeLibraryBuilder::Save(const std::string &path) const {
+  llvm::TimeTraceScope trace("SaveTypeLibrary");
+  std::error_code ec;
+  llvm::raw_fd_ostream os(path, ec);
+  CHECK_THROW(!ec) << "Cannot write " << path << ": " << ec.message();
+  os << Serialize();
+}
+
+TypeLibraryProvider::TypeLibraryProvider(
+    DecompilationContext &dec_ctx, std::shared_ptr<const TypeLibrary> library)
+    : TypeProvider(dec_ctx), library(std::move(library)) {
+  auto &triple{dec_ctx.ast_ctx.getTargetInfo().getTriple()};
+  llvm::Triple lib_triple{this->library->GetTriple()};
+  matches_target = lib_triple.getArch() == triple.getArch() &&
+                   lib_triple.getOS() == triple.getOS();
+  if (!matches_target) {
+    LOG_FIRST_N(WARNING, 1) << "Type library for " << lib_triple.str()
+                            << " is not used for " << triple.str();
+  }
+}
+
+clang::QualType TypeLibraryProvider::BuildRecord(
+    uint32_t idx, const TypeLibrary::TypeEntry &entry) {
+  auto record{library->GetRecord(entry.a)};
+  if (!record) {
+    return {};
+  }
+  auto &ast_ctx{dec_ctx.ast_ctx};
+  auto &ast{dec_ctx.ast};
+  auto tudecl{ast_ctx.getTranslationUnitDecl()};
+  auto name{library->GetString(record->name).str()};
+  // Records of the same name were declared for other entries, or by others
+  for (auto decl : tudecl->lookup(&ast_ctx.Idents.get(name))) {
+    if (auto existing = clang::dyn_cast<clang::RecordDecl>(decl)) {
+      return built_types[idx] = ast_ctx.getRecordType(existing);
+    }
+  }
+
+  auto is_union{record->flags & TypeLibrary::kUnion};
+  auto fwd_decl{is_union ? ast.CreateUnionDecl(tudecl, name)
+                         : ast.CreateStructDecl(tudecl, name)};
+  tudecl->addDecl(fwd_decl);
+  auto type{ast_ctx.getRecordType(fwd_decl)};
+  // Fields may point back to the record
+  built_types[idx] = type;
+  if (!(record->flags & TypeLibrary::kComplete)) {
+    return type;
+  }
+
+  // Built before the definition, since they may declare other records
+  std::vector<std::pair<const TypeLibrary::FieldEntry *, clang::QualType>>
+      field_types;
+  for (uint64_t i{0}; i < record->num_fields; ++i) {
+    auto field{library->GetField(record->first_field + i)};
+    auto field_type{field ? BuildType(field->type) : clang::QualType()};
+    if (field_type.isNull()) {
+      return type;
+    }
+    field_types.emplace_back(field, field_type);
+  }
+  auto decl{is_union ? ast.CreateUnionDecl(tudecl, name, fwd_decl)
+                     : ast.CreateStructDecl(tudecl, name, fwd_decl)};
+  for (auto [field, field_type] : field_types) {
+    auto field_name{library->GetString(field->name).str()};
+    decl->addDecl(
+        field->flags & TypeLibrary::kBitField
+            ? ast.CreateFieldDecl(decl, field_type, field_name,
+                                  field->bit_width)
+            : ast.CreateFieldDecl(decl, field_type, field_name));
+  }
+  decl->completeDefinition();
+  tudecl->addDecl(decl);
+  return type;
+}
+
+clang::QualType TypeLibraryProvider::BuildType(uint32_t idx) {
+  auto it{built_types.find(idx)};
+  if (it != built_types.end()) {
+    return it->second;
+  }
+  auto entry{library->GetType(idx)};
+  if (!entry) {
+    return {};
+  }
+
+  auto &ast_ctx{dec_ctx.ast_ctx};
+  // Types other than records only refer to types before them, which also
+  // keeps a malformed library from sending this into a loop
+  auto earlier{[this, idx](uint32_t ref) {
+    return ref < idx ? BuildType(ref) : clang::QualType();
+  }};
+  clang::QualType type;
+  switch (static_cast<TypeLibrary::TypeKind>(entry->kind)) {
+    case TypeLibrary::TypeKind::Builtin:
+      type = GetBuiltinType(ast_ctx, entry->a);
+      break;
+    case TypeLibrary::TypeKind::Pointer: {
+      auto pointee{earlier(entry->a)};
+      if (!pointee.isNull()) {
+        type = ast_ctx.getPointerType(pointee);
+      }
+    } break;
+    case TypeLibrary::TypeKind::Array: {
+      auto elem{earlier(entry->a)};
+      if (elem.isNull()) {
+        break;
+      }
+      if (entry->flags & TypeLibrary::kIncompleteArray) {
+        type = ast_ctx.getIncompleteArrayType(
+            elem, clang::ArrayType::ArraySizeModifier::Normal, 0);
+      } else {
+        llvm::APInt size(64, uint64_t{entry->c} << 32 | entry->b);
+        type = ast_ctx.getConstantArrayType(
+            elem, size, nullptr, clang::ArrayType::ArraySizeModifier::Normal,
+            0);
+      }
+    } break;
+    case TypeLibrary::TypeKind::Function: {
+      auto ret{earlier(entry->a)};
+      if (ret.isNull()) {
+        break;
+      }
+      if (entry->flags & TypeLibrary::kNoProto) {
+        type = ast_ctx.getFunctionNoProtoType(ret);
+        break;
+      }
+      std::vector<clang::QualType> params;
+      for (uint64_t i{0}; i < entry->c; ++i) {
+        auto param_idx{library->GetIndex(entry->b + i)};
+        auto param{param_idx ? earlier(*param_idx) : clang::QualType()};
+        if (param.isNull()) {
+          return built_types[idx] = {};
+        }
+        params.push_back(param);
+      }
+      clang::FunctionProtoType::ExtProtoInfo epi;
+      epi.Variadic = entry->flags & TypeLibrary::kVariadic;
+      type = ast_ctx.getFunctionType(ret, params, epi);
+    } break;
+    case TypeLibrary::TypeKind::Record:
+      type = BuildRecord(idx, *entry);
+      break;
+    case TypeLibrary::TypeKind::Typedef: {
+      auto underlying{earlier(entry->b)};
+      if (underlying.isNull()) {
+        break;
+      }
+      auto tudecl{ast_ctx.getTranslationUnitDecl()};
+      auto name{library->GetString(entry->a).str()};
+      clang::TypedefNameDecl *tdef_decl{nullptr};
+      for (auto decl : tudecl->lookup(&ast_ctx.Idents.get(name))) {
+        tdef_decl = clang::dyn_cast<clang::TypedefNameDecl>(decl);
+        if (tdef_decl) {
+          break;
+        }
+      }
+      if (!tdef_decl) {
+        tdef_decl = dec_ctx.ast.CreateTypedefDecl(tudecl, name, underlying);
+        tudecl->addDecl(tdef_decl);
+      }
+      type = ast_ctx.getTypedefType(tdef_decl);
+    } break;
+  }
+
+  if (!type.isNull()) {
+    if (entry->flags & TypeLibrary::kConst) {
+      type.addConst();
+    }
+    if (entry->flags & TypeLibrary::kVolatile) {
+      type.addVolatile();
+    }
+    if (entry->flags & TypeLibrary::kRestrict) {
+      type.addRestrict();
+    }
+  }
+  return built_types[idx] = type;
+}
+
+// Whether values of the IR type `ir` can be declared as `type`, so that the
+// library is not trusted when the IR disagrees with it
+static bool IsCompatible(clang::ASTContext &ast_ctx,
+                         const llvm::DataLayout &dl, llvm::Type *ir,
+                         clang::QualType type) {
+  if (type.isNull()) {
+    return false;
+  }
+  auto canon{type.getCanonicalType()};
+  if (ir->isVoidTy()) {
+    return canon->isVoidType();
+  }
+  if (ir->isPointerTy()) {
+    return canon->isPointerType();
+  }
+  if (ir->isIntegerTy(1)) {
+    return canon->isBooleanType();
+  }
+  if (ir->isIntegerTy()) {
+    return canon->isIntegerType() &&
+           ast_ctx.getTypeSize(canon) == ir->getIntegerBitWidth();
+  }
+  if (canon->isIncompleteType() || !ir->isSized()) {
+    return false;
+  }
+  uint64_t size{dl.getTypeAllocSize(ir)};
+  auto same_size{static_cast<uint64_t>(
+                     ast_ctx.getTypeSizeInChars(canon).getQuantity()) == size};
+  if (ir->isFloatingPointTy()) {
+    return canon->isRealFloatingType() && same_size;
+  }
+  if (ir->isStructTy()) {
+    return canon->isRecordType() && same_size;
+  }
+  if (ir->isArrayTy()) {
+    return canon->isArrayType() && same_size;
+  }
+  return false;
+}
+
+const TypeLibrary::TypeEntry *TypeLibraryProvider::GetFunctionType(
+    llvm::Function &func) {
+  if (!matches_target) {
+    return nullptr;
+  }
+  auto symbol{
+      library->Lookup(func.getName(), TypeLibrary::SymbolKind::Function)};
+  if (!symbol) {
+    return nullptr;
+  }
+  // Functions can be declared with a typedef of their type
+  auto idx{symbol->type};
+  auto entry{library->GetType(idx)};
+  while (entry &&
+         entry->kind == static_cast<uint32_t>(TypeLibrary::TypeKind::Typedef) &&
+         entry->b < idx) {
+    idx = entry->b;
+    entry = library->GetType(idx);
+  }
+  if (!entry ||
+      entry->kind != static_cast<uint32_t>(TypeLibrary::TypeKind::Function)) {
+    return nullptr;
+  }
+  if (!(entry->flags & TypeLibrary::kNoProto) &&
+      (entry->c != func.arg_size() ||
+       !(entry->flags & TypeLibrary::kVariadic) != !func.isVarArg())) {
+    return nullptr;
+  }
+  return entry;
+}
+
+clang::QualType TypeLibraryProvider::GetFunctionReturnType(
+    llvm::Function &func) {
+  auto entry{GetFunctionType(func)};
+  if (!entry) {
+    return {};
+  }
+  auto type{BuildType(entry->a)};
+  if (!IsCompatible(dec_ctx.ast_ctx, func.getParent()->getDataLayout(),
+                    func.getReturnType(), type)) {
+    return {};
+  }
+  return type;
+}
+
+clang::QualType TypeLibraryProvider::GetArgumentType(llvm::Argument &arg) {
+  auto func{arg.getParent()};
+  auto entry{GetFunctionType(*func)};
+  if (!entry || (entry->flags & TypeLibrary::kNoProto)) {
+    return {};
+  }
+  auto param_idx{library->GetIndex(entry->b + arg.getArgNo())};
+  if (!param_idx) {
+    return {};
+  }
+  auto type{BuildType(*param_idx)};
+  if (!IsCompatible(dec_ctx.ast_ctx, func->getParent()->getDataLayout(),
+                    arg.getType(), type)) {
+    return {};
+  }
+  return type;
+}
+
+clang::QualType TypeLibraryProvider::GetGlobalVarType(
+    llvm::GlobalVariable &gvar) {
+  if (!matches_target) {
+    return {};
+  }
+  auto symbol{
+      library->Lookup(gvar.getName(), TypeLibrary::SymbolKind::Variable)};
+  if (!symbol) {
+    return {};
+  }
+  auto type{BuildType(symbol->type)};
+  if (!IsCompatible(dec_ctx.ast_ctx, gvar.getParent()->getDataLayout(),
+                    gvar.getValueType(), type)) {
+    return {};
+  }
+  return type;
+}
+
+}  // namespace rellic
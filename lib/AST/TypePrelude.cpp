@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/TypePrelude.h"
+
+#include <clang/Basic/DiagnosticOptions.h>
+#include <clang/Basic/FileSystemOptions.h>
+#include <clang/Basic/TargetInfo.h>
+#include <clang/Frontend/CompilerInstance.h>
+#include <clang/Serialization/PCHContainerOperations.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/Constants.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/TimeProfiler.h>
+#include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+#include "rellic/AST/Util.h"
+#include "rellic/Exception.h"
+
+namespace rellic {
+
+// Version of the format of `<prefix>.json`
+static constexpr int64_t kPreludeVersion{1};
+
+namespace {
+// Writes a description of types that only depends on what `StructGenerator`
+// uses to generate them. Types that were already described are referred to
+// by the order in which they were first seen, so that recursive types have a
+// finite description.
+class TypeDescriber {
+  llvm::raw_ostream &os;
+  std::unordered_map<llvm::Metadata *, unsigned> seen;
+
+ public:
+  TypeDescriber(llvm::raw_ostream &os) : os(os) {}
+
+  void Describe(llvm::Metadata *node) {
+    if (!node) {
+      os << "null;";
+      return;
+    }
+    auto [it, inserted]{seen.try_emplace(node, seen.size())};
+    if (!inserted) {
+      os << '^' << it->second << ';';
+      return;
+    }
+
+    if (auto type = llvm::dyn_cast<llvm::DIType>(node)) {
+      os << type->getTag() << ' ' << type->getName() << ' '
+         << type->getSizeInBits() << ' ' << type->getOffsetInBits() << ' '
+         << static_cast<unsigned>(type->getFlags());
+    }
+    if (auto comp = llvm::dyn_cast<llvm::DICompositeType>(node)) {
+      os << '{';
+      for (auto elem : comp->getElements()) {
+        Describe(elem);
+      }
+      os << '}';
+      Describe(comp->getBaseType());
+    } else if (auto der = llvm::dyn_cast<llvm::DIDerivedType>(node)) {
+      os << '(';
+      Describe(der->getBaseType());
+      os << ')';
+    } else if (auto basic = llvm::dyn_cast<llvm::DIBasicType>(node)) {
+      os << ' ' << basic->getEncoding();
+    } else if (auto sub = llvm::dyn_cast<llvm::DISubroutineType>(node)) {
+      os << '(';
+      for (auto type : sub->getTypeArray()) {
+        Describe(type);
+      }
+      os << ')';
+    } else if (auto enumerator = llvm::dyn_cast<llvm::DIEnumerator>(node)) {
+      os << "enumerator " << enumerator->getName() << ' '
+         << llvm::toString(enumerator->getValue(), 10,
+                           !enumerator->isUnsigned());
+    } else if (auto subrange = llvm::dyn_cast<llvm::DISubrange>(node)) {
+      os << "subrange ";
+      auto count{subrange->getCount()};
+      if (auto ci = count.dyn_cast<llvm::ConstantInt *>()) {
+        os << ci->getZExtValue();
+      } else {
+        os << '?';
+      }
+    } else if (!llvm::isa<llvm::DIType>(node)) {
+      os << "metadata " << node->getMetadataID();
+    }
+    os << ';';
+  }
+};
+}  // namespace
+
+uint64_t GetDITypeHash(llvm::DIType *type) {
+  std::string text;
+  llvm::raw_string_ostream os(text);
+  TypeDescriber(os).Describe(type);
+  return llvm::xxHash64(os.str());
+}
+
+clang::TypeDecl *TypePrelude::Lookup(uint64_t hash) const {
+  auto it{decls.find(hash)};
+  return it == decls.end() ? nullptr : it->second;
+}
+
+std::unique_ptr<TypePrelude> TypePrelude::Load(const std::string &path,
+                                               const std::string &triple) {
+  llvm::TimeTraceScope trace("LoadTypePrelude");
+  auto buffer{llvm::MemoryBuffer::getFile(path + ".json")};
+  CHECK_THROW(buffer) << "Cannot read " << path << ".json: "
+                      << buffer.getError().message();
+  auto json{llvm::json::parse(buffer.get()->getBuffer())};
+  if (!json) {
+    THROW() << "Malformed prelude " << path
+            << ".json: " << llvm::toString(json.takeError());
+  }
+  auto map{json->getAsObject()};
+  CHECK_THROW(map) << "Malformed prelude " << path << ".json";
+  CHECK_THROW(map->getInteger("version") == kPreludeVersion)
+      << "Unsupported prelude version";
+  auto json_triple{map->getString("triple")};
+  CHECK_THROW(json_triple && llvm::Triple::normalize(*json_triple) ==
+                                 llvm::Triple::normalize(triple))
+      << "Prelude " << path << " was not generated for " << triple;
+
+  static clang::PCHContainerOperations pch_ops;
+  auto diags{clang::CompilerInstance::createDiagnostics(
+      new clang::DiagnosticOptions())};
+  std::unique_ptr<TypePrelude> prelude{new TypePrelude()};
+  prelude->ast_unit = clang::ASTUnit::LoadFromASTFile(
+      path + ".ast", pch_ops.getRawReader(), clang::ASTUnit::LoadEverything,
+      diags, clang::FileSystemOptions());
+  CHECK_THROW(prelude->ast_unit) << "Cannot load " << path << ".ast";
+  prelude->header = path + ".h";
+
+  std::vector<clang::Decl *> decls;
+  EnumerateDecls(prelude->ast_unit->getASTContext().getTranslationUnitDecl(),
+                 decls);
+  for (auto &entry : GetJSONEntries(*map, "types")) {
+    auto &pair{*entry.getAsArray()};
+    CHECK_THROW(pair.size() == 2) << "Malformed entry in types";
+    uint64_t hash;
+    CHECK_THROW(llvm::to_integer(GetJSONString(pair[0]), hash, 16))
+        << "Invalid type hash";
+    auto decl{clang::dyn_cast<clang::TypeDecl>(
+        decls[GetJSONIndex(pair[1], decls.size())])};
+    CHECK_THROW(decl) << "Type hash does not refer to a type";
+    prelude->decls[hash] = decl;
+  }
+  return prelude;
+}
+
+void TypePrelude::Save(clang::ASTUnit &ast_unit, const DeclMap &decls,
+                       const std::string &path) {
+  llvm::TimeTraceScope trace("SaveTypePrelude");
+  auto &ast_ctx{ast_unit.getASTContext()};
+  auto tudecl{ast_ctx.getTranslationUnitDecl()};
+  std::vector<clang::Decl *> all_decls;
+  EnumerateDecls(tudecl, all_decls);
+  auto decl_idx{Invert(all_decls)};
+
+  // Sorted, so that the same types always give the same file
+  std::vector<std::pair<uint64_t, clang::TypeDecl *>> sorted_decls{
+      decls.begin(), decls.end()};
+  std::sort(sorted_decls.begin(), sorted_decls.end(),
+            [](auto &a, auto &b) { return a.first < b.first; });
+  llvm::json::Array json_types;
+  for (auto [hash, decl] : sorted_decls) {
+    auto it{decl_idx.find(decl)};
+    CHECK_THROW(it != decl_idx.end())
+        << "Type is not declared in the translation unit";
+    json_types.push_back(
+        llvm::json::Array{llvm::utohexstr(hash, /*LowerCase=*/true),
+                          it->second});
+  }
+  llvm::json::Object map{
+      {"version", kPreludeVersion},
+      {"triple", ast_ctx.getTargetInfo().getTriple().str()},
+      {"types", std::move(json_types)},
+  };
+
+  // The map is written last, so that it is never found without the rest
+  std::error_code ec;
+  {
+    llvm::raw_fd_ostream os(path + ".h", ec);
+    CHECK_THROW(!ec) << "Cannot write " << path << ".h: " << ec.message();
+    os << "#pragma once\n\n";
+    tudecl->print(os);
+  }
+  CHECK_THROW(!ast_unit.Save(path + ".ast"))
+      << "Cannot write " << path << ".ast";
+  llvm::raw_fd_ostream os(path + ".json", ec);
+  CHECK_THROW(!ec) << "Cannot write " << path << ".json: " << ec.message();
+  os << llvm::json::Value(std::move(map));
+}
+
+}  // namespace rellic
@@ -24,6 +24,8 @@ clang::QualType TypeProvider::GetGlobalVarType(llvm::GlobalVariable&) {
   return {};
 }
 
+void TypeProvider::Prefetch(llvm::Module&) {}
+
 // Defers to DecompilationContext::GetQualType
 class FallbackTypeProvider : public TypeProvider {
  public:
@@ -131,40 +133,55 @@ TypeProviderCombiner::TypeProviderCombiner(DecompilationContext& dec_ctx)
 
 void TypeProviderCombiner::AddProvider(std::unique_ptr<TypeProvider> provider) {
   providers.push_back(std::move(provider));
+  // The new provider takes precedence over the answers given so far
+  ClearCache();
 }
 
-clang::QualType TypeProviderCombiner::GetFunctionReturnType(
-    llvm::Function& func) {
-  for (auto it{providers.rbegin()}; it != providers.rend(); ++it) {
-    auto& provider{*it};
-    auto res{provider->GetFunctionReturnType(func)};
+template <typename TValue, typename TQuery>
+static clang::QualType Combine(
+    std::vector<std::unique_ptr<TypeProvider>>& providers,
+    llvm::DenseMap<TValue*, clang::QualType>& cache, TValue& value,
+    TQuery query) {
+  auto it{cache.find(&value)};
+  if (it != cache.end()) {
+    return it->second;
+  }
+  clang::QualType res;
+  for (auto provider{providers.rbegin()}; provider != providers.rend();
+       ++provider) {
+    res = ((**provider).*query)(value);
     if (!res.isNull()) {
-      return res;
+      break;
     }
   }
-  return {};
+  cache[&value] = res;
+  return res;
+}
+
+clang::QualType TypeProviderCombiner::GetFunctionReturnType(
+    llvm::Function& func) {
+  return Combine(providers, return_types, func,
+                 &TypeProvider::GetFunctionReturnType);
 }
 
 clang::QualType TypeProviderCombiner::GetArgumentType(llvm::Argument& arg) {
-  for (auto it{providers.rbegin()}; it != providers.rend(); ++it) {
-    auto& provider{*it};
-    auto res{provider->GetArgumentType(arg)};
-    if (!res.isNull()) {
-      return res;
-    }
-  }
-  return {};
+  return Combine(providers, arg_types, arg, &TypeProvider::GetArgumentType);
 }
 
 clang::QualType TypeProviderCombiner::GetGlobalVarType(
     llvm::GlobalVariable& gvar) {
-  for (auto it{providers.rbegin()}; it != providers.rend(); ++it) {
-    auto& provider{*it};
-    auto res{provider->GetGlobalVarType(gvar)};
-    if (!res.isNull()) {
-      return res;
-    }
+  return Combine(providers, gvar_types, gvar, &TypeProvider::GetGlobalVarType);
+}
+
+void TypeProviderCombiner::Prefetch(llvm::Module& module) {
+  for (auto& provider : providers) {
+    provider->Prefetch(module);
   }
-  return {};
 }
-}  // namespace rellic
\ No newline at end of file
+
+void TypeProviderCombiner::ClearCache() {
+  return_types.clear();
+  arg_types.clear();
+  gvar_types.clear();
+}
+}  // namespace rellic
@@ -15,13 +15,30 @@
 #include <clang/Frontend/ASTUnit.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <llvm/ADT/Hashing.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/TimeProfiler.h>
 
+#include <algorithm>
+#include <limits>
 #include <numeric>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
 #include "rellic/AST/ASTBuilder.h"
+#include "rellic/AST/AlphaCache.h"
+#include "rellic/AST/Checkpoint.h"
+#include "rellic/AST/DebugInfoCollector.h"
 #include "rellic/AST/TypeProvider.h"
+#include "rellic/AST/Z3Portfolio.h"
+#include "rellic/AST/Z3QueryLog.h"
+#include "rellic/Activity.h"
 #include "rellic/BC/Util.h"
 #include "rellic/Exception.h"
+#include "rellic/Log.h"
 
 namespace rellic {
 
@@ -198,6 +215,134 @@ bool IsEquivalent(clang::Expr *a, clang::Expr *b) {
   return ev.Visit(a, b);
 }
 
+// Hashes exactly what `EqualityVisitor` compares. Expressions it cannot compare
+// are never equivalent to anything, so they are hashed by identity.
+class HashVisitor : public clang::StmtVisitor<HashVisitor, size_t> {
+  ExprHasher &hasher;
+
+  size_t Child(clang::Expr *expr) { return hasher.Get(expr).hash; }
+
+ public:
+  HashVisitor(ExprHasher &hasher) : hasher(hasher) {}
+
+  size_t VisitIntegerLiteral(clang::IntegerLiteral *expr) {
+    return llvm::hash_combine(expr->getStmtClass(), expr->getValue());
+  }
+
+  size_t VisitCharacterLiteral(clang::CharacterLiteral *expr) {
+    return llvm::hash_combine(expr->getStmtClass(), expr->getValue());
+  }
+
+  size_t VisitStringLiteral(clang::StringLiteral *expr) {
+    return llvm::hash_combine(expr->getStmtClass(), expr->getBytes());
+  }
+
+  size_t VisitFloatingLiteral(clang::FloatingLiteral *expr) {
+    // Positive and negative zeros compare equal
+    auto value{expr->getValue()};
+    size_t hash{0};
+    if (!value.isZero()) {
+      hash = llvm::hash_value(value);
+    }
+    return llvm::hash_combine(expr->getStmtClass(), hash);
+  }
+
+  size_t VisitCastExpr(clang::CastExpr *expr) {
+    // Any two casts can be equivalent, regardless of their kind
+    return llvm::hash_combine(clang::Stmt::CStyleCastExprClass,
+                              expr->getType().getAsOpaquePtr(),
+                              Child(expr->getSubExpr()));
+  }
+
+  size_t VisitUnaryOperator(clang::UnaryOperator *expr) {
+    return llvm::hash_combine(clang::Stmt::UnaryOperatorClass,
+                              expr->getOpcode(), Child(expr->getSubExpr()));
+  }
+
+  size_t VisitBinaryOperator(clang::BinaryOperator *expr) {
+    return llvm::hash_combine(clang::Stmt::BinaryOperatorClass,
+                              expr->getOpcode(), Child(expr->getLHS()),
+                              Child(expr->getRHS()));
+  }
+
+  size_t VisitConditionalOperator(clang::ConditionalOperator *expr) {
+    return llvm::hash_combine(expr->getStmtClass(), Child(expr->getCond()),
+                              Child(expr->getTrueExpr()),
+                              Child(expr->getFalseExpr()));
+  }
+
+  size_t VisitArraySubscriptExpr(clang::ArraySubscriptExpr *expr) {
+    return llvm::hash_combine(expr->getStmtClass(), Child(expr->getBase()),
+                              Child(expr->getIdx()));
+  }
+
+  size_t VisitCallExpr(clang::CallExpr *expr) {
+    auto hash{llvm::hash_combine(clang::Stmt::CallExprClass,
+                                 Child(expr->getCallee()))};
+    for (auto arg : expr->arguments()) {
+      hash = llvm::hash_combine(hash, Child(arg));
+    }
+    return hash;
+  }
+
+  size_t VisitMemberExpr(clang::MemberExpr *expr) {
+    return llvm::hash_combine(expr->getStmtClass(), expr->isArrow(),
+                              expr->getMemberDecl(),
+                              expr->getType().getAsOpaquePtr(),
+                              Child(expr->getBase()));
+  }
+
+  size_t VisitDeclRefExpr(clang::DeclRefExpr *expr) {
+    return llvm::hash_combine(expr->getStmtClass(), expr->getDecl());
+  }
+
+  size_t VisitInitListExpr(clang::InitListExpr *expr) {
+    auto hash{llvm::hash_combine(expr->getStmtClass(), expr->getNumInits())};
+    for (auto init : expr->inits()) {
+      hash = llvm::hash_combine(hash, Child(init));
+    }
+    return hash;
+  }
+
+  size_t VisitCompoundLiteralExpr(clang::CompoundLiteralExpr *expr) {
+    return llvm::hash_combine(expr->getStmtClass(),
+                              expr->getType().getAsOpaquePtr(),
+                              Child(expr->getInitializer()));
+  }
+
+  size_t VisitParenExpr(clang::ParenExpr *expr) {
+    return llvm::hash_combine(expr->getStmtClass(), Child(expr->getSubExpr()));
+  }
+
+  size_t VisitStmt(clang::Stmt *stmt) { return llvm::hash_value(stmt); }
+};
+
+ExprHasher::Info ExprHasher::Get(clang::Expr *expr) {
+  auto it{cache.find(expr)};
+  if (it != cache.end()) {
+    return it->second;
+  }
+
+  unsigned size{1};
+  for (auto child : expr->children()) {
+    if (auto child_expr = clang::dyn_cast_or_null<clang::Expr>(child)) {
+      size += Get(child_expr).size;
+    }
+  }
+  Info info{HashVisitor(*this).Visit(expr), size};
+  cache[expr] = info;
+  return info;
+}
+
+bool IsEquivalent(clang::Expr *a, clang::Expr *b, ExprHasher &hasher) {
+  auto info_a{hasher.Get(a)};
+  auto info_b{hasher.Get(b)};
+  if (info_a.hash != info_b.hash || info_a.size != info_b.size) {
+    return false;
+  }
+  return IsEquivalent(a, b);
+}
+
 class ExprCloner : public clang::StmtVisitor<ExprCloner, clang::Expr *> {
   ASTBuilder ast;
   clang::ASTContext &ctx;
@@ -337,6 +482,7 @@ std::string ClangThingToString(clang::QualType ty) {
 }
 
 z3::goal ApplyTactic(const z3::tactic &tactic, z3::expr expr) {
+  llvm::TimeTraceScope trace("ApplyTactic");
   z3::goal goal(tactic.ctx());
   goal.add(expr.simplify());
   auto app{tactic(goal)};
@@ -354,11 +500,643 @@ z3::expr HeavySimplify(z3::expr expr) {
     return expr.ctx().bool_val(true);
   }
 
-  z3::tactic aig(expr.ctx(), "aig");
-  z3::tactic simplify(expr.ctx(), "simplify");
-  z3::tactic ctx_solver_simplify(expr.ctx(), "ctx-solver-simplify");
-  auto tactic{simplify & aig & ctx_solver_simplify};
-  return ApplyTactic(tactic, expr).as_expr();
+  return ApplyTactic(MakeHeavySimplifyTactic(expr.ctx()), expr).as_expr();
+}
+
+z3::tactic MakeHeavySimplifyTactic(z3::context &ctx) {
+  return z3::tactic(ctx, "simplify") & z3::tactic(ctx, "aig") &
+         z3::tactic(ctx, "ctx-solver-simplify");
+}
+
+// Whether queries that can be raced across a portfolio are only given
+// `z3_portfolio` milliseconds on their own, which they are if that is within
+// `z3_timeout`
+static bool UsesPortfolio(DecompilationContext &dec_ctx) {
+  auto first{dec_ctx.z3_portfolio};
+  return first && (!dec_ctx.z3_timeout || first < dec_ctx.z3_timeout);
+}
+
+// Time limit of the first attempt at a query
+static unsigned GetFirstTimeout(DecompilationContext &dec_ctx,
+                                bool portfolio = true) {
+  return portfolio && UsesPortfolio(dec_ctx) ? dec_ctx.z3_portfolio
+                                             : dec_ctx.z3_timeout;
+}
+
+// Races `expr` across `portfolio` once its first attempt ran out of time,
+// for the rest of `z3_timeout`. Must be called within a `Z3Query`.
+static std::optional<z3::goal> RacePortfolio(
+    DecompilationContext &dec_ctx, z3::expr expr,
+    const std::vector<TacticBuilder> &portfolio) {
+  auto &cache{dec_ctx.z3_cache};
+  if (dec_ctx.Cancelled()) {
+    return std::nullopt;
+  }
+  ++cache.portfolio_races;
+  if (dec_ctx.progress) {
+    ++dec_ctx.progress->z3_calls;
+  }
+  auto timeout{dec_ctx.z3_timeout ? dec_ctx.z3_timeout - dec_ctx.z3_portfolio
+                                  : 0};
+  auto goal{RaceTactics(expr, portfolio, timeout, dec_ctx.progress)};
+  if (goal) {
+    ++cache.portfolio_wins;
+  }
+  return goal;
+}
+
+// Decides the satisfiability of `expr` with the portfolio, for the queries
+// that the solver could not decide within their first attempt
+static z3::check_result RaceProof(DecompilationContext &dec_ctx,
+                                  z3::expr expr) {
+  auto goal{RacePortfolio(dec_ctx, expr, GetProvePortfolio())};
+  if (goal && goal->is_decided_unsat()) {
+    return z3::unsat;
+  }
+  if (goal && goal->is_decided_sat()) {
+    return z3::sat;
+  }
+  return z3::unknown;
+}
+
+// Applies `tactic` to `expr`, giving up after `timeout` milliseconds if
+// nonzero or once the work is cancelled. Z3 reports both by failing the
+// tactic. If `portfolio` is not null, it takes over from the first attempt as
+// described by `z3_portfolio`.
+static std::optional<z3::goal> TryApplyTactic(
+    DecompilationContext &dec_ctx, z3::tactic tactic, z3::expr expr,
+    const std::vector<TacticBuilder> *portfolio = nullptr) {
+  auto timeout{GetFirstTimeout(dec_ctx, portfolio != nullptr)};
+  DecompilationContext::Z3Query query{dec_ctx};
+  if (query.Cancelled()) {
+    return std::nullopt;
+  }
+  if (dec_ctx.progress) {
+    ++dec_ctx.progress->z3_calls;
+  }
+  try {
+    if (!timeout) {
+      return ApplyTactic(tactic, expr);
+    }
+    return ApplyTactic(z3::try_for(tactic, timeout), expr);
+  } catch (z3::exception &) {
+    if (query.Cancelled()) {
+      ++dec_ctx.z3_cache.interrupts;
+      return std::nullopt;
+    }
+    if (!timeout) {
+      throw;
+    }
+  }
+  if (portfolio && UsesPortfolio(dec_ctx)) {
+    auto goal{RacePortfolio(dec_ctx, expr, *portfolio)};
+    if (goal) {
+      return goal;
+    }
+    if (query.Cancelled()) {
+      ++dec_ctx.z3_cache.interrupts;
+      return std::nullopt;
+    }
+  }
+  if (dec_ctx.z3_timeout) {
+    ++dec_ctx.z3_cache.timeouts;
+  }
+  return std::nullopt;
+}
+
+static void CollectVars(z3::expr expr, std::unordered_set<unsigned> &visited,
+                        std::unordered_set<unsigned> &vars) {
+  if (!expr.is_app() || !visited.insert(expr.id()).second) {
+    return;
+  }
+  if (expr.is_const() && expr.decl().decl_kind() == Z3_OP_UNINTERPRETED) {
+    vars.insert(expr.id());
+    return;
+  }
+  for (unsigned i{0}; i < expr.num_args(); ++i) {
+    CollectVars(expr.arg(i), visited, vars);
+  }
+}
+
+// Returns true if `a` and `b` both depend on some variable, but have none in
+// common
+static bool AreIndependent(z3::expr a, z3::expr b) {
+  std::unordered_set<unsigned> visited, vars_a, vars_b;
+  CollectVars(a, visited, vars_a);
+  visited.clear();
+  CollectVars(b, visited, vars_b);
+  if (vars_a.empty() || vars_b.empty()) {
+    return false;
+  }
+  for (auto var : vars_b) {
+    if (vars_a.count(var)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool IsNegation(z3::expr a, z3::expr b) {
+  return (a.is_not() && z3::eq(a.arg(0), b)) ||
+         (b.is_not() && z3::eq(b.arg(0), a));
+}
+
+// Decides the validity of formulas whose answer is obvious from their shape:
+// constants, equivalences between identical or negated formulas, and mutual
+// exclusion of a formula and its negation. Relations between independent
+// formulas are reported as not valid, which is only wrong if one of them is
+// valid or unsatisfiable by itself. Like a timeout, that only means a
+// refinement is missed, and `certain` is cleared since the answer is a guess.
+static std::optional<bool> ProveSyntactically(z3::expr expr, bool &certain) {
+  if (expr.is_true()) {
+    return true;
+  }
+  if (expr.is_false()) {
+    return false;
+  }
+
+  if (expr.is_eq() && expr.num_args() == 2) {
+    auto a{expr.arg(0)};
+    auto b{expr.arg(1)};
+    if (z3::eq(a, b)) {
+      return true;
+    }
+    if (IsNegation(a, b)) {
+      return false;
+    }
+    if (AreIndependent(a, b)) {
+      certain = false;
+      return false;
+    }
+  } else if (expr.is_not() && expr.arg(0).is_and() &&
+             expr.arg(0).num_args() == 2) {
+    auto a{expr.arg(0).arg(0)};
+    auto b{expr.arg(0).arg(1)};
+    if (IsNegation(a, b)) {
+      return true;
+    }
+    if (AreIndependent(a, b)) {
+      certain = false;
+      return false;
+    }
+  }
+
+  return std::nullopt;
+}
+
+// Builds the BDD of a boolean formula. Subformulas that are not boolean
+// connectives become variables of their own, and `opaque` is set if any of them
+// is not a boolean constant, since their relations are then unknown to the BDD.
+static BDD::Node ToBDD(DecompilationContext::BDDEngine &engine, z3::expr expr,
+                       std::unordered_map<unsigned, BDD::Node> &memo,
+                       bool &opaque) {
+  auto it{memo.find(expr.id())};
+  if (it != memo.end()) {
+    return it->second;
+  }
+
+  auto &bdd{engine.bdd};
+  auto Arg{[&](unsigned i) {
+    return ToBDD(engine, expr.arg(i), memo, opaque);
+  }};
+  auto Fold{[&](auto op, BDD::Node init) {
+    auto result{init};
+    for (unsigned i{0}; i < expr.num_args(); ++i) {
+      result = (bdd.*op)(result, Arg(i));
+    }
+    return result;
+  }};
+
+  BDD::Node result;
+  if (expr.is_true()) {
+    result = BDD::True;
+  } else if (expr.is_false()) {
+    result = BDD::False;
+  } else if (expr.is_not()) {
+    result = bdd.Not(Arg(0));
+  } else if (expr.is_and()) {
+    result = Fold(&BDD::And, BDD::True);
+  } else if (expr.is_or()) {
+    result = Fold(&BDD::Or, BDD::False);
+  } else if (expr.is_xor()) {
+    result = Fold(&BDD::Xor, BDD::False);
+  } else if (expr.is_implies()) {
+    result = bdd.Or(bdd.Not(Arg(0)), Arg(1));
+  } else if (expr.is_eq() && expr.num_args() == 2 && expr.arg(0).is_bool()) {
+    result = bdd.Iff(Arg(0), Arg(1));
+  } else if (expr.is_ite() && expr.is_bool()) {
+    result = bdd.Ite(Arg(0), Arg(1), Arg(2));
+  } else {
+    if (!expr.is_const() || expr.decl().decl_kind() != Z3_OP_UNINTERPRETED) {
+      opaque = true;
+    }
+    auto [var, inserted]{engine.vars.try_emplace(
+        expr.id(), static_cast<unsigned>(engine.atoms.size()))};
+    if (inserted) {
+      engine.atoms.push_back(expr);
+    }
+    result = bdd.Var(var->second);
+  }
+  memo[expr.id()] = result;
+  return result;
+}
+
+// Returns whether `expr` is valid, or nothing if the BDD cannot tell
+static std::optional<bool> ProveWithBDD(DecompilationContext::BDDEngine &engine,
+                                        z3::expr expr) {
+  if (!expr.is_bool()) {
+    return std::nullopt;
+  }
+
+  std::unordered_map<unsigned, BDD::Node> memo;
+  auto opaque{false};
+  auto node{ToBDD(engine, expr, memo, opaque)};
+  if (engine.bdd.Overflowed()) {
+    engine.bdd.Clear();
+    return std::nullopt;
+  }
+  if (node == BDD::True) {
+    // Valid no matter how the opaque subformulas are related
+    return true;
+  }
+  if (opaque) {
+    return std::nullopt;
+  }
+  return false;
+}
+
+// Returns the number of distinct nodes in the DAG of `expr`
+static uint64_t CountNodes(z3::expr expr) {
+  std::unordered_set<unsigned> seen;
+  std::vector<z3::expr> worklist{expr};
+  while (!worklist.empty()) {
+    auto e{worklist.back()};
+    worklist.pop_back();
+    if (!seen.insert(e.id()).second || !e.is_app()) {
+      continue;
+    }
+    for (auto i{0U}; i < e.num_args(); ++i) {
+      worklist.push_back(e.arg(i));
+    }
+  }
+  return seen.size();
+}
+
+// Decides the validity of `expr` from `dec_ctx.z3_cache`, from its shape or
+// with `dec_ctx.bdd_engine`, memoizing what it decides. Returns nothing if the
+// solver needs to be asked, and false without memoizing anything if the work
+// is out of budget or cancelled.
+static std::optional<bool> ProveWithoutSolver(DecompilationContext &dec_ctx,
+                                              z3::expr expr) {
+  auto &cache{dec_ctx.z3_cache};
+  auto it{cache.proofs.find(expr.id())};
+  if (it != cache.proofs.end()) {
+    ++cache.prove_hits;
+    Z3Statistics z3;
+    z3.cache_hits = 1;
+    dec_ctx.RecordZ3(z3);
+    return it->second;
+  }
+
+  bool certain{true};
+  if (auto result = ProveSyntactically(expr, certain)) {
+    ++cache.prove_shortcuts;
+    // Guesses are not memoized, like undecided proofs
+    if (certain) {
+      cache.exprs.push_back(expr);
+      cache.proofs[expr.id()] = *result;
+    }
+    return *result;
+  }
+
+  // Cancelled queries are not memoized, since they were never decided
+  if (dec_ctx.OutOfBudget() || dec_ctx.Cancelled()) {
+    return false;
+  }
+
+  ++cache.prove_misses;
+  if (dec_ctx.bdd_engine) {
+    if (auto result = ProveWithBDD(*dec_ctx.bdd_engine, expr)) {
+      ++cache.bdd_decisions;
+      cache.exprs.push_back(expr);
+      cache.proofs[expr.id()] = *result;
+      return *result;
+    }
+  }
+  if (dec_ctx.alpha_cache && !dec_ctx.syntactic_conditions) {
+    auto key{AlphaCache::Canonicalize(expr)};
+    if (auto result = dec_ctx.alpha_cache->GetProof(key)) {
+      ++cache.alpha_hits;
+      cache.exprs.push_back(expr);
+      cache.proofs[expr.id()] = *result;
+      return *result;
+    }
+  }
+  return std::nullopt;
+}
+
+static void SetSolverTimeout(DecompilationContext &dec_ctx) {
+  auto &z3_solver{dec_ctx.z3_solver};
+  auto timeout{GetFirstTimeout(dec_ctx)};
+  if (z3_solver.timeout != timeout) {
+    z3::params params{dec_ctx.z3_ctx};
+    params.set("timeout",
+               timeout ? timeout : std::numeric_limits<unsigned>::max());
+    z3_solver.solver.set(params);
+    z3_solver.timeout = timeout;
+  }
+}
+
+static const char *GetCheckName(z3::check_result check) {
+  switch (check) {
+    case z3::sat:
+      return "sat";
+    case z3::unsat:
+      return "unsat";
+    default:
+      return "unknown";
+  }
+}
+
+// Records a query to `dec_ctx.z3_query_log`, if any. Interrupted queries are
+// left out, since they cannot be reproduced.
+static void LogQuery(DecompilationContext &dec_ctx, z3::expr expr,
+                     const char *kind, const char *tactic, const char *result,
+                     Duration time) {
+  if (dec_ctx.z3_query_log && !dec_ctx.Cancelled()) {
+    dec_ctx.z3_query_log->Record(dec_ctx, expr, kind, tactic, result, time);
+  }
+}
+
+// Called once a query ran out of `z3_timeout`. What the function being
+// refined becomes without its answer depends on timing, so the function is
+// degraded like one that is out of budget.
+static void DegradeOnTimeout(DecompilationContext &dec_ctx) {
+  if (dec_ctx.current_function) {
+    dec_ctx.degraded_functions.insert(dec_ctx.current_function);
+  }
+}
+
+// Memoizes the answer of the solver about the validity of `expr`. Returns
+// false if the solver did not decide it, in which case nothing is memoized,
+// since another attempt may decide it.
+static bool RecordProof(DecompilationContext &dec_ctx, z3::expr expr,
+                        z3::check_result check, Z3Statistics &z3) {
+  auto &cache{dec_ctx.z3_cache};
+  if (check == z3::unknown) {
+    if (dec_ctx.Cancelled()) {
+      ++cache.interrupts;
+    } else if (dec_ctx.z3_timeout) {
+      ++cache.timeouts;
+      ++z3.timeouts;
+      DegradeOnTimeout(dec_ctx);
+    }
+    return false;
+  }
+  auto result{check == z3::unsat};
+  cache.exprs.push_back(expr);
+  cache.proofs[expr.id()] = result;
+  if (dec_ctx.alpha_cache) {
+    dec_ctx.alpha_cache->SetProof(AlphaCache::Canonicalize(expr), result);
+  }
+  return result;
+}
+
+bool Prove(DecompilationContext &dec_ctx, z3::expr expr) {
+  if (auto result = ProveWithoutSolver(dec_ctx, expr)) {
+    return *result;
+  }
+  if (dec_ctx.syntactic_conditions) {
+    return false;
+  }
+
+  SetSolverTimeout(dec_ctx);
+
+  // Solving in a scope of its own keeps the solver and what it has learned
+  // about the context around for the next query
+  Z3Statistics z3;
+  auto &solver{dec_ctx.z3_solver.solver};
+  auto check{z3::unknown};
+  {
+    DecompilationContext::Z3Query query{dec_ctx};
+    if (query.Cancelled()) {
+      return false;
+    }
+    if (dec_ctx.progress) {
+      ++dec_ctx.progress->z3_calls;
+    }
+    ScopedTimer timer(z3.time);
+    ScopedCounters counters(z3.counters);
+    solver.push();
+    try {
+      solver.add(!expr);
+      check = solver.check();
+    } catch (z3::exception &) {
+      // Treated as unprovable, like a query that ran out of time
+    }
+    solver.pop();
+    if (check == z3::unknown && UsesPortfolio(dec_ctx)) {
+      check = RaceProof(dec_ctx, !expr);
+    }
+  }
+  z3.queries = 1;
+  z3.nodes_in = CountNodes(expr);
+  z3.max_nodes = z3.nodes_in;
+  LogQuery(dec_ctx, expr, "prove", "solver", GetCheckName(check), z3.time);
+  auto result{RecordProof(dec_ctx, expr, check, z3)};
+  dec_ctx.RecordZ3(z3);
+  return result;
+}
+
+std::vector<CondVerdict> ClassifyConds(DecompilationContext &dec_ctx,
+                                       const std::vector<unsigned> &conds) {
+  std::vector<CondVerdict> verdicts(conds.size(), CondVerdict::Unknown);
+  // Both polarities of every condition, and which of them the cheap checks
+  // could not decide
+  std::vector<z3::expr> polarities;
+  std::vector<z3::expr> pending;
+  std::unordered_set<unsigned> queued;
+  for (auto cond : conds) {
+    auto expr{dec_ctx.z3_exprs[cond]};
+    for (auto polarity : {expr, !expr}) {
+      polarities.push_back(polarity);
+      if (!ProveWithoutSolver(dec_ctx, polarity) &&
+          queued.insert(polarity.id()).second) {
+        pending.push_back(polarity);
+      }
+    }
+  }
+
+  if (!pending.empty() && !dec_ctx.syntactic_conditions) {
+    SetSolverTimeout(dec_ctx);
+
+    // Every formula is guarded by a fresh literal and checked under the
+    // assumption of that literal, so that the whole batch shares one scope of
+    // the solver and what it learns along the way
+    Z3Statistics z3;
+    auto &solver{dec_ctx.z3_solver.solver};
+    DecompilationContext::Z3Query query{dec_ctx};
+    solver.push();
+    for (auto expr : pending) {
+      // Like single queries, the rest of the batch is left undecided once the
+      // function is out of budget or the work is cancelled
+      if (dec_ctx.OutOfBudget() || query.Cancelled()) {
+        break;
+      }
+      if (dec_ctx.progress) {
+        ++dec_ctx.progress->z3_calls;
+      }
+      auto check{z3::unknown};
+      Duration time{0};
+      {
+        ScopedTimer timer(time);
+        ScopedCounters counters(z3.counters);
+        try {
+          auto guard{dec_ctx.z3_ctx.bool_const(
+              ("validity!" + std::to_string(expr.id())).c_str())};
+          solver.add(z3::implies(guard, !expr));
+          z3::expr_vector assumptions{dec_ctx.z3_ctx};
+          assumptions.push_back(guard);
+          check = solver.check(assumptions);
+        } catch (z3::exception &) {
+          // Treated as unprovable, like a query that ran out of time
+        }
+        if (check == z3::unknown && UsesPortfolio(dec_ctx)) {
+          check = RaceProof(dec_ctx, !expr);
+        }
+      }
+      z3.time += time;
+      ++z3.queries;
+      auto nodes{CountNodes(expr)};
+      z3.nodes_in += nodes;
+      z3.max_nodes = std::max(z3.max_nodes, nodes);
+      LogQuery(dec_ctx, expr, "prove", "solver", GetCheckName(check), time);
+      RecordProof(dec_ctx, expr, check, z3);
+    }
+    solver.pop();
+    dec_ctx.RecordZ3(z3);
+  }
+
+  auto &proofs{dec_ctx.z3_cache.proofs};
+  auto Proved{[&proofs](z3::expr expr) {
+    auto it{proofs.find(expr.id())};
+    return it != proofs.end() && it->second;
+  }};
+  for (size_t i{0}; i < conds.size(); ++i) {
+    if (Proved(polarities[2 * i])) {
+      verdicts[i] = CondVerdict::True;
+    } else if (Proved(polarities[2 * i + 1])) {
+      verdicts[i] = CondVerdict::False;
+    }
+  }
+  return verdicts;
+}
+
+CondVerdict ClassifyCond(DecompilationContext &dec_ctx, unsigned cond) {
+  return ClassifyConds(dec_ctx, {cond}).front();
+}
+
+z3::expr HeavySimplify(DecompilationContext &dec_ctx, z3::expr expr) {
+  auto &cache{dec_ctx.z3_cache};
+  auto it{cache.simplified.find(expr.id())};
+  if (it != cache.simplified.end()) {
+    ++cache.simplify_hits;
+    Z3Statistics z3;
+    z3.cache_hits = 1;
+    dec_ctx.RecordZ3(z3);
+    return cache.exprs[it->second];
+  }
+
+  if (dec_ctx.OutOfBudget() || dec_ctx.Cancelled()) {
+    return expr;
+  }
+
+  ++cache.simplify_misses;
+  z3::expr result{expr};
+  auto nodes{CountNodes(expr)};
+  auto &stats{dec_ctx.stats};
+  // Large formulas are memoized as they are, or as lightly simplified, so
+  // that they are not measured again
+  auto light{dec_ctx.simplify_light_nodes &&
+             nodes > dec_ctx.simplify_light_nodes};
+  auto skipped{dec_ctx.simplify_max_nodes &&
+               nodes > dec_ctx.simplify_max_nodes};
+  // Simplified forms that other functions found for the same formula, up to
+  // the names of its variables
+  std::optional<AlphaCache::Key> alpha_key;
+  std::optional<z3::expr> shared;
+  if (dec_ctx.alpha_cache && !skipped && !dec_ctx.syntactic_conditions) {
+    alpha_key = AlphaCache::Canonicalize(expr);
+    shared = dec_ctx.alpha_cache->GetSimplified(*alpha_key);
+  }
+  if (skipped) {
+    ++stats.skipped_simplifications;
+  } else if (dec_ctx.syntactic_conditions) {
+    ++stats.light_simplifications;
+    result = expr.simplify();
+  } else if (shared) {
+    ++cache.alpha_hits;
+    if (light) {
+      ++stats.light_simplifications;
+    } else {
+      ++stats.full_simplifications;
+    }
+    result = *shared;
+  } else if (!light && Prove(dec_ctx, expr)) {
+    ++stats.full_simplifications;
+    result = expr.ctx().bool_val(true);
+    if (alpha_key) {
+      dec_ctx.alpha_cache->SetSimplified(*alpha_key, result);
+    }
+  } else if (dec_ctx.Cancelled()) {
+    return expr;
+  } else {
+    auto &z3_solver{dec_ctx.z3_solver};
+    Z3Statistics z3;
+    std::optional<z3::goal> goal;
+    {
+      ScopedTimer timer(z3.time);
+      ScopedCounters counters(z3.counters);
+      if (light) {
+        goal = TryApplyTactic(dec_ctx, z3_solver.light_simplify, expr);
+      } else {
+        goal = TryApplyTactic(dec_ctx, z3_solver.heavy_simplify, expr,
+                              &GetSimplifyPortfolio());
+      }
+    }
+    z3.queries = 1;
+    z3.nodes_in = nodes;
+    z3.max_nodes = nodes;
+    LogQuery(dec_ctx, expr, "simplify",
+             light ? "light_simplify" : "heavy_simplify",
+             goal ? "simplified" : "failed", z3.time);
+    if (goal) {
+      result = goal->as_expr();
+      z3.nodes_out = CountNodes(result);
+      if (alpha_key) {
+        dec_ctx.alpha_cache->SetSimplified(*alpha_key, result);
+      }
+    } else if (!dec_ctx.Cancelled() && dec_ctx.z3_timeout) {
+      z3.timeouts = 1;
+      DegradeOnTimeout(dec_ctx);
+    }
+    dec_ctx.RecordZ3(z3);
+    // Like undecided proofs, simplifications that were interrupted or ran
+    // out of time are not memoized
+    if (!goal && (dec_ctx.Cancelled() || dec_ctx.z3_timeout)) {
+      return expr;
+    }
+    if (light) {
+      ++stats.light_simplifications;
+    } else {
+      ++stats.full_simplifications;
+    }
+  }
+
+  cache.exprs.push_back(expr);
+  cache.simplified[expr.id()] = cache.exprs.size();
+  cache.exprs.push_back(result);
+  return result;
 }
 
 z3::expr_vector Clone(z3::expr_vector &vec) {
@@ -370,30 +1148,65 @@ z3::expr_vector Clone(z3::expr_vector &vec) {
   return clone;
 }
 
-z3::expr OrderById(z3::expr expr) {
-  if (expr.is_and() || expr.is_or()) {
+// Memoized in `memo`, which maps the id of a formula to the index of its
+// ordered form in `exprs`. Every key is kept in `exprs` as well, so that its
+// id cannot be recycled.
+static z3::expr OrderById(z3::expr expr, z3::expr_vector &exprs,
+                          std::unordered_map<unsigned, unsigned> &memo) {
+  if (!expr.is_and() && !expr.is_or() && !expr.is_not()) {
+    return expr;
+  }
+  auto it{memo.find(expr.id())};
+  if (it != memo.end()) {
+    return exprs[it->second];
+  }
+
+  z3::expr result{expr};
+  if (expr.is_not()) {
+    auto arg{expr.arg(0)};
+    auto ordered{OrderById(arg, exprs, memo)};
+    if (ordered.id() != arg.id()) {
+      result = !ordered;
+    }
+  } else {
     std::vector<unsigned> args_indices(expr.num_args(), 0);
     std::iota(args_indices.begin(), args_indices.end(), 0);
-    std::sort(args_indices.begin(), args_indices.end(),
-              [&expr](unsigned a, unsigned b) {
-                return expr.arg(a).id() < expr.arg(b).id();
-              });
+    auto by_id{[&expr](unsigned a, unsigned b) {
+      return expr.arg(a).id() < expr.arg(b).id();
+    }};
+    auto changed{!std::is_sorted(args_indices.begin(), args_indices.end(),
+                                 by_id)};
+    if (changed) {
+      std::sort(args_indices.begin(), args_indices.end(), by_id);
+    }
     z3::expr_vector new_args{expr.ctx()};
     for (auto idx : args_indices) {
-      new_args.push_back(OrderById(expr.arg(idx)));
+      auto arg{expr.arg(idx)};
+      auto ordered{OrderById(arg, exprs, memo)};
+      changed |= ordered.id() != arg.id();
+      new_args.push_back(ordered);
     }
-    if (expr.is_and()) {
-      return z3::mk_and(new_args);
-    } else {
-      return z3::mk_or(new_args);
+    // Nodes that are already in order are not rebuilt
+    if (changed) {
+      result = expr.is_and() ? z3::mk_and(new_args) : z3::mk_or(new_args);
     }
   }
 
-  if (expr.is_not()) {
-    return !OrderById(expr.arg(0));
-  }
+  exprs.push_back(expr);
+  memo[expr.id()] = exprs.size();
+  exprs.push_back(result);
+  return result;
+}
 
-  return expr;
+z3::expr OrderById(z3::expr expr) {
+  z3::expr_vector exprs{expr.ctx()};
+  std::unordered_map<unsigned, unsigned> memo;
+  return OrderById(expr, exprs, memo);
+}
+
+z3::expr OrderById(DecompilationContext &dec_ctx, z3::expr expr) {
+  auto &cache{dec_ctx.z3_cache};
+  return OrderById(expr, cache.exprs, cache.ordered);
 }
 
 DecompilationContext::DecompilationContext(clang::ASTUnit &ast_unit)
@@ -403,14 +1216,428 @@ DecompilationContext::DecompilationContext(clang::ASTUnit &ast_unit)
       marker_expr(ast.CreateAdd(ast.CreateFalse(), ast.CreateFalse())),
       type_provider(std::make_unique<TypeProviderCombiner>(*this)) {}
 
+DecompilationContext::~DecompilationContext() { SetProgress(nullptr); }
+
+void DecompilationContext::SetProgress(Progress *new_progress) {
+  if (progress == new_progress) {
+    return;
+  }
+  if (progress) {
+    progress->RemoveInterrupter(this);
+  }
+  progress = new_progress;
+  if (progress) {
+    progress->AddInterrupter(this, [this]() {
+      // Only queries that are running are interrupted, since Z3 could
+      // otherwise abandon the next query that is sent after a reset
+      std::unique_lock<std::mutex> lock(z3_query_mutex);
+      if (z3_querying) {
+        z3_ctx.interrupt();
+      }
+    });
+  }
+}
+
+DecompilationContext::Z3Query::Z3Query(DecompilationContext &dec_ctx)
+    : dec_ctx(dec_ctx), start(std::chrono::steady_clock::now()) {
+  PushActivity("z3", "query");
+  std::unique_lock<std::mutex> lock(dec_ctx.z3_query_mutex);
+  dec_ctx.z3_querying = true;
+}
+
+DecompilationContext::Z3Query::~Z3Query() {
+  PopActivity();
+  {
+    std::unique_lock<std::mutex> lock(dec_ctx.z3_query_mutex);
+    dec_ctx.z3_querying = false;
+  }
+  if (auto progress = dec_ctx.progress) {
+    progress->z3_nanoseconds +=
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count();
+  }
+}
+
+void DecompilationContext::EnterFunction(clang::FunctionDecl *fdecl) {
+  if (checkpoints) {
+    checkpoints->Preserve(fdecl);
+  }
+  // Left without `LeaveFunction`
+  if (current_function) {
+    PopActivity();
+  }
+  PushActivity("function", fdecl->getNameAsString());
+  current_function = fdecl;
+  current_function_start = std::chrono::steady_clock::now();
+}
+
+void DecompilationContext::LeaveFunction() {
+  if (current_function) {
+    Duration elapsed{std::chrono::steady_clock::now() -
+                     current_function_start};
+    function_time[current_function] += elapsed;
+    auto pass{current_pass ? current_pass : "refinement"};
+    auto &function{stats.functions[current_function->getNameAsString()]};
+    function.pass_time[pass] += elapsed;
+    ++function.pass_visits[pass];
+    PopActivity();
+  }
+  current_function = nullptr;
+}
+
+bool DecompilationContext::OutOfBudget() {
+  if (!current_function) {
+    return false;
+  }
+  if (!degraded_functions.empty() &&
+      degraded_functions.count(current_function)) {
+    return true;
+  }
+  if (function_budget.count() == 0 && !rss_limit && !ast_memory_limit &&
+      !z3_memory_limit && !z3_exprs_limit) {
+    return false;
+  }
+
+  if (OverSoftLimit()) {
+    degraded_functions.insert(current_function);
+    return true;
+  }
+  if (function_budget.count() == 0) {
+    return false;
+  }
+
+  auto elapsed{function_time[current_function] +
+               (std::chrono::steady_clock::now() - current_function_start)};
+  if (elapsed < function_budget) {
+    return false;
+  }
+
+  LOG(WARNING) << "Function " << current_function->getName().str()
+               << " exceeded its refinement budget";
+  degraded_functions.insert(current_function);
+  return true;
+}
+
+bool DecompilationContext::OverSoftLimit(const char *stage) {
+  if (exceeded_limit) {
+    return true;
+  }
+
+  if (rss_limit && GetPeakRSS() > rss_limit) {
+    exceeded_limit = "peak RSS";
+  } else if (ast_memory_limit &&
+             ast_ctx.getASTAllocatedMemory() > ast_memory_limit) {
+    exceeded_limit = "AST memory";
+  } else if (z3_memory_limit &&
+             Z3_get_estimated_alloc_size() > z3_memory_limit) {
+    exceeded_limit = "Z3 memory";
+  } else if (z3_exprs_limit && z3_exprs.size() > z3_exprs_limit) {
+    exceeded_limit = "Z3 formulas";
+  } else {
+    return false;
+  }
+
+  if (!stage) {
+    stage = current_pass ? current_pass : "refinement";
+  }
+  LOG(WARNING) << "Exceeded the soft limit on " << exceeded_limit << " in "
+               << stage
+               << (current_function
+                       ? " of " + current_function->getNameAsString()
+                       : std::string())
+               << ", skipping the remaining refinement";
+  return true;
+}
+
+void DecompilationContext::RecordZ3(const Z3Statistics &query) {
+  auto z3{query};
+  z3.peak_memory = std::max(z3.peak_memory, Z3_get_estimated_alloc_size());
+  auto pass{current_pass};
+  if (!pass && structuring_function) {
+    pass = "GenerateAST";
+  }
+  if (pass) {
+    stats.passes[pass].z3.Merge(z3);
+  }
+  if (current_function) {
+    stats.functions[current_function->getNameAsString()].z3.Merge(z3);
+  } else if (structuring_function) {
+    stats.functions[structuring_function->getName().str()].z3.Merge(z3);
+  }
+}
+
+// Bytes held by the buckets and nodes of `map`, whose nodes also hold a link
+// and the hash of their key
+template <typename Map>
+static uint64_t GetMapMemory(const Map &map) {
+  return map.bucket_count() * sizeof(void *) +
+         map.size() * (sizeof(typename Map::value_type) + 2 * sizeof(void *));
+}
+
+static uint64_t EstimateModuleMemory(const llvm::Module &module) {
+  uint64_t res{0};
+  for (auto &gvar : module.globals()) {
+    res += sizeof(gvar) + gvar.getNumOperands() * sizeof(llvm::Use);
+  }
+  for (auto &func : module) {
+    res += sizeof(func) + func.arg_size() * sizeof(llvm::Argument);
+    for (auto &block : func) {
+      res += sizeof(block);
+      for (auto &inst : block) {
+        res += sizeof(inst) + inst.getNumOperands() * sizeof(llvm::Use);
+      }
+    }
+  }
+  return res;
+}
+
+void DecompilationContext::RecordMemory(const char *stage,
+                                        const llvm::Module *module) {
+  MemorySnapshot snapshot;
+  snapshot.rss = GetCurrentRSS();
+  snapshot.ast = ast_ctx.getASTAllocatedMemory();
+  snapshot.z3 = Z3_get_estimated_alloc_size();
+  if (module) {
+    snapshot.module = EstimateModuleMemory(*module);
+  }
+  // Formulas themselves are counted by Z3
+  snapshot.conditions =
+      (z3_exprs.size() + z3_cache.exprs.size()) * sizeof(void *) +
+      GetMapMemory(z3_expr_ids) + GetMapMemory(conds) +
+      GetMapMemory(z3_cache.proofs) + GetMapMemory(z3_cache.simplified) +
+      GetMapMemory(z3_cache.ordered) + GetMapMemory(z3_br_edges_inv) +
+      GetMapMemory(z3_br_edges) + GetMapMemory(z3_sw_vars) +
+      GetMapMemory(z3_sw_vars_inv) + GetMapMemory(z3_sw_edges) +
+      GetMapMemory(z3_edges) + reaching_conds.capacity() * sizeof(unsigned);
+  snapshot.provenance =
+      GetMapMemory(stmt_provenance) + GetMapMemory(use_provenance);
+  snapshot.maps = GetMapMemory(type_decls) + qual_types.getMemorySize() +
+                  GetMapMemory(value_decls) + side_effects.getMemorySize() +
+                  GetMapMemory(temp_decls) + GetMapMemory(outgoing_uses) +
+                  GetMapMemory(cond_temps) + GetMapMemory(function_shapes) +
+                  GetMapMemory(function_time);
+  for (auto &[block, uses] : outgoing_uses) {
+    snapshot.maps += uses.capacity() * sizeof(llvm::Use *);
+  }
+  stats.memory.emplace_back(stage, snapshot);
+}
+
+static void CollectStmts(clang::Stmt *stmt,
+                         std::unordered_set<clang::Stmt *> &stmts) {
+  if (!stmt || !stmts.insert(stmt).second) {
+    return;
+  }
+  for (auto child : stmt->children()) {
+    CollectStmts(child, stmts);
+  }
+}
+
+std::unordered_set<clang::Stmt *> GetReachableStmts(clang::ASTContext &ctx) {
+  std::unordered_set<clang::Stmt *> stmts;
+  for (auto decl : ctx.getTranslationUnitDecl()->decls()) {
+    if (auto fdecl = clang::dyn_cast<clang::FunctionDecl>(decl)) {
+      if (fdecl->doesThisDeclarationHaveABody()) {
+        CollectStmts(fdecl->getBody(), stmts);
+      }
+    } else if (auto var = clang::dyn_cast<clang::VarDecl>(decl)) {
+      CollectStmts(var->getInit(), stmts);
+    }
+  }
+  return stmts;
+}
+
+void EnumerateDecls(clang::DeclContext *dc, std::vector<clang::Decl *> &decls) {
+  for (auto decl : dc->decls()) {
+    decls.push_back(decl);
+    if (auto fdecl = clang::dyn_cast<clang::FunctionDecl>(decl)) {
+      for (auto param : fdecl->parameters()) {
+        decls.push_back(param);
+      }
+    }
+    if (auto inner = clang::dyn_cast<clang::DeclContext>(decl)) {
+      EnumerateDecls(inner, decls);
+    }
+  }
+}
+
+void EnumerateStmts(clang::Stmt *stmt, std::vector<clang::Stmt *> &stmts) {
+  if (!stmt) {
+    return;
+  }
+  stmts.push_back(stmt);
+  for (auto child : stmt->children()) {
+    EnumerateStmts(child, stmts);
+  }
+}
+
+void ZipStmts(clang::Stmt *from, clang::Stmt *to,
+              std::unordered_map<clang::Stmt *, clang::Stmt *> &map) {
+  if (!from || !to) {
+    return;
+  }
+  map[from] = to;
+  auto to_child{to->child_begin()};
+  for (auto from_child : from->children()) {
+    CHECK(to_child != to->child_end()) << "Imported statement differs in shape";
+    ZipStmts(from_child, *to_child, map);
+    ++to_child;
+  }
+}
+
+const llvm::json::Array &GetJSONEntries(const llvm::json::Object &map,
+                                        llvm::StringRef key) {
+  auto entries{map.getArray(key)};
+  CHECK_THROW(entries) << "Missing " << key.str();
+  for (auto &entry : *entries) {
+    CHECK_THROW(entry.getAsArray()) << "Malformed entry in " << key.str();
+  }
+  return *entries;
+}
+
+int64_t GetJSONIndex(const llvm::json::Value &val, size_t size) {
+  auto idx{val.getAsInteger()};
+  CHECK_THROW(idx && *idx >= 0 && static_cast<size_t>(*idx) < size)
+      << "Invalid index";
+  return *idx;
+}
+
+llvm::StringRef GetJSONString(const llvm::json::Value &val) {
+  auto str{val.getAsString()};
+  CHECK_THROW(str) << "Expected a string";
+  return *str;
+}
+
+void DecompilationContext::Z3Cache::Merge(const Z3Cache &other) {
+  prove_hits += other.prove_hits;
+  prove_misses += other.prove_misses;
+  simplify_hits += other.simplify_hits;
+  simplify_misses += other.simplify_misses;
+  timeouts += other.timeouts;
+  interrupts += other.interrupts;
+  prove_shortcuts += other.prove_shortcuts;
+  bdd_decisions += other.bdd_decisions;
+  portfolio_races += other.portfolio_races;
+  portfolio_wins += other.portfolio_wins;
+  alpha_hits += other.alpha_hits;
+}
+
+DecompilationContext::Z3Solver::Z3Solver(z3::context &ctx)
+    : solver(ctx),
+      heavy_simplify(MakeHeavySimplifyTactic(ctx)),
+      light_simplify(z3::tactic(ctx, "simplify") &
+                     z3::tactic(ctx, "propagate-values")) {}
+
 unsigned DecompilationContext::InsertZExpr(const z3::expr &e) {
-  auto idx{z3_exprs.size()};
+  auto [it, inserted]{z3_expr_ids.try_emplace(e.id(), z3_exprs.size())};
+  // Ids are recycled once a formula dies, and entries can be replaced by
+  // `SetZExpr`, so the stored formula needs to be checked
+  if (!inserted) {
+    if (z3::eq(z3_exprs[it->second], e)) {
+      return it->second;
+    }
+    it->second = z3_exprs.size();
+  }
   z3_exprs.push_back(e);
-  return idx;
+  if (on_insert_z_expr) {
+    on_insert_z_expr(e);
+  }
+  return it->second;
+}
+
+void DecompilationContext::SetZExpr(unsigned idx, const z3::expr &e) {
+  z3_exprs.set(idx, e);
+  z3_expr_ids.try_emplace(e.id(), idx);
+}
+
+void DecompilationContext::CompactZExprs() {
+  llvm::TimeTraceScope trace("CompactZExprs");
+  auto live{GetReachableStmts(ast_ctx)};
+  for (auto it{conds.begin()}; it != conds.end();) {
+    if (live.count(it->first)) {
+      ++it;
+    } else {
+      it = conds.erase(it);
+    }
+  }
+
+  constexpr auto unused{std::numeric_limits<unsigned>::max()};
+  std::vector<unsigned> remap(z3_exprs.size(), unused);
+  auto Mark{[&](auto &map) {
+    for (auto &[key, idx] : map) {
+      remap[idx] = 0;
+    }
+  }};
+  Mark(conds);
+  for (auto idx : reaching_conds) {
+    if (idx != unused) {
+      remap[idx] = 0;
+    }
+  }
+  Mark(z3_edges);
+  Mark(z3_br_edges);
+  Mark(z3_sw_vars);
+  Mark(z3_sw_edges);
+
+  z3::expr_vector compacted{z3_ctx};
+  z3_expr_ids.clear();
+  unsigned simplified{0};
+  for (unsigned i{0}; i < remap.size(); ++i) {
+    if (i == z3_simplified) {
+      simplified = compacted.size();
+    }
+    if (remap[i] != unused) {
+      // Entries replaced by `SetZExpr` may have become duplicates
+      auto [it, inserted]{
+          z3_expr_ids.try_emplace(z3_exprs[i].id(), compacted.size())};
+      if (inserted) {
+        compacted.push_back(z3_exprs[i]);
+      }
+      remap[i] = it->second;
+    }
+  }
+  // Entries keep their relative order, so the simplified ones are still first
+  if (z3_simplified >= remap.size()) {
+    simplified = compacted.size();
+  }
+  z3_simplified = simplified;
+  RELLIC_LOG(Structuring) << "Compacted conditions from " << z3_exprs.size()
+                          << " to " << compacted.size();
+  z3_exprs = compacted;
+
+  auto Update{[&](auto &map) {
+    for (auto &[key, idx] : map) {
+      idx = remap[idx];
+    }
+  }};
+  Update(conds);
+  for (auto &idx : reaching_conds) {
+    if (idx != unused) {
+      idx = remap[idx];
+    }
+  }
+  Update(z3_edges);
+  Update(z3_br_edges);
+  Update(z3_sw_vars);
+  Update(z3_sw_edges);
 }
 
 clang::QualType DecompilationContext::GetQualType(llvm::Type *type) {
-  DLOG(INFO) << "GetQualType: " << LLVMThingToString(type);
+  auto it{qual_types.find(type)};
+  if (it != qual_types.end()) {
+    ++stats.qual_type_hits;
+    return it->second;
+  }
+  ++stats.qual_type_misses;
+  // Not inserted until the type is complete, since the recursive calls that
+  // create it can grow the map
+  auto result{CreateQualType(type)};
+  qual_types[type] = result;
+  return result;
+}
+
+clang::QualType DecompilationContext::CreateQualType(llvm::Type *type) {
+  RELLIC_LOG(Types) << "GetQualType: " << LLVMThingToString(type);
 
   clang::QualType result;
   switch (type->getTypeID()) {
@@ -494,10 +1721,16 @@ clang::QualType DecompilationContext::GetQualType(llvm::Type *type) {
         // Create a C struct declaration
         decl = sdecl = ast.CreateStructDecl(tudecl, sname);
 
+        std::vector<std::string> field_names;
+        if (debug_names) {
+          field_names = debug_names->GetFieldNames(strct);
+        }
+
         // Add fields to the C struct
         for (auto ecnt{0U}; ecnt < strct->getNumElements(); ++ecnt) {
           auto etype{GetQualType(strct->getElementType(ecnt))};
-          auto fname{"field" + std::to_string(ecnt)};
+          auto fname{field_names.empty() ? "field" + std::to_string(ecnt)
+                                         : field_names[ecnt]};
           sdecl->addDecl(ast.CreateFieldDecl(sdecl, etype, fname));
         }
 
@@ -12,6 +12,7 @@
 #include <glog/logging.h>
 
 #include "rellic/AST/Util.h"
+#include "rellic/Log.h"
 
 namespace rellic {
 
@@ -19,10 +20,11 @@ Z3CondSimplify::Z3CondSimplify(DecompilationContext& dec_ctx)
     : ASTPass(dec_ctx) {}
 
 void Z3CondSimplify::RunImpl() {
-  LOG(INFO) << "Simplifying conditions using Z3";
-  for (size_t i{0}; i < dec_ctx.z3_exprs.size() && !Stopped(); ++i) {
-    auto simpl{OrderById(dec_ctx.z3_exprs[i].simplify())};
-    dec_ctx.z3_exprs.set(i, simpl);
+  RELLIC_LOG(Passes) << "Simplifying conditions using Z3";
+  auto &i{dec_ctx.z3_simplified};
+  for (; i < dec_ctx.z3_exprs.size() && !Stopped(); ++i) {
+    auto simpl{OrderById(dec_ctx, dec_ctx.z3_exprs[i].simplify())};
+    dec_ctx.SetZExpr(i, simpl);
   }
 }
 
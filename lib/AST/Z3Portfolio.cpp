@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/Z3Portfolio.h"
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include "rellic/AST/Progress.h"
+#include "rellic/AST/Util.h"
+
+namespace rellic {
+
+namespace {
+
+// A tactic of the portfolio, along with the context it runs on and its copy
+// of the formula. The goal it produced is only set if it won the race.
+struct Entrant {
+  z3::context ctx;
+  std::optional<z3::tactic> tactic;
+  std::optional<z3::expr> expr;
+  std::optional<z3::goal> goal;
+};
+
+}  // namespace
+
+// The chain of `HeavySimplify`, see `MakeHeavySimplifyTactic`, is
+// `simplify & aig & ctx-solver-simplify`.
+// Its alternatives keep `ctx-solver-simplify`, which does the useful work,
+// but feed it formulas of other shapes.
+const std::vector<TacticBuilder> &GetSimplifyPortfolio() {
+  static const std::vector<TacticBuilder> portfolio{
+      [](z3::context &ctx) {
+        return z3::tactic(ctx, "simplify") &
+               z3::tactic(ctx, "ctx-solver-simplify");
+      },
+      [](z3::context &ctx) {
+        return z3::tactic(ctx, "simplify") &
+               z3::tactic(ctx, "propagate-values") &
+               z3::tactic(ctx, "ctx-simplify") &
+               z3::tactic(ctx, "ctx-solver-simplify");
+      },
+  };
+  return portfolio;
+}
+
+// Only decided goals are answers, so every chain fails otherwise
+const std::vector<TacticBuilder> &GetProvePortfolio() {
+  static const std::vector<TacticBuilder> portfolio{
+      [](z3::context &ctx) {
+        return z3::tactic(ctx, "smt") & z3::tactic(ctx, "fail-if-undecided");
+      },
+      [](z3::context &ctx) {
+        return z3::tactic(ctx, "qfbv") & z3::tactic(ctx, "fail-if-undecided");
+      },
+      [](z3::context &ctx) {
+        return z3::tactic(ctx, "simplify") &
+               z3::tactic(ctx, "propagate-values") &
+               z3::tactic(ctx, "solve-eqs") & z3::tactic(ctx, "smt") &
+               z3::tactic(ctx, "fail-if-undecided");
+      },
+  };
+  return portfolio;
+}
+
+std::optional<z3::goal> RaceTactics(z3::expr expr,
+                                    const std::vector<TacticBuilder> &portfolio,
+                                    unsigned timeout, Progress *progress) {
+  // Contexts are not safe to share between threads, so formulas are only
+  // translated from and into the context of `expr` on this one
+  std::vector<std::unique_ptr<Entrant>> entrants;
+  for (auto &build : portfolio) {
+    auto entrant{std::make_unique<Entrant>()};
+    auto &ctx{entrant->ctx};
+    entrant->expr.emplace(ctx, Z3_translate(expr.ctx(), expr, ctx));
+    auto tactic{build(ctx)};
+    entrant->tactic.emplace(timeout ? z3::try_for(tactic, timeout) : tactic);
+    entrants.push_back(std::move(entrant));
+  }
+
+  std::mutex mutex;
+  std::condition_variable finished_cv;
+  size_t finished{0};
+  Entrant *winner{nullptr};
+  auto InterruptAll{[&entrants]() {
+    for (auto &entrant : entrants) {
+      entrant->ctx.interrupt();
+    }
+  }};
+  if (progress) {
+    progress->AddInterrupter(&entrants, InterruptAll);
+  }
+
+  std::vector<std::thread> threads;
+  if (!progress || !progress->cancelled) {
+    for (auto &entrant : entrants) {
+      threads.emplace_back([&, entrant = entrant.get()]() {
+        std::optional<z3::goal> goal;
+        try {
+          goal = ApplyTactic(*entrant->tactic, *entrant->expr);
+        } catch (z3::exception &) {
+          // Failed, timed out or interrupted, which all lose the race
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        ++finished;
+        if (goal && !winner) {
+          entrant->goal = std::move(goal);
+          winner = entrant;
+        }
+        finished_cv.notify_all();
+      });
+    }
+  }
+
+  {
+    std::unique_lock<std::mutex> lock(mutex);
+    finished_cv.wait(lock, [&]() {
+      return winner || finished == threads.size();
+    });
+  }
+  // Interrupting a context whose tactic already finished is harmless, since
+  // it is not used again
+  InterruptAll();
+  for (auto &thread : threads) {
+    thread.join();
+  }
+  if (progress) {
+    progress->RemoveInterrupter(&entrants);
+  }
+
+  if (!winner) {
+    return std::nullopt;
+  }
+  z3::goal result(expr.ctx());
+  auto &goal{*winner->goal};
+  for (unsigned i{0}; i < goal.size(); ++i) {
+    z3::expr formula(expr.ctx(),
+                     Z3_translate(winner->ctx, goal[i], expr.ctx()));
+    result.add(formula);
+  }
+  return result;
+}
+
+}  // namespace rellic
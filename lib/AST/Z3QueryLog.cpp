@@ -0,0 +1,111 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/Z3QueryLog.h"
+
+#include <clang/AST/Decl.h>
+#include <llvm/IR/Function.h>
+#include <llvm/Support/JSON.h>
+
+#include <cstring>
+
+#include "rellic/AST/DecompilationContext.h"
+#include "rellic/Exception.h"
+
+namespace rellic {
+
+namespace {
+// Starts the line that describes each query
+constexpr const char *kHeader{";; rellic-query "};
+// Ends every benchmark written by `z3::solver::to_smt2`
+constexpr const char *kTerminator{"(check-sat)"};
+}  // namespace
+
+Z3QueryLog::Z3QueryLog(const std::string &path) {
+  std::error_code ec;
+  os = std::make_unique<llvm::raw_fd_ostream>(path, ec);
+  CHECK_THROW(!ec) << "Cannot write " << path << ": " << ec.message();
+}
+
+void Z3QueryLog::Record(const DecompilationContext &dec_ctx, z3::expr expr,
+                        const char *kind, const char *tactic,
+                        const char *result, Duration time) {
+  std::string function;
+  if (dec_ctx.current_function) {
+    function = dec_ctx.current_function->getNameAsString();
+  } else if (dec_ctx.structuring_function) {
+    function = dec_ctx.structuring_function->getName().str();
+  }
+  llvm::json::Object query{
+      {"kind", kind},
+      {"tactic", tactic},
+      {"pass", dec_ctx.current_pass
+                   ? dec_ctx.current_pass
+                   : (dec_ctx.structuring_function ? "structuring" : "")},
+      {"function", function},
+      {"timeout", static_cast<int64_t>(dec_ctx.z3_timeout)},
+      {"result", result},
+      {"time", time.count()},
+  };
+  // Serialized before taking the lock, since it is the expensive part
+  z3::solver solver(expr.ctx());
+  solver.add(expr);
+  auto benchmark{solver.to_smt2()};
+
+  std::unique_lock<std::mutex> lock(mutex);
+  *os << kHeader << llvm::json::Value(std::move(query)) << '\n' << benchmark;
+  os->flush();
+}
+
+void Z3QueryLog::Parse(llvm::StringRef log, std::vector<Query> &queries,
+                       z3::expr_vector &formulas) {
+  auto &ctx{formulas.ctx()};
+  while (!log.trim().empty()) {
+    auto start{log.find(kHeader)};
+    CHECK_THROW(start != llvm::StringRef::npos) << "Expected a query header";
+    auto [line, rest]{log.drop_front(start + strlen(kHeader)).split('\n')};
+    auto [benchmark, next]{rest.split(kTerminator)};
+    log = next;
+
+    auto json{llvm::json::parse(line)};
+    if (!json) {
+      THROW() << "Invalid query header: " << llvm::toString(json.takeError());
+    }
+    auto obj{json->getAsObject()};
+    CHECK_THROW(obj) << "Invalid query header: " << line.str();
+    Query query;
+    auto String{[obj](const char *key) {
+      auto value{obj->getString(key)};
+      return value ? value->str() : std::string{};
+    }};
+    query.kind = String("kind");
+    query.tactic = String("tactic");
+    query.pass = String("pass");
+    query.function = String("function");
+    query.result = String("result");
+    if (auto timeout = obj->getInteger("timeout")) {
+      query.timeout = *timeout;
+    }
+    if (auto time = obj->getNumber("time")) {
+      query.time = Duration(*time);
+    }
+
+    z3::expr_vector assertions{ctx};
+    try {
+      assertions = ctx.parse_string(benchmark.str().c_str());
+    } catch (z3::exception &e) {
+      THROW() << "Invalid query formula: " << e.msg();
+    }
+    CHECK_THROW(assertions.size() > 0) << "Query without a formula";
+    formulas.push_back(assertions.size() == 1 ? assertions[0]
+                                              : z3::mk_and(assertions));
+    queries.push_back(std::move(query));
+  }
+}
+
+}  // namespace rellic
@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/Activity.h"
+
+#include <glog/logging.h>
+#include <llvm/Support/Format.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace rellic {
+
+namespace {
+struct Frame {
+  const char *kind;
+  std::string name;
+  std::string detail;
+  std::chrono::steady_clock::time_point start;
+};
+
+struct ThreadActivity {
+  // Numbered in the order threads first push a frame, from 1
+  unsigned id;
+  // Guards `frames` against the threads that dump them
+  std::mutex mutex;
+  std::vector<Frame> frames;
+};
+
+std::mutex threads_mutex;
+std::vector<ThreadActivity *> threads;
+unsigned next_thread_id{1};
+
+// Registers the activity of the calling thread while it is alive
+struct ThreadRegistration {
+  ThreadActivity activity;
+
+  ThreadRegistration() {
+    std::unique_lock<std::mutex> lock(threads_mutex);
+    activity.id = next_thread_id++;
+    threads.push_back(&activity);
+  }
+
+  ~ThreadRegistration() {
+    std::unique_lock<std::mutex> lock(threads_mutex);
+    threads.erase(std::find(threads.begin(), threads.end(), &activity));
+  }
+};
+
+ThreadActivity &GetThreadActivity() {
+  thread_local ThreadRegistration registration;
+  return registration.activity;
+}
+
+// Calls `fn` with the id and frames of every thread that has frames, under
+// their locks
+template <typename Fn>
+void ForEachThread(Fn fn) {
+  std::unique_lock<std::mutex> lock(threads_mutex);
+  for (auto thread : threads) {
+    std::unique_lock<std::mutex> thread_lock(thread->mutex);
+    if (!thread->frames.empty()) {
+      fn(thread->id, thread->frames);
+    }
+  }
+}
+
+int signal_pipe[2]{-1, -1};
+
+void OnSignal(int) {
+  auto saved_errno{errno};
+  char byte{0};
+  // Nothing to do if the pipe is full, a dump is pending already
+  (void)!write(signal_pipe[1], &byte, 1);
+  errno = saved_errno;
+}
+}  // namespace
+
+void PushActivity(const char *kind, llvm::StringRef name) {
+  auto &activity{GetThreadActivity()};
+  Frame frame{kind, name.str(), {}, std::chrono::steady_clock::now()};
+  std::unique_lock<std::mutex> lock(activity.mutex);
+  activity.frames.push_back(std::move(frame));
+}
+
+void PopActivity() {
+  auto &activity{GetThreadActivity()};
+  std::unique_lock<std::mutex> lock(activity.mutex);
+  if (!activity.frames.empty()) {
+    activity.frames.pop_back();
+  }
+}
+
+void SetActivityDetail(llvm::StringRef detail) {
+  auto &activity{GetThreadActivity()};
+  std::unique_lock<std::mutex> lock(activity.mutex);
+  if (!activity.frames.empty()) {
+    activity.frames.back().detail = detail.str();
+  }
+}
+
+void DumpActivity(llvm::raw_ostream &os) {
+  auto now{std::chrono::steady_clock::now()};
+  auto any{false};
+  ForEachThread([&](unsigned id, const std::vector<Frame> &frames) {
+    any = true;
+    os << "Thread " << id << ":\n";
+    for (auto &frame : frames) {
+      std::chrono::duration<double> elapsed{now - frame.start};
+      os << llvm::format("  %10.3f s  ", elapsed.count()) << frame.kind << ' '
+         << frame.name;
+      if (!frame.detail.empty()) {
+        os << " (" << frame.detail << ')';
+      }
+      os << '\n';
+    }
+  });
+  if (!any) {
+    os << "No activity\n";
+  }
+  os.flush();
+}
+
+llvm::json::Array GetActivityJSON() {
+  auto now{std::chrono::steady_clock::now()};
+  llvm::json::Array json;
+  ForEachThread([&](unsigned id, const std::vector<Frame> &frames) {
+    llvm::json::Array stack;
+    for (auto &frame : frames) {
+      std::chrono::duration<double> elapsed{now - frame.start};
+      stack.push_back(llvm::json::Object{
+          {"kind", frame.kind},
+          {"name", frame.name},
+          {"detail", frame.detail},
+          {"elapsed", elapsed.count()},
+      });
+    }
+    json.push_back(llvm::json::Object{
+        {"thread", static_cast<int64_t>(id)},
+        {"frames", std::move(stack)},
+    });
+  });
+  return json;
+}
+
+void DumpActivityOnSignal(int signal) {
+  if (signal_pipe[0] < 0 && pipe(signal_pipe)) {
+    LOG(ERROR) << "Cannot dump activity on signal " << signal << ": "
+               << strerror(errno);
+    return;
+  }
+  struct sigaction action {};
+  action.sa_handler = OnSignal;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  sigaction(signal, &action, nullptr);
+
+  static std::once_flag started;
+  std::call_once(started, []() {
+    std::thread([]() {
+      char byte;
+      while (true) {
+        auto res{read(signal_pipe[0], &byte, 1)};
+        if (res < 0 && errno == EINTR) {
+          continue;
+        }
+        if (res <= 0) {
+          return;
+        }
+        DumpActivity(llvm::errs());
+      }
+    }).detach();
+  });
+}
+
+}  // namespace rellic
@@ -10,6 +10,8 @@
 
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <llvm/ADT/SetVector.h>
+#include <llvm/ADT/SmallPtrSet.h>
 #include <llvm/ADT/SmallVector.h>
 #include <llvm/IR/BasicBlock.h>
 #include <llvm/IR/Function.h>
@@ -20,18 +22,24 @@
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Metadata.h>
 #include <llvm/IR/Module.h>
+#include <llvm/IR/Operator.h>
 #include <llvm/IR/Verifier.h>
 #include <llvm/IRReader/IRReader.h>
+#include <llvm/Linker/Linker.h>
 #include <llvm/Passes/PassBuilder.h>
 #include <llvm/Support/FileSystem.h>
 #include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/SourceMgr.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/TimeProfiler.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/Utils.h>
-#include <llvm/Transforms/Utils/Cloning.h>
 #include <llvm/Transforms/Utils/Local.h>
 #include <llvm/Transforms/Utils/LowerSwitch.h>
 
+#include <chrono>
+#include <future>
+#include <optional>
 #include <unordered_map>
 
 namespace rellic {
@@ -81,9 +89,11 @@ bool VerifyModule(llvm::Module *module) {
 
 // Reads an LLVM module from a file.
 llvm::Module *LoadModuleFromFile(llvm::LLVMContext *context,
-                                 std::string file_name, bool allow_failure) {
+                                 std::string file_name, bool allow_failure,
+                                 bool lazy) {
   llvm::SMDiagnostic err;
-  auto mod_ptr = llvm::parseIRFile(file_name, err, *context);
+  auto mod_ptr = lazy ? llvm::getLazyIRFileModule(file_name, err, *context)
+                      : llvm::parseIRFile(file_name, err, *context);
   auto module = mod_ptr.release();
 
   if (!module) {
@@ -92,6 +102,11 @@ llvm::Module *LoadModuleFromFile(llvm::LLVMContext *context,
     return nullptr;
   }
 
+  // Bodies are read and verified once they are materialized
+  if (lazy) {
+    return module;
+  }
+
   auto ec = module->materializeAll();  // Just in case.
   if (ec) {
     LOG_IF(FATAL, !allow_failure)
@@ -110,11 +125,17 @@ llvm::Module *LoadModuleFromFile(llvm::LLVMContext *context,
   return module;
 }
 
-llvm::Module *LoadModuleFromMemory(llvm::LLVMContext *context,
-                                   std::string file_data, bool allow_failure) {
+llvm::Module *LoadModuleFromBuffer(llvm::LLVMContext *context,
+                                   llvm::MemoryBufferRef buffer,
+                                   bool allow_failure, bool lazy) {
   llvm::SMDiagnostic err;
-  llvm::MemoryBufferRef ref(file_data, "memory");
-  auto mod_ptr = llvm::parseIR(ref, err, *context);
+  // A lazy module keeps reading from `buffer`, through a wrapper that does not
+  // own or copy it
+  auto mod_ptr = lazy ? llvm::getLazyIRModule(
+                            llvm::MemoryBuffer::getMemBuffer(
+                                buffer, /*RequiresNullTerminator=*/false),
+                            err, *context)
+                      : llvm::parseIR(buffer, err, *context);
   auto module = mod_ptr.release();
 
   if (!module) {
@@ -123,6 +144,10 @@ llvm::Module *LoadModuleFromMemory(llvm::LLVMContext *context,
     return nullptr;
   }
 
+  if (lazy) {
+    return module;
+  }
+
   auto ec = module->materializeAll();  // Just in case.
   if (ec) {
     LOG_IF(FATAL, !allow_failure) << "Unable to materialize everything";
@@ -139,6 +164,51 @@ llvm::Module *LoadModuleFromMemory(llvm::LLVMContext *context,
   return module;
 }
 
+std::unique_ptr<llvm::Module> LinkModules(
+    std::vector<std::unique_ptr<llvm::Module>> modules,
+    std::unordered_map<std::string, size_t> &origins) {
+  CHECK(!modules.empty()) << "No modules to link";
+  // Definitions are tagged with the index of their module, since the linker
+  // renames the internal ones that clash
+  auto &context{modules[0]->getContext()};
+  auto kind{context.getMDKindID("rellic.origin")};
+  for (size_t i{0}; i < modules.size(); ++i) {
+    auto node{llvm::MDNode::get(
+        context, llvm::ConstantAsMetadata::get(llvm::ConstantInt::get(
+                     llvm::Type::getInt64Ty(context), i)))};
+    for (auto &obj : modules[i]->global_objects()) {
+      if (!obj.isDeclaration()) {
+        obj.setMetadata(kind, node);
+      }
+    }
+  }
+
+  auto linked{std::move(modules[0])};
+  for (size_t i{1}; i < modules.size(); ++i) {
+    auto name{modules[i]->getModuleIdentifier()};
+    LOG_IF(FATAL, llvm::Linker::linkModules(*linked, std::move(modules[i])))
+        << "Unable to link " << name << " with the modules before it";
+  }
+
+  for (auto &obj : linked->global_objects()) {
+    if (auto node = obj.getMetadata(kind)) {
+      auto index{
+          llvm::mdconst::extract<llvm::ConstantInt>(node->getOperand(0))};
+      origins[obj.getName().str()] = index->getZExtValue();
+      obj.setMetadata(kind, nullptr);
+    }
+  }
+  return linked;
+}
+
+llvm::Module *LoadModuleFromMemory(llvm::LLVMContext *context,
+                                   const std::string &file_data,
+                                   bool allow_failure) {
+  return LoadModuleFromBuffer(context,
+                              llvm::MemoryBufferRef(file_data, "memory"),
+                              allow_failure);
+}
+
 bool IsGlobalMetadata(const llvm::GlobalObject &go) {
   return go.getSection() == "llvm.metadata";
 }
@@ -199,15 +269,7 @@ void CopyMetadataTo(llvm::Value *src, llvm::Value *dst) {
   CloneMetadataInto(dst_inst, mds);
 }
 
-void RemovePHINodes(llvm::Module &module) {
-  std::vector<llvm::PHINode *> work_list;
-  for (auto &func : module) {
-    for (auto &inst : llvm::instructions(func)) {
-      if (auto phi = llvm::dyn_cast<llvm::PHINode>(&inst)) {
-        work_list.push_back(phi);
-      }
-    }
-  }
+static void DemotePHINodes(const std::vector<llvm::PHINode *> &work_list) {
   for (auto phi : work_list) {
     llvm::SmallVector<std::pair<unsigned, llvm::MDNode *>, 16u> mds;
     phi->getAllMetadataOtherThanDebugLoc(mds);
@@ -216,31 +278,66 @@ void RemovePHINodes(llvm::Module &module) {
   }
 }
 
-void LowerSwitches(llvm::Module &module) {
+static void RemovePHINodes(llvm::Function &func) {
+  std::vector<llvm::PHINode *> work_list;
+  for (auto &inst : llvm::instructions(func)) {
+    if (auto phi = llvm::dyn_cast<llvm::PHINode>(&inst)) {
+      work_list.push_back(phi);
+    }
+  }
+  DemotePHINodes(work_list);
+}
+
+void RemovePHINodes(llvm::Module &module) {
+  llvm::TimeTraceScope trace("RemovePHINodes");
+  for (auto &func : module) {
+    RemovePHINodes(func);
+  }
+}
+
+namespace {
+// Analyses needed by `llvm::LowerSwitchPass`, registered once and shared by
+// every function it is run on
+class SwitchLowering {
   llvm::PassBuilder pb;
-  llvm::ModulePassManager mpm;
-  llvm::ModuleAnalysisManager mam;
   llvm::LoopAnalysisManager lam;
-  llvm::CGSCCAnalysisManager cam;
   llvm::FunctionAnalysisManager fam;
+  llvm::CGSCCAnalysisManager cam;
+  llvm::ModuleAnalysisManager mam;
 
-  pb.registerFunctionAnalyses(fam);
-  pb.registerModuleAnalyses(mam);
-  pb.registerCGSCCAnalyses(cam);
-  pb.registerLoopAnalyses(lam);
-
-  pb.crossRegisterProxies(lam, fam, cam, mam);
+ public:
+  SwitchLowering() {
+    pb.registerFunctionAnalyses(fam);
+    pb.registerModuleAnalyses(mam);
+    pb.registerCGSCCAnalyses(cam);
+    pb.registerLoopAnalyses(lam);
+    pb.crossRegisterProxies(lam, fam, cam, mam);
+  }
 
-  llvm::FunctionPassManager fpm;
-  fpm.addPass(llvm::LowerSwitchPass());
+  ~SwitchLowering() {
+    mam.clear();
+    fam.clear();
+    cam.clear();
+    lam.clear();
+  }
 
-  mpm.addPass(llvm::createModuleToFunctionPassAdaptor(std::move(fpm)));
-  mpm.run(module, mam);
+  void Run(llvm::Function &func) {
+    if (func.isDeclaration()) {
+      return;
+    }
+    llvm::LowerSwitchPass().run(func, fam);
+    // Nothing else uses the analyses of `func`
+    fam.clear(func, func.getName());
+  }
+};
+}  // namespace
 
-  mam.clear();
-  fam.clear();
-  cam.clear();
-  lam.clear();
+void LowerSwitches(llvm::Module &module) {
+  llvm::TimeTraceScope trace("LowerSwitches");
+  SwitchLowering lowering;
+  for (auto &func : module) {
+    lowering.Run(func);
+  }
   CHECK(VerifyModule(&module)) << "Transformation broke module correctness";
 }
 
@@ -283,31 +380,67 @@ static llvm::LoadInst *ConvertInsertValue(llvm::InsertValueInst *I) {
   return load;
 }
 
-void RemoveInsertValues(llvm::Module &m) {
-  std::vector<llvm::InsertValueInst *> work_list;
-  for (auto &func : m) {
-    for (auto &inst : llvm::instructions(func)) {
-      if (auto iv = llvm::dyn_cast<llvm::InsertValueInst>(&inst)) {
-        work_list.push_back(iv);
-      }
-    }
-  }
-
+static void ConvertInsertValues(
+    const std::vector<llvm::InsertValueInst *> &work_list) {
   for (auto iv : work_list) {
     llvm::SmallVector<std::pair<unsigned, llvm::MDNode *>, 16u> mds;
     iv->getAllMetadataOtherThanDebugLoc(mds);
     auto new_load{ConvertInsertValue(iv)};
     CloneMetadataInto(new_load, mds);
   }
+}
+
+static void CollectInsertValues(llvm::Function &func,
+                                std::vector<llvm::InsertValueInst *> &out) {
+  for (auto &inst : llvm::instructions(func)) {
+    if (auto iv = llvm::dyn_cast<llvm::InsertValueInst>(&inst)) {
+      out.push_back(iv);
+    }
+  }
+}
+
+static void RemoveInsertValues(llvm::Function &func) {
+  std::vector<llvm::InsertValueInst *> work_list;
+  CollectInsertValues(func, work_list);
+  ConvertInsertValues(work_list);
+}
+
+void RemoveInsertValues(llvm::Module &m) {
+  llvm::TimeTraceScope trace("RemoveInsertValues");
+  for (auto &func : m) {
+    RemoveInsertValues(func);
+  }
 
   CHECK(VerifyModule(&m)) << "Transformation broke module correctness";
 }
 
-void ConvertArrayArguments(llvm::Module &m) {
+static bool HasArraySignature(llvm::Function &func) {
+  if (func.getReturnType()->isArrayTy()) {
+    return true;
+  }
+  for (auto &arg : func.args()) {
+    if (arg.getType()->isArrayTy()) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Does the work of `ConvertArrayArguments` without verifying the result
+static void WrapArrayArguments(llvm::Module &m) {
+  std::vector<llvm::Function *> orig_funcs;
+  for (auto &f : m.functions()) {
+    if (HasArraySignature(f)) {
+      orig_funcs.push_back(&f);
+    }
+  }
+  if (orig_funcs.empty()) {
+    return;
+  }
+
   std::unordered_map<llvm::Type *, llvm::Type *> conv_types;
   std::vector<unsigned> indices;
   indices.push_back(0);
-  std::vector<std::pair<llvm::Function *, llvm::Function *>> funcs_to_remove;
   auto &ctx{m.getContext()};
   auto ConvertType = [&](llvm::Type *t) -> llvm::Type * {
     if (!t->isArrayTy()) {
@@ -323,6 +456,8 @@ void ConvertArrayArguments(llvm::Module &m) {
     return ty;
   };
 
+  // The body of `orig_func` is moved into the new function rather than
+  // cloned, so `orig_func` is left as a declaration
   auto ConvertFunction = [&](llvm::Function *orig_func) -> llvm::Function * {
     auto return_ty{ConvertType(orig_func->getReturnType())};
     std::vector<llvm::Type *> arg_types;
@@ -333,100 +468,102 @@ void ConvertArrayArguments(llvm::Module &m) {
         llvm::FunctionType::get(return_ty, arg_types, orig_func->isVarArg())};
     auto new_func{llvm::Function::Create(func_type, orig_func->getLinkage(),
                                          orig_func->getName(), m)};
+    // Attributes of the wrapped values no longer apply to their types
+    new_func->copyAttributesFrom(orig_func);
+    auto attrs{new_func->getAttributes()};
+    for (auto &arg : orig_func->args()) {
+      if (arg.getType()->isArrayTy()) {
+        attrs = attrs.removeParamAttributes(ctx, arg.getArgNo());
+      }
+    }
+    if (orig_func->getReturnType()->isArrayTy()) {
+      attrs = attrs.removeRetAttributes(ctx);
+    }
+    new_func->setAttributes(attrs);
     if (orig_func->isDeclaration()) {
       return new_func;
     }
-    auto bb{llvm::BasicBlock::Create(m.getContext(), "", new_func)};
+    new_func->copyMetadata(orig_func, 0);
+    orig_func->clearMetadata();
+    new_func->splice(new_func->end(), orig_func);
 
-    llvm::ValueToValueMapTy ValueMap;
+    auto insert_pt{&*new_func->getEntryBlock().getFirstInsertionPt()};
     auto new_args{new_func->arg_begin()};
     for (auto &old_arg : orig_func->args()) {
       new_args->setName(old_arg.getName());
       if (old_arg.getType()->isArrayTy()) {
-        ValueMap[&old_arg] =
-            llvm::ExtractValueInst::Create(new_args, indices, "", bb);
+        old_arg.replaceAllUsesWith(llvm::ExtractValueInst::Create(
+            new_args, indices, "", insert_pt));
       } else {
-        ValueMap[&old_arg] = new_args;
+        old_arg.replaceAllUsesWith(new_args);
       }
       ++new_args;
     }
-    llvm::SmallVector<llvm::ReturnInst *, 8> Returns;
-    llvm::CloneFunctionInto(new_func, orig_func, ValueMap,
-                            llvm::CloneFunctionChangeType::LocalChangesOnly,
-                            Returns);
-    llvm::BranchInst::Create(bb->getNextNode(), bb);
 
     if (orig_func->getReturnType()->isArrayTy()) {
+      std::vector<llvm::ReturnInst *> returns;
+      for (auto &bb : *new_func) {
+        if (auto ret = llvm::dyn_cast<llvm::ReturnInst>(bb.getTerminator())) {
+          returns.push_back(ret);
+        }
+      }
       auto undef{llvm::UndefValue::get(return_ty)};
-      for (auto ret : Returns) {
+      for (auto ret : returns) {
         auto wrap{llvm::InsertValueInst::Create(undef, ret->getReturnValue(),
                                                 indices, "", ret)};
-        auto new_ret{llvm::ReturnInst::Create(ctx, wrap, ret)};
+        llvm::ReturnInst::Create(ctx, wrap, ret);
         ret->eraseFromParent();
       }
     }
-    funcs_to_remove.push_back(std::make_pair(orig_func, new_func));
     return new_func;
   };
 
-  std::unordered_map<llvm::Function *, llvm::Function *> fmap;
-  for (auto &f : m.functions()) {
-    if (f.getReturnType()->isArrayTy()) {
-      fmap[&f] = ConvertFunction(&f);
-    } else {
-      for (auto &arg : f.args()) {
-        if (arg.getType()->isArrayTy()) {
-          fmap[&f] = ConvertFunction(&f);
-          break;
-        }
-      }
-    }
+  std::vector<std::pair<llvm::Function *, llvm::Function *>> converted;
+  for (auto orig_func : orig_funcs) {
+    converted.push_back({orig_func, ConvertFunction(orig_func)});
   }
 
-  for (auto &f : m.functions()) {
-    std::vector<llvm::Instruction *> insts_to_remove;
-    for (auto &i : llvm::instructions(f)) {
-      if (auto call = llvm::dyn_cast<llvm::CallInst>(&i)) {
-        auto callee{call->getCalledFunction()};
-        auto new_func{fmap[callee]};
-        if (!new_func) {
-          continue;
-        }
+  // Only the users of the converted functions are visited, rather than every
+  // instruction of the module
+  for (auto [callee, new_func] : converted) {
+    std::vector<llvm::CallInst *> calls;
+    for (auto user : callee->users()) {
+      auto call{llvm::dyn_cast<llvm::CallInst>(user)};
+      if (call && call->getCalledFunction() == callee) {
+        calls.push_back(call);
+      }
+    }
 
-        std::vector<llvm::Value *> args;
-        for (auto &old_arg : call->args()) {
-          if (old_arg->getType()->isArrayTy()) {
-            auto undef{llvm::UndefValue::get(conv_types[old_arg->getType()])};
-            auto new_arg{llvm::InsertValueInst::Create(undef, old_arg, indices,
-                                                       "", call)};
-            args.push_back(new_arg);
-          } else {
-            args.push_back(old_arg);
-          }
-        }
-        llvm::SmallVector<std::pair<unsigned, llvm::MDNode *>, 16u> mds;
-        auto new_call{llvm::CallInst::Create(new_func->getFunctionType(),
-                                             new_func, args, call->getName(),
-                                             call)};
-        call->getAllMetadata(mds);
-        CloneMetadataInto(new_call, mds);
-        if (callee->getReturnType()->isArrayTy()) {
-          auto unwrap{
-              llvm::ExtractValueInst::Create(new_call, indices, "", call)};
-          call->replaceAllUsesWith(unwrap);
+    for (auto call : calls) {
+      std::vector<llvm::Value *> args;
+      for (auto &old_arg : call->args()) {
+        if (old_arg->getType()->isArrayTy()) {
+          auto undef{llvm::UndefValue::get(conv_types[old_arg->getType()])};
+          auto new_arg{llvm::InsertValueInst::Create(undef, old_arg, indices,
+                                                     "", call)};
+          args.push_back(new_arg);
         } else {
-          call->replaceAllUsesWith(new_call);
+          args.push_back(old_arg);
         }
-        insts_to_remove.push_back(call);
       }
-    }
-
-    for (auto inst : insts_to_remove) {
-      inst->eraseFromParent();
+      llvm::SmallVector<std::pair<unsigned, llvm::MDNode *>, 16u> mds;
+      auto new_call{llvm::CallInst::Create(new_func->getFunctionType(),
+                                           new_func, args, call->getName(),
+                                           call)};
+      call->getAllMetadata(mds);
+      CloneMetadataInto(new_call, mds);
+      if (callee->getReturnType()->isArrayTy()) {
+        auto unwrap{
+            llvm::ExtractValueInst::Create(new_call, indices, "", call)};
+        call->replaceAllUsesWith(unwrap);
+      } else {
+        call->replaceAllUsesWith(new_call);
+      }
+      call->eraseFromParent();
     }
   }
 
-  for (auto [func_to_remove, replacement] : funcs_to_remove) {
+  for (auto [func_to_remove, replacement] : converted) {
     // TODO(frabert): Sometimes uses stick around which are not calls (e.g.
     // references in globals). How do we replace those? Cannot use
     // `func->replaceAllUsesWith` because types don't match
@@ -439,10 +576,275 @@ void ConvertArrayArguments(llvm::Module &m) {
     } else {
       DLOG(ERROR) << "Keeping around old array function: "
                   << func_to_remove->getName().str();
+      // Its body now belongs to the replacement
+      if (func_to_remove->hasLocalLinkage()) {
+        func_to_remove->setLinkage(llvm::GlobalValue::ExternalLinkage);
+      }
     }
   }
+}
 
+void ConvertArrayArguments(llvm::Module &m) {
+  llvm::TimeTraceScope trace("ConvertArrayArguments");
+  WrapArrayArguments(m);
   CHECK(VerifyModule(&m)) << "Transformation broke module correctness";
 }
 
+namespace {
+// What the function-local preprocessing steps have to rewrite in a function
+struct PreprocessWork {
+  std::vector<llvm::PHINode *> phis;
+  std::vector<llvm::InsertValueInst *> insert_values;
+  bool has_switch{false};
+};
+
+// Only reads `func`, so it can run on any thread while other functions are
+// being rewritten
+PreprocessWork ScanFunction(llvm::Function &func) {
+  PreprocessWork work;
+  for (auto &inst : llvm::instructions(func)) {
+    if (auto phi = llvm::dyn_cast<llvm::PHINode>(&inst)) {
+      work.phis.push_back(phi);
+    } else if (auto iv = llvm::dyn_cast<llvm::InsertValueInst>(&inst)) {
+      work.insert_values.push_back(iv);
+    } else if (llvm::isa<llvm::SwitchInst>(inst)) {
+      work.has_switch = true;
+    }
+  }
+  return work;
+}
+}  // namespace
+
+void PreprocessModule(llvm::Module &module, bool remove_phi_nodes,
+                      bool lower_switches, PreprocessTimes &times,
+                      unsigned num_workers) {
+  llvm::TimeTraceScope trace("PreprocessModule");
+  auto timed{[&times](const char *step, auto fn) {
+    auto start{std::chrono::steady_clock::now()};
+    fn();
+    times[step] += std::chrono::steady_clock::now() - start;
+  }};
+
+  // Changes the signatures of functions and their call sites, so it is the
+  // only step that needs the whole module at once. The functions it creates
+  // are preprocessed like the others below.
+  timed("ConvertArrayArguments", [&]() { WrapArrayArguments(module); });
+
+  std::vector<llvm::Function *> funcs;
+  for (auto &func : module) {
+    if (!func.isDeclaration()) {
+      funcs.push_back(&func);
+    }
+  }
+
+  // Rewriting a function creates constants and types, and adds uses to values
+  // shared with other functions, none of which is thread-safe within a
+  // context. Workers scan the functions ahead of the rewriting instead, which
+  // then only visits the functions and instructions that need it.
+  std::vector<std::shared_future<PreprocessWork>> scans;
+  std::optional<llvm::ThreadPool> pool;
+  if (num_workers > 1) {
+    pool.emplace(llvm::hardware_concurrency(num_workers - 1));
+    for (auto func : funcs) {
+      scans.push_back(pool->async([func] { return ScanFunction(*func); }));
+    }
+  }
+
+  std::optional<SwitchLowering> lowering;
+  for (size_t i{0}; i < funcs.size(); ++i) {
+    auto &func{*funcs[i]};
+    auto work{pool ? scans[i].get() : ScanFunction(func)};
+    if (remove_phi_nodes && !work.phis.empty()) {
+      timed("RemovePHINodes", [&]() { DemotePHINodes(work.phis); });
+    }
+    if (lower_switches && work.has_switch) {
+      timed("LowerSwitches", [&]() {
+        if (!lowering) {
+          lowering.emplace();
+        }
+        lowering->Run(func);
+      });
+      // Lowering can delete blocks that became unreachable
+      work.insert_values.clear();
+      CollectInsertValues(func, work.insert_values);
+    }
+    if (!work.insert_values.empty()) {
+      timed("RemoveInsertValues",
+            [&]() { ConvertInsertValues(work.insert_values); });
+    }
+  }
+
+  timed("VerifyModule", [&]() {
+    CHECK(VerifyModule(&module)) << "Transformation broke module correctness";
+  });
+}
+
+namespace {
+// Marks the global values that `val` refers to as live, looking through
+// constant expressions and aggregates, and queues the ones seen for the first
+// time
+void MarkLive(llvm::Value *val,
+              llvm::SmallPtrSetImpl<llvm::GlobalValue *> &live,
+              llvm::SmallPtrSetImpl<llvm::Constant *> &visited,
+              std::vector<llvm::GlobalValue *> &worklist) {
+  if (auto gv = llvm::dyn_cast<llvm::GlobalValue>(val)) {
+    if (live.insert(gv).second) {
+      worklist.push_back(gv);
+    }
+    return;
+  }
+  auto constant{llvm::dyn_cast<llvm::Constant>(val)};
+  if (!constant || !visited.insert(constant).second) {
+    return;
+  }
+  for (auto &op : constant->operands()) {
+    MarkLive(op.get(), live, visited, worklist);
+  }
+}
+}  // namespace
+
+DeadGlobals RemoveDeadGlobals(llvm::Module &module,
+                              llvm::ArrayRef<llvm::GlobalValue *> roots) {
+  llvm::TimeTraceScope trace("RemoveDeadGlobals");
+  llvm::SmallPtrSet<llvm::GlobalValue *, 64> live;
+  llvm::SmallPtrSet<llvm::Constant *, 64> visited;
+  std::vector<llvm::GlobalValue *> worklist;
+  for (auto gv : roots) {
+    MarkLive(gv, live, visited, worklist);
+  }
+  // Aliases are kept even when local, since they are not removed
+  for (auto &gv : module.global_values()) {
+    if (!gv.hasLocalLinkage() || llvm::isa<llvm::GlobalAlias>(gv) ||
+        llvm::isa<llvm::GlobalIFunc>(gv)) {
+      MarkLive(&gv, live, visited, worklist);
+    }
+  }
+  while (!worklist.empty()) {
+    auto gv{worklist.back()};
+    worklist.pop_back();
+    // Initializers, aliasees, and the personality and prefix data of
+    // functions
+    for (auto &op : gv->operands()) {
+      MarkLive(op.get(), live, visited, worklist);
+    }
+    auto func{llvm::dyn_cast<llvm::Function>(gv)};
+    if (!func) {
+      continue;
+    }
+    for (auto &inst : llvm::instructions(*func)) {
+      for (auto &op : inst.operands()) {
+        MarkLive(op.get(), live, visited, worklist);
+      }
+    }
+  }
+
+  DeadGlobals res;
+  std::vector<llvm::GlobalValue *> dead;
+  for (auto &func : module.functions()) {
+    if (!live.count(&func)) {
+      dead.push_back(&func);
+      ++res.functions;
+    }
+  }
+  for (auto &var : module.globals()) {
+    if (!live.count(&var)) {
+      dead.push_back(&var);
+      ++res.variables;
+    }
+  }
+  // Dead values may refer to each other, so all of their references are
+  // dropped before any of them is erased
+  for (auto gv : dead) {
+    if (auto func = llvm::dyn_cast<llvm::Function>(gv)) {
+      func->dropAllReferences();
+    } else {
+      gv->dropAllReferences();
+    }
+  }
+  for (auto gv : dead) {
+    gv->removeDeadConstantUsers();
+    gv->eraseFromParent();
+  }
+  return res;
+}
+
+namespace {
+class ReferenceCollector {
+  llvm::SetVector<llvm::Type *> types;
+  llvm::SetVector<llvm::GlobalValue *> globals;
+  llvm::SmallPtrSet<llvm::Constant *, 16> visited;
+
+ public:
+  void AddType(llvm::Type *type) {
+    if (!types.insert(type)) {
+      return;
+    }
+    for (auto subtype : type->subtypes()) {
+      AddType(subtype);
+    }
+  }
+
+  void AddValue(llvm::Value *val) {
+    AddType(val->getType());
+    if (auto gv = llvm::dyn_cast<llvm::GlobalValue>(val)) {
+      globals.insert(gv);
+      AddType(gv->getValueType());
+      return;
+    }
+
+    auto constant{llvm::dyn_cast<llvm::Constant>(val)};
+    if (!constant || !visited.insert(constant).second) {
+      return;
+    }
+    if (auto gep = llvm::dyn_cast<llvm::GEPOperator>(constant)) {
+      AddType(gep->getSourceElementType());
+    }
+    for (auto &op : constant->operands()) {
+      AddValue(op.get());
+    }
+  }
+
+  void AddInstruction(llvm::Instruction &inst) {
+    AddType(inst.getType());
+    if (auto alloca = llvm::dyn_cast<llvm::AllocaInst>(&inst)) {
+      AddType(alloca->getAllocatedType());
+    } else if (auto gep = llvm::dyn_cast<llvm::GetElementPtrInst>(&inst)) {
+      AddType(gep->getSourceElementType());
+    } else if (auto call = llvm::dyn_cast<llvm::CallBase>(&inst)) {
+      AddType(call->getFunctionType());
+    }
+    for (auto &op : inst.operands()) {
+      if (!llvm::isa<llvm::BasicBlock>(op.get()) &&
+          !llvm::isa<llvm::MetadataAsValue>(op.get())) {
+        AddValue(op.get());
+      }
+    }
+  }
+
+  void Get(std::vector<llvm::Type *> &out_types,
+           std::vector<llvm::GlobalValue *> &out_globals) {
+    out_types.assign(types.begin(), types.end());
+    out_globals.assign(globals.begin(), globals.end());
+  }
+};
+}  // namespace
+
+void GetReferencedIR(llvm::Function &func, std::vector<llvm::Type *> &types,
+                     std::vector<llvm::GlobalValue *> &globals) {
+  ReferenceCollector collector;
+  collector.AddType(func.getFunctionType());
+  for (auto &inst : llvm::instructions(func)) {
+    collector.AddInstruction(inst);
+  }
+  collector.Get(types, globals);
+}
+
+void GetReferencedGlobals(llvm::Constant *constant,
+                          std::vector<llvm::GlobalValue *> &globals) {
+  ReferenceCollector collector;
+  collector.AddValue(constant);
+  std::vector<llvm::Type *> types;
+  collector.Get(types, globals);
+}
+
 }  // namespace rellic
\ No newline at end of file
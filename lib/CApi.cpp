@@ -0,0 +1,333 @@
+/*
+ * Copyright (c) 2021-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <glog/logging.h>
+#include <llvm/ADT/APInt.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <exception>
+#include <memory>
+#include <optional>
+#include <string>
+
+#include "rellic/AST/AlphaCache.h"
+#include "rellic/Decompiler.h"
+#include "rellic/Exception.h"
+#include "rellic/Printer.h"
+#include "rellic/Version.h"
+#include "rellic/rellic.h"
+
+struct rellic_result {
+  bool succeeded = false;
+  std::string code;
+  std::string provenance;
+  std::string stats;
+  std::string degraded_functions;
+  std::string error;
+};
+
+namespace rellic {
+namespace {
+
+// Options of `rellic_decompile` besides those of the decompiler
+struct CApiOptions {
+  DecompilationOptions decompilation;
+  bool provenance = false;
+  bool hex_literals = false;
+  // Whether the functions of the module share the answers of Z3 about their
+  // conditions, see `DecompilationOptions::alpha_cache`
+  bool alpha_cache = false;
+};
+
+// Reads `json` into `opts`. Throws on unknown keys and values of the wrong
+// type, so that misspelled options do not go unnoticed.
+void ParseOptions(llvm::StringRef json, CApiOptions &opts) {
+  if (json.trim().empty()) {
+    return;
+  }
+  auto parsed{llvm::json::parse(json)};
+  if (!parsed) {
+    THROW() << "Malformed options: " << llvm::toString(parsed.takeError());
+  }
+  auto map{parsed->getAsObject()};
+  CHECK_THROW(map) << "Options must be a JSON object";
+
+  auto &dec{opts.decompilation};
+  for (auto &[key, value] : *map) {
+    auto name{key.str()};
+    auto Bool{[&]() {
+      auto res{value.getAsBoolean()};
+      CHECK_THROW(res) << "Option " << name << " must be a boolean";
+      return *res;
+    }};
+    auto UInt{[&]() {
+      auto res{value.getAsUINT64()};
+      CHECK_THROW(res) << "Option " << name
+                       << " must be a nonnegative integer";
+      return *res;
+    }};
+    auto String{[&]() {
+      auto res{value.getAsString()};
+      CHECK_THROW(res) << "Option " << name << " must be a string";
+      return res->str();
+    }};
+
+    if (name == "lower_switches") {
+      dec.lower_switches = Bool();
+    } else if (name == "remove_phi_nodes") {
+      dec.remove_phi_nodes = Bool();
+    } else if (name == "remove_dead_globals") {
+      dec.remove_dead_globals = Bool();
+    } else if (name == "functions") {
+      auto arr{value.getAsArray()};
+      CHECK_THROW(arr) << "Option functions must be an array of names";
+      for (auto &func : *arr) {
+        auto str{func.getAsString()};
+        CHECK_THROW(str) << "Option functions must be an array of names";
+        dec.functions.push_back(str->str());
+      }
+    } else if (name == "call_depth") {
+      dec.call_depth = UInt();
+    } else if (name == "num_workers") {
+      dec.num_workers = UInt();
+    } else if (name == "scratch_contexts") {
+      dec.scratch_contexts = Bool();
+    } else if (name == "condition_engine") {
+      auto engine{String()};
+      if (engine == "z3") {
+        dec.condition_engine = DecompilationOptions::ConditionEngine::Z3;
+      } else if (engine == "bdd") {
+        dec.condition_engine = DecompilationOptions::ConditionEngine::BDD;
+      } else if (engine == "syntactic") {
+        dec.condition_engine = DecompilationOptions::ConditionEngine::Syntactic;
+      } else {
+        THROW() << "Unknown condition engine " << engine;
+      }
+    } else if (name == "reaching_cond_mode") {
+      auto mode{String()};
+      if (mode == "predecessors") {
+        dec.reaching_cond_mode =
+            DecompilationOptions::ReachingCondMode::Predecessors;
+      } else if (mode == "dominators") {
+        dec.reaching_cond_mode =
+            DecompilationOptions::ReachingCondMode::Dominators;
+      } else {
+        THROW() << "Unknown reaching condition mode " << mode;
+      }
+    } else if (name == "reuse_region_conds") {
+      dec.reuse_region_conds = Bool();
+    } else if (name == "cond_temp_threshold") {
+      dec.cond_temp_threshold = UInt();
+    } else if (name == "wide_string_threshold") {
+      dec.wide_string_threshold = UInt();
+    } else if (name == "debug_names_at_creation") {
+      dec.debug_names_at_creation = Bool();
+    } else if (name == "simplify_light_nodes") {
+      dec.simplify_light_nodes = UInt();
+    } else if (name == "simplify_max_nodes") {
+      dec.simplify_max_nodes = UInt();
+    } else if (name == "pipeline") {
+      dec.pipeline = String();
+    } else if (name == "adaptive_passes") {
+      dec.adaptive_passes = Bool();
+    } else if (name == "goto_fallback_blocks") {
+      dec.goto_fallback_blocks = UInt();
+    } else if (name == "goto_fallback_irreducible") {
+      dec.goto_fallback_irreducible = Bool();
+    } else if (name == "structuring_budget_ms") {
+      dec.structuring_budget_ms = UInt();
+    } else if (name == "z3_timeout_ms") {
+      dec.z3_timeout_ms = UInt();
+    } else if (name == "z3_portfolio_ms") {
+      dec.z3_portfolio_ms = UInt();
+    } else if (name == "function_budget_ms") {
+      dec.function_budget_ms = UInt();
+    } else if (name == "soft_rss_limit") {
+      dec.soft_rss_limit = UInt();
+    } else if (name == "soft_ast_memory_limit") {
+      dec.soft_ast_memory_limit = UInt();
+    } else if (name == "soft_z3_memory_limit") {
+      dec.soft_z3_memory_limit = UInt();
+    } else if (name == "soft_z3_exprs_limit") {
+      dec.soft_z3_exprs_limit = UInt();
+    } else if (name == "cache_dir") {
+      dec.cache_dir = String();
+    } else if (name == "cache_max_size") {
+      dec.cache_max_size = UInt();
+    } else if (name == "preprocess_cache_dir") {
+      dec.preprocess_cache_dir = String();
+    } else if (name == "provenance") {
+      opts.provenance = Bool();
+    } else if (name == "hex_literals") {
+      opts.hex_literals = Bool();
+    } else if (name == "alpha_cache") {
+      opts.alpha_cache = Bool();
+    } else {
+      THROW() << "Unknown option " << name;
+    }
+  }
+}
+
+void DecompileToResult(llvm::StringRef bitcode, llvm::StringRef options_json,
+                       rellic_result &res) {
+  CApiOptions opts;
+  ParseOptions(options_json, opts);
+  // The provenance of the decompiler is only needed to export it
+  opts.decompilation.provenance = opts.provenance;
+  std::optional<AlphaCache> alpha_cache;
+  if (opts.alpha_cache) {
+    alpha_cache.emplace();
+    opts.decompilation.alpha_cache = &*alpha_cache;
+  }
+
+  llvm::LLVMContext llvm_ctx;
+  std::unique_ptr<llvm::Module> module;
+  llvm::MemoryBufferRef buffer(bitcode, "bitcode");
+  if (opts.decompilation.preprocess_cache_dir.empty()) {
+    auto parsed{llvm::parseBitcodeFile(buffer, llvm_ctx)};
+    if (!parsed) {
+      res.error = "Cannot load bitcode: " + llvm::toString(parsed.takeError());
+      return;
+    }
+    module = std::move(*parsed);
+  } else {
+    module = LoadPreprocessedModule(llvm_ctx, buffer, opts.decompilation);
+    if (!module) {
+      res.error = "Cannot load bitcode";
+      return;
+    }
+  }
+
+  auto result{rellic::Decompile(std::move(module), opts.decompilation)};
+  if (!result.Succeeded()) {
+    res.error = result.TakeError().message;
+    return;
+  }
+  auto value{result.TakeValue()};
+
+  std::string provenance_lines;
+  llvm::raw_string_ostream provenance_os(provenance_lines);
+  std::optional<ProvenanceExporter> exporter;
+  ResultProvenance provenance{value};
+  PrintOptions print_opts;
+  print_opts.num_workers = opts.decompilation.num_workers;
+  if (opts.hex_literals) {
+    print_opts.hex_literals = [](const llvm::APInt &value) {
+      return value.uge(16);
+    };
+  }
+  if (opts.provenance) {
+    exporter.emplace(provenance_os);
+    print_opts.provenance = &provenance;
+    print_opts.on_printed = [&exporter](clang::Decl *decl, uint64_t begin,
+                                        uint64_t end,
+                                        llvm::ArrayRef<PrintedRange> ranges) {
+      exporter->Write(decl, begin, end, ranges);
+    };
+  }
+  {
+    llvm::raw_string_ostream os(res.code);
+    PrintTranslationUnit(value.ast->getASTContext(), os, print_opts);
+  }
+
+  if (opts.provenance) {
+    // The exporter writes one JSON object per line
+    provenance_os.flush();
+    llvm::SmallVector<llvm::StringRef, 16> lines;
+    llvm::StringRef(provenance_lines).split(lines, '\n', -1, false);
+    llvm::json::Array ranges;
+    for (auto line : lines) {
+      auto range{llvm::json::parse(line)};
+      CHECK(range) << "Invalid provenance: "
+                   << llvm::toString(range.takeError());
+      ranges.push_back(std::move(*range));
+    }
+    llvm::raw_string_ostream(res.provenance)
+        << llvm::json::Value(std::move(ranges));
+  }
+
+  llvm::raw_string_ostream(res.stats)
+      << llvm::json::Value(value.stats.ToJSON());
+  llvm::json::Array degraded;
+  for (auto &name : value.degraded_functions) {
+    degraded.push_back(name);
+  }
+  llvm::raw_string_ostream(res.degraded_functions)
+      << llvm::json::Value(std::move(degraded));
+  res.succeeded = true;
+}
+
+const char *GetString(const std::string &str, size_t *size) {
+  if (size) {
+    *size = str.size();
+  }
+  return str.c_str();
+}
+
+}  // namespace
+}  // namespace rellic
+
+extern "C" {
+
+int rellic_api_version(void) { return RELLIC_C_API_VERSION; }
+
+const char *rellic_version(void) {
+  static const std::string version{rellic::Version::GetVersionString()};
+  return version.c_str();
+}
+
+void rellic_set_min_log_level(int level) { FLAGS_minloglevel = level; }
+
+rellic_result *rellic_decompile(const char *bitcode, size_t size,
+                                const char *options_json) {
+  auto res{std::make_unique<rellic_result>()};
+  try {
+    rellic::DecompileToResult(llvm::StringRef(bitcode, size),
+                              options_json ? options_json : "", *res);
+  } catch (std::exception &ex) {
+    // Nothing may be thrown across the interface
+    *res = {};
+    res->error = ex.what();
+  }
+  return res.release();
+}
+
+void rellic_result_free(rellic_result *result) { delete result; }
+
+int rellic_result_succeeded(const rellic_result *result) {
+  return result->succeeded;
+}
+
+const char *rellic_result_code(const rellic_result *result, size_t *size) {
+  return rellic::GetString(result->code, size);
+}
+
+const char *rellic_result_provenance(const rellic_result *result,
+                                     size_t *size) {
+  return rellic::GetString(result->provenance, size);
+}
+
+const char *rellic_result_stats(const rellic_result *result, size_t *size) {
+  return rellic::GetString(result->stats, size);
+}
+
+const char *rellic_result_degraded_functions(const rellic_result *result,
+                                             size_t *size) {
+  return rellic::GetString(result->degraded_functions, size);
+}
+
+const char *rellic_result_error(const rellic_result *result, size_t *size) {
+  return rellic::GetString(result->error, size);
+}
+
+}  // extern "C"
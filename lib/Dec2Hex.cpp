@@ -6,6 +6,9 @@
  * the LICENSE file found in the root directory of this source tree.
  */
 
+#include "rellic/Dec2Hex.h"
+
+#include <clang/AST/Decl.h>
 #include <clang/AST/Expr.h>
 #include <clang/ASTMatchers/ASTMatchFinder.h>
 #include <clang/ASTMatchers/ASTMatchers.h>
@@ -13,8 +16,16 @@
 #include <clang/Rewrite/Core/Rewriter.h>
 #include <clang/Tooling/Tooling.h>
 #include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/ThreadPool.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "rellic/Printer.h"
+
 namespace rellic {
 namespace {
 using namespace clang;
@@ -22,77 +33,161 @@ using namespace clang::ast_matchers;
 
 StatementMatcher intlit = integerLiteral().bind("intlit");
 
+// Formats `lit` as a hexadecimal C literal with the same suffix that
+// `StmtPrinter` would use
+std::string FormatHex(const IntegerLiteral *lit) {
+  llvm::SmallString<40> str;
+  lit->getValue().toString(
+      str, /*radix=*/16, /*isSigned=*/lit->getType()->isSignedIntegerType(),
+      /*formatAsCLiteral=*/true);
+  str += GetIntegerLiteralSuffix(lit->getType());
+  return std::string(str.str());
+}
+
+// Replacements of integer literals in the source
+using HexEdits = std::vector<std::pair<SourceRange, std::string>>;
+
 class IntegerReplacer : public MatchFinder::MatchCallback {
-  Rewriter &rw;
+  HexEdits &edits;
   std::function<bool(const llvm::APInt &)> shouldConvert;
 
  public:
-  IntegerReplacer(Rewriter &rw,
+  IntegerReplacer(HexEdits &edits,
                   std::function<bool(const llvm::APInt &)> shouldConvert)
-      : rw(rw), shouldConvert(shouldConvert) {}
+      : edits(edits), shouldConvert(shouldConvert) {}
   virtual void run(const MatchFinder::MatchResult &Result) {
     if (auto lit = Result.Nodes.getNodeAs<IntegerLiteral>("intlit")) {
       if (!shouldConvert(lit->getValue())) {
         return;
       }
-
-      llvm::SmallString<40> str;
-      lit->getValue().toString(
-          str, /*radix=*/16, /*isSigned=*/lit->getType()->isSignedIntegerType(),
-          /*formatAsCLiteral=*/true);
-      std::string res;
-      llvm::raw_string_ostream OS(res);
-      OS << str;
-      switch (lit->getType()->castAs<BuiltinType>()->getKind()) {
-        default:
-          llvm_unreachable("Unexpected type for integer literal!");
-        case BuiltinType::Char_S:
-        case BuiltinType::Char_U:
-          OS << "i8";
-          break;
-        case BuiltinType::UChar:
-          OS << "Ui8";
-          break;
-        case BuiltinType::Short:
-          OS << "i16";
-          break;
-        case BuiltinType::UShort:
-          OS << "Ui16";
-          break;
-        case BuiltinType::Int:
-          break;  // no suffix.
-        case BuiltinType::UInt:
-          OS << 'U';
-          break;
-        case BuiltinType::Long:
-          OS << 'L';
-          break;
-        case BuiltinType::ULong:
-          OS << "UL";
-          break;
-        case BuiltinType::LongLong:
-          OS << "LL";
-          break;
-        case BuiltinType::ULongLong:
-          OS << "ULL";
-          break;
-      }
-      rw.ReplaceText(lit->getSourceRange(), res);
+      edits.emplace_back(lit->getSourceRange(), FormatHex(lit));
     }
   }
 };
+
+// Applies `edits` to the main file of `ast_ctx` and prints the result
+void WriteEdits(clang::ASTContext &ast_ctx, const HexEdits &edits,
+                llvm::raw_ostream &os) {
+  auto &sm{ast_ctx.getSourceManager()};
+  clang::Rewriter rewriter{sm, ast_ctx.getLangOpts()};
+  for (auto &[range, text] : edits) {
+    rewriter.ReplaceText(range, text);
+  }
+  if (auto buffer = rewriter.getRewriteBufferFor(sm.getMainFileID())) {
+    buffer->write(os);
+  } else {
+    os << sm.getBufferData(sm.getMainFileID());
+  }
+}
 }  // namespace
 
+llvm::StringRef GetIntegerLiteralSuffix(clang::QualType type) {
+  switch (type->castAs<clang::BuiltinType>()->getKind()) {
+    default:
+      llvm_unreachable("Unexpected type for integer literal!");
+    case clang::BuiltinType::Char_S:
+    case clang::BuiltinType::Char_U:
+      return "i8";
+    case clang::BuiltinType::UChar:
+      return "Ui8";
+    case clang::BuiltinType::Short:
+      return "i16";
+    case clang::BuiltinType::UShort:
+      return "Ui16";
+    case clang::BuiltinType::Int:
+      return "";  // no suffix.
+    case clang::BuiltinType::UInt:
+      return "U";
+    case clang::BuiltinType::Long:
+      return "L";
+    case clang::BuiltinType::ULong:
+      return "UL";
+    case clang::BuiltinType::LongLong:
+      return "LL";
+    case clang::BuiltinType::ULongLong:
+      return "ULL";
+  }
+}
+
+HexLiteralPrinter::HexLiteralPrinter(
+    std::function<bool(const llvm::APInt &)> shouldConvert)
+    : shouldConvert(shouldConvert) {}
+
+bool HexLiteralPrinter::handledStmt(clang::Stmt *stmt, llvm::raw_ostream &os) {
+  auto lit{clang::dyn_cast<clang::IntegerLiteral>(stmt)};
+  if (!lit || !shouldConvert(lit->getValue())) {
+    return false;
+  }
+  os << FormatHex(lit);
+  return true;
+}
+
+void PrintDeclWithHexLiterals(
+    clang::Decl *decl, llvm::raw_ostream &os,
+    std::function<bool(const llvm::APInt &)> shouldConvert) {
+  HexLiteralPrinter helper{shouldConvert};
+  PrintDecl(decl, os, &helper);
+}
+
 void ConvertIntegerLiteralsToHex(
     clang::ASTContext &ast_ctx, llvm::raw_ostream &os,
     std::function<bool(const llvm::APInt &)> shouldConvert) {
-  auto &sm{ast_ctx.getSourceManager()};
-  clang::Rewriter rewriter{sm, ast_ctx.getLangOpts()};
+  HexEdits edits;
   clang::ast_matchers::MatchFinder finder;
-  IntegerReplacer replacer{rewriter, shouldConvert};
+  IntegerReplacer replacer{edits, shouldConvert};
 
   finder.addMatcher(intlit, &replacer);
   finder.matchAST(ast_ctx);
-  rewriter.getRewriteBufferFor(sm.getMainFileID())->write(os);
+  WriteEdits(ast_ctx, edits, os);
+}
+
+void ConvertIntegerLiteralsToHex(
+    clang::ASTContext &ast_ctx, llvm::raw_ostream &os,
+    std::function<bool(const llvm::APInt &)> shouldConvert,
+    unsigned num_threads) {
+  if (num_threads <= 1) {
+    ConvertIntegerLiteralsToHex(ast_ctx, os, shouldConvert);
+    return;
+  }
+
+  // Each thread matches a contiguous range of the top-level declarations in
+  // the main file into edits of its own, which are applied in order once all
+  // of them are done. Matching only reads the AST, so the threads can share
+  // it; the rewriter is only touched by this thread.
+  auto &sm{ast_ctx.getSourceManager()};
+  std::vector<clang::Decl *> decls;
+  for (auto decl : ast_ctx.getTranslationUnitDecl()->decls()) {
+    if (sm.isInMainFile(decl->getLocation())) {
+      decls.push_back(decl);
+    }
+  }
+
+  auto num_chunks{std::min<size_t>(num_threads, decls.size())};
+  std::vector<HexEdits> chunk_edits(num_chunks);
+  {
+    llvm::ThreadPool pool(llvm::hardware_concurrency(num_threads));
+    for (size_t i{0}; i < num_chunks; ++i) {
+      pool.async([&, i] {
+        auto begin{decls.size() * i / num_chunks};
+        auto end{decls.size() * (i + 1) / num_chunks};
+        IntegerReplacer replacer{chunk_edits[i], shouldConvert};
+        clang::ast_matchers::MatchFinder finder;
+        finder.addMatcher(
+            clang::ast_matchers::decl(
+                clang::ast_matchers::forEachDescendant(intlit)),
+            &replacer);
+        for (auto j{begin}; j < end; ++j) {
+          finder.match(*decls[j], ast_ctx);
+        }
+      });
+    }
+    pool.wait();
+  }
+
+  HexEdits edits;
+  for (auto &chunk : chunk_edits) {
+    edits.insert(edits.end(), chunk.begin(), chunk.end());
+  }
+  WriteEdits(ast_ctx, edits, os);
 }
 }  // namespace rellic
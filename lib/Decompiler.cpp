@@ -9,167 +9,1280 @@
 #include "rellic/Decompiler.h"
 
 #include <clang/Basic/TargetInfo.h>
-#include <clang/Tooling/Tooling.h>
+#include <glog/logging.h>
+#include <llvm/ADT/SmallPtrSet.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
 #include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
 #include <llvm/IR/PassManager.h>
-#include <llvm/InitializePasses.h>
 #include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/Error.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/TimeProfiler.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/Utils.h>
+#include <llvm/Transforms/Utils/Cloning.h>
 #include <llvm/Transforms/Utils/Local.h>
 #include <llvm/Transforms/Utils/LowerSwitch.h>
+#include <llvm/Transforms/Utils/ModuleUtils.h>
 
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <future>
 #include <memory>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
 
-#include "rellic/AST/CondBasedRefine.h"
-#include "rellic/AST/DeadStmtElim.h"
+#include "rellic/AST/ASTUnitFactory.h"
+#include "rellic/AST/CostEstimate.h"
 #include "rellic/AST/DebugInfoCollector.h"
-#include "rellic/AST/ExprCombine.h"
+#include "rellic/AST/FunctionCache.h"
+#include "rellic/AST/FunctionShard.h"
 #include "rellic/AST/GenerateAST.h"
 #include "rellic/AST/IRToASTVisitor.h"
-#include "rellic/AST/LocalDeclRenamer.h"
-#include "rellic/AST/LoopRefine.h"
-#include "rellic/AST/MaterializeConds.h"
-#include "rellic/AST/NestedCondProp.h"
-#include "rellic/AST/NestedScopeCombine.h"
-#include "rellic/AST/ReachBasedRefine.h"
+#include "rellic/AST/PassProfile.h"
+#include "rellic/AST/PassRegistry.h"
 #include "rellic/AST/StructFieldRenamer.h"
-#include "rellic/AST/Z3CondSimplify.h"
 #include "rellic/BC/Util.h"
 #include "rellic/Exception.h"
+#include "rellic/Log.h"
+#include "rellic/Trace.h"
+#include "rellic/Version.h"
 
-namespace {
+static void Materialize(llvm::Function &func) {
+  if (auto err = func.materialize()) {
+    THROW() << "Cannot read the body of " << func.getName().str() << ": "
+            << llvm::toString(std::move(err));
+  }
+}
+
+// Finds the function named `name`, or if there is none and `name` is a
+// hexadecimal address, the function that lifters name `sub_<address>`
+static llvm::Function *FindFunction(llvm::Module &module,
+                                    llvm::StringRef name) {
+  if (auto func = module.getFunction(name)) {
+    return func;
+  }
+
+  uint64_t addr{};
+  auto digits{name};
+  if (digits.startswith_insensitive("0x")) {
+    digits = digits.drop_front(2);
+  }
+  if (digits.empty() || digits.getAsInteger(16, addr)) {
+    return nullptr;
+  }
+  for (auto &func : module.functions()) {
+    // Lifters may append a suffix to the address
+    auto suffix{func.getName()};
+    uint64_t func_addr{};
+    if (suffix.consume_front("sub_") &&
+        !suffix.consumeInteger(16, func_addr) && func_addr == addr) {
+      return &func;
+    }
+  }
+  return nullptr;
+}
+
+// Keeps the bodies of `options.functions` and of the functions they refer to
+// up to `options.call_depth` levels, and turns every other function into a
+// declaration. Bodies of lazily loaded modules are read here, and only for the
+// functions that are kept.
+static void SelectFunctions(llvm::Module &module,
+                            rellic::DecompilationOptions &options) {
+  llvm::TimeTraceScope trace("SelectFunctions");
+  bool lazy{module.getMaterializer() != nullptr};
+  if (!options.functions.empty()) {
+    llvm::SmallPtrSet<llvm::Function *, 16> selected;
+    // Visited breadth first, so that every function is reached at its least
+    // depth
+    std::vector<std::pair<llvm::Function *, unsigned>> worklist;
+    for (auto &name : options.functions) {
+      auto func{FindFunction(module, name)};
+      CHECK_THROW(func) << "No function named " << name;
+      if (selected.insert(func).second) {
+        worklist.push_back({func, 0});
+      }
+    }
+
+    std::vector<llvm::Type *> types;
+    std::vector<llvm::GlobalValue *> globals;
+    for (size_t i{0}; i < worklist.size(); ++i) {
+      auto [func, depth]{worklist[i]};
+      Materialize(*func);
+      if (options.call_depth && depth >= *options.call_depth) {
+        continue;
+      }
+      types.clear();
+      globals.clear();
+      rellic::GetReferencedIR(*func, types, globals);
+      for (auto gv : globals) {
+        auto callee{llvm::dyn_cast<llvm::Function>(gv)};
+        if (callee && selected.insert(callee).second) {
+          worklist.push_back({callee, depth + 1});
+        }
+      }
+    }
 
-static void InitOptPasses(void) {
-  auto& pr{*llvm::PassRegistry::getPassRegistry()};
-  initializeCore(pr);
-  initializeAnalysis(pr);
+    for (auto &func : module.functions()) {
+      if (!selected.count(&func) && !func.isDeclaration()) {
+        func.deleteBody();
+      }
+    }
+    RELLIC_LOG(Stats) << "Decompiling " << selected.size()
+                      << " selected functions";
+  }
+
+  if (lazy) {
+    if (auto err = module.materializeAll()) {
+      THROW() << "Cannot read module: " << llvm::toString(std::move(err));
+    }
+    CHECK_THROW(rellic::VerifyModule(&module)) << "Invalid module";
+  }
+}
+
+static void PrepareModule(llvm::Module &module,
+                          rellic::DecompilationOptions &options,
+                          rellic::PreprocessTimes &times) {
+  auto num_workers{options.num_workers
+                       ? options.num_workers
+                       : llvm::hardware_concurrency().compute_thread_count()};
+  rellic::PreprocessModule(module, options.remove_phi_nodes,
+                           options.lower_switches, times, num_workers);
 }
-}  // namespace
 
+// Removes the globals that nothing exported refers to if `options` ask for it,
+// before preprocessing spends any time on them. When functions have been
+// selected, the selection decides which of them are kept.
+static rellic::DeadGlobals RemoveUnreferencedGlobals(
+    llvm::Module &module, const rellic::DecompilationOptions &options,
+    rellic::PreprocessTimes &times) {
+  if (!options.remove_dead_globals) {
+    return {};
+  }
+  std::vector<llvm::GlobalValue *> roots;
+  if (!options.functions.empty()) {
+    for (auto &func : module.functions()) {
+      roots.push_back(&func);
+    }
+  }
+  auto start{std::chrono::steady_clock::now()};
+  auto dead{rellic::RemoveDeadGlobals(module, roots)};
+  times["RemoveDeadGlobals"] += std::chrono::steady_clock::now() - start;
+  RELLIC_LOG(Stats) << "Removed " << dead.functions
+                    << " unreferenced functions and " << dead.variables
+                    << " unreferenced variables";
+  return dead;
+}
+
+static void LogZ3Statistics(rellic::DecompilationContext &dec_ctx) {
+  auto &z3_cache{dec_ctx.z3_cache};
+  RELLIC_LOG(Stats) << "Prove cache: " << z3_cache.prove_hits << " hits, "
+                    << z3_cache.prove_misses << " misses, "
+                    << z3_cache.prove_shortcuts
+                    << " decided without the solver";
+  RELLIC_LOG(Stats) << "HeavySimplify cache: " << z3_cache.simplify_hits
+                    << " hits, " << z3_cache.simplify_misses << " misses";
+  if (z3_cache.timeouts) {
+    RELLIC_LOG(Stats) << "Z3 queries timed out: " << z3_cache.timeouts;
+  }
+  if (z3_cache.interrupts) {
+    RELLIC_LOG(Stats) << "Z3 queries interrupted: " << z3_cache.interrupts;
+  }
+  if (z3_cache.portfolio_races) {
+    RELLIC_LOG(Stats) << "Z3 queries raced across tactics: "
+                      << z3_cache.portfolio_races << ", "
+                      << z3_cache.portfolio_wins << " answered";
+  }
+  if (z3_cache.bdd_decisions) {
+    RELLIC_LOG(Stats) << "Proofs decided with BDDs: "
+                      << z3_cache.bdd_decisions;
+  }
+  if (z3_cache.alpha_hits) {
+    RELLIC_LOG(Stats) << "Z3 queries answered for equivalent conditions: "
+                      << z3_cache.alpha_hits;
+  }
+}
+
+// Logs who holds the memory measured at the end of the last stage, if the
+// stats category is enabled
+static void LogMemory(rellic::DecompilationContext &dec_ctx) {
+  if (dec_ctx.stats.memory.empty()) {
+    return;
+  }
+  auto &[stage, snapshot]{dec_ctx.stats.memory.back()};
+  auto MiB{[](uint64_t bytes) { return bytes / (1024 * 1024); }};
+  RELLIC_LOG(Stats) << "Memory after " << stage << ": " << MiB(snapshot.rss)
+                    << " MiB resident, " << MiB(snapshot.ast) << " MiB AST, "
+                    << MiB(snapshot.z3) << " MiB Z3, " << MiB(snapshot.module)
+                    << " MiB module, " << MiB(snapshot.conditions)
+                    << " MiB conditions, " << MiB(snapshot.provenance)
+                    << " MiB provenance, " << MiB(snapshot.maps)
+                    << " MiB maps";
+}
+
+// Stops recording provenance once a soft limit has been exceeded, and releases
+// what has been recorded so far
+static void ShedProvenance(rellic::DecompilationContext &dec_ctx,
+                           rellic::DecompilationOptions &options) {
+  if (dec_ctx.provenance_shed) {
+    dec_ctx.stmt_provenance.clear();
+    dec_ctx.use_provenance.clear();
+    return;
+  }
+  if (!dec_ctx.OverSoftLimit("provenance")) {
+    return;
+  }
+  if (options.provenance || options.on_decls) {
+    LOG(WARNING) << "Dropping provenance after exceeding the soft limit on "
+                 << dec_ctx.exceeded_limit;
+  }
+  dec_ctx.provenance_shed = true;
+  options.provenance = false;
+  dec_ctx.stmt_provenance = {};
+  dec_ctx.use_provenance = {};
+}
+
+// Fills the provenance maps of `result` and adds to its degraded functions.
+// The module of `result` must already be set. The provenance maps of `dec_ctx`
+// are consumed.
+static void TakeResultMaps(rellic::DecompilationContext &dec_ctx,
+                           rellic::DecompilationOptions &options,
+                           rellic::DecompilationResult &result) {
+  ShedProvenance(dec_ctx, options);
+  for (auto &func : result.module->functions()) {
+    auto decl{dec_ctx.value_decls.find(&func)};
+    if (decl != dec_ctx.value_decls.end() && decl->second &&
+        dec_ctx.degraded_functions.count(
+            clang::cast<clang::FunctionDecl>(decl->second))) {
+      result.degraded_functions.push_back(func.getName().str());
+    }
+  }
+
+  if (options.provenance) {
+    llvm::TimeTraceScope trace("BuildProvenance");
+    using DR = rellic::DecompilationResult;
+    result.stmt_provenance =
+        DR::StmtProvenance(std::move(dec_ctx.stmt_provenance));
+    result.value_decls = DR::DeclProvenance(std::move(dec_ctx.value_decls));
+    result.type_decls = DR::TypeDeclProvenance(std::move(dec_ctx.type_decls));
+    result.use_provenance =
+        DR::UseProvenance(std::move(dec_ctx.use_provenance));
+    RELLIC_LOG(Stats) << "Provenance: "
+                      << (result.stmt_provenance.GetMemoryUsage() +
+                          result.value_decls.GetMemoryUsage() +
+                          result.type_decls.GetMemoryUsage() +
+                          result.use_provenance.GetMemoryUsage()) /
+                             (1024 * 1024)
+                      << " MiB";
+  }
+}
+
+// Inverse of `TakeResultMaps`, used to resume from a previous result
 template <typename TKey, typename TValue>
-static void CopyMap(const std::unordered_map<TKey*, TValue*>& from,
-                    std::unordered_map<const TKey*, const TValue*>& to,
-                    std::unordered_map<const TValue*, const TKey*>& inverse) {
+static void RestoreMap(const rellic::ProvenanceMap<TKey, TValue>& from,
+                       std::unordered_map<TKey*, TValue*>& to) {
+  to.reserve(from.Size());
   for (auto [key, value] : from) {
-    if (value) {
-      to[key] = value;
-      inverse[value] = key;
+    to[const_cast<TKey*>(key)] = const_cast<TValue*>(value);
+  }
+}
+
+static std::unique_ptr<clang::ASTUnit> CreateASTUnit(llvm::Module &module) {
+  return rellic::ASTUnitFactory::Get().Create(module.getTargetTriple());
+}
+
+// Starts creating the translation unit of `module` on another thread. Only
+// its target triple is needed, so for small modules the cost of setting up
+// Clang is hidden behind reading and preparing the bitcode.
+static std::future<std::unique_ptr<clang::ASTUnit>> CreateASTUnitAsync(
+    llvm::Module &module) {
+  return std::async(std::launch::async, [triple{module.getTargetTriple()}] {
+    return rellic::ASTUnitFactory::Get().Create(triple);
+  });
+}
+
+static void AddTypeProviders(rellic::DecompilationContext &dec_ctx,
+                             rellic::DecompilationOptions &options) {
+  for (auto &provider : options.additional_providers) {
+    dec_ctx.type_provider->AddProvider(provider->create(dec_ctx));
+  }
+}
+
+static void SetConditionEngine(rellic::DecompilationContext &dec_ctx,
+                               rellic::DecompilationOptions &options) {
+  if (options.condition_engine ==
+      rellic::DecompilationOptions::ConditionEngine::BDD) {
+    dec_ctx.bdd_engine =
+        std::make_unique<rellic::DecompilationContext::BDDEngine>(
+            dec_ctx.z3_ctx);
+  }
+  dec_ctx.syntactic_conditions =
+      options.condition_engine ==
+      rellic::DecompilationOptions::ConditionEngine::Syntactic;
+  dec_ctx.dominator_reaching_conds =
+      options.reaching_cond_mode ==
+      rellic::DecompilationOptions::ReachingCondMode::Dominators;
+  dec_ctx.reuse_region_conds = options.reuse_region_conds;
+  dec_ctx.cond_temp_threshold = options.cond_temp_threshold;
+  dec_ctx.goto_fallback_blocks = options.goto_fallback_blocks;
+  dec_ctx.goto_fallback_irreducible = options.goto_fallback_irreducible;
+  dec_ctx.structuring_budget =
+      std::chrono::milliseconds(options.structuring_budget_ms);
+  dec_ctx.wide_string_threshold = options.wide_string_threshold;
+  dec_ctx.simplify_light_nodes = options.simplify_light_nodes;
+  dec_ctx.simplify_max_nodes = options.simplify_max_nodes;
+  dec_ctx.adaptive_passes = options.adaptive_passes;
+  dec_ctx.pass_profile = options.pass_profile;
+  dec_ctx.recorded_profile = options.record_pass_profile;
+  dec_ctx.alpha_cache = options.alpha_cache;
+  dec_ctx.z3_query_log = options.z3_query_log;
+  dec_ctx.SetProgress(options.progress);
+  dec_ctx.on_insert_z_expr = options.on_z3_expr;
+}
+
+// Structuring needs exact answers from Z3 for reaching conditions to converge,
+// so resource limits only apply to the refinement passes that follow it.
+static void SetRefinementLimits(rellic::DecompilationContext &dec_ctx,
+                                rellic::DecompilationOptions &options) {
+  dec_ctx.z3_timeout = options.z3_timeout_ms;
+  dec_ctx.z3_portfolio = options.z3_portfolio_ms;
+  dec_ctx.function_budget =
+      std::chrono::milliseconds(options.function_budget_ms);
+  dec_ctx.rss_limit = options.soft_rss_limit;
+  dec_ctx.ast_memory_limit = options.soft_ast_memory_limit;
+  dec_ctx.z3_memory_limit = options.soft_z3_memory_limit;
+  dec_ctx.z3_exprs_limit = options.soft_z3_exprs_limit;
+}
+
+static std::string GetPipeline(rellic::DecompilationOptions &options) {
+  return options.pipeline.empty() ? rellic::GetDefaultPipeline()
+                                  : options.pipeline;
+}
+
+// Only the functions in `scope` are refined, or all of them if it is null
+static void RunPasses(rellic::DecompilationContext &dec_ctx,
+                      rellic::DebugInfoCollector &dic,
+                      rellic::DecompilationOptions &options, bool rename_fields,
+                      const rellic::FunctionSet *scope = nullptr) {
+  std::unordered_set<std::string> excluded;
+  if (!rename_fields) {
+    excluded.insert("sfr");
+  }
+  // Names were already taken from debug info as declarations were created
+  if (dec_ctx.debug_names) {
+    excluded.insert("ldr");
+    excluded.insert("sfr");
+  }
+  // Linking `if` chains needs the solver to tell that conditions are disjoint
+  if (dec_ctx.syntactic_conditions) {
+    excluded.insert("rbr");
+  }
+  if (options.pass_profile || options.record_pass_profile) {
+    for (auto &[value, decl] : dec_ctx.value_decls) {
+      auto func{llvm::dyn_cast<llvm::Function>(value)};
+      auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+      if (func && fdecl && !func->isDeclaration() && fdecl->hasBody()) {
+        dec_ctx.function_shapes[fdecl] = rellic::GetFunctionShape(*func);
+      }
     }
   }
+  auto pipeline{
+      rellic::Pipeline::Parse(GetPipeline(options), dec_ctx, &dic, excluded)};
+  pipeline->SetScope(scope);
+  pipeline->Run();
 }
 
-namespace rellic {
-Result<DecompilationResult, DecompilationError> Decompile(
-    std::unique_ptr<llvm::Module> module, DecompilationOptions options) {
-  try {
-    if (options.remove_phi_nodes) {
-      RemovePHINodes(*module);
+// Describes the options that change how a function is decompiled, for use in
+// cache keys. Options that transform the module are already reflected in the
+// IR of each function.
+static std::string GetOptionsKey(rellic::DecompilationOptions &options) {
+  return "pipeline=" + GetPipeline(options) +
+         ";z3_timeout_ms=" + std::to_string(options.z3_timeout_ms) +
+         ";z3_portfolio_ms=" + std::to_string(options.z3_portfolio_ms) +
+         ";function_budget_ms=" + std::to_string(options.function_budget_ms) +
+         ";condition_engine=" +
+         std::to_string(static_cast<int>(options.condition_engine)) +
+         ";reaching_cond_mode=" +
+         std::to_string(static_cast<int>(options.reaching_cond_mode)) +
+         ";reuse_region_conds=" + std::to_string(options.reuse_region_conds) +
+         ";cond_temp_threshold=" + std::to_string(options.cond_temp_threshold) +
+         ";wide_string_threshold=" +
+         std::to_string(options.wide_string_threshold) +
+         ";simplify_light_nodes=" +
+         std::to_string(options.simplify_light_nodes) +
+         ";simplify_max_nodes=" + std::to_string(options.simplify_max_nodes) +
+         ";goto_fallback_blocks=" +
+         std::to_string(options.goto_fallback_blocks) +
+         ";goto_fallback_irreducible=" +
+         std::to_string(options.goto_fallback_irreducible) +
+         ";structuring_budget_ms=" +
+         std::to_string(options.structuring_budget_ms) +
+         ";debug_names_at_creation=" +
+         std::to_string(options.debug_names_at_creation) +
+         (options.pass_profile
+              ? ";pass_profile=" + options.pass_profile->GetKey()
+              : "");
+}
+
+// Splits `funcs` into at most `num_jobs` groups of about the same estimated
+// cost, by giving each function from the most to the least expensive to the
+// group with the lowest cost so far. Groups are returned from the most to the
+// least expensive, each listing its functions in module order.
+static std::vector<std::vector<llvm::Function *>> PartitionByCost(
+    const std::vector<llvm::Function *> &funcs, size_t num_jobs) {
+  std::vector<std::pair<uint64_t, size_t>> order;
+  for (size_t i{0}; i < funcs.size(); ++i) {
+    order.emplace_back(rellic::EstimateFunctionCost(*funcs[i]).cost, i);
+  }
+  std::sort(order.begin(), order.end(), [](auto &a, auto &b) {
+    return a.first != b.first ? a.first > b.first : a.second < b.second;
+  });
+
+  num_jobs = std::min(num_jobs, funcs.size());
+  std::vector<std::vector<size_t>> groups(num_jobs);
+  using Load = std::pair<uint64_t, size_t>;
+  std::priority_queue<Load, std::vector<Load>, std::greater<Load>> loads;
+  for (size_t i{0}; i < num_jobs; ++i) {
+    loads.emplace(0, i);
+  }
+  for (auto [cost, idx] : order) {
+    auto [load, group] = loads.top();
+    loads.pop();
+    groups[group].push_back(idx);
+    loads.emplace(load + cost, group);
+  }
+
+  std::vector<uint64_t> group_costs(num_jobs);
+  while (!loads.empty()) {
+    group_costs[loads.top().second] = loads.top().first;
+    loads.pop();
+  }
+  std::vector<size_t> by_cost(num_jobs);
+  for (size_t i{0}; i < num_jobs; ++i) {
+    by_cost[i] = i;
+  }
+  std::stable_sort(by_cost.begin(), by_cost.end(), [&](size_t a, size_t b) {
+    return group_costs[a] > group_costs[b];
+  });
+
+  std::vector<std::vector<llvm::Function *>> result;
+  for (auto group : by_cost) {
+    auto &indices{groups[group]};
+    std::sort(indices.begin(), indices.end());
+    std::vector<llvm::Function *> group_funcs;
+    for (auto idx : indices) {
+      group_funcs.push_back(funcs[idx]);
+    }
+    result.push_back(std::move(group_funcs));
+  }
+  return result;
+}
+
+// Number of shards per thread when functions do not get a shard of their own.
+// Having more shards than threads lets threads that finish early pick up the
+// remaining ones, instead of idling while the most loaded thread finishes.
+static constexpr size_t kShardsPerWorker{4};
+
+// Provenance of the main context while its declarations are streamed
+class ContextProvenance final : public rellic::ProvenanceLookup {
+  rellic::DecompilationContext &dec_ctx;
+  // Inverse of `value_decls`, built by the first query of a declaration
+  mutable std::unordered_map<const clang::ValueDecl *, const llvm::Value *>
+      decl_values;
+  mutable std::once_flag decl_values_built;
+
+ public:
+  ContextProvenance(rellic::DecompilationContext &dec_ctx) : dec_ctx(dec_ctx) {}
+  const llvm::Value *GetValue(const clang::Stmt *stmt) const override {
+    auto it{dec_ctx.stmt_provenance.find(const_cast<clang::Stmt *>(stmt))};
+    return it == dec_ctx.stmt_provenance.end() ? nullptr : it->second;
+  }
+  const llvm::Use *GetUse(const clang::Expr *expr) const override {
+    auto it{dec_ctx.use_provenance.find(const_cast<clang::Expr *>(expr))};
+    return it == dec_ctx.use_provenance.end() ? nullptr : it->second;
+  }
+  const llvm::Value *GetDeclValue(const clang::ValueDecl *decl) const override {
+    std::call_once(decl_values_built, [this]() {
+      for (auto &[value, value_decl] : dec_ctx.value_decls) {
+        decl_values.emplace(value_decl, value);
+      }
+    });
+    auto it{decl_values.find(decl)};
+    return it == decl_values.end() ? nullptr : it->second;
+  }
+};
+
+// Passes the declarations that have been added to the translation unit after
+// `last` to `options.on_decls`, renaming the fields of records first if `sfr`
+// is not null, and updates `last`
+static void EmitDecls(rellic::DecompilationContext &dec_ctx,
+                      rellic::DecompilationOptions &options,
+                      rellic::StructFieldRenamer *sfr, clang::Decl *&last) {
+  auto tudecl{dec_ctx.ast_ctx.getTranslationUnitDecl()};
+  auto first{last ? last->getNextDeclInContext()
+                  : (tudecl->decls_empty() ? nullptr : *tudecl->decls_begin())};
+  std::vector<clang::Decl *> decls;
+  for (auto decl{first}; decl; decl = decl->getNextDeclInContext()) {
+    if (auto record = clang::dyn_cast<clang::RecordDecl>(decl)) {
+      if (sfr) {
+        sfr->RenameFields(record);
+      }
+    }
+    decls.push_back(decl);
+    last = decl;
+  }
+  if (!decls.empty()) {
+    llvm::TimeTraceScope trace("EmitDecls");
+    options.on_decls(decls, ContextProvenance(dec_ctx));
+  }
+}
+
+// Decompiles function bodies on `num_workers` threads. The main context only
+// holds declarations, and receives the bodies of each batch of shards once
+// every worker is done with it. If `cache` is not null, functions found in it
+// are not decompiled again, and all other functions are decompiled in a shard
+// of their own so that they can be stored in it. Otherwise functions are
+// spread over `kShardsPerWorker` shards per thread of about the same estimated
+// cost.
+//
+// With `scratch_contexts`, every function also gets a shard of its own, and
+// shards are created, decompiled and merged `num_workers` at a time in module
+// order, so that the nodes that refinement discards are released with each
+// batch instead of accumulating until the end.
+//
+// Within a batch, the shards with the highest estimated cost are started
+// first, so that the most expensive functions are not left for the end.
+static void DecompileFunctionsInParallel(llvm::Module &module,
+                                         rellic::DecompilationContext &dec_ctx,
+                                         rellic::DebugInfoCollector &dic,
+                                         rellic::DecompilationOptions &options,
+                                         unsigned num_workers,
+                                         rellic::FunctionCache *cache) {
+  // Parsed up front so that a malformed pipeline is reported before any work
+  auto rename_fields{
+      !dec_ctx.debug_names &&
+      rellic::Pipeline::Parse(GetPipeline(options), dec_ctx, &dic)->Uses(
+          "sfr")};
+
+  struct Job {
+    std::vector<llvm::Function *> funcs;
+    // Loaded from the cache, or created when the batch of the job starts
+    std::unique_ptr<rellic::FunctionShard> shard;
+    std::string key;
+    uint64_t cost{0};
+  };
+  std::vector<Job> jobs;
+
+  if (cache) {
+    llvm::TimeTraceScope trace("FunctionCache::Load");
+    size_t hits{0};
+    for (auto &func : module.functions()) {
+      if (func.isDeclaration()) {
+        continue;
+      }
+      auto key{cache->GetKey(func)};
+      auto shard{cache->Load(func, key)};
+      hits += shard != nullptr;
+      jobs.push_back({{&func}, std::move(shard), std::move(key)});
+    }
+    RELLIC_LOG(Stats) << "Function cache: " << hits << " hits, "
+                      << jobs.size() - hits << " misses";
+    dec_ctx.stats.function_cache_hits += hits;
+    dec_ctx.stats.function_cache_misses += jobs.size() - hits;
+  } else if (options.scratch_contexts) {
+    for (auto &func : module.functions()) {
+      if (!func.isDeclaration()) {
+        jobs.push_back({{&func}, nullptr, ""});
+      }
+    }
+  } else {
+    std::vector<llvm::Function *> funcs;
+    for (auto &func : module.functions()) {
+      if (!func.isDeclaration()) {
+        funcs.push_back(&func);
+      }
+    }
+    for (auto &group : PartitionByCost(funcs, num_workers * kShardsPerWorker)) {
+      jobs.push_back({std::move(group), nullptr, ""});
+    }
+  }
+  for (auto &job : jobs) {
+    for (auto func : job.funcs) {
+      job.cost += rellic::EstimateFunctionCost(*func).cost;
+    }
+  }
+
+  rellic::GenerateAST::run(module, {}, dec_ctx);
+  // Types are declared up front, as they are when the whole module is
+  // generated in a single context, instead of as each batch is merged
+  std::vector<llvm::Function *> defined;
+  for (auto &func : module.functions()) {
+    if (!func.isDeclaration()) {
+      defined.push_back(&func);
+    }
+  }
+  rellic::GenerateAST::DeclareTypes(defined, dec_ctx);
+  SetRefinementLimits(dec_ctx, options);
+  RunPasses(dec_ctx, dic, options, /*rename_fields=*/false);
+
+  // When streaming, field names are assigned to records as they are passed on
+  std::unique_ptr<rellic::StructFieldRenamer> sfr;
+  if (options.on_decls && rename_fields) {
+    sfr = std::make_unique<rellic::StructFieldRenamer>(dec_ctx, dic);
+  }
+  clang::Decl *last_emitted{nullptr};
+  if (options.on_decls) {
+    EmitDecls(dec_ctx, options, sfr.get(), last_emitted);
+  }
+
+  size_t batch_size{options.scratch_contexts ? num_workers : jobs.size()};
+  llvm::ThreadPool pool(llvm::hardware_concurrency(num_workers));
+  for (size_t begin{0}; begin < jobs.size(); begin += batch_size) {
+    auto end{std::min(begin + batch_size, jobs.size())};
+
+    // Shards that still need to be decompiled, and their cache keys
+    std::vector<Job *> pending;
+    for (auto i{begin}; i < end; ++i) {
+      auto &job{jobs[i]};
+      if (job.shard) {
+        continue;
+      }
+      job.shard = std::make_unique<rellic::FunctionShard>(CreateASTUnit(module),
+                                                          job.funcs);
+      // Type providers are created by user-supplied factories, which are not
+      // required to be thread-safe
+      AddTypeProviders(job.shard->GetContext(), options);
+      SetConditionEngine(job.shard->GetContext(), options);
+      job.shard->GetContext().debug_names = dec_ctx.debug_names;
+      pending.push_back(&job);
     }
+    // The thread pool starts jobs in the order they are submitted
+    std::stable_sort(pending.begin(), pending.end(),
+                     [](Job *a, Job *b) { return a->cost > b->cost; });
 
-    if (options.lower_switches) {
-      LowerSwitches(*module);
+    std::vector<std::string> errors(pending.size());
+    for (auto i{0U}; i < pending.size(); ++i) {
+      pool.async([&module, &dic, &options, cache, &job = *pending[i],
+                  &error = errors[i]] {
+        rellic::TraceThread trace_thread;
+        llvm::TimeTraceScope trace("FunctionShard");
+        auto &shard{*job.shard};
+        try {
+          shard.GenerateAST(module);
+          SetRefinementLimits(shard.GetContext(), options);
+          auto &shard_ctx{shard.GetContext()};
+          RunPasses(shard_ctx, dic, options, /*rename_fields=*/false);
+          if (shard_ctx.Cancelled()) {
+            // Structuring and refinement stop early once cancelled, leaving
+            // bodies missing or half refined
+            for (auto func : job.funcs) {
+              auto decl{shard_ctx.value_decls.find(func)};
+              if (decl != shard_ctx.value_decls.end() && decl->second) {
+                shard_ctx.degraded_functions.insert(
+                    clang::cast<clang::FunctionDecl>(decl->second));
+              }
+            }
+          } else if (cache && shard_ctx.degraded_functions.empty()) {
+            // Degraded bodies depend on timing, and are worth retrying later
+            cache->Store(shard, job.key);
+          }
+        } catch (rellic::Exception &ex) {
+          error = ex.what();
+        }
+      });
     }
+    pool.wait();
 
-    ConvertArrayArguments(*module);
-    RemoveInsertValues(*module);
+    for (auto &error : errors) {
+      if (!error.empty()) {
+        THROW() << error;
+      }
+    }
 
-    InitOptPasses();
-    rellic::DebugInfoCollector dic;
-    dic.visit(*module);
+    std::vector<std::unique_ptr<rellic::FunctionShard>> shards;
+    for (auto i{begin}; i < end; ++i) {
+      shards.push_back(std::move(jobs[i].shard));
+    }
+    {
+      llvm::TimeTraceScope trace("FunctionShard::Merge");
+      rellic::FunctionShard::Merge(module, shards, dec_ctx);
+    }
+    for (auto &shard : shards) {
+      dec_ctx.stats.released_ast_memory +=
+          shard->GetASTUnit().getASTContext().getASTAllocatedMemory();
+    }
+    shards.clear();
+    ShedProvenance(dec_ctx, options);
 
-    std::vector<std::string> args{"-Wno-pointer-to-int-cast",
-                                  "-Wno-pointer-sign", "-target",
-                                  module->getTargetTriple()};
-    // Silence clang warning
-    // warning: unknown platform, assumming -mfloat-abi=soft
-    const auto& triple{llvm::Triple(module->getTargetTriple())};
-    if (triple.isARM()) {
-        args.push_back("-mfloat-abi=soft");
+    if (options.on_decls) {
+      EmitDecls(dec_ctx, options, sfr.get(), last_emitted);
     }
-    auto ast_unit{clang::tooling::buildASTFromCodeWithArgs("", args, "out.c")};
+  }
+
+  // Field names are global, so they are assigned once all bodies are merged
+  if (rename_fields && !options.on_decls) {
+    rellic::StructFieldRenamer sfr{dec_ctx, dic};
+    sfr.Run();
+  }
+}
+
+// Whether `options` ask for a function cache that can be used
+static bool UsesCache(rellic::DecompilationOptions &options) {
+  if (options.cache_dir.empty()) {
+    return false;
+  }
+  if (!options.additional_providers.empty()) {
+    LOG(WARNING) << "Function cache disabled because of additional type "
+                    "providers";
+    return false;
+  }
+  return true;
+}
+
+static void EvictCache(rellic::FunctionCache &cache) {
+  llvm::TimeTraceScope trace("FunctionCache::Evict");
+  cache.Evict();
+}
+
+namespace rellic {
+// Does the work of `Decompile`, looking up and storing functions in `cache` if
+// it is not null
+static Result<DecompilationResult, DecompilationError> DecompileWithCache(
+    std::unique_ptr<llvm::Module> module, DecompilationOptions &options,
+    FunctionCache *cache) {
+  try {
+    auto pending_ast_unit{CreateASTUnitAsync(*module)};
+    SelectFunctions(*module, options);
+    rellic::PreprocessTimes preprocessing;
+    auto dead{RemoveUnreferencedGlobals(*module, options, preprocessing)};
+    PrepareModule(*module, options, preprocessing);
+
+    // Local names are collected for the functions that are named, and types
+    // once fields are
+    rellic::DebugInfoCollector dic(rellic::DebugInfoCollector::kNames |
+                                   rellic::DebugInfoCollector::kTypes);
+    dic.CollectLazily(*module);
+
+    auto ast_unit{pending_ast_unit.get()};
     rellic::DecompilationContext dec_ctx(*ast_unit);
+    dec_ctx.stats.preprocessing = std::move(preprocessing);
+    dec_ctx.stats.dead_functions = dead.functions;
+    dec_ctx.stats.dead_variables = dead.variables;
+    AddTypeProviders(dec_ctx, options);
+    SetConditionEngine(dec_ctx, options);
+    if (options.debug_names_at_creation) {
+      dec_ctx.debug_names = &dic;
+    }
+    dec_ctx.RecordMemory("preprocessing", module.get());
 
-    for (auto& provider : options.additional_providers) {
-      dec_ctx.type_provider->AddProvider(provider->create(dec_ctx));
+    if (options.on_decls) {
+      options.scratch_contexts = true;
     }
+    auto num_workers{options.num_workers
+                         ? options.num_workers
+                         : llvm::hardware_concurrency().compute_thread_count()};
+    if (num_workers > 1 || cache || options.scratch_contexts) {
+      DecompileFunctionsInParallel(*module, dec_ctx, dic, options, num_workers,
+                                   cache);
+    } else {
+      rellic::GenerateAST::run(*module, dec_ctx);
+      dec_ctx.RecordMemory("structuring", module.get());
+      SetRefinementLimits(dec_ctx, options);
+      // TODO(surovic): Add llvm::Value* -> clang::Decl* map
+      // Especially for llvm::Argument* and llvm::Function*.
+      RunPasses(dec_ctx, dic, options, /*rename_fields=*/true);
+    }
+    dec_ctx.RecordMemory("refinement", module.get());
+
+    LogZ3Statistics(dec_ctx);
+    LogMemory(dec_ctx);
+
+    DecompilationResult result{};
+    result.ast = std::move(ast_unit);
+    result.module = std::move(module);
+    TakeResultMaps(dec_ctx, options, result);
+    result.stats = std::move(dec_ctx.stats);
+    result.stats.peak_rss = GetPeakRSS();
+    result.stats.ast_memory =
+        result.ast->getASTContext().getASTAllocatedMemory();
+    RELLIC_LOG(Stats) << "Peak RSS: " << result.stats.peak_rss / (1024 * 1024)
+                      << " MiB";
+    RELLIC_LOG(Stats) << "AST memory: "
+                      << result.stats.ast_memory / (1024 * 1024)
+                      << " MiB, plus "
+                      << result.stats.released_ast_memory / (1024 * 1024)
+                      << " MiB released with function shards";
+    RELLIC_LOG(Stats) << "Type cache: " << result.stats.qual_type_hits
+                      << " hits, " << result.stats.qual_type_misses
+                      << " misses";
+    if (result.stats.cond_temps) {
+      RELLIC_LOG(Stats) << "Condition temporaries: "
+                        << result.stats.cond_temps << ", saving "
+                        << result.stats.cond_temp_savings
+                        << " instruction translations";
+    }
+    if (result.stats.light_simplifications ||
+        result.stats.skipped_simplifications) {
+      RELLIC_LOG(Stats) << "HeavySimplify by formula size: "
+                        << result.stats.full_simplifications << " full, "
+                        << result.stats.light_simplifications << " light, "
+                        << result.stats.skipped_simplifications << " skipped";
+    }
+    if (result.stats.goto_fallbacks) {
+      RELLIC_LOG(Stats) << "Functions emitted with gotos: "
+                        << result.stats.goto_fallbacks;
+    }
+
+    return Result<DecompilationResult, DecompilationError>(std::move(result));
+  } catch (Exception& ex) {
+    DecompilationError error{};
+    error.message = ex.what();
+    error.module = std::move(module);
+    return Result<DecompilationResult, DecompilationError>(std::move(error));
+  }
+}
+
+Result<DecompilationResult, DecompilationError> Decompile(
+    std::unique_ptr<llvm::Module> module, DecompilationOptions options) {
+  std::unique_ptr<FunctionCache> cache;
+  if (UsesCache(options)) {
+    cache = std::make_unique<FunctionCache>(
+        options.cache_dir, options.cache_max_size, GetOptionsKey(options));
+  }
+  auto result{DecompileWithCache(std::move(module), options, cache.get())};
+  if (cache && result.Succeeded()) {
+    EvictCache(*cache);
+  }
+  return result;
+}
+
+DecompilerEngine::DecompilerEngine() = default;
+
+DecompilerEngine::~DecompilerEngine() { Flush(); }
+
+std::unique_ptr<llvm::Module> DecompilerEngine::LoadModule(
+    llvm::MemoryBufferRef buffer) {
+  return std::unique_ptr<llvm::Module>(
+      LoadModuleFromBuffer(&llvm_ctx, buffer, /*allow_failure=*/true));
+}
+
+Result<DecompilationResult, DecompilationError> DecompilerEngine::Decompile(
+    std::unique_ptr<llvm::Module> module, DecompilationOptions options) {
+  FunctionCache *cache{nullptr};
+  if (UsesCache(options)) {
+    auto key{GetOptionsKey(options)};
+    auto &entry{caches[options.cache_dir + '\n' +
+                       std::to_string(options.cache_max_size) + '\n' + key]};
+    if (!entry) {
+      entry = std::make_unique<FunctionCache>(options.cache_dir,
+                                              options.cache_max_size, key);
+    }
+    cache = entry.get();
+  }
+  auto result{DecompileWithCache(std::move(module), options, cache)};
+  if (result.Succeeded()) {
+    stats.Merge(result.Value().stats);
+  }
+  return result;
+}
+
+void DecompilerEngine::Flush() {
+  for (auto &[key, cache] : caches) {
+    EvictCache(*cache);
+  }
+}
+
+DecompilationHandle::DecompilationHandle(
+    std::unique_ptr<Progress> owned_progress, Progress* progress,
+    std::future<Result<DecompilationResult, DecompilationError>> future)
+    : owned_progress(std::move(owned_progress)),
+      progress(progress),
+      future(std::move(future)) {}
+
+DecompilationHandle::~DecompilationHandle() {
+  if (future.valid()) {
+    Cancel();
+    future.wait();
+  }
+}
 
-    rellic::GenerateAST::run(*module, dec_ctx);
-    // TODO(surovic): Add llvm::Value* -> clang::Decl* map
-    // Especially for llvm::Argument* and llvm::Function*.
+void DecompilationHandle::Cancel() { progress->Cancel(); }
 
-    rellic::CompositeASTPass pass_ast(dec_ctx);
-    auto& ast_passes{pass_ast.GetPasses()};
+bool DecompilationHandle::IsReady() const {
+  return WaitFor(std::chrono::milliseconds(0));
+}
 
-    ast_passes.push_back(std::make_unique<rellic::DeadStmtElim>(dec_ctx));
-    ast_passes.push_back(std::make_unique<rellic::LocalDeclRenamer>(
-        dec_ctx, dic.GetIRToNameMap()));
-    ast_passes.push_back(std::make_unique<rellic::StructFieldRenamer>(
-        dec_ctx, dic.GetIRTypeToDITypeMap()));
-    pass_ast.Run();
+bool DecompilationHandle::WaitFor(std::chrono::milliseconds timeout) const {
+  CHECK(future.valid()) << "The result has already been retrieved";
+  return future.wait_for(timeout) == std::future_status::ready;
+}
 
-    rellic::CompositeASTPass pass_cbr(dec_ctx);
-    auto& cbr_passes{pass_cbr.GetPasses()};
+Result<DecompilationResult, DecompilationError> DecompilationHandle::Get() {
+  CHECK(future.valid()) << "The result has already been retrieved";
+  return future.get();
+}
+
+DecompilationHandle DecompileAsync(std::unique_ptr<llvm::Module> module,
+                                   DecompilationOptions options,
+                                   FunctionCallback on_function) {
+  std::unique_ptr<Progress> owned_progress;
+  if (!options.progress) {
+    owned_progress = std::make_unique<Progress>();
+    options.progress = owned_progress.get();
+  }
+  auto progress{options.progress};
 
-    cbr_passes.push_back(std::make_unique<rellic::Z3CondSimplify>(dec_ctx));
-    cbr_passes.push_back(std::make_unique<rellic::NestedCondProp>(dec_ctx));
+  if (on_function) {
+    options.on_decls = [on_function = std::move(on_function),
+                        on_decls = std::move(options.on_decls)](
+                           llvm::ArrayRef<clang::Decl*> decls,
+                           const ProvenanceLookup& provenance) {
+      if (on_decls) {
+        on_decls(decls, provenance);
+      }
+      for (auto decl : decls) {
+        auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+        if (fdecl && fdecl->doesThisDeclarationHaveABody()) {
+          on_function(fdecl, provenance);
+        }
+      }
+    };
+  }
 
-    cbr_passes.push_back(std::make_unique<rellic::NestedScopeCombine>(dec_ctx));
+  auto future{std::async(
+      std::launch::async,
+      [module = std::move(module), options = std::move(options)]() mutable {
+        return Decompile(std::move(module), std::move(options));
+      })};
+  return DecompilationHandle(std::move(owned_progress), progress,
+                             std::move(future));
+}
 
-    cbr_passes.push_back(std::make_unique<rellic::CondBasedRefine>(dec_ctx));
-    cbr_passes.push_back(std::make_unique<rellic::ReachBasedRefine>(dec_ctx));
+std::vector<WorkUnit> SplitModule(llvm::Module &module,
+                                  DecompilationOptions options) {
+  llvm::TimeTraceScope trace("SplitModule");
+  SelectFunctions(module, options);
+  // Preprocessing is done again by whoever decompiles the units, and has
+  // nothing left to change by then
+  rellic::PreprocessTimes preprocessing;
+  RemoveUnreferencedGlobals(module, options, preprocessing);
+  PrepareModule(module, options, preprocessing);
 
-    while (pass_cbr.Run()) {
-      ;
+  FunctionCache cache(options.cache_dir, options.cache_max_size,
+                      GetOptionsKey(options));
+  std::vector<WorkUnit> units;
+  std::vector<llvm::Type *> types;
+  std::vector<llvm::GlobalValue *> globals;
+  for (auto &func : module.functions()) {
+    if (func.isDeclaration()) {
+      continue;
+    }
+    types.clear();
+    globals.clear();
+    GetReferencedIR(func, types, globals);
+    llvm::SmallPtrSet<const llvm::GlobalValue *, 16> referenced(
+        globals.begin(), globals.end());
+    // Other functions only need their prototypes, and unreferenced globals
+    // are left as declarations, which keeps large data out of every unit
+    llvm::ValueToValueMapTy vmap;
+    auto unit_module{llvm::CloneModule(
+        module, vmap, [&func, &referenced](const llvm::GlobalValue *gv) {
+          return gv == &func || (llvm::isa<llvm::GlobalVariable>(gv) &&
+                                 referenced.count(gv));
+        })};
+    if (options.remove_dead_globals) {
+      // Nothing in the unit refers to its function, which must survive being
+      // decompiled with the same options
+      llvm::appendToCompilerUsed(*unit_module,
+                                 {unit_module->getFunction(func.getName())});
     }
 
-    rellic::CompositeASTPass pass_loop{dec_ctx};
-    auto& loop_passes{pass_loop.GetPasses()};
+    WorkUnit unit;
+    unit.function = func.getName().str();
+    unit.cache_key = cache.GetKey(func);
+    llvm::raw_string_ostream os(unit.bitcode);
+    llvm::WriteBitcodeToFile(*unit_module, os);
+    os.flush();
+    units.push_back(std::move(unit));
+  }
+  RELLIC_LOG(Stats) << "Split module into " << units.size() << " work units";
+  return units;
+}
 
-    loop_passes.push_back(std::make_unique<rellic::LoopRefine>(dec_ctx));
-    loop_passes.push_back(std::make_unique<rellic::NestedCondProp>(dec_ctx));
-    loop_passes.push_back(
-        std::make_unique<rellic::NestedScopeCombine>(dec_ctx));
+ModuleDiff DiffModules(llvm::Module &previous, llvm::Module &module) {
+  llvm::TimeTraceScope trace("DiffModules");
+  // Keys of the functions with a body in `mod`, in module order
+  auto GetKeys{[](llvm::Module &mod) {
+    FunctionCache hasher("", 0, "");
+    std::vector<std::pair<llvm::Function *, std::string>> keys;
+    for (auto &func : mod.functions()) {
+      Materialize(func);
+      if (!func.isDeclaration()) {
+        keys.push_back({&func, hasher.GetKey(func, /*anonymous=*/true)});
+      }
+    }
+    return keys;
+  }};
 
-    while (pass_loop.Run()) {
-      ;
+  // Functions of `previous` that nothing was matched with yet
+  std::unordered_map<std::string, std::string> by_name;
+  std::unordered_multimap<std::string, std::string> by_key;
+  for (auto &[func, key] : GetKeys(previous)) {
+    by_name[func->getName().str()] = key;
+    by_key.emplace(key, func->getName().str());
+  }
+  auto Match{[&](const std::string &name, const std::string &key) {
+    by_name.erase(name);
+    auto range{by_key.equal_range(key)};
+    for (auto it{range.first}; it != range.second; ++it) {
+      if (it->second == name) {
+        by_key.erase(it);
+        break;
+      }
     }
+  }};
 
-    rellic::CompositeASTPass pass_scope{dec_ctx};
-    auto& scope_passes{pass_scope.GetPasses()};
-    scope_passes.push_back(std::make_unique<rellic::Z3CondSimplify>(dec_ctx));
-    scope_passes.push_back(std::make_unique<rellic::NestedCondProp>(dec_ctx));
+  ModuleDiff diff;
+  // Functions that kept their name and IR are matched first, so that they
+  // are not taken for renamed copies of each other
+  std::vector<std::pair<std::string, std::string>> others;
+  for (auto &[func, key] : GetKeys(module)) {
+    auto name{func->getName().str()};
+    auto it{by_name.find(name)};
+    if (it != by_name.end() && it->second == key) {
+      Match(name, key);
+      diff.unchanged.push_back(name);
+    } else {
+      others.push_back({name, key});
+    }
+  }
+  std::vector<std::string> unmatched;
+  for (auto &[name, key] : others) {
+    auto it{by_key.find(key)};
+    if (it != by_key.end()) {
+      diff.renamed.push_back({it->second, name});
+      Match(it->second, key);
+    } else {
+      unmatched.push_back(name);
+    }
+  }
+  for (auto &name : unmatched) {
+    auto it{by_name.find(name)};
+    if (it != by_name.end()) {
+      diff.changed.push_back(name);
+      Match(name, it->second);
+    } else {
+      diff.added.push_back(name);
+    }
+  }
+  for (auto &[name, key] : by_name) {
+    diff.removed.push_back(name);
+  }
+  std::sort(diff.removed.begin(), diff.removed.end());
+  return diff;
+}
+
+// Bumped whenever preprocessing changes what it produces
+static constexpr unsigned kPreprocessCacheVersion{1};
+
+// Hash of `buffer` and of the options that preprocessing depends on
+static std::string GetPreprocessKey(llvm::MemoryBufferRef buffer,
+                                    const DecompilationOptions &options) {
+  std::string text;
+  llvm::raw_string_ostream os(text);
+  os << kPreprocessCacheVersion << '\n'
+     << Version::GetVersionString() << '\n'
+     << "lower_switches=" << options.lower_switches
+     << ";remove_phi_nodes=" << options.remove_phi_nodes
+     << ";remove_dead_globals=" << options.remove_dead_globals
+     << ";call_depth="
+     << (options.call_depth ? std::to_string(*options.call_depth) : "none")
+     << ";functions=";
+  for (auto &name : options.functions) {
+    os << name << ',';
+  }
+  os << '\n';
+  os.flush();
 
-    scope_passes.push_back(
-        std::make_unique<rellic::NestedScopeCombine>(dec_ctx));
+  llvm::SHA1 hasher;
+  hasher.update(text);
+  hasher.update(buffer.getBuffer());
+  return llvm::toHex(hasher.final(), /*LowerCase=*/true);
+}
+
+// Writes `module` to `path` in `dir`. Failing to do so is not an error, the
+// module is just preprocessed again next time.
+static void StorePreprocessed(llvm::Module &module, const std::string &dir,
+                              const std::string &path) {
+  if (auto ec = llvm::sys::fs::create_directories(dir)) {
+    LOG(WARNING) << "Cannot create cache directory " << dir << ": "
+                 << ec.message();
+    return;
+  }
+  llvm::SmallString<128> tmp_path;
+  int fd;
+  if (auto ec = llvm::sys::fs::createUniqueFile(path + "-%%%%%%%%", fd,
+                                                tmp_path)) {
+    LOG(WARNING) << "Cannot write preprocessed module " << path << ": "
+                 << ec.message();
+    return;
+  }
+  {
+    llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+    llvm::WriteBitcodeToFile(module, os);
+  }
+  if (auto ec = llvm::sys::fs::rename(tmp_path, path)) {
+    LOG(WARNING) << "Cannot write preprocessed module " << path << ": "
+                 << ec.message();
+    llvm::sys::fs::remove(tmp_path);
+  }
+}
 
-    while (pass_scope.Run()) {
-      ;
+std::unique_ptr<llvm::Module> LoadPreprocessedModule(
+    llvm::LLVMContext &ctx, llvm::MemoryBufferRef buffer,
+    const DecompilationOptions &options) {
+  llvm::TimeTraceScope trace("LoadPreprocessedModule");
+  std::string path;
+  if (!options.preprocess_cache_dir.empty()) {
+    llvm::SmallString<128> entry{options.preprocess_cache_dir};
+    llvm::sys::path::append(entry, GetPreprocessKey(buffer, options) + ".bc");
+    path = entry.str().str();
+    if (auto cached = llvm::MemoryBuffer::getFile(path)) {
+      auto module{llvm::parseBitcodeFile(cached.get()->getMemBufferRef(), ctx)};
+      if (module) {
+        RELLIC_LOG(Stats) << "Loaded preprocessed module " << path;
+        return std::move(*module);
+      }
+      LOG(WARNING) << "Ignoring malformed preprocessed module " << path << ": "
+                   << llvm::toString(module.takeError());
     }
+  }
 
-    rellic::CompositeASTPass pass_ec{dec_ctx};
-    auto& ec_passes{pass_ec.GetPasses()};
-    ec_passes.push_back(std::make_unique<rellic::MaterializeConds>(dec_ctx));
-    ec_passes.push_back(std::make_unique<rellic::ExprCombine>(dec_ctx));
+  // Bodies are all read by `SelectFunctions`, so `buffer` is not needed
+  // once it returns
+  std::unique_ptr<llvm::Module> module{
+      LoadModuleFromBuffer(&ctx, buffer, /*allow_failure=*/true,
+                           /*lazy=*/!options.functions.empty())};
+  if (!module) {
+    return nullptr;
+  }
+  // Only the options that preprocessing depends on
+  DecompilationOptions prep_options;
+  prep_options.lower_switches = options.lower_switches;
+  prep_options.remove_phi_nodes = options.remove_phi_nodes;
+  prep_options.remove_dead_globals = options.remove_dead_globals;
+  prep_options.functions = options.functions;
+  prep_options.call_depth = options.call_depth;
+  prep_options.num_workers = options.num_workers;
+  SelectFunctions(*module, prep_options);
+  rellic::PreprocessTimes preprocessing;
+  RemoveUnreferencedGlobals(*module, prep_options, preprocessing);
+  PrepareModule(*module, prep_options, preprocessing);
+  if (!path.empty()) {
+    StorePreprocessed(*module, options.preprocess_cache_dir, path);
+  }
+  return module;
+}
+
+Result<DecompilationResult, DecompilationError> Redecompile(
+    DecompilationResult previous, const std::vector<llvm::Function*>& funcs,
+    DecompilationOptions options) {
+  auto module{std::move(previous.module)};
+  auto ast_unit{std::move(previous.ast)};
+  try {
+    // The preprocessing steps leave functions that have already been through
+    // them unchanged. Dead globals are not removed, since the declarations of
+    // `previous` may still refer to them.
+    rellic::PreprocessTimes preprocessing;
+    PrepareModule(*module, options, preprocessing);
+
+    // Local names are collected for the functions that are named, and types
+    // once fields are
+    rellic::DebugInfoCollector dic(rellic::DebugInfoCollector::kNames |
+                                   rellic::DebugInfoCollector::kTypes);
+    dic.CollectLazily(*module);
 
-    pass_ec.Run();
+    rellic::DecompilationContext dec_ctx(*ast_unit);
+    dec_ctx.stats.preprocessing = std::move(preprocessing);
+    AddTypeProviders(dec_ctx, options);
+    SetConditionEngine(dec_ctx, options);
+    if (options.debug_names_at_creation) {
+      dec_ctx.debug_names = &dic;
+    }
+    CHECK_THROW(options.provenance)
+        << "Results without provenance cannot be decompiled again";
+    RestoreMap(previous.stmt_provenance, dec_ctx.stmt_provenance);
+    RestoreMap(previous.value_decls, dec_ctx.value_decls);
+    RestoreMap(previous.type_decls, dec_ctx.type_decls);
+    RestoreMap(previous.use_provenance, dec_ctx.use_provenance);
+    // Keep the names of new anonymous structs distinct from the existing ones
+    for (auto [type, decl] : dec_ctx.type_decls) {
+      if (auto strct = llvm::dyn_cast<llvm::StructType>(type)) {
+        if (strct->isLiteral()) {
+          ++dec_ctx.num_literal_structs;
+        } else if (!strct->hasName()) {
+          ++dec_ctx.num_declared_structs;
+        }
+      }
+    }
+
+    rellic::GenerateAST::regenerate(*module, funcs, dec_ctx);
+    dec_ctx.RecordMemory("structuring", module.get());
+    SetRefinementLimits(dec_ctx, options);
+    rellic::FunctionSet scope;
+    for (auto func : funcs) {
+      auto decl{dec_ctx.value_decls.find(func)};
+      if (decl != dec_ctx.value_decls.end() && decl->second) {
+        scope.insert(clang::cast<clang::FunctionDecl>(decl->second));
+      }
+    }
+    // Field names have already been assigned from debug info
+    RunPasses(dec_ctx, dic, options, /*rename_fields=*/false, &scope);
+    dec_ctx.RecordMemory("refinement", module.get());
+
+    LogZ3Statistics(dec_ctx);
 
     DecompilationResult result{};
     result.ast = std::move(ast_unit);
     result.module = std::move(module);
-    CopyMap(dec_ctx.stmt_provenance, result.stmt_provenance_map,
-            result.value_to_stmt_map);
-    CopyMap(dec_ctx.value_decls, result.value_to_decl_map,
-            result.decl_provenance_map);
-    CopyMap(dec_ctx.type_decls, result.type_to_decl_map,
-            result.type_provenance_map);
-    CopyMap(dec_ctx.use_provenance, result.expr_use_map, result.use_expr_map);
+    std::unordered_set<std::string> names;
+    for (auto func : funcs) {
+      names.insert(func->getName().str());
+    }
+    for (auto &name : previous.degraded_functions) {
+      if (!names.count(name)) {
+        result.degraded_functions.push_back(name);
+      }
+    }
+    TakeResultMaps(dec_ctx, options, result);
+    result.stats = std::move(previous.stats);
+    for (auto &name : names) {
+      result.stats.functions.erase(name);
+    }
+    result.stats.Merge(dec_ctx.stats);
+    result.stats.peak_rss = GetPeakRSS();
+    result.stats.ast_memory =
+        result.ast->getASTContext().getASTAllocatedMemory();
 
     return Result<DecompilationResult, DecompilationError>(std::move(result));
   } catch (Exception& ex) {
     DecompilationError error{};
     error.message = ex.what();
     error.module = std::move(module);
+    error.ast = std::move(ast_unit);
     return Result<DecompilationResult, DecompilationError>(std::move(error));
   }
 }
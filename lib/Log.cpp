@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/Log.h"
+
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringSwitch.h>
+
+namespace rellic {
+namespace detail {
+std::atomic<unsigned> enabled_log_categories{
+    1U << static_cast<unsigned>(LogCategory::Passes)};
+}  // namespace detail
+
+bool SetLogCategories(llvm::StringRef names) {
+  llvm::SmallVector<llvm::StringRef, 8> parts;
+  names.split(parts, ',', -1, false);
+  unsigned mask{0};
+  for (auto name : parts) {
+    name = name.trim();
+    if (name == "all") {
+      mask = ~0U;
+      continue;
+    }
+    auto category{llvm::StringSwitch<int>(name)
+                      .Case("passes", int(LogCategory::Passes))
+                      .Case("structuring", int(LogCategory::Structuring))
+                      .Case("irgen", int(LogCategory::IRGen))
+                      .Case("types", int(LogCategory::Types))
+                      .Case("debuginfo", int(LogCategory::DebugInfo))
+                      .Case("stats", int(LogCategory::Stats))
+                      .Default(-1)};
+    if (category < 0) {
+      return false;
+    }
+    mask |= 1U << category;
+  }
+  detail::enabled_log_categories = mask;
+  return true;
+}
+
+}  // namespace rellic
@@ -0,0 +1,503 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/Printer.h"
+
+#include <clang/AST/Expr.h>
+#include <clang/AST/Stmt.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/IR/Argument.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/GlobalValue.h>
+#include <llvm/IR/Instruction.h>
+#include <llvm/IR/Use.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/ThreadPool.h>
+#include <llvm/Support/TimeProfiler.h>
+
+#include <algorithm>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include "rellic/Dec2Hex.h"
+
+namespace rellic {
+
+// Declarations are printed in chunks, so that the buffers of a whole
+// translation unit never exist at once
+static constexpr size_t kChunkSize{4096};
+
+namespace {
+// Decimal digits of every number below 100, so that integers are converted
+// two digits at a time
+struct DigitPairs {
+  char digits[200];
+
+  constexpr DigitPairs() : digits() {
+    for (auto i{0}; i < 100; ++i) {
+      digits[2 * i] = static_cast<char>('0' + i / 10);
+      digits[2 * i + 1] = static_cast<char>('0' + i % 10);
+    }
+  }
+};
+
+constexpr DigitPairs kDigitPairs;
+
+// A declaration printed with its terminator, and the ranges of its statements
+// relative to the start of `text`
+struct Rendered {
+  std::string text;
+  std::vector<PrintedRange> ranges;
+};
+
+// Records where statements that have provenance are printed. Expressions are
+// printed again from here to find where they end, but other statements are
+// preceded by their indentation and followed by their children, so only where
+// they start is known until the whole declaration is printed.
+class RangeRecorder : public clang::PrinterHelper {
+  const ProvenanceLookup& provenance;
+  clang::PrinterHelper* inner;
+  clang::ASTContext& ast_ctx;
+  clang::PrintingPolicy policy;
+  // Expression being printed again, which must not be intercepted
+  clang::Stmt* printing{nullptr};
+  std::vector<PrintedRange> ranges;
+  std::vector<size_t> first_lines;
+
+ public:
+  RangeRecorder(const ProvenanceLookup& provenance,
+                clang::PrinterHelper* inner, clang::ASTContext& ast_ctx)
+      : provenance(provenance),
+        inner(inner),
+        ast_ctx(ast_ctx),
+        policy(ast_ctx.getPrintingPolicy()) {
+    policy.SuppressSpecifiers = false;
+  }
+
+  bool handledStmt(clang::Stmt* stmt, llvm::raw_ostream& os) override {
+    if (stmt != printing) {
+      auto expr{clang::dyn_cast<clang::Expr>(stmt)};
+      auto value{provenance.GetValue(stmt)};
+      auto use{expr ? provenance.GetUse(expr) : nullptr};
+      if (value || use) {
+        uint64_t begin{os.tell()};
+        if (!expr) {
+          first_lines.push_back(ranges.size());
+          ranges.push_back({begin, begin, value, use});
+        } else {
+          auto outer{printing};
+          printing = stmt;
+          stmt->printPretty(os, this, policy, 0, "\n", &ast_ctx);
+          printing = outer;
+          ranges.push_back({begin, os.tell(), value, use});
+          return true;
+        }
+      }
+    }
+    return inner && inner->handledStmt(stmt, os);
+  }
+
+  // Returns the ranges recorded while printing `text`
+  std::vector<PrintedRange> TakeRanges(llvm::StringRef text) {
+    for (auto idx : first_lines) {
+      auto& range{ranges[idx]};
+      range.begin = std::min(text.find_first_not_of(' ', range.begin),
+                             text.size());
+      range.end = std::min(text.find('\n', range.begin), text.size());
+    }
+    first_lines.clear();
+    return std::move(ranges);
+  }
+};
+}  // namespace
+
+static bool HasBody(clang::Decl* decl) {
+  auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+  return fdecl && fdecl->doesThisDeclarationHaveABody();
+}
+
+void PrintDecl(clang::Decl* decl, llvm::raw_ostream& os,
+               clang::PrinterHelper* helper) {
+  if (!helper) {
+    decl->print(os);
+    return;
+  }
+
+  auto& ast_ctx{decl->getASTContext()};
+  auto policy{ast_ctx.getPrintingPolicy()};
+  // Same as what `DeclPrinter` uses for bodies and initializers
+  auto sub_policy{policy};
+  sub_policy.SuppressSpecifiers = false;
+
+  // Functions without a prototype have their parameters declared after it
+  auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+  if (fdecl && fdecl->doesThisDeclarationHaveABody() && fdecl->getBody() &&
+      (fdecl->hasPrototype() || !fdecl->getNumParams())) {
+    policy.TerseOutput = true;
+    decl->print(os, policy);
+    os << ' ';
+    fdecl->getBody()->printPretty(os, helper, sub_policy, 0, "\n", &ast_ctx);
+    return;
+  }
+
+  // Attributes are printed after the initializer
+  auto var{clang::dyn_cast<clang::VarDecl>(decl)};
+  if (var && var->getInit() && var->getInitStyle() == clang::VarDecl::CInit &&
+      !var->hasAttrs()) {
+    policy.SuppressInitializers = true;
+    decl->print(os, policy);
+    os << " = ";
+    sub_policy.IncludeTagDefinition = false;
+    var->getInit()->printPretty(os, helper, sub_policy, 0, "\n", &ast_ctx);
+    return;
+  }
+
+  decl->print(os);
+}
+
+const clang::InitListExpr* GetIntegerList(const clang::Expr* expr) {
+  auto list{clang::dyn_cast<clang::InitListExpr>(expr)};
+  if (!list || list->getSyntacticForm() ||
+      list->getNumInits() < kIntegerListThreshold) {
+    return nullptr;
+  }
+  auto type{list->getInit(0)->getType()};
+  if (!type->getAs<clang::BuiltinType>()) {
+    return nullptr;
+  }
+  for (auto i{0U}; i < list->getNumInits(); ++i) {
+    auto lit{clang::dyn_cast_or_null<clang::IntegerLiteral>(list->getInit(i))};
+    if (!lit || lit->getType() != type) {
+      return nullptr;
+    }
+  }
+  return list;
+}
+
+void AppendInteger(llvm::SmallVectorImpl<char>& buffer,
+                   const llvm::APInt& value, bool is_signed, bool hex) {
+  if (value.getBitWidth() > 64) {
+    value.toString(buffer, hex ? 16 : 10, is_signed, hex);
+    return;
+  }
+  auto magnitude{value.getZExtValue()};
+  if (is_signed && value.isNegative()) {
+    buffer.push_back('-');
+    magnitude = 0 - static_cast<uint64_t>(value.getSExtValue());
+  }
+  if (hex) {
+    buffer.push_back('0');
+    buffer.push_back('x');
+  }
+
+  // Digits are written backwards from the end
+  char digits[20];
+  auto end{std::end(digits)};
+  auto begin{end};
+  if (hex) {
+    do {
+      *--begin = "0123456789ABCDEF"[magnitude & 0xF];
+      magnitude >>= 4;
+    } while (magnitude);
+  } else {
+    for (; magnitude >= 100; magnitude /= 100) {
+      auto pair{&kDigitPairs.digits[2 * (magnitude % 100)]};
+      *--begin = pair[1];
+      *--begin = pair[0];
+    }
+    if (magnitude >= 10) {
+      *--begin = kDigitPairs.digits[2 * magnitude + 1];
+      *--begin = kDigitPairs.digits[2 * magnitude];
+    } else {
+      *--begin = static_cast<char>('0' + magnitude);
+    }
+  }
+  buffer.append(begin, end);
+}
+
+void PrintIntegerList(const clang::InitListExpr* list, llvm::raw_ostream& os,
+                      const std::function<bool(const llvm::APInt&)>& hex) {
+  auto type{list->getInit(0)->getType()};
+  auto is_signed{type->isSignedIntegerType()};
+  auto suffix{GetIntegerLiteralSuffix(type)};
+  llvm::SmallString<256> buffer;
+  // Room for a few digits per element
+  buffer.reserve(list->getNumInits() * (8 + suffix.size()));
+  buffer.push_back('{');
+  for (auto i{0U}; i < list->getNumInits(); ++i) {
+    if (i) {
+      buffer += ", ";
+    }
+    auto lit{clang::cast<clang::IntegerLiteral>(list->getInit(i))};
+    auto value{lit->getValue()};
+    AppendInteger(buffer, value, is_signed, hex && hex(value));
+    buffer += suffix;
+  }
+  buffer.push_back('}');
+  os << buffer;
+}
+
+// Prints a variable initialized with a list of integer literals the same as
+// `PrintDecl`, but with `PrintIntegerList`. Returns false if `decl` is not
+// such a variable, or if parts of the list have provenance to record.
+static bool PrintIntegerArray(clang::Decl* decl, llvm::raw_ostream& os,
+                              const PrintOptions& options) {
+  auto var{clang::dyn_cast<clang::VarDecl>(decl)};
+  if (!var || !var->getInit() ||
+      var->getInitStyle() != clang::VarDecl::CInit || var->hasAttrs()) {
+    return false;
+  }
+  auto list{GetIntegerList(var->getInit())};
+  if (!list) {
+    return false;
+  }
+  if (auto provenance = options.provenance) {
+    auto has_provenance{[provenance](const clang::Expr* expr) {
+      return provenance->GetValue(expr) || provenance->GetUse(expr);
+    }};
+    if (has_provenance(list) ||
+        std::any_of(list->begin(), list->end(), [&](const clang::Stmt* init) {
+          return has_provenance(clang::cast<clang::Expr>(init));
+        })) {
+      return false;
+    }
+  }
+
+  auto policy{decl->getASTContext().getPrintingPolicy()};
+  policy.SuppressInitializers = true;
+  decl->print(os, policy);
+  os << " = ";
+  PrintIntegerList(list, os, options.hex_literals);
+  return true;
+}
+
+// Same terminators as `DeclPrinter::VisitDeclContext`
+static void Render(clang::Decl* decl, Rendered& out,
+                   const PrintOptions& options) {
+  llvm::raw_string_ostream os(out.text);
+  if (options.print) {
+    options.print(decl, os);
+  } else if (!PrintIntegerArray(decl, os, options)) {
+    std::optional<HexLiteralPrinter> hex;
+    if (options.hex_literals) {
+      hex.emplace(options.hex_literals);
+    }
+    clang::PrinterHelper* helper{hex ? &*hex : nullptr};
+    if (options.provenance) {
+      RangeRecorder recorder(*options.provenance, helper,
+                             decl->getASTContext());
+      PrintDecl(decl, os, &recorder);
+      out.ranges = recorder.TakeRanges(out.text);
+    } else {
+      PrintDecl(decl, os, helper);
+    }
+  }
+  auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+  if (!fdecl || !fdecl->isThisDeclarationADefinition()) {
+    os << ';';
+  }
+  // Function bodies already end with a newline
+  if (!HasBody(decl)) {
+    os << '\n';
+  }
+}
+
+void PrintDecls(llvm::ArrayRef<clang::Decl*> decls, llvm::raw_ostream& os,
+                const PrintOptions& options) {
+  llvm::TimeTraceScope trace("PrintDecls");
+  std::vector<clang::Decl*> printed;
+  for (auto decl : decls) {
+    if (!decl->isImplicit()) {
+      printed.push_back(decl);
+    }
+  }
+
+  std::optional<llvm::ThreadPool> pool;
+  if (options.num_workers != 1) {
+    pool.emplace(llvm::hardware_concurrency(options.num_workers));
+  }
+  std::vector<Rendered> buffers;
+  for (size_t begin{0}; begin < printed.size(); begin += kChunkSize) {
+    auto end{std::min(begin + kChunkSize, printed.size())};
+    buffers.assign(end - begin, {});
+    for (auto i{begin}; i < end; ++i) {
+      auto decl{printed[i]};
+      auto& buffer{buffers[i - begin]};
+      if (pool && HasBody(decl)) {
+        pool->async([decl, &buffer, &options] {
+          Render(decl, buffer, options);
+        });
+      } else {
+        // Other declarations are short, and printed while waiting
+        Render(decl, buffer, options);
+      }
+    }
+    if (pool) {
+      pool->wait();
+    }
+    for (auto i{begin}; i < end; ++i) {
+      auto& buffer{buffers[i - begin]};
+      uint64_t offset{os.tell()};
+      os << buffer.text;
+      if (options.on_printed) {
+        for (auto& range : buffer.ranges) {
+          range.begin += offset;
+          range.end += offset;
+        }
+        options.on_printed(printed[i], offset, os.tell(), buffer.ranges);
+      }
+    }
+  }
+}
+
+void PrintDeclarations(llvm::ArrayRef<clang::Decl*> decls,
+                       llvm::raw_ostream& os) {
+  for (auto decl : decls) {
+    if (decl->isImplicit()) {
+      continue;
+    }
+    auto policy{decl->getASTContext().getPrintingPolicy()};
+    auto var{clang::dyn_cast<clang::VarDecl>(decl)};
+    if (HasBody(decl)) {
+      policy.TerseOutput = true;
+    } else if (var && var->isFileVarDecl() && var->hasInit()) {
+      if (var->getStorageClass() == clang::SC_None) {
+        os << "extern ";
+      }
+      policy.SuppressInitializers = true;
+    }
+    decl->print(os, policy);
+    os << ";\n";
+  }
+}
+
+void PrintTranslationUnit(clang::ASTContext& ast_ctx, llvm::raw_ostream& os,
+                          const PrintOptions& options) {
+  auto tudecl{ast_ctx.getTranslationUnitDecl()};
+  std::vector<clang::Decl*> decls(tudecl->decls_begin(), tudecl->decls_end());
+  PrintDecls(decls, os, options);
+}
+
+void ProvenanceExporter::Number(const llvm::Function* func) {
+  if (!numbered.insert(func).second) {
+    return;
+  }
+  for (auto& arg : func->args()) {
+    indices[&arg] = arg.getArgNo();
+  }
+  unsigned num_blocks{0};
+  unsigned num_insts{0};
+  for (auto& block : *func) {
+    indices[&block] = num_blocks++;
+    for (auto& inst : block) {
+      indices[&inst] = num_insts++;
+    }
+  }
+}
+
+std::string ProvenanceExporter::GetId(const llvm::Value* value) {
+  if (auto gvalue = llvm::dyn_cast<llvm::GlobalValue>(value)) {
+    return gvalue->hasName() ? "@" + gvalue->getName().str() : "";
+  }
+
+  const llvm::Function* func{nullptr};
+  std::string kind;
+  if (auto arg = llvm::dyn_cast<llvm::Argument>(value)) {
+    func = arg->getParent();
+    kind = "arg";
+  } else if (auto block = llvm::dyn_cast<llvm::BasicBlock>(value)) {
+    func = block->getParent();
+    kind = "bb";
+  } else if (auto inst = llvm::dyn_cast<llvm::Instruction>(value)) {
+    func = inst->getFunction();
+  }
+  if (!func) {
+    return "";
+  }
+  Number(func);
+  return "@" + func->getName().str() + ":" + kind +
+         std::to_string(indices.lookup(value));
+}
+
+void ProvenanceExporter::Write(clang::Decl* decl, uint64_t begin, uint64_t end,
+                               llvm::ArrayRef<PrintedRange> ranges) {
+  llvm::json::Array array;
+  for (auto& range : ranges) {
+    // Expressions that stand for a use come from the value that is used
+    auto value{range.value ? range.value
+                           : range.use ? range.use->get() : nullptr};
+    auto value_id{value ? GetId(value) : ""};
+    std::string use_id;
+    if (range.use) {
+      auto user_id{GetId(range.use->getUser())};
+      if (!user_id.empty()) {
+        use_id = user_id + "/" + std::to_string(range.use->getOperandNo());
+      }
+    }
+    if (value_id.empty() && use_id.empty()) {
+      continue;
+    }
+    array.push_back(llvm::json::Array{
+        range.begin, range.end,
+        value_id.empty() ? llvm::json::Value(nullptr) : value_id,
+        use_id.empty() ? llvm::json::Value(nullptr) : use_id});
+  }
+
+  llvm::json::Object obj;
+  auto named{clang::dyn_cast<clang::NamedDecl>(decl)};
+  if (named && named->getDeclName()) {
+    obj["decl"] = named->getNameAsString();
+  } else {
+    obj["decl"] = nullptr;
+  }
+  obj["begin"] = begin;
+  obj["end"] = end;
+  obj["ranges"] = std::move(array);
+  os << llvm::json::Value(std::move(obj)) << '\n';
+}
+
+void DeclIndexExporter::Write(clang::Decl* decl, uint64_t begin, uint64_t end,
+                              const ProvenanceLookup* provenance) {
+  auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+  auto var{clang::dyn_cast<clang::VarDecl>(decl)};
+  if (!fdecl && !var) {
+    return;
+  }
+
+  // The IR is recorded for one of the declarations of a function, which has
+  // a prototype and a definition
+  const llvm::Value* value{nullptr};
+  if (provenance) {
+    for (auto redecl : decl->redecls()) {
+      value = provenance->GetDeclValue(clang::cast<clang::ValueDecl>(redecl));
+      if (value) {
+        break;
+      }
+    }
+  }
+  auto gvalue{llvm::dyn_cast_or_null<llvm::GlobalValue>(value)};
+
+  llvm::json::Object obj;
+  obj["name"] = clang::cast<clang::NamedDecl>(decl)->getNameAsString();
+  obj["kind"] = fdecl ? "function" : "variable";
+  obj["definition"] = fdecl ? fdecl->isThisDeclarationADefinition()
+                            : var->isThisDeclarationADefinition() !=
+                                  clang::VarDecl::DeclarationOnly;
+  if (gvalue && gvalue->hasName()) {
+    obj["ir"] = "@" + gvalue->getName().str();
+  } else {
+    obj["ir"] = nullptr;
+  }
+  obj["begin"] = begin;
+  obj["end"] = end;
+  os << llvm::json::Value(std::move(obj)) << '\n';
+}
+
+}  // namespace rellic
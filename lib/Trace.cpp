@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/Trace.h"
+
+#include <glog/logging.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <atomic>
+#include <system_error>
+
+namespace rellic {
+
+static std::atomic_bool tracing{false};
+static unsigned trace_granularity{0};
+static std::string trace_process_name;
+
+void StartTracing(unsigned granularity_us, llvm::StringRef process_name) {
+  trace_granularity = granularity_us;
+  trace_process_name = process_name.str();
+  llvm::timeTraceProfilerInitialize(granularity_us, process_name);
+  tracing = true;
+}
+
+void StopTracing(const std::string &path) {
+  if (!tracing) {
+    return;
+  }
+  tracing = false;
+
+  std::error_code ec;
+  llvm::raw_fd_ostream os(path, ec);
+  if (ec) {
+    LOG(ERROR) << "Failed to create trace file: " << ec.message();
+  } else {
+    llvm::timeTraceProfilerWrite(os);
+  }
+  llvm::timeTraceProfilerCleanup();
+}
+
+bool IsTracing() { return tracing; }
+
+TraceThread::TraceThread()
+    : enabled(tracing && !llvm::timeTraceProfilerEnabled()) {
+  if (enabled) {
+    llvm::timeTraceProfilerInitialize(trace_granularity, trace_process_name);
+  }
+}
+
+TraceThread::~TraceThread() {
+  if (enabled) {
+    llvm::timeTraceProfilerFinishThread();
+  }
+}
+
+}  // namespace rellic
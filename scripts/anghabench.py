@@ -0,0 +1,257 @@
+#!/usr/bin/env python3
+
+import argparse
+import concurrent.futures
+import json
+import os
+import random
+import signal
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+# Version of the layout of the results, bumped whenever a field changes
+# meaning or is removed, so that results can be compared across releases
+SCHEMA_VERSION = 1
+
+PERCENTILES = [50, 95, 99]
+
+
+def get_inputs(path):
+    inputs = []
+    for root, dirs, files in os.walk(path):
+        dirs.sort()
+        for name in sorted(files):
+            if name.endswith(".bc"):
+                inputs.append(os.path.join(root, name))
+    return inputs
+
+
+def get_version(rellic):
+    try:
+        p = subprocess.run(
+            [rellic, "--version"],
+            stdout=subprocess.PIPE,
+            stderr=subprocess.STDOUT,
+            universal_newlines=True,
+        )
+    except OSError as e:
+        sys.exit("Error: cannot run %s: %s" % (rellic, e))
+    lines = p.stdout.strip().splitlines()
+    return lines[0] if lines else ""
+
+
+def decompile(args, path, output):
+    """Decompiles `path` in a process of its own, killed after `args.timeout`
+    seconds, and returns how it went."""
+    cmd = [args.rellic, "--input", path, "--output", output] + args.rellic_args
+    with tempfile.TemporaryFile() as stderr:
+        start = time.monotonic()
+        p = subprocess.Popen(cmd, stdout=subprocess.DEVNULL, stderr=stderr)
+        timed_out = threading.Event()
+
+        def kill():
+            timed_out.set()
+            p.kill()
+
+        timer = threading.Timer(args.timeout, kill) if args.timeout else None
+        if timer:
+            timer.start()
+        # Waits by hand for the peak memory of this process alone
+        _, status, usage = os.wait4(p.pid, 0)
+        elapsed = time.monotonic() - start
+        if timer:
+            timer.cancel()
+        if os.WIFSIGNALED(status):
+            p.returncode = -os.WTERMSIG(status)
+        else:
+            p.returncode = os.WEXITSTATUS(status)
+
+        result = {
+            "time": elapsed,
+            # Kilobytes on Linux
+            "peak_rss": usage.ru_maxrss * 1024,
+            "returncode": p.returncode,
+        }
+        if timed_out.is_set() and p.returncode == -signal.SIGKILL:
+            result["status"] = "timeout"
+        elif p.returncode < 0:
+            result["status"] = "crash"
+            result["signal"] = signal.Signals(-p.returncode).name
+        elif p.returncode > 0:
+            result["status"] = "error"
+        else:
+            result["status"] = "ok"
+        if result["status"] in ("crash", "error"):
+            stderr.seek(0)
+            lines = stderr.read().decode(errors="replace").strip().splitlines()
+            result["message"] = lines[-1] if lines else ""
+        return result
+
+
+def percentile(samples, p):
+    """Linearly interpolated percentile `p` of `samples`, which are sorted"""
+    if not samples:
+        return None
+    rank = (len(samples) - 1) * p / 100
+    lo = int(rank)
+    hi = min(lo + 1, len(samples) - 1)
+    return samples[lo] + (samples[hi] - samples[lo]) * (rank - lo)
+
+
+def distribution(samples):
+    samples = sorted(samples)
+    result = {"p%d" % p: percentile(samples, p) for p in PERCENTILES}
+    result["mean"] = sum(samples) / len(samples) if samples else None
+    result["max"] = samples[-1] if samples else None
+    return result
+
+
+def summarize(files, wall_time):
+    ok = [r for r in files.values() if r["status"] == "ok"]
+    summary = {
+        "files": len(files),
+        "wall_time": wall_time,
+        "files_per_second": len(files) / wall_time if wall_time else None,
+        # Latencies and memory only count decompilations that succeeded
+        "latency": distribution([r["time"] for r in ok]),
+        "peak_rss": distribution([r["peak_rss"] for r in ok]),
+    }
+    for status in ["ok", "error", "crash", "timeout"]:
+        summary[status] = sum(1 for r in files.values() if r["status"] == status)
+    return summary
+
+
+def print_summary(summary):
+    print(
+        "%d files in %.1f s (%.2f files/s): %d ok, %d errors, %d crashes, "
+        "%d timeouts"
+        % (
+            summary["files"],
+            summary["wall_time"],
+            summary["files_per_second"] or 0,
+            summary["ok"],
+            summary["error"],
+            summary["crash"],
+            summary["timeout"],
+        )
+    )
+    latency = summary["latency"]
+    if latency["max"] is not None:
+        print(
+            "latency: "
+            + ", ".join(
+                "p%d %.3f s" % (p, latency["p%d" % p]) for p in PERCENTILES
+            )
+            + ", max %.3f s" % latency["max"]
+        )
+        print(
+            "peak memory: "
+            + ", ".join(
+                "p%d %.1f MiB" % (p, summary["peak_rss"]["p%d" % p] / (1 << 20))
+                for p in PERCENTILES
+            )
+        )
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Decompiles AnghaBench bitcode in parallel and reports "
+        "throughput, latency and memory percentiles"
+    )
+    parser.add_argument("rellic", help="path to rellic-decomp")
+    parser.add_argument("inputs", help="directory of .bc files, searched recursively")
+    parser.add_argument(
+        "-j", "--jobs", type=int, default=os.cpu_count(), help="concurrent files"
+    )
+    parser.add_argument(
+        "-t", "--timeout", type=int, default=60, help="timeout per file in seconds"
+    )
+    parser.add_argument("--limit", type=int, help="decompile a sample of this size")
+    parser.add_argument(
+        "--seed", type=int, default=0, help="seed used to pick the sample"
+    )
+    parser.add_argument(
+        "--rellic-arg",
+        dest="rellic_args",
+        action="append",
+        default=[],
+        help="additional argument for rellic-decomp",
+    )
+    parser.add_argument("--output", help="write the results as JSON to this file")
+    parser.add_argument(
+        "--keep-output", help="keep the decompiled files in this directory"
+    )
+    args = parser.parse_args()
+
+    inputs = get_inputs(args.inputs)
+    if args.limit is not None and args.limit < len(inputs):
+        # Sampled from the sorted list, so the same seed picks the same files
+        inputs = sorted(random.Random(args.seed).sample(inputs, args.limit))
+    if not inputs:
+        sys.exit("Error: no .bc files in %s" % args.inputs)
+
+    with tempfile.TemporaryDirectory() as tempdir:
+        outdir = args.keep_output or tempdir
+        files = {}
+        start = time.monotonic()
+        with concurrent.futures.ThreadPoolExecutor(args.jobs) as executor:
+            futures = {}
+            for path in inputs:
+                name = os.path.relpath(path, args.inputs)
+                output = os.path.join(outdir, os.path.splitext(name)[0] + ".c")
+                os.makedirs(os.path.dirname(output), exist_ok=True)
+                futures[executor.submit(decompile, args, path, output)] = name
+            for done, future in enumerate(
+                concurrent.futures.as_completed(futures), 1
+            ):
+                name = futures[future]
+                result = future.result()
+                files[name] = result
+                if result["status"] != "ok":
+                    print(
+                        "[%d/%d] %s: %s %s"
+                        % (
+                            done,
+                            len(inputs),
+                            name,
+                            result["status"],
+                            result.get("message", ""),
+                        ),
+                        file=sys.stderr,
+                    )
+        wall_time = time.monotonic() - start
+
+    summary = summarize(files, wall_time)
+    print_summary(summary)
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump(
+                {
+                    "schema_version": SCHEMA_VERSION,
+                    "rellic_version": get_version(args.rellic),
+                    "options": {
+                        "jobs": args.jobs,
+                        "timeout": args.timeout,
+                        "limit": args.limit,
+                        "seed": args.seed,
+                        "rellic_args": args.rellic_args,
+                    },
+                    "summary": summary,
+                    "files": files,
+                },
+                f,
+                indent=2,
+                sort_keys=True,
+            )
+
+    # Only crashes fail the run, since errors and timeouts are expected on
+    # parts of AnghaBench
+    if summary["crash"]:
+        sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,168 @@
+#!/usr/bin/env python3
+
+import argparse
+import json
+import os
+import subprocess
+import sys
+import tempfile
+
+
+class RunError(Exception):
+    def __init__(self, msg):
+        self.msg = msg
+
+    def __str__(self):
+        return str(self.msg)
+
+
+def run_cmd(cmd, timeout):
+    try:
+        p = subprocess.run(
+            cmd,
+            stdout=subprocess.PIPE,
+            stderr=subprocess.PIPE,
+            timeout=timeout,
+            universal_newlines=True,
+        )
+    except FileNotFoundError as e:
+        raise RunError('Error: No such file or directory: "' + e.filename + '"')
+    except PermissionError as e:
+        raise RunError('Error: File "' + e.filename + '" is not an executable.')
+    except subprocess.TimeoutExpired:
+        raise RunError("Error: timed out: " + " ".join(cmd))
+
+    if p.returncode != 0:
+        raise RunError("Error: %s failed: %s" % (cmd[0], p.stderr))
+    return p
+
+
+def get_inputs(tests):
+    inputs = []
+    for item in sorted(os.scandir(tests), key=lambda item: item.name):
+        if item.is_file() and os.path.splitext(item.name)[1] in [".c", ".ll"]:
+            inputs.append(item.path)
+    return inputs
+
+
+def benchmark(args):
+    results = {}
+    with tempfile.TemporaryDirectory() as tempdir:
+        for path in get_inputs(args.tests):
+            name = os.path.splitext(os.path.basename(path))[0]
+            for level in args.opt_levels.split(","):
+                key = "%s@O%s" % (name, level)
+                bc = os.path.join(tempdir, key + ".bc")
+                try:
+                    run_cmd(
+                        [args.clang, "-c", "-emit-llvm", "-O" + level]
+                        + args.cflags
+                        + [path, "-o", bc],
+                        args.timeout,
+                    )
+                    # Each input is decompiled in a process of its own, so that
+                    # the peak memory is its own
+                    cmd = [
+                        args.rellic_bench,
+                        "--input",
+                        bc,
+                        "--repetitions",
+                        str(args.repetitions),
+                    ]
+                    if args.record_corpus:
+                        cmd += [
+                            "--record_corpus",
+                            os.path.join(args.record_corpus, key + ".smt2"),
+                        ]
+                    p = run_cmd(cmd, args.timeout)
+                except RunError as e:
+                    print("%s: %s" % (key, e), file=sys.stderr)
+                    continue
+                result = json.loads(p.stdout)
+                del result["input"]
+                results[key] = result
+                print(
+                    "%-32s %8.3f s %10d Z3 queries %8.1f MiB"
+                    % (
+                        key,
+                        result["decompile_time"]["median"],
+                        result["z3_calls"],
+                        result["peak_rss"] / (1024 * 1024),
+                    )
+                )
+    return results
+
+
+# Metrics compared against the baseline, and how to get them from a result
+METRICS = {
+    "decompile_time": lambda result: result["decompile_time"]["median"],
+    "z3_calls": lambda result: result["z3_calls"],
+    "peak_rss": lambda result: result["peak_rss"],
+}
+
+
+def compare(results, baseline, threshold):
+    """Prints the inputs whose metrics grew by more than `threshold` from
+    `baseline`, and returns how many did."""
+    regressions = 0
+    for key in sorted(results.keys() & baseline.keys()):
+        for metric, get in METRICS.items():
+            old = get(baseline[key])
+            new = get(results[key])
+            if old > 0 and new > old * (1 + threshold):
+                print(
+                    "regression: %s %s went from %s to %s (%+.1f%%)"
+                    % (key, metric, old, new, (new / old - 1) * 100)
+                )
+                regressions += 1
+    for key in sorted(baseline.keys() - results.keys()):
+        print("missing: %s is in the baseline but was not benchmarked" % key)
+    return regressions
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("rellic_bench", help="path to rellic-bench")
+    parser.add_argument("tests", help="path to test directory")
+    parser.add_argument("clang", help="path to clang")
+    parser.add_argument(
+        "--opt-levels",
+        default="0,1,2,3",
+        help="comma separated optimization levels to compile inputs at",
+    )
+    parser.add_argument(
+        "--repetitions", type=int, default=3, help="decompilations per input"
+    )
+    parser.add_argument("-t", "--timeout", help="set timeout in seconds", type=int)
+    parser.add_argument(
+        "--cflags", help="additional CFLAGS", action="append", default=[], type=str
+    )
+    parser.add_argument("--output", help="write the results as JSON to this file")
+    parser.add_argument(
+        "--baseline", help="compare the results with those saved in this file"
+    )
+    parser.add_argument(
+        "--threshold",
+        type=float,
+        default=0.1,
+        help="relative growth of a metric reported as a regression",
+    )
+
+    parser.add_argument(
+        "--record-corpus",
+        help="record the conditions of each input to this directory",
+    )
+
+    args = parser.parse_args()
+    if args.record_corpus:
+        os.makedirs(args.record_corpus, exist_ok=True)
+    results = benchmark(args)
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump({"results": results}, f, indent=2, sort_keys=True)
+
+    if args.baseline:
+        with open(args.baseline) as f:
+            baseline = json.load(f)["results"]
+        if compare(results, baseline, args.threshold):
+            sys.exit(1)
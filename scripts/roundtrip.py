@@ -49,8 +49,9 @@ def compile(self, clang, input, output, timeout, options=None):
     return p
 
 
-def decompile(self, rellic, input, output, timeout):
+def decompile(self, rellic, input, output, timeout, options=[]):
     cmd = [rellic]
+    cmd.extend(options)
     cmd.extend(
         ["--input", input, "--output", output]
     )
@@ -64,7 +65,41 @@ def decompile(self, rellic, input, output, timeout):
     return p
 
 
-def roundtrip(self, rellic, filename, clang, timeout, translate_only, general_flags, binary_compile_flags, bitcode_compile_flags, recompile_flags):
+def compare_workers(self, rellic, bitcode, expected, timeout, rellic_flags, workers):
+    """Decompiles `bitcode` again on each number of threads in `workers`, with
+    and without scratch contexts, and checks that the output is identical to
+    `expected` byte for byte"""
+    with open(expected, "rb") as f:
+        expected_output = f.read()
+
+    for num_workers in workers:
+        for scratch in [False, True]:
+            flags = rellic_flags + ["--num_workers=%d" % num_workers]
+            if scratch:
+                flags.append("--scratch_contexts")
+            output = expected + ".%d%s.c" % (num_workers, "s" if scratch else "")
+            decompile(self, rellic, bitcode, output, timeout, flags)
+            with open(output, "rb") as f:
+                self.assertEqual(
+                    expected_output, f.read(),
+                    "Different output with %s" % " ".join(flags[len(rellic_flags):]))
+
+
+def compare_flags(self, rellic, bitcode, expected, timeout, rellic_flags, extra_flags):
+    """Decompiles `bitcode` again with each flag of `extra_flags` added, and
+    checks that the output is identical to `expected` byte for byte"""
+    with open(expected, "rb") as f:
+        expected_output = f.read()
+
+    for i, flag in enumerate(extra_flags):
+        output = expected + ".f%d.c" % i
+        decompile(self, rellic, bitcode, output, timeout, rellic_flags + [flag])
+        with open(output, "rb") as f:
+            self.assertEqual(expected_output, f.read(),
+                             "Different output with %s" % flag)
+
+
+def roundtrip(self, rellic, filename, clang, timeout, translate_only, general_flags, binary_compile_flags, bitcode_compile_flags, recompile_flags, rellic_flags=[], workers=[], extra_flags=[]):
     with tempfile.TemporaryDirectory() as tempdir:
         out1 = os.path.join(tempdir, "out1")
         compile(self, clang, filename, out1, timeout, general_flags + binary_compile_flags)
@@ -77,7 +112,7 @@ def roundtrip(self, rellic, filename, clang, timeout, translate_only, general_fl
         compile(self, clang, filename, rt_bc, timeout, general_flags + bitcode_compile_flags + flags)
 
         rt_c = os.path.join(tempdir, "rt.c")
-        decompile(self, rellic, rt_bc, rt_c, timeout)
+        decompile(self, rellic, rt_bc, rt_c, timeout, rellic_flags)
 
         # ensure there is a C output file
         self.assertTrue(os.path.exists(rt_c))
@@ -85,6 +120,11 @@ def roundtrip(self, rellic, filename, clang, timeout, translate_only, general_fl
         # ensure the file has some C
         self.assertTrue(os.path.getsize(rt_c) > 0)
 
+        if workers:
+            compare_workers(self, rellic, rt_bc, rt_c, timeout, rellic_flags, workers)
+        if extra_flags:
+            compare_flags(self, rellic, rt_bc, rt_c, timeout, rellic_flags, extra_flags)
+
         # We should recompile, lets see how this goes
         if not translate_only:
             out2 = os.path.join(tempdir, "out2")
@@ -113,16 +153,22 @@ if __name__ == "__main__":
     parser.add_argument("-t", "--timeout", help="set timeout in seconds", type=int)
     parser.add_argument(
         "--cflags", help="additional CFLAGS", action='append', default=[], type=str)
+    parser.add_argument(
+        "--rellic-flags", help="additional flags for rellic-decomp", action='append', default=[], type=str)
+    parser.add_argument(
+        "--compare-workers", help="also decompile on this many threads, and check that the output is identical", action='append', default=[], type=int)
+    parser.add_argument(
+        "--compare-flags", help="also decompile with this flag for rellic-decomp, and check that the output is identical", action='append', default=[], type=str)
 
     args = parser.parse_args()
 
     def test_generator(path):
         def test(self):
-            roundtrip(self, args.rellic, path, args.clang, args.timeout, args.translate_only, args.cflags, [], []     , [])
-            roundtrip(self, args.rellic, path, args.clang, args.timeout, args.translate_only, args.cflags, [], ["-O1"], [])
-            roundtrip(self, args.rellic, path, args.clang, args.timeout, args.translate_only, args.cflags, [], ["-O2"], [])
-            roundtrip(self, args.rellic, path, args.clang, args.timeout, args.translate_only, args.cflags, [], ["-O3"], [])
-            roundtrip(self, args.rellic, path, args.clang, args.timeout, args.translate_only, args.cflags, [], ["-g3"], [])
+            roundtrip(self, args.rellic, path, args.clang, args.timeout, args.translate_only, args.cflags, [], []     , [], args.rellic_flags, args.compare_workers, args.compare_flags)
+            roundtrip(self, args.rellic, path, args.clang, args.timeout, args.translate_only, args.cflags, [], ["-O1"], [], args.rellic_flags, args.compare_workers, args.compare_flags)
+            roundtrip(self, args.rellic, path, args.clang, args.timeout, args.translate_only, args.cflags, [], ["-O2"], [], args.rellic_flags, args.compare_workers, args.compare_flags)
+            roundtrip(self, args.rellic, path, args.clang, args.timeout, args.translate_only, args.cflags, [], ["-O3"], [], args.rellic_flags, args.compare_workers, args.compare_flags)
+            roundtrip(self, args.rellic, path, args.clang, args.timeout, args.translate_only, args.cflags, [], ["-g3"], [], args.rellic_flags, args.compare_workers, args.compare_flags)
 
         return test
 
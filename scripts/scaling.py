@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+
+import argparse
+import json
+import math
+import sys
+
+from benchmark import RunError, run_cmd
+
+SHAPES = [
+    "if_ladder",
+    "nested_loops",
+    "nested_ifs",
+    "loop_exits",
+    "switch",
+    "irreducible",
+    "big_block",
+]
+
+# Decompilations faster than this are mostly noise, and are left out when
+# estimating how time grows
+MIN_TIME = 0.05
+
+
+def measure(args, shape):
+    """Decompiles `shape` at increasing sizes, each in a process of its own,
+    until a size fails or times out. Returns the points that were measured and
+    whether the curve was cut short."""
+    points = []
+    for size in args.sizes.split(","):
+        try:
+            p = run_cmd(
+                [
+                    args.rellic_bench,
+                    "--shape",
+                    shape,
+                    "--size",
+                    size,
+                    "--repetitions",
+                    str(args.repetitions),
+                ],
+                args.timeout,
+            )
+        except RunError as e:
+            print("%s@%s: %s" % (shape, size, e), file=sys.stderr)
+            return points, True
+        result = json.loads(p.stdout)
+        points.append(result)
+        print(
+            "%-16s %6s %8.3f s %10d Z3 queries %8.1f MiB"
+            % (
+                shape,
+                size,
+                result["decompile_time"]["median"],
+                result["z3_calls"],
+                result["peak_rss"] / (1024 * 1024),
+            )
+        )
+    return points, False
+
+
+def exponent(points):
+    """Slope of decompilation time against size on a log-log scale, between
+    the two largest sizes that took long enough to be measured."""
+    points = [p for p in points if p["decompile_time"]["median"] >= MIN_TIME]
+    if len(points) < 2:
+        return None
+    a, b = points[-2], points[-1]
+    if a["size"] == b["size"]:
+        return None
+    return math.log(
+        b["decompile_time"]["median"] / a["decompile_time"]["median"]
+    ) / math.log(b["size"] / a["size"])
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("rellic_bench", help="path to rellic-bench")
+    parser.add_argument(
+        "--shapes",
+        default=",".join(SHAPES),
+        help="comma separated shapes of control flow to synthesize",
+    )
+    parser.add_argument(
+        "--sizes",
+        default="1,2,4,8,16,32,64,128",
+        help="comma separated sizes to synthesize each shape at",
+    )
+    parser.add_argument(
+        "--repetitions", type=int, default=3, help="decompilations per size"
+    )
+    parser.add_argument("-t", "--timeout", help="set timeout in seconds", type=int)
+    parser.add_argument("--output", help="write the curves as JSON to this file")
+    parser.add_argument(
+        "--max-exponent",
+        type=float,
+        default=1.5,
+        help="growth exponent of decompilation time reported as a regression",
+    )
+
+    args = parser.parse_args()
+    curves = {}
+    regressions = 0
+    for shape in args.shapes.split(","):
+        points, cut = measure(args, shape)
+        curves[shape] = points
+        growth = exponent(points)
+        if growth is not None:
+            print("%s: time grows as size^%.2f" % (shape, growth))
+            if growth > args.max_exponent:
+                print("regression: %s grows faster than size^%s"
+                      % (shape, args.max_exponent))
+                regressions += 1
+        if cut:
+            print("regression: %s failed before its largest size" % shape)
+            regressions += 1
+
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump({"curves": curves}, f, indent=2, sort_keys=True)
+
+    if regressions:
+        sys.exit(1)
@@ -0,0 +1,94 @@
+#!/usr/bin/env python3
+
+import argparse
+import json
+import os
+import statistics
+import sys
+import tempfile
+import time
+
+from benchmark import RunError, run_cmd
+
+# Small enough that decompiling it costs next to nothing besides startup
+TINY_MODULE = """
+int add(int a, int b) { return a + b; }
+int main(int argc, char **argv) { return add(argc, 1); }
+"""
+
+
+def measure(cmd, args):
+    """Runs `cmd` `args.repetitions` times and returns the wall times"""
+    times = []
+    for _ in range(args.repetitions):
+        start = time.perf_counter()
+        run_cmd(cmd, args.timeout)
+        times.append(time.perf_counter() - start)
+    return times
+
+
+def benchmark(args):
+    results = {}
+    with tempfile.TemporaryDirectory() as tempdir:
+        src = os.path.join(tempdir, "tiny.c")
+        with open(src, "w") as f:
+            f.write(TINY_MODULE)
+        bc = os.path.join(tempdir, "tiny.bc")
+        run_cmd(
+            [args.clang, "-c", "-emit-llvm", "-O0"] + args.cflags + [src, "-o", bc],
+            args.timeout,
+        )
+        out = os.path.join(tempdir, "tiny.out.c")
+        cases = {
+            "version": [args.rellic, "--version"],
+            "tiny_module": [args.rellic, "--input", bc, "--output", out],
+            "one_function": [
+                args.rellic,
+                "--input",
+                bc,
+                "--output",
+                out,
+                "--functions",
+                "add",
+            ],
+        }
+        for name, cmd in cases.items():
+            try:
+                times = measure(cmd, args)
+            except RunError as e:
+                print("%s: %s" % (name, e), file=sys.stderr)
+                continue
+            results[name] = {
+                "median": statistics.median(times),
+                "min": min(times),
+                "max": max(times),
+            }
+            print(
+                "%-16s %8.3f s median %8.3f s min"
+                % (name, results[name]["median"], results[name]["min"])
+            )
+    return results
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(
+        description="Measures the startup latency of rellic-decomp"
+    )
+    parser.add_argument("rellic", help="path to rellic-decomp")
+    parser.add_argument("clang", help="path to clang")
+    parser.add_argument(
+        "--repetitions", type=int, default=10, help="runs per measurement"
+    )
+    parser.add_argument("-t", "--timeout", help="set timeout in seconds", type=int)
+    parser.add_argument(
+        "--cflags", help="additional CFLAGS", action="append", default=[], type=str
+    )
+    parser.add_argument("--output", help="write the results as JSON to this file")
+
+    args = parser.parse_args()
+    results = benchmark(args)
+    if args.output:
+        with open(args.output, "w") as f:
+            json.dump({"results": results}, f, indent=2, sort_keys=True)
+    if len(results) != 3:
+        sys.exit(1)
@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+
+import argparse
+import concurrent.futures
+import os
+import subprocess
+import sys
+import tempfile
+import unittest
+
+
+def run_cmd(cmd, timeout):
+    return subprocess.run(
+        cmd,
+        stdout=subprocess.PIPE,
+        stderr=subprocess.PIPE,
+        timeout=timeout,
+        universal_newlines=True,
+    )
+
+
+class TestBindings(unittest.TestCase):
+    def test_parallel(self):
+        # Decompiles every input on a thread pool in this process, and checks
+        # that the results are the same as those of rellic-decomp
+        with tempfile.TemporaryDirectory() as tempdir:
+            inputs = []
+            for item in sorted(os.scandir(args.tests), key=lambda i: i.name):
+                name, ext = os.path.splitext(item.name)
+                if not item.is_file() or ext != ".c":
+                    continue
+                bc = os.path.join(tempdir, name + ".bc")
+                p = run_cmd([args.clang, "-c", "-emit-llvm", "-O0", item.path,
+                             "-o", bc], args.timeout)
+                self.assertEqual(p.returncode, 0,
+                                 "clang failure: %s" % p.stderr)
+                out = os.path.join(tempdir, name + ".c")
+                p = run_cmd([args.rellic, "--input", bc, "--output", out],
+                            args.timeout)
+                if p.returncode != 0:
+                    # Inputs that rellic-decomp cannot handle are covered by
+                    # the other tests
+                    continue
+                with open(out) as f:
+                    inputs.append((bc, f.read()))
+
+            self.assertTrue(inputs, "nothing to decompile")
+            with concurrent.futures.ThreadPoolExecutor(4) as pool:
+                results = list(pool.map(
+                    lambda i: rellic.decompile_file(i[0], provenance=True),
+                    inputs))
+            for (bc, expected), result in zip(inputs, results):
+                self.assertEqual(result.code, expected,
+                                 "different output for " + bc)
+                self.assertIsInstance(result.provenance, list)
+                self.assertIn("passes", result.stats)
+
+    def test_errors(self):
+        with self.assertRaises(rellic.RellicError):
+            rellic.decompile(b"not bitcode")
+        with self.assertRaises(rellic.RellicError):
+            rellic.decompile(b"", no_such_option=1)
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser()
+    parser.add_argument("rellic", help="path to rellic-decomp")
+    parser.add_argument("library", help="path to librellic-c")
+    parser.add_argument("tests", help="path to test directory")
+    parser.add_argument("clang", help="path to clang")
+    parser.add_argument("-t", "--timeout", help="set timeout in seconds",
+                        type=int)
+
+    args = parser.parse_args()
+
+    os.environ["RELLIC_LIBRARY"] = args.library
+    sys.path.insert(0, os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                                    "..", "bindings", "python"))
+    import rellic
+
+    rellic.set_min_log_level(2)
+    unittest.main(argv=[sys.argv[0]])
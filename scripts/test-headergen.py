@@ -84,6 +84,38 @@ def roundtrip(self, rellic, filename, clang, timeout, cflags):
         compile(self, clang, rt_c, out2, timeout, cflags + ["-c", "-Wno-everything"])
 
 
+def batch(self, rellic, paths, clang, timeout, cflags):
+    with tempfile.TemporaryDirectory() as tempdir:
+        bcs = []
+        for path in paths:
+            name, _ = os.path.splitext(os.path.basename(path))
+            bc = os.path.join(tempdir, name + ".bc")
+            compile(self, clang, path, bc, timeout,
+                    cflags + ["-c", "-emit-llvm", "-g3"])
+            bcs.append(bc)
+
+        cmd = [rellic, "--batch", tempdir,
+               "--emit_prelude", os.path.join(tempdir, "prelude"),
+               "--cache_dir", os.path.join(tempdir, "cache")]
+        p = run_cmd(cmd, timeout)
+        self.assertEqual(p.returncode, 0, "rellic-headergen failure: %s" % p.stderr)
+        headers = {}
+        for bc in bcs:
+            h = os.path.splitext(bc)[0] + ".h"
+            with open(h) as f:
+                headers[h] = f.read()
+            compile(self, clang, h, h + ".o", timeout,
+                    cflags + ["-c", "-x", "c", "-Wno-everything"])
+
+        # The types did not change, so every header comes from the cache
+        p = run_cmd(cmd, timeout)
+        self.assertEqual(p.returncode, 0, "rellic-headergen failure: %s" % p.stderr)
+        self.assertIn("(%d cached)" % len(bcs), p.stdout)
+        for h, text in headers.items():
+            with open(h) as f:
+                self.assertEqual(f.read(), text, "cached header differs: " + h)
+
+
 class TestRoundtrip(unittest.TestCase):
     pass
 
@@ -105,6 +137,7 @@ if __name__ == "__main__":
 
         return test
 
+    paths = []
     for item in os.scandir(args.tests):
         if item.is_file():
             name, ext = os.path.splitext(item.name)
@@ -113,5 +146,13 @@ if __name__ == "__main__":
                 test_name = f"test_{name}"
                 test = test_generator(item.path)
                 setattr(TestRoundtrip, test_name, test)
+                if ext == ".c":
+                    paths.append(item.path)
+
+    def test_batch(self):
+        batch(self, args.rellic, sorted(paths), args.clang, args.timeout,
+              args.cflags)
+
+    setattr(TestRoundtrip, "test_batch", test_batch)
 
     unittest.main(argv=[sys.argv[0]])
@@ -0,0 +1,28 @@
+int printf(const char*, ...);
+
+int main() {
+  int code[] = {1, 2, 2, 3, 1, 4, 2, 0};
+  int acc = 0;
+  int pc = 0;
+  while (1) {
+    switch (code[pc++]) {
+      case 1:
+        acc += 10;
+        break;
+      case 2:
+        if (acc > 15) {
+          acc -= 3;
+        } else {
+          acc *= 2;
+        }
+        break;
+      case 3:
+      case 4:
+        printf("%d\n", acc);
+        break;
+      default:
+        printf("%d %d\n", pc, acc);
+        return 0;
+    }
+  }
+}
@@ -0,0 +1,17 @@
+int printf(const char*, ...);
+
+int main() {
+  int i = 0;
+  int sum = 0;
+  start:
+  i++;
+  switch(i) {
+    case 1: case 2: case 3: case 4: sum += i; goto start;
+    case 5: sum *= 2; goto start;
+    case 6: case 7: case 9: sum -= i; goto start;
+    case 8: case 10: case 11: sum += 3; goto start;
+    case 12: break;
+    default: sum = 0; break;
+  }
+  printf("%d %d\n", i, sum);
+}
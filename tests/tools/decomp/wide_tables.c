@@ -0,0 +1,19 @@
+unsigned short halves[8] = {0x0041, 0x00ff, 0x0007, 0xffff,
+                            0x0000, 0x1234, 0x0030, 0x0061};
+unsigned words[6] = {0x00000041, 0x0010ffff, 0x0000e000,
+                     0x0000000a, 0x00000000, 0x0001f600};
+unsigned surrogates[4] = {0x0000d800, 0x00000041, 0x0000dfff, 0x00000042};
+
+int main(void) {
+  unsigned sum = 0;
+  for (int i = 0; i < 8; ++i) {
+    sum = sum * 31 + halves[i];
+  }
+  for (int i = 0; i < 6; ++i) {
+    sum = sum * 31 + words[i];
+  }
+  for (int i = 0; i < 4; ++i) {
+    sum = sum * 31 + surrogates[i];
+  }
+  return sum % 251;
+}
@@ -0,0 +1,316 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <clang/AST/ASTContext.h>
+#include <clang/AST/Decl.h>
+#include <clang/AST/Expr.h>
+#include <clang/Frontend/ASTUnit.h>
+#include <clang/Tooling/Tooling.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/Regex.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <memory>
+#include <new>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "rellic/AST/ASTBuilder.h"
+
+DEFINE_string(filter, "",
+              "Regular expression that the names of the benchmarks to run "
+              "must match.");
+DEFINE_double(min_time, 0.5,
+              "Minimum time in seconds that each benchmark runs for.");
+DEFINE_uint32(nodes, 1000, "Number of nodes built by each run.");
+DEFINE_string(output, "", "File the results are also written to as JSON.");
+
+// Every allocation of the process goes through these, so that the ones made
+// while building nodes can be counted. Nodes themselves are allocated from
+// the arena of the `ASTContext`, which only allocates when a slab runs out.
+static uint64_t heap_allocations{0};
+
+void* operator new(std::size_t size) {
+  ++heap_allocations;
+  if (auto ptr = std::malloc(size ? size : 1)) {
+    return ptr;
+  }
+  throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t size) { return operator new(size); }
+
+void operator delete(void* ptr) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr) noexcept { std::free(ptr); }
+
+void operator delete(void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+void operator delete[](void* ptr, std::size_t) noexcept { std::free(ptr); }
+
+namespace {
+using Seconds = std::chrono::duration<double>;
+
+// Declarations of the `ASTBuilder::SetFastPath` tests in
+// unittests/AST/ASTBuilder.cpp, which cover the operands that the fast path
+// handles and the ones it leaves to `clang::Sema`
+const char* kDeclarations =
+    "struct s{int a; unsigned b : 3;}; struct s v; const struct s *p;"
+    "int i, j; unsigned u; char c; int *ip; void *vp;"
+    "int f(int x, unsigned y); void g(char x);";
+
+// A fresh translation unit of `kDeclarations`, and a builder with or without
+// the fast path. Nodes are built into it until it is replaced.
+struct Fixture {
+  std::unique_ptr<clang::ASTUnit> unit;
+  std::unique_ptr<rellic::ASTBuilder> ast;
+  clang::TranslationUnitDecl* tudecl{nullptr};
+  // What the nodes are built from, looked up before the builds are timed
+  std::vector<clang::Expr*> operands;
+  clang::ValueDecl* decl{nullptr};
+  clang::FieldDecl* field{nullptr};
+
+  void Reset(bool fast_path) {
+    ast.reset();
+    unit = clang::tooling::buildASTFromCode(kDeclarations, "out.c");
+    CHECK(unit) << "Failed to parse the declarations of the benchmarks";
+    ast = std::make_unique<rellic::ASTBuilder>(*unit);
+    ast->SetFastPath(fast_path);
+    tudecl = unit->getASTContext().getTranslationUnitDecl();
+    operands.clear();
+    decl = nullptr;
+    field = nullptr;
+  }
+
+  template <typename T = clang::ValueDecl>
+  T* Get(clang::DeclContext* decl_ctx, const std::string& name) {
+    auto& ctx{unit->getASTContext()};
+    auto lookup{decl_ctx->noload_lookup(&ctx.Idents.get(name))};
+    CHECK(!lookup.empty()) << "No declaration of " << name;
+    return clang::cast<T>(lookup.front());
+  }
+
+  clang::DeclRefExpr* Ref(const std::string& name) {
+    return ast->CreateDeclRef(Get(tudecl, name));
+  }
+
+  clang::FieldDecl* Field(const std::string& name) {
+    return Get<clang::FieldDecl>(Get<clang::RecordDecl>(tudecl, "s"), name);
+  }
+};
+
+// `build` creates one node of the kind being measured, from operands that
+// `prepare` creates before the runs are timed. Operands may be shared by
+// several nodes.
+struct Benchmark {
+  std::string name;
+  bool fast_path;
+  std::function<void(Fixture&)> prepare;
+  std::function<clang::Expr*(Fixture&)> build;
+};
+
+struct Measurement {
+  uint64_t nodes = 0;
+  Seconds time{0};
+  uint64_t heap_allocations = 0;
+  uint64_t arena_bytes = 0;
+};
+
+// Builds `FLAGS_nodes` nodes on a fresh fixture until the builds have taken
+// `FLAGS_min_time`, after a first run to warm up. Only the builds are timed,
+// and only the allocations they make are counted.
+Measurement Measure(const Benchmark& bench) {
+  Fixture fixture;
+  auto Run{[&](Measurement* m) {
+    fixture.Reset(bench.fast_path);
+    if (bench.prepare) {
+      bench.prepare(fixture);
+    }
+    auto& ctx{fixture.unit->getASTContext()};
+    auto arena_before{ctx.getASTAllocatedMemory()};
+    auto heap_before{heap_allocations};
+    auto start{std::chrono::steady_clock::now()};
+    for (unsigned i{0}; i < FLAGS_nodes; ++i) {
+      CHECK(bench.build(fixture)) << bench.name << " failed";
+    }
+    auto time{std::chrono::steady_clock::now() - start};
+    if (m) {
+      m->time += time;
+      m->heap_allocations += heap_allocations - heap_before;
+      m->arena_bytes += ctx.getASTAllocatedMemory() - arena_before;
+      m->nodes += FLAGS_nodes;
+    }
+  }};
+
+  Run(nullptr);
+  Measurement m;
+  while (m.time.count() < FLAGS_min_time) {
+    Run(&m);
+  }
+  return m;
+}
+
+// Every benchmark is run with and without the fast path
+std::vector<Benchmark> GetBenchmarks() {
+  struct Node {
+    const char* name;
+    std::function<void(Fixture&)> prepare;
+    std::function<clang::Expr*(Fixture&)> build;
+  };
+  // Refers to the variables or functions of `names`, and to `field` if any
+  auto Operands{[](std::vector<const char*> names, const char* field = "") {
+    return [names, field](Fixture& fixture) {
+      for (auto name : names) {
+        fixture.operands.push_back(fixture.Ref(name));
+      }
+      if (*field) {
+        fixture.field = fixture.Field(field);
+      }
+    };
+  }};
+  std::vector<Node> nodes{
+      {"CreateDeclRef",
+       [](Fixture& fixture) {
+         fixture.decl = fixture.Get(fixture.tudecl, "i");
+       },
+       [](Fixture& fixture) {
+         return fixture.ast->CreateDeclRef(fixture.decl);
+       }},
+      {"CreateBinaryOp", Operands({"i", "j"}),
+       [](Fixture& fixture) {
+         auto& ops{fixture.operands};
+         return fixture.ast->CreateAdd(ops[0], ops[1]);
+       }},
+      {"CreateBinaryOp/promoted", Operands({"c", "u"}),
+       [](Fixture& fixture) {
+         auto& ops{fixture.operands};
+         return fixture.ast->CreateAdd(ops[0], ops[1]);
+       }},
+      {"CreateCStyleCast", Operands({"ip"}),
+       [](Fixture& fixture) {
+         auto& ctx{fixture.unit->getASTContext()};
+         return fixture.ast->CreateCStyleCast(ctx.UnsignedLongTy,
+                                              fixture.operands[0]);
+       }},
+      {"CreateCall", Operands({"f", "i", "u"}),
+       [](Fixture& fixture) {
+         auto& ops{fixture.operands};
+         std::vector<clang::Expr*> args{ops[1], ops[2]};
+         return fixture.ast->CreateCall(ops[0], args);
+       }},
+      {"CreateFieldAcc", Operands({"v"}, "a"),
+       [](Fixture& fixture) {
+         return fixture.ast->CreateDot(fixture.operands[0], fixture.field);
+       }},
+      {"CreateFieldAcc/arrow", Operands({"p"}, "b"),
+       [](Fixture& fixture) {
+         return fixture.ast->CreateArrow(fixture.operands[0], fixture.field);
+       }},
+  };
+
+  std::vector<Benchmark> benches;
+  for (auto& node : nodes) {
+    benches.push_back({std::string(node.name) + "/fast", true, node.prepare,
+                       node.build});
+    benches.push_back({std::string(node.name) + "/sema", false, node.prepare,
+                       node.build});
+  }
+  return benches;
+}
+
+void PrintResults(const std::vector<Benchmark>& benches,
+                  const std::vector<Measurement>& results) {
+  llvm::outs() << llvm::format("%-32s %12s %14s %14s %10s\n", "Benchmark",
+                               "Time/node", "Allocs/node", "Arena B/node",
+                               "Nodes");
+  for (size_t i{0}; i < benches.size(); ++i) {
+    auto& m{results[i]};
+    double nodes = m.nodes;
+    llvm::outs() << llvm::format(
+        "%-32s %9.0f ns %14.2f %14.1f %10llu\n", benches[i].name.c_str(),
+        m.time.count() * 1e9 / nodes, m.heap_allocations / nodes,
+        m.arena_bytes / nodes, static_cast<unsigned long long>(m.nodes));
+  }
+}
+
+llvm::json::Array GetJSON(const std::vector<Benchmark>& benches,
+                          const std::vector<Measurement>& results) {
+  llvm::json::Array json;
+  for (size_t i{0}; i < benches.size(); ++i) {
+    auto& m{results[i]};
+    double nodes = m.nodes;
+    json.push_back(llvm::json::Object{
+        {"name", benches[i].name},
+        {"nodes", static_cast<int64_t>(m.nodes)},
+        {"time_per_node", m.time.count() / nodes},
+        {"heap_allocations_per_node", m.heap_allocations / nodes},
+        {"arena_bytes_per_node", m.arena_bytes / nodes},
+    });
+  }
+  return json;
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::stringstream usage;
+  usage << std::endl
+        << std::endl
+        << "  " << argv[0] << " \\" << std::endl
+        << "    [--filter REGEX] \\" << std::endl
+        << "    [--min_time SECONDS] \\" << std::endl
+        << "    [--nodes NUMBER] \\" << std::endl
+        << "    [--output OUTPUT_JSON_FILE]" << std::endl
+        << std::endl;
+
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  google::SetUsageMessage(usage.str());
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  LOG_IF(FATAL, !FLAGS_nodes) << "Each run must build at least one node.";
+  llvm::Regex filter(FLAGS_filter);
+  std::string error;
+  LOG_IF(FATAL, !filter.isValid(error)) << "Invalid filter: " << error;
+
+  std::vector<Benchmark> benches;
+  for (auto& bench : GetBenchmarks()) {
+    if (filter.match(bench.name)) {
+      benches.push_back(std::move(bench));
+    }
+  }
+
+  std::vector<Measurement> results;
+  for (auto& bench : benches) {
+    results.push_back(Measure(bench));
+  }
+  PrintResults(benches, results);
+
+  if (!FLAGS_output.empty()) {
+    std::error_code ec;
+    llvm::raw_fd_ostream output(FLAGS_output, ec);
+    CHECK(!ec) << "Failed to create output file: " << ec.message();
+    output << llvm::json::Value(llvm::json::Object{
+                  {"nodes_per_run", static_cast<int64_t>(FLAGS_nodes)},
+                  {"benchmarks", GetJSON(benches, results)},
+              })
+           << '\n';
+  }
+
+  google::ShutDownCommandLineFlags();
+  google::ShutdownGoogleLogging();
+  return EXIT_SUCCESS;
+}
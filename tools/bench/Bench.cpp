@@ -0,0 +1,295 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/raw_ostream.h>
+#include <z3++.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "Corpus.h"
+#include "Synthetic.h"
+#include "rellic/AST/ASTUnitFactory.h"
+#include "rellic/AST/DecompilationContext.h"
+#include "rellic/AST/IRToASTVisitor.h"
+#include "rellic/AST/Progress.h"
+#include "rellic/AST/Statistics.h"
+#include "rellic/BC/Util.h"
+#include "rellic/Decompiler.h"
+#include "rellic/Printer.h"
+
+DEFINE_string(input, "", "Input LLVM bitcode file.");
+DEFINE_string(output, "-",
+              "File the results are written to as JSON, or - for standard "
+              "output.");
+DEFINE_uint32(repetitions, 3, "Number of times the input is decompiled.");
+DEFINE_uint32(num_workers, 1,
+              "Number of threads used to decompile functions in parallel.");
+DEFINE_string(pipeline, "",
+              "Refinement passes to run (empty for the default pipeline).");
+DEFINE_string(shape, "",
+              "Shape of control flow to synthesize, instead of reading "
+              "--input.");
+DEFINE_uint32(size, 8, "Size of the control flow synthesized with --shape.");
+DEFINE_string(record_corpus, "",
+              "File the Boolean conditions created by the first decompilation "
+              "are written to, as a corpus for rellic-z3bench.");
+DEFINE_bool(ir_to_ast, false,
+            "Instead of decompiling, time the translation of the basic blocks "
+            "of the input to C statements, with and without clang::Sema.");
+
+namespace {
+using Seconds = std::chrono::duration<double>;
+
+struct Repetition {
+  Seconds decompile{0};
+  Seconds print{0};
+  rellic::DecompilationStatistics stats;
+  size_t z3_calls = 0;
+  Seconds z3_time{0};
+};
+
+// Minimum, median and mean of `samples`, which must not be empty
+llvm::json::Object Summarize(std::vector<double> samples) {
+  std::sort(samples.begin(), samples.end());
+  auto size{samples.size()};
+  auto median{size % 2 ? samples[size / 2]
+                       : (samples[size / 2 - 1] + samples[size / 2]) / 2};
+  return llvm::json::Object{
+      {"min", samples.front()},
+      {"median", median},
+      {"mean", std::accumulate(samples.begin(), samples.end(), 0.0) / size},
+  };
+}
+
+using Loader =
+    std::function<std::unique_ptr<llvm::Module>(llvm::LLVMContext& ctx)>;
+
+using Recorder = std::function<void(const z3::expr& formula)>;
+
+// Decompiles the module returned by `load` from scratch and prints the result
+// to nowhere. `record` is passed every new condition, if not empty.
+Repetition Run(const Loader& load, const Recorder& record) {
+  Repetition rep;
+  llvm::LLVMContext llvm_ctx;
+  std::unique_ptr<llvm::Module> module{load(llvm_ctx)};
+
+  rellic::Progress progress;
+  rellic::DecompilationOptions opts;
+  opts.num_workers = FLAGS_num_workers;
+  opts.pipeline = FLAGS_pipeline;
+  opts.progress = &progress;
+  opts.on_z3_expr = record;
+
+  auto start{std::chrono::steady_clock::now()};
+  auto result{rellic::Decompile(std::move(module), opts)};
+  rep.decompile = std::chrono::steady_clock::now() - start;
+  CHECK(result.Succeeded()) << result.TakeError().message;
+  auto value{result.TakeValue()};
+
+  start = std::chrono::steady_clock::now();
+  llvm::raw_null_ostream os;
+  rellic::PrintTranslationUnit(value.ast->getASTContext(), os);
+  rep.print = std::chrono::steady_clock::now() - start;
+
+  rep.stats = std::move(value.stats);
+  rep.z3_calls = progress.z3_calls;
+  rep.z3_time = std::chrono::nanoseconds(progress.z3_nanoseconds);
+  return rep;
+}
+
+// Translates every basic block of the module returned by `load` to C
+// statements and returns the time it took. Declarations are created
+// beforehand, so that only the translation of instructions is timed.
+Seconds RunIRToAST(const Loader& load, bool fast_path, uint64_t& instructions) {
+  llvm::LLVMContext llvm_ctx;
+  std::unique_ptr<llvm::Module> module{load(llvm_ctx)};
+  rellic::SplitModule(*module);
+
+  auto ast_unit{
+      rellic::ASTUnitFactory::Get().Create(module->getTargetTriple())};
+  rellic::DecompilationContext dec_ctx(*ast_unit);
+  dec_ctx.ast.SetFastPath(fast_path);
+  rellic::IRToASTVisitor gen(dec_ctx);
+  dec_ctx.type_provider->Prefetch(*module);
+  for (auto& func : module->functions()) {
+    gen.VisitFunctionDecl(func);
+  }
+  for (auto& var : module->globals()) {
+    gen.VisitGlobalVar(var);
+  }
+
+  instructions = 0;
+  std::vector<clang::Stmt*> stmts;
+  auto start{std::chrono::steady_clock::now()};
+  for (auto& func : module->functions()) {
+    for (auto& block : func) {
+      instructions += block.size();
+      stmts.clear();
+      gen.VisitBasicBlock(block, stmts);
+    }
+  }
+  return std::chrono::steady_clock::now() - start;
+}
+
+// Time spent in each stage of decompilation, averaged over `reps`
+llvm::json::Object GetStages(const std::vector<Repetition>& reps) {
+  std::map<std::string, double> stages;
+  for (auto& rep : reps) {
+    for (auto& [name, time] : rep.stats.preprocessing) {
+      stages["preprocess:" + name] += time.count();
+    }
+    for (auto& [name, func] : rep.stats.functions) {
+      stages["reaching_conds"] += func.reaching_conds_time.count();
+      stages["structuring"] += func.structuring_time.count();
+    }
+    for (auto& [name, pass] : rep.stats.passes) {
+      stages["pass:" + name] += pass.wall_time.count();
+    }
+    stages["print"] += rep.print.count();
+  }
+
+  llvm::json::Object json;
+  for (auto& [name, total] : stages) {
+    json[name] = total / reps.size();
+  }
+  return json;
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::stringstream usage;
+  usage << std::endl
+        << std::endl
+        << "  " << argv[0] << " \\" << std::endl
+        << "    (--input INPUT_BC_FILE | --shape SHAPE [--size NUM]) \\"
+        << std::endl
+        << "    [--repetitions NUM] \\" << std::endl
+        << "    [--ir_to_ast] \\" << std::endl
+        << "    [--output OUTPUT_JSON_FILE]" << std::endl
+        << std::endl;
+
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  google::SetUsageMessage(usage.str());
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  LOG_IF(FATAL, !FLAGS_repetitions) << "Must decompile at least once.";
+
+  Loader load;
+  llvm::json::Object json;
+  if (!FLAGS_shape.empty()) {
+    auto& shapes{GetSyntheticShapes()};
+    if (std::find(shapes.begin(), shapes.end(), FLAGS_shape) == shapes.end()) {
+      std::string names;
+      for (auto& shape : shapes) {
+        names += " " + shape;
+      }
+      LOG(FATAL) << "Unknown shape " << FLAGS_shape << ", expected one of:"
+                 << names;
+    }
+    load = [](llvm::LLVMContext& ctx) {
+      return GenerateSynthetic(ctx, FLAGS_shape, FLAGS_size);
+    };
+    json["shape"] = FLAGS_shape;
+    json["size"] = FLAGS_size;
+  } else {
+    LOG_IF(FATAL, FLAGS_input.empty())
+        << "Must specify the path to an input LLVM bitcode file.";
+    load = [](llvm::LLVMContext& ctx) {
+      return std::unique_ptr<llvm::Module>(rellic::LoadModuleFromFile(
+          &ctx, FLAGS_input, /*allow_failure=*/false));
+    };
+    json["input"] = FLAGS_input;
+  }
+
+  std::error_code ec;
+  llvm::raw_fd_ostream output(FLAGS_output, ec);
+  CHECK(!ec) << "Failed to create output file: " << ec.message();
+
+  if (FLAGS_ir_to_ast) {
+    // Both paths build the same nodes, so only their speed is compared
+    std::vector<double> sema_times, fast_times;
+    uint64_t instructions{0};
+    for (unsigned i{0}; i < FLAGS_repetitions; ++i) {
+      sema_times.push_back(
+          RunIRToAST(load, /*fast_path=*/false, instructions).count());
+      fast_times.push_back(
+          RunIRToAST(load, /*fast_path=*/true, instructions).count());
+    }
+    json["repetitions"] = FLAGS_repetitions;
+    json["ir_to_ast"] = llvm::json::Object{
+        {"instructions", static_cast<int64_t>(instructions)},
+        {"sema", Summarize(sema_times)},
+        {"fast", Summarize(fast_times)},
+    };
+    output << llvm::json::Value(std::move(json)) << '\n';
+
+    google::ShutDownCommandLineFlags();
+    google::ShutdownGoogleLogging();
+    return EXIT_SUCCESS;
+  }
+
+  std::unique_ptr<llvm::raw_fd_ostream> corpus;
+  std::mutex corpus_mutex;
+  Recorder record;
+  if (!FLAGS_record_corpus.empty()) {
+    corpus = std::make_unique<llvm::raw_fd_ostream>(FLAGS_record_corpus, ec);
+    CHECK(!ec) << "Failed to create corpus file: " << ec.message();
+    // Shards insert conditions from their own threads
+    record = [&](const z3::expr& formula) {
+      if (formula.is_bool()) {
+        auto benchmark{SerializeFormula(formula)};
+        std::unique_lock<std::mutex> lock(corpus_mutex);
+        *corpus << benchmark;
+      }
+    };
+  }
+
+  std::vector<Repetition> reps;
+  for (unsigned i{0}; i < FLAGS_repetitions; ++i) {
+    reps.push_back(Run(load, i ? Recorder{} : record));
+  }
+
+  std::vector<double> decompile_times, print_times;
+  for (auto& rep : reps) {
+    decompile_times.push_back(rep.decompile.count());
+    print_times.push_back(rep.print.count());
+  }
+  // Every repetition decompiles the same module the same way, so counts are
+  // only reported for the first one
+  json["repetitions"] = FLAGS_repetitions;
+  json["decompile_time"] = Summarize(decompile_times);
+  json["print_time"] = Summarize(print_times);
+  json["stages"] = GetStages(reps);
+  json["z3_calls"] = static_cast<int64_t>(reps.front().z3_calls);
+  json["z3_time"] = reps.front().z3_time.count();
+  json["peak_rss"] = static_cast<int64_t>(rellic::GetPeakRSS());
+  json["ast_memory"] = static_cast<int64_t>(reps.front().stats.ast_memory);
+
+  output << llvm::json::Value(std::move(json)) << '\n';
+
+  google::ShutDownCommandLineFlags();
+  google::ShutdownGoogleLogging();
+  return EXIT_SUCCESS;
+}
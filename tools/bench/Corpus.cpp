@@ -0,0 +1,34 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "Corpus.h"
+
+namespace {
+// Ends every benchmark written by `z3::solver::to_smt2`
+constexpr const char* kTerminator{"(check-sat)"};
+}  // namespace
+
+std::string SerializeFormula(const z3::expr& formula) {
+  z3::solver solver(formula.ctx());
+  solver.add(formula);
+  return solver.to_smt2();
+}
+
+void ParseCorpus(llvm::StringRef corpus, z3::expr_vector& formulas) {
+  auto& ctx{formulas.ctx()};
+  while (!corpus.trim().empty()) {
+    auto [benchmark, rest]{corpus.split(kTerminator)};
+    corpus = rest;
+    auto assertions{ctx.parse_string(benchmark.str().c_str())};
+    if (assertions.size() == 1) {
+      formulas.push_back(assertions[0]);
+    } else if (assertions.size() > 1) {
+      formulas.push_back(z3::mk_and(assertions));
+    }
+  }
+}
@@ -0,0 +1,24 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <z3++.h>
+
+#include <string>
+
+// Corpora of formulas are SMT-LIB 2 benchmarks that each assert one formula,
+// one after the other in a single file.
+
+// Returns the benchmark that asserts `formula`, which must be Boolean
+std::string SerializeFormula(const z3::expr& formula);
+
+// Appends the formulas of `corpus` to `formulas`, in order. Throws
+// `z3::exception` if the corpus is malformed.
+void ParseCorpus(llvm::StringRef corpus, z3::expr_vector& formulas);
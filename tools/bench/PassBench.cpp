@@ -0,0 +1,252 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <clang/AST/Decl.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "rellic/AST/DebugInfoCollector.h"
+#include "rellic/AST/PassRegistry.h"
+#include "rellic/AST/Snapshot.h"
+#include "rellic/AST/Statistics.h"
+#include "rellic/Exception.h"
+
+DEFINE_string(snapshot, "",
+              "Prefix of a snapshot saved by rellic-repl or rellic-xref.");
+DEFINE_string(before, "",
+              "Pass groups run on the snapshot before the ones being "
+              "measured. They are not timed.");
+DEFINE_string(passes, "",
+              "Pass groups to measure, in the syntax of --pipeline of "
+              "rellic-decomp, e.g. `fix(lr,ncp,nsc)`.");
+DEFINE_string(functions, "",
+              "Comma-separated names of the functions the passes are run on. "
+              "All of them by default.");
+DEFINE_string(save, "",
+              "Instead of measuring anything, save the snapshot as it is "
+              "after --before with this prefix, so that later runs can skip "
+              "--before.");
+DEFINE_uint32(z3_timeout, 0,
+              "Time limit in milliseconds for a single Z3 query, 0 for none.");
+DEFINE_double(min_time, 0.5,
+              "Minimum time in seconds that the passes run for.");
+DEFINE_string(output, "", "File the results are also written to as JSON.");
+
+namespace {
+using Seconds = std::chrono::duration<double>;
+
+// A snapshot that is loaded again before every run, so that each run starts
+// from the same AST
+struct Session {
+  llvm::LLVMContext llvm_ctx;
+  rellic::Snapshot snapshot;
+  std::unique_ptr<rellic::DebugInfoCollector> dic;
+  rellic::FunctionSet scope;
+
+  void Reset() {
+    // Released before what they refer to
+    dic.reset();
+    snapshot.dec_ctx.reset();
+    snapshot.ast_unit.reset();
+    snapshot.module.reset();
+    snapshot = rellic::LoadSnapshot(llvm_ctx, FLAGS_snapshot);
+    auto& dec_ctx{*snapshot.dec_ctx};
+    dec_ctx.z3_timeout = FLAGS_z3_timeout;
+    dic = std::make_unique<rellic::DebugInfoCollector>();
+    dic->visit(*snapshot.module);
+    scope.clear();
+    llvm::SmallVector<llvm::StringRef, 4> names;
+    llvm::StringRef(FLAGS_functions).split(names, ',', -1, false);
+    for (auto name : names) {
+      auto func{snapshot.module->getFunction(name)};
+      CHECK(func && !func->isDeclaration())
+          << "No definition of " << name.str() << " in the snapshot";
+      auto decl{dec_ctx.value_decls[func]};
+      CHECK(decl) << name.str() << " was not decompiled in the snapshot";
+      scope.insert(clang::cast<clang::FunctionDecl>(decl));
+    }
+    if (!FLAGS_before.empty()) {
+      Run(FLAGS_before);
+    }
+    // Only the passes being measured are counted
+    dec_ctx.stats = {};
+  }
+
+  void Run(const std::string& spec) {
+    auto pipeline{rellic::Pipeline::Parse(spec, *snapshot.dec_ctx, dic.get())};
+    if (!scope.empty()) {
+      pipeline->SetScope(&scope);
+    }
+    pipeline->Run();
+  }
+};
+
+struct Measurement {
+  unsigned runs = 0;
+  Seconds time{0};
+  rellic::DecompilationStatistics stats;
+};
+
+// Runs `FLAGS_passes` on a freshly loaded snapshot until the runs have taken
+// `FLAGS_min_time`, after a first run to warm up. Only the passes are timed.
+Measurement Measure(Session& session) {
+  auto Run{[&](Measurement* m) {
+    session.Reset();
+    auto start{std::chrono::steady_clock::now()};
+    session.Run(FLAGS_passes);
+    auto time{std::chrono::steady_clock::now() - start};
+    if (m) {
+      ++m->runs;
+      m->time += time;
+      m->stats.Merge(session.snapshot.dec_ctx->stats);
+    }
+  }};
+
+  Run(nullptr);
+  Measurement m;
+  while (m.time.count() < FLAGS_min_time) {
+    Run(&m);
+  }
+  return m;
+}
+
+rellic::Z3Statistics GetZ3(const rellic::DecompilationStatistics& stats) {
+  rellic::Z3Statistics res;
+  for (auto& [name, pass] : stats.passes) {
+    res.Merge(pass.z3);
+  }
+  return res;
+}
+
+void PrintResults(const Measurement& m) {
+  auto& stats{m.stats};
+  double runs = m.runs;
+  auto z3{GetZ3(stats)};
+  llvm::outs() << llvm::format(
+      "%s: %.3f ms/run over %u runs, %.1f Z3 queries/run (%.1f cached) "
+      "taking %.3f ms/run\n",
+      FLAGS_passes.c_str(), m.time.count() * 1e3 / runs, m.runs,
+      z3.queries / runs, z3.cache_hits / runs, z3.time.count() * 1e3 / runs);
+
+  for (auto& [desc, fix] : stats.fixpoint_groups) {
+    llvm::outs() << llvm::format(
+        "  %s: %.1f rounds/run, at most %u\n", desc.c_str(), fix.rounds / runs,
+        fix.max_rounds);
+  }
+
+  llvm::outs() << llvm::format("\n%-24s %12s %10s %10s %12s %12s\n", "Pass",
+                               "Time/run", "Runs/run", "Changes", "Queries",
+                               "Z3 time");
+  for (auto& [name, pass] : stats.passes) {
+    llvm::outs() << llvm::format(
+        "%-24s %9.3f ms %10.1f %10.1f %12.1f %9.3f ms\n", name.c_str(),
+        pass.wall_time.count() * 1e3 / runs, pass.runs / runs,
+        pass.changes / runs, pass.z3.queries / runs,
+        pass.z3.time.count() * 1e3 / runs);
+  }
+
+  std::vector<std::pair<std::string, rellic::Duration>> functions;
+  for (auto& [name, func] : stats.functions) {
+    rellic::Duration time{0};
+    for (auto& [pass, pass_time] : func.pass_time) {
+      time += pass_time;
+    }
+    functions.push_back({name, time});
+  }
+  std::sort(functions.begin(), functions.end(),
+            [](auto& a, auto& b) { return a.second > b.second; });
+  if (functions.size() > 10) {
+    functions.resize(10);
+  }
+  llvm::outs() << llvm::format("\n%-40s %12s %12s\n", "Function", "Time/run",
+                               "Queries");
+  for (auto& [name, time] : functions) {
+    llvm::outs() << llvm::format(
+        "%-40s %9.3f ms %12.1f\n", name.c_str(), time.count() * 1e3 / runs,
+        stats.functions.at(name).z3.queries / runs);
+  }
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::stringstream usage;
+  usage << std::endl
+        << std::endl
+        << "  " << argv[0] << " \\" << std::endl
+        << "    --snapshot SNAPSHOT_PREFIX \\" << std::endl
+        << "    [--before PASS_GROUPS] \\" << std::endl
+        << "    (--passes PASS_GROUPS | --save SNAPSHOT_PREFIX) \\"
+        << std::endl
+        << "    [--functions NAMES] \\" << std::endl
+        << "    [--z3_timeout MILLISECONDS] \\" << std::endl
+        << "    [--min_time SECONDS] \\" << std::endl
+        << "    [--output OUTPUT_JSON_FILE]" << std::endl
+        << std::endl;
+
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  google::SetUsageMessage(usage.str());
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  LOG_IF(FATAL, FLAGS_snapshot.empty())
+      << "Must specify the snapshot to load with --snapshot.";
+  LOG_IF(FATAL, FLAGS_passes.empty() == FLAGS_save.empty())
+      << "Must specify exactly one of --passes and --save.";
+
+  Session session;
+  try {
+    if (!FLAGS_save.empty()) {
+      session.Reset();
+      rellic::SaveSnapshot(*session.snapshot.module,
+                           *session.snapshot.dec_ctx, FLAGS_save);
+    } else {
+      auto m{Measure(session)};
+      PrintResults(m);
+
+      if (!FLAGS_output.empty()) {
+        std::error_code ec;
+        llvm::raw_fd_ostream output(FLAGS_output, ec);
+        CHECK(!ec) << "Failed to create output file: " << ec.message();
+        output << llvm::json::Value(llvm::json::Object{
+                      {"snapshot", FLAGS_snapshot},
+                      {"before", FLAGS_before},
+                      {"passes", FLAGS_passes},
+                      {"functions", FLAGS_functions},
+                      {"runs", m.runs},
+                      {"time_per_run", m.time.count() / m.runs},
+                      {"z3", GetZ3(m.stats).ToJSON()},
+                      {"stats", m.stats.ToJSON()},
+                  })
+               << '\n';
+      }
+    }
+  } catch (rellic::Exception& ex) {
+    LOG(FATAL) << ex.what();
+  }
+
+  google::ShutDownCommandLineFlags();
+  google::ShutdownGoogleLogging();
+  return EXIT_SUCCESS;
+}
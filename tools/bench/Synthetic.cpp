@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "Synthetic.h"
+
+#include <glog/logging.h>
+#include <llvm/IR/BasicBlock.h>
+#include <llvm/IR/Function.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/Verifier.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <functional>
+#include <map>
+
+namespace {
+// Builds the body of `int f(int x, int y)`, which returns what is stored to
+// `acc`, the first variable of the function
+class Builder {
+  llvm::Function* func;
+  llvm::IRBuilder<> builder;
+
+ public:
+  llvm::Value* x;
+  llvm::Value* y;
+  llvm::AllocaInst* acc;
+  // Where the shape ends up, which returns `acc`
+  llvm::BasicBlock* exit;
+
+  Builder(llvm::Function* func)
+      : func(func),
+        builder(llvm::BasicBlock::Create(func->getContext(), "entry", func)),
+        x(func->getArg(0)),
+        y(func->getArg(1)) {
+    x->setName("x");
+    y->setName("y");
+    acc = CreateVar("acc");
+    builder.CreateStore(Int(0), acc);
+    exit = Block("exit");
+    llvm::IRBuilder<> exit_builder(exit);
+    exit_builder.CreateRet(exit_builder.CreateLoad(Int32Ty(), acc));
+  }
+
+  llvm::IRBuilder<>& operator*() { return builder; }
+  llvm::IRBuilder<>* operator->() { return &builder; }
+
+  llvm::Type* Int32Ty() { return builder.getInt32Ty(); }
+  llvm::ConstantInt* Int(int64_t value) {
+    return llvm::ConstantInt::getSigned(builder.getInt32Ty(), value);
+  }
+
+  llvm::BasicBlock* Block(const llvm::Twine& name) {
+    return llvm::BasicBlock::Create(func->getContext(), name, func);
+  }
+
+  // Variables are all allocated in the entry block
+  llvm::AllocaInst* CreateVar(const llvm::Twine& name) {
+    llvm::IRBuilder<> entry(&func->getEntryBlock(),
+                            func->getEntryBlock().begin());
+    return entry.CreateAlloca(Int32Ty(), nullptr, name);
+  }
+
+  llvm::Value* Load(llvm::AllocaInst* var) {
+    return builder.CreateLoad(Int32Ty(), var);
+  }
+
+  void Add(llvm::AllocaInst* var, llvm::Value* value) {
+    builder.CreateStore(builder.CreateAdd(Load(var), value), var);
+  }
+};
+
+void IfLadder(Builder& b, unsigned size) {
+  for (unsigned i{0}; i < size; ++i) {
+    auto then{b.Block("then" + llvm::Twine(i))};
+    auto next{b.Block("test" + llvm::Twine(i + 1))};
+    b->CreateCondBr(b->CreateICmpEQ(b.x, b.Int(i)), then, next);
+    b->SetInsertPoint(then);
+    b->CreateStore(b.Int(i * 3 + 1), b.acc);
+    b->CreateBr(b.exit);
+    b->SetInsertPoint(next);
+  }
+  b->CreateStore(b.Int(-1), b.acc);
+  b->CreateBr(b.exit);
+}
+
+void NestedLoops(Builder& b, unsigned size) {
+  struct Loop {
+    llvm::AllocaInst* counter;
+    llvm::BasicBlock* header;
+    llvm::BasicBlock* latch;
+    llvm::BasicBlock* after;
+  };
+  std::vector<Loop> loops;
+  for (unsigned i{0}; i < size; ++i) {
+    auto suffix{llvm::Twine(i)};
+    Loop loop{b.CreateVar("i" + suffix), b.Block("header" + suffix),
+              b.Block("latch" + suffix), b.Block("after" + suffix)};
+    auto body{b.Block("body" + suffix)};
+    b->CreateStore(b.Int(0), loop.counter);
+    b->CreateBr(loop.header);
+    b->SetInsertPoint(loop.header);
+    b->CreateCondBr(b->CreateICmpSLT(b.Load(loop.counter), b.y), body,
+                    loop.after);
+    b->SetInsertPoint(body);
+    loops.push_back(loop);
+  }
+  if (!loops.empty()) {
+    b.Add(b.acc, b.Load(loops.back().counter));
+    b->CreateBr(loops.back().latch);
+  }
+  for (size_t i{loops.size()}; i-- > 0;) {
+    auto& loop{loops[i]};
+    b->SetInsertPoint(loop.latch);
+    b.Add(loop.counter, b.Int(1));
+    b->CreateBr(loop.header);
+    b->SetInsertPoint(loop.after);
+    b->CreateBr(i ? loops[i - 1].latch : b.exit);
+  }
+  if (loops.empty()) {
+    b->CreateBr(b.exit);
+  }
+}
+
+void NestedIfs(Builder& b, unsigned size) {
+  std::vector<llvm::BasicBlock*> joins;
+  for (unsigned i{0}; i < size; ++i) {
+    auto suffix{llvm::Twine(i)};
+    auto then{b.Block("then" + suffix)};
+    auto join{b.Block("join" + suffix)};
+    b->CreateCondBr(b->CreateICmpSGT(b.x, b.Int(i)), then, join);
+    b->SetInsertPoint(then);
+    joins.push_back(join);
+  }
+  b.Add(b.acc, b.y);
+  for (size_t i{joins.size()}; i-- > 0;) {
+    b->CreateBr(joins[i]);
+    b->SetInsertPoint(joins[i]);
+    b.Add(b.acc, b.Int(i + 1));
+  }
+  b->CreateBr(b.exit);
+}
+
+void LoopExits(Builder& b, unsigned size) {
+  auto header{b.Block("header")};
+  auto after{b.Block("after")};
+  b->CreateBr(header);
+  b->SetInsertPoint(header);
+  for (unsigned i{0}; i < size; ++i) {
+    auto next{b.Block("next" + llvm::Twine(i))};
+    b.Add(b.acc, b.Int(i + 1));
+    b->CreateCondBr(b->CreateICmpSGT(b.Load(b.acc), b.y), after, next);
+    b->SetInsertPoint(next);
+  }
+  b->CreateBr(header);
+  b->SetInsertPoint(after);
+  b->CreateBr(b.exit);
+}
+
+void Switch(Builder& b, unsigned size) {
+  auto def{b.Block("default")};
+  auto sw{b->CreateSwitch(b.x, def, size)};
+  for (unsigned i{0}; i < size; ++i) {
+    auto block{b.Block("case" + llvm::Twine(i))};
+    sw->addCase(b.Int(i), block);
+    b->SetInsertPoint(block);
+    b->CreateStore(b.Int(i * 7 + 1), b.acc);
+    b->CreateBr(b.exit);
+  }
+  b->SetInsertPoint(def);
+  b->CreateStore(b.Int(-1), b.acc);
+  b->CreateBr(b.exit);
+}
+
+void Irreducible(Builder& b, unsigned size) {
+  for (unsigned i{0}; i < size; ++i) {
+    auto suffix{llvm::Twine(i)};
+    auto first{b.Block("first" + suffix)};
+    auto second{b.Block("second" + suffix)};
+    auto next{b.Block("next" + suffix)};
+    // Both blocks of the loop can be entered from outside of it
+    b->CreateCondBr(b->CreateICmpSLT(b.x, b.Int(i)), first, second);
+    b->SetInsertPoint(first);
+    b.Add(b.acc, b.Int(1));
+    auto odd{b->CreateAnd(b.Load(b.acc), b.Int(1))};
+    b->CreateCondBr(b->CreateICmpEQ(odd, b.Int(0)), second, next);
+    b->SetInsertPoint(second);
+    b.Add(b.acc, b.Int(2));
+    b->CreateCondBr(b->CreateICmpSLT(b.Load(b.acc), b.y), first, next);
+    b->SetInsertPoint(next);
+  }
+  b->CreateBr(b.exit);
+}
+
+void BigBlock(Builder& b, unsigned size) {
+  llvm::Value* value{b.x};
+  for (unsigned i{0}; i < size; ++i) {
+    switch (i % 3) {
+      case 0:
+        value = b->CreateAdd(value, b.y);
+        break;
+      case 1:
+        value = b->CreateMul(value, b.Int(i | 1));
+        break;
+      default:
+        value = b->CreateXor(value, b.Int(i));
+        break;
+    }
+  }
+  b->CreateStore(value, b.acc);
+  b->CreateBr(b.exit);
+}
+
+using Generator = std::function<void(Builder&, unsigned)>;
+
+const std::map<std::string, Generator>& GetGenerators() {
+  static const std::map<std::string, Generator> generators{
+      {"if_ladder", IfLadder},      {"nested_loops", NestedLoops},
+      {"nested_ifs", NestedIfs},    {"loop_exits", LoopExits},
+      {"switch", Switch},           {"irreducible", Irreducible},
+      {"big_block", BigBlock},
+  };
+  return generators;
+}
+}  // namespace
+
+const std::vector<std::string>& GetSyntheticShapes() {
+  static const std::vector<std::string> shapes{[]() {
+    std::vector<std::string> shapes;
+    for (auto& [name, generator] : GetGenerators()) {
+      shapes.push_back(name);
+    }
+    return shapes;
+  }()};
+  return shapes;
+}
+
+std::unique_ptr<llvm::Module> GenerateSynthetic(llvm::LLVMContext& ctx,
+                                                const std::string& shape,
+                                                unsigned size) {
+  auto& generators{GetGenerators()};
+  auto it{generators.find(shape)};
+  if (it == generators.end()) {
+    return nullptr;
+  }
+
+  auto module{std::make_unique<llvm::Module>(shape, ctx)};
+  module->setTargetTriple(llvm::sys::getProcessTriple());
+  auto int32{llvm::Type::getInt32Ty(ctx)};
+  auto func{llvm::Function::Create(
+      llvm::FunctionType::get(int32, {int32, int32}, /*isVarArg=*/false),
+      llvm::GlobalValue::ExternalLinkage, "f", *module)};
+  Builder builder{func};
+  it->second(builder, size);
+  CHECK(!llvm::verifyModule(*module, &llvm::errs()))
+      << "Generated an invalid " << shape << " of size " << size;
+  return module;
+}
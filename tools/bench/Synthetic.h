@@ -0,0 +1,33 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+// Names of the shapes of control flow that `GenerateSynthetic` can generate
+const std::vector<std::string>& GetSyntheticShapes();
+
+// Returns a module for the host with a single function, `f`, whose control
+// flow has shape `shape` and grows linearly with `size`, or null if the shape
+// is unknown. The shapes are:
+//  - `if_ladder`: a cascade of `size` `if`/`else if` tests on an argument
+//  - `nested_loops`: `size` nested counted loops
+//  - `nested_ifs`: `size` nested `if`s, each of them a region of its own
+//  - `loop_exits`: a loop of `size` blocks, each of which can leave it
+//  - `switch`: a switch on an argument with `size` cases
+//  - `irreducible`: a sequence of `size` loops with two entries each
+//  - `big_block`: a single block of `size` arithmetic instructions
+std::unique_ptr<llvm::Module> GenerateSynthetic(llvm::LLVMContext& ctx,
+                                                const std::string& shape,
+                                                unsigned size);
@@ -0,0 +1,370 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/IR/IRBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Regex.h>
+#include <llvm/Support/raw_ostream.h>
+#include <z3++.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <unordered_set>
+#include <vector>
+
+#include "Corpus.h"
+#include "rellic/AST/ASTUnitFactory.h"
+#include "rellic/AST/DecompilationContext.h"
+#include "rellic/AST/IRToASTVisitor.h"
+#include "rellic/AST/Util.h"
+
+DEFINE_string(corpus, "",
+              "Corpus of formulas recorded with rellic-bench --record_corpus, "
+              "or a directory of them.");
+DEFINE_string(filter, "",
+              "Regular expression that the names of the benchmarks to run "
+              "must match.");
+DEFINE_double(min_time, 0.5,
+              "Minimum time in seconds that each benchmark runs for.");
+DEFINE_string(output, "", "File the results are also written to as JSON.");
+
+namespace {
+using Seconds = std::chrono::duration<double>;
+
+// `run` makes one pass over `count` formulas, after `setup` prepares it if
+// not empty. Only `run` is timed.
+struct Benchmark {
+  std::string name;
+  size_t count;
+  std::function<void()> setup;
+  std::function<void()> run;
+};
+
+struct Measurement {
+  size_t iterations = 0;
+  Seconds time{0};
+};
+
+// Runs `bench` once to warm it up, then until it has run for `FLAGS_min_time`
+Measurement Measure(const Benchmark& bench) {
+  if (bench.setup) {
+    bench.setup();
+  }
+  bench.run();
+
+  Measurement m;
+  while (m.time.count() < FLAGS_min_time) {
+    if (bench.setup) {
+      bench.setup();
+    }
+    auto start{std::chrono::steady_clock::now()};
+    bench.run();
+    m.time += std::chrono::steady_clock::now() - start;
+    ++m.iterations;
+  }
+  return m;
+}
+
+void ReadCorpus(const std::string& path, z3::expr_vector& formulas) {
+  auto buffer{llvm::MemoryBuffer::getFile(path)};
+  CHECK(buffer) << "Failed to read " << path << ": "
+                << buffer.getError().message();
+  try {
+    ParseCorpus((*buffer)->getBuffer(), formulas);
+  } catch (z3::exception& e) {
+    LOG(FATAL) << "Failed to parse " << path << ": " << e.msg();
+  }
+}
+
+// Reads `path`, or every `.smt2` file in it if it is a directory
+void ReadCorpora(const std::string& path, z3::expr_vector& formulas) {
+  if (!llvm::sys::fs::is_directory(path)) {
+    ReadCorpus(path, formulas);
+    return;
+  }
+
+  std::vector<std::string> files;
+  std::error_code ec;
+  for (llvm::sys::fs::directory_iterator it(path, ec), end; it != end && !ec;
+       it.increment(ec)) {
+    if (llvm::sys::path::extension(it->path()) == ".smt2") {
+      files.push_back(it->path());
+    }
+  }
+  CHECK(!ec) << "Failed to list " << path << ": " << ec.message();
+  std::sort(files.begin(), files.end());
+  for (auto& file : files) {
+    ReadCorpus(file, formulas);
+  }
+}
+
+void ClearZ3Cache(rellic::DecompilationContext& dec_ctx) {
+  auto& cache{dec_ctx.z3_cache};
+  cache.proofs.clear();
+  cache.simplified.clear();
+  cache.ordered.clear();
+  cache.exprs.resize(0);
+}
+
+bool IsAtom(const z3::expr& expr) {
+  return expr.is_const() && expr.decl().decl_kind() == Z3_OP_UNINTERPRETED;
+}
+
+/*
+ * Conditions refer to branch and switch instructions through their atoms, so
+ * that `IRToASTVisitor::ConvertExpr` needs them to be mapped back to IR the
+ * way `GenerateAST` does. This builds a function that branches on an argument
+ * for each Boolean atom and switches on one for each integer atom, and maps
+ * the atoms to those instructions.
+ */
+class AtomFunction {
+  rellic::DecompilationContext& dec_ctx;
+  // Atoms of the formulas seen so far, and for integer ones the largest case
+  // index they are compared to
+  std::vector<z3::expr> bool_atoms;
+  std::map<unsigned, std::pair<z3::expr, uint64_t>> int_atoms;
+  std::unordered_set<unsigned> seen;
+
+ public:
+  AtomFunction(rellic::DecompilationContext& dec_ctx) : dec_ctx(dec_ctx) {}
+
+  // Returns whether `ConvertExpr` can convert `expr`, and collects its atoms
+  bool Add(const z3::expr& expr) {
+    if (IsAtom(expr)) {
+      if (!expr.is_bool()) {
+        return false;
+      }
+      if (seen.insert(expr.id()).second) {
+        bool_atoms.push_back(expr);
+      }
+      return true;
+    }
+
+    switch (expr.decl().decl_kind()) {
+      case Z3_OP_TRUE:
+      case Z3_OP_FALSE:
+        return true;
+      case Z3_OP_EQ: {
+        // Only comparisons of switch variables with case indices
+        auto var{expr.arg(0)};
+        auto idx{expr.arg(1)};
+        if (!IsAtom(var)) {
+          std::swap(var, idx);
+        }
+        uint64_t case_idx;
+        if (!IsAtom(var) || !var.is_int() || !idx.is_numeral_u64(case_idx) ||
+            case_idx > 0xFFFF) {
+          return false;
+        }
+        auto it{int_atoms.try_emplace(var.id(), var, case_idx).first};
+        it->second.second = std::max(it->second.second, case_idx);
+        return true;
+      }
+      case Z3_OP_AND:
+      case Z3_OP_OR:
+      case Z3_OP_NOT:
+      case Z3_OP_ITE:
+        for (auto i{0U}; i < expr.num_args(); ++i) {
+          if (!Add(expr.arg(i))) {
+            return false;
+          }
+        }
+        return expr.num_args() > 0;
+      default:
+        return false;
+    }
+  }
+
+  // Creates the function in `module` and gives it a declaration in
+  // `dec_ctx.ast_ctx`
+  void Build(llvm::Module& module) {
+    auto& ctx{module.getContext()};
+    std::vector<llvm::Type*> params(bool_atoms.size(),
+                                    llvm::Type::getInt1Ty(ctx));
+    params.resize(params.size() + int_atoms.size(),
+                  llvm::Type::getInt32Ty(ctx));
+    auto func{llvm::Function::Create(
+        llvm::FunctionType::get(llvm::Type::getVoidTy(ctx), params,
+                                /*isVarArg=*/false),
+        llvm::GlobalValue::ExternalLinkage, "atoms", module)};
+
+    llvm::IRBuilder<> builder(llvm::BasicBlock::Create(ctx, "entry", func));
+    auto arg{func->arg_begin()};
+    for (auto& atom : bool_atoms) {
+      auto next{llvm::BasicBlock::Create(ctx, "", func)};
+      auto br{builder.CreateCondBr(&*arg++, next, next)};
+      dec_ctx.z3_br_edges_inv[atom.id()] = {br, true};
+      builder.SetInsertPoint(next);
+    }
+    for (auto& [id, atom] : int_atoms) {
+      auto max_idx{atom.second};
+      auto next{llvm::BasicBlock::Create(ctx, "", func)};
+      auto sw{builder.CreateSwitch(&*arg++, next, max_idx + 1)};
+      for (uint64_t i{0}; i <= max_idx; ++i) {
+        sw->addCase(builder.getInt32(i), next);
+      }
+      dec_ctx.z3_sw_vars_inv[id] = sw;
+      builder.SetInsertPoint(next);
+    }
+    builder.CreateRetVoid();
+
+    rellic::IRToASTVisitor(dec_ctx).VisitFunctionDecl(*func);
+  }
+};
+
+void PrintResults(const std::vector<Benchmark>& benches,
+                  const std::vector<Measurement>& results) {
+  llvm::outs() << llvm::format("%-28s %16s %12s %10s\n", "Benchmark",
+                               "Time/formula", "Iterations", "Formulas");
+  for (size_t i{0}; i < benches.size(); ++i) {
+    auto& m{results[i]};
+    auto ns{m.time.count() * 1e9 / (m.iterations * benches[i].count)};
+    llvm::outs() << llvm::format("%-28s %13.0f ns %12zu %10zu\n",
+                                 benches[i].name.c_str(), ns, m.iterations,
+                                 benches[i].count);
+  }
+}
+
+llvm::json::Array GetJSON(const std::vector<Benchmark>& benches,
+                          const std::vector<Measurement>& results) {
+  llvm::json::Array json;
+  for (size_t i{0}; i < benches.size(); ++i) {
+    auto& m{results[i]};
+    json.push_back(llvm::json::Object{
+        {"name", benches[i].name},
+        {"formulas", static_cast<int64_t>(benches[i].count)},
+        {"iterations", static_cast<int64_t>(m.iterations)},
+        {"time_per_formula",
+         m.time.count() / (m.iterations * benches[i].count)},
+    });
+  }
+  return json;
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::stringstream usage;
+  usage << std::endl
+        << std::endl
+        << "  " << argv[0] << " \\" << std::endl
+        << "    --corpus CORPUS_FILE_OR_DIRECTORY \\" << std::endl
+        << "    [--filter REGEX] \\" << std::endl
+        << "    [--min_time SECONDS] \\" << std::endl
+        << "    [--output OUTPUT_JSON_FILE]" << std::endl
+        << std::endl;
+
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  google::SetUsageMessage(usage.str());
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  LOG_IF(FATAL, FLAGS_corpus.empty()) << "Must specify a corpus of formulas.";
+  llvm::Regex filter(FLAGS_filter);
+  std::string error;
+  LOG_IF(FATAL, !filter.isValid(error)) << "Invalid filter: " << error;
+
+  auto triple{llvm::sys::getProcessTriple()};
+  auto ast_unit{rellic::ASTUnitFactory::Get().Create(triple)};
+  rellic::DecompilationContext dec_ctx(*ast_unit);
+
+  z3::expr_vector formulas{dec_ctx.z3_ctx};
+  ReadCorpora(FLAGS_corpus, formulas);
+  LOG_IF(FATAL, formulas.empty()) << "The corpus has no formulas.";
+
+  llvm::LLVMContext llvm_ctx;
+  llvm::Module module("atoms", llvm_ctx);
+  module.setTargetTriple(triple);
+  AtomFunction atoms(dec_ctx);
+  z3::expr_vector convertible{dec_ctx.z3_ctx};
+  for (auto formula : formulas) {
+    if (atoms.Add(formula)) {
+      convertible.push_back(formula);
+    }
+  }
+  atoms.Build(module);
+
+  auto each{[&formulas](auto fn) {
+    return [&formulas, fn]() {
+      for (auto formula : formulas) {
+        fn(formula);
+      }
+    };
+  }};
+  auto clear{[&dec_ctx]() { ClearZ3Cache(dec_ctx); }};
+  rellic::IRToASTVisitor visitor(dec_ctx);
+  // Each runs on the solver and caches of a single context, like passes do.
+  // The uncached ones measure Z3, the cached ones the cost of a hit.
+  std::vector<Benchmark> all{
+      {"HeavySimplify", formulas.size(), clear,
+       each([&](z3::expr e) { rellic::HeavySimplify(dec_ctx, e); })},
+      {"HeavySimplify/cached", formulas.size(), {},
+       each([&](z3::expr e) { rellic::HeavySimplify(dec_ctx, e); })},
+      {"Prove", formulas.size(), clear,
+       each([&](z3::expr e) { rellic::Prove(dec_ctx, e); })},
+      {"Prove/cached", formulas.size(), {},
+       each([&](z3::expr e) { rellic::Prove(dec_ctx, e); })},
+      {"OrderById", formulas.size(), {},
+       each([](z3::expr e) { rellic::OrderById(e); })},
+      {"OrderById/memoized", formulas.size(), clear,
+       each([&](z3::expr e) { rellic::OrderById(dec_ctx, e); })},
+      {"ConvertExpr", convertible.size(),
+       [&visitor]() { visitor.ClearConvertedExprs(); },
+       [&]() {
+         for (auto formula : convertible) {
+           visitor.ConvertExpr(formula);
+         }
+       }},
+  };
+
+  std::vector<Benchmark> benches;
+  for (auto& bench : all) {
+    if (bench.count && filter.match(bench.name)) {
+      benches.push_back(std::move(bench));
+    }
+  }
+  LOG_IF(WARNING, convertible.size() < formulas.size())
+      << formulas.size() - convertible.size()
+      << " formulas cannot be converted to C and are left out of ConvertExpr";
+
+  std::vector<Measurement> results;
+  for (auto& bench : benches) {
+    results.push_back(Measure(bench));
+  }
+  PrintResults(benches, results);
+
+  if (!FLAGS_output.empty()) {
+    std::error_code ec;
+    llvm::raw_fd_ostream output(FLAGS_output, ec);
+    CHECK(!ec) << "Failed to create output file: " << ec.message();
+    output << llvm::json::Value(llvm::json::Object{
+                  {"formulas", static_cast<int64_t>(formulas.size())},
+                  {"benchmarks", GetJSON(benches, results)},
+              })
+           << '\n';
+  }
+
+  google::ShutDownCommandLineFlags();
+  google::ShutdownGoogleLogging();
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,235 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/Support/Format.h>
+#include <llvm/Support/Host.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+#include <z3++.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <system_error>
+#include <tuple>
+#include <vector>
+
+#include "rellic/AST/ASTUnitFactory.h"
+#include "rellic/AST/DecompilationContext.h"
+#include "rellic/AST/Util.h"
+#include "rellic/AST/Z3QueryLog.h"
+#include "rellic/Exception.h"
+
+DEFINE_string(log, "",
+              "Queries recorded with rellic-decomp --z3_query_log, or any "
+              "other user of DecompilationOptions::z3_query_log.");
+DEFINE_uint32(timeout, 0,
+              "Timeout in milliseconds for every query, instead of the one it "
+              "was recorded with (0 to keep the recorded ones).");
+DEFINE_uint32(top, 10, "Number of slowest queries to list.");
+DEFINE_string(output, "", "File the results are also written to as JSON.");
+
+namespace {
+using Seconds = std::chrono::duration<double>;
+using Query = rellic::Z3QueryLog::Query;
+
+struct Replay {
+  Seconds time{0};
+  std::string result;
+};
+
+// Totals of the queries of a kind made by a pass
+struct Totals {
+  size_t queries = 0;
+  Seconds recorded{0};
+  Seconds replayed{0};
+  // Queries whose result differs from the recorded one
+  size_t changed = 0;
+};
+
+const char* GetCheckName(z3::check_result check) {
+  switch (check) {
+    case z3::sat:
+      return "sat";
+    case z3::unsat:
+      return "unsat";
+    default:
+      return "unknown";
+  }
+}
+
+// Runs `query` on the solver and tactics of `dec_ctx`, the way `Prove` and
+// `HeavySimplify` do on their first attempt. Portfolios and caches are left
+// out, so that only Z3 is measured.
+Replay Run(rellic::DecompilationContext& dec_ctx, const Query& query,
+           z3::expr formula) {
+  auto& z3_solver{dec_ctx.z3_solver};
+  auto timeout{FLAGS_timeout ? FLAGS_timeout : query.timeout};
+  Replay replay;
+  auto start{std::chrono::steady_clock::now()};
+  if (query.kind == "prove") {
+    z3::params params{dec_ctx.z3_ctx};
+    params.set("timeout",
+               timeout ? timeout : std::numeric_limits<unsigned>::max());
+    z3_solver.solver.set(params);
+    z3_solver.solver.push();
+    z3_solver.solver.add(!formula);
+    replay.result = GetCheckName(z3_solver.solver.check());
+    z3_solver.solver.pop();
+  } else if (query.kind == "simplify") {
+    CHECK(query.tactic == "heavy_simplify" ||
+          query.tactic == "light_simplify")
+        << "Unknown tactic " << query.tactic;
+    auto tactic{query.tactic == "heavy_simplify" ? z3_solver.heavy_simplify
+                                                 : z3_solver.light_simplify};
+    try {
+      rellic::ApplyTactic(timeout ? z3::try_for(tactic, timeout) : tactic,
+                          formula);
+      replay.result = "simplified";
+    } catch (z3::exception&) {
+      replay.result = "failed";
+    }
+  } else {
+    LOG(FATAL) << "Unknown kind of query " << query.kind;
+  }
+  replay.time = std::chrono::steady_clock::now() - start;
+  return replay;
+}
+
+using Key = std::tuple<std::string, std::string>;
+
+void PrintResults(const std::map<Key, Totals>& totals,
+                  const std::vector<Query>& queries,
+                  const std::vector<Replay>& replays) {
+  llvm::outs() << llvm::format("%-10s %-24s %8s %12s %12s %8s\n", "Kind",
+                               "Pass", "Queries", "Recorded", "Replayed",
+                               "Changed");
+  for (auto& [key, t] : totals) {
+    auto& [kind, pass]{key};
+    llvm::outs() << llvm::format(
+        "%-10s %-24s %8zu %10.3f s %10.3f s %8zu\n", kind.c_str(),
+        pass.empty() ? "-" : pass.c_str(), t.queries, t.recorded.count(),
+        t.replayed.count(), t.changed);
+  }
+
+  std::vector<size_t> slowest(queries.size());
+  for (size_t i{0}; i < slowest.size(); ++i) {
+    slowest[i] = i;
+  }
+  auto top{std::min<size_t>(FLAGS_top, slowest.size())};
+  std::partial_sort(slowest.begin(), slowest.begin() + top, slowest.end(),
+                    [&replays](size_t a, size_t b) {
+                      return replays[a].time > replays[b].time;
+                    });
+  if (!top) {
+    return;
+  }
+  llvm::outs() << llvm::format("\n%-6s %-10s %-24s %-24s %12s %s\n", "Query",
+                               "Kind", "Pass", "Function", "Replayed",
+                               "Result");
+  for (size_t i{0}; i < top; ++i) {
+    auto& query{queries[slowest[i]]};
+    auto& replay{replays[slowest[i]]};
+    llvm::outs() << llvm::format(
+        "%-6zu %-10s %-24s %-24s %10.3f s %s\n", slowest[i],
+        query.kind.c_str(), query.pass.empty() ? "-" : query.pass.c_str(),
+        query.function.empty() ? "-" : query.function.c_str(),
+        replay.time.count(), replay.result.c_str());
+  }
+}
+
+llvm::json::Array GetJSON(const std::vector<Query>& queries,
+                          const std::vector<Replay>& replays) {
+  llvm::json::Array json;
+  for (size_t i{0}; i < queries.size(); ++i) {
+    auto& query{queries[i]};
+    json.push_back(llvm::json::Object{
+        {"kind", query.kind},
+        {"tactic", query.tactic},
+        {"pass", query.pass},
+        {"function", query.function},
+        {"recorded_time", query.time.count()},
+        {"recorded_result", query.result},
+        {"replayed_time", replays[i].time.count()},
+        {"replayed_result", replays[i].result},
+    });
+  }
+  return json;
+}
+}  // namespace
+
+int main(int argc, char* argv[]) {
+  std::stringstream usage;
+  usage << std::endl
+        << std::endl
+        << "  " << argv[0] << " \\" << std::endl
+        << "    --log QUERY_LOG_FILE \\" << std::endl
+        << "    [--timeout MILLISECONDS] \\" << std::endl
+        << "    [--top COUNT] \\" << std::endl
+        << "    [--output OUTPUT_JSON_FILE]" << std::endl
+        << std::endl;
+
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  google::SetUsageMessage(usage.str());
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  LOG_IF(FATAL, FLAGS_log.empty()) << "Must specify a query log.";
+
+  auto triple{llvm::sys::getProcessTriple()};
+  auto ast_unit{rellic::ASTUnitFactory::Get().Create(triple)};
+  rellic::DecompilationContext dec_ctx(*ast_unit);
+
+  auto buffer{llvm::MemoryBuffer::getFile(FLAGS_log)};
+  CHECK(buffer) << "Failed to read " << FLAGS_log << ": "
+                << buffer.getError().message();
+  std::vector<Query> queries;
+  z3::expr_vector formulas{dec_ctx.z3_ctx};
+  try {
+    rellic::Z3QueryLog::Parse((*buffer)->getBuffer(), queries, formulas);
+  } catch (rellic::Exception& ex) {
+    LOG(FATAL) << "Failed to parse " << FLAGS_log << ": " << ex.what();
+  }
+  LOG_IF(FATAL, queries.empty()) << "The log has no queries.";
+
+  std::vector<Replay> replays;
+  std::map<Key, Totals> totals;
+  for (size_t i{0}; i < queries.size(); ++i) {
+    auto& query{queries[i]};
+    replays.push_back(Run(dec_ctx, query, formulas[i]));
+    auto& t{totals[{query.kind, query.pass}]};
+    ++t.queries;
+    t.recorded += query.time;
+    t.replayed += replays.back().time;
+    if (replays.back().result != query.result) {
+      ++t.changed;
+    }
+  }
+  PrintResults(totals, queries, replays);
+
+  if (!FLAGS_output.empty()) {
+    std::error_code ec;
+    llvm::raw_fd_ostream output(FLAGS_output, ec);
+    CHECK(!ec) << "Failed to create output file: " << ec.message();
+    output << llvm::json::Value(llvm::json::Object{
+                  {"queries", GetJSON(queries, replays)},
+              })
+           << '\n';
+  }
+
+  google::ShutDownCommandLineFlags();
+  google::ShutdownGoogleLogging();
+  return EXIT_SUCCESS;
+}
@@ -10,24 +10,123 @@
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <llvm/ADT/APInt.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/Support/FileSystem.h>
 #include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/ThreadPool.h>
 #include <llvm/Support/raw_ostream.h>
 #include <rellic/Dec2Hex.h>
 
+#include <algorithm>
+#include <atomic>
 #include <iostream>
 #include <sstream>
+#include <string>
 #include <system_error>
+#include <vector>
 
-DEFINE_string(input, "-", "Input C file.");
-DEFINE_string(output, "", "Output C file.");
+DEFINE_string(input, "-",
+              "Input C file, or directory whose .c files are all converted.");
+DEFINE_string(output, "",
+              "Output C file, or directory where the files converted from an "
+              "input directory are written under the same relative paths.");
+DEFINE_uint32(num_workers, 1,
+              "Number of threads used to convert the files of an input "
+              "directory, or to convert the functions of a single input file "
+              "(0 uses all available hardware threads).");
 
-int main(int argc, char *argv[]) {
+static bool ShouldConvert(const llvm::APInt& value) {
+  return value.getZExtValue() >= 16;
+}
+
+// Converts the integer literals of the C file at `input` and writes the result
+// to `output`, or to stdout if empty. The declarations of the file are split
+// between `num_threads` threads. Returns whether it succeeded.
+static bool ConvertFile(const std::string& input, const std::string& output,
+                        unsigned num_threads) {
+  auto input_file = llvm::MemoryBuffer::getFileOrSTDIN(input);
+  if (!input_file) {
+    LOG(ERROR) << input << ": " << input_file.getError().message();
+    return false;
+  }
+  auto ast_unit{clang::tooling::buildASTFromCodeWithArgs(
+      input_file.get()->getBuffer(), {}, input, "rellic-dec2hex")};
+  if (!ast_unit) {
+    LOG(ERROR) << input << ": could not be parsed";
+    return false;
+  }
+  auto& ast_ctx{ast_unit->getASTContext()};
+
+  if (output.empty()) {
+    rellic::ConvertIntegerLiteralsToHex(ast_ctx, llvm::outs(), ShouldConvert,
+                                        num_threads);
+    return true;
+  }
+
+  std::error_code ec;
+  llvm::raw_fd_ostream os(output, ec);
+  if (ec) {
+    LOG(ERROR) << output << ": " << ec.message();
+    return false;
+  }
+  rellic::ConvertIntegerLiteralsToHex(ast_ctx, os, ShouldConvert,
+                                      num_threads);
+  return true;
+}
+
+// Converts every .c file under `input_dir` on `num_workers` threads, each with
+// an AST of its own. Returns the number of failures.
+static unsigned ConvertDirectory(const std::string& input_dir,
+                                 const std::string& output_dir,
+                                 unsigned num_workers) {
+  std::vector<std::string> inputs;
+  std::error_code ec;
+  for (llvm::sys::fs::recursive_directory_iterator it(input_dir, ec), end;
+       it != end && !ec; it.increment(ec)) {
+    if (it->type() == llvm::sys::fs::file_type::regular_file &&
+        llvm::sys::path::extension(it->path()) == ".c") {
+      inputs.push_back(it->path());
+    }
+  }
+  if (ec) {
+    LOG(FATAL) << input_dir << ": " << ec.message();
+  }
+  std::sort(inputs.begin(), inputs.end());
+
+  std::atomic<unsigned> failures{0};
+  {
+    llvm::ThreadPool pool(llvm::hardware_concurrency(num_workers));
+    for (auto& input : inputs) {
+      pool.async([&input, &input_dir, &output_dir, &failures] {
+        llvm::SmallString<256> output{input};
+        llvm::sys::path::replace_path_prefix(output, input_dir, output_dir);
+        if (auto ec = llvm::sys::fs::create_directories(
+                llvm::sys::path::parent_path(output))) {
+          LOG(ERROR) << output.str().str() << ": " << ec.message();
+          ++failures;
+          return;
+        }
+        if (!ConvertFile(input, output.str().str(), /*num_threads=*/1)) {
+          ++failures;
+        }
+      });
+    }
+    pool.wait();
+  }
+  LOG(INFO) << inputs.size() - failures << " of " << inputs.size()
+            << " files converted";
+  return failures;
+}
+
+int main(int argc, char* argv[]) {
   std::stringstream usage;
   usage << std::endl
         << std::endl
         << "  " << argv[0] << " \\" << std::endl
-        << "    --input INPUT_C_FILE \\" << std::endl
-        << "    --output OUTPUT_C_FILE \\" << std::endl
+        << "    --input INPUT_C_FILE_OR_DIR \\" << std::endl
+        << "    --output OUTPUT_C_FILE_OR_DIR \\" << std::endl
+        << "    [--num_workers N] \\" << std::endl
         << std::endl;
 
   google::InitGoogleLogging(argv[0]);
@@ -35,31 +134,21 @@ int main(int argc, char *argv[]) {
   google::SetUsageMessage(usage.str());
   google::ParseCommandLineFlags(&argc, &argv, true);
 
-  auto input_file = llvm::MemoryBuffer::getFileOrSTDIN(FLAGS_input);
-  if (!input_file) {
-    LOG(FATAL) << input_file.getError().message();
-  }
-  auto ast_unit{clang::tooling::buildASTFromCodeWithArgs(
-      input_file.get()->getBuffer(), {}, FLAGS_input, "rellic-dec2hex")};
-  auto &ast_ctx{ast_unit->getASTContext()};
-
-  auto heuristic = [](const llvm::APInt &value) {
-    return value.getZExtValue() >= 16;
-  };
-
-  if (FLAGS_output.empty()) {
-    rellic::ConvertIntegerLiteralsToHex(ast_ctx, llvm::outs(), heuristic);
-  } else {
-    std::error_code ec;
-    llvm::raw_fd_ostream os(FLAGS_output, ec);
-    if (ec) {
-      LOG(FATAL) << ec.message();
+  auto num_workers{FLAGS_num_workers
+                       ? FLAGS_num_workers
+                       : llvm::hardware_concurrency().compute_thread_count()};
+  auto succeeded{true};
+  if (llvm::sys::fs::is_directory(FLAGS_input)) {
+    if (FLAGS_output.empty()) {
+      LOG(FATAL) << "--output must be a directory when --input is one";
     }
-    rellic::ConvertIntegerLiteralsToHex(ast_ctx, os, heuristic);
+    succeeded = !ConvertDirectory(FLAGS_input, FLAGS_output, num_workers);
+  } else {
+    succeeded = ConvertFile(FLAGS_input, FLAGS_output, num_workers);
   }
 
   google::ShutDownCommandLineFlags();
   google::ShutdownGoogleLogging();
 
-  return EXIT_SUCCESS;
+  return succeeded ? EXIT_SUCCESS : EXIT_FAILURE;
 }
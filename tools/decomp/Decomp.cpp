@@ -7,29 +7,293 @@
  */
 
 #include <clang/Tooling/Tooling.h>
+#include <fcntl.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <llvm/ADT/ArrayRef.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Bitcode/BitcodeReader.h>
+#include <llvm/Support/Base64.h>
+#include <llvm/Support/FileSystem.h>
 #include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/Program.h>
+#include <llvm/Support/ThreadPool.h>
 #include <llvm/Support/raw_ostream.h>
+#include <signal.h>
+#include <spawn.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <functional>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <optional>
+#include <string>
 #include <system_error>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
+#include "OutputFile.h"
+#include "Printer.h"
+#include "rellic/AST/AlphaCache.h"
+#include "rellic/AST/FunctionCache.h"
+#include "rellic/AST/PassProfile.h"
+#include "rellic/AST/TypeLibrary.h"
+#include "rellic/AST/Z3QueryLog.h"
+#include "rellic/Activity.h"
 #include "rellic/BC/Util.h"
 #include "rellic/Decompiler.h"
+#include "rellic/Exception.h"
+#include "rellic/Log.h"
+#include "rellic/Printer.h"
+#include "rellic/Trace.h"
 #include "rellic/Version.h"
 
 #ifndef LLVM_VERSION_STRING
 #define LLVM_VERSION_STRING LLVM_VERSION_MAJOR << "." << LLVM_VERSION_MINOR
 #endif
 
-DEFINE_string(input, "", "Input LLVM bitcode file.");
-DEFINE_string(output, "", "Output file.");
-DEFINE_bool(disable_z3, false, "Disable Z3 based AST tranformations.");
+DEFINE_string(input, "",
+              "Input LLVM bitcode file, or - to read it from standard input.");
+DEFINE_string(output, "",
+              "Output file, or - for standard output. This and the other "
+              "output files are compressed as they are written if their "
+              "name ends with .gz or .zst.");
+DEFINE_string(batch, "",
+              "Decompile every .bc file in this directory, or every file "
+              "listed in this manifest (one path per line). Each output is "
+              "written next to its input with a .c extension.");
+DEFINE_string(link, "",
+              "Decompile the .bc files in this directory, or listed in this "
+              "manifest, linked into one module. The types, globals and "
+              "prototypes they share are only generated once, into --header, "
+              "and each input gets a .c file next to it with its own "
+              "definitions.");
+DEFINE_string(header, "", "Header shared by the outputs of --link.");
+DEFINE_bool(server, false,
+            "Keep running and decompile the requests read from standard "
+            "input, one JSON object per line, answering each with a JSON "
+            "object on a line of standard output.");
+DEFINE_string(workers, "",
+              "File listing one shell command per line, each starting a "
+              "`rellic-decomp --server` with the same options as this run and "
+              "a --cache_dir shared with it. Functions are decompiled by these "
+              "workers, and the output is assembled from the cache.");
+DEFINE_uint32(work_unit_retries, 2,
+              "Times a function that failed on a worker is sent to another "
+              "one before it is decompiled locally.");
+DEFINE_uint32(batch_workers, 1,
+              "Number of files decompiled concurrently in batch mode (0 uses "
+              "all available hardware threads).");
+DEFINE_uint32(file_timeout, 0,
+              "Seconds each file of --batch may take before its decompilation "
+              "is cancelled, its partial output written and the file recorded "
+              "as timed out (0 for no limit).");
+DEFINE_bool(isolate, false,
+            "Decompile the files of --batch in --batch_workers child "
+            "processes, so that a crash only fails the file being decompiled "
+            "and the crashed worker is replaced.");
+DEFINE_string(crash_retry_pipeline, "dse",
+              "Pipeline with which a file of --isolate whose worker crashed "
+              "is retried once, with switches lowered and phi nodes removed "
+              "(empty to not retry).");
+DEFINE_bool(batch_worker, false,
+            "Decompile the files requested on standard input as a worker of "
+            "--isolate. Only meant to be set by the parent process.");
+DEFINE_uint32(function_timeout, 0,
+              "Seconds a file of --batch may spend without finishing the "
+              "structuring or a refinement pass of any function before it is "
+              "cancelled like with --file_timeout (0 for no limit).");
+DEFINE_string(functions, "",
+              "Comma-separated names of the functions to decompile, along with "
+              "the functions they refer to (empty for all). Other function "
+              "bodies are not read from the input. Addresses in hexadecimal "
+              "select the functions named sub_<address>.");
+DEFINE_int32(call_depth, -1,
+             "Levels of functions referred to by --functions that are "
+             "decompiled as well (-1 for all).");
+DEFINE_bool(disable_z3, false,
+            "Decide conditions syntactically instead of with Z3, for fast but "
+            "less refined output. Overrides --bdd_conditions.");
 DEFINE_bool(remove_phi_nodes, false,
             "Remove PHINodes from input bitcode before decompilation.");
 DEFINE_bool(lower_switch, false,
             "Remove SwitchInst by lowering them to branches.");
+DEFINE_bool(remove_dead_globals, false,
+            "Do not decompile internal functions and global variables that "
+            "no exported symbol refers to.");
+DEFINE_uint32(num_workers, 1,
+              "Number of threads used to decompile and print functions (0 "
+              "uses all available hardware threads).");
+DEFINE_bool(scratch_contexts, false,
+            "Decompile each function in a translation unit of its own, which "
+            "is released once its body has been merged.");
+DEFINE_uint32(goto_fallback_blocks, 0,
+              "Emit functions with more blocks than this with gotos instead "
+              "of structuring them (0 for no limit).");
+DEFINE_bool(goto_fallback_irreducible, false,
+            "Emit functions with irreducible control flow with gotos instead "
+            "of structuring them.");
+DEFINE_uint32(structuring_budget, 0,
+              "Emit functions whose reaching conditions take longer than this "
+              "many milliseconds with gotos (0 for no limit).");
+DEFINE_uint32(z3_timeout, 0,
+              "Time limit in milliseconds for each Z3 query during refinement "
+              "(0 for no limit).");
+DEFINE_uint32(z3_portfolio, 0,
+              "Race Z3 queries that take longer than this many milliseconds "
+              "across alternative tactics on several threads (0 to "
+              "disable).");
+DEFINE_uint32(function_budget, 0,
+              "Time limit in milliseconds for refining each function. "
+              "Functions over budget are emitted partially refined (0 for no "
+              "limit).");
+DEFINE_uint64(soft_rss_limit, 0,
+              "Peak resident memory in MiB past which refinement is cut short "
+              "and provenance is dropped (0 for no limit).");
+DEFINE_uint64(soft_ast_memory_limit, 0,
+              "Memory in MiB allocated for a translation unit past which "
+              "refinement is cut short and provenance is dropped (0 for no "
+              "limit).");
+DEFINE_uint64(soft_z3_memory_limit, 0,
+              "Memory in MiB allocated by Z3 past which refinement is cut "
+              "short and provenance is dropped (0 for no limit).");
+DEFINE_uint64(soft_z3_exprs_limit, 0,
+              "Number of Z3 conditions kept for a translation unit past which "
+              "refinement is cut short and provenance is dropped (0 for no "
+              "limit).");
+DEFINE_bool(bdd_conditions, false,
+            "Decide boolean conditions with BDDs, falling back to Z3 for the "
+            "others.");
+DEFINE_bool(dominator_reaching_conds, false,
+            "Build reaching conditions relative to immediate dominators, "
+            "which keeps them small.");
+DEFINE_bool(reuse_region_conds, false,
+            "With --dominator_reaching_conds, reuse the reaching conditions "
+            "of regions whose control flow has the same shape as one "
+            "structured before, e.g. copies of inlined code.");
+DEFINE_uint32(cond_temp_threshold, 0,
+              "Assign branch conditions translated from at least this many "
+              "instructions to a variable (0 disables it).");
+DEFINE_uint32(wide_string_threshold, 0,
+              "Print constant arrays of 16- and 32-bit integers with at least "
+              "this many elements as wide string literals (0 disables it).");
+DEFINE_bool(debug_names_at_creation, false,
+            "Name local variables and struct fields from debug info as they "
+            "are created, instead of with the ldr and sfr passes.");
+DEFINE_uint32(simplify_light_nodes, 0,
+              "Only apply cheap rewrites to conditions larger than this many "
+              "DAG nodes when simplifying them (0 for no limit).");
+DEFINE_uint32(simplify_max_nodes, 0,
+              "Do not simplify conditions larger than this many DAG nodes (0 "
+              "for no limit).");
+DEFINE_string(pipeline, "",
+              "Refinement passes to run, e.g. \"dse,ldr;fix(zcs,ncp)\" (empty "
+              "for the default pipeline).");
+DEFINE_bool(adaptive_passes, false,
+            "Skip refinement passes on the functions they cannot change "
+            "anymore within fixpoints.");
+DEFINE_string(pass_profile, "",
+              "Skip refinement passes on the functions whose shape this "
+              "profile of earlier runs shows they never change.");
+DEFINE_string(record_pass_profile, "",
+              "Add the refinement passes of this run to the profile in this "
+              "file.");
+DEFINE_bool(alpha_cache, false,
+            "Solve the conditions that are the same up to the names of their "
+            "variables once for every input, rather than once per "
+            "function.");
+DEFINE_string(z3_query_log, "",
+              "Record every query that reaches Z3 into this file, for "
+              "rellic-z3replay. Batch workers append their pid to it.");
+DEFINE_string(type_libraries, "",
+              "Comma-separated list of type libraries built by "
+              "rellic-typelib, whose prototypes are preferred over the "
+              "types recovered from the IR.");
+DEFINE_uint32(pass_profile_min_visits, 0,
+              "Visits without a change before --pass_profile skips a pass on "
+              "a shape (0 for the number saved in the profile).");
+DEFINE_bool(stream, false,
+            "Print each batch of functions as soon as it has been decompiled, "
+            "instead of the whole output at the end.");
+DEFINE_string(provenance, "",
+              "Write the IR that each range of the output was generated from "
+              "to this file, as one JSON object per line and declaration.");
+DEFINE_string(output_index, "",
+              "Write the byte range of each function and global variable in "
+              "the output, and the IR it was generated from, to this file as "
+              "one JSON object per line.");
+DEFINE_bool(hex_literals, false,
+            "Print integer literals of 16 and above in hexadecimal form.");
+DEFINE_string(hex_output, "",
+              "Also write the output to this file with integer literals of 16 "
+              "and above in hexadecimal form.");
+DEFINE_string(html_output, "",
+              "Also write the output to this file as HTML, the way rellic-xref "
+              "renders it.");
+DEFINE_string(cache_dir, "",
+              "Directory of a cache of decompiled functions shared between "
+              "runs.");
+DEFINE_uint64(cache_max_size, 0,
+              "Size in bytes the cache directory is trimmed to after each "
+              "decompilation (0 for no limit).");
+DEFINE_string(diff_against, "",
+              "Previous version of --input. Only the functions of --input "
+              "that are new or whose IR differs from the one in it are "
+              "decompiled, and the output starts with a comment listing "
+              "which functions changed.");
+DEFINE_string(diff_previous_output, "",
+              "With --diff_against, also write the previous version of the "
+              "changed functions, and the ones that were removed, to this "
+              "file to compare with --output. Functions found in --cache_dir, "
+              "e.g. from decompiling the previous version with it, are not "
+              "decompiled again.");
+DEFINE_string(preprocess_cache_dir, "",
+              "Directory of a cache of preprocessed inputs, keyed by their "
+              "contents and the preprocessing flags, so that runs with other "
+              "refinement options do not preprocess them again.");
+
+DEFINE_bool(progress, false,
+            "Show the progress of the decompilation on standard error.");
+
+DEFINE_string(stats, "",
+              "Write per-pass and per-function timing information as JSON to "
+              "this file.");
+DEFINE_bool(hardware_counters, false,
+            "Count the cycles, instructions, cache misses and branch misses "
+            "of every pass, function structuring and Z3 query in --stats, "
+            "with perf_event_open on Linux.");
+DEFINE_bool(report, false,
+            "Print a summary of where the time went to standard error after "
+            "decompiling: the most expensive functions and what dominated "
+            "each, the rounds of every fixpoint group and the hit rates of "
+            "the caches.");
+DEFINE_uint32(report_functions, 10,
+              "Number of functions listed by --report.");
+DEFINE_string(trace, "",
+              "Write a Chrome Trace Event file of the decompilation to this "
+              "path.");
+DEFINE_uint32(trace_granularity, 500,
+              "Minimum duration in microseconds of the spans recorded with "
+              "--trace.");
+DEFINE_string(log_categories, "passes",
+              "Comma-separated categories of diagnostics to log: passes, "
+              "structuring, irgen, types, debuginfo, stats, or all. The "
+              "others cost nothing to leave out.");
 
 DECLARE_bool(version);
 
@@ -80,6 +344,1223 @@ static void SetVersion(void) {
   google::SetVersionString(version.str());
 }
 
+// How to print the output. Ranges with provenance in `provenance` are written
+// to `exporter`, and where declarations are to `index`, when they are not
+// null.
+static rellic::PrintOptions GetPrintOptions(
+    const rellic::ProvenanceLookup* provenance,
+    rellic::ProvenanceExporter* exporter,
+    rellic::DeclIndexExporter* index = nullptr) {
+  rellic::PrintOptions opts;
+  opts.num_workers = FLAGS_num_workers;
+  if (FLAGS_hex_literals) {
+    opts.hex_literals = [](const llvm::APInt& value) {
+      return value.uge(16);
+    };
+  }
+  if (exporter) {
+    opts.provenance = provenance;
+  }
+  if (exporter || index) {
+    opts.on_printed = [exporter, index, provenance](
+                          clang::Decl* decl, uint64_t begin, uint64_t end,
+                          llvm::ArrayRef<rellic::PrintedRange> ranges) {
+      if (exporter) {
+        exporter->Write(decl, begin, end, ranges);
+      }
+      if (index) {
+        index->Write(decl, begin, end, provenance);
+      }
+    };
+  }
+  return opts;
+}
+
+// Another rendering of the output, printed from the same translation unit
+struct OutputFlavor {
+  std::unique_ptr<llvm::raw_ostream> os;
+  rellic::PrintOptions options;
+  // Written before the first declaration and after the last one
+  std::string prologue, epilogue;
+};
+
+// Opens the files of --hex_output and --html_output
+static std::vector<OutputFlavor> OpenOutputFlavors() {
+  std::vector<OutputFlavor> flavors;
+  auto Open{[&flavors](const std::string& path) -> OutputFlavor& {
+    std::error_code ec;
+    auto& flavor{flavors.emplace_back()};
+    flavor.os = OpenOutputFile(path, ec);
+    CHECK(!ec) << "Failed to create output file " << path << ": "
+               << ec.message();
+    flavor.options.num_workers = FLAGS_num_workers;
+    return flavor;
+  }};
+  if (!FLAGS_hex_output.empty()) {
+    Open(FLAGS_hex_output).options.hex_literals = [](const llvm::APInt& value) {
+      return value.uge(16);
+    };
+  }
+  if (!FLAGS_html_output.empty()) {
+    auto& flavor{Open(FLAGS_html_output)};
+    flavor.options.print = [](clang::Decl* decl, llvm::raw_ostream& os) {
+      PrintDecl(decl, decl->getASTContext().getPrintingPolicy(), 0, os);
+    };
+    flavor.prologue = "<pre>";
+    flavor.epilogue = "</pre>\n";
+  }
+  for (auto& flavor : flavors) {
+    *flavor.os << flavor.prologue;
+  }
+  return flavors;
+}
+
+using OutputPrinter =
+    std::function<void(llvm::raw_ostream&, const rellic::PrintOptions&)>;
+
+// Prints `output` with `options` on the calling thread and each of `flavors`
+// on a thread of its own, all from the same AST at once
+static void PrintOutputs(llvm::raw_ostream& output,
+                         const rellic::PrintOptions& options,
+                         std::vector<OutputFlavor>& flavors,
+                         const OutputPrinter& print) {
+  std::vector<std::thread> threads;
+  for (auto& flavor : flavors) {
+    threads.emplace_back([&flavor, &print] {
+      print(*flavor.os, flavor.options);
+      flavor.os->flush();
+    });
+  }
+  print(output, options);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+}
+
+// Profiles of --pass_profile and --record_pass_profile, shared by every
+// decompilation of the process
+static std::optional<rellic::PassProfile> pass_profile;
+static std::optional<rellic::PassProfile> recorded_profile;
+// Cache of --alpha_cache, shared the same way
+static std::optional<rellic::AlphaCache> alpha_cache;
+// Log of --z3_query_log, shared the same way
+static std::optional<rellic::Z3QueryLog> z3_query_log;
+// Libraries of --type_libraries, mapped once and shared the same way
+static std::vector<std::shared_ptr<const rellic::TypeLibrary>> type_libraries;
+
+// Returns false if --pass_profile cannot be read
+static bool LoadPassProfiles() {
+  try {
+    if (!FLAGS_pass_profile.empty()) {
+      pass_profile = rellic::PassProfile::Load(FLAGS_pass_profile);
+      if (FLAGS_pass_profile_min_visits) {
+        pass_profile->min_visits = FLAGS_pass_profile_min_visits;
+      }
+    }
+  } catch (rellic::Exception& ex) {
+    LOG(ERROR) << ex.what();
+    return false;
+  }
+  if (!FLAGS_record_pass_profile.empty()) {
+    recorded_profile.emplace();
+  }
+  return true;
+}
+
+// Returns false if one of --type_libraries cannot be loaded
+static bool LoadTypeLibraries() {
+  llvm::SmallVector<llvm::StringRef, 4> paths;
+  llvm::StringRef(FLAGS_type_libraries)
+      .split(paths, ',', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+  try {
+    for (auto path : paths) {
+      type_libraries.push_back(rellic::TypeLibrary::Load(path.trim().str()));
+    }
+  } catch (rellic::Exception& ex) {
+    LOG(ERROR) << ex.what();
+    return false;
+  }
+  return true;
+}
+
+// Adds what was recorded to the profile saved at --record_pass_profile, which
+// other processes may have updated in the meantime
+static void SaveRecordedProfile() {
+  if (!recorded_profile) {
+    return;
+  }
+  try {
+    auto profile{rellic::PassProfile::Load(FLAGS_record_pass_profile)};
+    profile.Merge(*recorded_profile);
+    profile.Save(FLAGS_record_pass_profile);
+  } catch (rellic::Exception& ex) {
+    LOG(ERROR) << ex.what();
+  }
+}
+
+static rellic::DecompilationOptions GetOptions(
+    llvm::raw_ostream& output, rellic::ProvenanceExporter* exporter = nullptr,
+    rellic::DeclIndexExporter* index = nullptr,
+    std::vector<OutputFlavor>* flavors = nullptr) {
+  rellic::DecompilationOptions opts{};
+  opts.lower_switches = FLAGS_lower_switch;
+  opts.remove_phi_nodes = FLAGS_remove_phi_nodes;
+  opts.remove_dead_globals = FLAGS_remove_dead_globals;
+  llvm::SmallVector<llvm::StringRef, 8> functions;
+  llvm::StringRef(FLAGS_functions)
+      .split(functions, ',', /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+  for (auto name : functions) {
+    opts.functions.push_back(name.trim().str());
+  }
+  if (FLAGS_call_depth >= 0) {
+    opts.call_depth = FLAGS_call_depth;
+  }
+  opts.num_workers = FLAGS_num_workers;
+  opts.scratch_contexts = FLAGS_scratch_contexts;
+  // Declarations that are streamed are printed with the provenance of the
+  // decompiler, otherwise only the C source may need it
+  opts.provenance = (exporter || index) && !FLAGS_stream;
+  opts.goto_fallback_blocks = FLAGS_goto_fallback_blocks;
+  opts.goto_fallback_irreducible = FLAGS_goto_fallback_irreducible;
+  opts.structuring_budget_ms = FLAGS_structuring_budget;
+  opts.z3_timeout_ms = FLAGS_z3_timeout;
+  opts.z3_portfolio_ms = FLAGS_z3_portfolio;
+  opts.function_budget_ms = FLAGS_function_budget;
+  opts.soft_rss_limit = FLAGS_soft_rss_limit * 1024 * 1024;
+  opts.soft_ast_memory_limit = FLAGS_soft_ast_memory_limit * 1024 * 1024;
+  opts.soft_z3_memory_limit = FLAGS_soft_z3_memory_limit * 1024 * 1024;
+  opts.soft_z3_exprs_limit = FLAGS_soft_z3_exprs_limit;
+  if (FLAGS_disable_z3) {
+    opts.condition_engine =
+        rellic::DecompilationOptions::ConditionEngine::Syntactic;
+  } else if (FLAGS_bdd_conditions) {
+    opts.condition_engine = rellic::DecompilationOptions::ConditionEngine::BDD;
+  }
+  if (FLAGS_dominator_reaching_conds) {
+    opts.reaching_cond_mode =
+        rellic::DecompilationOptions::ReachingCondMode::Dominators;
+  }
+  opts.reuse_region_conds = FLAGS_reuse_region_conds;
+  opts.cond_temp_threshold = FLAGS_cond_temp_threshold;
+  opts.wide_string_threshold = FLAGS_wide_string_threshold;
+  opts.debug_names_at_creation = FLAGS_debug_names_at_creation;
+  opts.simplify_light_nodes = FLAGS_simplify_light_nodes;
+  opts.simplify_max_nodes = FLAGS_simplify_max_nodes;
+  opts.pipeline = FLAGS_pipeline;
+  opts.adaptive_passes = FLAGS_adaptive_passes;
+  opts.pass_profile = pass_profile ? &*pass_profile : nullptr;
+  opts.record_pass_profile = recorded_profile ? &*recorded_profile : nullptr;
+  opts.alpha_cache = alpha_cache ? &*alpha_cache : nullptr;
+  opts.z3_query_log = z3_query_log ? &*z3_query_log : nullptr;
+  // Providers added last are asked first, so earlier libraries take
+  // precedence over later ones
+  for (auto it{type_libraries.rbegin()}; it != type_libraries.rend(); ++it) {
+    opts.additional_providers.push_back(
+        std::make_unique<rellic::TypeLibraryProviderFactory>(*it));
+  }
+  opts.cache_dir = FLAGS_cache_dir;
+  opts.cache_max_size = FLAGS_cache_max_size;
+  opts.preprocess_cache_dir = FLAGS_preprocess_cache_dir;
+  if (FLAGS_stream) {
+    opts.on_decls = [&output, exporter, index, flavors](
+                        llvm::ArrayRef<clang::Decl*> decls,
+                        const rellic::ProvenanceLookup& provenance) {
+      auto print_opts{GetPrintOptions(&provenance, exporter, index)};
+      if (flavors) {
+        PrintOutputs(output, print_opts, *flavors,
+                     [decls](llvm::raw_ostream& os,
+                             const rellic::PrintOptions& options) {
+                       rellic::PrintDecls(decls, os, options);
+                     });
+      } else {
+        rellic::PrintDecls(decls, output, print_opts);
+      }
+      output.flush();
+      // Entries are only written once the output they point to is
+      if (index) {
+        index->Flush();
+      }
+    };
+  }
+  return opts;
+}
+
+// Writes what `diff` found as a comment at the start of the output of
+// --diff_against
+static void PrintDiffSummary(llvm::raw_ostream& os,
+                             const rellic::ModuleDiff& diff) {
+  os << "/*\n * Compared with " << FLAGS_diff_against << ": "
+     << diff.unchanged.size() << " unchanged, " << diff.renamed.size()
+     << " renamed, " << diff.changed.size() << " changed, "
+     << diff.added.size() << " added, " << diff.removed.size()
+     << " removed\n";
+  auto List{[&os](const char* label, const std::vector<std::string>& names) {
+    for (auto& name : names) {
+      os << " * " << label << ": " << name << '\n';
+    }
+  }};
+  List("changed", diff.changed);
+  List("added", diff.added);
+  List("removed", diff.removed);
+  for (auto& [from, to] : diff.renamed) {
+    os << " * renamed: " << from << " -> " << to << '\n';
+  }
+  os << " */\n\n";
+}
+
+// Decompiles the functions of --diff_against that were changed or removed
+// since `diff` into --diff_previous_output
+static void DecompilePrevious(std::unique_ptr<llvm::Module> previous,
+                              const rellic::ModuleDiff& diff) {
+  std::error_code ec;
+  auto output_os{OpenOutputFile(FLAGS_diff_previous_output, ec)};
+  CHECK(!ec) << "Failed to create output file: " << ec.message();
+  auto& output{*output_os};
+  auto opts{GetOptions(output)};
+  opts.functions = diff.changed;
+  opts.functions.insert(opts.functions.end(), diff.removed.begin(),
+                        diff.removed.end());
+  if (opts.functions.empty()) {
+    return;
+  }
+  if (!opts.call_depth) {
+    opts.call_depth = 0;
+  }
+  auto result{rellic::Decompile(std::move(previous), opts)};
+  CHECK(result.Succeeded()) << FLAGS_diff_against << ": "
+                            << result.TakeError().message;
+  if (!FLAGS_stream) {
+    auto value{result.TakeValue()};
+    rellic::PrintTranslationUnit(value.ast->getASTContext(), output,
+                                 GetPrintOptions(nullptr, nullptr));
+  }
+}
+
+// Reports `progress` on standard error as a single line that is rewritten at
+// most a few times per second
+static void ShowProgress(rellic::Progress& progress) {
+  static constexpr std::chrono::milliseconds kInterval{100};
+  auto mutex{std::make_shared<std::mutex>()};
+  auto last{std::make_shared<std::chrono::steady_clock::time_point>()};
+  progress.on_update = [mutex, last](const rellic::Progress& progress) {
+    std::unique_lock<std::mutex> lock(*mutex, std::try_to_lock);
+    auto now{std::chrono::steady_clock::now()};
+    if (!lock || now - *last < kInterval) {
+      return;
+    }
+    *last = now;
+    auto stage{progress.stage.load()};
+    llvm::errs() << "\r\x1b[K" << (stage ? stage : "Decompiling") << ": "
+                 << progress.functions_generated << '/'
+                 << progress.functions_total << " functions structured, "
+                 << progress.functions_refined << " refined, iteration "
+                 << progress.iteration << ", " << progress.z3_calls
+                 << " Z3 queries";
+    llvm::errs().flush();
+  };
+}
+
+struct BatchResult {
+  std::string input;
+  bool succeeded = false;
+  // Whether it was cancelled by `--file_timeout` or `--function_timeout`
+  bool timed_out = false;
+  // Whether the worker of `--isolate` that decompiled it stopped without
+  // answering, after any retry
+  bool crashed = false;
+  std::string message;
+  std::chrono::duration<double> time{0};
+};
+
+// Returns the lines of `path`, except blank lines and lines starting with '#'
+static std::vector<std::string> ReadManifest(const std::string& path) {
+  auto manifest{llvm::MemoryBuffer::getFile(path)};
+  CHECK(manifest) << "Failed to read " << path << ": "
+                  << manifest.getError().message();
+  std::vector<std::string> entries;
+  llvm::SmallVector<llvm::StringRef, 16> lines;
+  manifest.get()->getBuffer().split(lines, '\n', -1, false);
+  for (auto line : lines) {
+    line = line.trim();
+    if (!line.empty() && !line.startswith("#")) {
+      entries.push_back(line.str());
+    }
+  }
+  return entries;
+}
+
+// Returns the bitcode files in `path` if it is a directory, or the files listed
+// in it otherwise
+static std::vector<std::string> GetBatchInputs(const std::string& path) {
+  std::vector<std::string> inputs;
+  if (llvm::sys::fs::is_directory(path)) {
+    std::error_code ec;
+    for (llvm::sys::fs::directory_iterator it(path, ec), end; it != end && !ec;
+         it.increment(ec)) {
+      if (llvm::sys::path::extension(it->path()) == ".bc") {
+        inputs.push_back(it->path());
+      }
+    }
+    CHECK(!ec) << "Failed to list " << path << ": " << ec.message();
+    std::sort(inputs.begin(), inputs.end());
+    return inputs;
+  }
+
+  return ReadManifest(path);
+}
+
+// Cancels the decompilations of `--batch` that exceed `--file_timeout`, or
+// that go for `--function_timeout` without finishing a function. Cancelling
+// interrupts the Z3 queries that are running, so that the worker is free again
+// soon after.
+class Watchdog {
+  using Clock = std::chrono::steady_clock;
+  static constexpr std::chrono::milliseconds kInterval{100};
+
+  struct Watched {
+    Clock::time_point start;
+    // When the number of functions done last changed, and that number
+    Clock::time_point last_change;
+    size_t last_done;
+    // Why the decompilation was cancelled, if it was
+    const char* reason;
+  };
+
+  std::mutex mutex;
+  std::condition_variable cv;
+  bool stop{false};
+  std::unordered_map<rellic::Progress*, Watched> watched;
+  std::thread thread;
+
+  static size_t GetDone(const rellic::Progress& progress) {
+    return progress.functions_generated + progress.functions_refined;
+  }
+
+  void Run() {
+    std::chrono::seconds file_timeout{FLAGS_file_timeout};
+    std::chrono::seconds function_timeout{FLAGS_function_timeout};
+    std::unique_lock<std::mutex> lock(mutex);
+    while (!cv.wait_for(lock, kInterval, [this] { return stop; })) {
+      auto now{Clock::now()};
+      for (auto& [progress, entry] : watched) {
+        if (entry.reason) {
+          continue;
+        }
+        auto done{GetDone(*progress)};
+        if (done != entry.last_done) {
+          entry.last_done = done;
+          entry.last_change = now;
+        }
+        if (file_timeout.count() && now - entry.start > file_timeout) {
+          entry.reason = "file timeout";
+        } else if (function_timeout.count() &&
+                   now - entry.last_change > function_timeout) {
+          entry.reason = "function timeout";
+        } else {
+          continue;
+        }
+        progress->Cancel();
+      }
+    }
+  }
+
+ public:
+  Watchdog() : thread([this] { Run(); }) {}
+
+  ~Watchdog() {
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      stop = true;
+    }
+    cv.notify_all();
+    thread.join();
+  }
+
+  void Watch(rellic::Progress& progress) {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto now{Clock::now()};
+    watched[&progress] = {now, now, GetDone(progress), nullptr};
+  }
+
+  // Stops watching `progress`, and returns why its decompilation was
+  // cancelled, or null if it was not
+  const char* Unwatch(rellic::Progress& progress) {
+    std::unique_lock<std::mutex> lock(mutex);
+    auto reason{watched[&progress].reason};
+    watched.erase(&progress);
+    return reason;
+  }
+};
+
+// Loads `input` into `ctx` for `Decompile` to be called with `opts`. With
+// `--preprocess_cache_dir`, it is selected and preprocessed here, or read
+// already preprocessed from the cache.
+static std::unique_ptr<llvm::Module> LoadInput(
+    llvm::LLVMContext& ctx, const std::string& input,
+    const rellic::DecompilationOptions& opts, bool allow_failure) {
+  if (opts.preprocess_cache_dir.empty()) {
+    return std::unique_ptr<llvm::Module>(
+        rellic::LoadModuleFromFile(&ctx, input, allow_failure,
+                                   /*lazy=*/!opts.functions.empty()));
+  }
+  auto buffer{llvm::MemoryBuffer::getFileOrSTDIN(input)};
+  if (!buffer) {
+    CHECK(allow_failure) << "Cannot read " << input << ": "
+                         << buffer.getError().message();
+    return nullptr;
+  }
+  try {
+    auto module{rellic::LoadPreprocessedModule(
+        ctx, buffer.get()->getMemBufferRef(), opts)};
+    CHECK(module || allow_failure) << "Cannot load " << input;
+    return module;
+  } catch (rellic::Exception& ex) {
+    CHECK(allow_failure) << ex.what();
+    return nullptr;
+  }
+}
+
+// Decompiles `input` into a .c file next to it. A file that is `conservative`
+// is decompiled with `--crash_retry_pipeline`, switches lowered and phi nodes
+// removed, which avoids the paths of the decompiler that crash the most.
+static BatchResult DecompileFile(const std::string& input, Watchdog* watchdog,
+                                 bool conservative = false) {
+  rellic::TraceThread trace_thread;
+  llvm::TimeTraceScope trace("DecompileFile", input);
+  rellic::ActivityScope activity("input", input);
+  if (conservative) {
+    rellic::SetActivityDetail("conservative");
+  }
+  BatchResult res{};
+  res.input = input;
+  auto start{std::chrono::steady_clock::now()};
+
+  llvm::SmallString<128> output_path{input};
+  llvm::sys::path::replace_extension(output_path, "c");
+  std::error_code ec;
+  llvm::raw_fd_ostream output(output_path, ec);
+  if (ec) {
+    res.message = "cannot create " + output_path.str().str() + ": " +
+                  ec.message();
+    res.time = std::chrono::steady_clock::now() - start;
+    return res;
+  }
+
+  auto options{GetOptions(output)};
+  if (conservative) {
+    options.lower_switches = true;
+    options.remove_phi_nodes = true;
+    options.pipeline = FLAGS_crash_retry_pipeline;
+  }
+
+  // Loaded once the options are known, since they decide how it is
+  // preprocessed
+  llvm::LLVMContext llvm_ctx;
+  auto module{LoadInput(llvm_ctx, input, options, /*allow_failure=*/true)};
+  if (!module) {
+    output.close();
+    llvm::sys::fs::remove(output_path);
+    res.message = "cannot load module";
+    res.time = std::chrono::steady_clock::now() - start;
+    return res;
+  }
+
+  rellic::Progress progress;
+  const char* timeout{nullptr};
+  if (watchdog) {
+    options.progress = &progress;
+    watchdog->Watch(progress);
+  }
+  auto result{rellic::Decompile(std::move(module), options)};
+  if (watchdog) {
+    timeout = watchdog->Unwatch(progress);
+    res.timed_out = timeout != nullptr;
+  }
+  if (result.Succeeded()) {
+    auto value{result.TakeValue()};
+    if (!FLAGS_stream) {
+      rellic::PrintTranslationUnit(value.ast->getASTContext(), output,
+                                   GetPrintOptions(nullptr, nullptr));
+    }
+    res.succeeded = !timeout;
+    if (timeout) {
+      res.message = std::string("cancelled by the ") + timeout +
+                    ", output is partial";
+    } else if (!value.degraded_functions.empty()) {
+      res.message = std::to_string(value.degraded_functions.size()) +
+                    " functions not fully refined";
+    }
+  } else {
+    res.message = result.TakeError().message;
+  }
+  res.time = std::chrono::steady_clock::now() - start;
+  return res;
+}
+
+// Answers the parent of `--isolate` until standard input is closed. Each
+// request is a JSON object with the `input` to decompile and whether to do so
+// `conservative`ly, and is answered with its `BatchResult` on a line of
+// standard output. Timeouts are enforced here, since the flags are the same.
+static void RunBatchWorker() {
+  std::optional<Watchdog> watchdog;
+  if (FLAGS_file_timeout || FLAGS_function_timeout) {
+    watchdog.emplace();
+  }
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    auto request{llvm::json::parse(line)};
+    CHECK(request) << "Invalid request: "
+                   << llvm::toString(request.takeError());
+    auto obj{request->getAsObject()};
+    auto input{obj ? obj->getString("input") : std::nullopt};
+    CHECK(input) << "Expected the path of the input in `input`";
+    auto res{DecompileFile(input->str(), watchdog ? &*watchdog : nullptr,
+                           obj->getBoolean("conservative").value_or(false))};
+    llvm::json::Object response{{"succeeded", res.succeeded},
+                                {"timed_out", res.timed_out},
+                                {"message", res.message},
+                                {"time", res.time.count()}};
+    llvm::outs() << llvm::json::Value(std::move(response)) << '\n';
+    llvm::outs().flush();
+  }
+}
+
+extern char** environ;
+
+// A child process running `--batch_worker` with the flags of this one, which
+// decompiles the files it is sent over a pipe one at a time. It is started on
+// the first request, and again on the one after it stops.
+class WorkerProcess {
+  pid_t pid{-1};
+  // Standard input and output of the worker
+  int requests{-1};
+  int responses{-1};
+
+  static bool Spawn(pid_t& pid, int& requests, int& responses) {
+    // Serialized so that no worker inherits the pipes of another, which would
+    // keep it from seeing its standard input closed
+    static std::mutex spawn_mutex;
+    static const std::string path{llvm::sys::fs::getMainExecutable(
+        google::GetArgv0(), reinterpret_cast<void*>(&RunBatchWorker))};
+    std::unique_lock<std::mutex> lock(spawn_mutex);
+
+    int to_child[2];
+    int from_child[2];
+    if (pipe(to_child)) {
+      return false;
+    }
+    if (pipe(from_child)) {
+      close(to_child[0]);
+      close(to_child[1]);
+      return false;
+    }
+    for (auto fd : {to_child[0], to_child[1], from_child[0], from_child[1]}) {
+      fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+
+    std::vector<std::string> args{google::GetArgvs()};
+    args.push_back("--batch_worker");
+    std::vector<char*> argv;
+    for (auto& arg : args) {
+      argv.push_back(arg.data());
+    }
+    argv.push_back(nullptr);
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_adddup2(&actions, to_child[0], STDIN_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, from_child[1], STDOUT_FILENO);
+    auto err{posix_spawn(&pid, path.c_str(), &actions, nullptr, argv.data(),
+                         environ)};
+    posix_spawn_file_actions_destroy(&actions);
+    close(to_child[0]);
+    close(from_child[1]);
+    if (err) {
+      LOG(ERROR) << "Cannot start a worker from " << path << ": "
+                 << std::strerror(err);
+      close(to_child[1]);
+      close(from_child[0]);
+      return false;
+    }
+    requests = to_child[1];
+    responses = from_child[0];
+    return true;
+  }
+
+  bool Write(llvm::StringRef data) {
+    while (!data.empty()) {
+      auto written{write(requests, data.data(), data.size())};
+      if (written < 0 && errno == EINTR) {
+        continue;
+      }
+      if (written <= 0) {
+        return false;
+      }
+      data = data.drop_front(written);
+    }
+    return true;
+  }
+
+  // Reads a line of the worker, which are short enough to be read a byte at a
+  // time
+  bool ReadLine(std::string& line) {
+    line.clear();
+    char c;
+    while (true) {
+      auto read_bytes{read(responses, &c, 1)};
+      if (read_bytes < 0 && errno == EINTR) {
+        continue;
+      }
+      if (read_bytes <= 0) {
+        return false;
+      }
+      if (c == '\n') {
+        return true;
+      }
+      line += c;
+    }
+  }
+
+  // Waits for the worker to exit, killing it first if `kill_it`, and
+  // describes how it did
+  std::string Stop(bool kill_it) {
+    close(requests);
+    close(responses);
+    if (kill_it) {
+      kill(pid, SIGKILL);
+    }
+    int status{0};
+    while (waitpid(pid, &status, 0) < 0 && errno == EINTR) {
+    }
+    pid = -1;
+    if (WIFSIGNALED(status)) {
+      auto signal{WTERMSIG(status)};
+      return "killed by signal " + std::to_string(signal) + " (" +
+             strsignal(signal) + ")";
+    }
+    return "exited with status " + std::to_string(WEXITSTATUS(status));
+  }
+
+ public:
+  WorkerProcess() = default;
+  WorkerProcess(const WorkerProcess&) = delete;
+  WorkerProcess& operator=(const WorkerProcess&) = delete;
+
+  ~WorkerProcess() {
+    if (pid >= 0) {
+      // The worker exits once its standard input is closed
+      Stop(/*kill_it=*/false);
+    }
+  }
+
+  // Decompiles `input` on the worker. The result is `crashed` if it stopped
+  // without answering.
+  BatchResult Decompile(const std::string& input, bool conservative) {
+    BatchResult res{};
+    res.input = input;
+    auto start{std::chrono::steady_clock::now()};
+    if (pid < 0 && !Spawn(pid, requests, responses)) {
+      res.message = "cannot start a worker";
+      return res;
+    }
+    // Where the worker is stuck is dumped by sending it the signal too
+    rellic::ActivityScope activity("input", input);
+    rellic::SetActivityDetail("worker " + std::to_string(pid));
+
+    std::string line;
+    llvm::raw_string_ostream(line)
+        << llvm::json::Value(llvm::json::Object{
+               {"input", input}, {"conservative", conservative}})
+        << '\n';
+    if (Write(line) && ReadLine(line)) {
+      auto response{llvm::json::parse(line)};
+      auto obj{response ? response->getAsObject() : nullptr};
+      if (obj) {
+        res.succeeded = obj->getBoolean("succeeded").value_or(false);
+        res.timed_out = obj->getBoolean("timed_out").value_or(false);
+        res.message = obj->getString("message").value_or("").str();
+        res.time = std::chrono::duration<double>(
+            obj->getNumber("time").value_or(0));
+        return res;
+      }
+      if (!response) {
+        llvm::consumeError(response.takeError());
+      }
+      res.crashed = true;
+      res.message = "worker answered `" + line + "` and was " +
+                    Stop(/*kill_it=*/true);
+    } else {
+      res.crashed = true;
+      res.message = "worker " + Stop(/*kill_it=*/false);
+    }
+    res.time = std::chrono::steady_clock::now() - start;
+    return res;
+  }
+};
+
+// Decompiles `input` on `worker`, and once more with the conservative options
+// of `--crash_retry_pipeline` if the worker crashed
+static BatchResult DecompileIsolated(WorkerProcess& worker,
+                                     const std::string& input) {
+  auto res{worker.Decompile(input, /*conservative=*/false)};
+  if (!res.crashed || FLAGS_crash_retry_pipeline.empty()) {
+    return res;
+  }
+  LOG(WARNING) << input << ": " << res.message << ", retrying with pipeline "
+               << FLAGS_crash_retry_pipeline;
+  auto crash{std::move(res.message)};
+  auto time{res.time};
+  res = worker.Decompile(input, /*conservative=*/true);
+  res.time += time;
+  res.message = crash + ", retried with pipeline " +
+                FLAGS_crash_retry_pipeline +
+                (res.message.empty() ? "" : ": " + res.message);
+  return res;
+}
+
+// Decompiles the inputs of `--batch` on `--batch_workers` threads, or worker
+// processes with `--isolate`, and prints a summary. Returns the number of
+// failures.
+static unsigned RunBatch() {
+  auto inputs{GetBatchInputs(FLAGS_batch)};
+  std::vector<BatchResult> results(inputs.size());
+  auto start{std::chrono::steady_clock::now()};
+  std::optional<Watchdog> watchdog;
+  if (!FLAGS_isolate && (FLAGS_file_timeout || FLAGS_function_timeout)) {
+    watchdog.emplace();
+  }
+  auto num_workers{FLAGS_batch_workers
+                       ? FLAGS_batch_workers
+                       : llvm::hardware_concurrency().compute_thread_count()};
+  if (FLAGS_isolate) {
+    // Writing to a worker that just crashed must not end this process
+    signal(SIGPIPE, SIG_IGN);
+    std::atomic<size_t> next{0};
+    std::vector<std::thread> threads;
+    for (auto i{0U}; i < num_workers; ++i) {
+      threads.emplace_back([&inputs, &results, &next] {
+        WorkerProcess worker;
+        for (size_t index; (index = next++) < inputs.size();) {
+          results[index] = DecompileIsolated(worker, inputs[index]);
+        }
+      });
+    }
+    for (auto& thread : threads) {
+      thread.join();
+    }
+  } else {
+    llvm::ThreadPool pool(llvm::hardware_concurrency(num_workers));
+    for (auto i{0U}; i < inputs.size(); ++i) {
+      pool.async([&input = inputs[i], &res = results[i], &watchdog] {
+        res = DecompileFile(input, watchdog ? &*watchdog : nullptr);
+      });
+    }
+    pool.wait();
+  }
+  std::chrono::duration<double> elapsed{std::chrono::steady_clock::now() -
+                                        start};
+
+  unsigned failures{0};
+  unsigned timeouts{0};
+  unsigned crashes{0};
+  for (auto& res : results) {
+    failures += !res.succeeded;
+    timeouts += res.timed_out;
+    crashes += res.crashed;
+    std::cout << (res.succeeded ? "ok   " : res.timed_out ? "TIME " : "FAIL ")
+              << res.time.count() << "s " << res.input;
+    if (!res.message.empty()) {
+      std::cout << ": " << res.message;
+    }
+    std::cout << std::endl;
+  }
+  std::cout << results.size() - failures << " succeeded, " << failures
+            << " failed";
+  if (timeouts) {
+    std::cout << ", " << timeouts << " timed out";
+  }
+  if (crashes) {
+    std::cout << ", " << crashes << " crashed";
+  }
+  std::cout << " in " << elapsed.count() << "s" << std::endl;
+  return failures;
+}
+
+// Returns how the outputs of `--link` next to `input` include `--header`:
+// by file name if it is in the same directory, otherwise by absolute path
+static std::string GetHeaderInclude(const std::string& input) {
+  llvm::SmallString<128> header{FLAGS_header};
+  llvm::sys::fs::make_absolute(header);
+  llvm::SmallString<128> input_path{input};
+  llvm::sys::fs::make_absolute(input_path);
+  if (llvm::sys::path::parent_path(header) ==
+      llvm::sys::path::parent_path(input_path)) {
+    return llvm::sys::path::filename(header).str();
+  }
+  return header.str().str();
+}
+
+// Links the inputs of `--link` and decompiles them as a single module, so
+// that what they share is generated once. Definitions of external functions
+// and variables are declared in `--header`, along with the types and the
+// declarations of everything else, and defined in the output of the input
+// they come from. Internal definitions only appear in that output. Returns
+// whether it succeeded.
+static bool RunLink() {
+  auto inputs{GetBatchInputs(FLAGS_link)};
+  CHECK(!inputs.empty()) << "No inputs in " << FLAGS_link;
+  llvm::LLVMContext llvm_ctx;
+  std::vector<std::unique_ptr<llvm::Module>> modules;
+  for (auto& input : inputs) {
+    modules.emplace_back(rellic::LoadModuleFromFile(&llvm_ctx, input));
+  }
+  std::unordered_map<std::string, size_t> origins;
+  auto module{rellic::LinkModules(std::move(modules), origins)};
+
+  auto opts{GetOptions(llvm::nulls())};
+  // Needed to tell which input each declaration comes from
+  opts.provenance = true;
+  auto result{rellic::Decompile(std::move(module), opts)};
+  if (!result.Succeeded()) {
+    LOG(ERROR) << result.TakeError().message;
+    return false;
+  }
+  auto value{result.TakeValue()};
+  for (auto& name : value.degraded_functions) {
+    LOG(WARNING) << "Function " << name << " was not fully refined";
+  }
+
+  std::vector<clang::Decl*> shared;
+  std::vector<std::vector<clang::Decl*>> prototypes(inputs.size());
+  std::vector<std::vector<clang::Decl*>> definitions(inputs.size());
+  auto tudecl{value.ast->getASTContext().getTranslationUnitDecl()};
+  for (auto decl : tudecl->decls()) {
+    auto vdecl{clang::dyn_cast<clang::ValueDecl>(decl)};
+    auto global{llvm::dyn_cast_or_null<llvm::GlobalValue>(
+        vdecl ? value.value_decls.LookupInverse(vdecl) : nullptr)};
+    auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+    auto var{clang::dyn_cast<clang::VarDecl>(decl)};
+    auto defined{(fdecl && fdecl->doesThisDeclarationHaveABody()) ||
+                 (var && var->hasInit())};
+    auto origin{global && defined ? origins.find(global->getName().str())
+                                  : origins.end()};
+    if (origin == origins.end()) {
+      shared.push_back(decl);
+      continue;
+    }
+    definitions[origin->second].push_back(decl);
+    if (!global->hasLocalLinkage()) {
+      shared.push_back(decl);
+    } else if (fdecl) {
+      // Static functions may be called before they are defined
+      prototypes[origin->second].push_back(decl);
+    }
+  }
+
+  std::error_code ec;
+  {
+    llvm::raw_fd_ostream header(FLAGS_header, ec);
+    if (ec) {
+      LOG(ERROR) << "Failed to create " << FLAGS_header << ": "
+                 << ec.message();
+      return false;
+    }
+    header << "#pragma once\n\n";
+    rellic::PrintDeclarations(shared, header);
+  }
+
+  auto print_opts{GetPrintOptions(nullptr, nullptr)};
+  auto succeeded{true};
+  for (size_t i{0}; i < inputs.size(); ++i) {
+    llvm::SmallString<128> output_path{inputs[i]};
+    llvm::sys::path::replace_extension(output_path, "c");
+    llvm::raw_fd_ostream output(output_path, ec);
+    if (ec) {
+      LOG(ERROR) << "Failed to create " << output_path.str().str() << ": "
+                 << ec.message();
+      succeeded = false;
+      continue;
+    }
+    output << "#include \"" << GetHeaderInclude(inputs[i]) << "\"\n\n";
+    if (!prototypes[i].empty()) {
+      rellic::PrintDeclarations(prototypes[i], output);
+      output << '\n';
+    }
+    rellic::PrintDecls(definitions[i], output, print_opts);
+  }
+  return succeeded;
+}
+
+// Decompiles the module at `input` of `request`, or encoded in base64 in
+// `bitcode`, or only the functions listed in `functions`, with the options
+// given on the command line. Answers with the C source in `code` unless it is
+// false, the provenance of its ranges in `provenance` if requested, and the
+// functions that were not fully refined, or with an `error`. The `id` of the
+// request, if any, is sent back.
+//
+// Work units of `--workers` also have a `cache_key`. They are answered with
+// `cached` if the function cache already holds it, and fail if decompiling
+// them did not store it.
+static llvm::json::Object ServeRequest(const llvm::json::Object& request) {
+  llvm::json::Object response;
+  if (auto id = request.get("id")) {
+    response["id"] = *id;
+  }
+  auto input{request.getString("input")};
+  auto bitcode{request.getString("bitcode")};
+  if (!input && !bitcode) {
+    response["error"] =
+        "Expected the path of the input in `input`, or bitcode in `bitcode`";
+    return response;
+  }
+  auto cache_key{request.getString("cache_key")};
+  if (cache_key && FLAGS_cache_dir.empty()) {
+    response["error"] = "Work units need a --cache_dir";
+    return response;
+  }
+  // Only used to look up entries, which does not depend on the options
+  rellic::FunctionCache cache(FLAGS_cache_dir, 0, "");
+  if (cache_key && cache.Contains(cache_key->str())) {
+    response["cached"] = true;
+    return response;
+  }
+  std::vector<std::string> functions;
+  if (auto names = request.getArray("functions")) {
+    for (auto& name : *names) {
+      if (auto str = name.getAsString()) {
+        functions.push_back(str->str());
+      }
+    }
+  }
+
+  // Every module gets a context of its own, since struct type names would be
+  // renamed to stay unique within a shared one
+  llvm::LLVMContext llvm_ctx;
+  std::unique_ptr<llvm::Module> module;
+  if (bitcode) {
+    std::vector<char> data;
+    if (auto err = llvm::decodeBase64(*bitcode, data)) {
+      response["error"] = "Invalid bitcode: " + llvm::toString(std::move(err));
+      return response;
+    }
+    auto parsed{llvm::parseBitcodeFile(
+        llvm::MemoryBufferRef(llvm::StringRef(data.data(), data.size()),
+                              "bitcode"),
+        llvm_ctx)};
+    if (!parsed) {
+      response["error"] =
+          "Cannot load bitcode: " + llvm::toString(parsed.takeError());
+      return response;
+    }
+    module = std::move(*parsed);
+  } else {
+    module.reset(rellic::LoadModuleFromFile(&llvm_ctx, input->str(),
+                                            /*allow_failure=*/true,
+                                            /*lazy=*/!functions.empty()));
+    if (!module) {
+      response["error"] = "Cannot load " + input->str();
+      return response;
+    }
+  }
+
+  std::string code;
+  std::string provenance_lines;
+  llvm::raw_string_ostream output(code);
+  llvm::raw_string_ostream provenance_os(provenance_lines);
+  std::optional<rellic::ProvenanceExporter> exporter;
+  if (request.getBoolean("provenance").value_or(false)) {
+    exporter.emplace(provenance_os);
+  }
+  auto exporter_ptr{exporter ? &*exporter : nullptr};
+  auto opts{GetOptions(output, exporter_ptr)};
+  opts.functions = std::move(functions);
+  auto result{rellic::Decompile(std::move(module), opts)};
+  if (!result.Succeeded()) {
+    response["error"] = result.TakeError().message;
+    return response;
+  }
+
+  if (cache_key && !cache.Contains(cache_key->str())) {
+    response["error"] =
+        "The function was not cached under " + cache_key->str() +
+        ", the cache directory or the options of the worker may differ";
+    return response;
+  }
+
+  auto value{result.TakeValue()};
+  if (request.getBoolean("code").value_or(true)) {
+    if (!FLAGS_stream) {
+      rellic::ResultProvenance provenance{value};
+      rellic::PrintTranslationUnit(value.ast->getASTContext(), output,
+                                   GetPrintOptions(&provenance, exporter_ptr));
+    }
+    output.flush();
+    response["code"] = std::move(code);
+  }
+  if (exporter) {
+    provenance_os.flush();
+    llvm::SmallVector<llvm::StringRef, 16> lines;
+    llvm::StringRef(provenance_lines).split(lines, '\n', -1, false);
+    llvm::json::Array ranges;
+    for (auto line : lines) {
+      auto range{llvm::json::parse(line)};
+      CHECK(range) << "Invalid provenance: "
+                   << llvm::toString(range.takeError());
+      ranges.push_back(std::move(*range));
+    }
+    response["provenance"] = std::move(ranges);
+  }
+  llvm::json::Array degraded;
+  for (auto& name : value.degraded_functions) {
+    degraded.push_back(name);
+  }
+  response["degraded_functions"] = std::move(degraded);
+  return response;
+}
+
+// Answers the requests of `--server` until standard input is closed. Process
+// startup and the set up of Clang are only paid once, and the translation unit
+// templates of `ASTUnitFactory` and the decompilation cache stay warm.
+static void RunServer() {
+  std::string line;
+  while (std::getline(std::cin, line)) {
+    if (llvm::StringRef(line).trim().empty()) {
+      continue;
+    }
+    llvm::json::Object response;
+    auto request{llvm::json::parse(line)};
+    if (!request) {
+      response["error"] = llvm::toString(request.takeError());
+    } else if (auto obj = request->getAsObject()) {
+      response = ServeRequest(*obj);
+    } else {
+      response["error"] = "Expected a JSON object";
+    }
+    llvm::outs() << llvm::json::Value(std::move(response)) << '\n';
+    llvm::outs().flush();
+  }
+}
+
+// Sends `share` of `units` to a worker started by the shell `command` and
+// marks the ones it decompiled in `done`. The requests are written to a file
+// in `dir` that is the standard input of the worker, which answers in another.
+static void RunWorker(const std::string& command, llvm::StringRef shell,
+                      const std::vector<size_t>& share,
+                      const std::vector<rellic::WorkUnit>& units,
+                      llvm::StringRef dir, unsigned index,
+                      std::vector<char>& done) {
+  llvm::SmallString<128> requests_path{dir};
+  llvm::sys::path::append(requests_path,
+                          "worker-" + std::to_string(index) + ".in");
+  llvm::SmallString<128> responses_path{dir};
+  llvm::sys::path::append(responses_path,
+                          "worker-" + std::to_string(index) + ".out");
+  {
+    std::error_code ec;
+    llvm::raw_fd_ostream requests(requests_path, ec);
+    CHECK(!ec) << "Failed to create " << requests_path.str().str() << ": "
+               << ec.message();
+    for (auto i : share) {
+      auto& unit{units[i]};
+      llvm::json::Object request{{"id", static_cast<int64_t>(i)},
+                                 {"bitcode", llvm::encodeBase64(unit.bitcode)},
+                                 {"cache_key", unit.cache_key},
+                                 {"code", false}};
+      requests << llvm::json::Value(std::move(request)) << '\n';
+    }
+  }
+
+  std::string message;
+  std::optional<llvm::StringRef> redirects[]{
+      llvm::StringRef(requests_path), llvm::StringRef(responses_path),
+      std::nullopt};
+  auto status{llvm::sys::ExecuteAndWait(shell, {shell, "-c", command},
+                                        std::nullopt, redirects, 0, 0,
+                                        &message)};
+  LOG_IF(WARNING, status) << "Worker `" << command << "` exited with status "
+                          << status << (message.empty() ? "" : ": ")
+                          << message;
+
+  // Whatever a worker answered before stopping still counts
+  auto responses{llvm::MemoryBuffer::getFile(responses_path)};
+  if (!responses) {
+    return;
+  }
+  llvm::SmallVector<llvm::StringRef, 16> lines;
+  responses.get()->getBuffer().split(lines, '\n', -1, false);
+  for (auto line : lines) {
+    auto response{llvm::json::parse(line)};
+    if (!response) {
+      llvm::consumeError(response.takeError());
+      continue;
+    }
+    auto obj{response->getAsObject()};
+    auto id{obj ? obj->getInteger("id") : std::nullopt};
+    if (!id || *id < 0 || static_cast<size_t>(*id) >= units.size()) {
+      continue;
+    }
+    if (auto error = obj->getString("error")) {
+      LOG(WARNING) << "Worker `" << command << "` failed to decompile "
+                   << units[*id].function << ": " << error->str();
+      continue;
+    }
+    done[*id] = true;
+  }
+}
+
+// Decompiles the functions of `module` on the workers of `--workers`, which
+// store them in the function cache shared with this process, so that
+// `Decompile` assembles the translation unit, its types and provenance from
+// the cache in module order as usual. Each worker is sent its share of the
+// work units at once. Units that fail, including those of workers that stop,
+// are sent to the next worker, up to `--work_unit_retries` times, and are
+// decompiled locally after that.
+static void DistributeWork(llvm::Module& module,
+                           const rellic::DecompilationOptions& opts) {
+  llvm::TimeTraceScope trace("DistributeWork");
+  auto commands{ReadManifest(FLAGS_workers)};
+  CHECK(!commands.empty()) << "No worker commands in " << FLAGS_workers;
+  auto shell{llvm::sys::findProgramByName("sh")};
+  CHECK(shell) << "Cannot find sh to start workers";
+  llvm::SmallString<128> dir;
+  auto ec{llvm::sys::fs::createUniqueDirectory("rellic-work", dir)};
+  CHECK(!ec) << "Failed to create a work directory: " << ec.message();
+
+  auto units{rellic::SplitModule(module, opts)};
+  std::vector<size_t> pending(units.size());
+  std::iota(pending.begin(), pending.end(), 0);
+  std::vector<char> done(units.size(), false);
+  for (auto attempt{0U}; !pending.empty() && attempt <= FLAGS_work_unit_retries;
+       ++attempt) {
+    // Rotated on every attempt, so that units are retried on another worker
+    std::vector<std::vector<size_t>> shares(commands.size());
+    for (size_t i{0}; i < pending.size(); ++i) {
+      shares[(i + attempt) % commands.size()].push_back(pending[i]);
+    }
+    {
+      llvm::ThreadPool pool(llvm::hardware_concurrency(commands.size()));
+      for (auto i{0U}; i < commands.size(); ++i) {
+        if (!shares[i].empty()) {
+          pool.async([&, i] {
+            RunWorker(commands[i], *shell, shares[i], units, dir, i, done);
+          });
+        }
+      }
+      pool.wait();
+    }
+    pending.erase(std::remove_if(pending.begin(), pending.end(),
+                                 [&done](size_t i) { return done[i]; }),
+                  pending.end());
+  }
+  LOG_IF(WARNING, !pending.empty())
+      << pending.size() << " functions failed on every worker and are "
+      << "decompiled locally";
+
+  ec = llvm::sys::fs::remove_directories(dir);
+  LOG_IF(WARNING, ec) << "Failed to remove " << dir.str().str() << ": "
+                      << ec.message();
+}
+
 int main(int argc, char* argv[]) {
   std::stringstream usage;
   usage << std::endl
@@ -87,6 +1568,21 @@ int main(int argc, char* argv[]) {
         << "  " << argv[0] << " \\" << std::endl
         << "    --input INPUT_BC_FILE \\" << std::endl
         << "    --output OUTPUT_C_FILE \\" << std::endl
+        << "    [--diff_against PREVIOUS_BC_FILE \\" << std::endl
+        << "     [--diff_previous_output PREVIOUS_C_FILE]] \\" << std::endl
+        << std::endl
+        << "  " << argv[0] << " \\" << std::endl
+        << "    --batch DIRECTORY_OR_MANIFEST \\" << std::endl
+        << "    [--batch_workers NUM_THREADS] \\" << std::endl
+        << "    [--file_timeout SECONDS] [--function_timeout SECONDS] \\"
+        << std::endl
+        << "    [--isolate [--crash_retry_pipeline PIPELINE]] \\" << std::endl
+        << std::endl
+        << "  " << argv[0] << " \\" << std::endl
+        << "    --link DIRECTORY_OR_MANIFEST \\" << std::endl
+        << "    --header OUTPUT_H_FILE \\" << std::endl
+        << std::endl
+        << "  " << argv[0] << " --server" << std::endl
         << std::endl
 
         // Print the version and exit.
@@ -99,37 +1595,275 @@ int main(int argc, char* argv[]) {
   SetVersion();
   google::ParseCommandLineFlags(&argc, &argv, true);
 
+  if (!rellic::SetLogCategories(FLAGS_log_categories)) {
+    LOG(ERROR) << "Unknown category in --log_categories="
+               << FLAGS_log_categories;
+    std::cerr << google::ProgramUsage();
+    return EXIT_FAILURE;
+  }
+  // Tells where a long job is without attaching a debugger
+  rellic::DumpActivityOnSignal(SIGUSR1);
+  if (FLAGS_hardware_counters && !rellic::EnableHardwareCounters()) {
+    LOG(WARNING) << "Hardware counters are not available on this system";
+  }
+
+  if (FLAGS_batch_worker) {
+    // Only the supervisor records, the flags are passed on as they are
+    FLAGS_record_pass_profile.clear();
+  }
+  if (!LoadPassProfiles() || !LoadTypeLibraries()) {
+    return EXIT_FAILURE;
+  }
+  if (FLAGS_alpha_cache) {
+    alpha_cache.emplace();
+  }
+  if (!FLAGS_z3_query_log.empty()) {
+    auto path{FLAGS_z3_query_log};
+    if (FLAGS_batch_worker) {
+      // Workers run side by side, each with its own log
+      path += "." + std::to_string(getpid());
+    }
+    try {
+      z3_query_log.emplace(path);
+    } catch (rellic::Exception& ex) {
+      LOG(ERROR) << ex.what();
+      return EXIT_FAILURE;
+    }
+  }
+
+  if (FLAGS_batch_worker) {
+    RunBatchWorker();
+
+    google::ShutDownCommandLineFlags();
+    google::ShutdownGoogleLogging();
+    return EXIT_SUCCESS;
+  }
+
+  if (FLAGS_server) {
+    auto conflicting{!FLAGS_input.empty() || !FLAGS_output.empty() ||
+                     !FLAGS_provenance.empty() || !FLAGS_batch.empty() ||
+                     !FLAGS_functions.empty() || !FLAGS_stats.empty() ||
+                     FLAGS_report || !FLAGS_workers.empty() ||
+                     FLAGS_progress || !FLAGS_record_pass_profile.empty() ||
+                     !FLAGS_hex_output.empty() || !FLAGS_html_output.empty() ||
+                     !FLAGS_diff_against.empty()};
+    LOG_IF(ERROR, conflicting)
+        << "--server cannot be combined with --input, --output, --provenance, "
+           "--batch, --functions, --stats, --report, --workers, --progress, "
+           "--record_pass_profile, --hex_output, --html_output or "
+           "--diff_against.";
+    if (conflicting) {
+      std::cerr << google::ProgramUsage();
+      return EXIT_FAILURE;
+    }
+
+    RunServer();
+
+    google::ShutDownCommandLineFlags();
+    google::ShutdownGoogleLogging();
+    return EXIT_SUCCESS;
+  }
+
+  if (!FLAGS_link.empty()) {
+    auto conflicting{!FLAGS_input.empty() || !FLAGS_output.empty() ||
+                     !FLAGS_provenance.empty() || !FLAGS_batch.empty() ||
+                     !FLAGS_workers.empty() || FLAGS_stream ||
+                     !FLAGS_hex_output.empty() || !FLAGS_html_output.empty() ||
+                     !FLAGS_diff_against.empty()};
+    LOG_IF(ERROR, conflicting)
+        << "--link cannot be combined with --input, --output, --provenance, "
+           "--batch, --workers, --stream, --hex_output, --html_output or "
+           "--diff_against.";
+    LOG_IF(ERROR, FLAGS_header.empty())
+        << "--link needs a --header to write shared declarations to.";
+    if (conflicting || FLAGS_header.empty()) {
+      std::cerr << google::ProgramUsage();
+      return EXIT_FAILURE;
+    }
+
+    if (!FLAGS_trace.empty()) {
+      rellic::StartTracing(FLAGS_trace_granularity, argv[0]);
+    }
+    auto succeeded{RunLink()};
+    if (!FLAGS_trace.empty()) {
+      rellic::StopTracing(FLAGS_trace);
+    }
+    SaveRecordedProfile();
+
+    google::ShutDownCommandLineFlags();
+    google::ShutdownGoogleLogging();
+    return succeeded ? EXIT_SUCCESS : EXIT_FAILURE;
+  }
+
+  if (!FLAGS_batch.empty()) {
+    auto conflicting{!FLAGS_input.empty() || !FLAGS_output.empty() ||
+                     !FLAGS_provenance.empty() || !FLAGS_workers.empty() ||
+                     !FLAGS_hex_output.empty() || !FLAGS_html_output.empty() ||
+                     !FLAGS_diff_against.empty()};
+    LOG_IF(ERROR, conflicting)
+        << "--batch cannot be combined with --input, --output, --provenance, "
+           "--workers, --hex_output, --html_output or --diff_against.";
+    auto unrecorded{FLAGS_isolate && !FLAGS_record_pass_profile.empty()};
+    LOG_IF(ERROR, unrecorded)
+        << "--record_pass_profile cannot record the workers of --isolate.";
+    if (conflicting || unrecorded) {
+      std::cerr << google::ProgramUsage();
+      return EXIT_FAILURE;
+    }
+
+    if (!FLAGS_trace.empty()) {
+      rellic::StartTracing(FLAGS_trace_granularity, argv[0]);
+    }
+    auto failures{RunBatch()};
+    if (!FLAGS_trace.empty()) {
+      rellic::StopTracing(FLAGS_trace);
+    }
+    SaveRecordedProfile();
+
+    google::ShutDownCommandLineFlags();
+    google::ShutdownGoogleLogging();
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
   LOG_IF(ERROR, FLAGS_input.empty())
       << "Must specify the path to an input LLVM bitcode file.";
 
   LOG_IF(ERROR, FLAGS_output.empty())
       << "Must specify the path to an output C file.";
 
-  if (FLAGS_input.empty() || FLAGS_output.empty()) {
+  LOG_IF(ERROR, !FLAGS_workers.empty() && FLAGS_cache_dir.empty())
+      << "--workers needs a --cache_dir shared with the workers.";
+
+  auto diff_conflicting{!FLAGS_diff_against.empty() &&
+                        (!FLAGS_functions.empty() || !FLAGS_workers.empty())};
+  LOG_IF(ERROR, diff_conflicting)
+      << "--diff_against cannot be combined with --functions or --workers.";
+  auto diff_missing{!FLAGS_diff_previous_output.empty() &&
+                    FLAGS_diff_against.empty()};
+  LOG_IF(ERROR, diff_missing)
+      << "--diff_previous_output needs a --diff_against to compare with.";
+
+  if (FLAGS_input.empty() || FLAGS_output.empty() ||
+      (!FLAGS_workers.empty() && FLAGS_cache_dir.empty()) ||
+      diff_conflicting || diff_missing) {
     std::cerr << google::ProgramUsage();
     return EXIT_FAILURE;
   }
 
-  std::unique_ptr<llvm::LLVMContext> llvm_ctx(new llvm::LLVMContext);
-  auto module{std::unique_ptr<llvm::Module>(
-      rellic::LoadModuleFromFile(llvm_ctx.get(), FLAGS_input))};
+  if (!FLAGS_trace.empty()) {
+    rellic::StartTracing(FLAGS_trace_granularity, argv[0]);
+  }
 
   std::error_code ec;
-  llvm::raw_fd_ostream output(FLAGS_output, ec);
+  auto output_os{OpenOutputFile(FLAGS_output, ec)};
   CHECK(!ec) << "Failed to create output file: " << ec.message();
+  auto& output{*output_os};
 
-  rellic::DecompilationOptions opts{};
-  opts.lower_switches = FLAGS_lower_switch;
-  opts.remove_phi_nodes = FLAGS_remove_phi_nodes;
+  std::unique_ptr<llvm::raw_ostream> provenance_os;
+  std::unique_ptr<rellic::ProvenanceExporter> exporter;
+  if (!FLAGS_provenance.empty()) {
+    provenance_os = OpenOutputFile(FLAGS_provenance, ec);
+    CHECK(!ec) << "Failed to create provenance file: " << ec.message();
+    exporter = std::make_unique<rellic::ProvenanceExporter>(*provenance_os);
+  }
+  std::unique_ptr<llvm::raw_ostream> index_os;
+  std::unique_ptr<rellic::DeclIndexExporter> index;
+  if (!FLAGS_output_index.empty()) {
+    index_os = OpenOutputFile(FLAGS_output_index, ec);
+    CHECK(!ec) << "Failed to create output index file: " << ec.message();
+    index = std::make_unique<rellic::DeclIndexExporter>(*index_os);
+  }
+
+  auto flavors{OpenOutputFlavors()};
 
-  auto result{rellic::Decompile(std::move(module), std::move(opts))};
+  auto opts{GetOptions(output, exporter.get(), index.get(), &flavors)};
+  std::unique_ptr<llvm::LLVMContext> llvm_ctx(new llvm::LLVMContext);
+  rellic::ActivityScope activity("input", FLAGS_input);
+  auto module{
+      LoadInput(*llvm_ctx, FLAGS_input, opts, /*allow_failure=*/false)};
+  if (!FLAGS_diff_against.empty()) {
+    auto previous{LoadInput(*llvm_ctx, FLAGS_diff_against, opts,
+                            /*allow_failure=*/false)};
+    rellic::ModuleDiff diff;
+    try {
+      diff = rellic::DiffModules(*previous, *module);
+    } catch (rellic::Exception& ex) {
+      LOG(FATAL) << ex.what();
+    }
+    LOG(INFO) << "Compared with " << FLAGS_diff_against << ": "
+              << diff.changed.size() + diff.added.size()
+              << " functions to decompile";
+    PrintDiffSummary(output, diff);
+    if (!FLAGS_diff_previous_output.empty()) {
+      DecompilePrevious(std::move(previous), diff);
+    }
+    // Renamed functions are left out along with the unchanged ones
+    opts.functions = diff.changed;
+    opts.functions.insert(opts.functions.end(), diff.added.begin(),
+                          diff.added.end());
+    if (opts.functions.empty()) {
+      for (auto& flavor : flavors) {
+        *flavor.os << flavor.epilogue;
+      }
+      if (!FLAGS_trace.empty()) {
+        rellic::StopTracing(FLAGS_trace);
+      }
+      google::ShutDownCommandLineFlags();
+      google::ShutdownGoogleLogging();
+      return EXIT_SUCCESS;
+    }
+    if (!opts.call_depth) {
+      opts.call_depth = 0;
+    }
+  }
+  rellic::Progress progress;
+  if (FLAGS_progress) {
+    ShowProgress(progress);
+    opts.progress = &progress;
+  }
+  if (!FLAGS_workers.empty()) {
+    DistributeWork(*module, opts);
+  }
+  auto result{rellic::Decompile(std::move(module), opts)};
+  if (FLAGS_progress) {
+    llvm::errs() << "\r\x1b[K";
+  }
   if (result.Succeeded()) {
     auto value{result.TakeValue()};
-    value.ast->getASTContext().getTranslationUnitDecl()->print(output);
+    if (!FLAGS_stream) {
+      rellic::ResultProvenance provenance{value};
+      auto& ast_ctx{value.ast->getASTContext()};
+      PrintOutputs(output,
+                   GetPrintOptions(&provenance, exporter.get(), index.get()),
+                   flavors,
+                   [&ast_ctx](llvm::raw_ostream& os,
+                              const rellic::PrintOptions& options) {
+                     rellic::PrintTranslationUnit(ast_ctx, os, options);
+                   });
+    }
+    for (auto& flavor : flavors) {
+      *flavor.os << flavor.epilogue;
+    }
+    for (auto &name : value.degraded_functions) {
+      LOG(WARNING) << "Function " << name << " was not fully refined";
+    }
+    if (!FLAGS_stats.empty()) {
+      auto stats{OpenOutputFile(FLAGS_stats, ec)};
+      CHECK(!ec) << "Failed to create statistics file: " << ec.message();
+      *stats << llvm::json::Value(value.stats.ToJSON()) << '\n';
+    }
+    if (FLAGS_report) {
+      rellic::PrintReport(value.stats, llvm::errs(), FLAGS_report_functions);
+    }
   } else {
     LOG(FATAL) << result.TakeError().message;
   }
 
+  if (!FLAGS_trace.empty()) {
+    rellic::StopTracing(FLAGS_trace);
+  }
+  SaveRecordedProfile();
+
   google::ShutDownCommandLineFlags();
   google::ShutdownGoogleLogging();
 
@@ -0,0 +1,152 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "OutputFile.h"
+
+#include <glog/logging.h>
+
+#include <cstdint>
+
+#ifdef RELLIC_ZLIB_SUPPORT
+#include <zlib.h>
+#endif
+#ifdef RELLIC_ZSTD_SUPPORT
+#include <zstd.h>
+#endif
+
+namespace {
+// Compresses what is written to it into `file`. The compressor only keeps a
+// window of the input, so output streamed one function at a time is not held
+// back until the end.
+class CompressedOstream : public llvm::raw_ostream {
+  uint64_t pos{0};
+
+  void write_impl(const char* ptr, size_t size) override {
+    pos += size;
+    Compress(ptr, size, /*finish=*/false);
+  }
+
+  uint64_t current_pos() const override { return pos; }
+
+ protected:
+  std::unique_ptr<llvm::raw_fd_ostream> file;
+  char out[1 << 16];
+
+  explicit CompressedOstream(std::unique_ptr<llvm::raw_fd_ostream> file)
+      : file(std::move(file)) {}
+
+  // Feeds `size` bytes at `ptr` to the compressor, and ends the compressed
+  // stream if `finish`
+  virtual void Compress(const char* ptr, size_t size, bool finish) = 0;
+
+  // Called by the destructors of subclasses, while `Compress` is still theirs
+  void Finish() {
+    flush();
+    Compress(nullptr, 0, /*finish=*/true);
+    // Like any other output file, fails loudly if writing it did
+    file->close();
+  }
+};
+
+#ifdef RELLIC_ZLIB_SUPPORT
+class GzipOstream : public CompressedOstream {
+  z_stream stream{};
+
+  void Compress(const char* ptr, size_t size, bool finish) override {
+    stream.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(ptr));
+    stream.avail_in = size;
+    int ret;
+    do {
+      stream.next_out = reinterpret_cast<Bytef*>(out);
+      stream.avail_out = sizeof(out);
+      ret = deflate(&stream, finish ? Z_FINISH : Z_NO_FLUSH);
+      CHECK(ret != Z_STREAM_ERROR) << "gzip compression failed";
+      file->write(out, sizeof(out) - stream.avail_out);
+    } while (stream.avail_out == 0 || (finish && ret != Z_STREAM_END));
+  }
+
+ public:
+  explicit GzipOstream(std::unique_ptr<llvm::raw_fd_ostream> file)
+      : CompressedOstream(std::move(file)) {
+    // 16 more window bits for a gzip header rather than a zlib one
+    CHECK_EQ(deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16,
+                          8, Z_DEFAULT_STRATEGY),
+             Z_OK)
+        << "Failed to start gzip compression";
+  }
+
+  ~GzipOstream() override {
+    Finish();
+    deflateEnd(&stream);
+  }
+};
+#endif
+
+#ifdef RELLIC_ZSTD_SUPPORT
+class ZstdOstream : public CompressedOstream {
+  ZSTD_CCtx* cctx;
+
+  void Compress(const char* ptr, size_t size, bool finish) override {
+    ZSTD_inBuffer input{ptr, size, 0};
+    size_t remaining;
+    do {
+      ZSTD_outBuffer output{out, sizeof(out), 0};
+      remaining = ZSTD_compressStream2(cctx, &output, &input,
+                                       finish ? ZSTD_e_end : ZSTD_e_continue);
+      CHECK(!ZSTD_isError(remaining))
+          << "zstd compression failed: " << ZSTD_getErrorName(remaining);
+      file->write(out, output.pos);
+    } while (finish ? remaining != 0 : input.pos != input.size);
+  }
+
+ public:
+  explicit ZstdOstream(std::unique_ptr<llvm::raw_fd_ostream> file)
+      : CompressedOstream(std::move(file)), cctx(ZSTD_createCCtx()) {
+    CHECK(cctx) << "Failed to start zstd compression";
+  }
+
+  ~ZstdOstream() override {
+    Finish();
+    ZSTD_freeCCtx(cctx);
+  }
+};
+#endif
+}  // namespace
+
+std::unique_ptr<llvm::raw_ostream> OpenOutputFile(llvm::StringRef path,
+                                                  std::error_code& ec) {
+  auto gzip{path.endswith(".gz")};
+  auto zstd{path.endswith(".zst")};
+#ifndef RELLIC_ZLIB_SUPPORT
+  if (gzip) {
+    ec = std::make_error_code(std::errc::not_supported);
+    return nullptr;
+  }
+#endif
+#ifndef RELLIC_ZSTD_SUPPORT
+  if (zstd) {
+    ec = std::make_error_code(std::errc::not_supported);
+    return nullptr;
+  }
+#endif
+  auto file{std::make_unique<llvm::raw_fd_ostream>(path, ec)};
+  if (ec) {
+    return nullptr;
+  }
+#ifdef RELLIC_ZLIB_SUPPORT
+  if (gzip) {
+    return std::make_unique<GzipOstream>(std::move(file));
+  }
+#endif
+#ifdef RELLIC_ZSTD_SUPPORT
+  if (zstd) {
+    return std::make_unique<ZstdOstream>(std::move(file));
+  }
+#endif
+  return file;
+}
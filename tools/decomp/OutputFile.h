@@ -0,0 +1,22 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#pragma once
+
+#include <llvm/ADT/StringRef.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <memory>
+#include <system_error>
+
+// Opens `path` for writing, or reports why it cannot in `ec`. Files whose name
+// ends with .gz or .zst are compressed with gzip or zstd as they are written,
+// so that nothing uncompressed reaches the disk. Positions in the returned
+// stream count the bytes before compression.
+std::unique_ptr<llvm::raw_ostream> OpenOutputFile(llvm::StringRef path,
+                                                  std::error_code& ec);
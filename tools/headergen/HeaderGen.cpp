@@ -6,18 +6,35 @@
  * the LICENSE file found in the root directory of this source tree.
  */
 #include <clang/AST/ASTContext.h>
-#include <clang/Tooling/Tooling.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/ADT/Triple.h>
+#include <llvm/IR/DebugInfoMetadata.h>
 #include <llvm/IR/LLVMContext.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/SHA1.h>
+#include <llvm/Support/ThreadPool.h>
 #include <llvm/Support/raw_ostream.h>
 
+#include <algorithm>
+#include <chrono>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
 
+#include "rellic/AST/ASTUnitFactory.h"
 #include "rellic/AST/DebugInfoCollector.h"
 #include "rellic/AST/StructGenerator.h"
 #include "rellic/AST/SubprogramGenerator.h"
+#include "rellic/AST/TypePrelude.h"
 #include "rellic/BC/Util.h"
+#include "rellic/Exception.h"
+#include "rellic/Printer.h"
 #include "rellic/Version.h"
 
 #ifndef LLVM_VERSION_STRING
@@ -27,6 +44,35 @@
 DEFINE_string(input, "", "Input file.");
 DEFINE_string(output, "", "Output file.");
 DEFINE_bool(generate_prototypes, true, "Generate function prototypes.");
+DEFINE_string(prelude, "",
+              "Prefix of a prelude whose type declarations are included "
+              "instead of being generated again.");
+DEFINE_string(emit_prelude, "",
+              "Prefix to save the type declarations of the input to, as a "
+              "prelude for other modules of the same project.");
+DEFINE_uint32(num_workers, 1,
+              "Number of threads used to compare type descriptions (0 uses "
+              "all available hardware threads).");
+DEFINE_string(batch, "",
+              "Directory of bitcode files, or file listing one input per "
+              "line, to generate headers for. Each header is written next to "
+              "its input with the .h extension. With --emit_prelude, the "
+              "types of all the inputs are first saved as a prelude that "
+              "every header includes.");
+DEFINE_uint32(batch_workers, 0,
+              "Number of inputs of --batch processed at the same time (0 "
+              "uses all available hardware threads).");
+DEFINE_bool(stream, false,
+            "Print each declaration as soon as everything it refers to has "
+            "been printed, instead of once all of them are generated, and "
+            "forget what was read about the fields of each type once it is "
+            "defined. Keeps the memory needed for large inputs down. Cannot "
+            "be used with --emit_prelude, except with --batch.");
+DEFINE_string(cache_dir, "",
+              "Directory where the headers generated with --batch are cached, "
+              "keyed by the hashes of the debug information types and "
+              "functions of their input, so that inputs whose types did not "
+              "change are skipped.");
 
 DECLARE_bool(version);
 
@@ -59,6 +105,408 @@ static void SetVersion(void) {
   google::SetVersionString(version.str());
 }
 
+using HashedTypes = std::vector<std::pair<uint64_t, llvm::DIType*>>;
+
+// Returns the types collected by `dic` with their `GetDITypeHash`, sorted by
+// it, so that the same types are always declared in the same order
+static HashedTypes HashTypes(rellic::DebugInfoCollector& dic) {
+  HashedTypes types;
+  for (auto type : dic.GetTypes()) {
+    types.emplace_back(rellic::GetDITypeHash(type), type);
+  }
+  std::stable_sort(types.begin(), types.end(), [](auto& a, auto& b) {
+    return a.first < b.first;
+  });
+  return types;
+}
+
+static std::vector<llvm::DIType*> GetTypes(const HashedTypes& types) {
+  std::vector<llvm::DIType*> res;
+  for (auto& [hash, type] : types) {
+    res.push_back(type);
+  }
+  return res;
+}
+
+// Prints the declarations added to `tudecl` after `last`, or all of them if
+// it is null, except the ones of the prelude, and returns the last one
+static clang::Decl* PrintNewDecls(clang::TranslationUnitDecl* tudecl,
+                                  rellic::StructGenerator& strctgen,
+                                  clang::Decl* last,
+                                  llvm::raw_ostream& output) {
+  std::vector<clang::Decl*> decls;
+  auto it{last ? clang::DeclContext::decl_iterator(last->getNextDeclInContext())
+               : tudecl->decls_begin()};
+  for (; it != tudecl->decls_end(); ++it) {
+    last = *it;
+    if (!strctgen.IsFromPrelude(last)) {
+      decls.push_back(last);
+    }
+  }
+  rellic::PrintDecls(decls, output);
+  return last;
+}
+
+// Declares the types and, if requested, the functions described by the debug
+// information of `module`, and prints them to `output`, as they are declared
+// with `--stream`. `types` are the ones `dic` collected, as returned by
+// `HashTypes`. Types found in `prelude` are included from its header instead of
+// being declared again. If `emit_prelude` is not empty, the types are also
+// saved as a prelude with that prefix. Throws if the prelude cannot be saved.
+static void GenerateHeader(llvm::Module& module,
+                           rellic::DebugInfoCollector& dic,
+                           const HashedTypes& types,
+                           rellic::TypePrelude* prelude,
+                           const std::string& emit_prelude,
+                           llvm::raw_ostream& output) {
+  auto ast_unit{rellic::ASTUnitFactory::Get().Create(module.getTargetTriple())};
+  rellic::StructGenerator strctgen(*ast_unit, FLAGS_num_workers);
+  rellic::SubprogramGenerator subgen(*ast_unit, strctgen);
+  if (prelude) {
+    strctgen.UsePrelude(*prelude);
+  }
+  auto sorted_types{GetTypes(types)};
+  auto tudecl{ast_unit->getASTContext().getTranslationUnitDecl()};
+  if (FLAGS_stream) {
+    CHECK(emit_prelude.empty()) << "Cannot stream a prelude";
+    if (prelude) {
+      output << "#include \"" << prelude->GetHeader() << "\"\n\n";
+    }
+    // Declarations are never changed once they have been added, and a
+    // definition is only added once everything it needs has been
+    clang::Decl* last{nullptr};
+    strctgen.GenerateDecls(sorted_types.begin(), sorted_types.end(),
+                           [&](llvm::DICompositeType* type) {
+                             strctgen.ReleaseFields(type);
+                             last = PrintNewDecls(tudecl, strctgen, last,
+                                                  output);
+                           });
+    last = PrintNewDecls(tudecl, strctgen, last, output);
+    if (FLAGS_generate_prototypes) {
+      for (auto func : dic.GetSubprograms()) {
+        subgen.VisitSubprogram(func);
+        last = PrintNewDecls(tudecl, strctgen, last, output);
+      }
+    }
+    return;
+  }
+  strctgen.GenerateDecls(sorted_types.begin(), sorted_types.end());
+
+  // Everything declared so far is in the emitted prelude
+  std::string header{prelude ? prelude->GetHeader() : ""};
+  size_t num_prelude_decls{0};
+  if (!emit_prelude.empty()) {
+    rellic::TypePrelude::Save(*ast_unit, strctgen.GetTypeDecls(),
+                              emit_prelude);
+    header = emit_prelude + ".h";
+    num_prelude_decls = std::distance(tudecl->decls_begin(),
+                                      tudecl->decls_end());
+  }
+
+  if (FLAGS_generate_prototypes) {
+    for (auto func : dic.GetSubprograms()) {
+      subgen.VisitSubprogram(func);
+    }
+  }
+
+  if (header.empty()) {
+    tudecl->print(output);
+  } else {
+    std::vector<clang::Decl*> decls;
+    for (auto decl : tudecl->decls()) {
+      if (num_prelude_decls) {
+        --num_prelude_decls;
+      } else if (!strctgen.IsFromPrelude(decl)) {
+        decls.push_back(decl);
+      }
+    }
+    output << "#include \"" << header << "\"\n\n";
+    rellic::PrintDecls(decls, output);
+  }
+}
+
+// Returns the bitcode files in `path` if it is a directory, or the files listed
+// in it otherwise
+static std::vector<std::string> GetBatchInputs(const std::string& path) {
+  std::vector<std::string> inputs;
+  if (llvm::sys::fs::is_directory(path)) {
+    std::error_code ec;
+    for (llvm::sys::fs::directory_iterator it(path, ec), end; it != end && !ec;
+         it.increment(ec)) {
+      if (llvm::sys::path::extension(it->path()) == ".bc") {
+        inputs.push_back(it->path());
+      }
+    }
+    CHECK(!ec) << "Failed to list " << path << ": " << ec.message();
+    std::sort(inputs.begin(), inputs.end());
+    return inputs;
+  }
+
+  auto manifest{llvm::MemoryBuffer::getFile(path)};
+  CHECK(manifest) << "Failed to read " << path << ": "
+                  << manifest.getError().message();
+  llvm::SmallVector<llvm::StringRef, 16> lines;
+  manifest.get()->getBuffer().split(lines, '\n', -1, false);
+  for (auto line : lines) {
+    line = line.trim();
+    if (!line.empty() && !line.startswith("#")) {
+      inputs.push_back(line.str());
+    }
+  }
+  return inputs;
+}
+
+// Saves the types of all of `inputs` as a prelude with `prefix`, so that the
+// headers of the inputs declare each of them only once. The modules are kept
+// loaded until then, since the generator refers to their debug information.
+static void EmitSharedPrelude(const std::vector<std::string>& inputs,
+                              const std::string& prefix) {
+  std::vector<std::unique_ptr<llvm::LLVMContext>> contexts;
+  std::vector<std::unique_ptr<llvm::Module>> modules;
+  std::unique_ptr<clang::ASTUnit> ast_unit;
+  std::unique_ptr<rellic::StructGenerator> strctgen;
+  std::string triple;
+  for (auto& input : inputs) {
+    contexts.push_back(std::make_unique<llvm::LLVMContext>());
+    std::unique_ptr<llvm::Module> module{rellic::LoadModuleFromFile(
+        contexts.back().get(), input, /*allow_failure=*/true)};
+    if (!module) {
+      LOG(WARNING) << "Cannot load " << input << ", its types are left out "
+                   << "of the prelude";
+      continue;
+    }
+    if (!ast_unit) {
+      triple = llvm::Triple::normalize(module->getTargetTriple());
+      ast_unit = rellic::ASTUnitFactory::Get().Create(triple);
+      strctgen = std::make_unique<rellic::StructGenerator>(*ast_unit,
+                                                           FLAGS_num_workers);
+    }
+    CHECK_EQ(llvm::Triple::normalize(module->getTargetTriple()), triple)
+        << "The inputs of --batch must share a target to share a prelude";
+    rellic::DebugInfoCollector dic(rellic::DebugInfoCollector::kTypes);
+    dic.visit(*module);
+    auto types{GetTypes(HashTypes(dic))};
+    strctgen->GenerateDecls(types.begin(), types.end());
+    modules.push_back(std::move(module));
+  }
+  CHECK(ast_unit) << "No input of --batch could be loaded";
+  rellic::TypePrelude::Save(*ast_unit, strctgen->GetTypeDecls(), prefix);
+}
+
+// Identifies the contents of `path`, or of nothing if it cannot be read
+static std::string HashFile(const std::string& path) {
+  llvm::SHA1 hasher;
+  if (auto buffer = llvm::MemoryBuffer::getFile(path)) {
+    hasher.update(buffer.get()->getBuffer());
+  }
+  return llvm::toHex(hasher.final(), /*LowerCase=*/true);
+}
+
+// Bump when the format of the generated headers changes
+constexpr unsigned kHeaderCacheVersion{1};
+
+// Key of the header of `module` in `--cache_dir`. The header only depends on
+// the debug information types and functions that `dic` collected, so the hashes
+// of those identify it regardless of the code of the module.
+static std::string GetHeaderKey(llvm::Module& module,
+                                rellic::DebugInfoCollector& dic,
+                                const HashedTypes& types,
+                                const std::string& prelude_key) {
+  std::string text;
+  llvm::raw_string_ostream os(text);
+  os << kHeaderCacheVersion << '\n'
+     << rellic::Version::GetVersionString() << '\n'
+     << module.getTargetTriple() << '\n'
+     << FLAGS_generate_prototypes << '\n'
+     << prelude_key << '\n';
+
+  for (auto& [hash, type] : types) {
+    os << hash << '\n';
+  }
+  if (FLAGS_generate_prototypes) {
+    for (auto subp : dic.GetSubprograms()) {
+      os << subp->getName() << ' ' << subp->getLinkageName() << ' '
+         << (subp->getType() ? rellic::GetDITypeHash(subp->getType()) : 0)
+         << '\n';
+    }
+  }
+  os.flush();
+
+  llvm::SHA1 hasher;
+  hasher.update(text);
+  return llvm::toHex(hasher.final(), /*LowerCase=*/true);
+}
+
+// Writes `text` to `path` through a temporary file, so that readers never see
+// it partially written
+static std::error_code WriteAtomically(const std::string& path,
+                                       llvm::StringRef text) {
+  llvm::SmallString<128> tmp_path;
+  int fd;
+  if (auto ec =
+          llvm::sys::fs::createUniqueFile(path + "-%%%%%%%%", fd, tmp_path)) {
+    return ec;
+  }
+  {
+    llvm::raw_fd_ostream os(fd, /*shouldClose=*/true);
+    os << text;
+  }
+  if (auto ec = llvm::sys::fs::rename(tmp_path, path)) {
+    llvm::sys::fs::remove(tmp_path);
+    return ec;
+  }
+  return {};
+}
+
+struct BatchResult {
+  std::string input;
+  bool succeeded = false;
+  bool cached = false;
+  std::string message;
+  std::chrono::duration<double> time{};
+};
+
+// Generates the header of `input` next to it, including the types of the
+// prelude with prefix `prelude_path` if not empty
+static BatchResult GenerateFile(const std::string& input,
+                                const std::string& prelude_path,
+                                const std::string& prelude_key) {
+  BatchResult res{};
+  res.input = input;
+  auto start{std::chrono::steady_clock::now()};
+  auto Finish{[&](std::string message) {
+    res.message = std::move(message);
+    res.time = std::chrono::steady_clock::now() - start;
+    return res;
+  }};
+
+  llvm::LLVMContext llvm_ctx;
+  std::unique_ptr<llvm::Module> module{
+      rellic::LoadModuleFromFile(&llvm_ctx, input, /*allow_failure=*/true)};
+  if (!module) {
+    return Finish("cannot load module");
+  }
+  rellic::DebugInfoCollector dic(rellic::DebugInfoCollector::kTypes |
+                                 rellic::DebugInfoCollector::kFunctions);
+  dic.visit(*module);
+  auto types{HashTypes(dic)};
+
+  llvm::SmallString<128> output_path{input};
+  llvm::sys::path::replace_extension(output_path, "h");
+  std::string cache_path;
+  if (!FLAGS_cache_dir.empty()) {
+    cache_path = FLAGS_cache_dir + "/" +
+                 GetHeaderKey(*module, dic, types, prelude_key) + ".h";
+    if (auto cached = llvm::MemoryBuffer::getFile(cache_path)) {
+      if (auto ec = WriteAtomically(output_path.str().str(),
+                                    cached.get()->getBuffer())) {
+        return Finish("cannot write " + output_path.str().str() + ": " +
+                      ec.message());
+      }
+      res.succeeded = true;
+      res.cached = true;
+      return Finish("");
+    }
+  }
+
+  // Each worker thread loads the prelude once and keeps it for the inputs it
+  // processes next
+  struct LoadedPrelude {
+    std::string triple;
+    std::unique_ptr<rellic::TypePrelude> prelude;
+  };
+  static thread_local LoadedPrelude loaded;
+  std::string text;
+  try {
+    if (!prelude_path.empty() &&
+        (!loaded.prelude || loaded.triple != module->getTargetTriple())) {
+      loaded.prelude =
+          rellic::TypePrelude::Load(prelude_path, module->getTargetTriple());
+      loaded.triple = module->getTargetTriple();
+    }
+    llvm::raw_string_ostream os(text);
+    GenerateHeader(*module, dic, types,
+                   prelude_path.empty() ? nullptr : loaded.prelude.get(),
+                   /*emit_prelude=*/"", os);
+  } catch (rellic::Exception& ex) {
+    return Finish(ex.what());
+  }
+
+  if (auto ec = WriteAtomically(output_path.str().str(), text)) {
+    return Finish("cannot write " + output_path.str().str() + ": " +
+                  ec.message());
+  }
+  if (!cache_path.empty()) {
+    if (auto ec = llvm::sys::fs::create_directories(FLAGS_cache_dir)) {
+      LOG(WARNING) << "Cannot create cache directory " << FLAGS_cache_dir
+                   << ": " << ec.message();
+    } else if (auto ec = WriteAtomically(cache_path, text)) {
+      LOG(WARNING) << "Cannot write cache entry " << cache_path << ": "
+                   << ec.message();
+    }
+  }
+  res.succeeded = true;
+  return Finish("");
+}
+
+// Generates the headers of the inputs of `--batch` on `--batch_workers`
+// threads and prints a summary. Returns the number of failures.
+static unsigned RunBatch() {
+  auto inputs{GetBatchInputs(FLAGS_batch)};
+  auto start{std::chrono::steady_clock::now()};
+
+  // With --emit_prelude, the types shared by the inputs are declared once in a
+  // prelude that all of their headers include
+  auto prelude_path{FLAGS_prelude};
+  if (!FLAGS_emit_prelude.empty()) {
+    try {
+      EmitSharedPrelude(inputs, FLAGS_emit_prelude);
+    } catch (rellic::Exception& ex) {
+      LOG(FATAL) << ex.what();
+    }
+    prelude_path = FLAGS_emit_prelude;
+  }
+  std::string prelude_key;
+  if (!prelude_path.empty()) {
+    prelude_key = prelude_path + ".h " + HashFile(prelude_path + ".h") + " " +
+                  HashFile(prelude_path + ".json");
+  }
+
+  std::vector<BatchResult> results(inputs.size());
+  {
+    auto num_workers{FLAGS_batch_workers
+                         ? FLAGS_batch_workers
+                         : llvm::hardware_concurrency().compute_thread_count()};
+    llvm::ThreadPool pool(llvm::hardware_concurrency(num_workers));
+    for (auto i{0U}; i < inputs.size(); ++i) {
+      pool.async([&input = inputs[i], &res = results[i], &prelude_path,
+                  &prelude_key] {
+        res = GenerateFile(input, prelude_path, prelude_key);
+      });
+    }
+    pool.wait();
+  }
+  std::chrono::duration<double> elapsed{std::chrono::steady_clock::now() -
+                                        start};
+
+  unsigned failures{0};
+  unsigned cached{0};
+  for (auto& res : results) {
+    failures += !res.succeeded;
+    cached += res.cached;
+    std::cout << (!res.succeeded ? "FAIL " : res.cached ? "hit  " : "ok   ")
+              << res.time.count() << "s " << res.input;
+    if (!res.message.empty()) {
+      std::cout << ": " << res.message;
+    }
+    std::cout << std::endl;
+  }
+  std::cout << results.size() - failures << " succeeded (" << cached
+            << " cached), " << failures << " failed in " << elapsed.count()
+            << "s" << std::endl;
+  return failures;
+}
+
 int main(int argc, char* argv[]) {
   std::stringstream usage;
   usage << std::endl
@@ -66,6 +514,13 @@ int main(int argc, char* argv[]) {
         << "  " << argv[0] << " \\" << std::endl
         << "    --input INPUT_FILE \\" << std::endl
         << "    --output OUTPUT_FILE \\" << std::endl
+        << "    [--prelude PREFIX | --emit_prelude PREFIX] \\" << std::endl
+        << "    [--stream] \\" << std::endl
+        << std::endl
+        << "  " << argv[0] << " \\" << std::endl
+        << "    --batch INPUT_DIR_OR_LIST \\" << std::endl
+        << "    [--batch_workers N] [--cache_dir DIR] \\" << std::endl
+        << "    [--prelude PREFIX | --emit_prelude PREFIX] \\" << std::endl
         << std::endl
 
         // Print the version and exit.
@@ -78,32 +533,55 @@ int main(int argc, char* argv[]) {
   SetVersion();
   google::ParseCommandLineFlags(&argc, &argv, true);
 
-  LOG_IF(ERROR, FLAGS_input.empty())
+  auto batch{!FLAGS_batch.empty()};
+  LOG_IF(ERROR, !batch && FLAGS_input.empty())
       << "Must specify the path to an input file.";
 
-  LOG_IF(ERROR, FLAGS_output.empty())
+  LOG_IF(ERROR, !batch && FLAGS_output.empty())
       << "Must specify the path to an output file.";
 
-  if (FLAGS_input.empty() || FLAGS_output.empty()) {
+  LOG_IF(ERROR, batch && (!FLAGS_input.empty() || !FLAGS_output.empty()))
+      << "--batch writes the output of each input next to it, and cannot be "
+         "used with --input or --output.";
+
+  LOG_IF(ERROR, !batch && !FLAGS_cache_dir.empty())
+      << "--cache_dir can only be used with --batch.";
+
+  LOG_IF(ERROR, !FLAGS_prelude.empty() && !FLAGS_emit_prelude.empty())
+      << "Cannot use a prelude and emit one at the same time.";
+
+  LOG_IF(ERROR, !batch && FLAGS_stream && !FLAGS_emit_prelude.empty())
+      << "--stream cannot be used with --emit_prelude, except with --batch.";
+
+  if ((!batch && (FLAGS_input.empty() || FLAGS_output.empty())) ||
+      (batch && (!FLAGS_input.empty() || !FLAGS_output.empty())) ||
+      (!batch && !FLAGS_cache_dir.empty()) ||
+      (!FLAGS_prelude.empty() && !FLAGS_emit_prelude.empty()) ||
+      (!batch && FLAGS_stream && !FLAGS_emit_prelude.empty())) {
     std::cerr << google::ProgramUsage();
     return EXIT_FAILURE;
   }
 
+  if (batch) {
+    auto failures{RunBatch()};
+    google::ShutDownCommandLineFlags();
+    google::ShutdownGoogleLogging();
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+  }
+
   auto llvm_ctx{std::make_unique<llvm::LLVMContext>()};
   auto module{rellic::LoadModuleFromFile(llvm_ctx.get(), FLAGS_input)};
-  auto dic{std::make_unique<rellic::DebugInfoCollector>()};
+  auto dic{std::make_unique<rellic::DebugInfoCollector>(
+      rellic::DebugInfoCollector::kTypes |
+      rellic::DebugInfoCollector::kFunctions)};
   dic->visit(module);
-  std::vector<std::string> args{"-Wno-pointer-to-int-cast", "-Wno-pointer-sign",
-                                "-target", module->getTargetTriple()};
-  auto ast_unit{clang::tooling::buildASTFromCodeWithArgs("", args, "out.c")};
-  rellic::StructGenerator strctgen(*ast_unit);
-  rellic::SubprogramGenerator subgen(*ast_unit, strctgen);
-  auto types{dic->GetTypes()};
-  strctgen.GenerateDecls(types.begin(), types.end());
-
-  if (FLAGS_generate_prototypes) {
-    for (auto func : dic->GetSubprograms()) {
-      subgen.VisitSubprogram(func);
+  std::unique_ptr<rellic::TypePrelude> prelude;
+  if (!FLAGS_prelude.empty()) {
+    try {
+      prelude = rellic::TypePrelude::Load(FLAGS_prelude,
+                                          module->getTargetTriple());
+    } catch (rellic::Exception& ex) {
+      LOG(FATAL) << ex.what();
     }
   }
 
@@ -111,8 +589,13 @@ int main(int argc, char* argv[]) {
   // FIXME(surovic): Figure out if the fix below works.
   // llvm::raw_fd_ostream output(FLAGS_output, ec, llvm::sys::fs::F_Text);
   llvm::raw_fd_ostream output(FLAGS_output, ec);
-  ast_unit->getASTContext().getTranslationUnitDecl()->print(output);
   CHECK(!ec) << "Failed to create output file: " << ec.message();
+  try {
+    GenerateHeader(*module, *dic, HashTypes(*dic), prelude.get(),
+                   FLAGS_emit_prelude, output);
+  } catch (rellic::Exception& ex) {
+    LOG(FATAL) << ex.what();
+  }
 
   google::ShutDownCommandLineFlags();
   google::ShutdownGoogleLogging();
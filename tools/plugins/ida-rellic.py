@@ -18,13 +18,62 @@ import subprocess
 from shutil import which
 
 
+class rellic_server_t:
+    """A `rellic-decomp --server` process that is kept around between
+    decompilations, so that its startup is only paid once"""
+
+    def __init__(self, rellic_decomp_path):
+        self._rellic_decomp_path = rellic_decomp_path
+        self._process = None
+        self._next_id = 0
+
+    def _start(self):
+        if self._process is not None and self._process.poll() is None:
+            return
+
+        self._process = subprocess.Popen([self._rellic_decomp_path, "--server"],
+                                         stdin=subprocess.PIPE,
+                                         stdout=subprocess.PIPE,
+                                         stderr=subprocess.DEVNULL,
+                                         text=True)
+
+    def decompile(self, bc_file_path, functions=[]):
+        """Returns the C source of the functions of `bc_file_path`, or of all
+        of them if `functions` is empty. Raises RuntimeError on failure."""
+        self._start()
+        self._next_id += 1
+        request = {"id": self._next_id, "input": bc_file_path,
+                   "functions": functions}
+
+        try:
+            self._process.stdin.write(json.dumps(request) + "\n")
+            self._process.stdin.flush()
+            line = self._process.stdout.readline()
+
+        except OSError as e:
+            self._process = None
+            raise RuntimeError("the rellic-decomp server stopped: {}".format(e))
+
+        if not line:
+            self._process = None
+            raise RuntimeError("the rellic-decomp server stopped")
+
+        response = json.loads(line)
+        if "error" in response:
+            raise RuntimeError(response["error"])
+
+        return response["code"]
+
+
 class rellic_decompile_function_t(ida_kernwin.action_handler_t):
     _anvill_decompile_json_path = None
     _rellic_decomp_path = None
     _opt_path = None
+    _server = None
 
     def __init__(self):
         self.locate_external_programs()
+        self._server = rellic_server_t(self._rellic_decomp_path)
 
         print("rellic: Found `opt` executable:", self._opt_path)
         print("rellic: Found `anvill-decompile-json` executable:",
@@ -141,21 +190,31 @@ class rellic_decompile_function_t(ida_kernwin.action_handler_t):
 
             return
 
-        # Finally, ask rellic to decompile the bitcode
-        c_file_path = os.path.join(working_directory, 'out.c')
+        # Finally, ask rellic to decompile the bitcode. Lifted functions are
+        # named after their address, which rellic accepts in hexadecimal, but
+        # the whole module is decompiled if it has no such function.
+        function_address = "{:x}".format(
+            ida_funcs.get_func(screen_cursor).start_ea)
 
         try:
-            subprocess.check_output([self._rellic_decomp_path, "--input", processed_bc_file_path,
-                                     "--output", c_file_path], text=True, stderr=subprocess.STDOUT)
+            try:
+                decompiled_function = self._server.decompile(
+                    processed_bc_file_path, [function_address])
 
-        except subprocess.CalledProcessError as e:
+            except RuntimeError:
+                decompiled_function = self._server.decompile(
+                    processed_bc_file_path)
+
+        except RuntimeError as e:
             print(
-                "rellic: Failed to start the rellic-decomp process. Error details follow:\n{}".format(e.output))
+                "rellic: Failed to decompile with rellic-decomp. Error details follow:\n{}".format(e))
 
             return
 
-        with open(c_file_path, "r") as rellic_output_file:
-            decompiled_function = rellic_output_file.read()
+        # Keep a copy of the output next to the inputs
+        c_file_path = os.path.join(working_directory, 'out.c')
+        with open(c_file_path, "w") as rellic_output_file:
+            rellic_output_file.write(decompiled_function)
 
         self.display_output(function_name, decompiled_function)
 
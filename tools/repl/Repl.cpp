@@ -5,9 +5,9 @@
  * This source code is licensed in accordance with the terms specified in
  * the LICENSE file found in the root directory of this source tree.
  */
+#include <clang/AST/RecursiveASTVisitor.h>
 #include <clang/Basic/TargetInfo.h>
 #include <clang/Frontend/ASTUnit.h>
-#include <clang/Tooling/Tooling.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <linenoise.h>
@@ -15,9 +15,9 @@
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
 #include <llvm/IR/PassManager.h>
-#include <llvm/InitializePasses.h>
 #include <llvm/Pass.h>
 #include <llvm/Passes/PassBuilder.h>
+#include <llvm/Support/Format.h>
 #include <llvm/Support/raw_ostream.h>
 #include <llvm/Transforms/Utils.h>
 #include <llvm/Transforms/Utils/Local.h>
@@ -26,43 +26,55 @@
 #include <sys/wait.h>
 #include <unistd.h>
 
+#include <chrono>
 #include <csignal>
 #include <cstdlib>
 #include <iostream>
+#include <map>
 #include <memory>
 #include <sstream>
 #include <system_error>
 
-#include "rellic/AST/CondBasedRefine.h"
-#include "rellic/AST/DeadStmtElim.h"
+#include "rellic/AST/ASTUnitFactory.h"
+#include "rellic/AST/Checkpoint.h"
 #include "rellic/AST/DebugInfoCollector.h"
-#include "rellic/AST/ExprCombine.h"
 #include "rellic/AST/GenerateAST.h"
 #include "rellic/AST/IRToASTVisitor.h"
 #include "rellic/AST/LocalDeclRenamer.h"
-#include "rellic/AST/LoopRefine.h"
-#include "rellic/AST/MaterializeConds.h"
-#include "rellic/AST/NestedCondProp.h"
-#include "rellic/AST/NestedScopeCombine.h"
-#include "rellic/AST/ReachBasedRefine.h"
+#include "rellic/AST/PassRegistry.h"
+#include "rellic/AST/Progress.h"
+#include "rellic/AST/Snapshot.h"
 #include "rellic/AST/StructFieldRenamer.h"
-#include "rellic/AST/Z3CondSimplify.h"
 #include "rellic/BC/Util.h"
 #include "rellic/Decompiler.h"
 #include "rellic/Exception.h"
+#include "rellic/Trace.h"
 #include "rellic/Version.h"
 
 #ifndef LLVM_VERSION_STRING
 #define LLVM_VERSION_STRING LLVM_VERSION_MAJOR << "." << LLVM_VERSION_MINOR
 #endif
 
+DEFINE_string(trace, "",
+              "Write a Chrome Trace Event file of the session to this path on "
+              "exit.");
+DEFINE_uint32(trace_granularity, 500,
+              "Minimum duration in microseconds of the spans recorded with "
+              "--trace.");
 DECLARE_bool(version);
 
 llvm::LLVMContext llvm_ctx;
 std::unique_ptr<llvm::Module> module{nullptr};
 std::unique_ptr<clang::ASTUnit> ast_unit{nullptr};
+// Counts the Z3 queries made on `dec_ctx`, which refers to it
+rellic::Progress progress;
 std::unique_ptr<rellic::DecompilationContext> dec_ctx;
-std::unique_ptr<rellic::CompositeASTPass> global_pass{nullptr};
+// Taken before every command that runs passes, along with the command. They
+// refer to `dec_ctx`, so they are dropped before it is replaced.
+std::unique_ptr<rellic::Checkpoints> checkpoints;
+std::vector<std::string> checkpoint_labels;
+std::unique_ptr<rellic::DebugInfoCollector> dic;
+std::unique_ptr<rellic::ASTPass> global_pass{nullptr};
 
 static void SetVersion(void) {
   std::stringstream version;
@@ -93,9 +105,6 @@ static void SetVersion(void) {
   google::SetVersionString(version.str());
 }
 
-static const char* available_passes[] = {"cbr", "dse", "ec",  "lr",
-                                         "ncp", "nsc", "rbr", "zcs"};
-
 static bool diff = false;
 
 template <typename... Ts>
@@ -145,36 +154,153 @@ class Diff {
   }
 };
 
-static std::unique_ptr<rellic::ASTPass> CreatePass(const std::string& name) {
-  if (name == "cbr") {
-    return std::make_unique<rellic::CondBasedRefine>(*dec_ctx);
-  } else if (name == "dse") {
-    return std::make_unique<rellic::DeadStmtElim>(*dec_ctx);
-  } else if (name == "ec") {
-    return std::make_unique<rellic::ExprCombine>(*dec_ctx);
-  } else if (name == "lr") {
-    return std::make_unique<rellic::LoopRefine>(*dec_ctx);
-  } else if (name == "mc") {
-    return std::make_unique<rellic::MaterializeConds>(*dec_ctx);
-  } else if (name == "ncp") {
-    return std::make_unique<rellic::NestedCondProp>(*dec_ctx);
-  } else if (name == "nsc") {
-    return std::make_unique<rellic::NestedScopeCombine>(*dec_ctx);
-  } else if (name == "rbr") {
-    return std::make_unique<rellic::ReachBasedRefine>(*dec_ctx);
-  } else if (name == "zcs") {
-    return std::make_unique<rellic::Z3CondSimplify>(*dec_ctx);
-  } else {
-    return nullptr;
+static bool profile = false;
+
+class NodeCounter : public clang::RecursiveASTVisitor<NodeCounter> {
+ public:
+  size_t stmts{0};
+  size_t decls{0};
+
+  bool VisitStmt(clang::Stmt*) {
+    ++stmts;
+    return true;
+  }
+
+  bool VisitDecl(clang::Decl*) {
+    ++decls;
+    return true;
+  }
+};
+
+static NodeCounter CountNodes() {
+  NodeCounter counter;
+  if (ast_unit) {
+    counter.TraverseDecl(ast_unit->getASTContext().getTranslationUnitDecl());
   }
+  return counter;
 }
 
-static void handle_stop(int signal) {
-  if (global_pass) {
-    global_pass->Stop();
+// Reports what a command cost between construction and `Print`: wall time,
+// Z3 queries, the size of the AST and of `z3_exprs`, and what each pass did
+class Cost {
+  std::chrono::steady_clock::time_point start;
+  size_t z3_calls;
+  uint64_t z3_nanoseconds;
+  NodeCounter nodes;
+  size_t z3_exprs;
+  std::map<std::string, rellic::PassStatistics> passes;
+  std::map<std::string, rellic::FunctionStatistics> functions;
+
+  size_t GetZ3Exprs() { return dec_ctx ? dec_ctx->z3_exprs.size() : 0; }
+
+ public:
+  Cost()
+      : start(std::chrono::steady_clock::now()),
+        z3_calls(progress.z3_calls),
+        z3_nanoseconds(progress.z3_nanoseconds),
+        nodes(CountNodes()),
+        z3_exprs(GetZ3Exprs()) {
+    if (dec_ctx) {
+      passes = dec_ctx->stats.passes;
+      functions = dec_ctx->stats.functions;
+    }
   }
+
+  // Prints the Z3 work done since `before`, if any
+  static void PrintZ3(const rellic::Z3Statistics& stats,
+                      const rellic::Z3Statistics& before) {
+    auto queries{stats.queries - before.queries};
+    auto hits{stats.cache_hits - before.cache_hits};
+    if (!queries && !hits) {
+      return;
+    }
+    llvm::outs() << ", Z3: " << queries << " queries, " << hits
+                 << " cached, " << stats.timeouts - before.timeouts
+                 << " timeouts, " << stats.nodes_in - before.nodes_in
+                 << " -> " << stats.nodes_out - before.nodes_out << " nodes, "
+                 << llvm::format("%.3f s", (stats.time - before.time).count());
+  }
+
+  void Print() {
+    std::chrono::duration<double> elapsed{std::chrono::steady_clock::now() -
+                                          start};
+    auto after{CountNodes()};
+    auto exprs_after{GetZ3Exprs()};
+    llvm::outs() << "wall time:  " << llvm::format("%.3f s", elapsed.count())
+                 << "\nZ3:         " << progress.z3_calls - z3_calls
+                 << " queries, "
+                 << llvm::format("%.3f s",
+                                 (progress.z3_nanoseconds - z3_nanoseconds) /
+                                     1e9)
+                 << "\nstatements: " << nodes.stmts << " -> " << after.stmts
+                 << "\ndecls:      " << nodes.decls << " -> " << after.decls
+                 << "\nz3_exprs:   " << z3_exprs << " -> " << exprs_after
+                 << '\n';
+    if (!dec_ctx) {
+      return;
+    }
+    for (auto& [name, stats] : dec_ctx->stats.passes) {
+      auto& before{passes[name]};
+      auto runs{stats.runs - before.runs};
+      auto padded{name};
+      padded.resize(12, ' ');
+      if (!runs) {
+        // Structuring is not a pass of its own, but queries Z3 as well
+        if (stats.z3.queries != before.z3.queries) {
+          llvm::outs() << "  " << padded << "structuring";
+          PrintZ3(stats.z3, before.z3);
+          llvm::outs() << '\n';
+        }
+        continue;
+      }
+      llvm::outs() << "  " << padded << runs << " runs, "
+                   << stats.changes - before.changes << " changes, "
+                   << llvm::format(
+                          "%.3f s",
+                          (stats.wall_time - before.wall_time).count());
+      PrintZ3(stats.z3, before.z3);
+      llvm::outs() << '\n';
+    }
+    auto header{false};
+    for (auto& [name, stats] : dec_ctx->stats.functions) {
+      auto& before{functions[name]};
+      if (stats.z3.queries == before.z3.queries &&
+          stats.z3.cache_hits == before.z3.cache_hits) {
+        continue;
+      }
+      if (!header) {
+        llvm::outs() << "per function:\n";
+        header = true;
+      }
+      llvm::outs() << "  " << name;
+      PrintZ3(stats.z3, before.z3);
+      llvm::outs() << '\n';
+    }
+    llvm::outs().flush();
+  }
+};
+
+static void drop_checkpoints() {
+  checkpoints = nullptr;
+  checkpoint_labels.clear();
 }
 
+static void take_checkpoint(const std::string& label) {
+  if (!checkpoints) {
+    checkpoints = std::make_unique<rellic::Checkpoints>(*dec_ctx);
+  }
+  checkpoints->Create();
+  checkpoint_labels.push_back(label);
+}
+
+static std::unique_ptr<rellic::ASTPass> CreatePass(const std::string& name) {
+  return rellic::CreatePass(name, *dec_ctx, dic.get());
+}
+
+// Only sets a flag, which passes and Z3 queries check, since stopping a pass
+// also takes locks that may be held by the interrupted code
+static void handle_stop(int) { progress.cancelled = true; }
+
 static void do_help() {
   std::cout << "available commands:\n"
             << "  quit               Exits the REPL\n"
@@ -186,23 +312,40 @@ static void do_help() {
             << "  clear              Clears the screen\n"
             << "  apply [pass]       Applies preprocessing pass\n"
             << "  decompile          Performs initial decompilation\n"
+            << "  save [path]        Saves the session to files prefixed "
+               "with path\n"
+            << "  resume [path]      Resumes a session saved with `save`\n"
             << "  run [passes]       Applies a sequence of refinement passes\n"
             << "  fixpoint [passes]  Tries to find a fixpoint for a sequence "
-               "of refinement passes\n\n"
+               "of refinement passes\n"
+            << "  pipeline [spec]    Runs a pipeline description, e.g.\n"
+            << "                     " << rellic::GetDefaultPipeline() << "\n"
+            << "  time [passes]      Same as `run`, and reports what the "
+               "passes cost\n"
+            << "  fixpoint --stats [passes]\n"
+            << "                     Same as `fixpoint`, and reports what the "
+               "passes cost\n"
+            << "  undo               Undoes the last run, time, fixpoint or "
+               "pipeline command\n"
+            << "  checkpoints        Lists the states of the AST before each "
+               "of those commands\n"
+            << "  checkout [n]       Restores the AST to checkpoint n, keeping "
+               "the later ones\n"
+            << "  profile [on/off]   Enables/disables reporting the wall time, "
+               "Z3 queries,\n"
+            << "                     AST size and z3_exprs growth of every "
+               "decompile, run,\n"
+            << "                     fixpoint and pipeline command\n\n"
             << "available preprocessing passes:\n"
             << "  remove-phi-nodes   Replaces Phi nodes with allocas\n"
             << "  lower-switches     Lowers switch instructions\n\n"
-            << "available refinement passes:\n"
-            << "  cbr                Condition-based refinement\n"
-            << "  dse                Dead statement elimination\n"
-            << "  ec                 Expression combination\n"
-            << "  lr                 Loop refinement\n"
-            << "  mc                 Condition materialization\n"
-            << "  ncp                Nested condition propagation\n"
-            << "  nsc                Nested scope combination\n"
-            << "  rbr                Reach-based refinement\n"
-            << "  zcs                Z3-based condition simplification\n"
-            << std::endl;
+            << "available refinement passes:\n";
+  for (auto& pass : rellic::GetRegisteredPasses()) {
+    std::string name{pass.name};
+    name.resize(19, ' ');
+    std::cout << "  " << name << pass.description << "\n";
+  }
+  std::cout << std::endl;
 }
 
 static void do_load(std::istream& is) {
@@ -215,10 +358,9 @@ static void do_load(std::istream& is) {
     return;
   }
 
-  std::vector<std::string> args{"-Wno-pointer-to-int-cast", "-Wno-pointer-sign",
-                                "-target", module->getTargetTriple()};
-  ast_unit = clang::tooling::buildASTFromCodeWithArgs("", args, "out.c");
+  drop_checkpoints();
   dec_ctx = {};
+  ast_unit = rellic::ASTUnitFactory::Get().Create(module->getTargetTriple());
 
   std::cout << "ok." << std::endl;
 }
@@ -298,43 +440,100 @@ static void do_apply(std::istream& is) {
 
 static void do_decompile() {
   try {
-    rellic::DebugInfoCollector dic;
-    dic.visit(*module);
-    dec_ctx = {};
+    dic = std::make_unique<rellic::DebugInfoCollector>();
+    dic->visit(*module);
+    drop_checkpoints();
+    dec_ctx = nullptr;
+    ast_unit = rellic::ASTUnitFactory::Get().Create(module->getTargetTriple());
+    dec_ctx = std::make_unique<rellic::DecompilationContext>(*ast_unit);
+    dec_ctx->SetProgress(&progress);
+    progress.cancelled = false;
+    Cost cost;
     rellic::GenerateAST::run(*module, *dec_ctx);
-    rellic::LocalDeclRenamer ldr{*dec_ctx, dic.GetIRToNameMap()};
-    rellic::StructFieldRenamer sfr{*dec_ctx, dic.GetIRTypeToDITypeMap()};
+    rellic::LocalDeclRenamer ldr{*dec_ctx, *dic};
+    rellic::StructFieldRenamer sfr{*dec_ctx, *dic};
     ldr.Run();
     sfr.Run();
+    if (profile) {
+      cost.Print();
+    }
+    if (progress.cancelled) {
+      std::cout << "stopped: some functions were not decompiled." << std::endl;
+    } else {
+      std::cout << "ok." << std::endl;
+    }
+  } catch (rellic::Exception& ex) {
+    std::cout << "error: " << ex.what() << std::endl;
+  }
+}
+
+static void do_save(std::istream& is) {
+  if (!dec_ctx) {
+    std::cout << "error: nothing has been decompiled." << std::endl;
+    return;
+  }
+
+  std::string path;
+  is >> path;
+  try {
+    rellic::SaveSnapshot(*module, *dec_ctx, path);
     std::cout << "ok." << std::endl;
   } catch (rellic::Exception& ex) {
     std::cout << "error: " << ex.what() << std::endl;
   }
 }
 
-static void do_run(std::istream& is) {
+static void do_resume(std::istream& is) {
+  std::string path;
+  is >> path;
+  try {
+    auto snapshot{rellic::LoadSnapshot(llvm_ctx, path)};
+    drop_checkpoints();
+    dec_ctx = nullptr;
+    module = std::move(snapshot.module);
+    ast_unit = std::move(snapshot.ast_unit);
+    dec_ctx = std::move(snapshot.dec_ctx);
+    dec_ctx->SetProgress(&progress);
+    dic = std::make_unique<rellic::DebugInfoCollector>();
+    dic->visit(*module);
+    std::cout << "ok." << std::endl;
+  } catch (rellic::Exception& ex) {
+    std::cout << "error: " << ex.what() << std::endl;
+  }
+}
+
+static void do_run(std::istream& is, bool report) {
   if (module == nullptr) {
     std::cout << "error: no module loaded." << std::endl;
     return;
   }
 
-  global_pass = std::make_unique<rellic::CompositeASTPass>(*dec_ctx);
+  auto composite{std::make_unique<rellic::CompositeASTPass>(*dec_ctx)};
+  std::string label{report ? "time" : "run"};
   std::string name;
   while (is >> name) {
+    label += ' ' + name;
     auto pass{CreatePass(name)};
     if (pass) {
-      global_pass->GetPasses().push_back(std::move(pass));
+      composite->GetPasses().push_back(std::move(pass));
     } else {
       std::cout << "error: unknown pass `" << name << "'." << std::endl;
       return;
     }
   }
+  global_pass = std::move(composite);
+  take_checkpoint(label);
 
   Diff d{[](llvm::raw_ostream& os) {
     ast_unit->getASTContext().getTranslationUnitDecl()->print(os, 0, false);
   }};
+  progress.cancelled = false;
   try {
+    Cost cost;
     auto res{global_pass->Run()};
+    if (report || profile) {
+      cost.Print();
+    }
     if (global_pass->Stopped()) {
       std::cout << "stopped." << std::endl;
     }
@@ -355,24 +554,38 @@ static void do_fixpoint(std::istream& is) {
     return;
   }
 
-  global_pass = std::make_unique<rellic::CompositeASTPass>(*dec_ctx);
+  auto composite{std::make_unique<rellic::CompositeASTPass>(*dec_ctx)};
+  auto report{false};
+  std::string label{"fixpoint"};
   std::string name;
   while (is >> name) {
+    label += ' ' + name;
+    if (name == "--stats") {
+      report = true;
+      continue;
+    }
     auto pass{CreatePass(name)};
     if (pass) {
-      global_pass->GetPasses().push_back(std::move(pass));
+      composite->GetPasses().push_back(std::move(pass));
     } else {
       std::cout << "error: unknown pass `" << name << "'." << std::endl;
       return;
     }
   }
+  global_pass = std::move(composite);
+  take_checkpoint(label);
 
   Diff d{[](llvm::raw_ostream& os) {
     ast_unit->getASTContext().getTranslationUnitDecl()->print(os, 0, false);
   }};
   std::cout << "computing fixpoint... press Ctrl-Z to stop" << std::endl;
+  progress.cancelled = false;
   try {
+    Cost cost;
     auto iter_count{global_pass->Fixpoint()};
+    if (report || profile) {
+      cost.Print();
+    }
     if (global_pass->Stopped()) {
       std::cout << "stopped after " << iter_count << " iterations.";
     } else {
@@ -385,6 +598,100 @@ static void do_fixpoint(std::istream& is) {
   global_pass = nullptr;
 }
 
+static void do_pipeline(std::istream& is) {
+  if (module == nullptr) {
+    std::cout << "error: no module loaded." << std::endl;
+    return;
+  }
+
+  std::string spec;
+  std::getline(is, spec);
+  try {
+    global_pass = rellic::Pipeline::Parse(spec, *dec_ctx, dic.get());
+  } catch (rellic::Exception& ex) {
+    std::cout << "error: " << ex.what() << std::endl;
+    return;
+  }
+  take_checkpoint("pipeline" + spec);
+
+  Diff d{[](llvm::raw_ostream& os) {
+    ast_unit->getASTContext().getTranslationUnitDecl()->print(os, 0, false);
+  }};
+  progress.cancelled = false;
+  try {
+    Cost cost;
+    auto res{global_pass->Run()};
+    if (profile) {
+      cost.Print();
+    }
+    if (global_pass->Stopped()) {
+      std::cout << "stopped." << std::endl;
+    }
+    if (res) {
+      std::cout << "ok: the pipeline reported changes." << std::endl;
+    } else {
+      std::cout << "ok: the pipeline did not report any change." << std::endl;
+    }
+  } catch (rellic::Exception& ex) {
+    std::cout << "error: " << ex.what() << std::endl;
+  }
+  global_pass = nullptr;
+}
+
+// Restores the AST to checkpoint `idx`, and drops it along with the later
+// ones if `undo` is set
+static void restore_checkpoint(size_t idx, bool undo) {
+  Diff d{[](llvm::raw_ostream& os) {
+    ast_unit->getASTContext().getTranslationUnitDecl()->print(os, 0, false);
+  }};
+  auto restored{checkpoints->Checkout(idx)};
+  if (undo) {
+    checkpoints->Truncate(idx);
+    checkpoint_labels.resize(idx);
+  }
+  std::cout << "ok: " << restored.size() << " functions restored."
+            << std::endl;
+}
+
+static void do_undo() {
+  if (!checkpoints || !checkpoints->Size()) {
+    std::cout << "error: nothing to undo." << std::endl;
+    return;
+  }
+  std::cout << "undoing `" << checkpoint_labels.back() << "'." << std::endl;
+  restore_checkpoint(checkpoints->Size() - 1, /*undo=*/true);
+}
+
+static void do_checkpoints() {
+  for (size_t i{0}; i < checkpoint_labels.size(); ++i) {
+    std::cout << "  " << i << ": before `" << checkpoint_labels[i] << "'\n";
+  }
+  std::cout << std::flush;
+}
+
+static void do_checkout(std::istream& is) {
+  size_t idx;
+  if (!(is >> idx) || !checkpoints || idx >= checkpoints->Size()) {
+    std::cout << "error: unknown checkpoint." << std::endl;
+    return;
+  }
+  restore_checkpoint(idx, /*undo=*/false);
+}
+
+static void do_profile(std::istream& is) {
+  std::string value;
+  is >> value;
+  if (value == "on") {
+    profile = true;
+  } else if (value == "off") {
+    profile = false;
+  } else {
+    std::cout << "unknown profile value `" << value << "'." << std::endl;
+    return;
+  }
+  std::cout << "ok." << std::endl;
+}
+
 static void do_diff(std::istream& is) {
   std::string value;
   is >> value;
@@ -414,8 +721,18 @@ void completion(const char* buf, linenoiseCompletions* lc) {
               lc, (line.substr(0, last_space + 1) + option_str).c_str());
         }
       }
-    } else {
+    } else if (line.find("profile ") == 0) {
+      for (auto option : {"on", "off"}) {
+        std::string option_str{option};
+        if (option_str.find(last_fragment) == 0) {
+          linenoiseAddCompletion(
+              lc, (line.substr(0, last_space + 1) + option_str).c_str());
+        }
+      }
+    } else if (line.find("pipeline") != 0) {
       linenoiseAddCompletion(lc, "print");
+      linenoiseAddCompletion(lc, "pipeline");
+      linenoiseAddCompletion(lc, "profile");
     }
   } else if (buf[0] == 'a') {
     if (line.find("apply ") == 0) {
@@ -448,22 +765,41 @@ void completion(const char* buf, linenoiseCompletions* lc) {
     linenoiseAddCompletion(lc, "load");
   } else if (buf[0] == 'c') {
     linenoiseAddCompletion(lc, "clear");
+    linenoiseAddCompletion(lc, "checkout");
+    linenoiseAddCompletion(lc, "checkpoints");
+  } else if (buf[0] == 'u') {
+    linenoiseAddCompletion(lc, "undo");
+  } else if (buf[0] == 's') {
+    linenoiseAddCompletion(lc, "save");
+  } else if (buf[0] == 't') {
+    if (line.find("time ") == 0) {
+      for (auto& pass : rellic::GetRegisteredPasses()) {
+        std::string pass_str{pass.name};
+        if (pass_str.find(last_fragment) == 0) {
+          linenoiseAddCompletion(
+              lc, (line.substr(0, last_space + 1) + pass_str).c_str());
+        }
+      }
+    } else {
+      linenoiseAddCompletion(lc, "time");
+    }
   } else if (buf[0] == 'r') {
     if (line.find("run ") == 0) {
-      for (auto pass : available_passes) {
-        std::string pass_str{pass};
+      for (auto& pass : rellic::GetRegisteredPasses()) {
+        std::string pass_str{pass.name};
         if (pass_str.find(last_fragment) == 0) {
           linenoiseAddCompletion(
               lc, (line.substr(0, last_space + 1) + pass_str).c_str());
         }
       }
     } else {
+      linenoiseAddCompletion(lc, "resume");
       linenoiseAddCompletion(lc, "run");
     }
   } else if (buf[0] == 'f') {
     if (line.find("fixpoint ") == 0) {
-      for (auto pass : available_passes) {
-        std::string pass_str{pass};
+      for (auto& pass : rellic::GetRegisteredPasses()) {
+        std::string pass_str{pass.name};
         if (pass_str.find(last_fragment) == 0) {
           linenoiseAddCompletion(
               lc, (line.substr(0, last_space + 1) + pass_str).c_str());
@@ -493,9 +829,9 @@ int main(int argc, char* argv[]) {
   SetVersion();
   google::ParseCommandLineFlags(&argc, &argv, true);
 
-  auto& pr{*llvm::PassRegistry::getPassRegistry()};
-  initializeCore(pr);
-  initializeAnalysis(pr);
+  if (!FLAGS_trace.empty()) {
+    rellic::StartTracing(FLAGS_trace_granularity, argv[0]);
+  }
 
   linenoiseSetCompletionCallback(completion);
   while (auto input = linenoise("rellic> ")) {
@@ -517,10 +853,26 @@ int main(int argc, char* argv[]) {
       do_apply(iss);
     } else if (command == "decompile") {
       do_decompile();
+    } else if (command == "save") {
+      do_save(iss);
+    } else if (command == "resume") {
+      do_resume(iss);
     } else if (command == "run") {
-      do_run(iss);
+      do_run(iss, /*report=*/false);
+    } else if (command == "time") {
+      do_run(iss, /*report=*/true);
+    } else if (command == "undo") {
+      do_undo();
+    } else if (command == "checkpoints") {
+      do_checkpoints();
+    } else if (command == "checkout") {
+      do_checkout(iss);
+    } else if (command == "profile") {
+      do_profile(iss);
     } else if (command == "fixpoint") {
       do_fixpoint(iss);
+    } else if (command == "pipeline") {
+      do_pipeline(iss);
     } else if (command == "quit") {
       std::cout << "goodbye." << std::endl;
       break;
@@ -531,6 +883,10 @@ int main(int argc, char* argv[]) {
     linenoiseFree(input);
   }
 
+  if (!FLAGS_trace.empty()) {
+    rellic::StopTracing(FLAGS_trace);
+  }
+
   google::ShutDownCommandLineFlags();
   google::ShutdownGoogleLogging();
 
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <clang/AST/Decl.h>
+#include <clang/Tooling/Tooling.h>
+#include <gflags/gflags.h>
+#include <glog/logging.h>
+#include <llvm/ADT/SmallVector.h>
+#include <llvm/ADT/StringRef.h>
+
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "rellic/AST/TypeLibrary.h"
+#include "rellic/Exception.h"
+
+DEFINE_string(input, "",
+              "Comma-separated list of C headers whose declarations are "
+              "added to the library.");
+DEFINE_string(output, "", "Output type library file.");
+DEFINE_string(target, "",
+              "Target triple the headers are parsed for (defaults to the "
+              "host).");
+DEFINE_string(clang_args, "",
+              "Space-separated arguments passed to clang when parsing the "
+              "headers, e.g. include paths and macro definitions.");
+
+int main(int argc, char* argv[]) {
+  std::stringstream usage;
+  usage << std::endl
+        << std::endl
+        << "  " << argv[0] << " \\" << std::endl
+        << "    --input HEADER[,HEADER...] \\" << std::endl
+        << "    --output OUTPUT_LIBRARY \\" << std::endl
+        << "    [--target TRIPLE] \\" << std::endl
+        << "    [--clang_args ARGS] \\" << std::endl
+        << std::endl;
+
+  google::InitGoogleLogging(argv[0]);
+  google::InstallFailureSignalHandler();
+  google::SetUsageMessage(usage.str());
+  google::ParseCommandLineFlags(&argc, &argv, true);
+
+  LOG_IF(FATAL, FLAGS_input.empty()) << "Must specify at least one header";
+  LOG_IF(FATAL, FLAGS_output.empty()) << "Must specify an output file";
+
+  // The headers are parsed as one translation unit, in the order given
+  std::string code;
+  llvm::SmallVector<llvm::StringRef, 8> headers;
+  llvm::StringRef(FLAGS_input).split(headers, ',', -1, false);
+  for (auto header : headers) {
+    code += "#include \"" + header.str() + "\"\n";
+  }
+
+  std::vector<std::string> args;
+  if (!FLAGS_target.empty()) {
+    args.push_back("-target");
+    args.push_back(FLAGS_target);
+  }
+  llvm::SmallVector<llvm::StringRef, 8> clang_args;
+  llvm::StringRef(FLAGS_clang_args).split(clang_args, ' ', -1, false);
+  for (auto arg : clang_args) {
+    args.push_back(arg.str());
+  }
+
+  auto ast_unit{clang::tooling::buildASTFromCodeWithArgs(
+      code, args, "typelib.c", "rellic-typelib")};
+  LOG_IF(FATAL, !ast_unit) << "Headers could not be parsed";
+
+  auto& ast_ctx{ast_unit->getASTContext()};
+  rellic::TypeLibraryBuilder builder(ast_ctx);
+  unsigned added{0};
+  unsigned skipped{0};
+  for (auto decl : ast_ctx.getTranslationUnitDecl()->decls()) {
+    auto declarator{clang::dyn_cast<clang::DeclaratorDecl>(decl)};
+    if (!declarator || !declarator->getIdentifier() ||
+        !(clang::isa<clang::FunctionDecl>(declarator) ||
+          clang::isa<clang::VarDecl>(declarator))) {
+      continue;
+    }
+    if (builder.Add(declarator)) {
+      ++added;
+    } else {
+      DLOG(WARNING) << "Skipping " << declarator->getName().str();
+      ++skipped;
+    }
+  }
+
+  try {
+    builder.Save(FLAGS_output);
+  } catch (rellic::Exception& ex) {
+    LOG(FATAL) << ex.what();
+  }
+  LOG(INFO) << added << " declarations added, " << skipped << " skipped";
+
+  google::ShutDownCommandLineFlags();
+  google::ShutdownGoogleLogging();
+
+  return EXIT_SUCCESS;
+}
@@ -59,6 +59,8 @@
 #include <string>
 
 #include "Printer.h"
+#include "rellic/Dec2Hex.h"
+#include "rellic/Printer.h"
 
 using namespace clang;
 
@@ -137,6 +139,7 @@ class StmtPrinter : public StmtVisitor<StmtPrinter> {
   void PrintOMPExecutableDirective(OMPExecutableDirective *S,
                                    bool ForceNoStmt = false);
   void PrintFPPragmas(CompoundStmt *S);
+  void PrintIntegerList(const InitListExpr *Node);
 
   void PrintExpr(Expr *E) {
     if (E)
@@ -1966,12 +1969,46 @@ void StmtPrinter::VisitConvertVectorExpr(ConvertVectorExpr *Node) {
   OS << ")";
 }
 
+// Prints the same as visiting every element of `Node`, a list returned by
+// `rellic::GetIntegerList`, but formats them into a single buffer
+void StmtPrinter::PrintIntegerList(const InitListExpr *Node) {
+  QualType Ty = Node->getInit(0)->getType();
+  bool isSigned = Ty->isSignedIntegerType();
+  StringRef Suffix = rellic::GetIntegerLiteralSuffix(Ty);
+  SmallString<256> Buf;
+  raw_svector_ostream BufOS(Buf);
+  SmallString<24> Digits;
+  BufOS << "{";
+  for (unsigned i = 0, e = Node->getNumInits(); i != e; ++i) {
+    if (i) BufOS << ", ";
+    const Expr *Init = Node->getInit(i);
+    // Same as Visit and VisitIntegerLiteral
+    BufOS << "<span class=\"clang stmt\" id=\"";
+    BufOS.write_hex((unsigned long long)Init);
+    BufOS << "\"><span class=\"clang number integer-literal\">";
+    llvm::APInt Value = cast<IntegerLiteral>(Init)->getValue();
+    Digits.clear();
+    rellic::AppendInteger(Digits, Value, isSigned, Value.getZExtValue() >= 16);
+    BufOS << Digits << Suffix << "</span></span>";
+  }
+  BufOS << "}";
+  OS << Buf;
+}
+
 void StmtPrinter::VisitInitListExpr(InitListExpr *Node) {
   if (Node->getSyntacticForm()) {
     Visit(Node->getSyntacticForm());
     return;
   }
 
+  // Global arrays of data can have millions of elements
+  if (!Helper && !Policy.ConstantsAsWritten) {
+    if (auto List = rellic::GetIntegerList(Node)) {
+      PrintIntegerList(List);
+      return;
+    }
+  }
+
   OS << "{";
   for (unsigned i = 0, e = Node->getNumInits(); i != e; ++i) {
     if (i) OS << ", ";
@@ -7,29 +7,50 @@
  */
 
 #include <clang/Frontend/ASTUnit.h>
-#include <clang/Tooling/Tooling.h>
 #include <gflags/gflags.h>
 #include <glog/logging.h>
 #include <httplib.h>
+#include <llvm/ADT/StringExtras.h>
+#include <llvm/Bitcode/BitcodeWriter.h>
 #include <llvm/IR/AssemblyAnnotationWriter.h>
 #include <llvm/IR/InstIterator.h>
 #include <llvm/IR/LLVMContext.h>
 #include <llvm/IR/Module.h>
+#include <llvm/IR/ModuleSlotTracker.h>
 #include <llvm/IR/PassManager.h>
-#include <llvm/InitializePasses.h>
 #include <llvm/Pass.h>
 #include <llvm/Passes/PassBuilder.h>
 #include <llvm/Support/FileSystem.h>
+#include <llvm/Support/Format.h>
 #include <llvm/Support/FormattedStream.h>
 #include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/Path.h>
+#include <llvm/Support/ThreadPool.h>
 #include <llvm/Support/raw_ostream.h>
+#include <llvm/Support/xxhash.h>
 #include <llvm/Transforms/Utils.h>
 #include <llvm/Transforms/Utils/Local.h>
 #include <llvm/Transforms/Utils/LowerSwitch.h>
+#include <sys/resource.h>
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <deque>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <memory>
 #include <mutex>
+#include <numeric>
+#include <optional>
+#include <queue>
 #include <random>
 #include <shared_mutex>
 #include <sstream>
@@ -38,27 +59,28 @@
 #include <thread>
 #include <unordered_map>
 #include <utility>
+#include <vector>
 
 #include "Printer.h"
 #include "rellic/AST/ASTPass.h"
-#include "rellic/AST/CondBasedRefine.h"
-#include "rellic/AST/DeadStmtElim.h"
+#include "rellic/AST/ASTUnitFactory.h"
+#include "rellic/AST/Checkpoint.h"
+#include "rellic/AST/CostEstimate.h"
 #include "rellic/AST/DebugInfoCollector.h"
-#include "rellic/AST/ExprCombine.h"
 #include "rellic/AST/GenerateAST.h"
 #include "rellic/AST/IRToASTVisitor.h"
 #include "rellic/AST/LocalDeclRenamer.h"
-#include "rellic/AST/LoopRefine.h"
-#include "rellic/AST/MaterializeConds.h"
-#include "rellic/AST/NestedCondProp.h"
-#include "rellic/AST/NestedScopeCombine.h"
-#include "rellic/AST/ReachBasedRefine.h"
+#include "rellic/AST/PassRegistry.h"
+#include "rellic/AST/Progress.h"
+#include "rellic/AST/Snapshot.h"
 #include "rellic/AST/StructFieldRenamer.h"
 #include "rellic/AST/Util.h"
-#include "rellic/AST/Z3CondSimplify.h"
+#include "rellic/Activity.h"
 #include "rellic/BC/Util.h"
 #include "rellic/Decompiler.h"
 #include "rellic/Exception.h"
+#include "rellic/Printer.h"
+#include "rellic/Trace.h"
 #include "rellic/Version.h"
 
 #ifndef LLVM_VERSION_STRING
@@ -70,10 +92,71 @@ DEFINE_string(address, "0.0.0.0", "Address on which the server will listen");
 DEFINE_int32(port, 80, "Port on which the server will listen");
 DEFINE_string(home, "./www", "");
 DEFINE_string(angha, "./anghabench", "Path for anghabench files");
+DEFINE_uint32(angha_refresh, 300,
+              "Age in seconds after which the index of --angha is built "
+              "again, in the background (0 never rebuilds it).");
+DEFINE_string(snapshots, "./snapshots",
+              "Directory where sessions are saved and resumed from");
+DEFINE_string(trace, "",
+              "Write a Chrome Trace Event file of the handled requests to this "
+              "path when the server shuts down.");
+DEFINE_uint32(trace_granularity, 500,
+              "Minimum duration in microseconds of the spans recorded with "
+              "--trace.");
+DEFINE_uint32(job_workers, 0,
+              "Number of threads that run decompilation and refinement jobs "
+              "(0 uses all available hardware threads).");
+DEFINE_uint32(max_queued_jobs, 64,
+              "Number of jobs that can wait for a worker before new ones are "
+              "rejected.");
+DEFINE_uint64(max_job_cost, 0,
+              "Estimated cost above which decompilation jobs are rejected, in "
+              "the units of rellic::EstimateModuleCost (0 means no limit).");
+DEFINE_uint64(session_cost_budget, 0,
+              "Estimated cost of the decompilation jobs that a session can "
+              "have admitted within 10 minutes, beyond which they are "
+              "rejected until enough of it is freed again (0 means no "
+              "limit).");
+DEFINE_uint64(session_memory_budget, 0,
+              "Estimated memory in MiB that sessions can use before the least "
+              "recently used ones are spilled to disk (0 means no limit).");
+DEFINE_string(spill_dir, "./spill",
+              "Directory where sessions are spilled to when they exceed "
+              "--session_memory_budget");
+DEFINE_string(cache_dir, "./cache",
+              "Directory where decompiled modules shared between sessions are "
+              "saved, for sessions that modify them to get their own copy");
+DEFINE_string(preload, "",
+              "File listing bitcode modules, one path per line, that are "
+              "decompiled in the background when the server starts, so that "
+              "sessions loading them later share the result at once.");
+DEFINE_uint32(max_event_streams, 16,
+              "Number of clients that can follow the events of their session "
+              "at once. Each of them takes a thread of the server.");
 
 using namespace std::chrono_literals;
 
 static constexpr auto SessionPersistenceTime{30min};
+// Time over which `--session_cost_budget` is freed again
+static constexpr std::chrono::duration<double> CostBudgetWindow{10min};
+// Queued jobs run cheapest first, except that a job that has waited longer
+// than this goes first, so that large jobs are delayed but not starved
+static constexpr auto MaxJobWait{30s};
+// How often the memory used by sessions is checked against the budget
+static constexpr auto EvictionInterval{10s};
+// Sessions accessed more recently than this are never spilled, since they are
+// likely to be in the middle of a sequence of requests
+static constexpr auto MinIdleTimeBeforeSpill{10s};
+// Events kept for the clients of a session that reconnect, and how often
+// progress is pushed to them at most
+static constexpr size_t kMaxBufferedEvents{256};
+static constexpr auto ProgressEventInterval{200ms};
+// Event streams with nothing to send are written a comment this often, so
+// that proxies do not close them
+static constexpr auto EventKeepAliveInterval{15s};
+// Rough size of an instruction, basic block or global in a module. LLVM does
+// not account for the memory it allocates, so module sizes are estimated.
+static constexpr size_t IRBytesPerValue{128};
 
 static void SetVersion(void) {
   std::stringstream version;
@@ -104,21 +187,458 @@ static void SetVersion(void) {
   google::SetVersionString(version.str());
 }
 
+// Distribution of durations, exported as a Prometheus histogram. Buckets are
+// cumulative, and the last one, for durations above every bound, is implied
+// by the total count.
+class Histogram {
+  static constexpr std::array<double, 14> kBounds{
+      0.001, 0.005, 0.01, 0.025, 0.05, 0.1, 0.25,
+      0.5,   1,     2.5,  5,     10,   60,  300};
+  std::array<uint64_t, kBounds.size()> buckets{};
+  uint64_t count{0};
+  double sum{0};
+
+ public:
+  void Observe(double seconds) {
+    for (size_t i{0}; i < kBounds.size(); ++i) {
+      buckets[i] += seconds <= kBounds[i];
+    }
+    ++count;
+    sum += seconds;
+  }
+
+  // Writes the series of the histogram, whose labels other than `le` are
+  // `labels`, e.g. `route="/action/ast"`
+  void Write(llvm::raw_ostream& os, llvm::StringRef name,
+             llvm::StringRef labels) const {
+    auto sep{labels.empty() ? "" : ","};
+    for (size_t i{0}; i < kBounds.size(); ++i) {
+      os << name << "_bucket{" << labels << sep << "le=\""
+         << llvm::format("%g", kBounds[i]) << "\"} " << buckets[i] << '\n';
+    }
+    os << name << "_bucket{" << labels << sep << "le=\"+Inf\"} " << count
+       << '\n';
+    os << name << "_sum{" << labels << "} " << llvm::format("%g", sum)
+       << '\n';
+    os << name << "_count{" << labels << "} " << count << '\n';
+  }
+};
+
+// What is exported at `/metrics`, other than what is measured when it is
+// requested. Counters only ever grow, as Prometheus expects.
+static struct {
+  std::mutex Mutex;
+  // Guarded by `Mutex`, keyed by route and method, or by action
+  std::map<std::pair<std::string, std::string>, Histogram> Requests;
+  std::map<std::string, Histogram> Jobs;
+  std::map<std::string, rellic::PassStatistics> Passes;
+
+  std::atomic<uint64_t> Z3Queries{0};
+  std::atomic<uint64_t> Z3Nanoseconds{0};
+  std::atomic<uint64_t> ProveHits{0}, ProveMisses{0};
+  std::atomic<uint64_t> SimplifyHits{0}, SimplifyMisses{0};
+  std::atomic<uint64_t> RenderHits{0}, RenderMisses{0};
+  std::atomic<uint64_t> ModuleHits{0}, ModuleMisses{0};
+} metrics;
+
+// Flattened provenance of a translation unit, from which pages of entries are
+// served without holding the locks of the session
+struct ProvenanceIndex {
+  // Maps of `rellic::DecompilationContext` the entries come from
+  static constexpr std::array<const char*, 5> Maps{
+      "stmt_provenance", "type_decls", "value_decls", "temp_decls",
+      "use_provenance"};
+
+  struct Entry {
+    unsigned Map;
+    uint64_t From, To;
+  };
+  std::vector<Entry> Entries;
+  // Indices of the entries whose IR belongs to each function, by name
+  std::unordered_map<std::string, std::vector<size_t>> Functions;
+  // Both pointers of every entry along with its index, sorted
+  std::vector<std::pair<uint64_t, size_t>> Pointers;
+};
+
+// HTML renderings of a module and of the functions of its translation unit,
+// and the index of its provenance, kept until they are modified. Each function
+// has a generation that is bumped whenever it changes, so that clients can
+// tell which ones to fetch again, and the cache as a whole has a version that
+// is bumped whenever anything changes.
+class RenderCache {
+  std::mutex mutex;
+  uint64_t version{0};
+  std::unordered_map<const clang::FunctionDecl*, unsigned> generations;
+  // Renderings are shared with the published versions of the session, which
+  // keep them once they are replaced here
+  std::unordered_map<const clang::FunctionDecl*,
+                     std::pair<unsigned, std::shared_ptr<const std::string>>>
+      functions;
+  std::optional<std::string> module;
+  std::shared_ptr<const ProvenanceIndex> provenance;
+
+ public:
+  using Printer = std::function<void(llvm::raw_ostream&)>;
+
+  uint64_t GetVersion() {
+    std::unique_lock<std::mutex> lock(mutex);
+    return version;
+  }
+
+  unsigned GetGeneration(const clang::FunctionDecl* fdecl) {
+    std::unique_lock<std::mutex> lock(mutex);
+    return generations[fdecl];
+  }
+
+  // Returns the rendering of `fdecl`, which is printed with `print` if it
+  // changed since it was last rendered. Functions can be rendered
+  // concurrently, but not while they are being modified.
+  std::shared_ptr<const std::string> GetFunction(
+      const clang::FunctionDecl* fdecl, const Printer& print) {
+    unsigned generation;
+    {
+      std::unique_lock<std::mutex> lock(mutex);
+      generation = generations[fdecl];
+      auto it{functions.find(fdecl)};
+      if (it != functions.end() && it->second.first == generation) {
+        ++metrics.RenderHits;
+        return it->second.second;
+      }
+    }
+    ++metrics.RenderMisses;
+    std::string html;
+    llvm::raw_string_ostream os(html);
+    print(os);
+    os.flush();
+    auto rendered{std::make_shared<const std::string>(std::move(html))};
+    std::unique_lock<std::mutex> lock(mutex);
+    functions[fdecl] = {generation, rendered};
+    return rendered;
+  }
+
+  std::string GetModule(const Printer& print) {
+    std::unique_lock<std::mutex> lock(mutex);
+    ++(module ? metrics.RenderHits : metrics.RenderMisses);
+    if (!module) {
+      module.emplace();
+      llvm::raw_string_ostream os(*module);
+      print(os);
+    }
+    return *module;
+  }
+
+  // Returns the provenance index, which is built with `build` if the module or
+  // its AST changed since it was last built
+  std::shared_ptr<const ProvenanceIndex> GetProvenance(
+      const std::function<ProvenanceIndex()>& build) {
+    std::unique_lock<std::mutex> lock(mutex);
+    if (!provenance) {
+      provenance = std::make_shared<const ProvenanceIndex>(build());
+    }
+    return provenance;
+  }
+
+  void InvalidateFunction(const clang::FunctionDecl* fdecl) {
+    std::unique_lock<std::mutex> lock(mutex);
+    ++version;
+    ++generations[fdecl];
+    functions.erase(fdecl);
+    provenance = nullptr;
+  }
+
+  void InvalidateModule() {
+    std::unique_lock<std::mutex> lock(mutex);
+    ++version;
+    module = std::nullopt;
+    provenance = nullptr;
+  }
+
+  // Forgets everything, for when the module or translation unit is replaced
+  void Clear() {
+    std::unique_lock<std::mutex> lock(mutex);
+    ++version;
+    generations.clear();
+    functions.clear();
+    module = std::nullopt;
+    provenance = nullptr;
+  }
+};
+
+// Events of a session that are pushed to its clients over `/action/events` as
+// server-sent events, so that they learn about the progress of jobs and about
+// what changed without polling. Events are numbered, and the latest ones are
+// kept so that clients that reconnect can resume after the last one they got.
+class EventChannel {
+  std::mutex mutex;
+  std::condition_variable cv;
+  // Events as they are sent, the first of which is numbered `first`
+  std::deque<std::string> events;
+  uint64_t first{1};
+  bool closed{false};
+  std::chrono::steady_clock::time_point last_progress;
+
+  void PushLocked(const char* type, llvm::json::Object data) {
+    std::string event;
+    llvm::raw_string_ostream os(event);
+    // JSON is printed on a single line, as the `data` field requires
+    os << "id: " << first + events.size() << "\nevent: " << type
+       << "\ndata: " << llvm::json::Value(std::move(data)) << "\n\n";
+    os.flush();
+    events.push_back(std::move(event));
+    if (events.size() > kMaxBufferedEvents) {
+      events.pop_front();
+      ++first;
+    }
+    cv.notify_all();
+  }
+
+ public:
+  void Push(const char* type, llvm::json::Object data) {
+    std::unique_lock<std::mutex> lock(mutex);
+    PushLocked(type, std::move(data));
+  }
+
+  // Pushes `progress` unless it was pushed less than `ProgressEventInterval`
+  // ago. Called from every thread that reports progress.
+  void PushProgress(const rellic::Progress& progress) {
+    auto now{std::chrono::steady_clock::now()};
+    std::unique_lock<std::mutex> lock(mutex);
+    if (now - last_progress < ProgressEventInterval) {
+      return;
+    }
+    last_progress = now;
+    auto stage{progress.stage.load()};
+    PushLocked("progress",
+               {{"stage", stage ? llvm::json::Value(stage) : nullptr},
+                {"functionsGenerated", progress.functions_generated.load()},
+                {"functionsTotal", progress.functions_total.load()},
+                {"functionsRefined", progress.functions_refined.load()},
+                {"iteration", progress.iteration.load()},
+                {"z3Calls", progress.z3_calls.load()}});
+  }
+
+  // Number of the next event to be pushed
+  uint64_t GetNext() {
+    std::unique_lock<std::mutex> lock(mutex);
+    return first + events.size();
+  }
+
+  // Appends the events from number `next` on to `out`, waiting up to
+  // `timeout` for one if there are none yet, and advances `next` past them.
+  // Events that were dropped before they could be read are replaced by a
+  // `reset` event, after which clients fetch everything again. Returns false
+  // once the channel is closed.
+  bool Read(uint64_t& next, std::string& out,
+            std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(mutex);
+    cv.wait_for(lock, timeout,
+                [&] { return closed || next < first + events.size(); });
+    if (closed) {
+      return false;
+    }
+    if (next < first) {
+      out += "event: reset\ndata: {}\n\n";
+      next = first;
+    }
+    for (; next < first + events.size(); ++next) {
+      out += events[next - first];
+    }
+    return true;
+  }
+
+  // Ends the streams of the clients, once the session expires
+  void Close() {
+    std::unique_lock<std::mutex> lock(mutex);
+    closed = true;
+    cv.notify_all();
+  }
+};
+
+// A decompiled module shared by every session that loaded the same bitcode,
+// which none of them can modify. It is also saved as a snapshot, from which
+// sessions that need to modify it load a copy of their own.
+struct CachedModule {
+  uint64_t Hash;
+  std::string Snapshot;
+  // Declared in the order they must be created, to be destroyed in reverse
+  std::unique_ptr<llvm::LLVMContext> Context;
+  std::unique_ptr<llvm::Module> Module;
+  std::unique_ptr<clang::ASTUnit> Unit;
+  std::unique_ptr<rellic::DecompilationContext> DecompContext;
+  RenderCache Rendered;
+
+  ~CachedModule() {
+    for (auto ext : {".bc", ".ast", ".json"}) {
+      llvm::sys::fs::remove(Snapshot + ext);
+    }
+  }
+};
+
+// Renderings of the last version of a session that no request was modifying.
+// Readers are served them instead of waiting while a job modifies the
+// session, so that its module and AST can still be viewed. Immutable once
+// published, and kept alive by the readers that still use them.
+struct PublishedVersion {
+  // Cache and version of it that the renderings were taken from
+  const RenderCache* Source;
+  uint64_t Version;
+  std::string Module;
+  // The rest is only set if there was an AST
+  std::optional<std::string> AST;
+  struct Function {
+    std::string Name;
+    unsigned Generation;
+    std::shared_ptr<const std::string> HTML;
+  };
+  std::vector<Function> Functions;
+  std::shared_ptr<const ProvenanceIndex> Provenance;
+};
+
 struct Session {
   size_t Id;
   std::chrono::time_point<std::chrono::system_clock> LastAccess;
+  // Progress of the latest job of the session, reset when a job is queued.
+  // Declared before the contexts that refer to it, to be destroyed last.
+  rellic::Progress Progress;
   std::unique_ptr<llvm::LLVMContext> Context;
   std::unique_ptr<llvm::Module> Module;
   std::unique_ptr<clang::ASTUnit> Unit;
   std::unique_ptr<rellic::ASTPass> Pass;
   std::unique_ptr<rellic::DecompilationContext> DecompContext;
+  // Taken before every run and fixpoint so that they can be undone, along with
+  // what was run. They refer to `DecompContext`, so they are dropped whenever
+  // it is replaced or its functions are generated again.
+  std::unique_ptr<rellic::Checkpoints> Checkpoints;
+  std::vector<std::string> CheckpointLabels;
+  // Hashes of the IR of each function at the time of the last decompilation,
+  // used to only decompile the functions that have changed since then
+  std::unordered_map<llvm::Function*, uint64_t> Fingerprints;
   // Must always be acquired in this order and released all at once
   std::shared_mutex LoadMutex, MutationMutex;
+  // Whether the module and AST were saved to disk and freed to stay within
+  // the memory budget. Set while holding `LoadMutex` exclusively.
+  std::atomic<bool> Spilled{false};
+  // Estimated memory used by the session when it was last measured
+  std::atomic<size_t> MemoryUsage{0};
+  // Used instead of `Module`, `Unit` and `DecompContext`, which are null,
+  // until the session modifies the module or its AST
+  std::shared_ptr<CachedModule> Shared;
+  // Hash of the bitcode the module was loaded from, if neither the module nor
+  // its AST have been modified since
+  std::optional<uint64_t> LoadedHash;
+  RenderCache Rendered;
+  // Published by the requests that modify the session before they do, but
+  // only once it has been viewed, since rendering it is not free
+  std::atomic<bool> Viewed{false};
+  std::mutex PublishedMutex;
+  std::shared_ptr<const PublishedVersion> Published;
+  // Estimated cost of the jobs admitted for the session as of `AdmittedAt`,
+  // which `--session_cost_budget` is freed from over `CostBudgetWindow`.
+  // Guarded by `jobs_mutex`.
+  double AdmittedCost{0};
+  std::chrono::time_point<std::chrono::steady_clock> AdmittedAt;
+  // Shared with the streams of its clients and with its jobs, which can
+  // outlive it
+  std::shared_ptr<EventChannel> Events;
+};
+
+// What the handlers that only read a session look at
+struct SessionView {
+  llvm::Module* Module;
+  clang::ASTUnit* Unit;
+  rellic::DecompilationContext* DecompContext;
+  RenderCache* Rendered;
 };
 
+static SessionView GetView(Session& session) {
+  if (session.Shared) {
+    return {session.Shared->Module.get(), session.Shared->Unit.get(),
+            session.Shared->DecompContext.get(), &session.Shared->Rendered};
+  }
+  return {session.Module.get(), session.Unit.get(),
+          session.DecompContext.get(), &session.Rendered};
+}
+
+// Bumps the generation of `fdecl` and tells the clients of `session` about it
+static void InvalidateFunction(Session& session,
+                               const clang::FunctionDecl* fdecl) {
+  session.Rendered.InvalidateFunction(fdecl);
+  session.Events->Push(
+      "function", {{"name", fdecl->getNameAsString()},
+                   {"generation", session.Rendered.GetGeneration(fdecl)}});
+}
+
+// Tells the clients of `session` that its AST was replaced, or changed in ways
+// that are not tracked by function
+static void ClearAST(Session& session) {
+  session.Rendered.Clear();
+  session.Events->Push("ast", {});
+}
+
+// Tells the clients of `session` that its module was replaced or modified
+static void InvalidateModule(Session& session) {
+  session.Rendered.InvalidateModule();
+  session.Events->Push("module", {});
+}
+
+// Bumps the generation of the functions changed by `pass`
+static void InvalidateRendered(Session& session, const rellic::ASTPass& pass) {
+  if (pass.HasUntrackedChanges()) {
+    ClearAST(session);
+    return;
+  }
+  for (auto fdecl : pass.GetModified()) {
+    InvalidateFunction(session, fdecl);
+  }
+}
+
+// Drops the checkpoints of `session`, before its context is replaced
+static void DropCheckpoints(Session& session) {
+  session.Checkpoints = nullptr;
+  session.CheckpointLabels.clear();
+}
+
+// Takes a checkpoint of the AST of `session` before it is refined by
+// `label`. The session must have a context of its own.
+static void TakeCheckpoint(Session& session, const std::string& label) {
+  if (!session.Checkpoints) {
+    session.Checkpoints =
+        std::make_unique<rellic::Checkpoints>(*session.DecompContext);
+  }
+  session.Checkpoints->Create();
+  session.CheckpointLabels.push_back(label);
+}
+
 static httplib::Server svr;
-static std::unordered_map<size_t, Session> sessions;
-static std::mutex sessions_mutex;
+
+// Sessions are spread over shards by id, so that requests from different
+// sessions rarely wait for each other to look theirs up
+static constexpr size_t kNumSessionShards{16};
+
+struct SessionShard {
+  std::mutex Mutex;
+  // Shared with the requests and spills that use them, so that a session
+  // that expires meanwhile is only freed once they are done with it
+  std::unordered_map<size_t, std::shared_ptr<Session>> Sessions;
+};
+
+static std::array<SessionShard, kNumSessionShards> session_shards;
+
+static SessionShard& GetShard(size_t id) {
+  return session_shards[id % kNumSessionShards];
+}
+
+// Sessions ordered by when they expire, so that the oldest one is always on
+// top. Accessing a session does not update its entry, which is pushed again
+// with its new deadline once it reaches the top.
+using SessionDeadline =
+    std::pair<std::chrono::time_point<std::chrono::system_clock>, size_t>;
+static std::priority_queue<SessionDeadline, std::vector<SessionDeadline>,
+                           std::greater<SessionDeadline>>
+    session_deadlines;
+static std::mutex expiry_mutex;
+static std::condition_variable expiry_cv;
+static bool stop_expiry{false};
 
 static std::vector<std::string> Split(const std::string& s,
                                       const std::string& delim) {
@@ -137,6 +657,26 @@ static std::vector<std::string> Split(const std::string& s,
 using write_lock = std::unique_lock<std::shared_mutex>;
 using read_lock = std::shared_lock<std::shared_mutex>;
 
+// Takes `mutation_mutex` shared, unless a request is modifying the session
+// and a version of it was published before, which is returned instead so
+// that the caller does not wait
+static std::shared_ptr<const PublishedVersion> LockForReading(
+    Session& session, read_lock& mutation_mutex) {
+  session.Viewed = true;
+  mutation_mutex = read_lock(session.MutationMutex, std::try_to_lock);
+  if (mutation_mutex.owns_lock()) {
+    return nullptr;
+  }
+  {
+    std::unique_lock<std::mutex> lock(session.PublishedMutex);
+    if (session.Published) {
+      return session.Published;
+    }
+  }
+  mutation_mutex.lock();
+  return nullptr;
+}
+
 static std::unordered_map<std::string, std::string> GetCookies(
     const httplib::Request& req) {
   std::unordered_map<std::string, std::string> res;
@@ -155,52 +695,74 @@ static std::unordered_map<std::string, std::string> GetCookies(
   return res;
 }
 
-static void RemoveOldSessions() {
-  auto now{std::chrono::system_clock::now()};
+static bool eviction_requested{false};
 
-  bool old_sessions_erased{false};
-  do {
-    old_sessions_erased = false;
-    for (auto it{sessions.begin()}; it != sessions.end(); ++it) {
-      if (now - it->second.LastAccess > SessionPersistenceTime) {
-        sessions.erase(it);
-        old_sessions_erased = true;
-        break;
-      }
-    }
-  } while (old_sessions_erased);
+// Asks for the memory used by sessions to be checked as soon as possible,
+// after something that may have increased it
+static void RequestEviction() {
+  if (!FLAGS_session_memory_budget) {
+    return;
+  }
+  {
+    std::unique_lock<std::mutex> lock(expiry_mutex);
+    eviction_requested = true;
+  }
+  expiry_cv.notify_one();
+}
+
+static void ScheduleExpiry(
+    std::chrono::time_point<std::chrono::system_clock> deadline, size_t id) {
+  {
+    std::unique_lock<std::mutex> lock(expiry_mutex);
+    session_deadlines.emplace(deadline, id);
+  }
+  expiry_cv.notify_one();
 }
 
-static Session& GetSession(const httplib::Request& req) {
-  std::unique_lock<std::mutex> lock(sessions_mutex);
+static void ReloadSession(Session& session);
+
+// Returns the session of `req`, creating it if needed. It is not expired for
+// as long as the returned pointer is held.
+static std::shared_ptr<Session> GetSession(const httplib::Request& req) {
   auto now{std::chrono::system_clock::now()};
 
+  size_t id;
   auto cookies{GetCookies(req)};
   auto sessionId{cookies.find("sessionId")};
   if (sessionId != cookies.end()) {
-    auto id{std::stoull(sessionId->second)};
-    auto kvp{sessions.find(id)};
-    auto& session{sessions[id]};
-    session.LastAccess = now;
-    if (kvp == sessions.end()) {
-      session.Id = id;
-      session.Context = std::make_unique<llvm::LLVMContext>();
-    }
-
-    RemoveOldSessions();
-    return session;
+    id = std::stoull(sessionId->second);
+  } else {
+    std::random_device dev;
+    std::uniform_int_distribution<std::size_t> dist;
+    id = dist(dev);
   }
 
-  std::random_device dev;
-  std::uniform_int_distribution<std::size_t> dist;
-  size_t id{dist(dev)};
-  auto& session{sessions[id]};
-  session.Id = id;
+  auto& shard{GetShard(id)};
+  std::unique_lock<std::mutex> lock(shard.Mutex);
+  auto [it, inserted]{shard.Sessions.try_emplace(id)};
+  if (inserted) {
+    it->second = std::make_shared<Session>();
+  }
+  auto session_ptr{it->second};
+  auto& session{*session_ptr};
   session.LastAccess = now;
-  session.Context = std::make_unique<llvm::LLVMContext>();
-
-  RemoveOldSessions();
-  return session;
+  if (inserted) {
+    session.Id = id;
+    session.Context = std::make_unique<llvm::LLVMContext>();
+    session.Events = std::make_shared<EventChannel>();
+    session.Progress.on_update = [events{session.Events}](
+                                     const rellic::Progress& progress) {
+      events->PushProgress(progress);
+    };
+    lock.unlock();
+    ScheduleExpiry(now + SessionPersistenceTime, id);
+  } else {
+    lock.unlock();
+  }
+  if (session.Spilled) {
+    ReloadSession(session);
+  }
+  return session_ptr;
 }
 
 static void SendJSON(httplib::Response& res, llvm::json::Object& obj) {
@@ -217,172 +779,1366 @@ static void SendJSON(httplib::Response& res, llvm::json::Array& arr) {
   res.set_content(s, "application/json");
 }
 
-static httplib::Server::HandlerResponse PreRoutingHandler(
-    const httplib::Request& req, httplib::Response& res) {
-  auto& session{GetSession(req)};
-  std::string header{"sessionId="};
-  header += std::to_string(session.Id);
-  res.set_header("Set-Cookie", header.c_str());
+// Size of the chunks in which streamed responses are sent
+static constexpr size_t kStreamChunkSize{64 * 1024};
 
-  return httplib::Server::HandlerResponse::Unhandled;
-}
+// Output stream that sends what is written to it as chunks of a response
+class SinkStream : public llvm::raw_ostream {
+  httplib::DataSink& sink;
+  uint64_t pos{0};
 
-static void LoadModule(const httplib::Request& req, httplib::Response& res) {
-  auto& session{GetSession(req)};
-  write_lock lock(session.LoadMutex, std::try_to_lock);
-  if (!lock.owns_lock()) {
-    llvm::json::Object msg{
-        {"message",
-         "Cannot load a new module while other operations are in progress."}};
-    res.status = 409;
-    SendJSON(res, msg);
-    return;
+  void write_impl(const char* ptr, size_t size) override {
+    sink.write(ptr, size);
+    pos += size;
   }
 
-  auto mod{rellic::LoadModuleFromMemory(session.Context.get(), req.body, true)};
-  if (!mod) {
-    llvm::json::Object msg{{"message", "Couldn't load LLVM module."}};
-    res.status = 400;
-    SendJSON(res, msg);
-    return;
+  uint64_t current_pos() const override { return pos; }
+
+ public:
+  SinkStream(httplib::DataSink& sink) : sink(sink) {
+    SetBufferSize(kStreamChunkSize);
   }
-  session.Module = std::unique_ptr<llvm::Module>(mod);
-  llvm::json::Object msg{{"message", "Ok."}};
-  SendJSON(res, msg);
-  res.status = 200;
+  ~SinkStream() override { flush(); }
+};
+
+// Sends what `write` prints as a chunked response. The output is rendered
+// while the locks of the session are held, and they are released before any of
+// it is sent, so that a slow client does not hold up writers of the session.
+static void Stream(httplib::Response& res, const char* content_type,
+                   read_lock load_mutex, read_lock mutation_mutex,
+                   const std::function<void(llvm::raw_ostream&)>& write) {
+  auto output{std::make_shared<std::string>()};
+  {
+    llvm::raw_string_ostream os(*output);
+    write(os);
+  }
+  if (mutation_mutex) {
+    mutation_mutex.unlock();
+  }
+  if (load_mutex) {
+    load_mutex.unlock();
+  }
+  res.set_chunked_content_provider(
+      content_type, [output](size_t offset, httplib::DataSink& sink) {
+        if (offset < output->size()) {
+          auto size{std::min(kStreamChunkSize, output->size() - offset)};
+          sink.write(output->data() + offset, size);
+          return true;
+        }
+        sink.done();
+        return true;
+      });
 }
 
-static void Decompile(const httplib::Request& req, httplib::Response& res) {
-  auto& session{GetSession(req)};
-  read_lock load_mutex(session.LoadMutex);
-  write_lock mutation_mutex(session.MutationMutex);
+// Handlers run on the server's thread pool, so tracing has to be enabled on
+// each of them separately
+static httplib::Server::Handler Traced(httplib::Server::Handler handler) {
+  return [handler](const httplib::Request& req, httplib::Response& res) {
+    rellic::TraceThread trace_thread;
+    llvm::TimeTraceScope trace("Request", req.path);
+    auto start{std::chrono::steady_clock::now()};
+    handler(req, res);
+    // Responses that are streamed are only measured until they start
+    std::chrono::duration<double> elapsed{std::chrono::steady_clock::now() -
+                                          start};
+    std::unique_lock<std::mutex> lock(metrics.Mutex);
+    metrics.Requests[{req.path, req.method}].Observe(elapsed.count());
+  };
+}
 
-  if (!session.Module) {
-    llvm::json::Object msg{{"message", "No module loaded."}};
-    res.status = 400;
-    SendJSON(res, msg);
-    return;
-  }
+// Decompilation and refinement can take longer than clients are willing to
+// wait for a response, so they are queued as jobs and run on a pool of their
+// own. Clients poll the state of a job and then retrieve what the handler
+// would have responded with. Each session has at most one job that has not
+// finished, and one finished job whose result can be retrieved.
+enum class JobState { Queued, Running, Done, Cancelled };
+
+struct Job {
+  uint64_t Id;
+  size_t SessionId;
+  std::string Action;
+  JobState State{JobState::Queued};
+  // Estimated cost, 0 for jobs that are not estimated
+  uint64_t Cost{0};
+  // What the handler is called with, until it runs
+  httplib::Request Request;
+  httplib::Server::Handler Handler;
+  std::chrono::time_point<std::chrono::steady_clock> QueuedAt, StartedAt,
+      FinishedAt;
+  int Status{200};
+  std::string Body;
+  std::string ContentType;
+  // Channel of the session, to which changes of state are pushed
+  std::shared_ptr<EventChannel> Events;
+};
 
-  try {
-    std::vector<std::string> args{"-Wno-pointer-to-int-cast",
-                                  "-Wno-pointer-sign", "-target",
-                                  session.Module->getTargetTriple()};
-    session.Unit = clang::tooling::buildASTFromCodeWithArgs("", args, "out.c");
-    session.DecompContext =
-        std::make_unique<rellic::DecompilationContext>(*session.Unit);
-    rellic::DebugInfoCollector dic;
-    dic.visit(*session.Module);
-    rellic::GenerateAST::run(*session.Module, *session.DecompContext);
-    rellic::LocalDeclRenamer ldr{*session.DecompContext, dic.GetIRToNameMap()};
-    rellic::StructFieldRenamer sfr{*session.DecompContext,
-                                   dic.GetIRTypeToDITypeMap()};
-    ldr.Run();
-    sfr.Run();
+static std::mutex jobs_mutex;
+static std::unordered_map<uint64_t, std::shared_ptr<Job>> jobs;
+// Latest job of each session
+static std::unordered_map<size_t, std::shared_ptr<Job>> session_jobs;
+// Jobs that have not started, in the order they were queued. Jobs that are
+// cancelled stay until a worker takes them.
+static std::vector<std::shared_ptr<Job>> queued_jobs;
+static uint64_t next_job_id{1};
+static size_t num_queued_jobs{0};
+static std::unique_ptr<llvm::ThreadPool> job_pool;
+// Decompilation times of the functions of each shape, which decompilation
+// jobs are estimated from
+static rellic::CostHistory cost_history;
+
+static const char* GetStateName(JobState state) {
+  switch (state) {
+    case JobState::Queued:
+      return "queued";
+    case JobState::Running:
+      return "running";
+    case JobState::Done:
+      return "done";
+    case JobState::Cancelled:
+      return "cancelled";
+  }
+  return "";
+}
 
-    llvm::json::Object msg{{"message", "Ok."}};
-    SendJSON(res, msg);
-    res.status = 200;
-  } catch (rellic::Exception& e) {
-    llvm::json::Object msg{{"message", e.what()}};
-    SendJSON(res, msg);
-    res.status = 400;
-    session.Unit = nullptr;
+// Pushes the state of `job` to the clients of its session. Must be called with
+// `jobs_mutex` held.
+static void PushJobState(const Job& job) {
+  llvm::json::Object msg{{"job", job.Id},
+                         {"action", job.Action},
+                         {"state", GetStateName(job.State)}};
+  if (job.State == JobState::Done) {
+    msg["status"] = job.Status;
   }
+  job.Events->Push("job", std::move(msg));
 }
 
-static void RemovePhi(const httplib::Request& req, httplib::Response& res) {
-  auto& session{GetSession(req)};
-  read_lock load_mutex(session.LoadMutex);
-  write_lock mutation_mutex(session.MutationMutex);
+// Whether `a` runs before `b` when neither has waited longer than
+// `MaxJobWait`
+static bool RunsBefore(const Job& a, const Job& b) {
+  return a.Cost != b.Cost ? a.Cost < b.Cost : a.Id < b.Id;
+}
 
-  if (!session.Module) {
-    llvm::json::Object msg{{"message", "No module loaded."}};
-    res.status = 400;
-    SendJSON(res, msg);
-    return;
+// Runs the queued job that goes next. Every job that is queued submits one
+// call to the pool, so there is always one to take.
+static void RunNextJob() {
+  std::shared_ptr<Job> job;
+  httplib::Request req;
+  httplib::Server::Handler handler;
+  {
+    std::unique_lock<std::mutex> lock(jobs_mutex);
+    CHECK(!queued_jobs.empty());
+    auto now{std::chrono::steady_clock::now()};
+    auto next{queued_jobs.begin()};
+    if (now - (*next)->QueuedAt < MaxJobWait) {
+      next = std::min_element(
+          queued_jobs.begin(), queued_jobs.end(),
+          [](auto& a, auto& b) { return RunsBefore(*a, *b); });
+    }
+    job = std::move(*next);
+    queued_jobs.erase(next);
+    req = std::move(job->Request);
+    handler = std::move(job->Handler);
+    if (job->State == JobState::Cancelled) {
+      return;
+    }
+    --num_queued_jobs;
+    job->State = JobState::Running;
+    job->StartedAt = now;
+    PushJobState(*job);
   }
 
-  rellic::RemovePHINodes(*session.Module);
+  httplib::Response res;
+  {
+    rellic::TraceThread trace_thread;
+    llvm::TimeTraceScope trace("Job", job->Action);
+    rellic::ActivityScope activity("job", job->Action);
+    rellic::SetActivityDetail("job " + std::to_string(job->Id) + ", session " +
+                              std::to_string(job->SessionId));
+    handler(req, res);
+  }
 
-  llvm::json::Object msg{{"message", "Ok."}};
-  SendJSON(res, msg);
-  res.status = 200;
+  std::unique_lock<std::mutex> lock(jobs_mutex);
+  job->State = JobState::Done;
+  job->FinishedAt = std::chrono::steady_clock::now();
+  {
+    std::chrono::duration<double> elapsed{job->FinishedAt - job->StartedAt};
+    std::unique_lock<std::mutex> metrics_lock(metrics.Mutex);
+    metrics.Jobs[job->Action].Observe(elapsed.count());
+  }
+  // Handlers that succeed do not always set a status
+  job->Status = res.status == -1 ? 200 : res.status;
+  job->Body = std::move(res.body);
+  job->ContentType = res.get_header_value("Content-Type");
+  PushJobState(*job);
+  lock.unlock();
+  RequestEviction();
 }
 
-static void LowerSwitches(const httplib::Request& req, httplib::Response& res) {
-  auto& session{GetSession(req)};
-  read_lock load_mutex(session.LoadMutex);
-  write_lock mutation_mutex(session.MutationMutex);
+// Estimates the cost of a job from its session, see `Job::Cost`
+using CostEstimator = std::function<uint64_t(Session&)>;
+
+// Runs `handler` as a job, and responds with the id of the job. Jobs whose
+// cost `estimate` puts over `--max_job_cost`, or over what remains of the
+// `--session_cost_budget` of their session, are rejected.
+static httplib::Server::Handler Queued(httplib::Server::Handler handler,
+                                       CostEstimator estimate = nullptr) {
+  return [handler, estimate](const httplib::Request& req,
+                             httplib::Response& res) {
+    auto session_ptr{GetSession(req)};
+    auto& session{*session_ptr};
+    // Estimated before `jobs_mutex` is taken, since it locks the session
+    uint64_t cost{estimate ? estimate(session) : 0};
+    if (FLAGS_max_job_cost && cost > FLAGS_max_job_cost) {
+      llvm::json::Object msg{{"message", "Job too large."}, {"cost", cost}};
+      res.status = 413;
+      SendJSON(res, msg);
+      return;
+    }
+    std::unique_lock<std::mutex> lock(jobs_mutex);
+    auto& latest{session_jobs[session.Id]};
+    if (latest && (latest->State == JobState::Queued ||
+                   latest->State == JobState::Running)) {
+      llvm::json::Object msg{{"message", "Server busy."}, {"job", latest->Id}};
+      res.status = 409;
+      SendJSON(res, msg);
+      return;
+    }
+    if (num_queued_jobs >= FLAGS_max_queued_jobs) {
+      llvm::json::Object msg{{"message", "Too many queued jobs."}};
+      res.status = 503;
+      SendJSON(res, msg);
+      return;
+    }
+    auto now{std::chrono::steady_clock::now()};
+    if (FLAGS_session_cost_budget) {
+      double budget(FLAGS_session_cost_budget);
+      std::chrono::duration<double> elapsed{now - session.AdmittedAt};
+      session.AdmittedCost =
+          std::max(0.0, session.AdmittedCost -
+                            budget * (elapsed / CostBudgetWindow));
+      session.AdmittedAt = now;
+      // A job larger than the whole budget is admitted when nothing else is
+      auto excess{session.AdmittedCost + cost - budget};
+      if (excess > 0 && session.AdmittedCost > 0) {
+        auto wait{std::min(excess, session.AdmittedCost) / budget *
+                  CostBudgetWindow.count()};
+        res.set_header("Retry-After",
+                       std::to_string(static_cast<uint64_t>(wait) + 1));
+        llvm::json::Object msg{{"message", "Session budget exceeded."},
+                               {"cost", cost}};
+        res.status = 429;
+        SendJSON(res, msg);
+        return;
+      }
+      session.AdmittedCost += cost;
+    }
 
-  if (!session.Module) {
-    llvm::json::Object msg{{"message", "No module loaded."}};
-    res.status = 400;
+    if (latest) {
+      jobs.erase(latest->Id);
+    }
+    // No job of the session is running, so nothing reports progress
+    session.Progress.Reset();
+    latest = std::make_shared<Job>();
+    latest->Id = next_job_id++;
+    latest->SessionId = session.Id;
+    latest->Action = req.path;
+    latest->QueuedAt = now;
+    latest->Cost = cost;
+    // Only what handlers use is copied, since requests also refer to the
+    // connection they were received on
+    latest->Request.method = req.method;
+    latest->Request.path = req.path;
+    latest->Request.headers = req.headers;
+    latest->Request.body = req.body;
+    latest->Handler = handler;
+    latest->Events = session.Events;
+    PushJobState(*latest);
+    jobs[latest->Id] = latest;
+    queued_jobs.push_back(latest);
+    ++num_queued_jobs;
+    job_pool->async(RunNextJob);
+
+    llvm::json::Object msg{{"message", "Queued."}, {"job", latest->Id}};
+    res.status = 202;
     SendJSON(res, msg);
-    return;
-  }
-
-  rellic::LowerSwitches(*session.Module);
-
-  llvm::json::Object msg{{"message", "Ok."}};
-  SendJSON(res, msg);
-  res.status = 200;
+  };
 }
 
-static void RemoveInsertValue(const httplib::Request& req,
-                              httplib::Response& res) {
-  auto& session{GetSession(req)};
-  read_lock load_mutex(session.LoadMutex);
-  write_lock mutation_mutex(session.MutationMutex);
+// Returns the job named by the `id` parameter of `req` if it belongs to the
+// session of `req`, or null. Must be called with `jobs_mutex` held.
+static std::shared_ptr<Job> FindJob(const httplib::Request& req,
+                                    const Session& session) {
+  uint64_t id;
+  if (!req.has_param("id") ||
+      llvm::StringRef(req.get_param_value("id")).getAsInteger(10, id)) {
+    return nullptr;
+  }
+  auto it{jobs.find(id)};
+  if (it == jobs.end() || it->second->SessionId != session.Id) {
+    return nullptr;
+  }
+  return it->second;
+}
 
-  if (!session.Module) {
-    llvm::json::Object msg{{"message", "No module loaded."}};
-    res.status = 400;
+static void GetJobState(const httplib::Request& req, httplib::Response& res) {
+  auto session_ptr{GetSession(req)};
+  auto& session{*session_ptr};
+  std::unique_lock<std::mutex> lock(jobs_mutex);
+  auto job{FindJob(req, session)};
+  if (!job) {
+    llvm::json::Object msg{{"message", "No such job."}};
+    res.status = 404;
     SendJSON(res, msg);
     return;
   }
 
-  rellic::RemoveInsertValues(*session.Module);
-
-  llvm::json::Object msg{{"message", "Ok."}};
+  auto now{std::chrono::steady_clock::now()};
+  auto millis{[](auto duration) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(duration)
+        .count();
+  }};
+  llvm::json::Object msg{{"job", job->Id},
+                         {"action", job->Action},
+                         {"state", GetStateName(job->State)},
+                         {"cost", job->Cost}};
+  auto progress{[&session]() {
+    auto& progress{session.Progress};
+    auto stage{progress.stage.load()};
+    return llvm::json::Object{
+        {"stage", stage ? llvm::json::Value(stage) : nullptr},
+        {"functionsGenerated", progress.functions_generated.load()},
+        {"functionsTotal", progress.functions_total.load()},
+        {"functionsRefined", progress.functions_refined.load()},
+        {"iteration", progress.iteration.load()},
+        {"z3Calls", progress.z3_calls.load()},
+        {"cancelled", progress.cancelled.load()}};
+  }};
+  switch (job->State) {
+    case JobState::Queued: {
+      // Jobs are mostly started cheapest first, so this is only where it
+      // would start if nothing else was queued
+      size_t position{0};
+      for (auto& other : queued_jobs) {
+        position += other->State == JobState::Queued &&
+                    RunsBefore(*other, *job);
+      }
+      msg["position"] = position;
+      msg["waiting"] = millis(now - job->QueuedAt);
+    } break;
+    case JobState::Running:
+      msg["waiting"] = millis(job->StartedAt - job->QueuedAt);
+      msg["running"] = millis(now - job->StartedAt);
+      msg["progress"] = progress();
+      break;
+    case JobState::Done:
+      msg["waiting"] = millis(job->StartedAt - job->QueuedAt);
+      msg["running"] = millis(job->FinishedAt - job->StartedAt);
+      msg["progress"] = progress();
+      break;
+    case JobState::Cancelled:
+      break;
+  }
+  res.status = 200;
   SendJSON(res, msg);
 }
 
-static void RemoveArrayArguments(const httplib::Request& req,
-                                 httplib::Response& res) {
-  auto& session{GetSession(req)};
-  read_lock load_mutex(session.LoadMutex);
-  write_lock mutation_mutex(session.MutationMutex);
-
-  if (!session.Module) {
-    llvm::json::Object msg{{"message", "No module loaded."}};
-    res.status = 400;
+static void GetJobResult(const httplib::Request& req, httplib::Response& res) {
+  auto session_ptr{GetSession(req)};
+  auto& session{*session_ptr};
+  std::unique_lock<std::mutex> lock(jobs_mutex);
+  auto job{FindJob(req, session)};
+  if (!job) {
+    llvm::json::Object msg{{"message", "No such job."}};
+    res.status = 404;
     SendJSON(res, msg);
     return;
   }
 
-  rellic::ConvertArrayArguments(*session.Module);
+  if (job->State == JobState::Cancelled) {
+    llvm::json::Object msg{{"message", "Cancelled."}};
+    res.status = 200;
+    SendJSON(res, msg);
+  } else if (job->State != JobState::Done) {
+    llvm::json::Object msg{{"message", "Job has not finished."}};
+    res.status = 409;
+    SendJSON(res, msg);
+  } else {
+    res.status = job->Status;
+    res.set_content(job->Body, job->ContentType.c_str());
+  }
+}
 
+static std::atomic<unsigned> num_event_streams{0};
+
+// Streams the events of the session of `req` as server-sent events, starting
+// after the one named by the `Last-Event-ID` header if the client reconnects.
+// The stream takes a thread of the server until the client goes away or the
+// session expires.
+static void StreamEvents(const httplib::Request& req, httplib::Response& res) {
+  auto events{GetSession(req)->Events};
+  if (++num_event_streams > FLAGS_max_event_streams) {
+    --num_event_streams;
+    llvm::json::Object msg{{"message", "Too many event streams."}};
+    res.status = 503;
+    SendJSON(res, msg);
+    return;
+  }
+  // Counts the stream until the response, and with it the provider, is gone
+  struct StreamSlot {
+    ~StreamSlot() { --num_event_streams; }
+  };
+  auto slot{std::make_shared<StreamSlot>()};
+
+  auto next{events->GetNext()};
+  uint64_t last;
+  if (!llvm::StringRef(req.get_header_value("Last-Event-ID"))
+           .getAsInteger(10, last)) {
+    next = std::min(next, last + 1);
+  }
+  res.status = 200;
+  res.set_header("Cache-Control", "no-cache");
+  res.set_chunked_content_provider(
+      "text/event-stream",
+      [events, slot, next](size_t, httplib::DataSink& sink) mutable {
+        std::string out;
+        auto keep_alive{std::chrono::steady_clock::now() +
+                        EventKeepAliveInterval};
+        // Waits a second at a time, so that clients that went away and
+        // servers that stop are noticed
+        while (out.empty()) {
+          if (!sink.is_writable()) {
+            return false;
+          }
+          if (!events->Read(next, out, 1s)) {
+            sink.done();
+            return true;
+          }
+          if (out.empty() && std::chrono::steady_clock::now() > keep_alive) {
+            out = ": keep-alive\n\n";
+          }
+        }
+        return sink.write(out.data(), out.size());
+      });
+}
+
+// Cancels the job of `session` if it has not started yet
+static bool CancelQueuedJob(const Session& session) {
+  std::unique_lock<std::mutex> lock(jobs_mutex);
+  auto it{session_jobs.find(session.Id)};
+  if (it == session_jobs.end() || it->second->State != JobState::Queued) {
+    return false;
+  }
+  it->second->State = JobState::Cancelled;
+  --num_queued_jobs;
+  PushJobState(*it->second);
+  return true;
+}
+
+// Asks the job of `session` to stop if it is running. Passes stop at their
+// next check, and decompilation after the function being structured.
+static bool CancelRunningJob(Session& session) {
+  std::unique_lock<std::mutex> lock(jobs_mutex);
+  auto it{session_jobs.find(session.Id)};
+  if (it == session_jobs.end() || it->second->State != JobState::Running) {
+    return false;
+  }
+  session.Progress.Cancel();
+  return true;
+}
+
+static size_t EstimateMemoryUsage(Session& session) {
+  size_t res{0};
+  if (session.Unit) {
+    auto& ast_ctx{session.Unit->getASTContext()};
+    res += ast_ctx.getASTAllocatedMemory() +
+           ast_ctx.getSideTableAllocatedMemory();
+  }
+  if (session.Module) {
+    size_t num_values{session.Module->global_size()};
+    for (auto& func : session.Module->functions()) {
+      num_values += 1 + func.size() + func.getInstructionCount();
+    }
+    res += num_values * IRBytesPerValue;
+  }
+  return res;
+}
+
+static std::string GetSpillPath(size_t id) {
+  llvm::SmallString<128> path{FLAGS_spill_dir};
+  llvm::sys::path::append(path, std::to_string(id));
+  return path.str().str();
+}
+
+static void RemoveSpill(size_t id) {
+  auto path{GetSpillPath(id)};
+  for (auto ext : {".bc", ".ast", ".json"}) {
+    llvm::sys::fs::remove(path + ext);
+  }
+}
+
+// Saves the module and AST of a session that is not in use to disk, and frees
+// them. Returns the memory that was freed.
+static size_t SpillSession(
+    size_t id, std::chrono::time_point<std::chrono::system_clock> now) {
+  auto& shard{GetShard(id)};
+  std::unique_lock<std::mutex> lock(shard.Mutex);
+  auto it{shard.Sessions.find(id)};
+  if (it == shard.Sessions.end()) {
+    return 0;
+  }
+  auto session_ptr{it->second};
+  auto& session{*session_ptr};
+  if (session.Spilled || !session.Module ||
+      now - session.LastAccess < MinIdleTimeBeforeSpill) {
+    return 0;
+  }
+  write_lock load_mutex(session.LoadMutex, std::try_to_lock);
+  if (!load_mutex.owns_lock()) {
+    return 0;
+  }
+  // The session cannot be removed while its lock is held, and requests that
+  // find it spilled wait for the lock before reloading it
+  lock.unlock();
+
+  auto path{GetSpillPath(id)};
+  try {
+    if (auto ec = llvm::sys::fs::create_directories(FLAGS_spill_dir)) {
+      THROW() << "Cannot create " << FLAGS_spill_dir << ": " << ec.message();
+    }
+    if (session.DecompContext) {
+      rellic::SaveSnapshot(*session.Module, *session.DecompContext, path);
+    } else {
+      std::error_code ec;
+      llvm::raw_fd_ostream os(path + ".bc", ec);
+      CHECK_THROW(!ec) << "Cannot write " << path << ".bc: " << ec.message();
+      llvm::WriteBitcodeToFile(*session.Module, os);
+    }
+  } catch (rellic::Exception& e) {
+    LOG(ERROR) << "Cannot spill session " << id << ": " << e.what();
+    RemoveSpill(id);
+    return 0;
+  }
+
+  session.Pass = nullptr;
+  DropCheckpoints(session);
+  session.DecompContext = nullptr;
+  session.Unit = nullptr;
+  session.Module = nullptr;
+  session.Fingerprints.clear();
+  session.Rendered.Clear();
+  // Types and constants are owned by the context, so it is freed as well
+  session.Context = std::make_unique<llvm::LLVMContext>();
+  session.Spilled = true;
+  size_t freed{session.MemoryUsage.exchange(0)};
+  LOG(INFO) << "Spilled session " << id << " to " << path;
+  return freed;
+}
+
+// Spills the least recently used sessions until the estimated memory used by
+// sessions fits within `--session_memory_budget`
+static void EvictSessions() {
+  struct Resident {
+    std::chrono::time_point<std::chrono::system_clock> LastAccess;
+    size_t Id;
+  };
+
+  size_t total{0};
+  std::vector<Resident> residents;
+  for (auto& shard : session_shards) {
+    std::unique_lock<std::mutex> lock(shard.Mutex);
+    for (auto& [id, session] : shard.Sessions) {
+      if (session->Spilled) {
+        continue;
+      }
+      // Sessions in use are counted with the memory they last used
+      write_lock load_mutex(session->LoadMutex, std::try_to_lock);
+      if (load_mutex.owns_lock()) {
+        session->MemoryUsage = EstimateMemoryUsage(*session);
+      }
+      total += session->MemoryUsage;
+      if (session->Module) {
+        residents.push_back({session->LastAccess, id});
+      }
+    }
+  }
+
+  auto budget{FLAGS_session_memory_budget * 1024 * 1024};
+  if (total <= budget) {
+    return;
+  }
+  std::sort(residents.begin(), residents.end(),
+            [](const Resident& a, const Resident& b) {
+              return a.LastAccess < b.LastAccess;
+            });
+  auto now{std::chrono::system_clock::now()};
+  for (auto& resident : residents) {
+    if (total <= budget) {
+      break;
+    }
+    total -= std::min(total, SpillSession(resident.Id, now));
+  }
+  if (total > budget) {
+    LOG(WARNING) << "Sessions use an estimated " << total / (1024 * 1024)
+                 << " MiB, which exceeds the budget of "
+                 << FLAGS_session_memory_budget << " MiB";
+  }
+}
+
+// Drops the jobs of a session that expired. Jobs that have not started yet
+// are cancelled, since their session would be created again otherwise.
+static void ForgetJobs(size_t session_id) {
+  std::unique_lock<std::mutex> lock(jobs_mutex);
+  auto it{session_jobs.find(session_id)};
+  if (it == session_jobs.end()) {
+    return;
+  }
+  auto& job{it->second};
+  if (job->State == JobState::Queued) {
+    job->State = JobState::Cancelled;
+    --num_queued_jobs;
+  }
+  jobs.erase(job->Id);
+  session_jobs.erase(it);
+}
+
+// Returns when the session with id `id` expires next, or nothing if it has
+// expired and was removed
+static std::optional<std::chrono::time_point<std::chrono::system_clock>>
+ExpireSession(size_t id,
+              std::chrono::time_point<std::chrono::system_clock> now) {
+  auto& shard{GetShard(id)};
+  std::unique_lock<std::mutex> lock(shard.Mutex);
+  auto it{shard.Sessions.find(id)};
+  if (it == shard.Sessions.end()) {
+    return std::nullopt;
+  }
+  auto& session{*it->second};
+  auto deadline{session.LastAccess + SessionPersistenceTime};
+  if (deadline > now) {
+    return deadline;
+  }
+  // Requests and spills hold a reference to the session while they use it,
+  // and jobs hold its load lock for as long as they run
+  if (it->second.use_count() > 1) {
+    return now + 1min;
+  }
+  write_lock load_mutex(session.LoadMutex, std::try_to_lock);
+  if (!load_mutex.owns_lock()) {
+    return now + 1min;
+  }
+  load_mutex.unlock();
+  bool spilled{session.Spilled};
+  auto events{session.Events};
+  shard.Sessions.erase(it);
+  lock.unlock();
+  events->Close();
+  if (spilled) {
+    RemoveSpill(id);
+  }
+  ForgetJobs(id);
+  return std::nullopt;
+}
+
+// Removes sessions that have not been accessed for `SessionPersistenceTime`
+// and keeps the others within the memory budget, without keeping any request
+// waiting while it does
+static void ExpireSessions() {
+  auto next_eviction{std::chrono::system_clock::now() + EvictionInterval};
+  std::unique_lock<std::mutex> lock(expiry_mutex);
+  while (!stop_expiry) {
+    auto now{std::chrono::system_clock::now()};
+    if (FLAGS_session_memory_budget &&
+        (eviction_requested || now >= next_eviction)) {
+      eviction_requested = false;
+      lock.unlock();
+      EvictSessions();
+      lock.lock();
+      next_eviction = now + EvictionInterval;
+      continue;
+    }
+
+    if (!session_deadlines.empty() && session_deadlines.top().first <= now) {
+      auto id{session_deadlines.top().second};
+      session_deadlines.pop();
+      lock.unlock();
+      auto next{ExpireSession(id, now)};
+      lock.lock();
+      if (next) {
+        session_deadlines.emplace(*next, id);
+      }
+      continue;
+    }
+
+    if (session_deadlines.empty() && !FLAGS_session_memory_budget) {
+      expiry_cv.wait(lock);
+    } else if (session_deadlines.empty()) {
+      expiry_cv.wait_until(lock, next_eviction);
+    } else if (!FLAGS_session_memory_budget) {
+      expiry_cv.wait_until(lock, session_deadlines.top().first);
+    } else {
+      expiry_cv.wait_until(
+          lock, std::min(next_eviction, session_deadlines.top().first));
+    }
+  }
+}
+
+static httplib::Server::HandlerResponse PreRoutingHandler(
+    const httplib::Request& req, httplib::Response& res) {
+  // Scrapers do not keep cookies, and would create a session each time
+  if (req.path == "/metrics" || req.path == "/debug/activity") {
+    return httplib::Server::HandlerResponse::Unhandled;
+  }
+  auto session_ptr{GetSession(req)};
+  auto& session{*session_ptr};
+  std::string header{"sessionId="};
+  header += std::to_string(session.Id);
+  res.set_header("Set-Cookie", header.c_str());
+
+  return httplib::Server::HandlerResponse::Unhandled;
+}
+
+static std::unordered_map<llvm::Function*, uint64_t> GetFingerprints(
+    llvm::Module& module) {
+  std::unordered_map<llvm::Function*, uint64_t> res;
+  llvm::ModuleSlotTracker slots(&module);
+  for (auto& func : module.functions()) {
+    std::string text;
+    llvm::raw_string_ostream os(text);
+    static_cast<llvm::Value&>(func).print(os, slots);
+    res[&func] = llvm::xxHash64(os.str());
+  }
+  return res;
+}
+
+static std::mutex module_cache_mutex;
+// Entries are removed once no session refers to them
+static std::unordered_map<uint64_t, std::weak_ptr<CachedModule>> module_cache;
+static uint64_t next_cached_module{0};
+
+// Makes `session` share the decompilation of the module with hash `hash`, if
+// another session has one
+static bool UseCachedModule(Session& session, uint64_t hash) {
+  std::shared_ptr<CachedModule> cached;
+  {
+    std::unique_lock<std::mutex> lock(module_cache_mutex);
+    auto it{module_cache.find(hash)};
+    if (it == module_cache.end()) {
+      return false;
+    }
+    cached = it->second.lock();
+    if (!cached) {
+      module_cache.erase(it);
+      return false;
+    }
+  }
+  session.Pass = nullptr;
+  DropCheckpoints(session);
+  session.DecompContext = nullptr;
+  session.Unit = nullptr;
+  session.Module = nullptr;
+  session.Fingerprints.clear();
+  session.Rendered.Clear();
+  session.Shared = std::move(cached);
+  session.LoadedHash = hash;
+  session.Events->Push("module", {});
+  session.Events->Push("ast", {});
+  return true;
+}
+
+// Replaces the module of `session` with `module`, loaded from bitcode with
+// hash `hash`
+static void SetModule(Session& session, std::unique_ptr<llvm::Module> module,
+                      uint64_t hash) {
+  // The previous AST refers to the module being replaced
+  session.Pass = nullptr;
+  DropCheckpoints(session);
+  session.DecompContext = nullptr;
+  session.Unit = nullptr;
+  session.Shared = nullptr;
+  session.Module = std::move(module);
+  session.Fingerprints.clear();
+  session.Rendered.Clear();
+  session.LoadedHash = hash;
+  session.Events->Push("module", {});
+  session.Events->Push("ast", {});
+}
+
+// Saves the snapshot of `cached` from `module` and `dec_ctx`, and adds it to
+// the cache. Must be called with `module_cache_mutex` held, so that sessions
+// loading the same module wait for it rather than decompiling it too.
+static bool AddCachedModule(std::shared_ptr<CachedModule> cached,
+                            llvm::Module& module,
+                            rellic::DecompilationContext& dec_ctx) {
+  // Entries that are being destroyed may still have their files, so each
+  // entry gets a name of its own
+  llvm::SmallString<128> path{FLAGS_cache_dir};
+  llvm::sys::path::append(path, llvm::utohexstr(cached->Hash) + "-" +
+                                    std::to_string(next_cached_module++));
+  cached->Snapshot = path.str().str();
+  try {
+    if (auto ec = llvm::sys::fs::create_directories(FLAGS_cache_dir)) {
+      THROW() << "Cannot create " << FLAGS_cache_dir << ": " << ec.message();
+    }
+    rellic::SaveSnapshot(module, dec_ctx, cached->Snapshot);
+  } catch (rellic::Exception& e) {
+    LOG(ERROR) << "Cannot cache module: " << e.what();
+    return false;
+  }
+  module_cache[cached->Hash] = std::move(cached);
+  return true;
+}
+
+// Moves the decompilation of `session` to the cache, if its module has not
+// been modified since it was loaded, so that sessions loading the same module
+// later do not decompile it again
+static void PublishModule(Session& session) {
+  if (!session.LoadedHash || UseCachedModule(session, *session.LoadedHash)) {
+    return;
+  }
+
+  auto cached{std::make_shared<CachedModule>()};
+  cached->Hash = *session.LoadedHash;
+  std::unique_lock<std::mutex> lock(module_cache_mutex);
+  if (!AddCachedModule(cached, *session.Module, *session.DecompContext)) {
+    return;
+  }
+  lock.unlock();
+
+  cached->Context = std::move(session.Context);
+  cached->Module = std::move(session.Module);
+  cached->Unit = std::move(session.Unit);
+  cached->DecompContext = std::move(session.DecompContext);
+  // Other sessions only read the shared context
+  cached->DecompContext->SetProgress(nullptr);
+  session.Context = std::make_unique<llvm::LLVMContext>();
+  session.Fingerprints.clear();
+  session.Rendered.Clear();
+  session.Shared = std::move(cached);
+}
+
+// Gives `session` its own copy of the module and AST it shares, before they
+// are modified. Returns false if the copy cannot be loaded.
+static bool Fork(Session& session) {
+  session.LoadedHash = std::nullopt;
+  if (!session.Shared) {
+    return true;
+  }
+  try {
+    auto snapshot{rellic::LoadSnapshot(*session.Context,
+                                       session.Shared->Snapshot)};
+    session.Module = std::move(snapshot.module);
+    session.Unit = std::move(snapshot.ast_unit);
+    session.DecompContext = std::move(snapshot.dec_ctx);
+    session.Fingerprints = GetFingerprints(*session.Module);
+    session.Rendered.Clear();
+  } catch (rellic::Exception& e) {
+    LOG(ERROR) << "Cannot copy shared module: " << e.what();
+    return false;
+  }
+  session.Shared = nullptr;
+  return true;
+}
+
+static void LoadModule(const httplib::Request& req, httplib::Response& res) {
+  auto session_ptr{GetSession(req)};
+  auto& session{*session_ptr};
+  write_lock lock(session.LoadMutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    llvm::json::Object msg{
+        {"message",
+         "Cannot load a new module while other operations are in progress."}};
+    res.status = 409;
+    SendJSON(res, msg);
+    return;
+  }
+
+  auto hash{llvm::xxHash64(req.body)};
+  if (UseCachedModule(session, hash)) {
+    ++metrics.ModuleHits;
+    llvm::json::Object msg{{"message", "Ok."}};
+    SendJSON(res, msg);
+    res.status = 200;
+    return;
+  }
+  ++metrics.ModuleMisses;
+
+  auto mod{rellic::LoadModuleFromMemory(session.Context.get(), req.body, true)};
+  if (!mod) {
+    llvm::json::Object msg{{"message", "Couldn't load LLVM module."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
+  }
+  SetModule(session, std::unique_ptr<llvm::Module>(mod), hash);
   llvm::json::Object msg{{"message", "Ok."}};
   SendJSON(res, msg);
+  res.status = 200;
+  lock.unlock();
+  RequestEviction();
 }
 
-class FixpointPass : public rellic::ASTPass {
-  rellic::CompositeASTPass comp;
+static void ReloadSession(Session& session) {
+  write_lock load_mutex(session.LoadMutex);
+  if (!session.Spilled) {
+    return;
+  }
 
- protected:
-  void StopImpl() override { comp.Stop(); }
+  auto path{GetSpillPath(session.Id)};
+  try {
+    if (llvm::sys::fs::exists(path + ".json")) {
+      auto snapshot{rellic::LoadSnapshot(*session.Context, path)};
+      session.Module = std::move(snapshot.module);
+      session.Unit = std::move(snapshot.ast_unit);
+      session.DecompContext = std::move(snapshot.dec_ctx);
+      session.Fingerprints = GetFingerprints(*session.Module);
+    } else {
+      auto mod{rellic::LoadModuleFromFile(session.Context.get(), path + ".bc",
+                                          /*allow_failure=*/true)};
+      CHECK_THROW(mod) << "Cannot load " << path << ".bc";
+      session.Module = std::unique_ptr<llvm::Module>(mod);
+    }
+  } catch (rellic::Exception& e) {
+    LOG(ERROR) << "Cannot reload session " << session.Id << ": " << e.what();
+  }
+  RemoveSpill(session.Id);
+  session.Rendered.Clear();
+  session.Spilled = false;
+  load_mutex.unlock();
+  RequestEviction();
+}
 
-  void RunImpl() override { comp.Fixpoint(); }
+// Adds the Z3 queries made by the job of a session, and the passes it ran on
+// `dec_ctx`, to the metrics once the job finishes. Only counts what was done
+// on `dec_ctx` if it is still the context of the session by then.
+class JobStatistics {
+  Session& session;
+  rellic::DecompilationContext* dec_ctx{nullptr};
+  size_t prove_hits{0}, prove_misses{0}, simplify_hits{0}, simplify_misses{0};
+  std::map<std::string, rellic::PassStatistics> passes;
 
  public:
-  FixpointPass(rellic::DecompilationContext& dec_ctx)
-      : ASTPass(dec_ctx), comp(dec_ctx) {}
-  std::vector<std::unique_ptr<ASTPass>>& GetPasses() {
-    return comp.GetPasses();
+  JobStatistics(Session& session, rellic::DecompilationContext* ctx = nullptr)
+      : session(session) {
+    Track(ctx);
+  }
+
+  // Counts what is done on `ctx` from now on
+  void Track(rellic::DecompilationContext* ctx) {
+    dec_ctx = ctx;
+    if (!dec_ctx) {
+      return;
+    }
+    auto& cache{dec_ctx->z3_cache};
+    prove_hits = cache.prove_hits;
+    prove_misses = cache.prove_misses;
+    simplify_hits = cache.simplify_hits;
+    simplify_misses = cache.simplify_misses;
+    passes = dec_ctx->stats.passes;
+  }
+
+  ~JobStatistics() {
+    auto& progress{session.Progress};
+    metrics.Z3Queries += progress.z3_calls;
+    metrics.Z3Nanoseconds += progress.z3_nanoseconds;
+    if (!dec_ctx || dec_ctx != GetView(session).DecompContext) {
+      return;
+    }
+    auto& cache{dec_ctx->z3_cache};
+    metrics.ProveHits += cache.prove_hits - prove_hits;
+    metrics.ProveMisses += cache.prove_misses - prove_misses;
+    metrics.SimplifyHits += cache.simplify_hits - simplify_hits;
+    metrics.SimplifyMisses += cache.simplify_misses - simplify_misses;
+    std::unique_lock<std::mutex> lock(metrics.Mutex);
+    for (auto& [name, stats] : dec_ctx->stats.passes) {
+      auto& before{passes[name]};
+      auto& total{metrics.Passes[name]};
+      total.wall_time += stats.wall_time - before.wall_time;
+      total.runs += stats.runs - before.runs;
+      total.changes += stats.changes - before.changes;
+      total.fixpoints += stats.fixpoints - before.fixpoints;
+      total.skipped_functions +=
+          stats.skipped_functions - before.skipped_functions;
+      total.z3.time += stats.z3.time - before.z3.time;
+      total.z3.queries += stats.z3.queries - before.z3.queries;
+      total.z3.cache_hits += stats.z3.cache_hits - before.z3.cache_hits;
+      total.z3.timeouts += stats.z3.timeouts - before.z3.timeouts;
+      total.z3.nodes_in += stats.z3.nodes_in - before.z3.nodes_in;
+      total.z3.nodes_out += stats.z3.nodes_out - before.z3.nodes_out;
+    }
   }
 };
 
+// Publishes the current version of `session` for the readers that come while
+// it is being modified, see `PublishedVersion`. Called by the requests that
+// modify the session once they hold its `MutationMutex` exclusively.
+static void Publish(Session& session);
+
+// Estimated cost of decompiling the module of `session` from scratch. Sessions
+// that another request is modifying are not waited for, and are estimated as
+// free, since their job will be turned away or has nothing to decompile.
+static uint64_t EstimateDecompileCost(Session& session) {
+  read_lock load_mutex(session.LoadMutex, std::try_to_lock);
+  if (!load_mutex.owns_lock()) {
+    return 0;
+  }
+  read_lock mutation_mutex(session.MutationMutex, std::try_to_lock);
+  if (!mutation_mutex.owns_lock() || !session.Module) {
+    return 0;
+  }
+  return rellic::EstimateModuleCost(*session.Module, &cost_history).cost;
+}
+
+static void Decompile(const httplib::Request& req, httplib::Response& res) {
+  auto session_ptr{GetSession(req)};
+  auto& session{*session_ptr};
+  read_lock load_mutex(session.LoadMutex);
+  write_lock mutation_mutex(session.MutationMutex);
+  Publish(session);
+  JobStatistics job_stats{session};
+
+  if (session.Shared) {
+    llvm::json::Object msg{{"message", "Ok."}};
+    SendJSON(res, msg);
+    res.status = 200;
+    return;
+  }
+
+  if (!session.Module) {
+    llvm::json::Object msg{{"message", "No module loaded."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
+  }
+
+  try {
+    // Functions are generated again without being preserved
+    DropCheckpoints(session);
+    auto fingerprints{GetFingerprints(*session.Module)};
+    // If the same functions are still in the module, only the ones that have
+    // been modified are decompiled again, which preserves the passes that
+    // have been run on the others
+    auto incremental{session.Unit &&
+                     fingerprints.size() == session.Fingerprints.size()};
+    std::vector<llvm::Function*> changed;
+    for (auto& func : session.Module->functions()) {
+      if (!incremental) {
+        break;
+      }
+      auto it{session.Fingerprints.find(&func)};
+      if (it == session.Fingerprints.end()) {
+        incremental = false;
+      } else if (it->second != fingerprints[&func]) {
+        changed.push_back(&func);
+      }
+    }
+
+    rellic::DebugInfoCollector dic;
+    dic.visit(*session.Module);
+    if (incremental) {
+      for (auto func : changed) {
+        if (auto decl = session.DecompContext->value_decls[func]) {
+          session.Rendered.InvalidateFunction(
+              clang::cast<clang::FunctionDecl>(decl));
+        }
+      }
+      session.DecompContext->SetProgress(&session.Progress);
+      job_stats.Track(session.DecompContext.get());
+      rellic::GenerateAST::regenerate(*session.Module, changed,
+                                      *session.DecompContext);
+      rellic::FunctionSet scope;
+      for (auto func : changed) {
+        if (auto decl = session.DecompContext->value_decls[func]) {
+          scope.insert(clang::cast<clang::FunctionDecl>(decl));
+          InvalidateFunction(session, clang::cast<clang::FunctionDecl>(decl));
+        }
+      }
+      rellic::LocalDeclRenamer ldr{*session.DecompContext, dic};
+      ldr.SetScope(&scope);
+      ldr.Run();
+    } else {
+      session.Rendered.Clear();
+      session.Unit = rellic::ASTUnitFactory::Get().Create(
+          session.Module->getTargetTriple());
+      session.DecompContext =
+          std::make_unique<rellic::DecompilationContext>(*session.Unit);
+      session.DecompContext->SetProgress(&session.Progress);
+      job_stats.Track(session.DecompContext.get());
+      rellic::GenerateAST::run(*session.Module, *session.DecompContext);
+      rellic::LocalDeclRenamer ldr{*session.DecompContext, dic};
+      rellic::StructFieldRenamer sfr{*session.DecompContext, dic};
+      ldr.Run();
+      sfr.Run();
+      if (!session.Progress.cancelled) {
+        auto& stats{session.DecompContext->stats.functions};
+        for (auto& func : session.Module->functions()) {
+          auto it{stats.find(func.getName().str())};
+          if (it != stats.end()) {
+            cost_history.Record(func, it->second.reaching_conds_time +
+                                          it->second.structuring_time);
+          }
+        }
+      }
+    }
+    // Some functions may not have been structured, nor the others renamed
+    if (session.Progress.cancelled) {
+      ClearAST(session);
+      session.Unit = nullptr;
+      session.DecompContext = nullptr;
+      session.Fingerprints.clear();
+      llvm::json::Object msg{{"message", "Stopped."}};
+      SendJSON(res, msg);
+      res.status = 200;
+      return;
+    }
+    session.Fingerprints = std::move(fingerprints);
+    if (!incremental) {
+      session.Events->Push("ast", {});
+      PublishModule(session);
+    }
+
+    llvm::json::Object msg{{"message", "Ok."}};
+    SendJSON(res, msg);
+    res.status = 200;
+  } catch (rellic::Exception& e) {
+    llvm::json::Object msg{{"message", e.what()}};
+    SendJSON(res, msg);
+    res.status = 400;
+    ClearAST(session);
+    session.Unit = nullptr;
+    session.Fingerprints.clear();
+  }
+}
+
+// Modules of --preload are decompiled one at a time on a thread of its own,
+// which only starts on the next one once no job is waiting for a worker, and
+// runs at the lowest priority so that the jobs of sessions take precedence.
+// They stay in the cache for as long as the server runs.
+static struct {
+  std::mutex Mutex;
+  std::condition_variable CV;
+  // Cancels the module being decompiled when the server stops
+  rellic::Progress Progress;
+  std::vector<std::shared_ptr<CachedModule>> Modules;
+  bool Stop{false};
+} preload;
+
+// Decompiles the module at `path` into the cache the way `Decompile` does,
+// unless a session already did
+static void PreloadModule(const std::string& path) {
+  rellic::ActivityScope activity("preload", path);
+  auto buffer{llvm::MemoryBuffer::getFile(path)};
+  if (!buffer) {
+    LOG(ERROR) << "Cannot preload " << path << ": "
+               << buffer.getError().message();
+    return;
+  }
+  auto hash{llvm::xxHash64(buffer.get()->getBuffer())};
+  auto Cached{[hash]() -> std::shared_ptr<CachedModule> {
+    auto it{module_cache.find(hash)};
+    return it == module_cache.end() ? nullptr : it->second.lock();
+  }};
+  {
+    std::unique_lock<std::mutex> lock(module_cache_mutex);
+    if (auto cached = Cached()) {
+      preload.Modules.push_back(std::move(cached));
+      return;
+    }
+  }
+
+  auto cached{std::make_shared<CachedModule>()};
+  cached->Hash = hash;
+  cached->Context = std::make_unique<llvm::LLVMContext>();
+  try {
+    auto mod{rellic::LoadModuleFromBuffer(
+        cached->Context.get(), buffer.get()->getMemBufferRef(), true)};
+    CHECK_THROW(mod) << "Cannot load the module";
+    cached->Module = std::unique_ptr<llvm::Module>(mod);
+    cached->Unit = rellic::ASTUnitFactory::Get().Create(
+        cached->Module->getTargetTriple());
+    cached->DecompContext =
+        std::make_unique<rellic::DecompilationContext>(*cached->Unit);
+    cached->DecompContext->SetProgress(&preload.Progress);
+    rellic::DebugInfoCollector dic;
+    dic.visit(*cached->Module);
+    rellic::GenerateAST::run(*cached->Module, *cached->DecompContext);
+    rellic::LocalDeclRenamer ldr{*cached->DecompContext, dic};
+    rellic::StructFieldRenamer sfr{*cached->DecompContext, dic};
+    ldr.Run();
+    sfr.Run();
+    cached->DecompContext->SetProgress(nullptr);
+  } catch (rellic::Exception& e) {
+    LOG(ERROR) << "Cannot preload " << path << ": " << e.what();
+    return;
+  }
+  if (preload.Progress.cancelled) {
+    return;
+  }
+
+  std::unique_lock<std::mutex> lock(module_cache_mutex);
+  // A session may have loaded it in the meantime
+  if (auto existing = Cached()) {
+    preload.Modules.push_back(std::move(existing));
+    return;
+  }
+  if (AddCachedModule(cached, *cached->Module, *cached->DecompContext)) {
+    preload.Modules.push_back(std::move(cached));
+    LOG(INFO) << "Preloaded " << path;
+  }
+}
+
+static void PreloadModules() {
+  auto buffer{llvm::MemoryBuffer::getFile(FLAGS_preload)};
+  if (!buffer) {
+    LOG(ERROR) << "Cannot read " << FLAGS_preload << ": "
+               << buffer.getError().message();
+    return;
+  }
+#ifdef __linux__
+  // Only lowers the priority of the calling thread on Linux
+  setpriority(PRIO_PROCESS, 0, 19);
+#endif
+  rellic::TraceThread trace_thread;
+  llvm::SmallVector<llvm::StringRef, 16> lines;
+  buffer.get()->getBuffer().split(lines, '\n', -1, false);
+  for (auto line : lines) {
+    auto path{line.trim()};
+    if (path.empty()) {
+      continue;
+    }
+    std::unique_lock<std::mutex> lock(preload.Mutex);
+    while (!preload.Stop) {
+      {
+        std::unique_lock<std::mutex> jobs_lock(jobs_mutex);
+        if (!num_queued_jobs) {
+          break;
+        }
+      }
+      preload.CV.wait_for(lock, 1s);
+    }
+    if (preload.Stop) {
+      return;
+    }
+    lock.unlock();
+    PreloadModule(path.str());
+  }
+}
+
+static void RemovePhi(const httplib::Request& req, httplib::Response& res) {
+  auto session_ptr{GetSession(req)};
+  auto& session{*session_ptr};
+  read_lock load_mutex(session.LoadMutex);
+  write_lock mutation_mutex(session.MutationMutex);
+  Publish(session);
+
+  if (!GetView(session).Module) {
+    llvm::json::Object msg{{"message", "No module loaded."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
+  }
+
+  if (!Fork(session)) {
+    llvm::json::Object msg{{"message", "Cannot copy the shared module."}};
+    res.status = 500;
+    SendJSON(res, msg);
+    return;
+  }
+
+  rellic::RemovePHINodes(*session.Module);
+  InvalidateModule(session);
+
+  llvm::json::Object msg{{"message", "Ok."}};
+  SendJSON(res, msg);
+  res.status = 200;
+}
+
+static void LowerSwitches(const httplib::Request& req, httplib::Response& res) {
+  auto session_ptr{GetSession(req)};
+  auto& session{*session_ptr};
+  read_lock load_mutex(session.LoadMutex);
+  write_lock mutation_mutex(session.MutationMutex);
+  Publish(session);
+
+  if (!GetView(session).Module) {
+    llvm::json::Object msg{{"message", "No module loaded."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
+  }
+
+  if (!Fork(session)) {
+    llvm::json::Object msg{{"message", "Cannot copy the shared module."}};
+    res.status = 500;
+    SendJSON(res, msg);
+    return;
+  }
+
+  rellic::LowerSwitches(*session.Module);
+  InvalidateModule(session);
+
+  llvm::json::Object msg{{"message", "Ok."}};
+  SendJSON(res, msg);
+  res.status = 200;
+}
+
+static void RemoveInsertValue(const httplib::Request& req,
+                              httplib::Response& res) {
+  auto session_ptr{GetSession(req)};
+  auto& session{*session_ptr};
+  read_lock load_mutex(session.LoadMutex);
+  write_lock mutation_mutex(session.MutationMutex);
+  Publish(session);
+
+  if (!GetView(session).Module) {
+    llvm::json::Object msg{{"message", "No module loaded."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
+  }
+
+  if (!Fork(session)) {
+    llvm::json::Object msg{{"message", "Cannot copy the shared module."}};
+    res.status = 500;
+    SendJSON(res, msg);
+    return;
+  }
+
+  rellic::RemoveInsertValues(*session.Module);
+  InvalidateModule(session);
+
+  llvm::json::Object msg{{"message", "Ok."}};
+  SendJSON(res, msg);
+}
+
+static void RemoveArrayArguments(const httplib::Request& req,
+                                 httplib::Response& res) {
+  auto session_ptr{GetSession(req)};
+  auto& session{*session_ptr};
+  read_lock load_mutex(session.LoadMutex);
+  write_lock mutation_mutex(session.MutationMutex);
+  Publish(session);
+
+  if (!GetView(session).Module) {
+    llvm::json::Object msg{{"message", "No module loaded."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
+  }
+
+  if (!Fork(session)) {
+    llvm::json::Object msg{{"message", "Cannot copy the shared module."}};
+    res.status = 500;
+    SendJSON(res, msg);
+    return;
+  }
+
+  rellic::ConvertArrayArguments(*session.Module);
+  InvalidateModule(session);
+
+  llvm::json::Object msg{{"message", "Ok."}};
+  SendJSON(res, msg);
+}
+
 static std::unique_ptr<rellic::ASTPass> CreatePass(
     Session& session, const llvm::json::Value& val) {
   if (auto obj = val.getAsObject()) {
@@ -393,31 +2149,14 @@ static std::unique_ptr<rellic::ASTPass> CreatePass(
     }
     auto str{name->str()};
 
-    if (str == "cbr") {
-      return std::make_unique<rellic::CondBasedRefine>(*session.DecompContext);
-    } else if (str == "dse") {
-      return std::make_unique<rellic::DeadStmtElim>(*session.DecompContext);
-    } else if (str == "ec") {
-      return std::make_unique<rellic::ExprCombine>(*session.DecompContext);
-    } else if (str == "lr") {
-      return std::make_unique<rellic::LoopRefine>(*session.DecompContext);
-    } else if (str == "mc") {
-      return std::make_unique<rellic::MaterializeConds>(*session.DecompContext);
-    } else if (str == "ncp") {
-      return std::make_unique<rellic::NestedCondProp>(*session.DecompContext);
-    } else if (str == "nsc") {
-      return std::make_unique<rellic::NestedScopeCombine>(
-          *session.DecompContext);
-    } else if (str == "rbr") {
-      return std::make_unique<rellic::ReachBasedRefine>(*session.DecompContext);
-    } else if (str == "zcs") {
-      return std::make_unique<rellic::Z3CondSimplify>(*session.DecompContext);
-    } else {
+    auto pass{rellic::CreatePass(str, *session.DecompContext)};
+    if (!pass) {
       LOG(ERROR) << "Request contains invalid pass id";
-      return nullptr;
     }
+    return pass;
   } else if (auto arr = val.getAsArray()) {
-    auto fix{std::make_unique<FixpointPass>(*session.DecompContext)};
+    auto fix{std::make_unique<rellic::FixpointASTPass>(
+        *session.DecompContext)};
     for (auto& pass : *arr) {
       auto p{CreatePass(session, pass)};
       if (!p) {
@@ -426,6 +2165,13 @@ static std::unique_ptr<rellic::ASTPass> CreatePass(
       fix->GetPasses().push_back(std::move(p));
     }
     return fix;
+  } else if (auto spec = val.getAsString()) {
+    try {
+      return rellic::Pipeline::Parse(spec->str(), *session.DecompContext);
+    } catch (rellic::Exception& ex) {
+      LOG(ERROR) << "Request contains invalid pipeline: " << ex.what();
+      return nullptr;
+    }
   } else {
     std::string s;
     llvm::raw_string_ostream os(s);
@@ -433,20 +2179,27 @@ static std::unique_ptr<rellic::ASTPass> CreatePass(
     LOG(ERROR) << "Invalid request type: " << s;
     return nullptr;
   }
-}
-
-static void Stop(const httplib::Request& req, httplib::Response& res) {
-  auto& session{GetSession(req)};
+}
+
+static void Stop(const httplib::Request& req, httplib::Response& res) {
+  auto session_ptr{GetSession(req)};
+  auto& session{*session_ptr};
+  if (CancelQueuedJob(session) || CancelRunningJob(session)) {
+    llvm::json::Object msg{{"message", "Ok."}};
+    SendJSON(res, msg);
+    return;
+  }
   read_lock load_mutex(session.LoadMutex);
 
-  if (!session.Module) {
+  auto view{GetView(session)};
+  if (!view.Module) {
     llvm::json::Object msg{{"message", "No module loaded."}};
     res.status = 400;
     SendJSON(res, msg);
     return;
   }
 
-  if (!session.Unit) {
+  if (!view.Unit) {
     llvm::json::Object msg{{"message", "No AST available."}};
     res.status = 400;
     SendJSON(res, msg);
@@ -466,27 +2219,32 @@ static void Stop(const httplib::Request& req, httplib::Response& res) {
 }
 
 static void Run(const httplib::Request& req, httplib::Response& res) {
-  auto& session{GetSession(req)};
+  auto session_ptr{GetSession(req)};
+  auto& session{*session_ptr};
   read_lock load_mutex(session.LoadMutex);
-  write_lock mutation_mutex(session.MutationMutex, std::try_to_lock);
+  // Jobs of a session run one at a time, so this only waits for requests that
+  // do not run as jobs
+  write_lock mutation_mutex(session.MutationMutex);
+  Publish(session);
 
-  if (!mutation_mutex.owns_lock()) {
-    llvm::json::Object msg{{"message", "Server busy."}};
+  auto view{GetView(session)};
+  if (!view.Module) {
+    llvm::json::Object msg{{"message", "No module loaded."}};
     res.status = 400;
     SendJSON(res, msg);
     return;
   }
 
-  if (!session.Module) {
-    llvm::json::Object msg{{"message", "No module loaded."}};
+  if (!view.Unit) {
+    llvm::json::Object msg{{"message", "No AST available."}};
     res.status = 400;
     SendJSON(res, msg);
     return;
   }
 
-  if (!session.Unit) {
-    llvm::json::Object msg{{"message", "No AST available."}};
-    res.status = 400;
+  if (!Fork(session)) {
+    llvm::json::Object msg{{"message", "Cannot copy the shared module."}};
+    res.status = 500;
     SendJSON(res, msg);
     return;
   }
@@ -499,6 +2257,7 @@ static void Run(const httplib::Request& req, httplib::Response& res) {
     return;
   }
 
+  session.DecompContext->SetProgress(&session.Progress);
   auto composite{
       std::make_unique<rellic::CompositeASTPass>(*session.DecompContext)};
   for (auto& obj : *json->getAsArray()) {
@@ -512,7 +2271,9 @@ static void Run(const httplib::Request& req, httplib::Response& res) {
     composite->GetPasses().push_back(std::move(pass));
   }
 
+  TakeCheckpoint(session, "run " + req.body);
   session.Pass = std::move(composite);
+  JobStatistics job_stats{session, session.DecompContext.get()};
 
   try {
     session.Pass->Run();
@@ -525,231 +2286,718 @@ static void Run(const httplib::Request& req, httplib::Response& res) {
       SendJSON(res, msg);
     }
     res.status = 200;
+    InvalidateRendered(session, *session.Pass);
+    session.Pass = nullptr;
+  } catch (rellic::Exception& e) {
+    llvm::json::Object msg{{"message", e.what()}};
+    SendJSON(res, msg);
+    res.status = 400;
+    ClearAST(session);
+    session.Pass = nullptr;
+  }
+}
+
+static void Fixpoint(const httplib::Request& req, httplib::Response& res) {
+  auto session_ptr{GetSession(req)};
+  auto& session{*session_ptr};
+  read_lock load_mutex(session.LoadMutex);
+  write_lock mutation_mutex(session.MutationMutex);
+  Publish(session);
+
+  auto view{GetView(session)};
+  if (!view.Module) {
+    llvm::json::Object msg{{"message", "No module loaded"}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
+  }
+
+  if (!view.Unit) {
+    llvm::json::Object msg{{"message", "No AST available"}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
+  }
+
+  if (!Fork(session)) {
+    llvm::json::Object msg{{"message", "Cannot copy the shared module."}};
+    res.status = 500;
+    SendJSON(res, msg);
+    return;
+  }
+
+  auto json{llvm::json::parse(req.body)};
+  if (!json) {
+    llvm::json::Object msg{{"message", "Invalid request: cannot parse."}};
+    SendJSON(res, msg);
+    res.status = 400;
+    return;
+  }
+
+  session.DecompContext->SetProgress(&session.Progress);
+  auto composite{
+      std::make_unique<rellic::CompositeASTPass>(*session.DecompContext)};
+  for (auto& obj : *json->getAsArray()) {
+    auto pass{CreatePass(session, obj)};
+    if (!pass) {
+      llvm::json::Object msg{{"message", "Invalid request"}};
+      SendJSON(res, msg);
+      res.status = 400;
+      return;
+    }
+    composite->GetPasses().push_back(std::move(pass));
+  }
+
+  TakeCheckpoint(session, "fixpoint " + req.body);
+  session.Pass = std::move(composite);
+  JobStatistics job_stats{session, session.DecompContext.get()};
+
+  try {
+    auto t1{std::chrono::system_clock::now()};
+    auto num_iterations{session.Pass->Fixpoint()};
+    auto t2{std::chrono::system_clock::now()};
+    auto elapsed{
+        std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count()};
+
+    if (session.Pass->Stopped()) {
+      llvm::json::Object msg{{"message", "Stopped."}};
+      SendJSON(res, msg);
+    } else {
+      std::string s;
+      llvm::raw_string_ostream os(s);
+      os << "Fixpoint found after " << num_iterations << " iterations ("
+         << elapsed << " ms).";
+      llvm::json::Object msg{{"message", s}};
+      SendJSON(res, msg);
+    }
+    res.status = 200;
+    InvalidateRendered(session, *session.Pass);
     session.Pass = nullptr;
   } catch (rellic::Exception& e) {
     llvm::json::Object msg{{"message", e.what()}};
     SendJSON(res, msg);
     res.status = 400;
+    ClearAST(session);
     session.Pass = nullptr;
   }
 }
 
-static void Fixpoint(const httplib::Request& req, httplib::Response& res) {
-  auto& session{GetSession(req)};
-  read_lock load_mutex(session.LoadMutex);
-  write_lock mutation_mutex(session.MutationMutex, std::try_to_lock);
+// Restores the AST of `session` to checkpoint `idx`. Undoing drops the
+// checkpoint along with the later ones, while checking out keeps them so that
+// they can be checked out again.
+static void RestoreCheckpoint(Session& session, size_t idx, bool undo) {
+  for (auto fdecl : session.Checkpoints->Checkout(idx)) {
+    InvalidateFunction(session, fdecl);
+  }
+  if (undo) {
+    session.Checkpoints->Truncate(idx);
+    session.CheckpointLabels.resize(idx);
+  }
+}
+
+static void Undo(const httplib::Request& req, httplib::Response& res) {
+  auto session_ptr{GetSession(req)};
+  auto& session{*session_ptr};
+  read_lock load_mutex(session.LoadMutex);
+  write_lock mutation_mutex(session.MutationMutex);
+  Publish(session);
+
+  if (!session.Checkpoints || !session.Checkpoints->Size()) {
+    llvm::json::Object msg{{"message", "Nothing to undo."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
+  }
+
+  auto label{session.CheckpointLabels.back()};
+  RestoreCheckpoint(session, session.Checkpoints->Size() - 1, /*undo=*/true);
+  llvm::json::Object msg{{"message", "Undid " + label + "."}};
+  SendJSON(res, msg);
+  res.status = 200;
+}
+
+static void Checkout(const httplib::Request& req, httplib::Response& res) {
+  auto session_ptr{GetSession(req)};
+  auto& session{*session_ptr};
+  read_lock load_mutex(session.LoadMutex);
+  write_lock mutation_mutex(session.MutationMutex);
+  Publish(session);
+
+  auto json{llvm::json::parse(req.body)};
+  if (!json) {
+    llvm::json::Object msg{{"message", "Invalid request: cannot parse."}};
+    SendJSON(res, msg);
+    res.status = 400;
+    return;
+  }
+  std::optional<int64_t> idx;
+  if (auto obj = json->getAsObject()) {
+    if (auto value = obj->getInteger("checkpoint")) {
+      idx = *value;
+    }
+  }
+  if (!idx || *idx < 0 || !session.Checkpoints ||
+      static_cast<size_t>(*idx) >= session.Checkpoints->Size()) {
+    llvm::json::Object msg{{"message", "Invalid checkpoint."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
+  }
+
+  RestoreCheckpoint(session, *idx, /*undo=*/false);
+  llvm::json::Object msg{{"message", "Ok."}};
+  SendJSON(res, msg);
+  res.status = 200;
+}
+
+// Lists the checkpoints of the session, oldest first, along with what was run
+// after each of them
+static void ListCheckpoints(const httplib::Request& req,
+                            httplib::Response& res) {
+  auto session_ptr{GetSession(req)};
+  auto& session{*session_ptr};
+  read_lock load_mutex(session.LoadMutex);
+  read_lock mutation_mutex(session.MutationMutex);
+  llvm::json::Array checkpoints;
+  for (size_t i{0}; i < session.CheckpointLabels.size(); ++i) {
+    checkpoints.push_back(llvm::json::Object{
+        {"checkpoint", static_cast<int64_t>(i)},
+        {"label", session.CheckpointLabels[i]}});
+  }
+  res.status = 200;
+  SendJSON(res, checkpoints);
+}
+
+class AAW : public llvm::AssemblyAnnotationWriter {
+  const Session& session;
+
+ public:
+  AAW(const Session& session) : session(session) {}
+
+  void emitFunctionAnnot(const llvm::Function* F,
+                         llvm::formatted_raw_ostream& OS) override {
+    OS << "</span><span class=\"llvm\" id=\"";
+    OS.write_hex((unsigned long long)F);
+    OS << "\">";
+  }
+  void emitInstructionAnnot(const llvm::Instruction* I,
+                            llvm::formatted_raw_ostream& OS) override {
+    OS << "</span><span class=\"llvm\" id=\"";
+    OS.write_hex((unsigned long long)I);
+    OS << "\">";
+  }
+  void emitBasicBlockStartAnnot(const llvm::BasicBlock*,
+                                llvm::formatted_raw_ostream& OS) override {
+    OS << "</span><span>";
+  }
+  void emitBasicBlockEndAnnot(const llvm::BasicBlock*,
+                              llvm::formatted_raw_ostream& OS) override {
+    OS << "</span><span>";
+  }
+  void printInfoComment(const llvm::Value&,
+                        llvm::formatted_raw_ostream& OS) override {
+    OS << "</span><span>";
+  }
+};
+
+static std::string RenderModule(Session& session, const SessionView& view) {
+  return view.Rendered->GetModule([&](llvm::raw_ostream& os) {
+    AAW aaw(session);
+    os << "<pre><span>";
+    view.Module->print(os, &aaw);
+    os << "</span></pre>";
+  });
+}
+
+static std::shared_ptr<const std::string> RenderFunction(
+    const SessionView& view, clang::FunctionDecl* fdecl) {
+  auto policy{view.Unit->getASTContext().getPrintingPolicy()};
+  return view.Rendered->GetFunction(fdecl, [&](llvm::raw_ostream& os) {
+    PrintDecl(fdecl, policy, 0, os);
+  });
+}
+
+// Prints the translation unit of `view`, reusing the renderings of its
+// functions
+static void RenderAST(const SessionView& view, llvm::raw_ostream& os) {
+  os << "<pre>";
+  auto& ast_ctx{view.Unit->getASTContext()};
+  auto policy{ast_ctx.getPrintingPolicy()};
+  rellic::PrintOptions print_opts;
+  print_opts.num_workers = 0;
+  print_opts.print = [&policy, &view](clang::Decl* decl,
+                                      llvm::raw_ostream& out) {
+    auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+    if (fdecl && fdecl->doesThisDeclarationHaveABody()) {
+      // Clients replace the functions named in `function` events in place
+      out << "<span data-function=\"";
+      llvm::printHTMLEscaped(fdecl->getName(), out);
+      out << "\">" << *RenderFunction(view, fdecl) << "</span>";
+    } else {
+      PrintDecl(decl, policy, 0, out);
+    }
+  };
+  rellic::PrintTranslationUnit(ast_ctx, os, print_opts);
+  os << "</pre>";
+}
+
+static void PrintModule(const httplib::Request& req, httplib::Response& res) {
+  auto session_ptr{GetSession(req)};
+  auto& session{*session_ptr};
+  read_lock load_mutex(session.LoadMutex);
+  read_lock mutation_mutex;
+  if (auto published = LockForReading(session, mutation_mutex)) {
+    res.status = 200;
+    res.set_content(published->Module, "text/html");
+    return;
+  }
+  auto view{GetView(session)};
+  if (!view.Module) {
+    llvm::json::Object msg{{"message", "No module loaded."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
+  }
+
+  res.status = 200;
+  res.set_content(RenderModule(session, view), "text/html");
+}
+
+static void PrintAST(const httplib::Request& req, httplib::Response& res) {
+  auto session_ptr{GetSession(req)};
+  auto& session{*session_ptr};
+  read_lock load_mutex(session.LoadMutex);
+  read_lock mutation_mutex;
+  if (auto published = LockForReading(session, mutation_mutex)) {
+    if (!published->AST) {
+      llvm::json::Object msg{{"message", "No AST available."}};
+      res.status = 400;
+      SendJSON(res, msg);
+      return;
+    }
+    res.status = 200;
+    res.set_content(*published->AST, "text/html");
+    return;
+  }
+  auto view{GetView(session)};
+  if (!view.Module) {
+    llvm::json::Object msg{{"message", "No module loaded."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
+  }
+
+  if (!view.Unit) {
+    llvm::json::Object msg{{"message", "No AST available."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
+  }
+
+  res.status = 200;
+  Stream(res, "text/html", std::move(load_mutex), std::move(mutation_mutex),
+         [view](llvm::raw_ostream& os) { RenderAST(view, os); });
+}
+
+static std::vector<clang::FunctionDecl*> GetDefinedFunctions(
+    clang::ASTUnit& unit) {
+  std::vector<clang::FunctionDecl*> res;
+  for (auto decl : unit.getASTContext().getTranslationUnitDecl()->decls()) {
+    auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+    if (fdecl && fdecl->doesThisDeclarationHaveABody()) {
+      res.push_back(fdecl);
+    }
+  }
+  return res;
+}
+
+// Lists the functions of the AST along with their generation, so that clients
+// can fetch only the ones that have changed
+static void ListFunctions(const httplib::Request& req,
+                          httplib::Response& res) {
+  auto session_ptr{GetSession(req)};
+  auto& session{*session_ptr};
+  read_lock load_mutex(session.LoadMutex);
+  read_lock mutation_mutex;
+  if (auto published = LockForReading(session, mutation_mutex)) {
+    if (!published->AST) {
+      llvm::json::Object msg{{"message", "No AST available."}};
+      res.status = 400;
+      SendJSON(res, msg);
+      return;
+    }
+    llvm::json::Array functions;
+    for (auto& function : published->Functions) {
+      functions.push_back(llvm::json::Object{
+          {"name", function.Name}, {"generation", function.Generation}});
+    }
+    res.status = 200;
+    SendJSON(res, functions);
+    return;
+  }
+  auto view{GetView(session)};
+  if (!view.Unit) {
+    llvm::json::Object msg{{"message", "No AST available."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
+  }
+
+  llvm::json::Array functions;
+  for (auto fdecl : GetDefinedFunctions(*view.Unit)) {
+    functions.push_back(llvm::json::Object{
+        {"name", fdecl->getNameAsString()},
+        {"generation", view.Rendered->GetGeneration(fdecl)}});
+  }
+  res.status = 200;
+  SendJSON(res, functions);
+}
+
+static void PrintFunction(const httplib::Request& req,
+                          httplib::Response& res) {
+  auto session_ptr{GetSession(req)};
+  auto& session{*session_ptr};
+  read_lock load_mutex(session.LoadMutex);
+  read_lock mutation_mutex;
+  auto name{req.get_param_value("name")};
+  auto Send{[&res](unsigned generation, const std::string& html) {
+    res.status = 200;
+    res.set_header("X-Generation", std::to_string(generation));
+    res.set_content("<pre>" + html + "</pre>", "text/html");
+  }};
+  auto published{LockForReading(session, mutation_mutex)};
+  auto view{GetView(session)};
+  if (published ? !published->AST : !view.Unit) {
+    llvm::json::Object msg{{"message", "No AST available."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
+  }
+
+  if (published) {
+    for (auto& function : published->Functions) {
+      if (function.Name == name) {
+        Send(function.Generation, *function.HTML);
+        return;
+      }
+    }
+  } else {
+    for (auto fdecl : GetDefinedFunctions(*view.Unit)) {
+      if (fdecl->getName() == name) {
+        Send(view.Rendered->GetGeneration(fdecl),
+             *RenderFunction(view, fdecl));
+        return;
+      }
+    }
+  }
+
+  llvm::json::Object msg{{"message", "No such function."}};
+  res.status = 404;
+  SendJSON(res, msg);
+}
+
+// The files under --angha, relative to it
+struct AnghaTree {
+  struct Dir {
+    std::vector<std::string> Dirs;
+    std::vector<std::string> Files;
+  };
+  // Keyed by path relative to --angha, "" for --angha itself
+  std::unordered_map<std::string, Dir> Dirs;
+  // Relative paths of every file, sorted for prefix searches
+  std::vector<std::string> Files;
+  // The whole tree in the format of `/action/angha`, rendered once
+  std::string JSON;
+  std::chrono::steady_clock::time_point Built;
+};
+
+static void WalkAngha(const std::string& path, const std::string& rel,
+                      AnghaTree& tree) {
+  auto& dir{tree.Dirs[rel]};
+  std::error_code ec;
+  for (llvm::sys::fs::directory_iterator it(path, ec, false), end;
+       it != end && !ec; it.increment(ec)) {
+    auto name{llvm::sys::path::filename(it->path()).str()};
+    auto child{rel.empty() ? name : rel + "/" + name};
+    if (it->type() == llvm::sys::fs::file_type::regular_file) {
+      dir.Files.push_back(name);
+      tree.Files.push_back(child);
+    } else if (it->type() == llvm::sys::fs::file_type::directory_file) {
+      dir.Dirs.push_back(name);
+    }
+  }
+  LOG_IF(WARNING, ec) << "Failed to list " << path << ": " << ec.message();
+  std::sort(dir.Dirs.begin(), dir.Dirs.end());
+  std::sort(dir.Files.begin(), dir.Files.end());
+  // Inserting the subdirectories does not move `dir`
+  for (auto& name : dir.Dirs) {
+    WalkAngha(path + "/" + name, rel.empty() ? name : rel + "/" + name, tree);
+  }
+}
+
+static std::string GetAnghaPath(const std::string& rel) {
+  return FLAGS_angha + "/" + rel;
+}
 
-  if (!mutation_mutex.owns_lock()) {
-    llvm::json::Object msg{
-        {"message", "Cannot execute while other operations are in progress"}};
-    res.status = 400;
-    SendJSON(res, msg);
-    return;
+static llvm::json::Array GetAnghaEntries(const AnghaTree& tree,
+                                         const std::string& rel) {
+  llvm::json::Array result;
+  auto& dir{tree.Dirs.at(rel)};
+  for (auto& name : dir.Dirs) {
+    auto child{rel.empty() ? name : rel + "/" + name};
+    result.push_back(llvm::json::Object{
+        {"name", name}, {"entries", GetAnghaEntries(tree, child)}});
+  }
+  for (auto& name : dir.Files) {
+    auto child{rel.empty() ? name : rel + "/" + name};
+    result.push_back(
+        llvm::json::Object{{"name", name}, {"path", GetAnghaPath(child)}});
   }
+  return result;
+}
 
-  if (!session.Module) {
-    llvm::json::Object msg{{"message", "No module loaded"}};
-    res.status = 400;
-    SendJSON(res, msg);
-    return;
+static std::shared_ptr<const AnghaTree> BuildAnghaTree() {
+  rellic::ActivityScope activity("angha", FLAGS_angha);
+  auto tree{std::make_shared<AnghaTree>()};
+  WalkAngha(FLAGS_angha, "", *tree);
+  std::sort(tree->Files.begin(), tree->Files.end());
+  llvm::raw_string_ostream os(tree->JSON);
+  os << llvm::json::Value(GetAnghaEntries(*tree, ""));
+  os.flush();
+  tree->Built = std::chrono::steady_clock::now();
+  LOG(INFO) << "Indexed " << tree->Files.size() << " files in " << FLAGS_angha;
+  return tree;
+}
+
+// Walking all of AnghaBench takes seconds, so its index is built on a thread
+// of its own when the server starts, and again once it is older than
+// --angha_refresh. Requests are answered from the last complete index while
+// the next one is built.
+static struct {
+  std::mutex Mutex;
+  std::condition_variable CV;
+  std::shared_ptr<const AnghaTree> Tree;
+  bool Building{true};
+  bool Stop{false};
+} angha_index;
+
+static void IndexAngha() {
+  std::unique_lock<std::mutex> lock(angha_index.Mutex);
+  while (!angha_index.Stop) {
+    if (!angha_index.Building) {
+      angha_index.CV.wait(lock);
+      continue;
+    }
+    lock.unlock();
+    auto tree{BuildAnghaTree()};
+    lock.lock();
+    angha_index.Tree = std::move(tree);
+    angha_index.Building = false;
   }
+}
 
-  if (!session.Unit) {
-    llvm::json::Object msg{{"message", "No AST available"}};
-    res.status = 400;
-    SendJSON(res, msg);
-    return;
+// Returns the last complete index, or null if none was built yet, and starts
+// building a new one if it is too old
+static std::shared_ptr<const AnghaTree> GetAnghaTree() {
+  std::unique_lock<std::mutex> lock(angha_index.Mutex);
+  auto& tree{angha_index.Tree};
+  if (tree && FLAGS_angha_refresh && !angha_index.Building &&
+      std::chrono::steady_clock::now() - tree->Built >=
+          std::chrono::seconds(FLAGS_angha_refresh)) {
+    angha_index.Building = true;
+    angha_index.CV.notify_one();
   }
+  return tree;
+}
 
-  auto json{llvm::json::parse(req.body)};
-  if (!json) {
-    llvm::json::Object msg{{"message", "Invalid request: cannot parse."}};
+// Without parameters, sends the whole tree. With `dir`, sends the entries of
+// that directory only, as `{"dirs": [names], "files": [{name, path}]}`. With
+// `prefix`, sends the paths of at most `limit` files whose path relative to
+// --angha starts with it, as `{"files": [paths], "truncated": bool}`.
+static void ListAngha(const httplib::Request& req, httplib::Response& res) {
+  auto tree{GetAnghaTree()};
+  if (!tree) {
+    llvm::json::Object msg{{"message", "AnghaBench is still being indexed."}};
+    res.status = 503;
     SendJSON(res, msg);
-    res.status = 400;
     return;
   }
 
-  auto composite{
-      std::make_unique<rellic::CompositeASTPass>(*session.DecompContext)};
-  for (auto& obj : *json->getAsArray()) {
-    auto pass{CreatePass(session, obj)};
-    if (!pass) {
-      llvm::json::Object msg{{"message", "Invalid request"}};
+  if (req.has_param("dir")) {
+    auto rel{llvm::StringRef(req.get_param_value("dir")).trim('/').str()};
+    auto it{tree->Dirs.find(rel)};
+    if (it == tree->Dirs.end()) {
+      llvm::json::Object msg{{"message", "No such directory."}};
+      res.status = 404;
       SendJSON(res, msg);
-      res.status = 400;
       return;
     }
-    composite->GetPasses().push_back(std::move(pass));
+    llvm::json::Array dirs, files;
+    for (auto& name : it->second.Dirs) {
+      dirs.push_back(name);
+    }
+    for (auto& name : it->second.Files) {
+      files.push_back(llvm::json::Object{
+          {"name", name},
+          {"path", GetAnghaPath(rel.empty() ? name : rel + "/" + name)}});
+    }
+    llvm::json::Object obj{{"dirs", std::move(dirs)},
+                           {"files", std::move(files)}};
+    res.status = 200;
+    SendJSON(res, obj);
+    return;
   }
 
-  session.Pass = std::move(composite);
-
-  try {
-    auto t1{std::chrono::system_clock::now()};
-    auto num_iterations{session.Pass->Fixpoint()};
-    auto t2{std::chrono::system_clock::now()};
-    auto elapsed{
-        std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count()};
-
-    if (session.Pass->Stopped()) {
-      llvm::json::Object msg{{"message", "Stopped."}};
-      SendJSON(res, msg);
-    } else {
-      std::string s;
-      llvm::raw_string_ostream os(s);
-      os << "Fixpoint found after " << num_iterations << " iterations ("
-         << elapsed << " ms).";
-      llvm::json::Object msg{{"message", s}};
+  if (req.has_param("prefix")) {
+    auto prefix{req.get_param_value("prefix")};
+    size_t limit{100};
+    if (req.has_param("limit") &&
+        llvm::StringRef(req.get_param_value("limit")).getAsInteger(10, limit)) {
+      llvm::json::Object msg{{"message", "Invalid limit."}};
+      res.status = 400;
       SendJSON(res, msg);
+      return;
     }
+    llvm::json::Array files;
+    auto it{std::lower_bound(tree->Files.begin(), tree->Files.end(), prefix)};
+    for (; it != tree->Files.end() && llvm::StringRef(*it).startswith(prefix) &&
+           files.size() < limit;
+         ++it) {
+      files.push_back(GetAnghaPath(*it));
+    }
+    auto truncated{it != tree->Files.end() &&
+                   llvm::StringRef(*it).startswith(prefix)};
+    llvm::json::Object obj{{"files", std::move(files)},
+                           {"truncated", truncated}};
     res.status = 200;
-    session.Pass = nullptr;
-  } catch (rellic::Exception& e) {
-    llvm::json::Object msg{{"message", e.what()}};
-    SendJSON(res, msg);
-    res.status = 400;
-    session.Pass = nullptr;
+    SendJSON(res, obj);
+    return;
   }
-}
-
-class AAW : public llvm::AssemblyAnnotationWriter {
-  const Session& session;
 
- public:
-  AAW(const Session& session) : session(session) {}
+  res.status = 200;
+  res.set_content(tree->JSON, "application/json");
+}
 
-  void emitFunctionAnnot(const llvm::Function* F,
-                         llvm::formatted_raw_ostream& OS) override {
-    OS << "</span><span class=\"llvm\" id=\"";
-    OS.write_hex((unsigned long long)F);
-    OS << "\">";
-  }
-  void emitInstructionAnnot(const llvm::Instruction* I,
-                            llvm::formatted_raw_ostream& OS) override {
-    OS << "</span><span class=\"llvm\" id=\"";
-    OS.write_hex((unsigned long long)I);
-    OS << "\">";
-  }
-  void emitBasicBlockStartAnnot(const llvm::BasicBlock*,
-                                llvm::formatted_raw_ostream& OS) override {
-    OS << "</span><span>";
+static void LoadAngha(const httplib::Request& req, httplib::Response& res) {
+  auto session_ptr{GetSession(req)};
+  auto& session{*session_ptr};
+  write_lock lock(session.LoadMutex, std::try_to_lock);
+  if (!lock.owns_lock()) {
+    llvm::json::Object msg{
+        {"message",
+         "Cannot load a new module while other operations are in progress."}};
+    res.status = 409;
+    SendJSON(res, msg);
+    return;
   }
-  void emitBasicBlockEndAnnot(const llvm::BasicBlock*,
-                              llvm::formatted_raw_ostream& OS) override {
-    OS << "</span><span>";
+
+  auto json{llvm::json::parse(req.body)};
+  auto buffer{llvm::MemoryBuffer::getFile(json->getAsString()->str())};
+  if (!buffer) {
+    llvm::json::Object msg{{"message", "Couldn't load LLVM module."}};
+    res.status = 400;
+    SendJSON(res, msg);
+    return;
   }
-  void printInfoComment(const llvm::Value&,
-                        llvm::formatted_raw_ostream& OS) override {
-    OS << "</span><span>";
+  auto hash{llvm::xxHash64(buffer.get()->getBuffer())};
+  if (UseCachedModule(session, hash)) {
+    ++metrics.ModuleHits;
+    llvm::json::Object msg{{"message", "Ok."}};
+    SendJSON(res, msg);
+    res.status = 200;
+    return;
   }
-};
+  ++metrics.ModuleMisses;
 
-static void PrintModule(const httplib::Request& req, httplib::Response& res) {
-  auto& session{GetSession(req)};
-  read_lock load_mutex(session.LoadMutex);
-  read_lock mutation_mutex(session.MutationMutex);
-  if (!session.Module) {
-    llvm::json::Object msg{{"message", "No module loaded."}};
+  auto mod{rellic::LoadModuleFromBuffer(session.Context.get(),
+                                        buffer.get()->getMemBufferRef(), true)};
+  if (!mod) {
+    llvm::json::Object msg{{"message", "Couldn't load LLVM module."}};
     res.status = 400;
     SendJSON(res, msg);
     return;
   }
-
-  std::string s;
-  llvm::raw_string_ostream os(s);
-  AAW aaw(session);
-  os << "<pre><span>";
-  session.Module->print(os, &aaw);
-  os << "</span></pre>";
+  SetModule(session, std::unique_ptr<llvm::Module>(mod), hash);
+  llvm::json::Object msg{{"message", "Ok."}};
+  SendJSON(res, msg);
   res.status = 200;
-  res.set_content(s, "text/html");
+  lock.unlock();
+  RequestEviction();
 }
 
-template <typename TKey, typename TValue>
-static void CopyMap(const std::unordered_map<TKey*, TValue*>& from,
-                    std::unordered_map<const TKey*, const TValue*>& to,
-                    std::unordered_map<const TValue*, const TKey*>& inverse) {
-  for (auto [key, value] : from) {
-    if (value) {
-      to[key] = value;
-      inverse[value] = key;
+// Returns the prefix of the snapshot named in the body of `req`, or an empty
+// string if the name is not a plain file name
+static std::string GetSnapshotPath(const httplib::Request& req) {
+  auto json{llvm::json::parse(req.body)};
+  if (!json || !json->getAsString()) {
+    if (!json) {
+      llvm::consumeError(json.takeError());
     }
+    return "";
   }
+  auto name{*json->getAsString()};
+  if (name.empty() || llvm::sys::path::filename(name) != name ||
+      name.startswith(".")) {
+    return "";
+  }
+  llvm::SmallString<128> path{FLAGS_snapshots};
+  llvm::sys::path::append(path, name);
+  return path.str().str();
 }
 
-static void PrintAST(const httplib::Request& req, httplib::Response& res) {
-  auto& session{GetSession(req)};
+static void SaveSnapshot(const httplib::Request& req, httplib::Response& res) {
+  auto session_ptr{GetSession(req)};
+  auto& session{*session_ptr};
   read_lock load_mutex(session.LoadMutex);
   read_lock mutation_mutex(session.MutationMutex);
-  if (!session.Module) {
-    llvm::json::Object msg{{"message", "No module loaded."}};
+  auto view{GetView(session)};
+  if (!view.Module || !view.DecompContext) {
+    llvm::json::Object msg{{"message", "Nothing has been decompiled."}};
     res.status = 400;
     SendJSON(res, msg);
     return;
   }
 
-  if (!session.Unit) {
-    llvm::json::Object msg{{"message", "No AST available."}};
+  auto path{GetSnapshotPath(req)};
+  if (path.empty()) {
+    llvm::json::Object msg{{"message", "Invalid snapshot name."}};
     res.status = 400;
     SendJSON(res, msg);
     return;
   }
 
-  rellic::DecompilationResult::StmtToIRMap stmt_provenance_map;
-  rellic::DecompilationResult::IRToStmtMap value_to_stmt_map;
-  rellic::DecompilationResult::IRToDeclMap value_to_decl_map;
-  rellic::DecompilationResult::DeclToIRMap decl_provenance_map;
-  rellic::DecompilationResult::IRToTypeDeclMap type_to_decl_map;
-  rellic::DecompilationResult::TypeDeclToIRMap type_provenance_map;
-
-  CopyMap(session.DecompContext->stmt_provenance, stmt_provenance_map,
-          value_to_stmt_map);
-  CopyMap(session.DecompContext->value_decls, value_to_decl_map,
-          decl_provenance_map);
-  CopyMap(session.DecompContext->type_decls, type_to_decl_map,
-          type_provenance_map);
-
-  std::string s;
-  llvm::raw_string_ostream os(s);
-  os << "<pre>";
-  PrintDecl(session.Unit->getASTContext().getTranslationUnitDecl(),
-            session.Unit->getASTContext().getPrintingPolicy(), 0, os);
-  os << "</pre>";
-  res.status = 200;
-  res.set_content(s, "text/html");
+  try {
+    if (auto ec = llvm::sys::fs::create_directories(FLAGS_snapshots)) {
+      THROW() << "Cannot create " << FLAGS_snapshots << ": " << ec.message();
+    }
+    rellic::SaveSnapshot(*view.Module, *view.DecompContext, path);
+    llvm::json::Object msg{{"message", "Ok."}};
+    SendJSON(res, msg);
+    res.status = 200;
+  } catch (rellic::Exception& e) {
+    llvm::json::Object msg{{"message", e.what()}};
+    SendJSON(res, msg);
+    res.status = 500;
+  }
 }
 
-static llvm::json::Array EnumerateEntries(
-    const llvm::sys::fs::directory_entry& entry) {
+static void ListSnapshots(const httplib::Request& req,
+                          httplib::Response& res) {
+  llvm::json::Array names;
   std::error_code ec;
-  llvm::json::Array result;
-  for (llvm::sys::fs::directory_iterator it(entry.path(), ec, false), end;
-       it != end; it.increment(ec)) {
-    auto& entry_path{it->path()};
-    auto entry_name{entry_path.substr(entry_path.find_last_of('/') + 1)};
-    llvm::json::Object obj;
-    obj["name"] = entry_name;
-    if (it->type() == llvm::sys::fs::file_type::regular_file) {
-      obj["path"] = entry_path;
-      result.push_back(std::move(obj));
-    } else if (it->type() == llvm::sys::fs::file_type::directory_file) {
-      obj["entries"] = EnumerateEntries(*it);
-      result.push_back(std::move(obj));
+  for (llvm::sys::fs::directory_iterator it(FLAGS_snapshots, ec), end;
+       it != end && !ec; it.increment(ec)) {
+    if (llvm::sys::path::extension(it->path()) == ".json") {
+      names.push_back(llvm::sys::path::stem(it->path()).str());
     }
   }
-
-  return result;
-}
-
-static void ListAngha(const httplib::Request& req, httplib::Response& res) {
   res.status = 200;
-  auto entries{
-      EnumerateEntries(llvm::sys::fs::directory_entry(FLAGS_angha, false))};
-  SendJSON(res, entries);
+  SendJSON(res, names);
 }
 
-static void LoadAngha(const httplib::Request& req, httplib::Response& res) {
-  auto& session{GetSession(req)};
+static void LoadSnapshot(const httplib::Request& req, httplib::Response& res) {
+  auto session_ptr{GetSession(req)};
+  auto& session{*session_ptr};
   write_lock lock(session.LoadMutex, std::try_to_lock);
   if (!lock.owns_lock()) {
     llvm::json::Object msg{
@@ -760,74 +3008,414 @@ static void LoadAngha(const httplib::Request& req, httplib::Response& res) {
     return;
   }
 
-  auto json{llvm::json::parse(req.body)};
-  auto mod{rellic::LoadModuleFromFile(session.Context.get(),
-                                      json->getAsString()->str(), true)};
-  if (!mod) {
-    llvm::json::Object msg{{"message", "Couldn't load LLVM module."}};
+  auto path{GetSnapshotPath(req)};
+  if (path.empty()) {
+    llvm::json::Object msg{{"message", "Invalid snapshot name."}};
     res.status = 400;
     SendJSON(res, msg);
     return;
   }
-  session.Module = std::unique_ptr<llvm::Module>(mod);
-  llvm::json::Object msg{{"message", "Ok."}};
-  SendJSON(res, msg);
-  res.status = 200;
+
+  try {
+    auto snapshot{rellic::LoadSnapshot(*session.Context, path)};
+    session.Pass = nullptr;
+    DropCheckpoints(session);
+    session.DecompContext = nullptr;
+    session.Shared = nullptr;
+    session.LoadedHash = std::nullopt;
+    session.Module = std::move(snapshot.module);
+    session.Unit = std::move(snapshot.ast_unit);
+    session.DecompContext = std::move(snapshot.dec_ctx);
+    session.Fingerprints = GetFingerprints(*session.Module);
+    session.Rendered.Clear();
+    session.Events->Push("module", {});
+    session.Events->Push("ast", {});
+    llvm::json::Object msg{{"message", "Ok."}};
+    SendJSON(res, msg);
+    res.status = 200;
+  } catch (rellic::Exception& e) {
+    llvm::json::Object msg{{"message", e.what()}};
+    SendJSON(res, msg);
+    res.status = 400;
+  }
+  lock.unlock();
+  RequestEviction();
+}
+
+static const llvm::Function* GetParentFunction(const llvm::Value* value) {
+  if (auto inst = llvm::dyn_cast_or_null<llvm::Instruction>(value)) {
+    return inst->getFunction();
+  }
+  if (auto arg = llvm::dyn_cast_or_null<llvm::Argument>(value)) {
+    return arg->getParent();
+  }
+  if (auto block = llvm::dyn_cast_or_null<llvm::BasicBlock>(value)) {
+    return block->getParent();
+  }
+  return llvm::dyn_cast_or_null<llvm::Function>(value);
+}
+
+static ProvenanceIndex BuildProvenanceIndex(
+    rellic::DecompilationContext& dec_ctx) {
+  ProvenanceIndex index;
+  // `ir` is the value whose function the entry belongs to, if any
+  auto Add{[&index](unsigned map, const void* from, const void* to,
+                    const llvm::Value* ir) {
+    auto i{index.Entries.size()};
+    index.Entries.push_back({map, (uint64_t)from, (uint64_t)to});
+    index.Pointers.emplace_back((uint64_t)from, i);
+    index.Pointers.emplace_back((uint64_t)to, i);
+    if (auto func{GetParentFunction(ir)}) {
+      index.Functions[func->getName().str()].push_back(i);
+    }
+  }};
+  for (auto [stmt, value] : dec_ctx.stmt_provenance) {
+    Add(0, stmt, value, value);
+  }
+  for (auto [type, decl] : dec_ctx.type_decls) {
+    Add(1, type, decl, nullptr);
+  }
+  for (auto [value, decl] : dec_ctx.value_decls) {
+    Add(2, value, decl, value);
+  }
+  for (auto [arg, decl] : dec_ctx.temp_decls) {
+    Add(3, arg, decl, arg);
+  }
+  for (auto [expr, use] : dec_ctx.use_provenance) {
+    if (use) {
+      Add(4, expr, use->get(), use->getUser());
+    }
+  }
+  std::sort(index.Pointers.begin(), index.Pointers.end());
+  return index;
+}
+
+static void Publish(Session& session) {
+  auto view{GetView(session)};
+  auto version{view.Rendered->GetVersion()};
+  {
+    std::unique_lock<std::mutex> lock(session.PublishedMutex);
+    auto& published{session.Published};
+    if (published && published->Source == view.Rendered &&
+        published->Version == version && session.Viewed && view.Module) {
+      return;
+    }
+    // Readers wait for the request instead of seeing an older version
+    published = nullptr;
+  }
+  if (!session.Viewed || !view.Module) {
+    return;
+  }
+
+  auto published{std::make_shared<PublishedVersion>()};
+  published->Source = view.Rendered;
+  published->Version = version;
+  published->Module = RenderModule(session, view);
+  if (view.Unit) {
+    published->AST.emplace();
+    llvm::raw_string_ostream os(*published->AST);
+    RenderAST(view, os);
+    os.flush();
+    for (auto fdecl : GetDefinedFunctions(*view.Unit)) {
+      published->Functions.push_back({fdecl->getNameAsString(),
+                                      view.Rendered->GetGeneration(fdecl),
+                                      RenderFunction(view, fdecl)});
+    }
+  }
+  if (view.DecompContext) {
+    published->Provenance = view.Rendered->GetProvenance(
+        [&view] { return BuildProvenanceIndex(*view.DecompContext); });
+  }
+  std::unique_lock<std::mutex> lock(session.PublishedMutex);
+  session.Published = std::move(published);
 }
 
+// Lists the provenance of the AST as pairs of pointers, grouped by the map of
+// `rellic::DecompilationContext` they come from. Entries can be restricted to
+// the IR of the function named by the `function` parameter, and to those with
+// a pointer equal to `value` or within [`begin`, `end`), in hexadecimal. Pages
+// of them are selected with `offset` and `limit`, and `total` is the number of
+// entries that match.
 static void PrintProvenance(const httplib::Request& req,
                             httplib::Response& res) {
-  auto& session{GetSession(req)};
-  read_lock load_mutex(session.LoadMutex);
-  read_lock mutation_mutex(session.MutationMutex);
-  if (!session.Module) {
-    llvm::json::Object msg{{"message", "No module loaded."}};
+  auto BadRequest{[&res](const char* message) {
+    llvm::json::Object msg{{"message", message}};
     res.status = 400;
     SendJSON(res, msg);
+  }};
+  auto GetParam{[&req](const char* name, unsigned radix, uint64_t& value) {
+    return !req.has_param(name) ||
+           !llvm::StringRef(req.get_param_value(name))
+                .getAsInteger(radix, value);
+  }};
+  uint64_t offset{0}, limit{std::numeric_limits<uint64_t>::max()};
+  uint64_t value{0}, begin{0}, end{std::numeric_limits<uint64_t>::max()};
+  if (!GetParam("offset", 10, offset) || !GetParam("limit", 10, limit) ||
+      !GetParam("value", 16, value) || !GetParam("begin", 16, begin) ||
+      !GetParam("end", 16, end)) {
+    BadRequest("Invalid parameters.");
     return;
   }
-
-  llvm::json::Array stmt_provenance;
-  for (auto elem : session.DecompContext->stmt_provenance) {
-    stmt_provenance.push_back(llvm::json::Array(
-        {(unsigned long long)elem.first, (unsigned long long)elem.second}));
+  if (req.has_param("value")) {
+    begin = value;
+    end = value + 1;
   }
 
-  llvm::json::Array type_decls;
-  for (auto elem : session.DecompContext->type_decls) {
-    type_decls.push_back(llvm::json::Array(
-        {(unsigned long long)elem.first, (unsigned long long)elem.second}));
+  auto session_ptr{GetSession(req)};
+  auto& session{*session_ptr};
+  std::shared_ptr<const ProvenanceIndex> index;
+  {
+    read_lock load_mutex(session.LoadMutex);
+    read_lock mutation_mutex;
+    if (auto published = LockForReading(session, mutation_mutex)) {
+      index = published->Provenance;
+      if (!index) {
+        BadRequest("No AST available.");
+        return;
+      }
+    } else {
+      auto view{GetView(session)};
+      if (!view.Module) {
+        BadRequest("No module loaded.");
+        return;
+      }
+      if (!view.DecompContext) {
+        BadRequest("No AST available.");
+        return;
+      }
+      index = view.Rendered->GetProvenance(
+          [&view] { return BuildProvenanceIndex(*view.DecompContext); });
+    }
   }
 
-  llvm::json::Array value_decls;
-  for (auto elem : session.DecompContext->value_decls) {
-    value_decls.push_back(llvm::json::Array(
-        {(unsigned long long)elem.first, (unsigned long long)elem.second}));
+  // Indices of the matching entries, in increasing order
+  std::vector<size_t> matches;
+  auto filtered{false};
+  if (req.has_param("function")) {
+    auto it{index->Functions.find(req.get_param_value("function"))};
+    if (it != index->Functions.end()) {
+      matches = it->second;
+    }
+    filtered = true;
+  }
+  if (req.has_param("value") || req.has_param("begin") ||
+      req.has_param("end")) {
+    std::vector<size_t> in_range;
+    for (auto it{std::lower_bound(index->Pointers.begin(),
+                                  index->Pointers.end(),
+                                  std::make_pair(begin, size_t(0)))};
+         it != index->Pointers.end() && it->first < end; ++it) {
+      in_range.push_back(it->second);
+    }
+    std::sort(in_range.begin(), in_range.end());
+    in_range.erase(std::unique(in_range.begin(), in_range.end()),
+                   in_range.end());
+    if (filtered) {
+      std::vector<size_t> both;
+      std::set_intersection(matches.begin(), matches.end(), in_range.begin(),
+                            in_range.end(), std::back_inserter(both));
+      matches = std::move(both);
+    } else {
+      matches = std::move(in_range);
+    }
+    filtered = true;
+  }
+  if (!filtered) {
+    matches.resize(index->Entries.size());
+    std::iota(matches.begin(), matches.end(), 0);
   }
 
-  llvm::json::Array temp_decls;
-  for (auto elem : session.DecompContext->temp_decls) {
-    temp_decls.push_back(llvm::json::Array(
-        {(unsigned long long)elem.first, (unsigned long long)elem.second}));
+  auto total{matches.size()};
+  auto first{std::min<uint64_t>(offset, total)};
+  auto last{first + std::min<uint64_t>(limit, total - first)};
+  matches.erase(matches.begin() + last, matches.end());
+  matches.erase(matches.begin(), matches.begin() + first);
+
+  res.status = 200;
+  res.set_chunked_content_provider(
+      "application/json",
+      [index, matches{std::move(matches)}, first, total](
+          size_t, httplib::DataSink& sink) {
+        {
+          SinkStream os(sink);
+          llvm::json::OStream json(os);
+          json.object([&] {
+            json.attribute("total", (unsigned long long)total);
+            json.attribute("offset", (unsigned long long)first);
+            for (unsigned map{0}; map < ProvenanceIndex::Maps.size(); ++map) {
+              json.attributeArray(ProvenanceIndex::Maps[map], [&] {
+                for (auto i : matches) {
+                  auto& entry{index->Entries[i]};
+                  if (entry.Map != map) {
+                    continue;
+                  }
+                  json.array([&] {
+                    json.value((unsigned long long)entry.From);
+                    json.value((unsigned long long)entry.To);
+                  });
+                }
+              });
+            }
+          });
+        }
+        sink.done();
+        return true;
+      });
+}
+
+// Exports the metrics in the text format of Prometheus
+// Lists what every thread of the server is doing, as JSON or as text if
+// `format=text`
+static void PrintActivity(const httplib::Request& req,
+                          httplib::Response& res) {
+  if (req.get_param_value("format") == "text") {
+    std::string text;
+    llvm::raw_string_ostream os(text);
+    rellic::DumpActivity(os);
+    res.set_content(os.str(), "text/plain");
+    return;
   }
+  auto activity{rellic::GetActivityJSON()};
+  SendJSON(res, activity);
+}
 
-  llvm::json::Array use_provenance;
-  for (auto elem : session.DecompContext->use_provenance) {
-    if (!elem.second) {
-      continue;
+static void PrintMetrics(const httplib::Request&, httplib::Response& res) {
+  std::string text;
+  llvm::raw_string_ostream os(text);
+  auto Header{[&os](const char* name, const char* type, const char* help) {
+    os << "# HELP " << name << ' ' << help << "\n# TYPE " << name << ' '
+       << type << '\n';
+  }};
+
+  size_t resident{0}, spilled{0}, memory{0};
+  for (auto& shard : session_shards) {
+    std::unique_lock<std::mutex> lock(shard.Mutex);
+    for (auto& [id, session] : shard.Sessions) {
+      ++(session->Spilled ? spilled : resident);
+      memory += session->MemoryUsage;
+    }
+  }
+  Header("rellic_xref_sessions", "gauge", "Sessions that have not expired.");
+  os << "rellic_xref_sessions{state=\"resident\"} " << resident << '\n';
+  os << "rellic_xref_sessions{state=\"spilled\"} " << spilled << '\n';
+  Header("rellic_xref_session_memory_bytes", "gauge",
+         "Memory used by sessions, as estimated when it was last measured.");
+  os << "rellic_xref_session_memory_bytes " << memory << '\n';
+  Header("rellic_xref_peak_rss_bytes", "gauge",
+         "Peak resident set size of the server.");
+  os << "rellic_xref_peak_rss_bytes " << rellic::GetPeakRSS() << '\n';
+
+  size_t shared{0};
+  {
+    std::unique_lock<std::mutex> lock(module_cache_mutex);
+    for (auto& [hash, cached] : module_cache) {
+      shared += !cached.expired();
+    }
+  }
+  Header("rellic_xref_shared_modules", "gauge",
+         "Decompiled modules shared between sessions.");
+  os << "rellic_xref_shared_modules " << shared << '\n';
+
+  size_t running{0}, queued;
+  {
+    std::unique_lock<std::mutex> lock(jobs_mutex);
+    queued = num_queued_jobs;
+    for (auto& [id, job] : jobs) {
+      running += job->State == JobState::Running;
     }
-    use_provenance.push_back(
-        llvm::json::Array({(unsigned long long)elem.first,
-                           (unsigned long long)elem.second->get()}));
   }
+  Header("rellic_xref_jobs", "gauge", "Jobs that have not finished.");
+  os << "rellic_xref_jobs{state=\"queued\"} " << queued << '\n';
+  os << "rellic_xref_jobs{state=\"running\"} " << running << '\n';
+
+  auto Counter{[&](const char* name, const char* help, uint64_t value) {
+    Header(name, "counter", help);
+    os << name << ' ' << value << '\n';
+  }};
+  Counter("rellic_xref_z3_queries_total",
+          "Queries sent to Z3 by jobs that finished.", metrics.Z3Queries);
+  Header("rellic_xref_z3_seconds_total", "counter",
+         "Time spent waiting for Z3 by jobs that finished.");
+  os << "rellic_xref_z3_seconds_total "
+     << llvm::format("%g", metrics.Z3Nanoseconds / 1e9) << '\n';
+  auto CacheCounter{[&](const char* cache, const char* help, uint64_t hits,
+                        uint64_t misses) {
+    std::string name{"rellic_xref_"};
+    name += cache;
+    name += "_cache_lookups_total";
+    Header(name.c_str(), "counter", help);
+    os << name << "{result=\"hit\"} " << hits << '\n';
+    os << name << "{result=\"miss\"} " << misses << '\n';
+  }};
+  CacheCounter("prove", "Lookups in the memoized proofs of Z3.",
+               metrics.ProveHits, metrics.ProveMisses);
+  CacheCounter("simplify", "Lookups in the memoized simplifications of Z3.",
+               metrics.SimplifyHits, metrics.SimplifyMisses);
+  CacheCounter("render", "Lookups of HTML renderings of modules and functions.",
+               metrics.RenderHits, metrics.RenderMisses);
+  CacheCounter("module", "Lookups of decompiled modules when loading one.",
+               metrics.ModuleHits, metrics.ModuleMisses);
+
+  std::unique_lock<std::mutex> lock(metrics.Mutex);
+  Header("rellic_xref_pass_seconds_total", "counter",
+         "Time spent running each pass.");
+  for (auto& [name, stats] : metrics.Passes) {
+    os << "rellic_xref_pass_seconds_total{pass=\"" << name << "\"} "
+       << llvm::format("%g", stats.wall_time.count()) << '\n';
+  }
+  Header("rellic_xref_pass_runs_total", "counter",
+         "Runs of each pass, including fixpoint iterations.");
+  for (auto& [name, stats] : metrics.Passes) {
+    os << "rellic_xref_pass_runs_total{pass=\"" << name << "\"} "
+       << stats.runs << '\n';
+  }
+  Header("rellic_xref_pass_z3_seconds_total", "counter",
+         "Time spent in Z3 queries made by each pass.");
+  for (auto& [name, stats] : metrics.Passes) {
+    os << "rellic_xref_pass_z3_seconds_total{pass=\"" << name << "\"} "
+       << llvm::format("%g", stats.z3.time.count()) << '\n';
+  }
+  Header("rellic_xref_pass_z3_queries_total", "counter",
+         "Z3 queries made by each pass, by whether they were cached.");
+  for (auto& [name, stats] : metrics.Passes) {
+    os << "rellic_xref_pass_z3_queries_total{pass=\"" << name
+       << "\",result=\"miss\"} " << stats.z3.queries << '\n'
+       << "rellic_xref_pass_z3_queries_total{pass=\"" << name
+       << "\",result=\"hit\"} " << stats.z3.cache_hits << '\n';
+  }
+  Header("rellic_xref_pass_z3_timeouts_total", "counter",
+         "Z3 queries made by each pass that timed out.");
+  for (auto& [name, stats] : metrics.Passes) {
+    os << "rellic_xref_pass_z3_timeouts_total{pass=\"" << name << "\"} "
+       << stats.z3.timeouts << '\n';
+  }
+  Header("rellic_xref_pass_z3_nodes_total", "counter",
+         "DAG nodes of the formulas given to Z3 by each pass, and of the "
+         "simplified formulas it returned.");
+  for (auto& [name, stats] : metrics.Passes) {
+    os << "rellic_xref_pass_z3_nodes_total{pass=\"" << name
+       << "\",direction=\"in\"} " << stats.z3.nodes_in << '\n'
+       << "rellic_xref_pass_z3_nodes_total{pass=\"" << name
+       << "\",direction=\"out\"} " << stats.z3.nodes_out << '\n';
+  }
+  Header("rellic_xref_request_duration_seconds", "histogram",
+         "Time spent handling requests to each route.");
+  for (auto& [key, histogram] : metrics.Requests) {
+    // Routes and methods are fixed strings that need no escaping
+    std::string labels{"route=\"" + key.first + "\",method=\"" + key.second +
+                       "\""};
+    histogram.Write(os, "rellic_xref_request_duration_seconds", labels);
+  }
+  Header("rellic_xref_job_duration_seconds", "histogram",
+         "Time spent running jobs, from when they start.");
+  for (auto& [action, histogram] : metrics.Jobs) {
+    histogram.Write(os, "rellic_xref_job_duration_seconds",
+                    "action=\"" + action + "\"");
+  }
+  lock.unlock();
 
-  llvm::json::Object msg{{"stmt_provenance", std::move(stmt_provenance)},
-                         {"type_decls", std::move(type_decls)},
-                         {"value_decls", std::move(value_decls)},
-                         {"temp_decls", std::move(temp_decls)},
-                         {"use_provenance", std::move(use_provenance)}};
-  SendJSON(res, msg);
-  res.status = 200;
+  os.flush();
+  res.set_content(text, "text/plain; version=0.0.4");
 }
 
 int main(int argc, char* argv[]) {
@@ -847,29 +3435,91 @@ int main(int argc, char* argv[]) {
   SetVersion();
   google::ParseCommandLineFlags(&argc, &argv, true);
 
+  if (!FLAGS_trace.empty()) {
+    rellic::StartTracing(FLAGS_trace_granularity, argv[0]);
+    // Let the server shut down cleanly so that the trace can be written
+    std::signal(SIGINT, [](int) { svr.stop(); });
+    std::signal(SIGTERM, [](int) { svr.stop(); });
+  }
+
   svr.set_logger([](const httplib::Request& req, const httplib::Response&) {
     LOG(INFO) << req.method << " " << req.path;
   });
+  // Event streams hold on to their thread, so they get threads of their own
+  svr.new_task_queue = [] {
+    return new httplib::ThreadPool(CPPHTTPLIB_THREAD_POOL_COUNT +
+                                   FLAGS_max_event_streams);
+  };
   svr.set_mount_point("/", FLAGS_home);
   svr.set_pre_routing_handler(PreRoutingHandler);
-  svr.Post("/action/module", LoadModule);
-  svr.Post("/action/decompile", Decompile);
-  svr.Post("/action/remove-phi-nodes", RemovePhi);
-  svr.Post("/action/lower-switches", LowerSwitches);
-  svr.Post("/action/remove-array-arguments", RemoveArrayArguments);
-  svr.Post("/action/remove-insertvalue", RemoveInsertValue);
-  svr.Post("/action/run", Run);
-  svr.Post("/action/fixpoint", Fixpoint);
-  svr.Post("/action/stop", Stop);
-  svr.Post("/action/loadAngha", LoadAngha);
-
-  svr.Get("/action/module", PrintModule);
-  svr.Get("/action/ast", PrintAST);
-  svr.Get("/action/angha", ListAngha);
-  svr.Get("/action/provenance", PrintProvenance);
+  svr.Post("/action/module", Traced(LoadModule));
+  svr.Post("/action/decompile",
+           Traced(Queued(Decompile, EstimateDecompileCost)));
+  svr.Post("/action/remove-phi-nodes", Traced(RemovePhi));
+  svr.Post("/action/lower-switches", Traced(LowerSwitches));
+  svr.Post("/action/remove-array-arguments", Traced(RemoveArrayArguments));
+  svr.Post("/action/remove-insertvalue", Traced(RemoveInsertValue));
+  svr.Post("/action/run", Traced(Queued(Run)));
+  svr.Post("/action/fixpoint", Traced(Queued(Fixpoint)));
+  svr.Post("/action/stop", Traced(Stop));
+  svr.Post("/action/undo", Traced(Undo));
+  svr.Post("/action/checkout", Traced(Checkout));
+  svr.Post("/action/loadAngha", Traced(LoadAngha));
+  svr.Post("/action/snapshot", Traced(SaveSnapshot));
+  svr.Post("/action/loadSnapshot", Traced(LoadSnapshot));
+
+  svr.Get("/action/module", Traced(PrintModule));
+  svr.Get("/action/ast", Traced(PrintAST));
+  svr.Get("/action/functions", Traced(ListFunctions));
+  svr.Get("/action/function", Traced(PrintFunction));
+  svr.Get("/action/angha", Traced(ListAngha));
+  svr.Get("/action/snapshots", Traced(ListSnapshots));
+  svr.Get("/action/checkpoints", Traced(ListCheckpoints));
+  svr.Get("/action/provenance", Traced(PrintProvenance));
+  svr.Get("/action/job", Traced(GetJobState));
+  svr.Get("/action/job/result", Traced(GetJobResult));
+  svr.Get("/action/events", Traced(StreamEvents));
+  svr.Get("/metrics", PrintMetrics);
+  svr.Get("/debug/activity", PrintActivity);
+
+  job_pool = std::make_unique<llvm::ThreadPool>(
+      llvm::hardware_concurrency(FLAGS_job_workers));
+  std::thread expiry_thread(ExpireSessions);
+  std::thread angha_thread(IndexAngha);
+  std::thread preload_thread;
+  if (!FLAGS_preload.empty()) {
+    preload_thread = std::thread(PreloadModules);
+  }
 
   LOG(INFO) << "Listening";
   svr.listen(FLAGS_address.c_str(), FLAGS_port);
+  // Jobs refer to sessions, so they have to finish first
+  job_pool->wait();
+  {
+    std::unique_lock<std::mutex> lock(expiry_mutex);
+    stop_expiry = true;
+  }
+  expiry_cv.notify_one();
+  expiry_thread.join();
+  {
+    std::unique_lock<std::mutex> lock(angha_index.Mutex);
+    angha_index.Stop = true;
+  }
+  angha_index.CV.notify_one();
+  angha_thread.join();
+  if (preload_thread.joinable()) {
+    {
+      std::unique_lock<std::mutex> lock(preload.Mutex);
+      preload.Stop = true;
+    }
+    preload.Progress.Cancel();
+    preload.CV.notify_one();
+    preload_thread.join();
+  }
+
+  if (!FLAGS_trace.empty()) {
+    rellic::StopTracing(FLAGS_trace);
+  }
 
   google::ShutDownCommandLineFlags();
   google::ShutdownGoogleLogging();
@@ -147,36 +147,167 @@ const app = new Vue({
             }
         }
     },
+    created: function () {
+        // Not reactive: what the events of the session say has changed since
+        // it was last fetched, and the jobs waiting for them
+        this.events = null
+        this.busy = 0
+        this.refreshTimer = null
+        this.changes = { module: false, ast: false, functions: {} }
+        this.finishedJobs = new Set()
+        this.jobWaiters = {}
+        this.jobStatus = null
+    },
     mounted: function () {
         (async () => {
-            await Promise.all([
+            await Promise.allSettled([
                 this.loadModule(),
                 this.loadAST(),
                 this.loadProvenance(),
                 this.loadAngha()])
+            // Once the session cookie is set
+            this.connectEvents()
         })()
     },
     updated: function () {
-        const spans = document.querySelectorAll('.clang[id],.llvm[id]')
-        for (let span of spans) {
-            span.addEventListener('mouseover', e => {
-                e.stopImmediatePropagation()
-                span.classList.add('hover')
-                for (let prov of this.provenance[span.id] ?? []) {
-                    const provenanceSpan = document.getElementById(prov)
-                    provenanceSpan?.classList?.add('hover')
+        this.addHover(document)
+    },
+    methods: {
+        addHover(root) {
+            const spans = root.querySelectorAll('.clang[id],.llvm[id]')
+            for (let span of spans) {
+                span.addEventListener('mouseover', e => {
+                    e.stopImmediatePropagation()
+                    span.classList.add('hover')
+                    for (let prov of this.provenance[span.id] ?? []) {
+                        const provenanceSpan = document.getElementById(prov)
+                        provenanceSpan?.classList?.add('hover')
+                    }
+                })
+                span.addEventListener('mouseleave', e => {
+                    span.classList.remove('hover')
+                    for (let prov of this.provenance[span.id] ?? []) {
+                        const provenanceSpan = document.getElementById(prov)
+                        provenanceSpan?.classList?.remove('hover')
+                    }
+                })
+            }
+        },
+        // Follows the events of the session, so that jobs and changes made by
+        // other clients are seen without polling
+        connectEvents() {
+            if (!window.EventSource) {
+                return
+            }
+            const events = new EventSource("/action/events",
+                { withCredentials: true })
+            const on = (type, handler) => events.addEventListener(type,
+                e => handler(JSON.parse(e.data)))
+            on("job", job => {
+                if (job.state != "done" && job.state != "cancelled") {
+                    return
                 }
+                this.finishedJobs.add(job.job)
+                this.jobWaiters[job.job]?.()
             })
-            span.addEventListener('mouseleave', e => {
-                span.classList.remove('hover')
-                for (let prov of this.provenance[span.id] ?? []) {
-                    const provenanceSpan = document.getElementById(prov)
-                    provenanceSpan?.classList?.remove('hover')
+            on("progress", progress => {
+                if (this.jobStatus !== null && progress.stage) {
+                    this.showProgress(this.jobStatus, progress)
                 }
             })
-        }
-    },
-    methods: {
+            on("function", func => {
+                this.changes.functions[func.name] = func.generation
+                this.scheduleRefresh()
+            })
+            on("ast", () => {
+                this.changes.ast = true
+                this.scheduleRefresh()
+            })
+            on("module", () => {
+                this.changes.module = true
+                this.scheduleRefresh()
+            })
+            // Events were missed, so anything may have changed
+            on("reset", () => {
+                this.changes.module = true
+                this.changes.ast = true
+                this.scheduleRefresh()
+            })
+            this.events = events
+        },
+        // Changes made while an action of this client runs are fetched once it
+        // ends, the others shortly after they are announced
+        scheduleRefresh() {
+            if (this.busy || this.refreshTimer) {
+                return
+            }
+            this.refreshTimer = setTimeout(async () => {
+                this.refreshTimer = null
+                try {
+                    await this.applyChanges()
+                } catch (e) {
+                    this.status = e
+                }
+            }, 100)
+        },
+        clearChanges() {
+            this.changes = { module: false, ast: false, functions: {} }
+        },
+        async applyChanges() {
+            const changes = this.changes
+            this.clearChanges()
+            if (changes.module) {
+                try {
+                    await this.loadModule()
+                } catch (e) {
+                    this.module = null
+                }
+            }
+            if (changes.ast) {
+                this.provenance = {}
+                try {
+                    await this.loadAST()
+                    await this.loadProvenance()
+                } catch (e) {
+                    this.ast = null
+                }
+                return
+            }
+            for (let name in changes.functions) {
+                await this.loadFunction(name, changes.functions[name])
+            }
+        },
+        // Replaces the rendering of function `name` with the one of
+        // `generation`, along with its provenance
+        async loadFunction(name, generation) {
+            const span = document.querySelector(
+                `[data-function="${CSS.escape(name)}"]`)
+            if (!span) {
+                this.changes.ast = true
+                return await this.applyChanges()
+            }
+            // Until the request that changed it releases the session, the
+            // version published before is served instead
+            for (let tries = 0; tries < 20; ++tries) {
+                res = await fetch(
+                    `/action/function?name=${encodeURIComponent(name)}`, {
+                    credentials: "include",
+                    method: "GET"
+                })
+                if (res.status != 200) {
+                    throw (await res.json()).message
+                }
+                if (+res.headers.get("X-Generation") >= generation) {
+                    const html = await res.text()
+                    span.innerHTML = html.replace(/^<pre>|<\/pre>$/g, "")
+                    this.addHover(span)
+                    await this.loadProvenance(
+                        `&function=${encodeURIComponent(name)}`)
+                    return
+                }
+                await new Promise(resolve => setTimeout(resolve, 100))
+            }
+        },
         async loadModule() {
             res = await fetch("/action/module", {
                 credentials: "include",
@@ -197,18 +328,38 @@ const app = new Vue({
                 throw (await res.json()).message
             }
             let text = await res.text()
+            // Functions may have been replaced in place since the AST was last
+            // set, so it is rendered again even if it is the same
+            if (text === this.ast) {
+                this.ast = null
+                await this.$nextTick()
+            }
             this.ast = text
         },
-        async loadProvenance() {
-            res = await fetch("/action/provenance", {
-                credentials: "include",
-                method: "GET"
-            })
-            if (res.status != 200) {
-                throw (await res.json()).message
+        async loadProvenance(filter = "") {
+            const limit = 65536
+            for (let offset = 0; ; offset += limit) {
+                res = await fetch(
+                    `/action/provenance?offset=${offset}&limit=${limit}` +
+                    filter, {
+                    credentials: "include",
+                    method: "GET"
+                })
+                if (res.status != 200) {
+                    throw (await res.json()).message
+                }
+                const prov = await res.json()
+                this.addProvenance(prov)
+                if (offset + limit >= prov.total) {
+                    break
+                }
             }
-            const prov = await res.json()
+        },
+        addProvenance(prov) {
             for (let map in prov) {
+                if (!Array.isArray(prov[map])) {
+                    continue
+                }
                 for (let [from, to] of prov[map]) {
                     if (!from || !to) {
                         continue
@@ -228,6 +379,69 @@ const app = new Vue({
                 }
             }
         },
+        async runJob(url, body) {
+            let res = await fetch(url, {
+                credentials: "include",
+                body: body,
+                method: "POST"
+            })
+            if (res.status != 202) {
+                throw (await res.json()).message
+            }
+            const id = (await res.json()).job
+            const status = this.status
+            this.jobStatus = status
+            for (;;) {
+                // With events, the state is only polled in case the one that
+                // ends the job was missed
+                await new Promise(resolve => {
+                    if (this.finishedJobs.has(id)) {
+                        return resolve()
+                    }
+                    this.jobWaiters[id] = resolve
+                    setTimeout(resolve, this.events ? 2000 : 250)
+                })
+                delete this.jobWaiters[id]
+                res = await fetch(`/action/job?id=${id}`, {
+                    credentials: "include",
+                    method: "GET"
+                })
+                const job = await res.json()
+                if (res.status != 200) {
+                    throw job.message
+                }
+                if (job.state == "done" || job.state == "cancelled") {
+                    break
+                }
+                const progress = job.progress
+                if (progress && progress.stage) {
+                    this.showProgress(status, progress)
+                }
+            }
+            this.jobStatus = null
+            this.finishedJobs.delete(id)
+            return await fetch(`/action/job/result?id=${id}`, {
+                credentials: "include",
+                method: "GET"
+            })
+        },
+        showProgress(status, progress) {
+            this.status = `${status} ${progress.stage}: ` +
+                `${progress.functionsGenerated}/` +
+                `${progress.functionsTotal} functions structured, ` +
+                `${progress.functionsRefined} refined, iteration ` +
+                `${progress.iteration}, ${progress.z3Calls} Z3 queries`
+        },
+        // Fetches what a job changed: only the functions it modified if the
+        // events of the session say which, everything otherwise
+        async refreshAfterJob() {
+            if (this.events) {
+                return await this.applyChanges()
+            }
+            await this.loadAST()
+            this.provenance = {}
+            await this.loadProvenance()
+        },
         async loadAngha() {
             res = await fetch("/action/angha", {
                 credentials: "include",
@@ -245,6 +459,7 @@ const app = new Vue({
         upload() {
             this.status = "Uploading...";
             (async () => {
+                ++this.busy
                 try {
                     let res = await fetch("/action/module", {
                         credentials: "include",
@@ -257,40 +472,41 @@ const app = new Vue({
                     this.status = "Loading module text..."
                     await this.loadModule()
                     this.ast = null
+                    this.clearChanges()
                     this.status = "Ready."
                 } catch (e) {
                     this.status = e
                     this.module = null
                     this.ast = null
+                } finally {
+                    --this.busy
                 }
             })()
         },
         decompile() {
             this.status = "Decompiling...";
             (async () => {
+                ++this.busy
                 try {
-                    let res = await fetch("/action/decompile", {
-                        credentials: "include",
-                        method: "POST"
-                    })
+                    let res = await this.runJob("/action/decompile")
                     if (res.status != 200) {
                         throw (await res.json()).message
                     }
                     this.status = "Loading AST..."
-                    await this.loadAST()
-                    this.status = "Loading provenance info..."
-                    this.provenance = {}
-                    await this.loadProvenance()
+                    await this.refreshAfterJob()
                     this.status = "Ready."
                 } catch (e) {
                     this.status = e
                     this.ast = null
+                } finally {
+                    --this.busy
                 }
             })()
         },
         runAction(action) {
             this.status = `${action.desc}...`;
             (async () => {
+                ++this.busy
                 try {
                     let res = await fetch(action.url, {
                         credentials: "include",
@@ -300,10 +516,13 @@ const app = new Vue({
                         throw (await res.json()).message
                     }
                     this.status = (await res.json()).message
-                    this.loadModule()
+                    await this.loadModule()
+                    this.changes.module = false
                 } catch (e) {
                     this.status = e
                     this.ast = null
+                } finally {
+                    --this.busy
                 }
             })()
         },
@@ -328,6 +547,7 @@ const app = new Vue({
                 const path = this.$refs.anghaDialog.returnValue;
                 console.log("path: ", path);
                 (async () => {
+                    ++this.busy
                     try {
                         this.status = `Loading ${path}...`
                         this.running = true
@@ -341,11 +561,14 @@ const app = new Vue({
                         }
                         await this.loadModule()
                         this.ast = null
+                        this.clearChanges()
                         this.status = "Ready."
                     } catch (e) {
                         this.status = e
                         this.module = null
                         this.ast = null
+                    } finally {
+                        --this.busy
                     }
                 })()
             }
@@ -355,22 +578,19 @@ const app = new Vue({
                 try {
                     this.status = "Executing passes..."
                     this.running = true
-                    let res = await fetch("/action/run", {
-                        credentials: "include",
-                        body: JSON.stringify(this.commands),
-                        method: "POST"
-                    })
+                    ++this.busy
+                    let res = await this.runJob("/action/run",
+                        JSON.stringify(this.commands))
                     if (res.status != 200) {
                         throw (await res.json()).message
                     }
                     this.status = (await res.json()).message
-                    await this.loadAST()
-                    this.provenance = {}
-                    await this.loadProvenance()
+                    await this.refreshAfterJob()
                 } catch (e) {
                     this.status = e
                 } finally {
                     this.running = false
+                    --this.busy
                 }
             })()
         },
@@ -379,22 +599,19 @@ const app = new Vue({
                 try {
                     this.status = "Searching fixpoint..."
                     this.running = true
-                    let res = await fetch("/action/fixpoint", {
-                        credentials: "include",
-                        body: JSON.stringify(this.commands),
-                        method: "POST"
-                    })
+                    ++this.busy
+                    let res = await this.runJob("/action/fixpoint",
+                        JSON.stringify(this.commands))
                     if (res.status != 200) {
                         throw (await res.json()).message
                     }
                     this.status = (await res.json()).message
-                    await this.loadAST()
-                    this.provenance = {}
-                    await this.loadProvenance()
+                    await this.refreshAfterJob()
                 } catch (e) {
                     this.status = e
                 } finally {
                     this.running = false
+                    --this.busy
                 }
             })()
         },
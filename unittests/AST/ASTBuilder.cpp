@@ -33,6 +33,62 @@ static void IsNullPtrExprCheck(clang::ASTContext &ctx, clang::Expr *expr) {
         clang::Expr::NPCK_ZeroLiteral);
 }
 
+// Whether `a` and `b` are trees of the same kinds of nodes, with the same
+// types, operators and declarations
+static bool IsSameTree(clang::Stmt *a, clang::Stmt *b) {
+  if (!a || !b) {
+    return a == b;
+  }
+  if (a->getStmtClass() != b->getStmtClass()) {
+    return false;
+  }
+  if (auto expr = clang::dyn_cast<clang::Expr>(a)) {
+    auto other{clang::cast<clang::Expr>(b)};
+    if (expr->getType() != other->getType() ||
+        expr->getValueKind() != other->getValueKind() ||
+        expr->getObjectKind() != other->getObjectKind()) {
+      return false;
+    }
+  }
+  if (auto cast = clang::dyn_cast<clang::CastExpr>(a)) {
+    if (cast->getCastKind() != clang::cast<clang::CastExpr>(b)->getCastKind()) {
+      return false;
+    }
+  }
+  if (auto op = clang::dyn_cast<clang::UnaryOperator>(a)) {
+    auto other{clang::cast<clang::UnaryOperator>(b)};
+    if (op->getOpcode() != other->getOpcode() ||
+        op->canOverflow() != other->canOverflow()) {
+      return false;
+    }
+  }
+  if (auto op = clang::dyn_cast<clang::BinaryOperator>(a)) {
+    if (op->getOpcode() != clang::cast<clang::BinaryOperator>(b)->getOpcode()) {
+      return false;
+    }
+  }
+  if (auto ref = clang::dyn_cast<clang::DeclRefExpr>(a)) {
+    if (ref->getDecl() != clang::cast<clang::DeclRefExpr>(b)->getDecl()) {
+      return false;
+    }
+  }
+  if (auto member = clang::dyn_cast<clang::MemberExpr>(a)) {
+    if (member->getMemberDecl() !=
+        clang::cast<clang::MemberExpr>(b)->getMemberDecl()) {
+      return false;
+    }
+  }
+  auto child_a{a->child_begin()};
+  auto child_b{b->child_begin()};
+  for (; child_a != a->child_end() && child_b != b->child_end();
+       ++child_a, ++child_b) {
+    if (!IsSameTree(*child_a, *child_b)) {
+      return false;
+    }
+  }
+  return child_a == a->child_end() && child_b == b->child_end();
+}
+
 }  // namespace
 
 // TODO(surovic): Add test cases for signed llvm::APInt and group
@@ -1320,4 +1376,107 @@ TEST_SUITE("ASTBuilder::CreateSwitchStmt") {
       }
     }
   }
-}
\ No newline at end of file
+}
+
+TEST_SUITE("ASTBuilder::SetFastPath") {
+  SCENARIO("Build the same expressions with and without clang::Sema") {
+    GIVEN("Declarations of variables, a structure and functions") {
+      auto unit{GetASTUnit(
+          "struct s{int a; unsigned b : 3;}; struct s v; const struct s *p;"
+          "int i, j; unsigned u; char c; int *ip; void *vp;"
+          "int f(int x, unsigned y); void g(char x);")};
+      auto &ctx{unit->getASTContext()};
+      auto tudecl{ctx.getTranslationUnitDecl()};
+      rellic::ASTBuilder sema_ast(*unit);
+      sema_ast.SetFastPath(false);
+      rellic::ASTBuilder fast_ast(*unit);
+      auto ref{[&](rellic::ASTBuilder &ast, const std::string &name) {
+        return ast.CreateDeclRef(GetDecl<clang::ValueDecl>(tudecl, name));
+      }};
+      auto field{[&](const std::string &name) {
+        auto sdecl{GetDecl<clang::RecordDecl>(tudecl, "s")};
+        return GetDecl<clang::FieldDecl>(sdecl, name);
+      }};
+      // Builds an expression with both builders and compares them
+      auto check{[&](auto build) {
+        clang::Expr *expected{build(sema_ast)};
+        clang::Expr *actual{build(fast_ast)};
+        REQUIRE(expected != nullptr);
+        REQUIRE(actual != nullptr);
+        CHECK(IsSameTree(expected, actual));
+      }};
+      THEN("integer arithmetic and comparisons are the same") {
+        check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateAdd(ref(ast, "i"), ref(ast, "j"));
+        });
+        check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateLT(ast.CreateShl(ref(ast, "u"), ref(ast, "u")),
+                              ast.CreateIntLit(llvm::APInt(32U, 7U)));
+        });
+        check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateLAnd(ref(ast, "ip"),
+                                ast.CreateNot(ref(ast, "i")));
+        });
+      }
+      THEN("operands that are promoted or converted are the same") {
+        check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateAdd(ref(ast, "c"), ref(ast, "c"));
+        });
+        check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateAdd(ref(ast, "i"), ref(ast, "u"));
+        });
+        check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateNot(ast.CreateDot(ref(ast, "v"), field("b")));
+        });
+      }
+      THEN("assignments, dereferences and addresses are the same") {
+        check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateAssign(ast.CreateDeref(ref(ast, "ip")),
+                                  ref(ast, "i"));
+        });
+        check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateAssign(ref(ast, "ip"),
+                                  ast.CreateAddrOf(ref(ast, "j")));
+        });
+        check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateAddrOf(ast.CreateDeref(ref(ast, "ip")));
+        });
+        check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateLNot(ref(ast, "vp"));
+        });
+      }
+      THEN("casts are the same") {
+        check([&](rellic::ASTBuilder &ast) { return ast.CreateNull(); });
+        check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateCStyleCast(ctx.UnsignedLongTy, ref(ast, "ip"));
+        });
+        check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateCStyleCast(ctx.getPointerType(ctx.CharTy),
+                                      ref(ast, "ip"));
+        });
+        check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateCStyleCast(ctx.BoolTy, ref(ast, "u"));
+        });
+        check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateCStyleCast(ctx.ShortTy, ref(ast, "u"));
+        });
+      }
+      THEN("calls and field accesses are the same") {
+        check([&](rellic::ASTBuilder &ast) {
+          std::vector<clang::Expr *> args{ref(ast, "i"), ref(ast, "u")};
+          return ast.CreateCall(ref(ast, "f"), args);
+        });
+        check([&](rellic::ASTBuilder &ast) {
+          std::vector<clang::Expr *> args{ref(ast, "i")};
+          return ast.CreateCall(ref(ast, "g"), args);
+        });
+        check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateDot(ref(ast, "v"), field("a"));
+        });
+        check([&](rellic::ASTBuilder &ast) {
+          return ast.CreateArrow(ref(ast, "p"), field("b"));
+        });
+      }
+    }
+  }
+}
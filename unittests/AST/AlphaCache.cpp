@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/AlphaCache.h"
+
+#include <doctest/doctest.h>
+
+TEST_SUITE("AlphaCache") {
+  SCENARIO("Formulas equal up to renaming share their answers") {
+    GIVEN("The same condition over different variables of two contexts") {
+      rellic::AlphaCache cache;
+      z3::context ctx_a, ctx_b;
+      auto a1{ctx_a.bool_const("br_a1")};
+      auto a2{ctx_a.bool_const("br_a2")};
+      auto b1{ctx_b.bool_const("br_b1")};
+      auto b2{ctx_b.bool_const("br_b2")};
+      auto key_a{rellic::AlphaCache::Canonicalize(a1 || (!a1 && a2))};
+      auto key_b{rellic::AlphaCache::Canonicalize(b1 || (!b1 && b2))};
+      THEN("a proof found for one is found for the other") {
+        cache.SetProof(key_a, false);
+        auto proof{cache.GetProof(key_b)};
+        REQUIRE(proof);
+        CHECK_FALSE(*proof);
+        CHECK_EQ(cache.hits, 1);
+      }
+      THEN("a simplified form is returned over the other's variables") {
+        cache.SetSimplified(key_a, a1 || a2);
+        auto simplified{cache.GetSimplified(key_b)};
+        REQUIRE(simplified);
+        CHECK(z3::eq(*simplified, b1 || b2));
+      }
+      THEN("formulas of another shape are not found") {
+        cache.SetProof(key_a, false);
+        auto key{rellic::AlphaCache::Canonicalize(b1 && b2)};
+        CHECK_FALSE(cache.GetProof(key));
+        CHECK_EQ(cache.misses, 1);
+      }
+      THEN("the order of the variables matters") {
+        cache.SetProof(key_a, false);
+        auto key{rellic::AlphaCache::Canonicalize(b2 || (!b1 && b2))};
+        CHECK_FALSE(cache.GetProof(key));
+      }
+    }
+  }
+
+  SCENARIO("Simplified forms with foreign variables are not stored") {
+    GIVEN("A result that refers to a constant missing from its key") {
+      rellic::AlphaCache cache;
+      z3::context ctx;
+      auto x{ctx.bool_const("x")};
+      auto y{ctx.bool_const("y")};
+      auto key{rellic::AlphaCache::Canonicalize(x && !x)};
+      cache.SetSimplified(key, y);
+      THEN("it is not found") { CHECK_FALSE(cache.GetSimplified(key)); }
+    }
+  }
+}
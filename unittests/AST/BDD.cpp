@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/BDD.h"
+
+#include <doctest/doctest.h>
+
+TEST_SUITE("BDD") {
+  SCENARIO("Equivalent formulas are the same node") {
+    GIVEN("Two variables a and b") {
+      rellic::BDD bdd;
+      auto a{bdd.Var(0)};
+      auto b{bdd.Var(1)};
+      THEN("De Morgan's laws hold") {
+        CHECK_EQ(bdd.Not(bdd.And(a, b)), bdd.Or(bdd.Not(a), bdd.Not(b)));
+        CHECK_EQ(bdd.Not(bdd.Or(a, b)), bdd.And(bdd.Not(a), bdd.Not(b)));
+      }
+      THEN("tautologies and contradictions are constants") {
+        CHECK_EQ(bdd.Or(a, bdd.Not(a)), rellic::BDD::True);
+        CHECK_EQ(bdd.And(a, bdd.Not(a)), rellic::BDD::False);
+        CHECK_EQ(bdd.Iff(bdd.Xor(a, b), bdd.Not(bdd.Iff(a, b))),
+                 rellic::BDD::True);
+      }
+      THEN("different formulas are different nodes") {
+        CHECK_NE(bdd.And(a, b), bdd.Or(a, b));
+        CHECK_NE(a, b);
+      }
+    }
+  }
+
+  SCENARIO("Running out of nodes") {
+    GIVEN("A BDD with room for a few nodes") {
+      rellic::BDD bdd(4);
+      auto x{bdd.And(bdd.Var(0), bdd.And(bdd.Var(1), bdd.Var(2)))};
+      THEN("it reports the overflow until it is cleared") {
+        CHECK(bdd.Overflowed());
+        bdd.Clear();
+        CHECK_FALSE(bdd.Overflowed());
+        CHECK_EQ(bdd.Size(), 2);
+      }
+      (void)x;
+    }
+  }
+}
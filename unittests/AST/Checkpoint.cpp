@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/Checkpoint.h"
+
+#include <clang/AST/Decl.h>
+#include <clang/AST/Stmt.h>
+
+#include "Util.h"
+
+TEST_SUITE("Checkpoints") {
+  SCENARIO("Functions are restored to the state of a checkpoint") {
+    GIVEN("Two functions, one of which is modified after a checkpoint") {
+      auto unit{GetASTUnit(
+          "void f(int x) { if (x) { x = 1; } else { x = 2; } }\n"
+          "void g(void) {}")};
+      auto tudecl{unit->getASTContext().getTranslationUnitDecl()};
+      auto f{GetDecl<clang::FunctionDecl>(tudecl, "f")};
+      auto g{GetDecl<clang::FunctionDecl>(tudecl, "g")};
+      rellic::DecompilationContext dec_ctx(*unit);
+      rellic::Checkpoints checkpoints(dec_ctx);
+      auto body{f->getBody()};
+      auto if_stmt{clang::cast<clang::IfStmt>(
+          clang::cast<clang::CompoundStmt>(body)->body_front())};
+      auto then_stmt{if_stmt->getThen()};
+      auto else_stmt{if_stmt->getElse()};
+      auto cond{dec_ctx.z3_ctx.bool_const("c")};
+      dec_ctx.conds[if_stmt] = dec_ctx.InsertZExpr(cond);
+
+      auto first{checkpoints.Create()};
+      dec_ctx.EnterFunction(f);
+      if_stmt->setThen(else_stmt);
+      if_stmt->setElse(then_stmt);
+      dec_ctx.conds[if_stmt] = dec_ctx.InsertZExpr(!cond);
+      std::vector<clang::Stmt *> stmts{if_stmt};
+      f->setBody(dec_ctx.ast.CreateCompoundStmt(stmts));
+      dec_ctx.LeaveFunction();
+      auto second{checkpoints.Create()};
+
+      THEN("checking out the checkpoint undoes the changes") {
+        auto restored{checkpoints.Checkout(first)};
+        REQUIRE_EQ(restored.size(), 1);
+        CHECK_EQ(restored[0], f);
+        CHECK_EQ(f->getBody(), body);
+        CHECK_EQ(if_stmt->getThen(), then_stmt);
+        CHECK_EQ(if_stmt->getElse(), else_stmt);
+        CHECK(z3::eq(dec_ctx.z3_exprs[dec_ctx.conds[if_stmt]], cond));
+      }
+      THEN("later checkpoints can be checked out again") {
+        checkpoints.Checkout(first);
+        auto restored{checkpoints.Checkout(second)};
+        REQUIRE_EQ(restored.size(), 1);
+        CHECK_NE(f->getBody(), body);
+        CHECK_EQ(if_stmt->getThen(), else_stmt);
+        CHECK(z3::eq(dec_ctx.z3_exprs[dec_ctx.conds[if_stmt]], !cond));
+      }
+      THEN("unmodified functions are left alone") {
+        auto g_body{g->getBody()};
+        checkpoints.Checkout(first);
+        CHECK_EQ(g->getBody(), g_body);
+        CHECK(checkpoints.Checkout(second).size() == 1);
+        CHECK(checkpoints.Checkout(second).empty());
+      }
+      THEN("undone checkpoints are dropped") {
+        checkpoints.Truncate(second);
+        CHECK_EQ(checkpoints.Size(), 1);
+      }
+    }
+  }
+}
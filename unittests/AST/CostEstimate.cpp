@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/CostEstimate.h"
+
+#include <doctest/doctest.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <memory>
+
+#include "rellic/AST/PassProfile.h"
+#include "rellic/BC/Util.h"
+
+namespace {
+const char *kModule = R"(
+define i32 @straight(i32 %a) {
+  %r = add i32 %a, 1
+  ret i32 %r
+}
+
+define i32 @loop(i32 %n) {
+entry:
+  br label %head
+head:
+  %i = phi i32 [ 0, %entry ], [ %next, %body ]
+  %done = icmp sge i32 %i, %n
+  br i1 %done, label %exit, label %body
+body:
+  %next = add i32 %i, 1
+  br label %head
+exit:
+  ret i32 %i
+}
+
+declare i32 @external(i32)
+)";
+}  // namespace
+
+TEST_SUITE("CostEstimate") {
+  SCENARIO("Estimating the cost of decompiling a module") {
+    GIVEN("A module with a straight-line function and a loop") {
+      llvm::LLVMContext ctx;
+      std::unique_ptr<llvm::Module> module{rellic::LoadModuleFromBuffer(
+          &ctx, llvm::MemoryBufferRef(kModule, "module"))};
+      REQUIRE(module);
+      auto &straight{*module->getFunction("straight")};
+      auto &loop{*module->getFunction("loop")};
+
+      THEN("functions are measured") {
+        auto cost{rellic::EstimateFunctionCost(loop)};
+        CHECK_EQ(cost.blocks, 4U);
+        CHECK_EQ(cost.instructions, 7U);
+        CHECK_EQ(cost.loop_depth, 1U);
+        CHECK_GT(cost.cost, rellic::EstimateFunctionCost(straight).cost);
+        auto external{module->getFunction("external")};
+        CHECK_EQ(rellic::EstimateFunctionCost(*external).cost, 0U);
+      }
+      THEN("the module is the sum of its definitions") {
+        auto cost{rellic::EstimateModuleCost(*module)};
+        CHECK_EQ(cost.functions, 2U);
+        CHECK_EQ(cost.known_functions, 0U);
+        CHECK_EQ(cost.max_loop_depth, 1U);
+        CHECK_EQ(cost.cost, rellic::EstimateFunctionCost(straight).cost +
+                                rellic::EstimateFunctionCost(loop).cost);
+      }
+      THEN("measured times take over the estimates of their shapes") {
+        rellic::CostHistory history;
+        CHECK_FALSE(history.Lookup(rellic::GetFunctionShape(loop)));
+        // The loop took ten times as long as its estimate suggests
+        auto straight_cost{rellic::EstimateFunctionCost(straight).cost};
+        auto loop_cost{rellic::EstimateFunctionCost(loop).cost};
+        history.Record(straight, rellic::Duration(straight_cost));
+        history.Record(loop, rellic::Duration(loop_cost * 10));
+        auto known{history.Lookup(rellic::GetFunctionShape(loop))};
+        REQUIRE(known);
+        CHECK_GT(*known, loop_cost);
+        auto known_straight{
+            history.Lookup(rellic::GetFunctionShape(straight))};
+        REQUIRE(known_straight);
+        CHECK_LT(*known_straight, straight_cost);
+        auto cost{rellic::EstimateModuleCost(*module, &history)};
+        CHECK_EQ(cost.known_functions, 2U);
+        CHECK_EQ(cost.cost, *known + *known_straight);
+      }
+    }
+  }
+}
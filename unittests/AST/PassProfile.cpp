@@ -0,0 +1,46 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/PassProfile.h"
+
+#include <doctest/doctest.h>
+
+TEST_SUITE("PassProfile") {
+  SCENARIO("Skip passes that never change a shape") {
+    GIVEN("A profile with two passes recorded on one shape") {
+      rellic::PassProfile profile;
+      profile.min_visits = 2;
+      rellic::Duration time{0.25};
+      profile.Record("b1.l0.s0", "dse", false, time);
+      profile.Record("b1.l0.s0", "ncp", true, time);
+      profile.Record("b1.l0.s0", "ncp", false, time);
+      THEN("passes are useless once visited enough without a change") {
+        CHECK(!profile.IsUseless("b1.l0.s0", "dse"));
+        profile.Record("b1.l0.s0", "dse", false, time);
+        CHECK(profile.IsUseless("b1.l0.s0", "dse"));
+        CHECK(!profile.IsUseless("b1.l0.s0", "ncp"));
+        CHECK(!profile.IsUseless("b2.l0.s0", "dse"));
+      }
+      THEN("merging adds up the visits") {
+        rellic::PassProfile other{profile};
+        other.Merge(profile);
+        CHECK(other.IsUseless("b1.l0.s0", "dse"));
+        CHECK(other.GetKey() != profile.GetKey());
+      }
+      THEN("the profile survives a JSON round trip") {
+        profile.Record("b1.l0.s0", "dse", false, time);
+        auto copy{
+            rellic::PassProfile::FromJSON(llvm::json::Value(profile.ToJSON()))};
+        REQUIRE(copy);
+        CHECK(copy->min_visits == 2);
+        CHECK(copy->IsUseless("b1.l0.s0", "dse"));
+        CHECK(copy->GetKey() == profile.GetKey());
+      }
+    }
+  }
+}
@@ -9,6 +9,11 @@
 #include "rellic/AST/StructGenerator.h"
 
 #include <clang/AST/Decl.h>
+#include <clang/AST/Expr.h>
+#include <llvm/BinaryFormat/Dwarf.h>
+#include <llvm/IR/DIBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
 
 #include "Util.h"
 #include "rellic/AST/ASTBuilder.h"
@@ -119,4 +124,96 @@ TEST_SUITE("StructGenerator::GetAccessor") {
       }
     }
   }
-}
\ No newline at end of file
+
+  SCENARIO("Create accessors for arrays of structs") {
+    GIVEN("Struct definition s") {
+      std::vector<std::string> args{"-target", "x86_64-pc-linux-gnu"};
+      auto unit{GetASTUnit(
+          "struct s { int i; struct { char c[4]; short h[2]; } a[2]; } x;",
+          args)};
+      auto &ctx{unit->getASTContext()};
+      auto tudecl{ctx.getTranslationUnitDecl()};
+      rellic::ASTBuilder ast(*unit);
+      rellic::StructGenerator gen(*unit);
+      auto var{GetDeclRef<clang::VarDecl>(ast, tudecl, "x")};
+      auto strct{GetDecl<clang::RecordDecl>(tudecl, "s")};
+      THEN("return accesses to the elements") {
+        // x.a[1].c[1]
+        auto accessors_c{gen.GetAccessor(var, strct, 104, 8)};
+        REQUIRE_EQ(accessors_c.size(), 1);
+        auto sub_c{clang::dyn_cast<clang::ArraySubscriptExpr>(accessors_c[0])};
+        REQUIRE(sub_c);
+        CHECK(ctx.hasSameType(sub_c->getType(), ctx.CharTy));
+
+        // x.a[1].h[1]
+        auto accessors_h{gen.GetAccessor(var, strct, 144, 16)};
+        REQUIRE_EQ(accessors_h.size(), 1);
+        CHECK(ctx.hasSameType(accessors_h[0]->getType(), ctx.ShortTy));
+
+        auto accessors_i{gen.GetAccessor(var, strct, 0, 32)};
+        CHECK_EQ(accessors_i.size(), 1);
+
+        auto accessors_invalid{gen.GetAccessor(var, strct, 32, 32)};
+        CHECK_EQ(accessors_invalid.size(), 0);
+      }
+      THEN("return new accessors for repeated ranges") {
+        auto first{gen.GetAccessor(var, strct, 0, 32)};
+        auto second{gen.GetAccessor(var, strct, 0, 32)};
+        REQUIRE_EQ(first.size(), 1);
+        REQUIRE_EQ(second.size(), 1);
+        CHECK_NE(first[0], second[0]);
+      }
+    }
+  }
+}
+TEST_SUITE("StructGenerator::GenerateDecls") {
+  SCENARIO("Definitions are reported in dependency order") {
+    GIVEN("struct outer { struct inner in; int *p; }") {
+      llvm::LLVMContext llvm_ctx;
+      llvm::Module module("m", llvm_ctx);
+      llvm::DIBuilder dib(module);
+      auto file{dib.createFile("test.c", "/")};
+      auto int_type{dib.createBasicType("int", 32, llvm::dwarf::DW_ATE_signed)};
+      auto inner{dib.createStructType(
+          file, "inner", file, 1, 32, 32, llvm::DINode::FlagZero, nullptr,
+          dib.getOrCreateArray({dib.createMemberType(
+              file, "i", file, 1, 32, 32, 0, llvm::DINode::FlagZero,
+              int_type)}))};
+      auto in{dib.createMemberType(file, "in", file, 2, 32, 32, 0,
+                                   llvm::DINode::FlagZero, inner)};
+      auto p{dib.createMemberType(file, "p", file, 2, 64, 64, 64,
+                                  llvm::DINode::FlagZero,
+                                  dib.createPointerType(int_type, 64))};
+      auto outer{dib.createStructType(file, "outer", file, 2, 128, 64,
+                                      llvm::DINode::FlagZero, nullptr,
+                                      dib.getOrCreateArray({in, p}))};
+      dib.finalize();
+
+      std::vector<std::string> args{"-target", "x86_64-pc-linux-gnu"};
+      auto unit{GetASTUnit("", args)};
+      auto tudecl{unit->getASTContext().getTranslationUnitDecl()};
+      rellic::StructGenerator gen(*unit);
+      std::vector<llvm::DIType *> types{outer};
+      std::vector<std::string> defined;
+      gen.GenerateDecls(types.begin(), types.end(),
+                        [&](llvm::DICompositeType *type) {
+                          gen.ReleaseFields(type);
+                          defined.push_back(type->getName().str());
+                          // The definition is the last declaration
+                          clang::Decl *last{nullptr};
+                          for (auto decl : tudecl->decls()) {
+                            last = decl;
+                          }
+                          auto record{clang::dyn_cast<clang::RecordDecl>(last)};
+                          REQUIRE(record);
+                          CHECK(record->isCompleteDefinition());
+                          CHECK_EQ(record->getName(), type->getName());
+                        });
+      THEN("the inner struct is defined first") {
+        REQUIRE_EQ(defined.size(), 2);
+        CHECK_EQ(defined[0], "inner");
+        CHECK_EQ(defined[1], "outer");
+      }
+    }
+  }
+}
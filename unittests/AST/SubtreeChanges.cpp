@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include <clang/AST/Decl.h>
+#include <clang/AST/Stmt.h>
+
+#include <vector>
+
+#include "Util.h"
+#include "rellic/AST/DeadStmtElim.h"
+
+TEST_SUITE("SubtreeChanges") {
+  SCENARIO("Passes skip the subtrees that did not change since") {
+    GIVEN("A function that DeadStmtElim leaves alone") {
+      auto unit{GetASTUnit("void f(int x) { if (x) { x = 1; } x = 2; }")};
+      auto tudecl{unit->getASTContext().getTranslationUnitDecl()};
+      auto f{GetDecl<clang::FunctionDecl>(tudecl, "f")};
+      rellic::DecompilationContext dec_ctx(*unit);
+      auto body{clang::cast<clang::CompoundStmt>(f->getBody())};
+      auto if_stmt{clang::cast<clang::IfStmt>(body->body_front())};
+      rellic::DeadStmtElim pass(dec_ctx);
+      REQUIRE_FALSE(pass.Run());
+      auto &stats{dec_ctx.stats.passes["DeadStmtElim"]};
+      REQUIRE_EQ(stats.skipped_subtrees, 0U);
+
+      THEN("running it again skips the whole body") {
+        CHECK_FALSE(pass.Run());
+        CHECK_EQ(stats.skipped_subtrees, 1U);
+      }
+      THEN("a statement marked as changed is examined again") {
+        std::vector<clang::Stmt *> empty;
+        if_stmt->setThen(dec_ctx.ast.CreateCompoundStmt(empty));
+        dec_ctx.subtree_changes.Mark(if_stmt);
+        dec_ctx.subtree_changes.Mark(body);
+        CHECK(pass.Run());
+        auto new_body{clang::cast<clang::CompoundStmt>(f->getBody())};
+        CHECK_EQ(new_body->size(), 1U);
+      }
+      THEN("a function marked as changed is examined again") {
+        std::vector<clang::Stmt *> empty;
+        if_stmt->setThen(dec_ctx.ast.CreateCompoundStmt(empty));
+        dec_ctx.subtree_changes.Mark(f);
+        CHECK(pass.Run());
+        CHECK_EQ(stats.skipped_subtrees, 0U);
+      }
+      THEN("changes made by the pass are not skipped") {
+        std::vector<clang::Stmt *> empty;
+        if_stmt->setThen(dec_ctx.ast.CreateCompoundStmt(empty));
+        dec_ctx.subtree_changes.Mark(f);
+        REQUIRE(pass.Run());
+        // The body it created is examined, the statement it kept is skipped
+        CHECK_FALSE(pass.Run());
+        CHECK_EQ(stats.skipped_subtrees, 1U);
+      }
+    }
+  }
+}
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/TypeLibrary.h"
+
+#include <clang/AST/Decl.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include <string>
+
+#include "Util.h"
+#include "rellic/Exception.h"
+
+namespace {
+using Library = rellic::TypeLibrary;
+
+std::shared_ptr<const Library> LoadString(llvm::StringRef contents) {
+  return Library::Load(llvm::MemoryBuffer::getMemBufferCopy(contents));
+}
+}  // namespace
+
+TEST_SUITE("TypeLibrary") {
+  SCENARIO("Prototypes are read back from a serialized library") {
+    GIVEN("A library built from declarations") {
+      auto unit{GetASTUnit(
+          "struct s { int a; struct s *next; };"
+          "typedef unsigned long size_t2;"
+          "int f(struct s *p, size_t2 n);"
+          "extern int g;")};
+      auto tudecl{unit->getASTContext().getTranslationUnitDecl()};
+      rellic::TypeLibraryBuilder builder(unit->getASTContext());
+      REQUIRE(builder.Add(GetDecl<clang::FunctionDecl>(tudecl, "f")));
+      REQUIRE(builder.Add(GetDecl<clang::VarDecl>(tudecl, "g")));
+      auto contents{builder.Serialize()};
+      auto library{LoadString(contents)};
+
+      THEN("its symbols are found by name and kind") {
+        CHECK_NE(library->Lookup("f", Library::SymbolKind::Function), nullptr);
+        CHECK_NE(library->Lookup("g", Library::SymbolKind::Variable), nullptr);
+        CHECK_EQ(library->Lookup("f", Library::SymbolKind::Variable), nullptr);
+        CHECK_EQ(library->Lookup("h", Library::SymbolKind::Function), nullptr);
+      }
+      THEN("the prototype of a function is kept") {
+        auto sym{library->Lookup("f", Library::SymbolKind::Function)};
+        REQUIRE_NE(sym, nullptr);
+        auto type{library->GetType(sym->type)};
+        REQUIRE_NE(type, nullptr);
+        CHECK_EQ(type->kind, uint32_t(Library::TypeKind::Function));
+        CHECK_EQ(type->c, 2U);
+        auto param{library->GetIndex(type->b + 1)};
+        REQUIRE_NE(param, nullptr);
+        auto size{library->GetType(*param)};
+        REQUIRE_NE(size, nullptr);
+        CHECK_EQ(size->kind, uint32_t(Library::TypeKind::Typedef));
+        CHECK_EQ(library->GetString(size->a), "size_t2");
+      }
+      THEN("records keep their fields") {
+        auto sym{library->Lookup("f", Library::SymbolKind::Function)};
+        auto type{library->GetType(sym->type)};
+        auto pointer{library->GetType(*library->GetIndex(type->b))};
+        REQUIRE_NE(pointer, nullptr);
+        CHECK_EQ(pointer->kind, uint32_t(Library::TypeKind::Pointer));
+        auto record_type{library->GetType(pointer->a)};
+        REQUIRE_NE(record_type, nullptr);
+        CHECK_EQ(record_type->kind, uint32_t(Library::TypeKind::Record));
+        auto record{library->GetRecord(record_type->a)};
+        REQUIRE_NE(record, nullptr);
+        CHECK_EQ(library->GetString(record->name), "s");
+        CHECK(record->flags & Library::kComplete);
+        CHECK_EQ(record->num_fields, 2U);
+        auto next{library->GetField(record->first_field + 1)};
+        REQUIRE_NE(next, nullptr);
+        CHECK_EQ(library->GetString(next->name), "next");
+      }
+      THEN("damaged contents are rejected") {
+        CHECK_THROWS_AS(LoadString(contents.substr(0, contents.size() - 1)),
+                        rellic::Exception);
+        auto bad_magic{contents};
+        bad_magic[0] = 'X';
+        CHECK_THROWS_AS(LoadString(bad_magic), rellic::Exception);
+      }
+    }
+  }
+}
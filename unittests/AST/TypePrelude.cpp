@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/TypePrelude.h"
+
+#include <doctest/doctest.h>
+#include <llvm/BinaryFormat/Dwarf.h>
+#include <llvm/IR/DIBuilder.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+
+// Creates `struct node { int <field>; struct node *next; }`
+static llvm::DICompositeType *CreateList(llvm::Module &module,
+                                         llvm::StringRef field) {
+  llvm::DIBuilder dib(module);
+  auto file{dib.createFile("test.c", "/")};
+  auto int_type{dib.createBasicType("int", 32, llvm::dwarf::DW_ATE_signed)};
+  auto node{dib.createStructType(file, "node", file, 1, 128, 64,
+                                 llvm::DINode::FlagZero, nullptr,
+                                 llvm::DINodeArray())};
+  auto ptr{dib.createPointerType(node, 64)};
+  auto value{dib.createMemberType(file, field, file, 1, 32, 32, 0,
+                                  llvm::DINode::FlagZero, int_type)};
+  auto next{dib.createMemberType(file, "next", file, 2, 64, 64, 64,
+                                 llvm::DINode::FlagZero, ptr)};
+  dib.replaceArrays(node, dib.getOrCreateArray({value, next}));
+  dib.finalize();
+  return node;
+}
+
+TEST_SUITE("GetDITypeHash") {
+  SCENARIO("Hash recursive types from different modules") {
+    GIVEN("The same list type in two contexts, and one with another field") {
+      llvm::LLVMContext ctx_a, ctx_b;
+      llvm::Module module_a("a", ctx_a), module_b("b", ctx_b);
+      auto list_a{CreateList(module_a, "value")};
+      auto list_b{CreateList(module_b, "value")};
+      auto other{CreateList(module_b, "data")};
+      THEN("identical types have the same hash") {
+        CHECK_EQ(rellic::GetDITypeHash(list_a), rellic::GetDITypeHash(list_b));
+      }
+      THEN("types with different fields have different hashes") {
+        CHECK_NE(rellic::GetDITypeHash(list_b), rellic::GetDITypeHash(other));
+      }
+    }
+  }
+}
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/Z3Portfolio.h"
+
+#include <doctest/doctest.h>
+
+#include "rellic/AST/Progress.h"
+
+TEST_SUITE("RaceTactics") {
+  SCENARIO("The first answer is translated back") {
+    GIVEN("A formula over bitvectors") {
+      z3::context ctx;
+      auto x{ctx.bv_const("x", 32)};
+      auto y{ctx.bv_const("y", 32)};
+      auto valid{z3::implies(x == y && y == 4, x + 1 == 5)};
+      THEN("the prove portfolio decides its negation unsatisfiable") {
+        auto goal{rellic::RaceTactics(!valid, rellic::GetProvePortfolio(), 0,
+                                      nullptr)};
+        REQUIRE(goal);
+        CHECK(goal->is_decided_unsat());
+        CHECK_EQ(&goal->ctx(), &ctx);
+      }
+      THEN("the prove portfolio decides a satisfiable formula") {
+        auto goal{rellic::RaceTactics(x == y, rellic::GetProvePortfolio(), 0,
+                                      nullptr)};
+        REQUIRE(goal);
+        CHECK(goal->is_decided_sat());
+      }
+      THEN("the simplify portfolio returns an equivalent formula") {
+        auto goal{rellic::RaceTactics(valid && x == y,
+                                      rellic::GetSimplifyPortfolio(), 0,
+                                      nullptr)};
+        REQUIRE(goal);
+        z3::solver solver(ctx);
+        solver.add(goal->as_expr() != (x == y));
+        CHECK_EQ(solver.check(), z3::unsat);
+      }
+    }
+  }
+
+  SCENARIO("Cancelled races give up") {
+    GIVEN("A cancelled progress") {
+      z3::context ctx;
+      auto x{ctx.bv_const("x", 32)};
+      rellic::Progress progress;
+      progress.Cancel();
+      THEN("no tactic is run") {
+        CHECK_FALSE(rellic::RaceTactics(x == 1, rellic::GetProvePortfolio(), 0,
+                                        &progress));
+      }
+    }
+  }
+}
@@ -0,0 +1,66 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/AST/Z3QueryLog.h"
+
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/MemoryBuffer.h>
+
+#include "Util.h"
+#include "rellic/AST/DecompilationContext.h"
+#include "rellic/Exception.h"
+
+TEST_SUITE("Z3QueryLog") {
+  SCENARIO("Recorded queries are parsed back") {
+    GIVEN("A log of two queries") {
+      auto unit{GetASTUnit()};
+      rellic::DecompilationContext dec_ctx(*unit);
+      llvm::SmallString<128> path;
+      REQUIRE(!llvm::sys::fs::createTemporaryFile("queries", "smt2", path));
+      auto a{dec_ctx.z3_ctx.bool_const("a")};
+      auto b{dec_ctx.z3_ctx.bool_const("b")};
+      {
+        rellic::Z3QueryLog log(path.str().str());
+        dec_ctx.current_pass = "cbr";
+        dec_ctx.z3_timeout = 100;
+        log.Record(dec_ctx, a || !a, "prove", "solver", "unsat",
+                   rellic::Duration{0.5});
+        dec_ctx.current_pass = nullptr;
+        log.Record(dec_ctx, a && (b || a), "simplify", "heavy_simplify",
+                   "simplified", rellic::Duration{0.25});
+      }
+      auto buffer{llvm::MemoryBuffer::getFile(path)};
+      REQUIRE(buffer);
+      llvm::sys::fs::remove(path);
+
+      THEN("their formulas and what was asked of them are kept") {
+        std::vector<rellic::Z3QueryLog::Query> queries;
+        z3::expr_vector formulas{dec_ctx.z3_ctx};
+        rellic::Z3QueryLog::Parse((*buffer)->getBuffer(), queries, formulas);
+        REQUIRE_EQ(queries.size(), 2);
+        REQUIRE_EQ(formulas.size(), 2);
+        CHECK(z3::eq(formulas[0], a || !a));
+        CHECK(z3::eq(formulas[1], a && (b || a)));
+        CHECK_EQ(queries[0].kind, "prove");
+        CHECK_EQ(queries[0].pass, "cbr");
+        CHECK_EQ(queries[0].timeout, 100);
+        CHECK_EQ(queries[0].result, "unsat");
+        CHECK_EQ(queries[0].time.count(), 0.5);
+        CHECK_EQ(queries[1].tactic, "heavy_simplify");
+        CHECK_EQ(queries[1].pass, "");
+      }
+      THEN("malformed logs are rejected") {
+        std::vector<rellic::Z3QueryLog::Query> queries;
+        z3::expr_vector formulas{dec_ctx.z3_ctx};
+        CHECK_THROWS_AS(
+            rellic::Z3QueryLog::Parse("(assert x)", queries, formulas),
+            rellic::Exception);
+      }
+    }
+  }
+}
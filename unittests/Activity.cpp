@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/Activity.h"
+
+#include <doctest/doctest.h>
+
+#include <string>
+#include <thread>
+
+// Returns the frames of the thread whose outermost frame is named `name`, or
+// null
+static const llvm::json::Array *FindFrames(const llvm::json::Array &threads,
+                                           llvm::StringRef name) {
+  for (auto &thread : threads) {
+    auto frames{thread.getAsObject()->getArray("frames")};
+    if (frames && !frames->empty() &&
+        (*frames)[0].getAsObject()->getString("name") == name) {
+      return frames;
+    }
+  }
+  return nullptr;
+}
+
+TEST_SUITE("Activity") {
+  SCENARIO("Threads report what they are doing") {
+    GIVEN("A thread inside a pass and a function") {
+      rellic::ActivityScope input("input", "activity-test");
+      rellic::ActivityScope pass("pass", "cbr");
+      rellic::SetActivityDetail("iteration 2");
+      rellic::PushActivity("function", "f");
+
+      THEN("its frames are listed outermost first") {
+        auto threads{rellic::GetActivityJSON()};
+        auto frames{FindFrames(threads, "activity-test")};
+        REQUIRE(frames);
+        REQUIRE_EQ(frames->size(), 3);
+        auto pass_frame{(*frames)[1].getAsObject()};
+        CHECK(*pass_frame->getString("kind") == "pass");
+        CHECK(*pass_frame->getString("name") == "cbr");
+        CHECK(*pass_frame->getString("detail") == "iteration 2");
+        CHECK(*(*frames)[2].getAsObject()->getString("name") == "f");
+      }
+      THEN("popped frames are gone") {
+        rellic::PopActivity();
+        auto threads{rellic::GetActivityJSON()};
+        auto frames{FindFrames(threads, "activity-test")};
+        REQUIRE(frames);
+        CHECK_EQ(frames->size(), 2);
+        rellic::PushActivity("function", "f");
+      }
+      THEN("the frames of other threads are listed too") {
+        std::thread([]() {
+          rellic::ActivityScope scope("input", "other-thread");
+          auto threads{rellic::GetActivityJSON()};
+          CHECK(FindFrames(threads, "other-thread"));
+        }).join();
+        auto threads{rellic::GetActivityJSON()};
+        CHECK_FALSE(FindFrames(threads, "other-thread"));
+        std::string text;
+        llvm::raw_string_ostream os(text);
+        rellic::DumpActivity(os);
+        CHECK_NE(os.str().find("pass cbr (iteration 2)"), std::string::npos);
+      }
+      rellic::PopActivity();
+    }
+  }
+}
@@ -0,0 +1,878 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/Decompiler.h"
+
+#include <clang/AST/Decl.h>
+#include <doctest/doctest.h>
+#include <llvm/ADT/SmallString.h>
+#include <llvm/IR/InstIterator.h>
+#include <llvm/IR/Instructions.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <llvm/Support/FileSystem.h>
+#include <llvm/Support/JSON.h>
+#include <llvm/Support/MemoryBuffer.h>
+#include <llvm/Support/raw_ostream.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "rellic/BC/Util.h"
+#include "rellic/Printer.h"
+
+namespace {
+const char *kModule = R"(
+define i32 @f(i32 %a) {
+entry:
+  %cmp = icmp sgt i32 %a, 0
+  br i1 %cmp, label %then, label %end
+then:
+  br label %end
+end:
+  %r = phi i32 [ 1, %then ], [ 0, %entry ]
+  ret i32 %r
+}
+
+define i32 @g(i32 %a) {
+  %r = call i32 @f(i32 %a)
+  ret i32 %r
+}
+)";
+
+std::unique_ptr<llvm::Module> LoadModule(llvm::LLVMContext &ctx,
+                                         const char *text = kModule) {
+  return std::unique_ptr<llvm::Module>(rellic::LoadModuleFromBuffer(
+      &ctx, llvm::MemoryBufferRef(text, "module")));
+}
+
+// Decompiles the module of `text` with `options` and returns it printed. The
+// statistics of the decompilation are moved into `stats` if it is not null.
+std::string DecompileText(const char *text,
+                          const rellic::DecompilationOptions &options,
+                          rellic::DecompilationStatistics *stats = nullptr) {
+  llvm::LLVMContext ctx;
+  auto module{LoadModule(ctx, text)};
+  REQUIRE(module);
+  auto result{rellic::Decompile(std::move(module), options)};
+  REQUIRE(result.Succeeded());
+  auto &value{result.Value()};
+  std::string code;
+  llvm::raw_string_ostream os(code);
+  rellic::PrintTranslationUnit(value.ast->getASTContext(), os);
+  if (stats) {
+    *stats = std::move(value.stats);
+  }
+  return os.str();
+}
+}  // namespace
+
+TEST_SUITE("DecompileAsync") {
+  SCENARIO("Functions are streamed as they are decompiled") {
+    GIVEN("A module with two functions") {
+      llvm::LLVMContext ctx;
+      auto module{LoadModule(ctx)};
+      REQUIRE(module);
+      std::vector<std::string> names;
+      auto handle{rellic::DecompileAsync(
+          std::move(module), {},
+          [&names](const clang::FunctionDecl *fdecl,
+                   const rellic::ProvenanceLookup &provenance) {
+            CHECK(fdecl->hasBody());
+            names.push_back(fdecl->getName().str());
+          })};
+      THEN("each definition is passed on once, in module order") {
+        auto result{handle.Get()};
+        REQUIRE(result.Succeeded());
+        CHECK_EQ(names, std::vector<std::string>{"f", "g"});
+      }
+    }
+  }
+
+  SCENARIO("Cancelling a decompilation") {
+    GIVEN("A decompilation that has been started") {
+      llvm::LLVMContext ctx;
+      auto module{LoadModule(ctx)};
+      REQUIRE(module);
+      auto handle{rellic::DecompileAsync(std::move(module))};
+      THEN("it still returns what it has done") {
+        handle.Cancel();
+        CHECK(handle.WaitFor(std::chrono::minutes(1)));
+        CHECK(handle.IsReady());
+        CHECK(handle.Get().Succeeded());
+      }
+    }
+  }
+}
+
+TEST_SUITE("ConditionEngine") {
+  SCENARIO("Decompiling without the solver") {
+    GIVEN("A module and the syntactic condition engine") {
+      llvm::LLVMContext ctx;
+      auto module{LoadModule(ctx)};
+      REQUIRE(module);
+      rellic::DecompilationOptions options;
+      options.condition_engine =
+          rellic::DecompilationOptions::ConditionEngine::Syntactic;
+      THEN("every function is decompiled without a Z3 query") {
+        auto result{rellic::Decompile(std::move(module), options)};
+        REQUIRE(result.Succeeded());
+        auto &stats{result.Value().stats};
+        CHECK_EQ(stats.functions.size(), 2U);
+        CHECK_EQ(stats.full_simplifications, 0U);
+        for (auto &[name, pass] : stats.passes) {
+          CHECK_MESSAGE(pass.z3.queries == 0, name);
+        }
+        for (auto &[name, func] : stats.functions) {
+          CHECK_MESSAGE(func.z3.queries == 0, name);
+        }
+      }
+    }
+  }
+}
+
+TEST_SUITE("Report") {
+  SCENARIO("Summarizing where the time of a decompilation went") {
+    GIVEN("A decompiled module") {
+      llvm::LLVMContext ctx;
+      auto module{LoadModule(ctx)};
+      REQUIRE(module);
+      auto result{rellic::Decompile(std::move(module), {})};
+      REQUIRE(result.Succeeded());
+      auto &stats{result.Value().stats};
+
+      THEN("fixpoint groups are named after the pipeline") {
+        auto group{stats.fixpoint_groups.find("fix(lr,ncp,nsc)")};
+        REQUIRE(group != stats.fixpoint_groups.end());
+        CHECK_GE(group->second.runs, 1U);
+        CHECK_GE(group->second.rounds, group->second.max_rounds);
+      }
+      THEN("refinement time is attributed to functions and passes") {
+        auto &f{stats.functions.at("f")};
+        CHECK_FALSE(f.pass_time.empty());
+        CHECK_GE(f.pass_visits.at("NestedScopeCombine"), 1U);
+        for (auto &[name, func] : stats.functions) {
+          CHECK_LE(func.z3.max_nodes, func.z3.nodes_in);
+        }
+      }
+      THEN("the report lists the most expensive functions first") {
+        std::string report;
+        llvm::raw_string_ostream os(report);
+        rellic::PrintReport(stats, os, 1);
+        os.flush();
+        CHECK_NE(report.find("Most expensive functions:"), std::string::npos);
+        CHECK_NE(report.find("fix(lr,ncp,nsc): "), std::string::npos);
+        CHECK_NE(report.find("types: "), std::string::npos);
+        // Only one function is listed
+        auto f{report.find("  f: ")};
+        auto g{report.find("  g: ")};
+        CHECK_NE(f == std::string::npos, g == std::string::npos);
+      }
+    }
+  }
+}
+
+TEST_SUITE("GotoFallback") {
+  SCENARIO("Emitting large functions with gotos") {
+    GIVEN("A module with a function of three blocks and one of one block") {
+      llvm::LLVMContext ctx;
+      auto module{LoadModule(ctx)};
+      REQUIRE(module);
+      rellic::DecompilationOptions options;
+      options.goto_fallback_blocks = 2;
+      THEN("only the larger function is emitted with gotos") {
+        auto result{rellic::Decompile(std::move(module), options)};
+        REQUIRE(result.Succeeded());
+        auto &value{result.Value()};
+        CHECK_EQ(value.stats.goto_fallbacks, 1U);
+        CHECK_EQ(value.degraded_functions, std::vector<std::string>{"f"});
+        std::string code;
+        llvm::raw_string_ostream os(code);
+        rellic::PrintTranslationUnit(value.ast->getASTContext(), os);
+        CHECK_NE(os.str().find("goto "), std::string::npos);
+      }
+    }
+  }
+}
+
+TEST_SUITE("RemoveDeadGlobals") {
+  SCENARIO("Removing unreferenced internal functions and variables") {
+    GIVEN("A module with a used and an unused internal helper") {
+      const char *text = R"(
+@table = internal global [2 x i32] [i32 1, i32 2]
+@unused_table = internal global [2 x i32] [i32 3, i32 4]
+
+define internal i32 @used(i32 %a) {
+  %p = getelementptr [2 x i32], ptr @table, i32 0, i32 %a
+  %r = load i32, ptr %p
+  ret i32 %r
+}
+
+define internal i32 @unused(i32 %a) {
+  %r = call i32 @unused(i32 %a)
+  %p = getelementptr [2 x i32], ptr @unused_table, i32 0, i32 %a
+  store i32 %r, ptr %p
+  ret i32 %r
+}
+
+define i32 @main(i32 %a) {
+  %r = call i32 @used(i32 %a)
+  ret i32 %r
+}
+)";
+      llvm::LLVMContext ctx;
+      auto module{LoadModule(ctx, text)};
+      REQUIRE(module);
+      THEN("only what the exported function reaches is kept") {
+        auto dead{rellic::RemoveDeadGlobals(*module)};
+        CHECK_EQ(dead.functions, 1U);
+        CHECK_EQ(dead.variables, 1U);
+        CHECK(module->getFunction("used"));
+        CHECK_FALSE(module->getFunction("unused"));
+        CHECK(module->getGlobalVariable("table", true));
+        CHECK_FALSE(module->getGlobalVariable("unused_table", true));
+      }
+      THEN("the removals are counted in the statistics") {
+        rellic::DecompilationOptions options;
+        options.remove_dead_globals = true;
+        auto result{rellic::Decompile(std::move(module), options)};
+        REQUIRE(result.Succeeded());
+        CHECK_EQ(result.Value().stats.dead_functions, 1U);
+        CHECK_EQ(result.Value().stats.dead_variables, 1U);
+      }
+    }
+  }
+}
+
+TEST_SUITE("ConvertArrayArguments") {
+  SCENARIO("Wrapping array arguments and returns in structs") {
+    GIVEN("A function that takes and returns an array, and a caller") {
+      const char *text = R"(
+define internal [2 x i32] @swap([2 x i32] %a) {
+  %x = extractvalue [2 x i32] %a, 0
+  %y = extractvalue [2 x i32] %a, 1
+  %b = insertvalue [2 x i32] undef, i32 %y, 0
+  %c = insertvalue [2 x i32] %b, i32 %x, 1
+  ret [2 x i32] %c
+}
+
+define i32 @main([2 x i32] %a) {
+  %r = call [2 x i32] @swap([2 x i32] %a)
+  %x = extractvalue [2 x i32] %r, 0
+  ret i32 %x
+}
+)";
+      llvm::LLVMContext ctx;
+      auto module{LoadModule(ctx, text)};
+      REQUIRE(module);
+      rellic::ConvertArrayArguments(*module);
+      THEN("the functions keep their names and bodies") {
+        auto swap{module->getFunction("swap")};
+        REQUIRE(swap);
+        CHECK_FALSE(swap->isDeclaration());
+        CHECK(swap->getReturnType()->isStructTy());
+        CHECK(swap->getArg(0)->getType()->isStructTy());
+        auto caller{module->getFunction("main")};
+        REQUIRE(caller);
+        CHECK(caller->getArg(0)->getType()->isStructTy());
+        CHECK_EQ(module->size(), 2U);
+      }
+    }
+  }
+}
+
+TEST_SUITE("LoadPreprocessedModule") {
+  SCENARIO("Reusing preprocessed modules") {
+    GIVEN("An empty preprocessing cache") {
+      llvm::SmallString<128> dir;
+      REQUIRE_FALSE(llvm::sys::fs::createUniqueDirectory("rellic-test", dir));
+      rellic::DecompilationOptions options;
+      options.remove_phi_nodes = true;
+      options.preprocess_cache_dir = dir.str().str();
+      llvm::MemoryBufferRef buffer(kModule, "module");
+      THEN("the module is preprocessed once and then read back") {
+        llvm::LLVMContext ctx;
+        auto first{rellic::LoadPreprocessedModule(ctx, buffer, options)};
+        REQUIRE(first);
+        std::error_code ec;
+        size_t entries{0};
+        for (llvm::sys::fs::directory_iterator it(dir, ec), end;
+             it != end && !ec; it.increment(ec)) {
+          ++entries;
+        }
+        CHECK_EQ(entries, 1U);
+
+        llvm::LLVMContext other_ctx;
+        auto second{rellic::LoadPreprocessedModule(other_ctx, buffer, options)};
+        REQUIRE(second);
+        for (auto &inst : llvm::instructions(*second->getFunction("f"))) {
+          CHECK_FALSE(llvm::isa<llvm::PHINode>(inst));
+        }
+        auto result{rellic::Decompile(std::move(second), options)};
+        CHECK(result.Succeeded());
+      }
+      llvm::sys::fs::remove_directories(dir);
+    }
+  }
+}
+
+TEST_SUITE("FunctionShard") {
+  SCENARIO("Decompiling functions in contexts of their own") {
+    GIVEN("A module whose functions refer to globals through initializers") {
+      const char *text = R"(
+@table = global [2 x ptr] [ptr @f, ptr @g]
+@unused = global i32 7
+
+define i32 @f(i32 %a) {
+  %r = add i32 %a, 1
+  ret i32 %r
+}
+
+define i32 @g(i32 %a) {
+  %p = getelementptr [2 x ptr], ptr @table, i32 0, i32 %a
+  %fn = load ptr, ptr %p
+  %r = call i32 %fn(i32 %a)
+  ret i32 %r
+}
+)";
+      auto Print{[text](bool scratch_contexts) {
+        rellic::DecompilationOptions options;
+        options.scratch_contexts = scratch_contexts;
+        return DecompileText(text, options);
+      }};
+      THEN("the output is the same as in a single context") {
+        CHECK_EQ(Print(true), Print(false));
+      }
+    }
+  }
+}
+
+TEST_SUITE("FunctionCache") {
+  SCENARIO("Cancelled decompilations are not cached") {
+    GIVEN("An empty cache and a cancelled progress") {
+      llvm::SmallString<128> dir;
+      REQUIRE_FALSE(llvm::sys::fs::createUniqueDirectory("rellic-test", dir));
+      rellic::Progress progress;
+      progress.Cancel();
+      rellic::DecompilationOptions options;
+      options.cache_dir = dir.str().str();
+      options.num_workers = 2;
+      options.progress = &progress;
+      THEN("the functions are degraded and nothing is stored") {
+        llvm::LLVMContext ctx;
+        auto module{LoadModule(ctx)};
+        REQUIRE(module);
+        auto result{rellic::Decompile(std::move(module), options)};
+        REQUIRE(result.Succeeded());
+        auto degraded{result.Value().degraded_functions};
+        std::sort(degraded.begin(), degraded.end());
+        CHECK_EQ(degraded, std::vector<std::string>{"f", "g"});
+
+        std::error_code ec;
+        size_t entries{0};
+        for (llvm::sys::fs::recursive_directory_iterator it(dir, ec), end;
+             it != end && !ec; it.increment(ec)) {
+          entries += it->type() == llvm::sys::fs::file_type::regular_file;
+        }
+        CHECK_EQ(entries, 0U);
+      }
+      llvm::sys::fs::remove_directories(dir);
+    }
+  }
+}
+
+TEST_SUITE("DecompilerEngine") {
+  SCENARIO("Decompiling several modules with one engine") {
+    GIVEN("An engine") {
+      rellic::DecompilerEngine engine;
+      THEN("every module loaded into it can be decompiled") {
+        for (auto i{0}; i < 2; ++i) {
+          auto module{
+              engine.LoadModule(llvm::MemoryBufferRef(kModule, "module"))};
+          REQUIRE(module);
+          auto result{engine.Decompile(std::move(module))};
+          REQUIRE(result.Succeeded());
+          CHECK(result.Value().ast);
+        }
+        CHECK_EQ(engine.GetStatistics().functions.size(), 2U);
+      }
+    }
+  }
+}
+
+TEST_SUITE("LinkModules") {
+  SCENARIO("Linking modules with clashing internal functions") {
+    GIVEN("Two modules that each define a static helper") {
+      const char *first = R"(
+define internal i32 @helper(i32 %a) {
+  ret i32 %a
+}
+
+define i32 @a(i32 %a) {
+  %r = call i32 @helper(i32 %a)
+  ret i32 %r
+}
+)";
+      const char *second = R"(
+define internal i32 @helper(i32 %a) {
+  %r = add i32 %a, 1
+  ret i32 %r
+}
+
+define i32 @b(i32 %a) {
+  %r = call i32 @helper(i32 %a)
+  ret i32 %r
+}
+)";
+      llvm::LLVMContext ctx;
+      std::vector<std::unique_ptr<llvm::Module>> modules;
+      modules.emplace_back(rellic::LoadModuleFromBuffer(
+          &ctx, llvm::MemoryBufferRef(first, "first")));
+      modules.emplace_back(rellic::LoadModuleFromBuffer(
+          &ctx, llvm::MemoryBufferRef(second, "second")));
+      std::unordered_map<std::string, size_t> origins;
+      auto module{rellic::LinkModules(std::move(modules), origins)};
+      REQUIRE(module);
+
+      THEN("every definition is attributed to its module") {
+        REQUIRE_EQ(origins.size(), 4U);
+        CHECK_EQ(origins["a"], 0U);
+        CHECK_EQ(origins["b"], 1U);
+        CHECK_EQ(origins["helper"], 0U);
+        CHECK_EQ(module->getFunction("helper")->size(), 1U);
+      }
+
+      THEN("the shared declarations are printed without bodies") {
+        auto result{rellic::Decompile(std::move(module))};
+        REQUIRE(result.Succeeded());
+        auto &ast_ctx{result.Value().ast->getASTContext()};
+        auto tudecl{ast_ctx.getTranslationUnitDecl()};
+        std::vector<clang::Decl *> decls;
+        for (auto decl : tudecl->decls()) {
+          auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+          if (fdecl && fdecl->getName() == "a") {
+            decls.push_back(decl);
+          }
+        }
+        REQUIRE_EQ(decls.size(), 1U);
+        std::string text;
+        llvm::raw_string_ostream os(text);
+        rellic::PrintDeclarations(decls, os);
+        os.flush();
+        CHECK_EQ(text.find("return"), std::string::npos);
+        CHECK_EQ(text.back(), '\n');
+        CHECK_NE(text.find(");"), std::string::npos);
+      }
+    }
+  }
+}
+
+TEST_SUITE("MemorySnapshot") {
+  SCENARIO("Breaking memory down by stage") {
+    GIVEN("A module decompiled in a single context") {
+      llvm::LLVMContext ctx;
+      auto module{LoadModule(ctx)};
+      REQUIRE(module);
+      rellic::DecompilationOptions options;
+      options.num_workers = 1;
+      auto result{rellic::Decompile(std::move(module), options)};
+      REQUIRE(result.Succeeded());
+      auto &stats{result.Value().stats};
+      THEN("every stage is measured in order") {
+        REQUIRE_EQ(stats.memory.size(), 3U);
+        CHECK_EQ(stats.memory[0].first, "preprocessing");
+        CHECK_EQ(stats.memory[1].first, "structuring");
+        CHECK_EQ(stats.memory[2].first, "refinement");
+        auto &refined{stats.memory[2].second};
+        CHECK_GT(refined.ast, 0U);
+        CHECK_GT(refined.module, 0U);
+        CHECK_GT(refined.conditions, 0U);
+        CHECK_GE(refined.ast, stats.memory[0].second.ast);
+      }
+      THEN("the snapshots are part of the JSON") {
+        auto json{stats.ToJSON()};
+        auto memory{json.getArray("memory")};
+        REQUIRE(memory);
+        REQUIRE_EQ(memory->size(), 3U);
+        auto stage{(*memory)[1].getAsObject()->getString("stage")};
+        REQUIRE(stage);
+        CHECK_EQ(stage->str(), "structuring");
+      }
+      THEN("merging keeps the largest figures of a stage") {
+        rellic::DecompilationStatistics other;
+        rellic::MemorySnapshot snapshot;
+        snapshot.ast = stats.memory[0].second.ast + 1;
+        other.memory.emplace_back("preprocessing", snapshot);
+        other.memory.emplace_back("output", snapshot);
+        auto module_memory{stats.memory[0].second.module};
+        stats.Merge(other);
+        REQUIRE_EQ(stats.memory.size(), 4U);
+        CHECK_EQ(stats.memory[0].second.ast, snapshot.ast);
+        CHECK_EQ(stats.memory[0].second.module, module_memory);
+        CHECK_EQ(stats.memory[3].first, "output");
+      }
+    }
+  }
+}
+
+TEST_SUITE("HardwareCounters") {
+  SCENARIO("Reporting hardware events") {
+    GIVEN("Statistics of a pass that was counted") {
+      rellic::DecompilationStatistics stats;
+      auto &pass{stats.passes["pass"]};
+      pass.counters.cycles = 100;
+      pass.counters.instructions = 200;
+      pass.counters.cache_misses = 3;
+      stats.passes["other"];
+      THEN("only counted passes have counters in the JSON") {
+        auto json{stats.ToJSON()};
+        auto passes{json.getObject("passes")};
+        REQUIRE(passes);
+        auto counters{passes->getObject("pass")->getObject("counters")};
+        REQUIRE(counters);
+        CHECK_EQ(counters->getInteger("instructions"), 200);
+        CHECK_FALSE(passes->getObject("other")->getObject("counters"));
+      }
+      THEN("merging adds them up") {
+        auto other{stats};
+        stats.Merge(other);
+        CHECK_EQ(stats.passes["pass"].counters.cycles, 200U);
+        CHECK_EQ(stats.passes["pass"].counters.cache_misses, 6U);
+      }
+    }
+    GIVEN("A module decompiled with counters if the system has them") {
+      auto enabled{rellic::EnableHardwareCounters()};
+      llvm::LLVMContext ctx;
+      auto module{LoadModule(ctx)};
+      REQUIRE(module);
+      rellic::DecompilationOptions options;
+      options.num_workers = 1;
+      auto result{rellic::Decompile(std::move(module), options)};
+      REQUIRE(result.Succeeded());
+      auto &stats{result.Value().stats};
+      THEN("the passes and functions that ran were counted") {
+        uint64_t pass_instructions{0}, function_instructions{0};
+        for (auto &[name, pass] : stats.passes) {
+          pass_instructions += pass.counters.instructions;
+        }
+        for (auto &[name, function] : stats.functions) {
+          function_instructions += function.counters.instructions;
+        }
+        CHECK_EQ(pass_instructions > 0, enabled);
+        CHECK_EQ(function_instructions > 0, enabled);
+      }
+    }
+  }
+}
+
+TEST_SUITE("DeclIndexExporter") {
+  SCENARIO("Indexing where declarations are in the output") {
+    GIVEN("A decompiled module printed with an index") {
+      llvm::LLVMContext ctx;
+      auto module{LoadModule(ctx)};
+      REQUIRE(module);
+      auto result{rellic::Decompile(std::move(module))};
+      REQUIRE(result.Succeeded());
+      auto &value{result.Value()};
+      rellic::ResultProvenance provenance{value};
+      std::string code;
+      std::string index_lines;
+      llvm::raw_string_ostream os(code);
+      llvm::raw_string_ostream index_os(index_lines);
+      rellic::DeclIndexExporter index(index_os);
+      rellic::PrintOptions options;
+      options.on_printed = [&](clang::Decl *decl, uint64_t begin, uint64_t end,
+                               llvm::ArrayRef<rellic::PrintedRange> ranges) {
+        index.Write(decl, begin, end, &provenance);
+      };
+      rellic::PrintTranslationUnit(value.ast->getASTContext(), os, options);
+      os.flush();
+      index_os.flush();
+
+      THEN("the range of each definition holds its text") {
+        llvm::SmallVector<llvm::StringRef, 8> lines;
+        llvm::StringRef(index_lines).split(lines, '\n', -1, false);
+        std::unordered_map<std::string, std::string> definitions;
+        for (auto line : lines) {
+          auto entry{llvm::json::parse(line)};
+          REQUIRE(static_cast<bool>(entry));
+          auto obj{entry->getAsObject()};
+          if (!*obj->getBoolean("definition")) {
+            continue;
+          }
+          CHECK_EQ(*obj->getString("kind"), "function");
+          auto begin{static_cast<size_t>(*obj->getInteger("begin"))};
+          auto end{static_cast<size_t>(*obj->getInteger("end"))};
+          REQUIRE_LE(begin, end);
+          REQUIRE_LE(end, code.size());
+          auto name{obj->getString("name")->str()};
+          CHECK_EQ(*obj->getString("ir"), "@" + name);
+          definitions[name] = code.substr(begin, end - begin);
+        }
+        REQUIRE_EQ(definitions.size(), 2U);
+        CHECK_NE(definitions["f"].find("f("), std::string::npos);
+        CHECK_NE(definitions["g"].find("f("), std::string::npos);
+        CHECK_EQ(definitions["f"].back(), '\n');
+      }
+    }
+  }
+}
+
+TEST_SUITE("DebugNamesAtCreation") {
+  SCENARIO("Naming declarations from debug info as they are created") {
+    GIVEN("A module with debug info for two locals and a struct") {
+      const char *text = R"(
+%struct.pair = type { i32, i32 }
+
+define i32 @f(i32 %n) !dbg !6 {
+  %x = alloca i32
+  %y = alloca i32
+  %p = alloca %struct.pair
+  call void @llvm.dbg.declare(metadata ptr %x, metadata !12,
+                              metadata !DIExpression()), !dbg !16
+  call void @llvm.dbg.declare(metadata ptr %y, metadata !13,
+                              metadata !DIExpression()), !dbg !16
+  call void @llvm.dbg.declare(metadata ptr %p, metadata !14,
+                              metadata !DIExpression()), !dbg !16
+  store i32 %n, ptr %x
+  store i32 %n, ptr %y
+  %second = getelementptr %struct.pair, ptr %p, i32 0, i32 1
+  store i32 %n, ptr %second
+  %a = load i32, ptr %x
+  %b = load i32, ptr %y
+  %c = load i32, ptr %second
+  %d = add i32 %a, %b
+  %e = add i32 %d, %c
+  ret i32 %e
+}
+
+declare void @llvm.dbg.declare(metadata, metadata, metadata)
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!3, !4}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1,
+                             emissionKind: FullDebug)
+!1 = !DIFile(filename: "test.c", directory: "/")
+!3 = !{i32 7, !"Dwarf Version", i32 4}
+!4 = !{i32 2, !"Debug Info Version", i32 3}
+!5 = !DIBasicType(name: "int", size: 32, encoding: DW_ATE_signed)
+!6 = distinct !DISubprogram(name: "f", scope: !1, file: !1, type: !7,
+                            spFlags: DISPFlagDefinition, unit: !0)
+!7 = !DISubroutineType(types: !8)
+!8 = !{!5, !5}
+!9 = distinct !DICompositeType(tag: DW_TAG_structure_type, name: "pair",
+                               size: 64, elements: !10)
+!10 = !{!17, !18}
+!12 = !DILocalVariable(name: "x", scope: !6, type: !5)
+!13 = !DILocalVariable(name: "x", scope: !15, type: !5)
+!14 = !DILocalVariable(name: "p", scope: !6, type: !9)
+!15 = distinct !DILexicalBlock(scope: !6, file: !1)
+!16 = !DILocation(line: 2, scope: !6)
+!17 = !DIDerivedType(tag: DW_TAG_member, name: "first", scope: !9,
+                     baseType: !5, size: 32)
+!18 = !DIDerivedType(tag: DW_TAG_member, name: "second", scope: !9,
+                     baseType: !5, size: 32, offset: 32)
+)";
+      auto Decompile{[text](bool at_creation) {
+        rellic::DecompilationOptions options;
+        options.debug_names_at_creation = at_creation;
+        rellic::DecompilationStatistics stats;
+        auto code{DecompileText(text, options, &stats)};
+        return std::make_pair(code, stats.passes);
+      }};
+
+      THEN("locals and fields get the names the renaming passes give") {
+        auto [renamed, renamed_passes]{Decompile(false)};
+        auto [created, created_passes]{Decompile(true)};
+        CHECK_EQ(created, renamed);
+        CHECK_NE(created.find("int x;"), std::string::npos);
+        CHECK_NE(created.find("int x_var1;"), std::string::npos);
+        CHECK_NE(created.find("second"), std::string::npos);
+        CHECK(renamed_passes.count("LocalDeclRenamer"));
+        CHECK_FALSE(created_passes.count("LocalDeclRenamer"));
+        CHECK_FALSE(created_passes.count("StructFieldRenamer"));
+      }
+    }
+  }
+}
+
+TEST_SUITE("ReuseRegionConds") {
+  SCENARIO("Regions of the same shape share their reaching conditions") {
+    GIVEN("Two functions with the same control flow") {
+      const char *text = R"(
+define i32 @f(i32 %a) {
+entry:
+  %cmp = icmp sgt i32 %a, 0
+  br i1 %cmp, label %then, label %else
+then:
+  br label %end
+else:
+  br label %end
+end:
+  %r = phi i32 [ 1, %then ], [ 2, %else ]
+  ret i32 %r
+}
+
+define i32 @g(i32 %b) {
+entry:
+  %cmp = icmp eq i32 %b, 7
+  br i1 %cmp, label %then, label %else
+then:
+  br label %end
+else:
+  br label %end
+end:
+  %r = phi i32 [ 3, %then ], [ 4, %else ]
+  ret i32 %r
+}
+)";
+      auto Decompile{[text](bool reuse) {
+        rellic::DecompilationOptions options;
+        options.num_workers = 1;
+        options.reaching_cond_mode =
+            rellic::DecompilationOptions::ReachingCondMode::Dominators;
+        options.reuse_region_conds = reuse;
+        rellic::DecompilationStatistics stats;
+        DecompileText(text, options, &stats);
+        return stats;
+      }};
+
+      THEN("the second one takes the conditions of the first") {
+        auto computed{Decompile(false)};
+        auto reused{Decompile(true)};
+        CHECK_EQ(computed.reused_regions, 0U);
+        CHECK_GE(reused.reused_regions, 1U);
+        CHECK_EQ(reused.reused_region_blocks, 3U);
+        CHECK_GT(computed.functions.at("g").reaching_cond_simplifications, 0U);
+        CHECK_EQ(reused.functions.at("g").reaching_cond_simplifications, 0U);
+        CHECK_EQ(reused.functions.at("f").reaching_cond_simplifications,
+                 computed.functions.at("f").reaching_cond_simplifications);
+      }
+    }
+  }
+}
+
+TEST_SUITE("LazyReachingConds") {
+  SCENARIO("Only the reaching conditions structuring uses are computed") {
+    GIVEN("A switch whose cases join after it") {
+      const char *text = R"(
+define i32 @f(i32 %a) {
+entry:
+  br label %sw
+sw:
+  switch i32 %a, label %def [
+    i32 1, label %one
+    i32 2, label %two
+  ]
+one:
+  br label %end
+two:
+  br label %end
+def:
+  br label %end
+end:
+  %r = phi i32 [ 3, %one ], [ 4, %two ], [ 5, %def ]
+  ret i32 %r
+}
+)";
+      auto Decompile{[text](bool dominators) {
+        rellic::DecompilationOptions options;
+        options.num_workers = 1;
+        if (dominators) {
+          options.reaching_cond_mode =
+              rellic::DecompilationOptions::ReachingCondMode::Dominators;
+        }
+        rellic::DecompilationStatistics stats;
+        auto code{DecompileText(text, options, &stats)};
+        return std::make_pair(code, stats);
+      }};
+
+      THEN("the cases are left without conditions") {
+        for (auto dominators : {false, true}) {
+          auto [code, stats]{Decompile(dominators)};
+          auto &func{stats.functions.at("f")};
+          CHECK_EQ(func.reaching_cond_skipped_blocks, 3U);
+          CHECK_EQ(func.reaching_cond_simplifications, 0U);
+          CHECK_NE(code.find("switch"), std::string::npos);
+        }
+      }
+    }
+  }
+}
+
+TEST_SUITE("DiffModules") {
+  SCENARIO("Matching the functions of two versions of a module") {
+    GIVEN("A module and a later version of it") {
+      const char *previous_text = R"(
+define i32 @same(i32 %a) {
+  %r = add i32 %a, 1
+  ret i32 %r
+}
+
+define i32 @old_name(i32 %a) {
+  %r = mul i32 %a, 3
+  ret i32 %r
+}
+
+define i32 @patched(i32 %a) {
+  %r = sub i32 %a, 1
+  ret i32 %r
+}
+
+define i32 @gone(i32 %a) {
+  ret i32 %a
+}
+)";
+      const char *text = R"(
+define i32 @same(i32 %a) {
+  %r = add i32 %a, 1
+  ret i32 %r
+}
+
+define i32 @new_name(i32 %a) {
+  %r = mul i32 %a, 3
+  ret i32 %r
+}
+
+define i32 @patched(i32 %a) {
+  %c = icmp sgt i32 %a, 0
+  %d = sub i32 %a, 1
+  %r = select i1 %c, i32 %d, i32 0
+  ret i32 %r
+}
+
+define i32 @fresh(i32 %a) {
+  %r = xor i32 %a, 7
+  ret i32 %r
+}
+)";
+      llvm::LLVMContext ctx;
+      std::unique_ptr<llvm::Module> previous{rellic::LoadModuleFromBuffer(
+          &ctx, llvm::MemoryBufferRef(previous_text, "previous"))};
+      auto module{LoadModule(ctx, text)};
+      REQUIRE(previous);
+      REQUIRE(module);
+
+      THEN("functions are matched by IR, then by name") {
+        auto diff{rellic::DiffModules(*previous, *module)};
+        CHECK_EQ(diff.unchanged, std::vector<std::string>{"same"});
+        REQUIRE_EQ(diff.renamed.size(), 1U);
+        CHECK_EQ(diff.renamed[0].first, "old_name");
+        CHECK_EQ(diff.renamed[0].second, "new_name");
+        CHECK_EQ(diff.changed, std::vector<std::string>{"patched"});
+        CHECK_EQ(diff.added, std::vector<std::string>{"fresh"});
+        CHECK_EQ(diff.removed, std::vector<std::string>{"gone"});
+      }
+    }
+  }
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+// Budgets on the work done by the decompiler, in units that do not depend on
+// the machine: Z3 queries, pass runs and AST nodes. Inputs are grown and the
+// budgets bound how fast the work may grow with them, so that algorithmic
+// regressions fail these tests while constant factors do not. They run as a
+// test of their own, see unittests/CMakeLists.txt.
+
+#include <clang/AST/Decl.h>
+#include <llvm/IR/LLVMContext.h>
+#include <llvm/IR/Module.h>
+#include <z3++.h>
+
+#include <algorithm>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "AST/Util.h"
+#include "Synthetic.h"
+#include "rellic/AST/ASTBuilder.h"
+#include "rellic/AST/DecompilationContext.h"
+#include "rellic/AST/Util.h"
+#include "rellic/Decompiler.h"
+
+namespace {
+// Cost proxies of decompiling a module
+struct Cost {
+  uint64_t z3_queries = 0;
+  uint64_t pass_runs = 0;
+  // Most iterations a fixpoint of any pass took, on average
+  uint64_t iterations_per_fixpoint = 0;
+  uint64_t ast_nodes = 0;
+};
+
+// Decompiles the synthetic function of `shape` and `size` on a single thread
+Cost Decompile(const std::string &shape, unsigned size) {
+  llvm::LLVMContext ctx;
+  auto module{GenerateSynthetic(ctx, shape, size)};
+  REQUIRE(module);
+  rellic::DecompilationOptions options;
+  options.num_workers = 1;
+  auto result{rellic::Decompile(std::move(module), options)};
+  REQUIRE(result.Succeeded());
+  auto &value{result.Value()};
+
+  Cost cost;
+  // Work is attributed to the pass that did it, or to GenerateAST
+  for (auto &[name, pass] : value.stats.passes) {
+    cost.z3_queries += pass.z3.queries;
+    cost.pass_runs += pass.runs;
+    if (pass.fixpoints) {
+      cost.iterations_per_fixpoint = std::max<uint64_t>(
+          cost.iterations_per_fixpoint, pass.runs / pass.fixpoints);
+    }
+  }
+  auto tudecl{value.ast->getASTContext().getTranslationUnitDecl()};
+  for (auto decl : tudecl->decls()) {
+    auto fdecl{clang::dyn_cast<clang::FunctionDecl>(decl)};
+    if (fdecl && fdecl->hasBody()) {
+      std::vector<clang::Stmt *> stmts;
+      rellic::EnumerateStmts(fdecl->getBody(), stmts);
+      cost.ast_nodes += stmts.size();
+    }
+  }
+  return cost;
+}
+
+unsigned CountNodes(z3::expr expr, std::unordered_set<unsigned> &seen) {
+  if (!seen.insert(expr.id()).second) {
+    return 0;
+  }
+  unsigned count{1};
+  if (expr.is_app()) {
+    for (auto i{0U}; i < expr.num_args(); ++i) {
+      count += CountNodes(expr.arg(i), seen);
+    }
+  }
+  return count;
+}
+
+unsigned CountNodes(z3::expr expr) {
+  std::unordered_set<unsigned> seen;
+  return CountNodes(expr, seen);
+}
+}  // namespace
+
+TEST_SUITE("Performance") {
+  SCENARIO("Decompiling grows at most quadratically with the input") {
+    GIVEN("Synthetic functions of several shapes at two sizes") {
+      const unsigned kSize{4};
+      THEN("doubling the size bounds the growth of the work") {
+        for (auto shape : {"if_ladder", "nested_ifs", "switch",
+                           "nested_loops"}) {
+          CAPTURE(shape);
+          auto small{Decompile(shape, kSize)};
+          auto large{Decompile(shape, 2 * kSize)};
+          // At most quadratic in the size
+          CHECK_LE(large.z3_queries, 4 * small.z3_queries + 16);
+          CHECK_GT(small.ast_nodes, 0U);
+          CHECK_LE(large.ast_nodes, 4 * small.ast_nodes + 16);
+          // At most linear in the size
+          CHECK_LE(large.pass_runs, 2 * small.pass_runs + 16);
+          CHECK_LE(large.iterations_per_fixpoint, 2 * (2 * kSize) + 4);
+        }
+      }
+    }
+  }
+
+  SCENARIO("Simplifying asks Z3 once per formula") {
+    GIVEN("A disjunction of cases that all imply the same atom") {
+      auto unit{GetASTUnit()};
+      rellic::DecompilationContext dec_ctx(*unit);
+      auto &z3_ctx{dec_ctx.z3_ctx};
+      auto b{z3_ctx.bool_const("b")};
+      auto formula{z3_ctx.bool_val(false)};
+      for (auto i{0}; i < 8; ++i) {
+        auto a{z3_ctx.bool_const(("a" + std::to_string(i)).c_str())};
+        formula = formula || (a && b) || (!a && b);
+      }
+      auto &cache{dec_ctx.z3_cache};
+      auto simplified{rellic::HeavySimplify(dec_ctx, formula)};
+      THEN("the result is no larger than the formula") {
+        CHECK_LE(CountNodes(simplified), CountNodes(formula));
+      }
+      THEN("the answer is reused for the same formula") {
+        auto misses{cache.simplify_misses};
+        auto proofs{cache.prove_misses};
+        CHECK_EQ(misses, 1U);
+        CHECK_LE(proofs, 1U);
+        rellic::HeavySimplify(dec_ctx, formula);
+        CHECK_EQ(cache.simplify_misses, misses);
+        CHECK_EQ(cache.prove_misses, proofs);
+        CHECK_EQ(cache.simplify_hits, 1U);
+      }
+    }
+  }
+
+  SCENARIO("Building expressions creates a bounded number of nodes") {
+    GIVEN("A chain of additions of a variable") {
+      auto unit{GetASTUnit("int x;")};
+      rellic::ASTBuilder ast(*unit);
+      auto tudecl{unit->getASTContext().getTranslationUnitDecl()};
+      auto var{GetDecl<clang::VarDecl>(tudecl, "x")};
+      const unsigned kOps{64};
+      clang::Expr *expr{ast.CreateDeclRef(var)};
+      for (auto i{0U}; i < kOps; ++i) {
+        expr = ast.CreateAdd(expr, ast.CreateDeclRef(var));
+      }
+      THEN("each operation adds its operands and their conversions only") {
+        std::vector<clang::Stmt *> stmts;
+        rellic::EnumerateStmts(expr, stmts);
+        // An operator, a reference and a conversion to an rvalue per step
+        CHECK_LE(stmts.size(), 3 * kOps + 2);
+      }
+    }
+  }
+}
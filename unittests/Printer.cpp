@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/Printer.h"
+
+#include <llvm/ADT/APSInt.h>
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "AST/Util.h"
+#include "rellic/AST/ASTBuilder.h"
+#include "rellic/Dec2Hex.h"
+
+namespace {
+// Prints `expr` with clang's statement printer
+std::string PrintPretty(clang::ASTContext &ast_ctx, clang::Expr *expr,
+                        clang::PrinterHelper *helper = nullptr) {
+  std::string str;
+  llvm::raw_string_ostream os(str);
+  auto policy{ast_ctx.getPrintingPolicy()};
+  expr->printPretty(os, helper, policy, 0, "\n", &ast_ctx);
+  return os.str();
+}
+
+std::string PrintList(const clang::InitListExpr *list,
+                      std::function<bool(const llvm::APInt &)> hex = {}) {
+  std::string str;
+  llvm::raw_string_ostream os(str);
+  rellic::PrintIntegerList(list, os, hex);
+  return os.str();
+}
+}  // namespace
+
+TEST_SUITE("PrintIntegerList") {
+  SCENARIO("Large lists of integer literals are printed in bulk") {
+    GIVEN("Lists of signed and unsigned literals of every magnitude") {
+      auto unit{GetASTUnit()};
+      auto &ast_ctx{unit->getASTContext()};
+      rellic::ASTBuilder ast(*unit);
+      std::vector<int64_t> values{0, 1, -1, 9, 10, 15, 16, 99, 100, 255,
+                                  -256, 12345, INT32_MAX, INT32_MIN};
+      for (auto i{0}; values.size() < rellic::kIntegerListThreshold; ++i) {
+        values.push_back(i * 7919 - 100000);
+      }
+      std::vector<clang::Expr *> ints;
+      std::vector<clang::Expr *> longs;
+      for (auto value : values) {
+        ints.push_back(ast.CreateIntLit(
+            llvm::APSInt(llvm::APInt(32, value, true), false)));
+        longs.push_back(ast.CreateIntLit(
+            llvm::APSInt(llvm::APInt(64, value, true), true)));
+      }
+      auto int_list{ast.CreateInitList(ints)};
+      auto long_list{ast.CreateInitList(longs)};
+
+      THEN("they are recognized") {
+        CHECK_EQ(rellic::GetIntegerList(int_list), int_list);
+        CHECK_EQ(rellic::GetIntegerList(long_list), long_list);
+      }
+      THEN("they are printed the same as by clang") {
+        CHECK_EQ(PrintList(int_list), PrintPretty(ast_ctx, int_list));
+        CHECK_EQ(PrintList(long_list), PrintPretty(ast_ctx, long_list));
+      }
+      THEN("they are printed in hexadecimal the same as by HexLiteralPrinter") {
+        auto large{[](const llvm::APInt &value) {
+          return value.getZExtValue() >= 10;
+        }};
+        rellic::HexLiteralPrinter helper{large};
+        CHECK_EQ(PrintList(int_list, large),
+                 PrintPretty(ast_ctx, int_list, &helper));
+        CHECK_EQ(PrintList(long_list, large),
+                 PrintPretty(ast_ctx, long_list, &helper));
+      }
+      THEN("short lists and lists of mixed types are not recognized") {
+        std::vector<clang::Expr *> few(ints.begin(), ints.begin() + 2);
+        CHECK_EQ(rellic::GetIntegerList(ast.CreateInitList(few)), nullptr);
+        auto mixed{ints};
+        mixed.back() = longs.back();
+        CHECK_EQ(rellic::GetIntegerList(ast.CreateInitList(mixed)), nullptr);
+      }
+    }
+  }
+}
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2022-present, Trail of Bits, Inc.
+ * All rights reserved.
+ *
+ * This source code is licensed in accordance with the terms specified in
+ * the LICENSE file found in the root directory of this source tree.
+ */
+
+#include "rellic/Provenance.h"
+
+#include <doctest/doctest.h>
+
+#include <unordered_map>
+#include <utility>
+
+TEST_SUITE("ProvenanceMap") {
+  SCENARIO("Lookups in both directions") {
+    GIVEN("A map with a null value and two keys sharing a value") {
+      int keys[4]{};
+      char values[2]{};
+      std::unordered_map<int *, char *> map{{&keys[0], &values[0]},
+                                            {&keys[1], &values[1]},
+                                            {&keys[2], &values[1]},
+                                            {&keys[3], nullptr}};
+      rellic::ProvenanceMap<int, char> provenance(map);
+      THEN("null values are not recorded") {
+        CHECK_EQ(provenance.Size(), 3);
+        CHECK_FALSE(provenance.Contains(&keys[3]));
+        CHECK_EQ(provenance.Lookup(&keys[3]), nullptr);
+      }
+      THEN("keys map to their values") {
+        CHECK_EQ(provenance.Lookup(&keys[0]), &values[0]);
+        CHECK_EQ(provenance.Lookup(&keys[1]), &values[1]);
+        CHECK_EQ(provenance.Lookup(&keys[2]), &values[1]);
+      }
+      THEN("values map back to one of their keys") {
+        CHECK_EQ(provenance.LookupInverse(&values[0]), &keys[0]);
+        auto key{provenance.LookupInverse(&values[1])};
+        CHECK((key == &keys[1] || key == &keys[2]));
+      }
+      THEN("unknown pointers are not found") {
+        char other{};
+        CHECK_EQ(provenance.LookupInverse(&other), nullptr);
+        CHECK_EQ(provenance.Lookup(nullptr), nullptr);
+      }
+      THEN("building from a temporary consumes it") {
+        rellic::ProvenanceMap<int, char> moved(std::move(map));
+        CHECK(map.empty());
+        CHECK_EQ(moved.Size(), 3);
+        CHECK_EQ(moved.LookupInverse(&values[0]), &keys[0]);
+      }
+    }
+  }
+}